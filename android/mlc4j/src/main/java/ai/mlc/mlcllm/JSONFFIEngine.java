@@ -12,6 +12,7 @@ public class JSONFFIEngine {
     private Function reloadFunc;
     private Function unloadFunc;
     private Function resetFunc;
+    private Function trimMemoryFunc;
     private Function chatCompletionFunc;
     private Function abortFunc;
     private Function getLastErrorFunc;
@@ -28,6 +29,7 @@ public class JSONFFIEngine {
         reloadFunc = jsonFFIEngine.getFunction("reload");
         unloadFunc = jsonFFIEngine.getFunction("unload");
         resetFunc = jsonFFIEngine.getFunction("reset");
+        trimMemoryFunc = jsonFFIEngine.getFunction("trim_memory");
         chatCompletionFunc = jsonFFIEngine.getFunction("chat_completion");
         abortFunc = jsonFFIEngine.getFunction("abort");
         getLastErrorFunc = jsonFFIEngine.getFunction("get_last_error");
@@ -84,4 +86,8 @@ public class JSONFFIEngine {
         resetFunc.invoke();
     }
 
+    public void trimMemory(boolean critical) {
+        trimMemoryFunc.pushArg(critical ? 1 : 0).invoke();
+    }
+
 }
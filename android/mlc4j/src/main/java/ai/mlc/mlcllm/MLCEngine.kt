@@ -68,6 +68,10 @@ class MLCEngine {
         jsonFFIEngine.reset()
     }
 
+    fun trimMemory(critical: Boolean) {
+        jsonFFIEngine.trimMemory(critical)
+    }
+
     fun unload() {
         jsonFFIEngine.unload()
     }
@@ -5,10 +5,12 @@
 
 #include "grammar.h"
 
+#include "../support/encoding.h"
 #include "grammar_functor.h"
 #include "grammar_parser.h"
 #include "grammar_serializer.h"
 #include "json_schema_converter.h"
+#include "regex_converter.h"
 
 namespace mlc {
 namespace llm {
@@ -16,6 +18,41 @@ namespace serve {
 
 TVM_REGISTER_OBJECT_TYPE(BNFGrammarNode);
 
+void BNFGrammarNode::BuildCharacterClassTables() const {
+  char_class_table_offsets_.assign(NumRuleExprs(), -1);
+  for (int32_t i = 0; i < static_cast<int32_t>(NumRuleExprs()); ++i) {
+    auto rule_expr = GetRuleExpr(i);
+    if (rule_expr.type != RuleExprType::kCharacterClass &&
+        rule_expr.type != RuleExprType::kCharacterClassStar) {
+      continue;
+    }
+    char_class_table_offsets_[i] = char_class_tables_.size();
+    char_class_tables_.resize(char_class_tables_.size() + 4, 0);
+    uint64_t* table = char_class_tables_.data() + char_class_table_offsets_[i];
+    bool is_negative = static_cast<bool>(rule_expr[0]);
+    for (int byte = 0; byte < 256; ++byte) {
+      auto [accepted, num_bytes, codepoint] = HandleUTF8FirstByte(byte);
+      bool in_class;
+      if (!accepted) {
+        in_class = false;
+      } else if (num_bytes > 1) {
+        in_class = is_negative;
+      } else {
+        in_class = is_negative;
+        for (int j = 1; j < rule_expr.size(); j += 2) {
+          if (rule_expr[j] <= byte && byte <= rule_expr[j + 1]) {
+            in_class = !is_negative;
+            break;
+          }
+        }
+      }
+      if (in_class) {
+        table[byte >> 6] |= uint64_t(1) << (byte & 63);
+      }
+    }
+  }
+}
+
 std::ostream& operator<<(std::ostream& os, const BNFGrammar& grammar) {
   os << BNFGrammarPrinter(grammar).ToString();
   return os;
@@ -53,6 +90,14 @@ TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarFromJSON").set_body_typed([](String j
   return BNFGrammar::FromJSON(json_string);
 });
 
+BNFGrammar BNFGrammar::FromBinary(const std::string& binary) {
+  return BNFBinaryParser::Parse(binary);
+}
+
+TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarFromBinary").set_body_typed([](std::string binary) {
+  return BNFGrammar::FromBinary(binary);
+});
+
 BNFGrammar BNFGrammar::FromSchema(const std::string& schema, std::optional<int> indent,
                                   std::optional<std::pair<std::string, std::string>> separators,
                                   bool strict_mode) {
@@ -79,6 +124,14 @@ TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarFromSchema").set_body([](TVMArgs args
   *rv = BNFGrammar::FromSchema(args[0], indent, separators, args[3]);
 });
 
+BNFGrammar BNFGrammar::FromRegex(const std::string& regex) {
+  return FromEBNFString(RegexToEBNF(regex));
+}
+
+TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarFromRegex").set_body_typed([](String regex) {
+  return BNFGrammar::FromRegex(regex);
+});
+
 // Optimized json grammar for the speed of the grammar state matcher
 const std::string kJSONGrammarString = R"(
 main ::= (
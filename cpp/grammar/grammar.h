@@ -11,6 +11,7 @@
 #include <tvm/runtime/registry.h>
 
 #include <cstdint>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -147,6 +148,22 @@ class BNFGrammarNode : public Object {
     return {type, data_ptr, data_len};
   }
 
+  /*!
+   * \brief Check whether the byte is accepted by the character class (or character class star)
+   * rule expr with the given id, as the first byte of a codepoint. The check is a lookup in a
+   * 256-bit table of the character class, instead of a scan of its ranges. The tables of all
+   * character classes are built when the first lookup happens.
+   * \note The following bytes of a multi-byte codepoint are not checked by the table. The
+   * character class accepts any multi-byte codepoint iff it is negative.
+   */
+  bool CharacterClassAcceptsFirstByte(int32_t rule_expr_id, uint8_t byte) const {
+    std::call_once(char_class_tables_built_, [this]() { BuildCharacterClassTables(); });
+    DCHECK(char_class_table_offsets_[rule_expr_id] != -1)
+        << "rule_expr_id " << rule_expr_id << " is not a character class";
+    const uint64_t* table = char_class_tables_.data() + char_class_table_offsets_[rule_expr_id];
+    return (table[byte >> 6] >> (byte & 63)) & 1;
+  }
+
   static constexpr const char* _type_key = "mlc.grammar.BNFGrammar";
   static constexpr const bool _type_has_method_sequal_reduce = false;
   static constexpr const bool _type_has_method_shash_reduce = false;
@@ -163,9 +180,22 @@ class BNFGrammarNode : public Object {
   /*! \brief The id of the main rule. */
   int32_t main_rule_id_ = -1;
 
+  /*! \brief Build the tables of the bytes accepted by every character class rule expr. */
+  void BuildCharacterClassTables() const;
+
+  /*! \brief Whether the character class tables are built. */
+  mutable std::once_flag char_class_tables_built_;
+  /*! \brief The offset of the table of each rule expr in char_class_tables_. -1 for the rule
+   * exprs that are not character classes. */
+  mutable std::vector<int32_t> char_class_table_offsets_;
+  /*! \brief The 256-bit tables of the character classes, four 64-bit words each. */
+  mutable std::vector<uint64_t> char_class_tables_;
+
   friend class BNFGrammarBuilder;
   friend class BNFGrammarJSONSerializer;
   friend class BNFJSONParser;
+  friend class BNFGrammarBinarySerializer;
+  friend class BNFBinaryParser;
 };
 
 class BNFGrammar : public ObjectRef {
@@ -186,6 +216,13 @@ class BNFGrammar : public ObjectRef {
    */
   static BNFGrammar FromJSON(const std::string& json_string);
 
+  /*!
+   * \brief Construct a BNF grammar from the dumped binary string.
+   * \param binary The binary string. This string should have the same format as the result of
+   * BNFGrammarBinarySerializer::ToString.
+   */
+  static BNFGrammar FromBinary(const std::string& binary);
+
   /*!
    * \brief Construct a BNF grammar from the json schema string. The schema string should be in the
    * format of the schema of a JSON file. We will parse the schema and generate a BNF grammar.
@@ -208,6 +245,13 @@ class BNFGrammar : public ObjectRef {
       std::optional<std::pair<std::string, std::string>> separators = std::nullopt,
       bool strict_mode = true);
 
+  /*!
+   * \brief Construct a BNF grammar from a regular expression. The grammar accepts the strings
+   * fully matched by the regex. See RegexToEBNF() for the supported syntax.
+   * \param regex The regular expression.
+   */
+  static BNFGrammar FromRegex(const std::string& regex);
+
   /*!
    * \brief Get the grammar of standard JSON format. We have built-in support for JSON.
    */
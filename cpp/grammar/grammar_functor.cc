@@ -315,6 +315,49 @@ BNFGrammar BNFGrammarNormalizer::Apply(const BNFGrammar& grammar) {
   return grammar_;
 }
 
+bool RegularGrammarDetector::Apply(const BNFGrammar& grammar) {
+  Init(grammar);
+  int num_rules = grammar_->NumRules();
+  rule_refs_.assign(num_rules, {});
+  for (cur_rule_id_ = 0; cur_rule_id_ < num_rules; ++cur_rule_id_) {
+    auto rule = grammar_->GetRule(cur_rule_id_);
+    VisitExpr(rule.body_expr_id);
+    VisitLookaheadAssertion(rule.lookahead_assertion_id);
+  }
+
+  // Find a cycle in the rule reference graph with an iterative DFS.
+  // 0: not visited, 1: on the DFS path, 2: finished.
+  std::vector<int> visit_state(num_rules, 0);
+  std::vector<std::pair<int32_t, int>> dfs_stack;
+  for (int32_t root = 0; root < num_rules; ++root) {
+    if (visit_state[root] != 0) {
+      continue;
+    }
+    visit_state[root] = 1;
+    dfs_stack.push_back({root, 0});
+    while (!dfs_stack.empty()) {
+      auto& [rule_id, next_ref] = dfs_stack.back();
+      if (next_ref == static_cast<int>(rule_refs_[rule_id].size())) {
+        visit_state[rule_id] = 2;
+        dfs_stack.pop_back();
+        continue;
+      }
+      int32_t ref_rule_id = rule_refs_[rule_id][next_ref++];
+      if (visit_state[ref_rule_id] == 1) {
+        return false;
+      } else if (visit_state[ref_rule_id] == 0) {
+        visit_state[ref_rule_id] = 1;
+        dfs_stack.push_back({ref_rule_id, 0});
+      }
+    }
+  }
+  return true;
+}
+
+void RegularGrammarDetector::VisitRuleRef(const RuleExpr& rule_expr) {
+  rule_refs_[cur_rule_id_].push_back(rule_expr[0]);
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
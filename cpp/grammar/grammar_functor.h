@@ -9,6 +9,7 @@
 
 #include <queue>
 #include <string>
+#include <vector>
 
 #include "grammar.h"
 #include "grammar_builder.h"
@@ -83,7 +84,11 @@ class BNFGrammarFunctor {
   /*! \brief Visit a lookahead assertion expr referred by id. */
   virtual T VisitLookaheadAssertion(int32_t lookahead_assertion_id) {
     if (lookahead_assertion_id == -1) {
-      return -1;
+      if constexpr (std::is_same<T, void>::value) {
+        return;
+      } else {
+        return -1;
+      }
     }
     return VisitExpr(lookahead_assertion_id);
   }
@@ -212,6 +217,27 @@ class BNFGrammarNormalizer : public BNFGrammarMutator {
   std::vector<std::unique_ptr<BNFGrammarMutator>> GetNormalizerList();
 };
 
+/*!
+ * \brief Detect whether a BNFGrammar is regular. A grammar is regular when no rule refers to
+ * itself, directly or through other rules (including lookahead assertions). Such a grammar
+ * describes a regular language, and the matcher stacks have a bounded depth, so the matcher can
+ * only reach finitely many states. Character class stars do not break the regularity.
+ */
+class RegularGrammarDetector : public BNFGrammarVisitor<bool> {
+ public:
+  using BNFGrammarVisitor::BNFGrammarVisitor;
+
+  bool Apply(const BNFGrammar& grammar) final;
+
+ private:
+  void VisitRuleRef(const RuleExpr& rule_expr) final;
+
+  /*! \brief The id of the current rule being visited. */
+  int32_t cur_rule_id_ = -1;
+  /*! \brief The ids of the rules referred by each rule. */
+  std::vector<std::vector<int32_t>> rule_refs_;
+};
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -5,9 +5,13 @@
 
 #include "grammar_parser.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "../support/encoding.h"
 #include "../support/json_parser.h"
 #include "grammar_builder.h"
+#include "grammar_serializer.h"
 
 namespace mlc {
 namespace llm {
@@ -480,6 +484,106 @@ BNFGrammar BNFJSONParser::Parse(std::string json_string) {
   return BNFGrammar(std::move(node));
 }
 
+BNFGrammar BNFBinaryParser::Parse(const std::string& binary) {
+  auto node = make_object<BNFGrammarNode>();
+  const char* cur = binary.data();
+  const char* end = binary.data() + binary.size();
+  // Check the remaining length before allocating, so that a malformed size does not allocate a
+  // huge buffer.
+  auto f_check_remaining = [&cur, end](int64_t num_bytes) {
+    CHECK(num_bytes >= 0 && num_bytes <= end - cur) << "The binary grammar is truncated.";
+  };
+  auto f_read = [&cur, &f_check_remaining](void* dst, int64_t num_bytes) {
+    f_check_remaining(num_bytes);
+    std::memcpy(dst, cur, num_bytes);
+    cur += num_bytes;
+  };
+  auto f_read_int = [&f_read]() {
+    int32_t value;
+    f_read(&value, sizeof(int32_t));
+    return value;
+  };
+  auto f_read_vector = [&f_read, &f_read_int, &f_check_remaining](std::vector<int32_t>* dst) {
+    int32_t size = f_read_int();
+    CHECK_GE(size, 0) << "The binary grammar is malformed.";
+    f_check_remaining(static_cast<int64_t>(size) * sizeof(int32_t));
+    dst->resize(size);
+    f_read(dst->data(), static_cast<int64_t>(size) * sizeof(int32_t));
+  };
+
+  CHECK_EQ(static_cast<uint32_t>(f_read_int()), BNFGrammarBinarySerializer::kMagic)
+      << "The string is not a binary grammar.";
+  CHECK_EQ(static_cast<uint32_t>(f_read_int()), BNFGrammarBinarySerializer::kVersion)
+      << "The binary grammar version is not supported.";
+  node->main_rule_id_ = f_read_int();
+  int32_t num_rules = f_read_int();
+  CHECK_GE(num_rules, 0) << "The binary grammar is malformed.";
+  // Every rule takes at least three ints: the name length, the body and the lookahead assertion.
+  f_check_remaining(static_cast<int64_t>(num_rules) * 3 * sizeof(int32_t));
+  node->rules_.reserve(num_rules);
+  for (int32_t i = 0; i < num_rules; ++i) {
+    BNFGrammarNode::Rule rule;
+    int32_t name_length = f_read_int();
+    CHECK_GE(name_length, 0) << "The binary grammar is malformed.";
+    f_check_remaining(name_length);
+    rule.name.resize(name_length);
+    f_read(rule.name.data(), name_length);
+    rule.body_expr_id = f_read_int();
+    rule.lookahead_assertion_id = f_read_int();
+    node->rules_.push_back(std::move(rule));
+  }
+  f_read_vector(&node->rule_expr_data_);
+  f_read_vector(&node->rule_expr_indptr_);
+  CHECK(cur == end) << "The binary grammar has trailing bytes.";
+
+  // Validate the ids and the storage of the rule exprs, so that the grammar never reads out of
+  // bound when matching.
+  using RuleExprType = BNFGrammarNode::RuleExprType;
+  const std::vector<int32_t>& data = node->rule_expr_data_;
+  const std::vector<int32_t>& indptr = node->rule_expr_indptr_;
+  int32_t num_rule_exprs = static_cast<int32_t>(indptr.size());
+  auto f_is_rule_id = [num_rules](int32_t id) { return id >= 0 && id < num_rules; };
+  auto f_is_rule_expr_id = [num_rule_exprs](int32_t id) { return id >= 0 && id < num_rule_exprs; };
+  CHECK(f_is_rule_id(node->main_rule_id_)) << "The binary grammar has invalid main rule id.";
+  for (const BNFGrammarNode::Rule& rule : node->rules_) {
+    CHECK(f_is_rule_expr_id(rule.body_expr_id) &&
+          (rule.lookahead_assertion_id == -1 || f_is_rule_expr_id(rule.lookahead_assertion_id)))
+        << "The binary grammar has invalid rule expr id in rule " << rule.name << ".";
+  }
+  // The rule exprs are stored consecutively as [type, data_len, data...].
+  int64_t expected_start = 0;
+  for (int32_t i = 0; i < num_rule_exprs; ++i) {
+    CHECK(indptr[i] == expected_start && expected_start + 2 <= static_cast<int64_t>(data.size()))
+        << "The binary grammar has invalid rule expr indptr.";
+    int32_t type = data[indptr[i]];
+    int32_t data_len = data[indptr[i] + 1];
+    CHECK(data_len >= 0 && expected_start + 2 + data_len <= static_cast<int64_t>(data.size()))
+        << "The binary grammar has invalid rule expr length.";
+    CHECK(type >= static_cast<int32_t>(RuleExprType::kByteString) &&
+          type <= static_cast<int32_t>(RuleExprType::kChoices))
+        << "The binary grammar has invalid rule expr type " << type << ".";
+    const int32_t* begin = data.data() + indptr[i] + 2;
+    const int32_t* finish = begin + data_len;
+    switch (static_cast<RuleExprType>(type)) {
+      case RuleExprType::kRuleRef:
+        CHECK(data_len == 1 && f_is_rule_id(*begin))
+            << "The binary grammar has invalid rule reference.";
+        break;
+      case RuleExprType::kSequence:
+      case RuleExprType::kChoices:
+        CHECK(std::all_of(begin, finish, f_is_rule_expr_id))
+            << "The binary grammar has invalid rule expr reference.";
+        break;
+      default:
+        break;
+    }
+    expected_start += 2 + data_len;
+  }
+  CHECK(expected_start == static_cast<int64_t>(data.size()))
+      << "The binary grammar has trailing rule expr data.";
+  return BNFGrammar(std::move(node));
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
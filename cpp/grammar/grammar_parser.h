@@ -61,6 +61,20 @@ class BNFJSONParser {
   static BNFGrammar Parse(std::string json_string);
 };
 
+/*!
+ * \brief Parse a BNF grammar from the raw representation of the AST in binary format.
+ * \sa BNFGrammarBinarySerializer for the binary format.
+ */
+class BNFBinaryParser {
+ public:
+  /*!
+   * \brief Parse the binary string. If the string is malformed, throw an error.
+   * \param binary The binary string.
+   * \return The parsed BNF grammar.
+   */
+  static BNFGrammar Parse(const std::string& binary);
+};
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
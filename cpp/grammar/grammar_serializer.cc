@@ -170,6 +170,62 @@ TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarToJSON")
       return BNFGrammarJSONSerializer(grammar, prettify).ToString();
     });
 
+std::string BNFGrammarBinarySerializer::ToString() {
+  std::string result;
+  auto f_append = [&result](const void* data, size_t num_bytes) {
+    result.append(static_cast<const char*>(data), num_bytes);
+  };
+  auto f_append_int = [&f_append](int64_t value) {
+    int32_t value_int32 = static_cast<int32_t>(value);
+    f_append(&value_int32, sizeof(int32_t));
+  };
+  size_t num_names_bytes = 0;
+  for (const auto& rule : grammar_->rules_) {
+    num_names_bytes += rule.name.size();
+  }
+  result.reserve(sizeof(int32_t) * (6 + grammar_->rules_.size() * 3 +
+                                    grammar_->rule_expr_data_.size() +
+                                    grammar_->rule_expr_indptr_.size()) +
+                 num_names_bytes);
+
+  f_append_int(kMagic);
+  f_append_int(kVersion);
+  f_append_int(grammar_->main_rule_id_);
+  f_append_int(grammar_->rules_.size());
+  for (const auto& rule : grammar_->rules_) {
+    f_append_int(rule.name.size());
+    f_append(rule.name.data(), rule.name.size());
+    f_append_int(rule.body_expr_id);
+    f_append_int(rule.lookahead_assertion_id);
+  }
+  f_append_int(grammar_->rule_expr_data_.size());
+  f_append(grammar_->rule_expr_data_.data(), grammar_->rule_expr_data_.size() * sizeof(int32_t));
+  f_append_int(grammar_->rule_expr_indptr_.size());
+  f_append(grammar_->rule_expr_indptr_.data(),
+           grammar_->rule_expr_indptr_.size() * sizeof(int32_t));
+  return result;
+}
+
+uint64_t BNFGrammarBinarySerializer::Hash(const BNFGrammar& grammar) {
+  std::string binary = BNFGrammarBinarySerializer(grammar).ToString();
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char byte : binary) {
+    hash = (hash ^ byte) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarToBinary").set_body([](TVMArgs args, TVMRetValue* rv) {
+  BNFGrammar grammar = args[0];
+  std::string binary = BNFGrammarBinarySerializer(grammar).ToString();
+  *rv = TVMByteArray{binary.data(), binary.size()};
+});
+
+TVM_REGISTER_GLOBAL("mlc.grammar.BNFGrammarHash").set_body_typed([](const BNFGrammar& grammar) {
+  // Return the hash as a signed integer, which keeps the bits of the unsigned hash.
+  return static_cast<int64_t>(BNFGrammarBinarySerializer::Hash(grammar));
+});
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -7,6 +7,7 @@
 #ifndef MLC_LLM_GRAMMAR_GRAMMAR_SERIALIZER_H_
 #define MLC_LLM_GRAMMAR_GRAMMAR_SERIALIZER_H_
 
+#include <cstdint>
 #include <string>
 
 #include "grammar.h"
@@ -110,6 +111,39 @@ class BNFGrammarJSONSerializer : public BNFGrammarSerializer {
   bool prettify_;
 };
 
+/*!
+ * \brief Serialize the raw representation of the BNF AST to a compact binary string. It is much
+ * cheaper to parse than the JSON format, and its content hash identifies the grammar.
+ * \sa BNFBinaryParser::Parse for parsing the binary string.
+ * \details Binary format. All integers are 32-bit in the native byte order:
+ *  magic, version, main_rule_id, num_rules,
+ *  [name_length, name bytes, body_expr_id, lookahead_assertion_id] for each rule,
+ *  num_rule_expr_data, rule_expr_data...,
+ *  num_rule_expr_indptr, rule_expr_indptr...
+ */
+class BNFGrammarBinarySerializer : public BNFGrammarSerializer {
+ public:
+  /*!
+   * \brief Constructor.
+   * \param grammar The grammar to serialize.
+   */
+  explicit BNFGrammarBinarySerializer(const BNFGrammar& grammar) : BNFGrammarSerializer(grammar) {}
+
+  /*! \brief Dump the raw representation of the AST to a binary string. */
+  std::string ToString() final;
+
+  /*!
+   * \brief The content hash of the grammar, i.e. the FNV-1a hash of its binary serialization.
+   * Grammars with the same rules and rule exprs have the same hash across processes.
+   */
+  static uint64_t Hash(const BNFGrammar& grammar);
+
+  /*! \brief The magic number of the binary format. */
+  static constexpr uint32_t kMagic = 0x424e4647;
+  /*! \brief The version of the binary format. */
+  static constexpr uint32_t kVersion = 1;
+};
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -5,6 +5,8 @@
 // #define TVM_LOG_DEBUG 1
 #include "grammar_state_matcher.h"
 
+#include <tvm/runtime/threading_backend.h>
+
 #include <chrono>
 #include <queue>
 
@@ -13,6 +15,7 @@
 #include "grammar.h"
 #include "grammar_serializer.h"
 #include "grammar_state_matcher_base.h"
+#include "grammar_state_matcher_json.h"
 #include "grammar_state_matcher_preproc.h"
 #include "grammar_state_matcher_state.h"
 #include "support.h"
@@ -157,6 +160,9 @@ class GrammarStateMatcherNodeImpl : public GrammarStateMatcherNode, public Gramm
     init_ctx_->stop_token_ids = stop_token_ids;
   }
 
+  /*! \brief Get the init context of the matcher. */
+  const std::shared_ptr<GrammarStateInitContext>& GetInitContext() const { return init_ctx_; }
+
  private:
   /*!
    * \brief If is_uncertain_saved is true, find the next token in uncertain_indices. Otherwise,
@@ -173,13 +179,22 @@ class GrammarStateMatcherNodeImpl : public GrammarStateMatcherNode, public Gramm
   void SetTokenBitmask(DLTensor* next_token_bitmask, const DynamicBitset& accepted_bitset,
                        const std::vector<int32_t>& rejected_indices, bool can_reach_end);
 
+  /*! \brief Mask out the padded tokens beyond the vocabulary in next_token_bitmask. */
+  void MaskOutPaddedTokens(DLTensor* next_token_bitmask);
+
+  /*!
+   * \brief Get the current state in the token-level DFA of the grammar, i.e. the canonical form
+   * of the stacks. It lists the rule positions of each stack from the top to the root, with the
+   * stacks sorted and deduplicated, so the same stacks always give the same state.
+   */
+  void GetTokenMaskDFAState(std::vector<int32_t>* state);
+
   /*!
    * \brief Accept the stop token and terminates the matcher.
    * \returns Whether the stop token can be accepted.
    */
   bool AcceptStopToken();
 
-  friend IntTuple FindNextRejectedTokens(GrammarStateMatcher matcher, bool verbose);
   friend NDArray FindNextTokenBitmaskAsNDArray(GrammarStateMatcher matcher, int full_vocab_size);
 
   std::shared_ptr<GrammarStateInitContext> init_ctx_;
@@ -190,6 +205,9 @@ class GrammarStateMatcherNodeImpl : public GrammarStateMatcherNode, public Gramm
   DynamicBitset tmp_accepted_bitset_;
   std::vector<int32_t> tmp_rejected_indices_;
   std::vector<int32_t> tmp_rejected_indices_delta_;
+  std::vector<int32_t> tmp_latest_stack_tops_;
+  std::vector<int32_t> tmp_dfa_state_;
+  std::vector<std::vector<int32_t>> tmp_dfa_stacks_;
 };
 
 bool GrammarStateMatcherNodeImpl::AcceptStopToken() {
@@ -260,7 +278,25 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
          "find the next token mask";
   const auto& sorted_token_table = init_ctx_->sorted_token_table;
   const auto& catagorized_tokens_for_grammar = init_ctx_->catagorized_tokens_for_grammar;
-  const auto& latest_stack_tops = stack_tops_history_.GetLatest();
+  // Copy the latest stack tops, since the history is pushed and rolled back when checking the
+  // stacks below.
+  auto latest_stack_tops_view = stack_tops_history_.GetLatest();
+  tmp_latest_stack_tops_.assign(latest_stack_tops_view.begin(), latest_stack_tops_view.end());
+  const auto& latest_stack_tops = tmp_latest_stack_tops_;
+
+  // For a regular grammar, the mask of a visited state is fetched from the token-level DFA.
+  const std::shared_ptr<TokenMaskDFA>& token_mask_dfa = init_ctx_->token_mask_dfa;
+  if (token_mask_dfa != nullptr) {
+    CHECK(next_token_bitmask->ndim == 1 &&
+          next_token_bitmask->shape[0] >= DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size))
+        << "The provied bitmask's shape is not valid.";
+    GetTokenMaskDFAState(&tmp_dfa_state_);
+    if (token_mask_dfa->FindMask(tmp_dfa_state_,
+                                 reinterpret_cast<uint32_t*>(next_token_bitmask->data))) {
+      MaskOutPaddedTokens(next_token_bitmask);
+      return;
+    }
+  }
 
   // We check all the stacks one by one, and find the accepted token set or the rejected token set
   // for each stack. We will try to find the small one of the two sets.
@@ -366,15 +402,43 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
   // Finally update the rejected_ids bitset
   bool can_reach_end = CanReachEnd();
   SetTokenBitmask(next_token_bitmask, tmp_accepted_bitset_, tmp_rejected_indices_, can_reach_end);
+  if (token_mask_dfa != nullptr) {
+    token_mask_dfa->AddState(tmp_dfa_state_,
+                             reinterpret_cast<const uint32_t*>(next_token_bitmask->data));
+  }
+  MaskOutPaddedTokens(next_token_bitmask);
+}
 
+void GrammarStateMatcherNodeImpl::MaskOutPaddedTokens(DLTensor* next_token_bitmask) {
   // Up till now, we use vocab_size from `GetVocabSize()`, while `next_token_bitmask` is of
   // vocab_size read from `config.json`. For models like QWen2 and Phi3, the latter can be larger.
   // So we further mask out the dummy padded tokens.
   CHECK(next_token_bitmask->ndim == 1);
   DynamicBitset next_token_bitset(next_token_bitmask->shape[0] * 32,
                                   reinterpret_cast<uint32_t*>(next_token_bitmask->data));
-  for (int i = init_ctx_->vocab_size; i < next_token_bitmask->shape[0] * 32; i++) {
-    next_token_bitset.Set(i, false);
+  next_token_bitset.SetRange(init_ctx_->vocab_size, next_token_bitmask->shape[0] * 32, false);
+}
+
+void GrammarStateMatcherNodeImpl::GetTokenMaskDFAState(std::vector<int32_t>* state) {
+  auto latest_stack_tops = stack_tops_history_.GetLatest();
+  tmp_dfa_stacks_.resize(latest_stack_tops.size());
+  for (int i = 0; i < static_cast<int>(latest_stack_tops.size()); ++i) {
+    std::vector<int32_t>& stack = tmp_dfa_stacks_[i];
+    stack.clear();
+    for (int32_t id = latest_stack_tops[i]; id != RulePosition::kNoParent;
+         id = tree_[id].parent_id) {
+      const RulePosition& rule_position = tree_[id];
+      stack.insert(stack.end(), {rule_position.rule_id, rule_position.sequence_id,
+                                 rule_position.element_id, rule_position.left_utf8_bytes,
+                                 rule_position.element_in_string});
+    }
+  }
+  std::sort(tmp_dfa_stacks_.begin(), tmp_dfa_stacks_.end());
+  auto stacks_end = std::unique(tmp_dfa_stacks_.begin(), tmp_dfa_stacks_.end());
+  state->clear();
+  for (auto it = tmp_dfa_stacks_.begin(); it != stacks_end; ++it) {
+    state->push_back(it->size());
+    state->insert(state->end(), it->begin(), it->end());
   }
 }
 
@@ -388,7 +452,7 @@ std::string GrammarStateMatcherNodeImpl::FindJumpForwardString() {
   bool can_find_next_char = true;
 
   while (can_find_next_char) {
-    const auto& stack_tops = stack_tops_history_.GetLatest();
+    auto stack_tops = stack_tops_history_.GetLatest();
 
     // 1. Check that for every stack top, the next possible char is unique and the same
     // -1 means not found yet; 0~255 means the next char
@@ -447,6 +511,7 @@ std::string GrammarStateMatcherNodeImpl::FindJumpForwardString() {
           ExpandRulePosition(new_rule_position, &tmp_new_stack_tops_, true);
         }
       }
+      DeduplicateStackTops(&tmp_new_stack_tops_);
       stack_tops_history_.PushHistory(tmp_new_stack_tops_);
       ++num_accepted_chars;
     }
@@ -544,9 +609,75 @@ int GrammarStateMatcherNodeImpl::GetNextUncertainToken(
   }
 }
 
+/*!
+ * \brief Get the generic matcher for the debug functions that work on the characters, which the
+ * JSON matcher does not support.
+ * \note The matcher implementations share the type index of GrammarStateMatcherNode, so that they
+ * are the same object type to the FFI. Thus `ObjectRef::as` cannot tell them apart.
+ */
+GrammarStateMatcherNodeImpl* GetGenericMatcherNode(const GrammarStateMatcher& matcher) {
+  auto node = const_cast<GrammarStateMatcherNodeImpl*>(
+      dynamic_cast<const GrammarStateMatcherNodeImpl*>(matcher.operator->()));
+  CHECK(node != nullptr) << "The matcher of the built-in JSON grammar does not support matching "
+                            "characters. Create the matcher from the grammar instead.";
+  return node;
+}
+
+/*! \brief Get the init context of either the generic matcher or the JSON matcher. */
+std::shared_ptr<GrammarStateInitContext> GetInitContextOfMatcher(
+    const GrammarStateMatcher& matcher) {
+  if (const auto* node = dynamic_cast<const GrammarStateMatcherNodeImpl*>(matcher.operator->())) {
+    return node->GetInitContext();
+  }
+  const auto* json_node = dynamic_cast<const JSONStateMatcherNodeImpl*>(matcher.operator->());
+  ICHECK(json_node != nullptr) << "Unknown grammar state matcher implementation";
+  return json_node->GetInitContext();
+}
+
+/*! \brief Create the JSON matcher if the init context is for it, or the generic matcher. */
+ObjectPtr<GrammarStateMatcherNode> MakeGrammarStateMatcherNode(
+    std::shared_ptr<GrammarStateInitContext> init_ctx, int max_rollback_steps) {
+  if (init_ctx->json_token_masks != nullptr) {
+    return make_object<JSONStateMatcherNodeImpl>(init_ctx, max_rollback_steps);
+  }
+  return make_object<GrammarStateMatcherNodeImpl>(init_ctx, max_rollback_steps);
+}
+
 GrammarStateMatcher::GrammarStateMatcher(std::shared_ptr<GrammarStateInitContext> init_ctx,
                                          int max_rollback_steps)
-    : ObjectRef(make_object<GrammarStateMatcherNodeImpl>(init_ctx, max_rollback_steps)) {}
+    : ObjectRef(MakeGrammarStateMatcherNode(init_ctx, max_rollback_steps)) {}
+
+void GrammarStateMatcher::BatchFindNextTokenBitmask(
+    const std::vector<GrammarStateMatcher>& matchers, DLTensor* next_token_bitmask,
+    const std::vector<int>& rows) {
+  CHECK_EQ(next_token_bitmask->ndim, 2);
+  CHECK(next_token_bitmask->dtype.code == kDLUInt && next_token_bitmask->dtype.bits == 32);
+  CHECK_EQ(matchers.size(), rows.size());
+  int64_t bitmask_size = next_token_bitmask->shape[1];
+  uint32_t* data = reinterpret_cast<uint32_t*>(static_cast<char*>(next_token_bitmask->data) +
+                                               next_token_bitmask->byte_offset);
+
+  // Each matcher writes its own row, so the matchers can run concurrently.
+  auto f_find_bitmask = [&](int i) {
+    CHECK(rows[i] >= 0 && rows[i] < next_token_bitmask->shape[0]);
+    int64_t row_shape[] = {bitmask_size};
+    DLTensor row = *next_token_bitmask;
+    row.data = data + rows[i] * bitmask_size;
+    row.ndim = 1;
+    row.shape = row_shape;
+    row.strides = nullptr;
+    row.byte_offset = 0;
+    matchers[i]->FindNextTokenBitmask(&row);
+  };
+  int num_matchers = matchers.size();
+  if (num_matchers <= 1 || tvm::runtime::threading::MaxConcurrency() <= 1) {
+    for (int i = 0; i < num_matchers; ++i) {
+      f_find_bitmask(i);
+    }
+    return;
+  }
+  tvm::runtime::parallel_for_with_threading_backend(f_find_bitmask, 0, num_matchers);
+}
 
 #ifndef COMPILE_MLC_WASM_RUNTIME
 // This creates tokenizer dependency issue in WASM building for web, hence skipped
@@ -584,11 +715,20 @@ TVM_REGISTER_GLOBAL("mlc.grammar.GrammarStateMatcherFromTokenTable")
       *rv = GrammarStateMatcher(init_ctx, max_rollback_steps);
     });
 
+TVM_REGISTER_GLOBAL("mlc.grammar.GrammarStateMatcherForJSONFromTokenTable")
+    .set_body_typed([](Array<String> token_table_arr, int max_rollback_steps) {
+      std::vector<std::string> token_table(token_table_arr.begin(), token_table_arr.end());
+      auto init_ctx = std::make_shared<GrammarStateInitContext>();
+      init_ctx->grammar = BNFGrammar::GetGrammarOfJSON();
+      SetTokenizerInfoOfInitContext(init_ctx.get(), token_table);
+      InitJSONStateMatcherOfInitContext(init_ctx.get(),
+                                        std::max<int>(std::thread::hardware_concurrency(), 1));
+      return GrammarStateMatcher(init_ctx, max_rollback_steps);
+    });
+
 TVM_REGISTER_GLOBAL("mlc.grammar.GrammarStateMatcherDebugAcceptChar")
     .set_body_typed([](GrammarStateMatcher matcher, int32_t codepoint, bool verbose) {
-      auto mutable_node =
-          const_cast<GrammarStateMatcherNodeImpl*>(matcher.as<GrammarStateMatcherNodeImpl>());
-      return mutable_node->AcceptChar(codepoint, verbose);
+      return GetGenericMatcherNode(matcher)->AcceptChar(codepoint, verbose);
     });
 
 TVM_REGISTER_GLOBAL("mlc.grammar.GrammarStateMatcherAcceptToken")
@@ -622,8 +762,7 @@ TVM_REGISTER_GLOBAL("mlc.grammar.GrammarStateMatcherSetStopTokenIds")
 /*! \brief Check if a matcher can accept the complete string, and then reach the end of the
  * grammar. Does not change the state of the GrammarStateMatcher. For test purpose. */
 bool MatchCompleteString(GrammarStateMatcher matcher, String str, bool verbose) {
-  auto mutable_node =
-      const_cast<GrammarStateMatcherNodeImpl*>(matcher.as<GrammarStateMatcherNodeImpl>());
+  auto mutable_node = GetGenericMatcherNode(matcher);
   int accepted_cnt = 0;
   for (auto char_value : str.operator std::string()) {
     if (!mutable_node->AcceptChar(char_value, verbose)) {
@@ -699,7 +838,7 @@ std::string PrintAcceptedRejectedTokens(
  * \returns A tuple of rejected token ids.
  */
 IntTuple FindNextRejectedTokens(GrammarStateMatcher matcher, bool verbose = false) {
-  auto init_ctx = matcher.as<GrammarStateMatcherNodeImpl>()->init_ctx_;
+  auto init_ctx = GetInitContextOfMatcher(matcher);
   auto vocab_size = init_ctx->vocab_size;
   auto bitset_size = DynamicBitset::CalculateBufferSize(vocab_size);
   auto ndarray = NDArray::Empty(ShapeTuple{static_cast<long>(bitset_size)},
@@ -12,6 +12,8 @@
 #include <tvm/runtime/registry.h>
 
 #include <cstdint>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -137,6 +139,18 @@ class GrammarStateMatcher : public ObjectRef {
   static std::shared_ptr<GrammarStateInitContext> CreateInitContext(
       const BNFGrammar& grammar, const std::vector<std::string>& token_table);
 
+  /*!
+   * \brief Find the next token bitmasks of a batch of matchers in parallel, and store them in
+   * the rows of one contiguous bitmask, which can be copied to device at once.
+   * \param matchers The matchers. A matcher must not appear more than once.
+   * \param next_token_bitmask The bitmask to store the results. It must be pre-allocated with the
+   * shape (num_rows, ceil(vocab_size, 32)) and the dtype uint32.
+   * \param rows The bitmask row of each matcher.
+   */
+  static void BatchFindNextTokenBitmask(const std::vector<GrammarStateMatcher>& matchers,
+                                        DLTensor* next_token_bitmask,
+                                        const std::vector<int>& rows);
+
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(GrammarStateMatcher, ObjectRef, GrammarStateMatcherNode);
 };
 
@@ -156,7 +170,25 @@ class GrammarInitContextCacheNode : public Object {
   virtual std::shared_ptr<GrammarStateInitContext> GetInitContextForJSONSchema(
       const std::string& schema) = 0;
 
-  /*! \brief Clear the interal cache of init contexts. */
+  /*!
+   * \brief Get the init context for a JSON schema string without blocking. On the first use of
+   * the schema, its init context is created on a worker thread, and the returned future becomes
+   * ready when the preprocessing finishes. Later calls share the same future.
+   */
+  virtual std::shared_future<std::shared_ptr<GrammarStateInitContext>>
+  GetInitContextForJSONSchemaAsync(const std::string& schema) = 0;
+
+  /*!
+   * \brief Get the init context for a regular expression without blocking, in the same way as
+   * GetInitContextForJSONSchemaAsync.
+   */
+  virtual std::shared_future<std::shared_ptr<GrammarStateInitContext>>
+  GetInitContextForRegexAsync(const std::string& regex) = 0;
+
+  /*!
+   * \brief Clear the interal cache of init contexts. It waits for the init contexts under
+   * preprocessing.
+   */
   virtual void Clear() = 0;
 
   static constexpr const char* _type_key = "mlc.serve.GrammarInitContextCacheNode";
@@ -171,8 +203,12 @@ class GrammarInitContextCache : public ObjectRef {
    * \brief Construct a GrammarInitContextCache with a token table. This class will always create
    * grammar state init contexts with this token table.
    * \param token_table The token table that the grammar will use.
+   * \param cache_dir The directory to persist the preprocessing results in, so that they are
+   * reused across processes. The results are keyed by the grammar and the token table, and are
+   * loaded lazily when a grammar is first used. Empty means the results are only kept in memory.
    */
-  GrammarInitContextCache(const std::vector<std::string>& token_table);
+  GrammarInitContextCache(const std::vector<std::string>& token_table,
+                          const std::string& cache_dir = "");
 
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(GrammarInitContextCache, ObjectRef,
                                         GrammarInitContextCacheNode);
@@ -8,6 +8,7 @@
 
 #include <vector>
 
+#include "../support/utils.h"
 #include "grammar.h"
 #include "grammar_state_matcher_state.h"
 
@@ -101,6 +102,15 @@ class GrammarStateMatcherBase {
   bool ExpandRulePosition(RulePosition cur_rule_position, std::vector<int32_t>* new_stack_tops,
                           bool consider_parent = true, int32_t first_id_if_inserted = -1);
 
+  /*!
+   * \brief Remove the stack tops that are equal to a previous stack top in the list, i.e. that
+   * have the same rule position and the same parent node. Different paths of the expansion can
+   * reach the same stack, and keeping only one copy avoids matching the same stack repeatedly.
+   * The removed stack tops are freed if they are not referred to by the history.
+   * \param stack_tops The stack tops to deduplicate in place. The order is preserved.
+   */
+  void DeduplicateStackTops(std::vector<int32_t>* stack_tops);
+
   // The matched grammar.
   BNFGrammar grammar_;
   // The tree storing all states
@@ -112,6 +122,7 @@ class GrammarStateMatcherBase {
   // Temporary data for AcceptChar, PushInitialState, etc to store new stacks.
   // They are stored here to avoid repeated allocation.
   std::vector<int32_t> tmp_new_stack_tops_;
+  std::vector<uint32_t> tmp_stack_top_hashes_;
 };
 
 /*! \brief Check the codepoint is contained in the character class. */
@@ -124,20 +135,8 @@ inline bool GrammarStateMatcherBase::CheckIfAccepted(const RulePosition& rule_po
     if (rule_position.left_utf8_bytes > 0) {
       return (char_value & 0xC0) == 0x80;
     }
-    auto [accepted, num_bytes, codepoint] = HandleUTF8FirstByte(char_value);
-    if (!accepted) {
-      return false;
-    }
-    bool is_negative = static_cast<bool>(current_element[0]);
-    if (num_bytes > 1) {
-      return is_negative;
-    }
-    for (int i = 1; i < current_element.size(); i += 2) {
-      if (current_element[i] <= char_value && char_value <= current_element[i + 1]) {
-        return !is_negative;
-      }
-    }
-    return is_negative;
+    return grammar_->CharacterClassAcceptsFirstByte(
+        current_sequence[rule_position.element_id], char_value);
   } else if (current_element.type == RuleExprType::kByteString) {
     return current_element[rule_position.element_in_string] == char_value;
   } else {
@@ -199,7 +198,7 @@ inline bool GrammarStateMatcherBase::AcceptChar(uint8_t char_value, bool verbose
               << PrintAsEscaped(char_value) << "\"";
     LOG(INFO) << "Previous stack: " << PrintStackState();
   }
-  const auto& prev_stack_tops = stack_tops_history_.GetLatest();
+  auto prev_stack_tops = stack_tops_history_.GetLatest();
 
   tmp_new_stack_tops_.clear();
   for (auto prev_top : prev_stack_tops) {
@@ -232,6 +231,7 @@ inline bool GrammarStateMatcherBase::AcceptChar(uint8_t char_value, bool verbose
     }
     return false;
   }
+  DeduplicateStackTops(&tmp_new_stack_tops_);
   stack_tops_history_.PushHistory(tmp_new_stack_tops_);
   if (verbose) {
     LOG(INFO) << "Character: " << static_cast<int>(char_value) << " \""
@@ -245,7 +245,7 @@ inline bool GrammarStateMatcherBase::AcceptChar(uint8_t char_value, bool verbose
 }
 
 inline bool GrammarStateMatcherBase::CanReachEnd() const {
-  const auto& last_stack_tops = stack_tops_history_.GetLatest();
+  auto last_stack_tops = stack_tops_history_.GetLatest();
   return std::any_of(last_stack_tops.begin(), last_stack_tops.end(),
                      [&](int32_t id) { return tree_.IsEndPosition(tree_[id]); });
 }
@@ -330,7 +330,7 @@ inline bool GrammarStateMatcherBase::ExpandRulePosition(RulePosition cur_rule_po
                                                         std::vector<int32_t>* new_stack_tops,
                                                         bool consider_parent,
                                                         int32_t first_id_if_inserted) {
-  bool is_first = false;
+  bool is_first = true;
   bool is_iteration_successful = true;
 
   for (; is_iteration_successful;
@@ -394,6 +394,37 @@ inline bool GrammarStateMatcherBase::ExpandRulePosition(RulePosition cur_rule_po
   return true;
 }
 
+inline void GrammarStateMatcherBase::DeduplicateStackTops(std::vector<int32_t>* stack_tops) {
+  if (stack_tops->size() <= 1) {
+    return;
+  }
+  // The stacks are few in practice, so the candidates are found by a linear scan of the hashes.
+  tmp_stack_top_hashes_.clear();
+  int num_unique = 0;
+  for (int32_t id : *stack_tops) {
+    const RulePosition& rule_position = tree_[id];
+    uint32_t hash = HashCombine(rule_position.sequence_id, rule_position.element_id,
+                                rule_position.left_utf8_bytes, rule_position.element_in_string,
+                                rule_position.parent_id);
+    bool is_duplicate = false;
+    for (int i = 0; i < num_unique; ++i) {
+      if (tmp_stack_top_hashes_[i] == hash && tree_[(*stack_tops)[i]] == rule_position) {
+        is_duplicate = true;
+        break;
+      }
+    }
+    if (is_duplicate) {
+      // Free the node if it is newly created, i.e. not referred to by anything else.
+      tree_.AttachRefTo(id);
+      tree_.RemoveRefTo(id);
+    } else {
+      tmp_stack_top_hashes_.push_back(hash);
+      (*stack_tops)[num_unique++] = id;
+    }
+  }
+  stack_tops->resize(num_unique);
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
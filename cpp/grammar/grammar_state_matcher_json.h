@@ -0,0 +1,569 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file grammar/grammar_state_matcher_json.h
+ * \brief The specialized matcher of the built-in JSON grammar. It replaces the generic matcher
+ * for the response format json_object without a schema, the most common structured output.
+ */
+#ifndef MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_JSON_H_
+#define MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_JSON_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../support/dynamic_bitset.h"
+#include "../support/encoding.h"
+#include "grammar_state_matcher.h"
+#include "grammar_state_matcher_preproc.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The state of the JSON matcher, which is an explicit pushdown automaton over bytes. It
+ * accepts exactly the language of BNFGrammar::GetGrammarOfJSON: a top-level object or array,
+ * whitespaces of [ \n\t] between the tokens and no trailing whitespace.
+ * \details The state consists of a lexical state and the stack of the open containers. Unlike
+ * the stacks of the generic matcher, it is small and cheap to copy, so the matcher keeps a whole
+ * state for each token of the history.
+ */
+struct JSONMatcherState {
+  /*! \brief The lexical state. */
+  enum Kind : uint8_t {
+    // Before the top-level object or array.
+    kStart,
+    // After "{", expecting a key or "}".
+    kObjectFirst,
+    // After "," in an object, expecting a key.
+    kObjectKey,
+    // After a key, expecting ":".
+    kColon,
+    // After ":", or after "," in an array, expecting a value.
+    kValue,
+    // After "[", expecting a value or "]".
+    kArrayFirst,
+    // After a value in a container, expecting "," or the close of the container.
+    kAfterValue,
+    // In a string. aux is the number of pending UTF-8 continuation bytes.
+    kString,
+    // After "\" in a string.
+    kEscape,
+    // In "\uXXXX" of a string. aux is the number of pending hex digits.
+    kUnicode,
+    // In true, false or null. literal is the index in kLiterals, and aux the number of matched
+    // characters.
+    kLiteral,
+    // In a number, after "-", after the leading "0", in the integer digits, after ".", in the
+    // fraction digits, after "e" or "E", after the exponent sign, and in the exponent digits.
+    kNumMinus,
+    kNumZero,
+    kNumInt,
+    kNumDot,
+    kNumFrac,
+    kNumExp,
+    kNumExpSign,
+    kNumExpDigits,
+    // After the top-level value, expecting the stop token.
+    kEnd,
+    // After the stop token.
+    kTerminated,
+  };
+
+  /*! \brief The literals of JSON. */
+  static constexpr const char* kLiterals[] = {"true", "false", "null"};
+
+  Kind kind = kStart;
+  uint8_t aux = 0;
+  uint8_t literal = 0;
+  /*! \brief Whether the string is an object key. */
+  bool in_key = false;
+  /*! \brief The open containers from the outermost, each "{" or "[". */
+  std::string stack;
+
+  /*!
+   * \brief Accept one byte of the output.
+   * \return Whether the byte is accepted. The state is unspecified when the byte is rejected.
+   */
+  bool AcceptByte(uint8_t byte);
+
+  /*!
+   * \brief Get the key of the state in the table of the token masks. A token closes at most as
+   * many containers as its bytes, so the key only has the top entries of the stack up to the max
+   * token length, and a flag of whether the stack is deeper, which tells if the stack can be
+   * emptied by a token. The deep containers thus do not add states to the table.
+   * \param key The key to write to.
+   * \param max_token_length The max byte length of the tokens.
+   */
+  void GetMaskKey(std::vector<int32_t>* key, int max_token_length) const {
+    int num_stack_entries = std::min<int>(stack.size(), max_token_length);
+    bool is_truncated = static_cast<int>(stack.size()) > num_stack_entries;
+    key->assign({static_cast<int32_t>(kind) | (static_cast<int32_t>(aux) << 8) |
+                 (static_cast<int32_t>(literal) << 16) | (static_cast<int32_t>(in_key) << 24) |
+                 (static_cast<int32_t>(is_truncated) << 25)});
+    key->insert(key->end(), stack.end() - num_stack_entries, stack.end());
+  }
+
+ private:
+  static bool IsWhitespace(uint8_t byte) { return byte == ' ' || byte == '\n' || byte == '\t'; }
+
+  static bool IsDigit(uint8_t byte) { return byte >= '0' && byte <= '9'; }
+
+  /*! \brief Accept the first byte of a value. */
+  bool StartValue(uint8_t byte);
+
+  /*! \brief Finish a value, which is the top-level value if the stack is empty. */
+  void EndValue() {
+    kind = stack.empty() ? kEnd : kAfterValue;
+    aux = 0;
+  }
+};
+
+inline bool JSONMatcherState::StartValue(uint8_t byte) {
+  switch (byte) {
+    case '{':
+    case '[':
+      stack.push_back(byte);
+      kind = byte == '{' ? kObjectFirst : kArrayFirst;
+      return true;
+    case '"':
+      kind = kString;
+      in_key = false;
+      return true;
+    case '-':
+      kind = kNumMinus;
+      return true;
+    case '0':
+      kind = kNumZero;
+      return true;
+    case 't':
+    case 'f':
+    case 'n':
+      kind = kLiteral;
+      literal = byte == 't' ? 0 : (byte == 'f' ? 1 : 2);
+      aux = 1;
+      return true;
+    default:
+      if (byte >= '1' && byte <= '9') {
+        kind = kNumInt;
+        return true;
+      }
+      return false;
+  }
+}
+
+inline bool JSONMatcherState::AcceptByte(uint8_t byte) {
+  switch (kind) {
+    case kStart:
+      if (byte != '{' && byte != '[') {
+        return false;
+      }
+      return StartValue(byte);
+    case kObjectFirst:
+      if (byte == '}') {
+        stack.pop_back();
+        EndValue();
+        return true;
+      }
+      [[fallthrough]];
+    case kObjectKey:
+      if (IsWhitespace(byte)) {
+        return true;
+      }
+      if (byte != '"') {
+        return false;
+      }
+      kind = kString;
+      in_key = true;
+      return true;
+    case kColon:
+      if (IsWhitespace(byte)) {
+        return true;
+      }
+      if (byte != ':') {
+        return false;
+      }
+      kind = kValue;
+      return true;
+    case kArrayFirst:
+      if (byte == ']') {
+        stack.pop_back();
+        EndValue();
+        return true;
+      }
+      [[fallthrough]];
+    case kValue:
+      return IsWhitespace(byte) || StartValue(byte);
+    case kAfterValue:
+      if (IsWhitespace(byte)) {
+        return true;
+      }
+      if (byte == ',') {
+        kind = stack.back() == '{' ? kObjectKey : kValue;
+        return true;
+      }
+      if (byte != (stack.back() == '{' ? '}' : ']')) {
+        return false;
+      }
+      stack.pop_back();
+      EndValue();
+      return true;
+    case kString:
+      if (aux > 0) {
+        if ((byte & 0xC0) != 0x80) {
+          return false;
+        }
+        --aux;
+        return true;
+      }
+      if (byte == '"') {
+        kind = in_key ? kColon : kAfterValue;
+        in_key = false;
+        return true;
+      }
+      if (byte == '\\') {
+        kind = kEscape;
+        return true;
+      }
+      if (byte < 0x20) {
+        return false;
+      }
+      if (byte < 0x80) {
+        return true;
+      }
+      if (byte >= 0xF8 || (byte & 0xC0) == 0x80) {
+        return false;
+      }
+      aux = byte >= 0xF0 ? 3 : (byte >= 0xE0 ? 2 : 1);
+      return true;
+    case kEscape:
+      if (byte == 'u') {
+        kind = kUnicode;
+        aux = 4;
+        return true;
+      }
+      if (byte != '"' && byte != '\\' && byte != '/' && byte != 'b' && byte != 'f' &&
+          byte != 'n' && byte != 'r' && byte != 't') {
+        return false;
+      }
+      kind = kString;
+      return true;
+    case kUnicode:
+      if (!IsDigit(byte) && !(byte >= 'a' && byte <= 'f') && !(byte >= 'A' && byte <= 'F')) {
+        return false;
+      }
+      if (--aux == 0) {
+        kind = kString;
+      }
+      return true;
+    case kLiteral:
+      if (byte != kLiterals[literal][aux]) {
+        return false;
+      }
+      if (kLiterals[literal][++aux] == '\0') {
+        EndValue();
+      }
+      return true;
+    case kNumMinus:
+      if (byte == '0') {
+        kind = kNumZero;
+        return true;
+      }
+      if (byte >= '1' && byte <= '9') {
+        kind = kNumInt;
+        return true;
+      }
+      return false;
+    case kNumDot:
+    case kNumExpSign:
+      if (!IsDigit(byte)) {
+        return false;
+      }
+      kind = kind == kNumDot ? kNumFrac : kNumExpDigits;
+      return true;
+    case kNumExp:
+      if (byte == '+' || byte == '-') {
+        kind = kNumExpSign;
+        return true;
+      }
+      if (!IsDigit(byte)) {
+        return false;
+      }
+      kind = kNumExpDigits;
+      return true;
+    case kNumInt:
+    case kNumFrac:
+    case kNumExpDigits:
+      if (IsDigit(byte)) {
+        return true;
+      }
+      [[fallthrough]];
+    case kNumZero:
+      if (byte == '.' && (kind == kNumZero || kind == kNumInt)) {
+        kind = kNumDot;
+        return true;
+      }
+      if ((byte == 'e' || byte == 'E') && kind != kNumExpDigits) {
+        kind = kNumExp;
+        return true;
+      }
+      // The number ends before the byte. A number is never the top-level value.
+      EndValue();
+      return AcceptByte(byte);
+    default:
+      return false;
+  }
+}
+
+/*!
+ * \brief Compute the mask of the tokens acceptable from the JSON matcher state. The mask does
+ * not include the stop tokens, which can be overridden by SetStopTokenIds.
+ * \param init_ctx The init context holding the tokenizer information.
+ * \param state The state of the JSON matcher.
+ * \param bitmask The buffer of the mask, of ceil(vocab_size, 32) words.
+ */
+inline void ComputeJSONTokenMask(const GrammarStateInitContext& init_ctx,
+                                 const JSONMatcherState& state, uint32_t* bitmask) {
+  DynamicBitset bitset(init_ctx.vocab_size, bitmask);
+  bitset.Reset();
+  // path[i] is the state after the first i bytes of the current token. The tokens are sorted,
+  // so the state of the common prefix with the previous token is reused.
+  std::vector<JSONMatcherState> path{state};
+  const std::string* prev_token = nullptr;
+  int prev_matched_size = 0;
+  for (const auto& [token_id, token] : init_ctx.sorted_token_table) {
+    bool accepted = true;
+    int matched_size = 0;
+    if (prev_token != nullptr) {
+      int lcp_len =
+          std::mismatch(token.begin(), token.end(), prev_token->begin(), prev_token->end()).first -
+          token.begin();
+      // The previous token is rejected at a byte that the current token shares.
+      accepted = lcp_len <= prev_matched_size;
+      matched_size = std::min(prev_matched_size, lcp_len);
+    }
+    if (accepted) {
+      if (path.size() < token.size() + 1) {
+        path.resize(token.size() + 1);
+      }
+      for (; matched_size < static_cast<int>(token.size()); ++matched_size) {
+        path[matched_size + 1] = path[matched_size];
+        if (!path[matched_size + 1].AcceptByte(token[matched_size])) {
+          accepted = false;
+          break;
+        }
+      }
+    }
+    if (accepted) {
+      bitset.Set(token_id, true);
+    }
+    prev_token = &token;
+    prev_matched_size = matched_size;
+  }
+}
+
+/*!
+ * \brief Enable the JSON matcher for the init context of the built-in JSON grammar, whose
+ * tokenizer information is set. The masks of the common states, i.e. the structural states in
+ * the containers of up to two levels, are computed here, and the other states are computed at
+ * the first visit by a matcher.
+ * \param num_threads The number of threads to compute the masks with.
+ */
+inline void InitJSONStateMatcherOfInitContext(GrammarStateInitContext* ptr, int num_threads) {
+  ICHECK_GT(ptr->vocab_size, 0);
+  int bitmask_size = DynamicBitset::CalculateBufferSize(ptr->vocab_size);
+  ptr->json_token_masks = std::make_shared<TokenMaskDFA>(bitmask_size);
+  ptr->json_max_token_length = 0;
+  for (const auto& [token_id, token] : ptr->sorted_token_table) {
+    ptr->json_max_token_length =
+        std::max(ptr->json_max_token_length, static_cast<int>(token.size()));
+  }
+
+  std::vector<JSONMatcherState> states(1);
+  for (const char* stack : {"{", "[", "{{", "{[", "[{", "[["}) {
+    JSONMatcherState state;
+    state.stack = stack;
+    bool in_object = state.stack.back() == '{';
+    for (auto kind : {JSONMatcherState::kObjectFirst, JSONMatcherState::kObjectKey,
+                      JSONMatcherState::kColon, JSONMatcherState::kValue,
+                      JSONMatcherState::kArrayFirst, JSONMatcherState::kAfterValue,
+                      JSONMatcherState::kString}) {
+      bool object_only = kind == JSONMatcherState::kObjectFirst ||
+                         kind == JSONMatcherState::kObjectKey || kind == JSONMatcherState::kColon;
+      if ((object_only && !in_object) || (kind == JSONMatcherState::kArrayFirst && in_object)) {
+        continue;
+      }
+      state.kind = kind;
+      states.push_back(state);
+      if (kind == JSONMatcherState::kString && in_object) {
+        state.in_key = true;
+        states.push_back(state);
+        state.in_key = false;
+      }
+    }
+  }
+
+  num_threads = std::max(std::min<int>(num_threads, states.size()), 1);
+  auto f_compute_masks = [&](int thread_id) {
+    std::vector<uint32_t> bitmask(bitmask_size);
+    std::vector<int32_t> key;
+    for (int i = thread_id; i < static_cast<int>(states.size()); i += num_threads) {
+      ComputeJSONTokenMask(*ptr, states[i], bitmask.data());
+      states[i].GetMaskKey(&key, ptr->json_max_token_length);
+      ptr->json_token_masks->AddState(key, bitmask.data());
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int thread_id = 1; thread_id < num_threads; ++thread_id) {
+    workers.emplace_back(f_compute_masks, thread_id);
+  }
+  f_compute_masks(0);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+/*!
+ * \brief The matcher of the built-in JSON grammar. It has the same behavior as the generic
+ * matcher of the grammar, but finds the next token mask by a table fetch keyed by its state.
+ */
+class JSONStateMatcherNodeImpl : public GrammarStateMatcherNode {
+ public:
+  JSONStateMatcherNodeImpl(std::shared_ptr<GrammarStateInitContext> init_ctx,
+                           int max_rollback_steps = 0)
+      : init_ctx_(std::move(init_ctx)), max_rollback_steps_(max_rollback_steps), history_(1) {
+    ICHECK(init_ctx_->json_token_masks != nullptr);
+  }
+
+  bool AcceptToken(int32_t token_id, bool verbose = false) final;
+
+  void FindNextTokenBitmask(DLTensor* next_token_bitmask) final;
+
+  std::string FindJumpForwardString() final;
+
+  void Rollback(int num_tokens) final {
+    CHECK(num_tokens < static_cast<int>(history_.size()))
+        << "Intended to rollback " << num_tokens << " tokens, but only the last "
+        << history_.size() - 1 << " steps of history are saved";
+    history_.erase(history_.end() - num_tokens, history_.end());
+  }
+
+  int MaxRollbackSteps() const final { return max_rollback_steps_; }
+
+  bool IsTerminated() const final {
+    return history_.back().kind == JSONMatcherState::kTerminated;
+  }
+
+  void ResetState() final { history_.assign(1, JSONMatcherState()); }
+
+  void SetStopTokenIds(const std::vector<int32_t>& stop_token_ids) final {
+    init_ctx_->stop_token_ids = stop_token_ids;
+  }
+
+  /*! \brief Get the init context of the matcher. */
+  const std::shared_ptr<GrammarStateInitContext>& GetInitContext() const { return init_ctx_; }
+
+ private:
+  /*! \brief Push the state after a token, discarding the history beyond the rollback steps. */
+  void PushState(JSONMatcherState state) {
+    history_.push_back(std::move(state));
+    while (static_cast<int>(history_.size()) > max_rollback_steps_ + 1) {
+      history_.pop_front();
+    }
+  }
+
+  std::shared_ptr<GrammarStateInitContext> init_ctx_;
+  int max_rollback_steps_;
+  /*! \brief The initial state and the states after the last tokens, the latest at the back. */
+  std::deque<JSONMatcherState> history_;
+  // Temporary data for FindNextTokenBitmask, stored here to avoid repeated allocation.
+  std::vector<int32_t> tmp_mask_key_;
+};
+
+inline bool JSONStateMatcherNodeImpl::AcceptToken(int32_t token_id, bool verbose) {
+  CHECK(!IsTerminated())
+      << "GrammarStateMatcher has terminated after accepting the stop token, but is trying to "
+         "accept another token id "
+      << token_id;
+  CHECK(token_id >= 0 && token_id < init_ctx_->vocab_size)
+      << "Invalid token id " << token_id << " for GrammarStateMatcher";
+
+  if (std::find(init_ctx_->stop_token_ids.begin(), init_ctx_->stop_token_ids.end(), token_id) !=
+      init_ctx_->stop_token_ids.end()) {
+    if (history_.back().kind != JSONMatcherState::kEnd) {
+      return false;
+    }
+    JSONMatcherState state;
+    state.kind = JSONMatcherState::kTerminated;
+    PushState(std::move(state));
+    return true;
+  }
+  if (init_ctx_->special_token_ids.count(token_id) > 0) {
+    LOG(FATAL)
+        << "Token id " << token_id << ": " << init_ctx_->token_table[token_id]
+        << " is regarded as a special token, and cannot be accepted by the GrammarStateMatcher";
+  }
+
+  const std::string& token = init_ctx_->token_table[token_id];
+  JSONMatcherState state = history_.back();
+  for (int pos = 0; pos < static_cast<int>(token.size()); ++pos) {
+    if (!state.AcceptByte(token[pos])) {
+      if (verbose) {
+        LOG(INFO) << "The token \"" << PrintAsEscaped(token) << "\" is rejected at position "
+                  << pos;
+      }
+      return false;
+    }
+  }
+  PushState(std::move(state));
+  return true;
+}
+
+inline void JSONStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitmask) {
+  CHECK(!IsTerminated())
+      << "GrammarStateMatcher has terminated after accepting the stop token, but is trying to "
+         "find the next token mask";
+  CHECK(next_token_bitmask->ndim == 1 &&
+        next_token_bitmask->shape[0] >= DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size))
+      << "The provied bitmask's shape is not valid.";
+  uint32_t* data = reinterpret_cast<uint32_t*>(next_token_bitmask->data);
+  const JSONMatcherState& state = history_.back();
+  state.GetMaskKey(&tmp_mask_key_, init_ctx_->json_max_token_length);
+  if (!init_ctx_->json_token_masks->FindMask(tmp_mask_key_, data)) {
+    ComputeJSONTokenMask(*init_ctx_, state, data);
+    init_ctx_->json_token_masks->AddState(tmp_mask_key_, data);
+  }
+
+  DynamicBitset next_token_bitset(next_token_bitmask->shape[0] * 32, data);
+  if (state.kind == JSONMatcherState::kEnd) {
+    for (int id : init_ctx_->stop_token_ids) {
+      next_token_bitset.Set(id, true);
+    }
+  }
+  // Mask out the padded tokens beyond the vocabulary.
+  next_token_bitset.SetRange(init_ctx_->vocab_size, next_token_bitmask->shape[0] * 32, false);
+}
+
+inline std::string JSONStateMatcherNodeImpl::FindJumpForwardString() {
+  CHECK(!IsTerminated())
+      << "GrammarStateMatcher has terminated after accepting the stop token, but is trying to "
+         "get the jump forward string";
+  // In JSON, the next bytes are only determined in the literals.
+  const JSONMatcherState& state = history_.back();
+  if (state.kind != JSONMatcherState::kLiteral) {
+    return "";
+  }
+  return JSONMatcherState::kLiterals[state.literal] + state.aux;
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_JSON_H_
@@ -6,13 +6,29 @@
 #ifndef MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_PREPROC_H_
 #define MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_PREPROC_H_
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "../support/dynamic_bitset.h"
 #include "../support/encoding.h"
 #include "../support/utils.h"
 #include "grammar.h"
+#include "grammar_functor.h"
+#include "grammar_serializer.h"
 #include "grammar_state_matcher_base.h"
+#include "json_schema_converter.h"
 
 namespace mlc {
 namespace llm {
@@ -63,6 +79,81 @@ struct CatagorizedTokens {
                     const std::vector<int32_t>& uncertain_indices);
 };
 
+/*!
+ * \brief The token-level DFA of a regular grammar. The matcher of a regular grammar can only
+ * reach finitely many states, which are the states of the DFA. For each state, the DFA stores
+ * the next token bitmask, so finding the mask of a known state is a table fetch instead of
+ * matching the uncertain tokens against the stacks.
+ * \details A state is keyed by the canonical form of the matcher stacks, see
+ * GrammarStateMatcherNodeImpl. The states are explored lazily: a state is added when a matcher
+ * first reaches it, and is shared by all the matchers of the init context. The number of states
+ * is capped by the memory of the masks. Thread safe.
+ */
+class TokenMaskDFA {
+ public:
+  /*! \param bitmask_size The number of uint32 words of a mask. */
+  explicit TokenMaskDFA(int bitmask_size)
+      : bitmask_size_(bitmask_size),
+        max_num_states_(std::max<int64_t>(kMaxNumBytes / (bitmask_size * sizeof(uint32_t)), 1)) {}
+
+  /*!
+   * \brief Copy the mask of the given state into the bitmask.
+   * \return Whether the state is found.
+   */
+  bool FindMask(const std::vector<int32_t>& state, uint32_t* bitmask) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = state_ids_.find(state);
+    if (it == state_ids_.end()) {
+      return false;
+    }
+    std::memcpy(bitmask, masks_.data() + static_cast<int64_t>(it->second) * bitmask_size_,
+                bitmask_size_ * sizeof(uint32_t));
+    return true;
+  }
+
+  /*! \brief Add the state with its mask. Do nothing if the state exists or the DFA is full. */
+  void AddState(const std::vector<int32_t>& state, const uint32_t* bitmask) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (static_cast<int64_t>(state_ids_.size()) >= max_num_states_ || state_ids_.count(state)) {
+      return;
+    }
+    int32_t state_id = state_ids_.size();
+    state_ids_.emplace(state, state_id);
+    masks_.insert(masks_.end(), bitmask, bitmask + bitmask_size_);
+  }
+
+  /*! \brief The number of explored states. */
+  int NumStates() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return state_ids_.size();
+  }
+
+ private:
+  struct StateHash {
+    std::size_t operator()(const std::vector<int32_t>& state) const noexcept {
+      uint32_t seed = state.size();
+      for (int32_t value : state) {
+        HashCombineBinary(seed, value);
+      }
+      return seed;
+    }
+  };
+
+  /*! \brief The max total bytes of the masks. */
+  static constexpr int64_t kMaxNumBytes = 64LL << 20;
+
+  /*! \brief The number of uint32 words of a mask. */
+  int bitmask_size_;
+  /*! \brief The max number of states. */
+  int64_t max_num_states_;
+  /*! \brief The mutex guarding the states. */
+  mutable std::shared_mutex mutex_;
+  /*! \brief Mapping from the states to the state ids. */
+  std::unordered_map<std::vector<int32_t>, int32_t, StateHash> state_ids_;
+  /*! \brief The masks of the states, of shape (num_states, bitmask_size). */
+  std::vector<uint32_t> masks_;
+};
+
 /*!
  * \brief All information that we need to match tokens in the tokenizer to the specified grammar.
  * It is the result of preprocessing.
@@ -111,8 +202,24 @@ class GrammarStateInitContext {
   /*! \brief Mapping from RulePositions to the catagorized tokens. */
   std::unordered_map<RulePosition, CatagorizedTokens, RulePositionHash, RulePositionEqual>
       catagorized_tokens_for_grammar;
+  /*! \brief The token-level DFA if the grammar is regular, or nullptr otherwise. */
+  std::shared_ptr<TokenMaskDFA> token_mask_dfa;
+  /*!
+   * \brief The token masks of the states of the JSON matcher, keyed by JSONMatcherState, if the
+   * init context is for the JSON matcher, or nullptr otherwise. When it is set, GrammarStateMatcher
+   * uses the JSON matcher in place of the generic matcher, and the catagorized tokens are unused.
+   */
+  std::shared_ptr<TokenMaskDFA> json_token_masks;
+  /*!
+   * \brief The max byte length of the tokens. A token closes at most this number of containers,
+   * so only the top entries of the container stack up to this number key the JSON token masks.
+   */
+  int json_max_token_length = 0;
 };
 
+/*! \brief Enable the JSON matcher for the init context. See grammar_state_matcher_json.h. */
+inline void InitJSONStateMatcherOfInitContext(GrammarStateInitContext* ptr, int num_threads);
+
 /*! \brief The concrete implementation of GrammarStateMatcherNode. */
 class GrammarStateMatcherForInitContext : public GrammarStateMatcherBase {
  public:
@@ -131,6 +238,17 @@ class GrammarStateMatcherForInitContext : public GrammarStateMatcherBase {
       int vocab_size, const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
       bool consider_parent_rule);
 
+  /*!
+   * \brief Catagorize the tokens in [begin, end) of the sorted token table, and append their
+   * indices to the accepted, rejected and uncertain indices. Disjoint ranges can be catagorized
+   * by different matchers in parallel, and the results concatenated in range order.
+   */
+  void CatagorizeTokenRange(const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
+                            bool consider_parent_rule, int begin, int end,
+                            std::vector<int32_t>* accepted_indices,
+                            std::vector<int32_t>* rejected_indices,
+                            std::vector<int32_t>* uncertain_indices);
+
  private:
   using RuleExpr = BNFGrammarNode::RuleExpr;
   using RuleExprType = BNFGrammarNode::RuleExprType;
@@ -225,21 +343,30 @@ inline CatagorizedTokens GrammarStateMatcherForInitContext::GetCatagorizedTokens
   tmp_accepted_indices_.clear();
   tmp_rejected_indices_.clear();
   tmp_uncertain_indices_.clear();
+  CatagorizeTokenRange(sorted_token_table, consider_parent_rule, 0, sorted_token_table.size(),
+                       &tmp_accepted_indices_, &tmp_rejected_indices_, &tmp_uncertain_indices_);
+  return CatagorizedTokens(vocab_size, sorted_token_table, tmp_accepted_indices_,
+                           tmp_rejected_indices_, tmp_uncertain_indices_);
+}
 
+inline void GrammarStateMatcherForInitContext::CatagorizeTokenRange(
+    const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
+    bool consider_parent_rule, int begin, int end, std::vector<int32_t>* accepted_indices,
+    std::vector<int32_t>* rejected_indices, std::vector<int32_t>* uncertain_indices) {
   // For every character in the current token, stores whether it is possible to reach the end of
   // the rule when matching until this character. Store it in a stack for later rollback.
   tmp_can_reach_end_stack_.assign({CanReachEnd()});
   tmp_can_reach_end_prefix_or_stack_.assign({tmp_can_reach_end_stack_.back()});
 
   int prev_matched_size = 0;
-  for (int i = 0; i < static_cast<int>(sorted_token_table.size()); ++i) {
+  for (int i = begin; i < end; ++i) {
     const auto& token = sorted_token_table[i].second;
 
     bool accepted = true;
 
     // Many tokens may contain the same prefix, so we will avoid unnecessary matching
     // by finding the longest common prefix with the previous token.
-    if (i > 0) {
+    if (i > begin) {
       const auto& prev_token = sorted_token_table[i - 1].second;
       int lcp_len =
           std::mismatch(token.begin(), token.end(), prev_token.begin(), prev_token.end()).first -
@@ -278,36 +405,30 @@ inline CatagorizedTokens GrammarStateMatcherForInitContext::GetCatagorizedTokens
     bool can_reach_end = tmp_can_reach_end_prefix_or_stack_.back();
 
     if (accepted) {
-      tmp_accepted_indices_.push_back(i);
+      accepted_indices->push_back(i);
     } else if (can_reach_end && consider_parent_rule &&
                IsTokenPassLookaheadAssertion(token, tmp_can_reach_end_stack_)) {
       // 1. If the current rule is the main rule (consider_parent_rule=false), there are no
       // uncertain tokens. Not accepted tokens are just rejected.
       // 2. If a token cannot pass the lookahead assertion, it is rejected.
-      tmp_uncertain_indices_.push_back(i);
+      uncertain_indices->push_back(i);
     } else {
-      tmp_rejected_indices_.push_back(i);
+      rejected_indices->push_back(i);
     }
   }
   // Rollback the last matched part
   RollbackChars(prev_matched_size);
-  return CatagorizedTokens(vocab_size, sorted_token_table, tmp_accepted_indices_,
-                           tmp_rejected_indices_, tmp_uncertain_indices_);
 }
 
-inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitContext(
-    const BNFGrammar& grammar, const std::vector<std::string>& token_table) {
-  using RuleExprType = BNFGrammarNode::RuleExprType;
-  auto ptr = std::make_shared<GrammarStateInitContext>();
-
-  ptr->grammar = grammar;
+/*!
+ * \brief Set the tokenizer information of the init context from the token table. The information
+ * does not depend on the grammar.
+ */
+inline void SetTokenizerInfoOfInitContext(GrammarStateInitContext* ptr,
+                                          const std::vector<std::string>& token_table) {
   ptr->vocab_size = token_table.size();
   ptr->token_table = token_table;
 
-  if (ptr->vocab_size == 0) {
-    return ptr;
-  }
-
   for (int i = 0; i < token_table.size(); ++i) {
     const auto& token = token_table[i];
     // TODO(yixin): Now we detect stop tokens from the token string. We should be able to pass
@@ -333,11 +454,27 @@ inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitC
     return a.second < b.second;
   };
   std::sort(ptr->sorted_token_table.begin(), ptr->sorted_token_table.end(), f_compare_token);
+}
 
-  // Find the corresponding catagorized tokens for:
+/*!
+ * \brief Find the catagorized tokens of the grammar of the init context, whose tokenizer
+ * information is already set.
+ * \param num_threads The number of threads to catagorize the tokens with. The sorted token
+ * table is split into contiguous ranges, and each thread matches one range for all rule
+ * positions.
+ */
+inline void CatagorizeTokensOfInitContext(GrammarStateInitContext* ptr, int num_threads = 1) {
+  using RuleExprType = BNFGrammarNode::RuleExprType;
+  const BNFGrammar& grammar = ptr->grammar;
+  if (ptr->vocab_size == 0) {
+    return;
+  }
+
+  // Find the rule positions to catagorize the tokens for:
   // 1. All character class or character class star (with last_utf8_bytes=0, 1, 2, 3)
   // 2. All byte strings (with element_in_string=0, 1, 2, ...)
   auto main_rule_id = grammar->GetMainRuleId();
+  std::vector<RulePosition> rule_positions;
   for (int rule_id = 0; rule_id < static_cast<int>(grammar->NumRules()); ++rule_id) {
     auto rule = grammar->GetRule(rule_id);
     auto rule_body = grammar->GetRuleExpr(rule.body_expr_id);
@@ -354,70 +491,456 @@ inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitC
           continue;
         }
 
-        auto add_catagorized_tokens = [&](const RulePosition& rule_position) {
-          auto grammar_state_matcher = GrammarStateMatcherForInitContext(grammar, rule_position);
-          auto cur_catagorized_tokens_for_grammar = grammar_state_matcher.GetCatagorizedTokens(
-              ptr->vocab_size, ptr->sorted_token_table, rule_id != main_rule_id);
-          ptr->catagorized_tokens_for_grammar[rule_position] = cur_catagorized_tokens_for_grammar;
-        };
-
         auto cur_rule_position = RulePosition(rule_id, sequence_id, element_id);
         if (element.type == RuleExprType::kByteString) {
           for (int idx = 0; idx < element.size(); ++idx) {
             cur_rule_position.element_in_string = idx;
-            add_catagorized_tokens(cur_rule_position);
+            rule_positions.push_back(cur_rule_position);
           }
         } else {
           DCHECK(element.type == RuleExprType::kCharacterClassStar ||
                  element.type == RuleExprType::kCharacterClass);
           for (int left_utf8_bytes = 0; left_utf8_bytes <= 3; ++left_utf8_bytes) {
             cur_rule_position.left_utf8_bytes = left_utf8_bytes;
-            add_catagorized_tokens(cur_rule_position);
+            rule_positions.push_back(cur_rule_position);
           }
         }
       }
     }
   }
+
+  // Each range has at least kMinTokensPerThread tokens, so that the matching work outweighs
+  // the thread launch and the lost prefix sharing at the range boundaries.
+  constexpr int kMinTokensPerThread = 2048;
+  int num_tokens = ptr->sorted_token_table.size();
+  num_threads = std::max(std::min(num_threads, num_tokens / kMinTokensPerThread), 1);
+  int num_positions = rule_positions.size();
+  // indices[range][position] are the accepted, rejected and uncertain indices.
+  std::vector<std::vector<std::array<std::vector<int32_t>, 3>>> indices(
+      num_threads, std::vector<std::array<std::vector<int32_t>, 3>>(num_positions));
+  auto f_catagorize_range = [&](int range_id) {
+    int begin = static_cast<int64_t>(num_tokens) * range_id / num_threads;
+    int end = static_cast<int64_t>(num_tokens) * (range_id + 1) / num_threads;
+    for (int i = 0; i < num_positions; ++i) {
+      auto grammar_state_matcher = GrammarStateMatcherForInitContext(grammar, rule_positions[i]);
+      auto& [accepted, rejected, uncertain] = indices[range_id][i];
+      grammar_state_matcher.CatagorizeTokenRange(ptr->sorted_token_table,
+                                                 rule_positions[i].rule_id != main_rule_id, begin,
+                                                 end, &accepted, &rejected, &uncertain);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int range_id = 1; range_id < num_threads; ++range_id) {
+    workers.emplace_back(f_catagorize_range, range_id);
+  }
+  f_catagorize_range(0);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  // Concatenate the indices of the ranges in order. The indices stay sorted.
+  for (int i = 0; i < num_positions; ++i) {
+    std::array<std::vector<int32_t>, 3> merged = std::move(indices[0][i]);
+    for (int range_id = 1; range_id < num_threads; ++range_id) {
+      for (int k = 0; k < 3; ++k) {
+        merged[k].insert(merged[k].end(), indices[range_id][i][k].begin(),
+                         indices[range_id][i][k].end());
+      }
+    }
+    ptr->catagorized_tokens_for_grammar[rule_positions[i]] = CatagorizedTokens(
+        ptr->vocab_size, ptr->sorted_token_table, merged[0], merged[1], merged[2]);
+  }
+}
+
+/*!
+ * \brief Create the token-level DFA of the grammar of the init context if the grammar is
+ * regular. The DFA states are explored during matching.
+ */
+inline void InitTokenMaskDFAOfInitContext(GrammarStateInitContext* ptr) {
+  if (ptr->vocab_size > 0 && RegularGrammarDetector().Apply(ptr->grammar)) {
+    ptr->token_mask_dfa =
+        std::make_shared<TokenMaskDFA>(DynamicBitset::CalculateBufferSize(ptr->vocab_size));
+  }
+}
+
+inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitContext(
+    const BNFGrammar& grammar, const std::vector<std::string>& token_table) {
+  auto ptr = std::make_shared<GrammarStateInitContext>();
+  ptr->grammar = grammar;
+  SetTokenizerInfoOfInitContext(ptr.get(), token_table);
+  CatagorizeTokensOfInitContext(ptr.get(), std::max<int>(std::thread::hardware_concurrency(), 1));
+  InitTokenMaskDFAOfInitContext(ptr.get());
   return ptr;
 }
 
+/*!
+ * \brief The on-disk cache of the catagorized tokens of grammars, so that the preprocessing of
+ * a grammar is shared by engine restarts and replicas. Each grammar is stored in a file named by
+ * the hash of the grammar and the hash of the token table.
+ * \details The file is a flat little-endian binary that can be memory mapped. All fields are
+ * 4-byte aligned:
+ *  - header: magic (uint64), version (uint32), vocab_size (uint32), grammar_hash (uint64),
+ *    tokenizer_hash (uint64), num_entries (uint64);
+ *  - each entry: rule_id, sequence_id, element_id, left_utf8_bytes, element_in_string,
+ *    save_type, num_accepted, num_rejected, num_uncertain, num_bitset_words (all int32),
+ *    followed by the int32 accepted, rejected and uncertain indices and the uint32 bitset words.
+ */
+class GrammarInitContextDiskCache {
+ public:
+  GrammarInitContextDiskCache() = default;
+
+  /*!
+   * \brief Construct the disk cache in the given directory for the given token table.
+   * \param cache_dir The cache directory. Empty means the disk cache is disabled.
+   * \param token_table The token table of the init contexts.
+   */
+  GrammarInitContextDiskCache(std::string cache_dir, const std::vector<std::string>& token_table)
+      : cache_dir_(std::move(cache_dir)) {
+    tokenizer_hash_ = kFNVOffsetBasis;
+    for (const std::string& token : token_table) {
+      uint64_t length = token.size();
+      tokenizer_hash_ = HashBytes(tokenizer_hash_, &length, sizeof(length));
+      tokenizer_hash_ = HashBytes(tokenizer_hash_, token.data(), token.size());
+    }
+  }
+
+  /*! \brief Whether the disk cache is enabled. */
+  bool Enabled() const { return !cache_dir_.empty(); }
+
+  /*!
+   * \brief Load the catagorized tokens of the grammar of the init context into the init context.
+   * \return Whether the catagorized tokens are found.
+   */
+  bool Load(GrammarStateInitContext* init_ctx) const {
+    uint64_t grammar_hash = HashGrammar(init_ctx->grammar);
+    std::ifstream fin(GetPath(grammar_hash), std::ios::binary);
+    if (!fin.good()) {
+      return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    Reader reader{data.data(), data.data() + data.size()};
+    Header header;
+    if (!reader.Read(&header, 1) || header.magic != kMagic || header.version != kVersion ||
+        header.vocab_size != init_ctx->vocab_size || header.grammar_hash != grammar_hash ||
+        header.tokenizer_hash != tokenizer_hash_) {
+      LOG(WARNING) << "Ignore the mismatched grammar cache file " << GetPath(grammar_hash);
+      return false;
+    }
+    auto f_corrupt = [&]() {
+      LOG(WARNING) << "Ignore the corrupt grammar cache file " << GetPath(grammar_hash);
+      return false;
+    };
+    // The token indices are the indices of the sorted token table.
+    int32_t num_sorted_tokens = init_ctx->sorted_token_table.size();
+    auto f_valid_indices = [&](const std::vector<int32_t>& indices) {
+      return std::all_of(indices.begin(), indices.end(),
+                         [&](int32_t index) { return index >= 0 && index < num_sorted_tokens; });
+    };
+    decltype(init_ctx->catagorized_tokens_for_grammar) catagorized_tokens_for_grammar;
+    for (uint64_t i = 0; i < header.num_entries; ++i) {
+      EntryHeader entry;
+      if (!reader.Read(&entry, 1) || entry.rule_id < 0 ||
+          entry.rule_id >= static_cast<int32_t>(init_ctx->grammar->NumRules()) ||
+          entry.save_type < 0 ||
+          entry.save_type > static_cast<int32_t>(CatagorizedTokens::SaveType::kAcceptedBitset)) {
+        return f_corrupt();
+      }
+      RulePosition rule_position(entry.rule_id, entry.sequence_id, entry.element_id);
+      rule_position.left_utf8_bytes = entry.left_utf8_bytes;
+      rule_position.element_in_string = entry.element_in_string;
+      CatagorizedTokens& tokens = catagorized_tokens_for_grammar[rule_position];
+      tokens.save_type = static_cast<CatagorizedTokens::SaveType>(entry.save_type);
+      if (!reader.ReadVector(&tokens.accepted_indices, entry.num_accepted) ||
+          !reader.ReadVector(&tokens.rejected_indices, entry.num_rejected) ||
+          !reader.ReadVector(&tokens.uncertain_indices, entry.num_uncertain) ||
+          !f_valid_indices(tokens.accepted_indices) || !f_valid_indices(tokens.rejected_indices) ||
+          !f_valid_indices(tokens.uncertain_indices)) {
+        return f_corrupt();
+      }
+      if (tokens.save_type == CatagorizedTokens::SaveType::kAcceptedBitset) {
+        tokens.accepted_bitset = DynamicBitset(init_ctx->vocab_size);
+        if (tokens.accepted_bitset.BufferSize() != entry.num_bitset_words ||
+            !reader.Read(tokens.accepted_bitset.Data(), entry.num_bitset_words)) {
+          return f_corrupt();
+        }
+      } else if (entry.num_bitset_words != 0) {
+        return f_corrupt();
+      }
+    }
+    if (reader.cur != reader.end) {
+      return f_corrupt();
+    }
+    init_ctx->catagorized_tokens_for_grammar = std::move(catagorized_tokens_for_grammar);
+    return true;
+  }
+
+  /*!
+   * \brief Save the catagorized tokens of the init context. The file is written to a temporary
+   * path and then renamed, so that concurrent readers never see a partial file.
+   */
+  void Save(const GrammarStateInitContext& init_ctx) const {
+    uint64_t grammar_hash = HashGrammar(init_ctx.grammar);
+    std::string data;
+    Header header{kMagic,       kVersion,       static_cast<uint32_t>(init_ctx.vocab_size),
+                  grammar_hash, tokenizer_hash_, init_ctx.catagorized_tokens_for_grammar.size()};
+    Append(&data, &header, 1);
+    for (const auto& [rule_position, tokens] : init_ctx.catagorized_tokens_for_grammar) {
+      EntryHeader entry{rule_position.rule_id,
+                        rule_position.sequence_id,
+                        rule_position.element_id,
+                        rule_position.left_utf8_bytes,
+                        rule_position.element_in_string,
+                        static_cast<int32_t>(tokens.save_type),
+                        static_cast<int32_t>(tokens.accepted_indices.size()),
+                        static_cast<int32_t>(tokens.rejected_indices.size()),
+                        static_cast<int32_t>(tokens.uncertain_indices.size()),
+                        tokens.save_type == CatagorizedTokens::SaveType::kAcceptedBitset
+                            ? tokens.accepted_bitset.BufferSize()
+                            : 0};
+      Append(&data, &entry, 1);
+      Append(&data, tokens.accepted_indices.data(), tokens.accepted_indices.size());
+      Append(&data, tokens.rejected_indices.data(), tokens.rejected_indices.size());
+      Append(&data, tokens.uncertain_indices.data(), tokens.uncertain_indices.size());
+      Append(&data, tokens.accepted_bitset.Data(), entry.num_bitset_words);
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(cache_dir_, error);
+    std::string path = GetPath(grammar_hash);
+    std::string tmp_path = path + ".tmp" + std::to_string(std::random_device()());
+    {
+      std::ofstream fout(tmp_path, std::ios::binary);
+      fout.write(data.data(), data.size());
+      if (!fout.good()) {
+        LOG(WARNING) << "Failed to write the grammar cache file " << tmp_path;
+        fout.close();
+        std::filesystem::remove(tmp_path, error);
+        return;
+      }
+    }
+    std::filesystem::rename(tmp_path, path, error);
+    if (error) {
+      std::filesystem::remove(tmp_path, error);
+    }
+  }
+
+ private:
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t vocab_size;
+    uint64_t grammar_hash;
+    uint64_t tokenizer_hash;
+    uint64_t num_entries;
+  };
+
+  struct EntryHeader {
+    int32_t rule_id;
+    int32_t sequence_id;
+    int32_t element_id;
+    int32_t left_utf8_bytes;
+    int32_t element_in_string;
+    int32_t save_type;
+    int32_t num_accepted;
+    int32_t num_rejected;
+    int32_t num_uncertain;
+    int32_t num_bitset_words;
+  };
+
+  /*! \brief The bounds-checked reader of the file data. */
+  struct Reader {
+    const char* cur;
+    const char* end;
+
+    template <typename T>
+    bool Read(T* dst, int64_t count) {
+      int64_t num_bytes = count * static_cast<int64_t>(sizeof(T));
+      if (count < 0 || num_bytes > end - cur) {
+        return false;
+      }
+      std::memcpy(dst, cur, num_bytes);
+      cur += num_bytes;
+      return true;
+    }
+
+    bool ReadVector(std::vector<int32_t>* dst, int64_t count) {
+      if (count < 0 || count * static_cast<int64_t>(sizeof(int32_t)) > end - cur) {
+        return false;
+      }
+      dst->resize(count);
+      return Read(dst->data(), count);
+    }
+  };
+
+  template <typename T>
+  static void Append(std::string* data, const T* src, int64_t count) {
+    data->append(reinterpret_cast<const char*>(src), count * sizeof(T));
+  }
+
+  /*! \brief The FNV-1a hash of the bytes, continuing the given hash. */
+  static uint64_t HashBytes(uint64_t hash, const void* data, size_t num_bytes) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < num_bytes; ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  /*! \brief Hash the grammar by its binary serialization. */
+  static uint64_t HashGrammar(const BNFGrammar& grammar) {
+    return BNFGrammarBinarySerializer::Hash(grammar);
+  }
+
+  std::string GetPath(uint64_t grammar_hash) const {
+    char file_name[64];
+    std::snprintf(file_name, sizeof(file_name), "%016llx_%016llx.bin",
+                  static_cast<unsigned long long>(grammar_hash),
+                  static_cast<unsigned long long>(tokenizer_hash_));
+    return (std::filesystem::path(cache_dir_) / file_name).string();
+  }
+
+  /*! \brief The magic number of the cache files. */
+  static constexpr uint64_t kMagic = 0x4d4c4347524d4331ULL;
+  /*! \brief The version of the cache file format. Bump it when the preprocessing changes. */
+  static constexpr uint32_t kVersion = 2;
+  static constexpr uint64_t kFNVOffsetBasis = 14695981039346656037ULL;
+
+  /*! \brief The cache directory. */
+  std::string cache_dir_;
+  /*! \brief The hash of the token table. */
+  uint64_t tokenizer_hash_ = 0;
+};
+
+/*! \brief Whether the preprocessing of the init context has finished with an exception. */
+inline bool IsFailedInitContext(
+    const std::shared_future<std::shared_ptr<GrammarStateInitContext>>& init_ctx) {
+  if (init_ctx.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    return false;
+  }
+  try {
+    init_ctx.get();
+  } catch (...) {
+    return true;
+  }
+  return false;
+}
+
 class GrammarInitContextCacheImpl : public GrammarInitContextCacheNode {
  public:
-  GrammarInitContextCacheImpl(const std::vector<std::string>& token_table);
+  GrammarInitContextCacheImpl(const std::vector<std::string>& token_table,
+                              const std::string& cache_dir);
 
   std::shared_ptr<GrammarStateInitContext> GetInitContextForJSONSchema(
       const std::string& schema) final;
 
+  std::shared_future<std::shared_ptr<GrammarStateInitContext>> GetInitContextForJSONSchemaAsync(
+      const std::string& schema) final;
+
+  std::shared_future<std::shared_ptr<GrammarStateInitContext>> GetInitContextForRegexAsync(
+      const std::string& regex) final;
+
   std::shared_ptr<GrammarStateInitContext> GetInitContextForJSON() final;
 
   void Clear() final;
 
  private:
-  /*! \brief The token table associated with this storage class. */
-  std::vector<std::string> token_table_;
-  /*! \brief The cache for the init context of a JSON schema. */
-  std::unordered_map<std::string, std::shared_ptr<GrammarStateInitContext>>
+  /*! \brief Create the init context of the grammar, loading it from the disk cache if found. */
+  std::shared_ptr<GrammarStateInitContext> CreateInitContext(const BNFGrammar& grammar) const;
+
+  /*!
+   * \brief The init context holding the tokenizer information only, which is shared by
+   * the init contexts of all grammars.
+   */
+  GrammarStateInitContext tokenizer_init_ctx_;
+  /*! \brief The on-disk cache of the catagorized tokens. */
+  GrammarInitContextDiskCache disk_cache_;
+  /*!
+   * \brief The number of threads to preprocess a grammar with. Half of the hardware threads
+   * are left to the engine, which keeps running while the grammar is preprocessed.
+   */
+  int num_threads_;
+  /*!
+   * \brief The cache for the init context of a JSON schema. The init contexts under
+   * preprocessing are pending futures. It is declared after the members read by the
+   * preprocessing, so that it is destructed first and waits for the preprocessing.
+   */
+  std::unordered_map<std::string, std::shared_future<std::shared_ptr<GrammarStateInitContext>>>
       init_ctx_for_schema_cache_;
+  /*! \brief The cache for the init context of a regex, in the same way as the schema cache. */
+  std::unordered_map<std::string, std::shared_future<std::shared_ptr<GrammarStateInitContext>>>
+      init_ctx_for_regex_cache_;
   /*! \brief The init context for JSON. */
   std::shared_ptr<GrammarStateInitContext> init_ctx_for_json_;
 };
 
 inline GrammarInitContextCacheImpl::GrammarInitContextCacheImpl(
-    const std::vector<std::string>& token_table)
-    : token_table_(token_table) {
-  init_ctx_for_json_ =
-      GrammarStateMatcher::CreateInitContext(BNFGrammar::GetGrammarOfJSON(), token_table_);
+    const std::vector<std::string>& token_table, const std::string& cache_dir)
+    : disk_cache_(cache_dir, token_table),
+      num_threads_(std::max<int>(std::thread::hardware_concurrency() / 2, 1)) {
+  SetTokenizerInfoOfInitContext(&tokenizer_init_ctx_, token_table);
+  if (token_table.empty()) {
+    init_ctx_for_json_ = CreateInitContext(BNFGrammar::GetGrammarOfJSON());
+    return;
+  }
+  // The built-in JSON grammar is matched by the JSON matcher, which needs no catagorized tokens.
+  init_ctx_for_json_ = std::make_shared<GrammarStateInitContext>(tokenizer_init_ctx_);
+  init_ctx_for_json_->grammar = BNFGrammar::GetGrammarOfJSON();
+  InitJSONStateMatcherOfInitContext(init_ctx_for_json_.get(), num_threads_);
+}
+
+inline std::shared_ptr<GrammarStateInitContext> GrammarInitContextCacheImpl::CreateInitContext(
+    const BNFGrammar& grammar) const {
+  auto init_ctx = std::make_shared<GrammarStateInitContext>(tokenizer_init_ctx_);
+  init_ctx->grammar = grammar;
+  InitTokenMaskDFAOfInitContext(init_ctx.get());
+  if (disk_cache_.Enabled() && disk_cache_.Load(init_ctx.get())) {
+    return init_ctx;
+  }
+  CatagorizeTokensOfInitContext(init_ctx.get(), num_threads_);
+  if (disk_cache_.Enabled()) {
+    disk_cache_.Save(*init_ctx);
+  }
+  return init_ctx;
 }
 
 inline std::shared_ptr<GrammarStateInitContext>
 GrammarInitContextCacheImpl::GetInitContextForJSONSchema(const std::string& schema) {
-  auto it = init_ctx_for_schema_cache_.find(schema);
+  return GetInitContextForJSONSchemaAsync(schema).get();
+}
+
+inline std::shared_future<std::shared_ptr<GrammarStateInitContext>>
+GrammarInitContextCacheImpl::GetInitContextForJSONSchemaAsync(const std::string& schema) {
+  // The schemas differing only in the whitespaces share the init context.
+  std::string key = CanonicalizeJSONSchema(schema);
+  auto it = init_ctx_for_schema_cache_.find(key);
   if (it != init_ctx_for_schema_cache_.end()) {
-    return it->second;
+    if (!IsFailedInitContext(it->second)) {
+      return it->second;
+    }
+    // The failed preprocessing is evicted, so that the lookups do not keep the failure.
+    init_ctx_for_schema_cache_.erase(it);
+  }
+  // The worker only reads the members that are immutable after construction.
+  auto init_ctx = std::async(std::launch::async, [this, schema]() {
+                    return CreateInitContext(BNFGrammar::FromSchema(schema));
+                  }).share();
+  init_ctx_for_schema_cache_[key] = init_ctx;
+  return init_ctx;
+}
+
+inline std::shared_future<std::shared_ptr<GrammarStateInitContext>>
+GrammarInitContextCacheImpl::GetInitContextForRegexAsync(const std::string& regex) {
+  auto it = init_ctx_for_regex_cache_.find(regex);
+  if (it != init_ctx_for_regex_cache_.end()) {
+    if (!IsFailedInitContext(it->second)) {
+      return it->second;
+    }
+    init_ctx_for_regex_cache_.erase(it);
   }
-  auto init_ctx =
-      GrammarStateMatcher::CreateInitContext(BNFGrammar::FromSchema(schema), token_table_);
-  init_ctx_for_schema_cache_[schema] = init_ctx;
+  auto init_ctx = std::async(std::launch::async, [this, regex]() {
+                    return CreateInitContext(BNFGrammar::FromRegex(regex));
+                  }).share();
+  init_ctx_for_regex_cache_[regex] = init_ctx;
   return init_ctx;
 }
 
@@ -426,10 +949,14 @@ GrammarInitContextCacheImpl::GetInitContextForJSON() {
   return init_ctx_for_json_;
 }
 
-inline void GrammarInitContextCacheImpl::Clear() { init_ctx_for_schema_cache_.clear(); }
+inline void GrammarInitContextCacheImpl::Clear() {
+  init_ctx_for_schema_cache_.clear();
+  init_ctx_for_regex_cache_.clear();
+}
 
-GrammarInitContextCache::GrammarInitContextCache(const std::vector<std::string>& token_table)
-    : ObjectRef(make_object<GrammarInitContextCacheImpl>(token_table)) {}
+GrammarInitContextCache::GrammarInitContextCache(const std::vector<std::string>& token_table,
+                                                 const std::string& cache_dir)
+    : ObjectRef(make_object<GrammarInitContextCacheImpl>(token_table, cache_dir)) {}
 
 }  // namespace serve
 }  // namespace llm
@@ -6,6 +6,7 @@
 #ifndef MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_STATE_H_
 #define MLC_LLM_GRAMMAR_GRAMMAR_STATE_MATCHER_STATE_H_
 
+#include <deque>
 #include <queue>
 #include <vector>
 
@@ -217,6 +218,25 @@ class RulePositionTree {
   RulePositionBuffer node_buffer_;
 };
 
+/*!
+ * \brief A view of the stack tops of one history record. It refers to the storage of the
+ * StackTopsHistory, so it is invalidated when a history record is pushed or popped.
+ */
+class StackTopsView {
+ public:
+  StackTopsView(const int32_t* begin, const int32_t* end) : begin_(begin), end_(end) {}
+
+  const int32_t* begin() const { return begin_; }
+  const int32_t* end() const { return end_; }
+  int size() const { return static_cast<int>(end_ - begin_); }
+  bool empty() const { return begin_ == end_; }
+  int32_t operator[](int index) const { return begin_[index]; }
+
+ private:
+  const int32_t* begin_;
+  const int32_t* end_;
+};
+
 /*!
  * \brief A class to maintain the stack tops and its history to support rollback.
  * \details This class helps to maintain nodes by automatically maintaining the attached references.
@@ -224,6 +244,10 @@ class RulePositionTree {
  *
  * It can store up to the previous max_rollback_steps + 1 steps of history, and thus supports
  * rolling back up to max_rollback_steps steps.
+ *
+ * The stack tops of all history records are stored contiguously in one buffer, and every record
+ * is a range of the buffer. So pushing and popping records does not allocate memory once the
+ * buffer is warmed up. The space of the discarded earliest records is reclaimed lazily.
  */
 class StackTopsHistory {
  public:
@@ -242,7 +266,8 @@ class StackTopsHistory {
    * limit. If the history is dropped, node that do not exist in any stack any more will be freed.
    */
   void PushHistory(const std::vector<int32_t>& stack_tops) {
-    stack_tops_history_.push_back(stack_tops);
+    record_begins_.push_back(static_cast<int32_t>(stack_tops_buffer_.size()));
+    stack_tops_buffer_.insert(stack_tops_buffer_.end(), stack_tops.begin(), stack_tops.end());
     for (auto id : stack_tops) {
       tree_->AttachRefTo(id);
     }
@@ -251,10 +276,10 @@ class StackTopsHistory {
   /*! \brief Roll back to several previous steps. Possibly frees node that do not exist in any stack
    * any more. */
   void Rollback(int rollback_steps) {
-    DCHECK(rollback_steps < stack_tops_history_.size())
+    DCHECK(rollback_steps < Size())
         << "The number of requested rollback steps is greater than or equal to the current "
            "history "
-        << "size: " << rollback_steps << " vs " << stack_tops_history_.size() << ".";
+        << "size: " << rollback_steps << " vs " << Size() << ".";
     while (rollback_steps--) {
       PopLatest();
     }
@@ -263,17 +288,21 @@ class StackTopsHistory {
   /*! \brief Discard the earliest several steps. Possibly frees node that do not exist in any stack
    * any more. */
   void DiscardEarliest(int discard_steps) {
-    DCHECK(discard_steps < stack_tops_history_.size())
+    DCHECK(discard_steps < Size())
         << "The number of requested discard steps is greater than or equal to the current "
            "history "
-        << "size: " << discard_steps << " vs " << stack_tops_history_.size() << ".";
+        << "size: " << discard_steps << " vs " << Size() << ".";
     while (discard_steps--) {
       PopEarliest();
     }
+    CompactBuffer();
   }
 
-  /*! \brief Get the latest stack tops. */
-  const std::vector<int32_t>& GetLatest() const { return stack_tops_history_.back(); }
+  /*!
+   * \brief Get the latest stack tops.
+   * \note The returned view is invalidated by pushing or popping history records.
+   */
+  StackTopsView GetLatest() const { return GetRecord(Size() - 1); }
 
   /*!
    * \brief Print one history record.
@@ -283,42 +312,74 @@ class StackTopsHistory {
   std::string PrintHistory(int history_position_to_latest = 0) const;
 
   /*! \brief Get the number of history records. */
-  int Size() const { return stack_tops_history_.size(); }
+  int Size() const { return record_begins_.size(); }
 
   /*! \brief Check the well-formedness of the tree and the associated buffer. */
   void CheckWellFormed() const;
 
   /*! \brief Reset the history and the associated node tree. */
   void Reset() {
-    stack_tops_history_.clear();
+    stack_tops_buffer_.clear();
+    record_begins_.clear();
     tree_->Reset();
   }
 
  private:
+  /*! \brief Get the stack tops of the history record with the given index. */
+  StackTopsView GetRecord(int index) const {
+    DCHECK(index >= 0 && index < Size());
+    const int32_t* data = stack_tops_buffer_.data();
+    int32_t end = index + 1 < Size() ? record_begins_[index + 1]
+                                     : static_cast<int32_t>(stack_tops_buffer_.size());
+    return StackTopsView(data + record_begins_[index], data + end);
+  }
+
   /*! \brief Pop the oldest history record. Possibly frees node that do not exist in any stack any
    * more. */
   void PopEarliest() {
-    const auto& old_stack_tops = stack_tops_history_.front();
-    for (auto id : old_stack_tops) {
+    for (auto id : GetRecord(0)) {
       tree_->RemoveRefTo(id);
     }
-    stack_tops_history_.pop_front();
+    record_begins_.pop_front();
   }
 
   /*! \brief Pop the latest history record. Possibly frees node that do not exist in any stack any
    * more. */
   void PopLatest() {
-    const auto& new_stack_tops = stack_tops_history_.back();
-    for (auto id : new_stack_tops) {
+    for (auto id : GetLatest()) {
       tree_->RemoveRefTo(id);
     }
-    stack_tops_history_.pop_back();
+    stack_tops_buffer_.resize(record_begins_.back());
+    record_begins_.pop_back();
+  }
+
+  /*!
+   * \brief Move the live records to the front of the buffer when the space of the discarded
+   * records dominates the buffer, so that the buffer stays bounded by the live records.
+   */
+  void CompactBuffer() {
+    int32_t num_discarded =
+        record_begins_.empty() ? stack_tops_buffer_.size() : record_begins_.front();
+    if (num_discarded < kMinCompactSize ||
+        num_discarded * 2 < static_cast<int32_t>(stack_tops_buffer_.size())) {
+      return;
+    }
+    stack_tops_buffer_.erase(stack_tops_buffer_.begin(),
+                             stack_tops_buffer_.begin() + num_discarded);
+    for (auto& begin : record_begins_) {
+      begin -= num_discarded;
+    }
   }
 
+  /*! \brief The min number of discarded stack tops to trigger the buffer compaction. */
+  static constexpr int32_t kMinCompactSize = 1024;
+
   /*! \brief Modifiable pointer to the RulePositionTree. */
   RulePositionTree* tree_;
-  /*! \brief The history of stack tops. */
-  std::deque<std::vector<int32_t>> stack_tops_history_;
+  /*! \brief The stack tops of all history records, stored contiguously in the history order. */
+  std::vector<int32_t> stack_tops_buffer_;
+  /*! \brief The beginning offset of each history record in stack_tops_buffer_. */
+  std::deque<int32_t> record_begins_;
 };
 
 inline bool RulePositionTree::IsEndPosition(const RulePosition& rule_position) const {
@@ -419,8 +480,7 @@ inline void RulePositionTree::CheckWellFormed(const std::vector<int32_t>& outsid
 }
 
 inline std::string StackTopsHistory::PrintHistory(int history_position_to_latest) const {
-  const auto& latest_tops = stack_tops_history_[static_cast<int64_t>(stack_tops_history_.size()) -
-                                                1 - history_position_to_latest];
+  auto latest_tops = GetRecord(Size() - 1 - history_position_to_latest);
   std::stringstream ss;
   ss << "Stacks tops size: " << latest_tops.size() << std::endl;
   int cnt = 0;
@@ -432,10 +492,9 @@ inline std::string StackTopsHistory::PrintHistory(int history_position_to_latest
 }
 
 inline void StackTopsHistory::CheckWellFormed() const {
-  std::vector<int32_t> outside_pointers;
-  for (const auto& stack_tops : stack_tops_history_) {
-    outside_pointers.insert(outside_pointers.end(), stack_tops.begin(), stack_tops.end());
-  }
+  std::vector<int32_t> outside_pointers(
+      stack_tops_buffer_.begin() + (record_begins_.empty() ? 0 : record_begins_.front()),
+      stack_tops_buffer_.end());
   tree_->CheckWellFormed(outside_pointers);
 }
 
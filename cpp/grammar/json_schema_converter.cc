@@ -7,6 +7,8 @@
 #include <tvm/runtime/logging.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <iostream>
 #include <map>
@@ -14,6 +16,7 @@
 #include <optional>
 #include <queue>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -139,6 +142,12 @@ class JSONSchemaToEBNFConverter {
   inline static const std::string kBasicEscape = "basic_escape";
   inline static const std::string kBasicStringSub = "basic_string_sub";
 
+  // Keys that do not effect the validation
+  inline static const std::unordered_set<std::string> kSkippedKeys = {
+      "title",    "default",   "description", "examples", "deprecated",
+      "readOnly", "writeOnly", "$comment",    "$schema",
+  };
+
   /*! \brief Add the basic rules to the rules list and the basic_rules_cache. */
   void AddBasicRules();
 
@@ -174,9 +183,19 @@ class JSONSchemaToEBNFConverter {
   /*! \brief Visit the schema and return the rule body for later constructing the rule. */
   std::string VisitSchema(const picojson::value& schema, const std::string& rule_name);
 
-  /*! \brief Visit a reference schema. */
+  /*!
+   * \brief Visit a reference schema. A definition referred to more than once is converted only
+   * once into a shared rule, and its references are converted to that rule. The recursive
+   * definitions are supported in this way as well.
+   */
   std::string VisitRef(const picojson::object& schema, const std::string& rule_name);
 
+  /*! \brief Count the references to every URI in the schema into ref_counts_. */
+  void CountRefs(const picojson::value& schema);
+
+  /*! \brief Get a rule name based on the hint that is not used by the constructed rules. */
+  std::string GetUniqueRuleName(const std::string& rule_name_hint);
+
   /*! \brief Get the schema from the URI. */
   picojson::value URIToSchema(const picojson::value& uri);
 
@@ -329,6 +348,15 @@ class JSONSchemaToEBNFConverter {
   // The cache for basic rules. Mapping from the key of schema returned by GetSchemaCacheIndex()
   // to the basic rule name.
   std::map<std::string, std::string> basic_rules_cache_;
+  // The number of references to each URI in the root schema.
+  std::unordered_map<std::string, int> ref_counts_;
+  // The shared rules of the definitions referred to more than once. Mapping from the URI and the
+  // indent level of the reference to the rule name, since the separators in the rule depend on
+  // the indent level.
+  std::map<std::pair<std::string, int>, std::string> ref_rules_cache_;
+  // The shared rules of the definitions whose conversion is in progress. Mapping from the URI to
+  // the rule name.
+  std::unordered_map<std::string, std::string> ref_rules_in_progress_;
 };
 
 JSONSchemaToEBNFConverter::JSONSchemaToEBNFConverter(
@@ -342,6 +370,7 @@ JSONSchemaToEBNFConverter::JSONSchemaToEBNFConverter(
   colon_ = separators->second;
 
   AddBasicRules();
+  CountRefs(json_schema_);
 }
 
 std::string JSONSchemaToEBNFConverter::Convert() {
@@ -432,11 +461,6 @@ std::string JSONSchemaToEBNFConverter::CreateRuleFromSchema(const picojson::valu
 }
 
 std::string JSONSchemaToEBNFConverter::GetSchemaCacheIndex(const picojson::value& schema) {
-  // Keys that do not effect the validation
-  static const std::unordered_set<std::string> kSkippedKeys = {
-      "title",    "default",   "description", "examples", "deprecated",
-      "readOnly", "writeOnly", "$comment",    "$schema",
-  };
   if (schema.is<picojson::object>()) {
     // remove skipped keys and sort key by lexicographical order
     std::string result = "{";
@@ -531,6 +555,43 @@ std::string JSONSchemaToEBNFConverter::VisitSchema(const picojson::value& schema
 std::string JSONSchemaToEBNFConverter::VisitRef(const picojson::object& schema,
                                                 const std::string& rule_name) {
   ICHECK(schema.count("$ref"));
+  const picojson::value& uri = schema.at("$ref");
+  bool has_other_keywords = std::any_of(schema.begin(), schema.end(), [](const auto& kv) {
+    return kv.first != "$ref" && kSkippedKeys.count(kv.first) == 0;
+  });
+  if (!has_other_keywords && uri.is<std::string>() && ref_counts_[uri.get<std::string>()] > 1) {
+    const std::string& uri_str = uri.get<std::string>();
+    auto key = std::make_pair(uri_str, indentManager_->total_indent_);
+    auto it = ref_rules_cache_.find(key);
+    if (it != ref_rules_cache_.end()) {
+      return it->second;
+    }
+    // A definition referring to itself under a deeper indent level reuses the rule of the
+    // enclosing reference, since the grammar cannot track unboundedly nested indent levels.
+    auto in_progress_it = ref_rules_in_progress_.find(uri_str);
+    if (in_progress_it != ref_rules_in_progress_.end()) {
+      return in_progress_it->second;
+    }
+    std::string ref_rule_name_hint = "defs";
+    std::string def_name = uri_str.substr(uri_str.rfind('/') + 1);
+    if (!def_name.empty()) {
+      ref_rule_name_hint += "_";
+      for (char c : def_name) {
+        ref_rule_name_hint += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+      }
+    }
+    std::string ref_rule_name = GetUniqueRuleName(ref_rule_name_hint);
+    ref_rules_cache_[key] = ref_rule_name;
+    ref_rules_in_progress_[uri_str] = ref_rule_name;
+    // Add the rule before visiting the definition, which may refer to itself.
+    int ref_rule_idx = rules_.size();
+    rules_.emplace_back(ref_rule_name, "");
+    std::string ref_rule_body = VisitSchema(URIToSchema(uri), ref_rule_name);
+    rules_[ref_rule_idx].second = ref_rule_body;
+    ref_rules_in_progress_.erase(uri_str);
+    return ref_rule_name;
+  }
+
   picojson::value new_schema = URIToSchema(schema.at("$ref"));
   if (!new_schema.is<bool>()) {
     picojson::object new_schema_obj = new_schema.get<picojson::object>();
@@ -544,6 +605,38 @@ std::string JSONSchemaToEBNFConverter::VisitRef(const picojson::object& schema,
   return VisitSchema(new_schema, rule_name);
 }
 
+void JSONSchemaToEBNFConverter::CountRefs(const picojson::value& schema) {
+  if (schema.is<picojson::object>()) {
+    for (const auto& [key, value] : schema.get<picojson::object>()) {
+      if (key == "$ref" && value.is<std::string>()) {
+        ++ref_counts_[value.get<std::string>()];
+      } else {
+        CountRefs(value);
+      }
+    }
+  } else if (schema.is<picojson::array>()) {
+    for (const auto& item : schema.get<picojson::array>()) {
+      CountRefs(item);
+    }
+  }
+}
+
+std::string JSONSchemaToEBNFConverter::GetUniqueRuleName(const std::string& rule_name_hint) {
+  auto is_used = [&](const std::string& name) {
+    return std::any_of(rules_.begin(), rules_.end(),
+                       [&](const auto& rule) { return rule.first == name; });
+  };
+  if (!is_used(rule_name_hint)) {
+    return rule_name_hint;
+  }
+  for (int i = 1;; ++i) {
+    std::string name = rule_name_hint + "_" + std::to_string(i);
+    if (!is_used(name)) {
+      return name;
+    }
+  }
+}
+
 picojson::value JSONSchemaToEBNFConverter::URIToSchema(const picojson::value& uri) {
   if (uri.get<std::string>().substr(0, 8) == "#/$defs/") {
     return json_schema_.get("$defs").get(uri.get<std::string>().substr(8));
@@ -971,6 +1064,16 @@ std::string JSONSchemaToEBNF(std::string schema, std::optional<int> indent,
   return converter.Convert();
 }
 
+std::string CanonicalizeJSONSchema(const std::string& schema) {
+  picojson::value schema_value;
+  std::string err = picojson::parse(schema_value, schema);
+  if (!err.empty()) {
+    return schema;
+  }
+  // The object keys keep their order, since the properties are converted in the schema order.
+  return schema_value.serialize(false);
+}
+
 TVM_REGISTER_GLOBAL("mlc.grammar.DebugJSONSchemaToEBNF")
     .set_body([](TVMArgs args, TVMRetValue* rv) {
       std::optional<int> indent;
@@ -37,6 +37,16 @@ std::string JSONSchemaToEBNF(
     std::optional<std::pair<std::string, std::string>> separators = std::nullopt,
     bool strict_mode = true);
 
+/*!
+ * \brief Get the canonical form of a JSON schema string, where the whitespaces are removed. The
+ * object keys keep their order, as the order of the properties decides the order of the fields in
+ * the grammar. The schemas with the same canonical form are converted to the same grammar, so the
+ * canonical form serves as the key to cache the conversion.
+ * \param schema The JSON schema string.
+ * \returns The canonical JSON schema string, or the input string if it is not valid JSON.
+ */
+std::string CanonicalizeJSONSchema(const std::string& schema);
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
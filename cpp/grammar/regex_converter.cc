@@ -0,0 +1,556 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file grammar/regex_converter.cc
+ */
+#include "regex_converter.h"
+
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/registry.h>
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../support/encoding.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief Convert a regular expression to EBNF grammar string by recursive descent. The parameters
+ * follow RegexToEBNF().
+ * \details The regex is lowered to the EBNF constructs directly: literals to strings, character
+ * classes to character classes, groups to parenthesized expressions, and the counted quantifiers
+ * to repeated and nested optional expressions.
+ */
+class RegexToEBNFConverter {
+ public:
+  explicit RegexToEBNFConverter(const std::string& regex)
+      : regex_(regex), begin_(regex_.c_str()), end_(begin_ + regex_.size()), cur_(begin_) {}
+
+  /*! \brief The main method. Convert the regex to EBNF grammar string. */
+  std::string Convert();
+
+ private:
+  /*! \brief A character class represented by ranges of codepoints. */
+  struct CharacterClass {
+    std::vector<std::pair<TCodepoint, TCodepoint>> ranges;
+    bool is_negative = false;
+  };
+
+  /*! \brief A parsed atom of the regex. */
+  struct Atom {
+    /*! \brief The EBNF element of the atom. */
+    std::string element;
+    /*! \brief Whether the atom is a literal codepoint, which can be merged into a string. */
+    bool is_literal = false;
+    /*! \brief The codepoint of the literal atom. */
+    TCodepoint codepoint = 0;
+  };
+
+  // Parse the alternation of concatenations, until the end or a ")".
+  std::string ParseAlternation();
+  // Parse the concatenation of quantified atoms, until the end, a "|" or a ")".
+  std::string ParseConcatenation();
+  // Parse an atom, i.e. a literal, a character class or a group.
+  Atom ParseAtom();
+  // Parse a group after the "(".
+  std::string ParseGroup();
+  // Parse a character class after the "[".
+  CharacterClass ParseCharacterClass();
+  // Parse an escape sequence after the "\". Return whether it is a class shorthand (e.g. "\d"),
+  // which is stored in char_class, or a codepoint, which is stored in codepoint.
+  bool ParseEscape(bool in_character_class, CharacterClass* char_class, TCodepoint* codepoint);
+  // Try to parse a quantifier at the current position. Return whether a quantifier is found, and
+  // store the min and max repetitions. A max of -1 means unbounded.
+  bool ParseQuantifier(int* min_repeat, int* max_repeat);
+  // Apply the quantifier to the element and return the EBNF expression.
+  std::string ApplyQuantifier(const std::string& element, int min_repeat, int max_repeat);
+  // Skip the name of a named group until the ">".
+  void SkipGroupName();
+
+  // Print a character class as an EBNF element.
+  static std::string PrintCharacterClass(const CharacterClass& char_class);
+  // Print a codepoint in an EBNF string or character class.
+  static std::string PrintCodepoint(TCodepoint codepoint, bool in_character_class);
+
+  // Peek the char at the given offset, or "\0" past the end of the regex.
+  char Peek(int delta = 0) const { return delta < end_ - cur_ ? cur_[delta] : '\0'; }
+  void Consume(int cnt = 1) { cur_ += cnt; }
+  bool AtEnd() const { return cur_ >= end_ || *cur_ == '\0'; }
+
+  [[noreturn]] void ThrowError(const std::string& msg) const {
+    throw tvm::Error("Regex parse error at position " + std::to_string(cur_ - begin_) + ": " + msg +
+                     ". The regex is: " + regex_);
+  }
+
+  // The regex to convert
+  std::string regex_;
+  // The max repetition count of a counted quantifier.
+  static constexpr int kMaxRepeatCount = 10000;
+  // The max total size of the EBNF elements copied by the counted quantifiers, which bounds the
+  // size of the grammar.
+  static constexpr int64_t kMaxRepeatExpansionSize = 1 << 18;
+
+  // The beginning of the regex
+  const char* begin_;
+  // The end of the regex
+  const char* end_;
+  // The current position in the regex
+  const char* cur_;
+  // The total size of the EBNF elements copied by the counted quantifiers so far
+  int64_t repeat_expansion_size_ = 0;
+};
+
+std::string RegexToEBNFConverter::Convert() {
+  if (Peek() == '^') {
+    Consume();
+  }
+  std::string body = ParseAlternation();
+  if (!AtEnd()) {
+    ThrowError("Unmatched \")\"");
+  }
+  return "main ::= " + body + "\n";
+}
+
+std::string RegexToEBNFConverter::ParseAlternation() {
+  std::string result = ParseConcatenation();
+  while (Peek() == '|') {
+    Consume();
+    result += " | " + ParseConcatenation();
+  }
+  return result;
+}
+
+std::string RegexToEBNFConverter::ParseConcatenation() {
+  std::vector<std::string> elements;
+  // The consecutive literals without quantifiers are merged into one string.
+  std::string literal_string;
+  auto flush_literal_string = [&]() {
+    if (!literal_string.empty()) {
+      elements.push_back("\"" + literal_string + "\"");
+      literal_string.clear();
+    }
+  };
+
+  while (!AtEnd() && Peek() != '|' && Peek() != ')') {
+    if (Peek() == '$') {
+      Consume();
+      if (!AtEnd() && Peek() != '|' && Peek() != ')') {
+        ThrowError("\"$\" is only supported at the end of the regex");
+      }
+      continue;
+    }
+    Atom atom = ParseAtom();
+    int min_repeat, max_repeat;
+    bool has_quantifier = ParseQuantifier(&min_repeat, &max_repeat);
+    if (atom.is_literal && !has_quantifier) {
+      literal_string += PrintCodepoint(atom.codepoint, false);
+      continue;
+    }
+    flush_literal_string();
+    elements.push_back(has_quantifier ? ApplyQuantifier(atom.element, min_repeat, max_repeat)
+                                      : atom.element);
+  }
+  flush_literal_string();
+
+  if (elements.empty()) {
+    return "\"\"";
+  }
+  std::string result = elements[0];
+  for (int i = 1; i < static_cast<int>(elements.size()); ++i) {
+    result += " " + elements[i];
+  }
+  return result;
+}
+
+RegexToEBNFConverter::Atom RegexToEBNFConverter::ParseAtom() {
+  Atom atom;
+  switch (Peek()) {
+    case '(': {
+      Consume();
+      atom.element = ParseGroup();
+      return atom;
+    }
+    case '[': {
+      Consume();
+      atom.element = PrintCharacterClass(ParseCharacterClass());
+      return atom;
+    }
+    case '.': {
+      Consume();
+      CharacterClass char_class;
+      char_class.ranges.push_back({'\n', '\n'});
+      char_class.is_negative = true;
+      atom.element = PrintCharacterClass(char_class);
+      return atom;
+    }
+    case '\\': {
+      Consume();
+      CharacterClass char_class;
+      if (ParseEscape(false, &char_class, &atom.codepoint)) {
+        atom.element = PrintCharacterClass(char_class);
+      } else {
+        atom.is_literal = true;
+        atom.element = "\"" + PrintCodepoint(atom.codepoint, false) + "\"";
+      }
+      return atom;
+    }
+    case '*':
+    case '+':
+    case '?':
+      ThrowError("Nothing to repeat");
+    case '^':
+      ThrowError("\"^\" is only supported at the beginning of the regex");
+    default: {
+      auto [codepoint, new_cur] = ParseNextUTF8(cur_);
+      if (codepoint == CharHandlingError::kInvalidUTF8) {
+        ThrowError("Invalid UTF-8 sequence");
+      }
+      cur_ = new_cur;
+      atom.is_literal = true;
+      atom.codepoint = codepoint;
+      atom.element = "\"" + PrintCodepoint(codepoint, false) + "\"";
+      return atom;
+    }
+  }
+}
+
+std::string RegexToEBNFConverter::ParseGroup() {
+  if (Peek() == '?') {
+    if (Peek(1) == ':') {
+      Consume(2);
+    } else if (Peek(1) == 'P' && Peek(2) == '<') {
+      Consume(3);
+      SkipGroupName();
+    } else if (Peek(1) == '<' && Peek(2) != '=' && Peek(2) != '!') {
+      Consume(2);
+      SkipGroupName();
+    } else if (Peek(1) == '=' || Peek(1) == '!' || Peek(1) == '<') {
+      ThrowError("Lookaround assertions are not supported");
+    } else {
+      ThrowError("Unsupported group extension");
+    }
+  }
+  std::string body = ParseAlternation();
+  if (Peek() != ')') {
+    ThrowError("Missing \")\"");
+  }
+  Consume();
+  return "(" + body + ")";
+}
+
+void RegexToEBNFConverter::SkipGroupName() {
+  const char* name_begin = cur_;
+  while (!AtEnd() && Peek() != '>') {
+    Consume();
+  }
+  if (AtEnd()) {
+    ThrowError("Missing \">\" of the group name");
+  }
+  if (cur_ == name_begin) {
+    ThrowError("Empty group name");
+  }
+  Consume();
+}
+
+RegexToEBNFConverter::CharacterClass RegexToEBNFConverter::ParseCharacterClass() {
+  CharacterClass char_class;
+  if (Peek() == '^') {
+    char_class.is_negative = true;
+    Consume();
+  }
+  bool is_first = true;
+  while (!AtEnd() && (Peek() != ']' || is_first)) {
+    is_first = false;
+    TCodepoint lower;
+    if (Peek() == '\\') {
+      Consume();
+      CharacterClass shorthand;
+      if (ParseEscape(true, &shorthand, &lower)) {
+        if (shorthand.is_negative) {
+          ThrowError("Negated class shorthands are not supported in character classes");
+        }
+        char_class.ranges.insert(char_class.ranges.end(), shorthand.ranges.begin(),
+                                 shorthand.ranges.end());
+        continue;
+      }
+    } else {
+      auto [codepoint, new_cur] = ParseNextUTF8(cur_);
+      if (codepoint == CharHandlingError::kInvalidUTF8) {
+        ThrowError("Invalid UTF-8 sequence");
+      }
+      cur_ = new_cur;
+      lower = codepoint;
+    }
+
+    TCodepoint upper = lower;
+    if (Peek() == '-' && Peek(1) != ']' && Peek(1) != '\0') {
+      Consume();
+      if (Peek() == '\\') {
+        Consume();
+        CharacterClass shorthand;
+        if (ParseEscape(true, &shorthand, &upper)) {
+          ThrowError("Invalid character class range");
+        }
+      } else {
+        auto [codepoint, new_cur] = ParseNextUTF8(cur_);
+        if (codepoint == CharHandlingError::kInvalidUTF8) {
+          ThrowError("Invalid UTF-8 sequence");
+        }
+        cur_ = new_cur;
+        upper = codepoint;
+      }
+      if (lower > upper) {
+        ThrowError("Invalid character class range: lower bound is larger than upper bound");
+      }
+    }
+    char_class.ranges.push_back({lower, upper});
+  }
+  if (AtEnd()) {
+    ThrowError("Missing \"]\"");
+  }
+  Consume();
+  return char_class;
+}
+
+bool RegexToEBNFConverter::ParseEscape(bool in_character_class, CharacterClass* char_class,
+                                       TCodepoint* codepoint) {
+  char c = Peek();
+  if (c == '\0') {
+    ThrowError("Incomplete escape sequence");
+  }
+  Consume();
+  switch (c) {
+    case 'd':
+    case 'D':
+      char_class->ranges = {{'0', '9'}};
+      char_class->is_negative = c == 'D';
+      return true;
+    case 'w':
+    case 'W':
+      char_class->ranges = {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}};
+      char_class->is_negative = c == 'W';
+      return true;
+    case 's':
+    case 'S':
+      char_class->ranges = {{'\t', '\r'}, {' ', ' '}};
+      char_class->is_negative = c == 'S';
+      return true;
+    case 'n':
+      *codepoint = '\n';
+      return false;
+    case 't':
+      *codepoint = '\t';
+      return false;
+    case 'r':
+      *codepoint = '\r';
+      return false;
+    case 'f':
+      *codepoint = '\f';
+      return false;
+    case 'v':
+      *codepoint = '\v';
+      return false;
+    case '0':
+      *codepoint = '\0';
+      return false;
+    case 'x':
+    case 'u':
+    case 'U': {
+      int len = c == 'x' ? 2 : (c == 'u' ? 4 : 8);
+      TCodepoint value = 0;
+      for (int i = 0; i < len; ++i) {
+        char digit = Peek();
+        int digit_value;
+        if (digit >= '0' && digit <= '9') {
+          digit_value = digit - '0';
+        } else if (digit >= 'a' && digit <= 'f') {
+          digit_value = digit - 'a' + 10;
+        } else if (digit >= 'A' && digit <= 'F') {
+          digit_value = digit - 'A' + 10;
+        } else {
+          ThrowError("Invalid hex escape sequence");
+        }
+        value = value * 16 + digit_value;
+        Consume();
+      }
+      *codepoint = value;
+      return false;
+    }
+    case 'b':
+      if (in_character_class) {
+        *codepoint = '\b';
+        return false;
+      }
+      ThrowError("Word boundaries are not supported");
+    default:
+      if ((c >= '1' && c <= '9') || c == 'B' || c == 'A' || c == 'Z' || c == 'z') {
+        ThrowError("Backreferences and anchors are not supported");
+      }
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+        ThrowError(std::string("Unknown escape sequence \\") + c);
+      }
+      // Escaped punctuations and other chars stand for themselves.
+      Consume(-1);
+      auto [escaped_codepoint, new_cur] = ParseNextUTF8(cur_);
+      if (escaped_codepoint == CharHandlingError::kInvalidUTF8) {
+        ThrowError("Invalid UTF-8 sequence");
+      }
+      cur_ = new_cur;
+      *codepoint = escaped_codepoint;
+      return false;
+  }
+}
+
+bool RegexToEBNFConverter::ParseQuantifier(int* min_repeat, int* max_repeat) {
+  switch (Peek()) {
+    case '*':
+      *min_repeat = 0;
+      *max_repeat = -1;
+      Consume();
+      break;
+    case '+':
+      *min_repeat = 1;
+      *max_repeat = -1;
+      Consume();
+      break;
+    case '?':
+      *min_repeat = 0;
+      *max_repeat = 1;
+      Consume();
+      break;
+    case '{': {
+      // A "{" that does not start a valid counted quantifier is a literal, as in Python.
+      const char* start = cur_;
+      auto parse_int = [&](int* value) {
+        if (Peek() < '0' || Peek() > '9') return false;
+        *value = 0;
+        while (Peek() >= '0' && Peek() <= '9') {
+          *value = *value * 10 + (Peek() - '0');
+          if (*value > kMaxRepeatCount) {
+            ThrowError("Invalid quantifier: the repetition count exceeds the limit " +
+                       std::to_string(kMaxRepeatCount));
+          }
+          Consume();
+        }
+        return true;
+      };
+      Consume();
+      bool has_min = parse_int(min_repeat);
+      if (!has_min) {
+        *min_repeat = 0;
+      }
+      bool has_max = false;
+      *max_repeat = -1;
+      if (Peek() == '}' && has_min) {
+        *max_repeat = *min_repeat;
+      } else if (Peek() == ',') {
+        Consume();
+        has_max = parse_int(max_repeat);
+      }
+      if (Peek() == '}' && !has_min && !has_max) {
+        ThrowError("Invalid quantifier: empty repetition count");
+      }
+      if (Peek() != '}') {
+        cur_ = start;
+        return false;
+      }
+      Consume();
+      if (*max_repeat != -1 && *min_repeat > *max_repeat) {
+        ThrowError("Invalid quantifier: min repetition is larger than max repetition");
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+  // The lazy quantifiers match the same set of strings.
+  if (Peek() == '?') {
+    Consume();
+  }
+  if (Peek() == '*' || Peek() == '+' || Peek() == '?' ||
+      (Peek() == '{' && Peek(1) >= '0' && Peek(1) <= '9')) {
+    ThrowError("Multiple repeat");
+  }
+  return true;
+}
+
+std::string RegexToEBNFConverter::ApplyQuantifier(const std::string& element, int min_repeat,
+                                                  int max_repeat) {
+  if (min_repeat == 0 && max_repeat == -1) {
+    return element + "*";
+  } else if (min_repeat == 1 && max_repeat == -1) {
+    return element + "+";
+  } else if (min_repeat == 0 && max_repeat == 1) {
+    return element + "?";
+  }
+  // The element is copied once per repetition, and the copies of nested quantifiers multiply.
+  int64_t num_copies = max_repeat == -1 ? min_repeat + 1 : max_repeat;
+  repeat_expansion_size_ += num_copies * static_cast<int64_t>(element.size());
+  if (repeat_expansion_size_ > kMaxRepeatExpansionSize) {
+    ThrowError("The counted quantifiers expand to more than " +
+               std::to_string(kMaxRepeatExpansionSize) +
+               " bytes of grammar. Please use smaller repetition counts");
+  }
+  std::vector<std::string> parts(min_repeat, element);
+  if (max_repeat == -1) {
+    parts.push_back(element + "*");
+  } else if (max_repeat > min_repeat) {
+    // x{0,3} is lowered to (x (x x?)?)?.
+    std::string optional_part = element + "?";
+    for (int i = 1; i < max_repeat - min_repeat; ++i) {
+      optional_part = "(" + element + " " + optional_part + ")?";
+    }
+    parts.push_back(optional_part);
+  }
+  if (parts.empty()) {
+    return "\"\"";
+  }
+  std::string result = "(" + parts[0];
+  for (int i = 1; i < static_cast<int>(parts.size()); ++i) {
+    result += " " + parts[i];
+  }
+  return result + ")";
+}
+
+std::string RegexToEBNFConverter::PrintCharacterClass(const CharacterClass& char_class) {
+  std::string result = char_class.is_negative ? "[^" : "[";
+  for (const auto& [lower, upper] : char_class.ranges) {
+    result += PrintCodepoint(lower, true);
+    if (upper != lower) {
+      result += "-" + PrintCodepoint(upper, true);
+    }
+  }
+  return result + "]";
+}
+
+std::string RegexToEBNFConverter::PrintCodepoint(TCodepoint codepoint, bool in_character_class) {
+  bool is_special = codepoint == '\\' || codepoint == '"' ||
+                    (in_character_class && (codepoint == ']' || codepoint == '^' ||
+                                            codepoint == '-'));
+  if (codepoint >= 0x20 && codepoint < 0x7F && !is_special) {
+    return std::string(1, static_cast<char>(codepoint));
+  }
+  char buf[16];
+  if (codepoint <= 0xFFFF) {
+    snprintf(buf, sizeof(buf), "\\u%04X", codepoint);
+  } else {
+    snprintf(buf, sizeof(buf), "\\U%08X", codepoint);
+  }
+  return buf;
+}
+
+std::string RegexToEBNF(const std::string& regex) { return RegexToEBNFConverter(regex).Convert(); }
+
+TVM_REGISTER_GLOBAL("mlc.grammar.DebugRegexToEBNF").set_body_typed([](String regex) {
+  return RegexToEBNF(regex);
+});
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,34 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file grammar/regex_converter.h
+ * \brief The header for translating regular expressions to EBNF grammar.
+ */
+
+#ifndef MLC_LLM_GRAMMAR_REGEX_CONVERTER_H_
+#define MLC_LLM_GRAMMAR_REGEX_CONVERTER_H_
+
+#include <string>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*!
+ * \brief Convert a regular expression to EBNF grammar string. The grammar matches the strings
+ * fully matched by the regex.
+ *
+ * The supported syntax: literals, escaped chars, character classes (including \d, \w, \s and
+ * their negations), ".", alternation "|", groups "(...)", non-capturing and named groups, and the
+ * quantifiers "*", "+", "?", "{n}", "{n,}" and "{n,m}" (the lazy variants are treated the same).
+ * "^" at the beginning and "$" at the end are ignored. Backreferences and lookarounds are not
+ * supported.
+ * \param regex The regular expression.
+ * \returns The EBNF grammar string, whose main rule is "main".
+ */
+std::string RegexToEBNF(const std::string& regex);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_GRAMMAR_REGEX_CONVERTER_H_
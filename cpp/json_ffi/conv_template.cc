@@ -221,9 +221,108 @@ Result<std::optional<std::string>> TryGetFunctionCallingString(
   return TResult::Ok(function_list_json.serialize());
 };
 
+/*!
+ * \brief The writer of the prompt texts. The texts are appended as the template literals and the
+ * message contents, and are committed as text data, or as token data when the compiled template
+ * is given. We lazily accumulate the pending texts to reduce amount of segments in the data.
+ */
+class PromptWriter {
+ public:
+  explicit PromptWriter(const CompiledConversation* compiled_conv)
+      : compiled_conv_(compiled_conv) {}
+
+  /*! \brief Append a template literal. The adjacent literals are tokenized as a whole. */
+  void AppendLiteral(const std::string& text) { pending_literal_ += text; }
+
+  /*! \brief Append a message content. */
+  void AppendContent(const std::string& text) {
+    if (compiled_conv_ == nullptr) {
+      pending_literal_ += text;
+      return;
+    }
+    if (text.empty()) return;
+    FlushLiteral();
+    std::vector<int32_t> token_ids =
+        compiled_conv_->EncodeContent(text, /*is_leading=*/pending_token_ids_.empty());
+    pending_token_ids_.insert(pending_token_ids_.end(), token_ids.begin(), token_ids.end());
+  }
+
+  /*! \brief Whether there is no pending text. */
+  bool Empty() const { return pending_literal_.empty() && pending_token_ids_.empty(); }
+
+  /*! \brief Commit the pending texts to the data list. */
+  void Commit(std::vector<Data>* message_list) {
+    if (compiled_conv_ == nullptr) {
+      if (!pending_literal_.empty()) {
+        message_list->push_back(TextData(pending_literal_));
+        pending_literal_.clear();
+      }
+      return;
+    }
+    FlushLiteral();
+    if (!pending_token_ids_.empty()) {
+      message_list->push_back(TokenData(std::move(pending_token_ids_)));
+      pending_token_ids_.clear();
+    }
+  }
+
+ private:
+  /*! \brief Move the pending literal to the pending token ids. */
+  void FlushLiteral() {
+    if (pending_literal_.empty()) return;
+    const std::vector<int32_t>& token_ids = compiled_conv_->EncodeLiteral(
+        pending_literal_, /*is_leading=*/pending_token_ids_.empty());
+    pending_token_ids_.insert(pending_token_ids_.end(), token_ids.begin(), token_ids.end());
+    pending_literal_.clear();
+  }
+
+  /*! \brief The compiled template, or nullptr for the text data. */
+  const CompiledConversation* compiled_conv_;
+  /*! \brief The pending literal text, which also holds the contents for the text data. */
+  std::string pending_literal_;
+  /*! \brief The pending token ids for the token data. */
+  std::vector<int32_t> pending_token_ids_;
+};
+
+/*!
+ * \brief Append the text of the template with the placeholder replaced by the content, as the
+ * same text as the replacement in Conversation::GetSystemText and GetRoleText.
+ */
+void AppendTemplateText(const std::string& text_template, const std::string& placeholder,
+                        const std::string& content, const std::optional<std::string>& fn_call_str,
+                        PromptWriter* writer) {
+  size_t pos = text_template.find(placeholder);
+  std::string prefix = text_template.substr(0, pos);
+  std::string suffix =
+      pos == std::string::npos ? "" : text_template.substr(pos + placeholder.length());
+  // replace placeholder[FUNCTION] with function_string
+  // this assumes function calling is used for a single request scenario only
+  const std::string& fn_placeholder = PLACEHOLDERS[MessagePlaceholders::FUNCTION];
+  size_t fn_pos = fn_call_str ? prefix.find(fn_placeholder) : std::string::npos;
+  if (fn_pos != std::string::npos) {
+    writer->AppendLiteral(prefix.substr(0, fn_pos));
+    writer->AppendContent(fn_call_str.value());
+    writer->AppendLiteral(prefix.substr(fn_pos + fn_placeholder.length()));
+  } else {
+    writer->AppendLiteral(prefix);
+  }
+  if (pos == std::string::npos) return;
+  writer->AppendContent(content);
+  fn_pos = fn_call_str && fn_pos == std::string::npos ? suffix.find(fn_placeholder)
+                                                      : std::string::npos;
+  if (fn_pos != std::string::npos) {
+    writer->AppendLiteral(suffix.substr(0, fn_pos));
+    writer->AppendContent(fn_call_str.value());
+    writer->AppendLiteral(suffix.substr(fn_pos + fn_placeholder.length()));
+  } else {
+    writer->AppendLiteral(suffix);
+  }
+}
+
 Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
                                        const ChatCompletionRequest& request,
-                                       const ModelConfig& config, DLDevice device) {
+                                       const ModelConfig& config, DLDevice device,
+                                       const CompiledConversation* compiled_conv) {
   using TResult = Result<std::vector<Data>>;
 
   Result<std::optional<std::string>> fn_call_str_tmp = TryGetFunctionCallingString(conv, request);
@@ -250,14 +349,23 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
   f_populate_system_message(conv.messages);
   f_populate_system_message(request.messages);
 
-  // pending text records the text to be put into data
-  // we lazily accumulate the pending text
-  // to reduce amount of segments in the Data vector
-  std::string pending_text =
-      conv.GetSystemText(has_custom_system ? custom_system_inputs : conv.system_message);
+  // The compiled template renders token data only when it is verified to be exact.
+  PromptWriter writer(compiled_conv != nullptr && compiled_conv->IsExact() ? compiled_conv
+                                                                           : nullptr);
+  // The system message of the template is a part of the literal, while the custom system message
+  // is a content.
+  if (has_custom_system) {
+    AppendTemplateText(conv.system_template, PLACEHOLDERS[MessagePlaceholders::SYSTEM],
+                       custom_system_inputs, std::nullopt, &writer);
+  } else {
+    writer.AppendLiteral(conv.GetSystemText(conv.system_message));
+  }
 
   // Get the message strings
   std::vector<Data> message_list;
+  // The base64 images and their positions in the message list
+  std::vector<std::string> base64_images;
+  std::vector<size_t> image_positions;
   size_t non_system_msg_count = 0;
 
   // returns error if error happens
@@ -275,7 +383,7 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
       const std::string& role_name = role_it->second;
       // skip when content is empty
       if (msg.content.IsNull()) {
-        pending_text += role_name + conv.role_empty_sep;
+        writer.AppendLiteral(role_name + conv.role_empty_sep);
         continue;
       }
       ++non_system_msg_count;
@@ -286,10 +394,10 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
       std::string role_prefix = "";
       // Do not append role prefix if this is the first message and there is already a system
       // message
-      if (conv.add_role_after_system_message || pending_text.empty() || non_system_msg_count != 1) {
+      if (conv.add_role_after_system_message || writer.Empty() || non_system_msg_count != 1) {
         role_prefix = role_name + conv.role_content_sep;
       }
-      pending_text += role_prefix;
+      writer.AppendLiteral(role_prefix);
 
       if (msg.content.IsParts()) {
         for (const auto& item : msg.content.Parts()) {
@@ -304,7 +412,9 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
                   "The text type content of a message does not have \"text\" field");
             }
             // replace placeholder[ROLE] with input message from role
-            pending_text += conv.GetRoleText(msg.role, it_text->second, fn_call_string);
+            AppendTemplateText(conv.role_templates.at(msg.role),
+                               PLACEHOLDERS[MessagePlaceholderFromString(msg.role)],
+                               it_text->second, fn_call_string, &writer);
           } else if (it_type->second == "image_url") {
             if (item.find("image_url") == item.end()) {
               return TResult::Error("Content should have an image_url field");
@@ -313,35 +423,27 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
                 item.at("image_url");  // TODO(mlc-team): According to OpenAI API reference this
                                        // should be a map, with a "url" key containing the URL, but
                                        // we are just assuming this as the URL for now
-            std::string base64_image = image_url.substr(image_url.find(",") + 1);
-            Result<NDArray> image_data_res = LoadImageFromBase64(base64_image);
-            if (image_data_res.IsErr()) {
-              return TResult::Error(image_data_res.UnwrapErr());
-            }
             if (!config.vision_config.has_value()) {
               return TResult::Error("Vision config is required for image input");
             }
-            int image_size = config.vision_config.value().image_size;
-            int patch_size = config.vision_config.value().patch_size;
-
-            int embed_size = (image_size * image_size) / (patch_size * patch_size);
-
-            auto image_ndarray = ClipPreprocessor(image_data_res.Unwrap(), image_size, device);
             // lazily commit text data
-            if (pending_text.length() != 0) {
-              message_list.push_back(TextData(pending_text));
-              pending_text = "";
-            }
-            message_list.push_back(ImageData(image_ndarray, embed_size));
+            writer.Commit(&message_list);
+            // The images are loaded together after all messages are processed, and a null
+            // placeholder takes the image position for now.
+            image_positions.push_back(message_list.size());
+            base64_images.push_back(image_url.substr(image_url.find(",") + 1));
+            message_list.push_back(Data());
           } else {
             return TResult::Error("Unsupported content type: " + it_type->second);
           }
         }
       } else {
         ICHECK(msg.content.IsText());
-        pending_text += conv.GetRoleText(msg.role, msg.content.Text(), fn_call_string);
+        AppendTemplateText(conv.role_templates.at(msg.role),
+                           PLACEHOLDERS[MessagePlaceholderFromString(msg.role)],
+                           msg.content.Text(), fn_call_string, &writer);
       }
-      pending_text += seperator;
+      writer.AppendLiteral(seperator);
     }
     return std::nullopt;
   };
@@ -359,8 +461,25 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
   if (auto err = f_process_messages({last_assistant_begin})) {
     return err.value();
   }
-  if (pending_text.length() != 0) {
-    message_list.push_back(TextData(pending_text));
+  writer.Commit(&message_list);
+  // Load and preprocess the images in parallel
+  if (!base64_images.empty()) {
+    int image_size = config.vision_config.value().image_size;
+    int patch_size = config.vision_config.value().patch_size;
+    int embed_size = (image_size * image_size) / (patch_size * patch_size);
+    Result<std::vector<NDArray>> images_res =
+        LoadClipImagesFromBase64(base64_images, image_size, device);
+    if (images_res.IsErr()) {
+      return TResult::Error(images_res.UnwrapErr());
+    }
+    std::vector<NDArray> images = images_res.Unwrap();
+    for (size_t i = 0; i < images.size(); ++i) {
+      // The images are identified by the hash of their base64 strings, with which the image
+      // embeddings are cached and the images are matched in prefix cache.
+      std::string content_hash =
+          ImageDataNode::HashContent(base64_images[i].data(), base64_images[i].size());
+      message_list[image_positions[i]] = ImageData(images[i], embed_size, std::move(content_hash));
+    }
   }
   // Handle system_prefix_token_ids
   if (conv.system_prefix_token_ids.has_value()) {
@@ -369,6 +488,86 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
   return TResult::Ok(message_list);
 }
 
+/****************** Compiled conversation template ******************/
+
+std::unique_ptr<CompiledConversation> CompiledConversation::Compile(const Conversation& conv,
+                                                                    Tokenizer tokenizer) {
+  std::unique_ptr<CompiledConversation> compiled(new CompiledConversation(std::move(tokenizer)));
+  // Verify the token spans with probe conversations. The probe contents start and end with
+  // the characters that are likely to merge with the adjacent literals.
+  static const std::vector<std::string> probe_contents = {"Hello", " hello, world! ",
+                                                          "\nA\n", "1. x:", "\"\u4f60\u597d\""};
+  compiled->exact_ = true;
+  ModelConfig probe_config;
+  for (bool custom_system : {false, true}) {
+    for (const std::string& content : probe_contents) {
+      ChatCompletionRequest request;
+      auto f_add_message = [&request](const std::string& role, const std::string& content) {
+        ChatCompletionMessage message;
+        message.role = role;
+        message.content = content;
+        request.messages.push_back(message);
+      };
+      if (custom_system) f_add_message("system", content);
+      f_add_message("user", content);
+      f_add_message("assistant", content);
+      f_add_message("user", content);
+      Result<std::vector<Data>> text_prompt =
+          CreatePrompt(conv, request, probe_config, DLDevice{kDLCPU, 0});
+      Result<std::vector<Data>> token_prompt =
+          CreatePrompt(conv, request, probe_config, DLDevice{kDLCPU, 0}, compiled.get());
+      if (text_prompt.IsErr() || token_prompt.IsErr()) {
+        // The template does not support the probe roles.
+        compiled->exact_ = false;
+        return compiled;
+      }
+      std::vector<int32_t> text_token_ids;
+      for (const Data& data : text_prompt.Unwrap()) {
+        if (const auto* text_data = data.as<TextDataNode>()) {
+          std::vector<int32_t> token_ids = compiled->tokenizer_->Encode(text_data->text);
+          text_token_ids.insert(text_token_ids.end(), token_ids.begin(), token_ids.end());
+        } else if (const auto* token_data = data.as<TokenDataNode>()) {
+          text_token_ids.insert(text_token_ids.end(), token_data->token_ids.begin(),
+                                token_data->token_ids.end());
+        }
+      }
+      std::vector<int32_t> span_token_ids;
+      for (const Data& data : token_prompt.Unwrap()) {
+        const auto* token_data = data.as<TokenDataNode>();
+        ICHECK(token_data != nullptr);
+        span_token_ids.insert(span_token_ids.end(), token_data->token_ids.begin(),
+                              token_data->token_ids.end());
+      }
+      if (span_token_ids != text_token_ids) {
+        compiled->exact_ = false;
+        return compiled;
+      }
+    }
+  }
+  return compiled;
+}
+
+const std::vector<int32_t>& CompiledConversation::EncodeLiteral(const std::string& text,
+                                                                bool is_leading) const {
+  std::unordered_map<std::string, std::vector<int32_t>>& cache = literal_cache_[is_leading];
+  {
+    std::lock_guard<std::mutex> lock(literal_cache_mutex_);
+    auto it = cache.find(text);
+    if (it != cache.end()) {
+      return it->second;
+    }
+  }
+  std::vector<int32_t> token_ids = EncodeContent(text, is_leading);
+  std::lock_guard<std::mutex> lock(literal_cache_mutex_);
+  // The literals are from the template, so the number of cached literals is bounded.
+  return cache.emplace(text, std::move(token_ids)).first->second;
+}
+
+std::vector<int32_t> CompiledConversation::EncodeContent(const std::string& text,
+                                                         bool is_leading) const {
+  return is_leading ? tokenizer_->Encode(text) : tokenizer_->EncodeNoPrependSpace(text);
+}
+
 Result<Conversation> Conversation::FromJSON(const picojson::object& json_obj) {
   using TResult = Result<Conversation>;
   Conversation conv;
@@ -3,14 +3,18 @@
 
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <typeinfo>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 #include "../serve/data.h"
 #include "../support/result.h"
+#include "../tokenizers/tokenizers.h"
 #include "openai_api_protocol.h"
 #include "picojson.h"
 
@@ -142,10 +146,62 @@ struct Conversation {
   static Result<Conversation> FromJSON(const std::string& json_str);
 };
 
-/*! \brief Create the list of prompts from the messages based on the conversation template. */
+/*!
+ * \brief The conversation template compiled with the tokenizer. The prompt is rendered as token
+ * data, where the template literals (the system text, the roles, the literal parts of the role
+ * templates and the separators) are tokenized once and reused as token spans, and only the
+ * message contents are tokenized for each request.
+ *
+ * Rendering the token spans is the same as tokenizing the prompt text only when the tokenizer
+ * does not merge tokens across the boundaries of the literals and the contents, which holds when
+ * the literals start and end with special tokens. This is verified with probe conversations when
+ * compiling, and the templates that fail the verification are not exact and keep the text prompt.
+ */
+class CompiledConversation {
+ public:
+  /*! \brief Compile the conversation template with the given tokenizer. */
+  static std::unique_ptr<CompiledConversation> Compile(const Conversation& conv,
+                                                       Tokenizer tokenizer);
+
+  /*! \brief Whether rendering token spans is verified to be the same as the text prompt. */
+  bool IsExact() const { return exact_; }
+
+  /*!
+   * \brief Get the token ids of a template literal, which are cached after the first call.
+   * \param text The literal text.
+   * \param is_leading Whether the text starts a text segment of the prompt. The space is only
+   * prepended in the encoding of the leading text, as if the text segment is tokenized as a whole.
+   */
+  const std::vector<int32_t>& EncodeLiteral(const std::string& text, bool is_leading) const;
+
+  /*! \brief Get the token ids of a message content, with the same convention as EncodeLiteral. */
+  std::vector<int32_t> EncodeContent(const std::string& text, bool is_leading) const;
+
+ private:
+  explicit CompiledConversation(Tokenizer tokenizer) : tokenizer_(std::move(tokenizer)) {}
+
+  /*! \brief The tokenizer. */
+  Tokenizer tokenizer_;
+  /*! \brief Whether rendering token spans is verified to be exact. */
+  bool exact_ = false;
+  /*! \brief The mutex of the literal caches, which are shared by the request submission threads. */
+  mutable std::mutex literal_cache_mutex_;
+  /*!
+   * \brief The cached token ids of the literals, for the leading and the non-leading literals
+   * respectively. The cached vectors are never erased, so the references to them stay valid.
+   */
+  mutable std::unordered_map<std::string, std::vector<int32_t>> literal_cache_[2];
+};
+
+/*!
+ * \brief Create the list of prompts from the messages based on the conversation template.
+ * \param compiled_conv The compiled conversation template. When it is given and exact, the texts
+ * are rendered as token data with the cached template literal token spans.
+ */
 Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
                                        const ChatCompletionRequest& request,
-                                       const ModelConfig& config, DLDevice device);
+                                       const ModelConfig& config, DLDevice device,
+                                       const CompiledConversation* compiled_conv = nullptr);
 
 }  // namespace json_ffi
 }  // namespace llm
@@ -0,0 +1,673 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file json_ffi/http_server.cc
+ * \brief The native HTTP server serving the OpenAI chat completion API on JSONFFIEngine.
+ *
+ * The server runs an epoll event loop on a standalone thread, which parses the HTTP/1.1
+ * requests, passes them to the engine call thread for submission to the JSON FFI engine, and
+ * writes the responses back. The streaming requests are answered with server-sent events. The
+ * engine stream outputs are passed from the stream back thread to the event loop through a
+ * lock-free queue and an eventfd, so the event loop never blocks on the engine.
+ *
+ * Endpoints:
+ *  - POST /v1/chat/completions
+ *  - GET /health
+ */
+#include <picojson.h>
+#include <tvm/runtime/module.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../support/lock_free_queue.h"
+#include "http_utils.h"
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif  // __linux__
+
+namespace mlc {
+namespace llm {
+namespace json_ffi {
+
+using namespace tvm::runtime;
+
+#ifdef __linux__
+
+/*! \brief A chat completion response chunk from the engine, routed to its connection. */
+struct ResponseChunk {
+  /*! \brief The request id of the chunk. */
+  std::string request_id;
+  /*! \brief The chunk JSON object. */
+  picojson::value chunk;
+};
+
+/*! \brief A call to the JSON FFI engine, made on the engine call thread. */
+struct EngineCall {
+  /*! \brief The request id of the call. */
+  std::string request_id;
+  /*! \brief The request JSON string to submit, or std::nullopt to abort the request. */
+  std::optional<std::string> request_json_str;
+};
+
+/*! \brief The native HTTP server on JSONFFIEngine. */
+class JSONFFIHTTPServer : public ModuleNode {
+ public:
+  ~JSONFFIHTTPServer() { Stop(); }
+
+  /*!
+   * \brief Create and load the JSON FFI engine, and start its background loops.
+   * \param device_type The device type to run the models on.
+   * \param device_id The device id to run the models on.
+   * \param engine_config_json_str The engine config JSON string.
+   */
+  void InitEngine(int device_type, int device_id, String engine_config_json_str) {
+    CHECK(!engine_.defined()) << "The engine of the server has been initialized.";
+    const PackedFunc* fcreate = Registry::Get("mlc.json_ffi.CreateJSONFFIEngine");
+    ICHECK(fcreate != nullptr) << "Cannot find mlc.json_ffi.CreateJSONFFIEngine";
+    engine_ = (*fcreate)();
+    fchat_completion_ = engine_.GetFunction("chat_completion");
+    fabort_ = engine_.GetFunction("abort");
+    fget_last_error_ = engine_.GetFunction("get_last_error");
+    PackedFunc callback([this](TVMArgs args, TVMRetValue* ret) {
+      std::string responses_json_str = args[0];
+      OnEngineResponses(responses_json_str);
+    });
+    engine_.GetFunction("init_background_engine")(device_type, device_id, callback);
+    Module engine = engine_;
+    background_loop_thread_ =
+        std::thread([engine]() { engine.GetFunction("run_background_loop")(); });
+    stream_back_loop_thread_ =
+        std::thread([engine]() { engine.GetFunction("run_background_stream_back_loop")(); });
+    engine_.GetFunction("reload")(engine_config_json_str);
+  }
+
+  /*!
+   * \brief Start serving on the given address.
+   * \param host The IPv4 address to listen on.
+   * \param port The port to listen on.
+   */
+  void Start(String host, int port) {
+    CHECK(engine_.defined()) << "The engine of the server has not been initialized.";
+    CHECK(!event_loop_thread_.joinable()) << "The server has been started.";
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    CHECK_GE(listen_fd_, 0) << "Failed to create the socket: " << strerror(errno);
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    CHECK_EQ(inet_pton(AF_INET, std::string(host).c_str(), &addr.sin_addr), 1)
+        << "Invalid IPv4 address " << host;
+    CHECK_EQ(bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+        << "Failed to bind " << host << ":" << port << ": " << strerror(errno);
+    CHECK_EQ(listen(listen_fd_, SOMAXCONN), 0) << "Failed to listen: " << strerror(errno);
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    CHECK_GE(epoll_fd_, 0) << "Failed to create epoll: " << strerror(errno);
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_GE(event_fd_, 0) << "Failed to create eventfd: " << strerror(errno);
+    AddToEpoll(listen_fd_, EPOLLIN);
+    AddToEpoll(event_fd_, EPOLLIN);
+    exit_now_ = false;
+    exit_engine_calls_ = false;
+    engine_call_thread_ = std::thread([this]() { RunEngineCallLoop(); });
+    event_loop_thread_ = std::thread([this]() { RunEventLoop(); });
+  }
+
+  /*! \brief Stop the server and the engine. */
+  void Stop() {
+    bool started = event_loop_thread_.joinable();
+    if (started) {
+      exit_now_ = true;
+      WakeUpEventLoop();
+      event_loop_thread_.join();
+      {
+        std::lock_guard<std::mutex> lock(engine_call_mutex_);
+        exit_engine_calls_ = true;
+        engine_calls_.clear();
+      }
+      engine_call_cv_.notify_one();
+      engine_call_thread_.join();
+    }
+    // The stream back loop keeps writing to the eventfd until it exits,
+    // so the fds are closed only after the engine loops are joined.
+    if (engine_.defined()) {
+      engine_.GetFunction("exit_background_loop")();
+      background_loop_thread_.join();
+      stream_back_loop_thread_.join();
+      engine_ = Module(nullptr);
+    }
+    if (started) {
+      for (auto& [fd, conn] : connections_) {
+        close(fd);
+      }
+      connections_.clear();
+      request_connections_.clear();
+      close(listen_fd_);
+      close(epoll_fd_);
+      close(event_fd_);
+      listen_fd_ = -1;
+      epoll_fd_ = -1;
+      event_fd_ = -1;
+    }
+  }
+
+  TVM_MODULE_VTABLE_BEGIN("mlc.json_ffi.http_server");
+  TVM_MODULE_VTABLE_ENTRY("init_engine", &JSONFFIHTTPServer::InitEngine);
+  TVM_MODULE_VTABLE_ENTRY("start", &JSONFFIHTTPServer::Start);
+  TVM_MODULE_VTABLE_ENTRY("stop", &JSONFFIHTTPServer::Stop);
+  TVM_MODULE_VTABLE_END();
+
+ private:
+  /*! \brief The state of a client connection. */
+  struct Connection {
+    /*! \brief The bytes received and not yet parsed. */
+    std::string in_buf;
+    /*! \brief The bytes to send. */
+    std::string out_buf;
+    /*! \brief The id of the request being served, which is empty when idle. */
+    std::string request_id;
+    /*! \brief Whether the request being served streams the response. */
+    bool stream = false;
+    /*! \brief Whether the streaming response includes the usage chunk. */
+    bool include_usage = false;
+    /*!
+     * \brief Whether the streaming response uses the chunked transfer encoding. The HTTP/1.0
+     * clients do not support it, and the end of their response is marked by closing the
+     * connection.
+     */
+    bool chunked = true;
+    /*!
+     * \brief Whether the status line of the streaming response has been sent. It is deferred to
+     * the first chunk, so that a request failing on submission gets an error status.
+     */
+    bool stream_started = false;
+    /*! \brief Whether the request failed and its remaining chunks are dropped. */
+    bool request_failed = false;
+    /*! \brief Whether the received bytes exceed the max request size. */
+    bool request_too_large = false;
+    /*! \brief Whether to close the connection after the response is sent. */
+    bool close_after_response = false;
+    /*! \brief Whether the socket is registered for writability. */
+    bool waiting_writable = false;
+    /*! \brief The model of the request, and its aggregated non-streaming response. */
+    std::string model;
+    ChatCompletionAggregate aggregate;
+  };
+
+  /*! \brief The max size of the request header. */
+  static constexpr size_t kMaxHeaderSize = 64 << 10;
+  /*! \brief The max size of the request body. */
+  static constexpr size_t kMaxBodySize = 64 << 20;
+  /*! \brief The max number of bytes buffered for the requests of a connection. */
+  static constexpr size_t kMaxBufferedRequestSize = kMaxHeaderSize + 4 + kMaxBodySize;
+
+  /************** Engine side, on the stream back thread **************/
+
+  /*! \brief Split the engine responses by request and pass them to the event loop. */
+  void OnEngineResponses(const std::string& responses_json_str) {
+    picojson::value responses;
+    std::string err = picojson::parse(responses, responses_json_str);
+    if (!err.empty() || !responses.is<picojson::array>()) {
+      LOG(WARNING) << "Invalid responses from the JSON FFI engine: " << err;
+      return;
+    }
+    for (picojson::value& chunk : responses.get<picojson::array>()) {
+      if (!chunk.is<picojson::object>() || !chunk.contains("id")) continue;
+      std::string request_id = chunk.get("id").to_str();
+      response_queue_.Push(ResponseChunk{std::move(request_id), std::move(chunk)});
+    }
+    WakeUpEventLoop();
+  }
+
+  void WakeUpEventLoop() {
+    if (event_fd_ < 0) return;
+    uint64_t one = 1;
+    ssize_t ret = write(event_fd_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  /************** Engine side, on the engine call thread **************/
+
+  /*! \brief Pass an engine call from the event loop to the engine call thread. */
+  void PushEngineCall(EngineCall call) {
+    {
+      std::lock_guard<std::mutex> lock(engine_call_mutex_);
+      engine_calls_.push_back(std::move(call));
+    }
+    engine_call_cv_.notify_one();
+  }
+
+  /*!
+   * \brief Make the engine calls in order, so that the event loop never waits for the request
+   * submissions, and an abort is always made after the submission of its request.
+   */
+  void RunEngineCallLoop() {
+    while (true) {
+      EngineCall call;
+      {
+        std::unique_lock<std::mutex> lock(engine_call_mutex_);
+        engine_call_cv_.wait(lock,
+                             [this]() { return exit_engine_calls_ || !engine_calls_.empty(); });
+        if (exit_engine_calls_) {
+          return;
+        }
+        call = std::move(engine_calls_.front());
+        engine_calls_.pop_front();
+      }
+      if (!call.request_json_str.has_value()) {
+        fabort_(call.request_id);
+        continue;
+      }
+      // A request failing in preparation streams back an error chunk and the usage chunk from
+      // the engine. The failed submissions are answered in the same way.
+      std::optional<std::string> err;
+      try {
+        bool submitted = fchat_completion_(call.request_json_str.value(), call.request_id);
+        if (!submitted) {
+          String last_error = fget_last_error_();
+          err = std::string(last_error);
+        }
+      } catch (const std::exception& e) {
+        err = e.what();
+      }
+      if (err.has_value()) {
+        std::vector<picojson::value> chunks =
+            MakeChatCompletionErrorChunks(call.request_id, err.value());
+        for (picojson::value& chunk : chunks) {
+          response_queue_.Push(ResponseChunk{call.request_id, std::move(chunk)});
+        }
+        WakeUpEventLoop();
+      }
+    }
+  }
+
+  /************** Event loop **************/
+
+  void RunEventLoop() {
+    constexpr int kMaxEvents = 256;
+    epoll_event events[kMaxEvents];
+    while (!exit_now_) {
+      int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, /*timeout=*/-1);
+      if (num_events < 0) {
+        CHECK_EQ(errno, EINTR) << "epoll_wait failed: " << strerror(errno);
+        continue;
+      }
+      for (int i = 0; i < num_events; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == listen_fd_) {
+          AcceptConnections();
+        } else if (fd == event_fd_) {
+          uint64_t count;
+          while (read(event_fd_, &count, sizeof(count)) > 0) {
+          }
+          DrainResponses();
+        } else {
+          uint32_t ev = events[i].events;
+          if (ev & (EPOLLERR | EPOLLHUP)) {
+            CloseConnection(fd);
+            continue;
+          }
+          if ((ev & EPOLLIN) && !ReadConnection(fd)) {
+            continue;
+          }
+          if (ev & EPOLLOUT) {
+            FlushConnection(fd);
+          }
+        }
+      }
+    }
+  }
+
+  void AddToEpoll(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    CHECK_EQ(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev), 0)
+        << "epoll_ctl failed: " << strerror(errno);
+  }
+
+  void AcceptConnections() {
+    while (true) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      connections_[fd] = Connection();
+      AddToEpoll(fd, EPOLLIN | EPOLLRDHUP);
+    }
+  }
+
+  /*!
+   * \brief Read the available bytes of the connection and handle the complete requests.
+   * \return Whether the connection is still open.
+   */
+  bool ReadConnection(int fd) {
+    Connection& conn = connections_.at(fd);
+    char buf[16 << 10];
+    while (true) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        // The bytes after an oversized request or a closing request are dropped.
+        if (!conn.request_too_large && !conn.close_after_response) {
+          conn.in_buf.append(buf, n);
+          if (conn.in_buf.size() > kMaxBufferedRequestSize) {
+            conn.in_buf.clear();
+            conn.request_too_large = true;
+          }
+        }
+        continue;
+      }
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // The client closed the connection.
+        CloseConnection(fd);
+        return false;
+      }
+      if (errno != EINTR) break;
+    }
+    return HandleBufferedRequests(fd);
+  }
+
+  /*!
+   * \brief Handle the complete requests in the read buffer of an idle connection. The
+   * requests are handled one at a time, and the pipelined ones wait for the previous response.
+   * \return Whether the connection is still open.
+   */
+  bool HandleBufferedRequests(int fd) {
+    Connection& conn = connections_.at(fd);
+    while (conn.request_id.empty() && !conn.close_after_response) {
+      size_t header_end = conn.in_buf.find("\r\n\r\n");
+      if (header_end == std::string::npos && conn.in_buf.size() > kMaxHeaderSize) {
+        conn.close_after_response = true;
+        SendSimpleResponse(&conn, 431, "Request Header Fields Too Large", "");
+        break;
+      }
+      if (conn.request_too_large) {
+        conn.close_after_response = true;
+        SendSimpleResponse(&conn, 413, "Payload Too Large", "");
+        break;
+      }
+      if (header_end == std::string::npos) {
+        break;
+      }
+      HTTPRequestHeader header;
+      if (!ParseHTTPRequestHeader(conn.in_buf.substr(0, header_end), &header)) {
+        conn.close_after_response = true;
+        SendSimpleResponse(&conn, 400, "Bad Request", "");
+        break;
+      }
+      if (header.content_length > kMaxBodySize) {
+        conn.close_after_response = true;
+        SendSimpleResponse(&conn, 413, "Payload Too Large", "");
+        break;
+      }
+      size_t body_begin = header_end + 4;
+      if (conn.in_buf.size() < body_begin + header.content_length) {
+        break;
+      }
+      std::string body = conn.in_buf.substr(body_begin, header.content_length);
+      conn.in_buf.erase(0, body_begin + header.content_length);
+      conn.close_after_response = !header.keep_alive;
+      conn.chunked = header.version != "HTTP/1.0";
+      HandleRequest(fd, &conn, header.method, header.path, body);
+    }
+    return FlushConnection(fd);
+  }
+
+  void HandleRequest(int fd, Connection* conn, const std::string& method,
+                     const std::string& path, const std::string& body) {
+    if (path == "/health" && method == "GET") {
+      SendSimpleResponse(conn, 200, "OK", "application/json", "{\"status\": \"ok\"}");
+      return;
+    }
+    if (path != "/v1/chat/completions") {
+      SendSimpleResponse(conn, 404, "Not Found", "");
+      return;
+    }
+    if (method != "POST") {
+      SendSimpleResponse(conn, 405, "Method Not Allowed", "");
+      return;
+    }
+    picojson::value request;
+    std::string err = picojson::parse(request, body);
+    if (!err.empty() || !request.is<picojson::object>()) {
+      SendSimpleResponse(conn, 400, "Bad Request", "application/json",
+                         ErrorResponseJSON("Invalid JSON request: " + err));
+      return;
+    }
+    const picojson::object& request_obj = request.get<picojson::object>();
+    auto it_stream = request_obj.find("stream");
+    conn->stream = it_stream != request_obj.end() && it_stream->second.is<bool>() &&
+                   it_stream->second.get<bool>();
+    conn->include_usage = false;
+    auto it_options = request_obj.find("stream_options");
+    if (it_options != request_obj.end() && it_options->second.is<picojson::object>() &&
+        it_options->second.contains("include_usage")) {
+      const picojson::value& include_usage = it_options->second.get("include_usage");
+      conn->include_usage = include_usage.is<bool>() && include_usage.get<bool>();
+    }
+    auto it_model = request_obj.find("model");
+    conn->model = it_model != request_obj.end() && it_model->second.is<std::string>()
+                      ? it_model->second.get<std::string>()
+                      : "";
+    conn->aggregate = ChatCompletionAggregate();
+    conn->stream_started = false;
+    conn->request_failed = false;
+    if (conn->stream && !conn->chunked) {
+      conn->close_after_response = true;
+    }
+    conn->request_id = "chatcmpl-" + std::to_string(next_request_index_++);
+    request_connections_[conn->request_id] = fd;
+    PushEngineCall(EngineCall{conn->request_id, body});
+  }
+
+  /*! \brief Send the status line and the headers of the streaming response. */
+  static void StartStreamResponse(Connection* conn) {
+    conn->out_buf +=
+        "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n";
+    if (conn->chunked) {
+      conn->out_buf += "Transfer-Encoding: chunked\r\n";
+    }
+    conn->out_buf += conn->close_after_response ? "Connection: close\r\n\r\n"
+                                                : "Connection: keep-alive\r\n\r\n";
+    conn->stream_started = true;
+  }
+
+  /*! \brief Append an event of the streaming response. */
+  static void AppendStreamEvent(Connection* conn, const std::string& event) {
+    conn->out_buf += conn->chunked ? EncodeHTTPChunk(event) : event;
+  }
+
+  /*! \brief Route the engine response chunks to their connections. */
+  void DrainResponses() {
+    ResponseChunk response;
+    std::vector<int> touched_fds;
+    while (response_queue_.TryPop(&response)) {
+      auto it = request_connections_.find(response.request_id);
+      if (it == request_connections_.end()) {
+        // The connection has been closed.
+        continue;
+      }
+      int fd = it->second;
+      Connection& conn = connections_.at(fd);
+      bool is_final = IsFinalChatCompletionChunk(response.chunk);
+      if (conn.request_failed) {
+        // The error response has been sent.
+      } else if (conn.stream) {
+        if (!conn.stream_started) {
+          std::optional<std::string> error = GetChatCompletionChunkError(response.chunk);
+          if (error.has_value()) {
+            // The request failed before any output, which gets an error status.
+            conn.request_failed = true;
+            SendSimpleResponse(&conn, 400, "Bad Request", "application/json",
+                               ErrorResponseJSON(error.value()));
+          } else {
+            StartStreamResponse(&conn);
+          }
+        }
+        if (!conn.request_failed && (!is_final || conn.include_usage)) {
+          AppendStreamEvent(&conn, "data: " + response.chunk.serialize() + "\n\n");
+        }
+        if (!conn.request_failed && is_final) {
+          AppendStreamEvent(&conn, "data: [DONE]\n\n");
+          if (conn.chunked) {
+            conn.out_buf += "0\r\n\r\n";
+          }
+        }
+      } else {
+        AggregateChatCompletionChunk(response.chunk, &conn.aggregate);
+        if (is_final && conn.aggregate.error.has_value()) {
+          SendSimpleResponse(&conn, 400, "Bad Request", "application/json",
+                             ErrorResponseJSON(conn.aggregate.error.value()));
+        } else if (is_final) {
+          SendSimpleResponse(
+              &conn, 200, "OK", "application/json",
+              BuildChatCompletionJSON(conn.request_id, conn.model, conn.aggregate,
+                                      response.chunk.get("usage")));
+        }
+      }
+      if (is_final) {
+        request_connections_.erase(it);
+        conn.request_id.clear();
+      }
+      touched_fds.push_back(fd);
+    }
+    for (int fd : touched_fds) {
+      if (connections_.count(fd) && FlushConnection(fd)) {
+        // Serve the next pipelined request of the connection.
+        HandleBufferedRequests(fd);
+      }
+    }
+  }
+
+  void SendSimpleResponse(Connection* conn, int status, const std::string& reason,
+                          const std::string& content_type, const std::string& body = "") {
+    conn->out_buf += "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+    if (!content_type.empty()) {
+      conn->out_buf += "Content-Type: " + content_type + "\r\n";
+    }
+    conn->out_buf += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    conn->out_buf += conn->close_after_response ? "Connection: close\r\n\r\n"
+                                                : "Connection: keep-alive\r\n\r\n";
+    conn->out_buf += body;
+  }
+
+  /*!
+   * \brief Send the buffered bytes of the connection, and wait for writability if the socket
+   * buffer is full.
+   * \return Whether the connection is still open.
+   */
+  bool FlushConnection(int fd) {
+    Connection& conn = connections_.at(fd);
+    size_t sent = 0;
+    while (sent < conn.out_buf.size()) {
+      ssize_t n = send(fd, conn.out_buf.data() + sent, conn.out_buf.size() - sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        sent += n;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        CloseConnection(fd);
+        return false;
+      }
+    }
+    conn.out_buf.erase(0, sent);
+    bool need_writable = !conn.out_buf.empty();
+    if (need_writable != conn.waiting_writable) {
+      epoll_event ev{};
+      ev.events = EPOLLIN | EPOLLRDHUP | (need_writable ? EPOLLOUT : 0);
+      ev.data.fd = fd;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+      conn.waiting_writable = need_writable;
+    }
+    if (conn.out_buf.empty() && conn.request_id.empty() && conn.close_after_response) {
+      CloseConnection(fd);
+      return false;
+    }
+    return true;
+  }
+
+  /*! \brief Close the connection, and abort its request in flight. */
+  void CloseConnection(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) return;
+    if (!it->second.request_id.empty()) {
+      request_connections_.erase(it->second.request_id);
+      PushEngineCall(EngineCall{it->second.request_id, std::nullopt});
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections_.erase(it);
+  }
+
+  /*! \brief The JSON FFI engine module and its functions. */
+  Module engine_{nullptr};
+  PackedFunc fchat_completion_;
+  PackedFunc fabort_;
+  PackedFunc fget_last_error_;
+  /*! \brief The threads running the engine background loops. */
+  std::thread background_loop_thread_;
+  std::thread stream_back_loop_thread_;
+
+  /*! \brief The engine calls passed from the event loop to the engine call thread. */
+  std::thread engine_call_thread_;
+  std::mutex engine_call_mutex_;
+  std::condition_variable engine_call_cv_;
+  std::deque<EngineCall> engine_calls_;
+  bool exit_engine_calls_ = false;
+
+  /*! \brief The engine response chunks passed from the stream back thread to the event loop. */
+  MPSCQueue<ResponseChunk> response_queue_;
+
+  /*! \brief The event loop states, which are only accessed on the event loop thread. */
+  std::thread event_loop_thread_;
+  std::atomic<bool> exit_now_ = false;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+  std::unordered_map<int, Connection> connections_;
+  /*! \brief The connection fd serving each request in flight. */
+  std::unordered_map<std::string, int> request_connections_;
+  int64_t next_request_index_ = 0;
+};
+
+TVM_REGISTER_GLOBAL("mlc.json_ffi.CreateHTTPServer").set_body_typed([]() {
+  return Module(make_object<JSONFFIHTTPServer>());
+});
+
+#else  // __linux__
+
+TVM_REGISTER_GLOBAL("mlc.json_ffi.CreateHTTPServer").set_body_typed([]() {
+  LOG(FATAL) << "The native HTTP server is only supported on Linux.";
+  return Module(nullptr);
+});
+
+#endif  // __linux__
+
+}  // namespace json_ffi
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,189 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file json_ffi/http_utils.cc
+ * \brief The implementation of the HTTP message utilities.
+ */
+#include "http_utils.h"
+
+#include <cctype>
+#include <cstdio>
+
+#include "openai_api_protocol.h"
+
+namespace mlc {
+namespace llm {
+namespace json_ffi {
+
+/*! \brief Lowercase the string in place. */
+static void ToLower(std::string* str) {
+  for (char& c : *str) {
+    c = std::tolower(static_cast<unsigned char>(c));
+  }
+}
+
+bool ParseHTTPRequestHeader(const std::string& header, HTTPRequestHeader* result) {
+  size_t line_end = header.find("\r\n");
+  std::string request_line = header.substr(0, line_end);
+  size_t sp1 = request_line.find(' ');
+  size_t sp2 = sp1 == std::string::npos ? std::string::npos : request_line.find(' ', sp1 + 1);
+  if (sp1 == std::string::npos || sp2 == std::string::npos) {
+    return false;
+  }
+  result->method = request_line.substr(0, sp1);
+  result->path = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+  result->version = request_line.substr(sp2 + 1);
+  if (result->version != "HTTP/1.0" && result->version != "HTTP/1.1") {
+    return false;
+  }
+  result->content_length = 0;
+  result->keep_alive = result->version == "HTTP/1.1";
+  size_t pos = line_end == std::string::npos ? header.size() : line_end + 2;
+  while (pos < header.size()) {
+    size_t end = header.find("\r\n", pos);
+    if (end == std::string::npos) end = header.size();
+    std::string line = header.substr(pos, end - pos);
+    pos = end + 2;
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string key = line.substr(0, colon);
+    ToLower(&key);
+    size_t value_begin = line.find_first_not_of(' ', colon + 1);
+    size_t value_end = line.find_last_not_of(' ');
+    std::string value = value_begin == std::string::npos
+                            ? ""
+                            : line.substr(value_begin, value_end - value_begin + 1);
+    if (key == "content-length") {
+      // Only plain decimal digits, so that the signs and the overflows are rejected.
+      if (value.empty() || value.size() > 18 ||
+          value.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+      }
+      result->content_length = std::stoull(value);
+    } else if (key == "connection") {
+      ToLower(&value);
+      if (value == "close") result->keep_alive = false;
+      if (value == "keep-alive") result->keep_alive = true;
+    } else if (key == "transfer-encoding") {
+      // Chunked request bodies are not supported.
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string EncodeHTTPChunk(const std::string& data) {
+  char size_line[32];
+  snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+  return size_line + data + "\r\n";
+}
+
+std::string ErrorResponseJSON(const std::string& message) {
+  picojson::object error;
+  error["message"] = picojson::value(message);
+  picojson::object ret;
+  ret["error"] = picojson::value(error);
+  return picojson::value(ret).serialize();
+}
+
+bool IsFinalChatCompletionChunk(const picojson::value& chunk) {
+  return chunk.contains("usage") && !chunk.get("usage").is<picojson::null>();
+}
+
+std::optional<std::string> GetChatCompletionChunkError(const picojson::value& chunk) {
+  if (!chunk.contains("choices") || !chunk.get("choices").is<picojson::array>()) {
+    return std::nullopt;
+  }
+  for (const picojson::value& choice : chunk.get("choices").get<picojson::array>()) {
+    if (!choice.contains("finish_reason") || !choice.get("finish_reason").is<std::string>() ||
+        choice.get("finish_reason").get<std::string>() != "error") {
+      continue;
+    }
+    // The error message is streamed back as the delta content.
+    if (choice.contains("delta") && choice.get("delta").contains("content") &&
+        choice.get("delta").get("content").is<std::string>()) {
+      return choice.get("delta").get("content").get<std::string>();
+    }
+    return std::string("The request failed.");
+  }
+  return std::nullopt;
+}
+
+void AggregateChatCompletionChunk(const picojson::value& chunk,
+                                  ChatCompletionAggregate* aggregate) {
+  if (!aggregate->error.has_value()) {
+    aggregate->error = GetChatCompletionChunkError(chunk);
+  }
+  if (!chunk.contains("choices") || !chunk.get("choices").is<picojson::array>()) return;
+  for (const picojson::value& choice : chunk.get("choices").get<picojson::array>()) {
+    if (!choice.is<picojson::object>()) continue;
+    int64_t index = choice.contains("index") && choice.get("index").is<int64_t>()
+                        ? choice.get("index").get<int64_t>()
+                        : 0;
+    if (index < 0) continue;
+    if (static_cast<int64_t>(aggregate->contents.size()) <= index) {
+      aggregate->contents.resize(index + 1);
+      aggregate->finish_reasons.resize(index + 1);
+    }
+    if (choice.contains("delta") && choice.get("delta").contains("content") &&
+        choice.get("delta").get("content").is<std::string>()) {
+      aggregate->contents[index] += choice.get("delta").get("content").get<std::string>();
+    }
+    if (choice.contains("finish_reason") && !choice.get("finish_reason").is<picojson::null>()) {
+      aggregate->finish_reasons[index] = choice.get("finish_reason");
+    }
+  }
+}
+
+std::string BuildChatCompletionJSON(const std::string& request_id, const std::string& model,
+                                    const ChatCompletionAggregate& aggregate,
+                                    const picojson::value& usage) {
+  picojson::array choices;
+  for (int i = 0; i < static_cast<int>(aggregate.contents.size()); ++i) {
+    picojson::object message;
+    message["role"] = picojson::value("assistant");
+    message["content"] = picojson::value(aggregate.contents[i]);
+    picojson::object choice;
+    choice["index"] = picojson::value(static_cast<int64_t>(i));
+    choice["message"] = picojson::value(message);
+    choice["finish_reason"] = aggregate.finish_reasons[i];
+    choices.push_back(picojson::value(choice));
+  }
+  picojson::object response;
+  response["id"] = picojson::value(request_id);
+  response["object"] = picojson::value("chat.completion");
+  response["model"] = picojson::value(model);
+  response["choices"] = picojson::value(choices);
+  response["usage"] = usage;
+  return picojson::value(response).serialize();
+}
+
+std::vector<picojson::value> MakeChatCompletionErrorChunks(const std::string& request_id,
+                                                           const std::string& error) {
+  ChatCompletionMessage delta;
+  delta.content = error;
+  delta.role = "assistant";
+  ChatCompletionStreamResponseChoice choice;
+  choice.finish_reason = FinishReason::error;
+  choice.index = 0;
+  choice.delta = delta;
+  ChatCompletionStreamResponse response;
+  response.id = request_id;
+  response.choices = {choice};
+  response.model = "json_ffi";
+  response.system_fingerprint = "";
+  std::vector<picojson::value> chunks;
+  chunks.push_back(picojson::value(response.AsJSON()));
+
+  response.choices.clear();
+  picojson::object usage;
+  usage["prompt_tokens"] = picojson::value(static_cast<int64_t>(0));
+  usage["completion_tokens"] = picojson::value(static_cast<int64_t>(0));
+  usage["total_tokens"] = picojson::value(static_cast<int64_t>(0));
+  response.usage = picojson::value(usage);
+  chunks.push_back(picojson::value(response.AsJSON()));
+  return chunks;
+}
+
+}  // namespace json_ffi
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,86 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file json_ffi/http_utils.h
+ * \brief The HTTP message utilities of the native HTTP server on JSONFFIEngine.
+ */
+#ifndef MLC_LLM_JSON_FFI_HTTP_UTILS_H_
+#define MLC_LLM_JSON_FFI_HTTP_UTILS_H_
+
+#include <picojson.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace json_ffi {
+
+/*! \brief The request line and the headers of an HTTP request that the server cares about. */
+struct HTTPRequestHeader {
+  std::string method;
+  std::string path;
+  /*! \brief The HTTP version, which is either "HTTP/1.0" or "HTTP/1.1". */
+  std::string version;
+  size_t content_length = 0;
+  /*! \brief Whether the connection persists after the response. */
+  bool keep_alive = true;
+};
+
+/*!
+ * \brief Parse the request line and the headers of an HTTP request.
+ * \param header The header bytes before the empty line.
+ * \param result The parsed header.
+ * \return Whether the header is valid. Chunked request bodies are not supported.
+ */
+bool ParseHTTPRequestHeader(const std::string& header, HTTPRequestHeader* result);
+
+/*! \brief Encode the data as a chunk of the chunked transfer encoding. */
+std::string EncodeHTTPChunk(const std::string& data);
+
+/*! \brief The JSON body of an error response. */
+std::string ErrorResponseJSON(const std::string& message);
+
+/*! \brief The non-streaming chat completion response aggregated from the stream chunks. */
+struct ChatCompletionAggregate {
+  /*! \brief The content of each choice. */
+  std::vector<std::string> contents;
+  /*! \brief The finish reason of each choice. */
+  std::vector<picojson::value> finish_reasons;
+  /*! \brief The error message when any choice finishes with an error. */
+  std::optional<std::string> error;
+};
+
+/*! \brief Whether the chunk is the usage chunk, which is the last chunk of a request. */
+bool IsFinalChatCompletionChunk(const picojson::value& chunk);
+
+/*! \brief Get the error message of the chunk when any choice in it finishes with an error. */
+std::optional<std::string> GetChatCompletionChunkError(const picojson::value& chunk);
+
+/*! \brief Accumulate the deltas of a stream chunk into the aggregated response. */
+void AggregateChatCompletionChunk(const picojson::value& chunk, ChatCompletionAggregate* aggregate);
+
+/*!
+ * \brief Build the non-streaming chat completion response.
+ * \param request_id The id of the request.
+ * \param model The model of the request.
+ * \param aggregate The response aggregated from the stream chunks.
+ * \param usage The usage of the final chunk.
+ * \return The response JSON string.
+ */
+std::string BuildChatCompletionJSON(const std::string& request_id, const std::string& model,
+                                    const ChatCompletionAggregate& aggregate,
+                                    const picojson::value& usage);
+
+/*!
+ * \brief Make the stream chunks of a failed request: the error chunk and the usage chunk, as
+ * JSONFFIEngine streams back for the requests it fails to prepare.
+ */
+std::vector<picojson::value> MakeChatCompletionErrorChunks(const std::string& request_id,
+                                                           const std::string& error);
+
+}  // namespace json_ffi
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_JSON_FFI_HTTP_UTILS_H_
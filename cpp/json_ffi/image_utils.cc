@@ -1,6 +1,13 @@
 #include "image_utils.h"
 
 #include <dmlc/io.h>
+#include <tvm/runtime/threading_backend.h>
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include "../../3rdparty/tvm/src/support/base64.h"
 #define STB_IMAGE_IMPLEMENTATION
@@ -51,106 +58,250 @@ size_t Base64DecodedSize(const std::string& base64_str) {
   return 3 * len / 4 - padding;
 }
 
-Result<NDArray> LoadImageFromBase64(const std::string& base64_str) {
-  using TResult = Result<NDArray>;
+/*! \brief Decode the base64 encoded image into RGB pixels, which are freed by stbi_image_free. */
+Result<unsigned char*> DecodeBase64Image(const std::string& base64_str, int* width, int* height) {
+  using TResult = Result<unsigned char*>;
   MemoryBufferStream stream(base64_str.c_str(), base64_str.size());
   tvm::support::Base64InStream base64_stream(&stream);
   size_t decoded_size = Base64DecodedSize(base64_str);
   std::vector<unsigned char> decoded(decoded_size);
   base64_stream.InitPosition();
   base64_stream.Read((void*)decoded.data(), decoded_size);
-  int width, height, num_channels;
+  int num_channels;
   unsigned char* image_data =
-      stbi_load_from_memory(decoded.data(), decoded_size, &width, &height, &num_channels, 3);
+      stbi_load_from_memory(decoded.data(), decoded_size, width, height, &num_channels, 3);
   if (!image_data) {
     return TResult::Error(stbi_failure_reason());
   }
+  return TResult::Ok(image_data);
+}
+
+Result<NDArray> LoadImageFromBase64(const std::string& base64_str) {
+  using TResult = Result<NDArray>;
+  int width, height;
+  Result<unsigned char*> image_data_res = DecodeBase64Image(base64_str, &width, &height);
+  if (image_data_res.IsErr()) {
+    return TResult::Error(image_data_res.UnwrapErr());
+  }
+  unsigned char* image_data = image_data_res.Unwrap();
   auto image_ndarray = NDArray::Empty({height, width, 3}, {kDLUInt, 8, 1}, {kDLCPU, 0});
   image_ndarray.CopyFromBytes((void*)image_data, width * height * 3);
   stbi_image_free(image_data);
   return TResult::Ok(image_ndarray);
 }
 
-NDArray ClipPreprocessor(NDArray image_data, int target_size, DLDevice device) {
-  int height = image_data->shape[0];
-  int width = image_data->shape[1];
-  // Resize
-  const int short_side = width < height ? width : height;
-  const int long_side = width > height ? width : height;
-  const int new_short_side = target_size;
-  const int new_long_side = (int)(new_short_side * (long_side / (float)short_side));
-  const int new_width = width < height ? new_short_side : new_long_side;
-  const int new_height = width > height ? new_short_side : new_long_side;
-
-  std::vector<float> processed_image_data(new_width * new_height * 3);
-
-  // Bilinear Interpolation
-  for (int y = 0; y < new_height; y++) {
-    for (int x = 0; x < new_width; x++) {
-      const float x_ratio = float(width - 1) / new_width;
-      const float y_ratio = float(height - 1) / new_height;
-      const int x1 = int(x_ratio * x);
-      const int y1 = int(y_ratio * y);
-      const int x2 = x1 + 1;
-      const int y2 = y1 + 1;
-      const float x_diff = x_ratio * x - x1;
-      const float y_diff = y_ratio * y - y1;
-      for (int c = 0; c < 3; c++) {
-        const uint8_t top_left = ((uint8_t*)image_data->data)[(y1 * width + x1) * 3 + c];
-        const uint8_t top_right = ((uint8_t*)image_data->data)[(y1 * width + x2) * 3 + c];
-        const uint8_t bottom_left = ((uint8_t*)image_data->data)[(y2 * width + x1) * 3 + c];
-        const uint8_t bottom_right = ((uint8_t*)image_data->data)[(y2 * width + x2) * 3 + c];
-        processed_image_data[(y * new_width + x) * 3 + c] =
-            (float)(int(top_left * (1 - x_diff) * (1 - y_diff) + top_right * x_diff * (1 - y_diff) +
-                        bottom_left * y_diff * (1 - x_diff) + bottom_right * x_diff * y_diff));
-      }
+/*!
+ * \brief The fused CLIP preprocessing of an RGB image: bilinear resize of the short side to the
+ * target size, center crop, rescale, normalize and HWC to CHW transpose in a single pass. Only the
+ * pixels in the crop window are interpolated, and each of them is written to the output once.
+ */
+class ClipPreprocessKernel {
+ public:
+  ClipPreprocessKernel(const uint8_t* image, int height, int width, int target_size)
+      : image_(image), width_(width), height_(height), target_size_(target_size) {
+    const int short_side = width < height ? width : height;
+    const int long_side = width > height ? width : height;
+    const int new_short_side = target_size;
+    const int new_long_side = (int)(new_short_side * (long_side / (float)short_side));
+    const int new_width = width < height ? new_short_side : new_long_side;
+    const int new_height = width > height ? new_short_side : new_long_side;
+    x_ratio_ = float(width - 1) / new_width;
+    y_ratio_ = float(height - 1) / new_height;
+    crop_x_ = (new_width - target_size) / 2;
+    crop_y_ = (new_height - target_size) / 2;
+    // The source columns and weights are shared by all output rows.
+    x1_.resize(target_size);
+    x2_.resize(target_size);
+    x_diff_.resize(target_size);
+    for (int x = 0; x < target_size; ++x) {
+      const int resized_x = x + crop_x_;
+      x1_[x] = int(x_ratio_ * resized_x);
+      x2_[x] = std::min(x1_[x] + 1, width - 1);
+      x_diff_[x] = x_ratio_ * resized_x - x1_[x];
+    }
+    for (int c = 0; c < 3; ++c) {
+      scale_[c] = 1.0f / (255.0f * kImageStd[c]);
+      bias_[c] = -kImageMean[c] / kImageStd[c];
     }
   }
 
-  // Center crop
-  const int crop_x = (new_width - target_size) / 2;
-  const int crop_y = (new_height - target_size) / 2;
-  std::vector<float> cropped_image_data(target_size * target_size * 3);
-  for (int y = 0; y < target_size; y++) {
-    for (int x = 0; x < target_size; x++) {
-      for (int c = 0; c < 3; c++) {
-        cropped_image_data[(y * target_size + x) * 3 + c] =
-            processed_image_data[((y + crop_y) * new_width + x + crop_x) * 3 + c];
+  /*! \brief Write the output rows in [row_begin, row_end) to the CHW float output. */
+  void Run(int row_begin, int row_end, float* output) const {
+    const int plane_size = target_size_ * target_size_;
+    for (int y = row_begin; y < row_end; ++y) {
+      const int resized_y = y + crop_y_;
+      const int y1 = int(y_ratio_ * resized_y);
+      const int y2 = std::min(y1 + 1, height_ - 1);
+      const float y_diff = y_ratio_ * resized_y - y1;
+      const uint8_t* top = image_ + static_cast<int64_t>(y1) * width_ * 3;
+      const uint8_t* bottom = image_ + static_cast<int64_t>(y2) * width_ * 3;
+      for (int c = 0; c < 3; ++c) {
+        float* out_row = output + c * plane_size + y * target_size_;
+        const float scale = scale_[c];
+        const float bias = bias_[c];
+        for (int x = 0; x < target_size_; ++x) {
+          const int x1 = x1_[x] * 3 + c;
+          const int x2 = x2_[x] * 3 + c;
+          const float x_diff = x_diff_[x];
+          // The interpolated value is truncated to an integer, as a resized uint8 image.
+          const float value =
+              (float)(int(top[x1] * (1 - x_diff) * (1 - y_diff) + top[x2] * x_diff * (1 - y_diff) +
+                          bottom[x1] * y_diff * (1 - x_diff) + bottom[x2] * x_diff * y_diff));
+          out_row[x] = value * scale + bias;
+        }
       }
     }
   }
 
-  // Rescale
-  for (int i = 0; i < target_size * target_size * 3; i++) {
-    cropped_image_data[i] = cropped_image_data[i] / 255.0f;
+ private:
+  static constexpr float kImageMean[3] = {0.48145466f, 0.4578275f, 0.40821073f};
+  static constexpr float kImageStd[3] = {0.26862954f, 0.26130258f, 0.27577711f};
+
+  const uint8_t* image_;
+  int width_;
+  int height_;
+  int target_size_;
+  float x_ratio_;
+  float y_ratio_;
+  int crop_x_;
+  int crop_y_;
+  std::vector<int> x1_;
+  std::vector<int> x2_;
+  std::vector<float> x_diff_;
+  float scale_[3];
+  float bias_[3];
+};
+
+/*!
+ * \brief The pool of the host staging buffers of the preprocessed images. The buffers are
+ * page-locked for CUDA and ROCm devices, so that the copies to the device are direct DMA. They
+ * are reused, as allocating page-locked memory is much slower than allocating pageable memory.
+ */
+class ImageStagingBufferPool {
+ public:
+  static ImageStagingBufferPool* Global() {
+    // Leaked on purpose, so that the buffers are not freed after the device runtime is torn down.
+    static ImageStagingBufferPool* pool = new ImageStagingBufferPool();
+    return pool;
   }
 
-  // Normalize
-  const float IMAGE_MEAN[] = {0.48145466f, 0.4578275f, 0.40821073f};
-  const float IMAGE_STD[] = {0.26862954f, 0.26130258f, 0.27577711f};
-  for (int i = 0; i < target_size * target_size * 3; i++) {
-    const int c = i % 3;
-    cropped_image_data[i] = (cropped_image_data[i] - IMAGE_MEAN[c]) / IMAGE_STD[c];
+  /*! \brief Return the host device to stage the data copied to the device. */
+  static DLDevice GetStagingDevice(DLDevice device) {
+    if (device.device_type == kDLCUDA) {
+      return {kDLCUDAHost, 0};
+    } else if (device.device_type == kDLROCM) {
+      return {kDLROCMHost, 0};
+    }
+    return {kDLCPU, 0};
   }
 
-  std::vector<float> image_data_channel_first(target_size * target_size * 3);
-  for (int y = 0; y < target_size; y++) {
-    for (int x = 0; x < target_size; x++) {
-      for (int c = 0; c < 3; c++) {
-        image_data_channel_first[c * target_size * target_size + y * target_size + x] =
-            cropped_image_data[(y * target_size + x) * 3 + c];
+  NDArray Acquire(int target_size, DLDevice staging_device) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<NDArray>& free_buffers = free_buffers_[Key(target_size, staging_device)];
+      if (!free_buffers.empty()) {
+        NDArray buffer = free_buffers.back();
+        free_buffers.pop_back();
+        return buffer;
       }
     }
+    return NDArray::Empty({1, 3, target_size, target_size}, {kDLFloat, 32, 1}, staging_device);
   }
 
-  // Create NDArray
-  auto image_ndarray = NDArray::Empty({1, 3, target_size, target_size}, {kDLFloat, 32, 1}, device);
-  image_ndarray.CopyFromBytes((void*)image_data_channel_first.data(),
-                              target_size * target_size * 3 * sizeof(float));
+  void Release(NDArray buffer) {
+    int target_size = buffer->shape[2];
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<NDArray>& free_buffers = free_buffers_[Key(target_size, buffer->device)];
+    if (free_buffers.size() < kMaxFreeBuffersPerKey) {
+      free_buffers.push_back(std::move(buffer));
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxFreeBuffersPerKey = 16;
 
+  static int64_t Key(int target_size, DLDevice device) {
+    return (static_cast<int64_t>(device.device_type) << 32) | target_size;
+  }
+
+  std::mutex mutex_;
+  std::unordered_map<int64_t, std::vector<NDArray>> free_buffers_;
+};
+
+/*!
+ * \brief Preprocess the RGB image for CLIP encoder and return an NDArray on the given device. The
+ * rows are processed in parallel when `parallel_rows` is true. The output is written directly to
+ * the result NDArray for CPU devices, or otherwise to a pooled host staging buffer.
+ */
+NDArray ClipPreprocessRGB(const uint8_t* image, int height, int width, int target_size,
+                          DLDevice device, bool parallel_rows) {
+  ClipPreprocessKernel kernel(image, height, width, target_size);
+  bool is_cpu = device.device_type == kDLCPU;
+  DLDevice staging_device = ImageStagingBufferPool::GetStagingDevice(device);
+  NDArray output =
+      is_cpu ? NDArray::Empty({1, 3, target_size, target_size}, {kDLFloat, 32, 1}, device)
+             : ImageStagingBufferPool::Global()->Acquire(target_size, staging_device);
+  float* output_data = static_cast<float*>(output->data);
+  if (parallel_rows) {
+    constexpr int kRowsPerTask = 16;
+    int num_tasks = (target_size + kRowsPerTask - 1) / kRowsPerTask;
+    tvm::runtime::parallel_for_with_threading_backend(
+        [&](int task) {
+          int row_begin = task * kRowsPerTask;
+          kernel.Run(row_begin, std::min(row_begin + kRowsPerTask, target_size), output_data);
+        },
+        0, num_tasks);
+  } else {
+    kernel.Run(0, target_size, output_data);
+  }
+  if (is_cpu) {
+    return output;
+  }
+  auto image_ndarray = NDArray::Empty({1, 3, target_size, target_size}, {kDLFloat, 32, 1}, device);
+  image_ndarray.CopyFrom(output);
+  ImageStagingBufferPool::Global()->Release(std::move(output));
   return image_ndarray;
 }
 
+NDArray ClipPreprocessor(NDArray image_data, int target_size, DLDevice device) {
+  int height = image_data->shape[0];
+  int width = image_data->shape[1];
+  return ClipPreprocessRGB(static_cast<const uint8_t*>(image_data->data), height, width,
+                           target_size, device, /*parallel_rows=*/true);
+}
+
+Result<std::vector<NDArray>> LoadClipImagesFromBase64(const std::vector<std::string>& base64_strs,
+                                                      int target_size, DLDevice device) {
+  using TResult = Result<std::vector<NDArray>>;
+  int num_images = base64_strs.size();
+  std::vector<NDArray> images(num_images);
+  std::vector<std::optional<std::string>> errors(num_images);
+  // A single image is parallelized across rows, and multiple images across images.
+  bool parallel_rows = num_images == 1;
+  auto f_process_image = [&](int i) {
+    int width, height;
+    Result<unsigned char*> image_data_res = DecodeBase64Image(base64_strs[i], &width, &height);
+    if (image_data_res.IsErr()) {
+      errors[i] = image_data_res.UnwrapErr();
+      return;
+    }
+    unsigned char* image_data = image_data_res.Unwrap();
+    images[i] = ClipPreprocessRGB(image_data, height, width, target_size, device, parallel_rows);
+    stbi_image_free(image_data);
+  };
+  if (parallel_rows) {
+    f_process_image(0);
+  } else {
+    tvm::runtime::parallel_for_with_threading_backend(f_process_image, 0, num_images);
+  }
+  for (const std::optional<std::string>& error : errors) {
+    if (error.has_value()) {
+      return TResult::Error(error.value());
+    }
+  }
+  return TResult::Ok(std::move(images));
+}
+
 }  // namespace json_ffi
 }  // namespace llm
 }  // namespace mlc
@@ -10,6 +10,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "../support/result.h"
 
@@ -24,6 +25,16 @@ Result<tvm::runtime::NDArray> LoadImageFromBase64(const std::string& base64_str)
 tvm::runtime::NDArray ClipPreprocessor(tvm::runtime::NDArray image_data, int target_size,
                                        DLDevice device);
 
+/*!
+ * \brief Load the base64 encoded images and preprocess them for CLIP encoder, in parallel across
+ * the images. The images are preprocessed from the decoded pixels in a single pass, and staged
+ * in page-locked host memory when the device is a GPU.
+ * \return The NDArrays of shape {1, 3, target_size, target_size} on the given device in the
+ * order of the inputs, or the error of the first image failing to decode.
+ */
+Result<std::vector<tvm::runtime::NDArray>> LoadClipImagesFromBase64(
+    const std::vector<std::string>& base64_strs, int target_size, DLDevice device);
+
 }  // namespace json_ffi
 }  // namespace llm
 }  // namespace mlc
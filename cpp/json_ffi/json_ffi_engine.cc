@@ -3,12 +3,15 @@
 #include <picojson.h>
 #include <tvm/runtime/module.h>
 #include <tvm/runtime/registry.h>
+#include <tvm/runtime/threading_backend.h>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 
 #include "../serve/model.h"
 #include "../support/json_parser.h"
+#include "../support/json_writer.h"
 #include "../support/result.h"
 
 namespace mlc {
@@ -17,23 +20,151 @@ namespace json_ffi {
 
 using namespace tvm::runtime;
 
-JSONFFIEngine::JSONFFIEngine() { engine_ = serve::ThreadedEngine::Create(); }
+/*!
+ * \brief The maximum number of request preparation workers. The preparation of a request is much
+ * cheaper than its decoding, so a few workers suffice to keep up with bursts of requests.
+ */
+constexpr unsigned kMaxNumRequestPrepWorkers = 4;
+
+JSONFFIEngine::JSONFFIEngine() {
+  engine_ = serve::ThreadedEngine::Create();
+  unsigned num_workers =
+      std::clamp(std::thread::hardware_concurrency() / 2, 1U, kMaxNumRequestPrepWorkers);
+  prep_workers_.reserve(num_workers);
+  for (unsigned i = 0; i < num_workers; ++i) {
+    prep_workers_.emplace_back([this]() { this->RequestPreparationLoop(); });
+  }
+}
 
 bool JSONFFIEngine::ChatCompletion(std::string request_json_str, std::string request_id) {
-  bool success = this->AddRequest(request_json_str, request_id);
-  if (!success) {
-    this->StreamBackError(request_id);
+  {
+    std::lock_guard<std::mutex> lock(prep_mutex_);
+    if (!exit_prep_workers_) {
+      pending_request_ids_.insert(request_id);
+      prep_queue_.emplace_back(std::move(request_json_str), std::move(request_id));
+      prep_queue_cv_.notify_one();
+      return true;
+    }
+  }
+  SetLastError("The JSON FFI engine has exited.");
+  return false;
+}
+
+void JSONFFIEngine::RequestPreparationLoop() {
+  while (true) {
+    std::pair<std::string, std::string> item;
+    {
+      std::unique_lock<std::mutex> lock(prep_mutex_);
+      prep_queue_cv_.wait(lock, [this]() { return exit_prep_workers_ || !prep_queue_.empty(); });
+      if (exit_prep_workers_) {
+        return;
+      }
+      item = std::move(prep_queue_.front());
+      prep_queue_.pop_front();
+      ++num_preparing_requests_;
+    }
+    const std::string& request_id = item.second;
+    // The exceptions of a request are streamed back as its error, instead of escaping the
+    // worker thread and terminating the process.
+    Result<PreparedRequest> prepared = [&]() {
+      try {
+        return PrepareRequest(item.first, request_id);
+      } catch (const std::exception& e) {
+        return Result<PreparedRequest>::Error(e.what());
+      }
+    }();
+    std::string err;
+    bool stream_back_error = false;
+    {
+      std::lock_guard<std::mutex> lock(prep_mutex_);
+      // The request is submitted under the lock, so that an abort either drops the request
+      // before it is added to the engine, or is ordered after the request in the engine.
+      if (pending_request_ids_.erase(request_id)) {
+        if (prepared.IsOk()) {
+          try {
+            SubmitPreparedRequest(prepared.Unwrap());
+          } catch (const std::exception& e) {
+            err = e.what();
+            stream_back_error = true;
+          }
+        } else {
+          err = prepared.UnwrapErr();
+          stream_back_error = true;
+        }
+      }
+      --num_preparing_requests_;
+    }
+    prep_done_cv_.notify_all();
+    if (stream_back_error) {
+      SetLastError(err);
+      try {
+        StreamBackError(request_id, std::move(err));
+      } catch (const std::exception& e) {
+        LOG(ERROR) << "Failed to stream back the error of request " << request_id << ": "
+                   << e.what();
+      }
+    }
   }
-  return success;
 }
 
-void JSONFFIEngine::StreamBackError(std::string request_id) {
+void JSONFFIEngine::WaitForRequestPreparation() {
+  std::unique_lock<std::mutex> lock(prep_mutex_);
+  prep_done_cv_.wait(lock, [this]() {
+    return exit_prep_workers_ || (prep_queue_.empty() && num_preparing_requests_ == 0);
+  });
+}
+
+void JSONFFIEngine::StopRequestPreparationWorkers() {
+  std::unordered_set<std::string> dropped_request_ids;
+  {
+    std::lock_guard<std::mutex> lock(prep_mutex_);
+    exit_prep_workers_ = true;
+    prep_queue_.clear();
+    dropped_request_ids = std::move(pending_request_ids_);
+    pending_request_ids_.clear();
+  }
+  prep_queue_cv_.notify_all();
+  prep_done_cv_.notify_all();
+  for (std::thread& worker : prep_workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  for (const std::string& request_id : dropped_request_ids) {
+    StreamBackAbort(request_id);
+  }
+}
+
+void JSONFFIEngine::InvokeRequestStreamCallback(const std::string& responses) {
+  std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+  if (this->request_stream_callback_ != nullptr) {
+    this->request_stream_callback_(responses);
+  }
+}
+
+void JSONFFIEngine::SetLastError(std::string err) {
+  std::lock_guard<std::mutex> lock(err_mutex_);
+  err_ = std::move(err);
+}
+
+void JSONFFIEngine::StreamBackError(std::string request_id, std::string error) {
+  StreamBackFinish(std::move(request_id), FinishReason::error, std::move(error));
+}
+
+void JSONFFIEngine::StreamBackAbort(std::string request_id) {
+  StreamBackFinish(std::move(request_id), FinishReason::abort, std::nullopt);
+}
+
+void JSONFFIEngine::StreamBackFinish(std::string request_id, FinishReason finish_reason,
+                                     std::optional<std::string> content) {
   ChatCompletionMessage delta;
-  delta.content = this->err_;
+  if (content.has_value()) {
+    delta.content = std::move(content.value());
+  }
   delta.role = "assistant";
 
   ChatCompletionStreamResponseChoice choice;
-  choice.finish_reason = FinishReason::error;
+  choice.finish_reason = finish_reason;
   choice.index = 0;
   choice.delta = delta;
 
@@ -58,14 +189,25 @@ void JSONFFIEngine::StreamBackError(std::string request_id) {
   response_arr.push_back(picojson::value(response.AsJSON()));
 
   std::string stream_back_json = picojson::value(response_arr).serialize();
-  this->request_stream_callback_(stream_back_json);
+  this->InvokeRequestStreamCallback(stream_back_json);
 }
 
 bool JSONFFIEngine::AddRequest(std::string request_json_str, std::string request_id) {
+  Result<PreparedRequest> prepared = PrepareRequest(request_json_str, request_id);
+  if (prepared.IsErr()) {
+    SetLastError(prepared.UnwrapErr());
+    return false;
+  }
+  SubmitPreparedRequest(prepared.Unwrap());
+  return true;
+}
+
+Result<JSONFFIEngine::PreparedRequest> JSONFFIEngine::PrepareRequest(
+    const std::string& request_json_str, const std::string& request_id) const {
+  using TResult = Result<PreparedRequest>;
   Result<ChatCompletionRequest> request_res = ChatCompletionRequest::FromJSON(request_json_str);
   if (request_res.IsErr()) {
-    err_ = request_res.UnwrapErr();
-    return false;
+    return TResult::Error(request_res.UnwrapErr());
   }
   ChatCompletionRequest request = request_res.Unwrap();
   Array<Data> inputs;
@@ -77,10 +219,10 @@ bool JSONFFIEngine::AddRequest(std::string request_json_str, std::string request
   if (!is_special_request) {
     // get prompt: note, assistant was appended in the end.
     Result<std::vector<Data>> inputs_obj =
-        CreatePrompt(this->conv_template_, request, this->model_config_, this->device_);
+        CreatePrompt(this->conv_template_, request, this->model_config_, this->device_,
+                     this->compiled_conv_template_.get());
     if (inputs_obj.IsErr()) {
-      err_ = inputs_obj.UnwrapErr();
-      return false;
+      return TResult::Error(inputs_obj.UnwrapErr());
     }
     inputs = inputs_obj.Unwrap();
 
@@ -116,37 +258,57 @@ bool JSONFFIEngine::AddRequest(std::string request_json_str, std::string request
 
   Result<GenerationConfig> res_gen_config = GenerationConfig::Validate(GenerationConfig(gen_cfg));
   if (res_gen_config.IsErr()) {
-    err_ = res_gen_config.UnwrapErr();
-    return false;
+    return TResult::Error(res_gen_config.UnwrapErr());
   }
 
-  Request engine_request(request_id, inputs, res_gen_config.Unwrap());
+  PreparedRequest prepared;
+  prepared.request = Request(request_id, inputs, res_gen_config.Unwrap());
 
   // setup request state
-  RequestState rstate;
-  rstate.model = request.model.value_or("");
-  rstate.streamer.reserve(gen_cfg->n);
+  prepared.state.model = request.model.value_or("");
+  prepared.state.streamer.reserve(gen_cfg->n);
   for (int i = 0; i < gen_cfg->n; ++i) {
-    rstate.streamer.push_back(TextStreamer(tokenizer_));
+    prepared.state.streamer.push_back(TextStreamer(tokenizer_));
   }
-  request_map_[request_id] = std::move(rstate);
+  return TResult::Ok(std::move(prepared));
+}
 
-  this->engine_->AddRequest(engine_request);
-  return true;
+void JSONFFIEngine::SubmitPreparedRequest(PreparedRequest prepared) {
+  {
+    std::lock_guard<std::mutex> lock(request_map_mutex_);
+    request_map_[prepared.request->id] = std::move(prepared.state);
+  }
+  this->engine_->AddRequest(prepared.request);
 }
 
 bool JSONFFIEngine::Abort(std::string request_id) {
-  this->engine_->AbortRequest(request_id);
-  auto it = request_map_.find(request_id);
-  if (it != request_map_.end()) {
-    request_map_.erase(it);
+  bool dropped = false;
+  {
+    std::lock_guard<std::mutex> lock(prep_mutex_);
+    // A request which is not prepared yet is dropped by its preparation worker.
+    dropped = pending_request_ids_.erase(request_id);
+    if (!dropped) {
+      this->engine_->AbortRequest(request_id);
+    }
+  }
+  if (dropped) {
+    // The engine never sees the dropped request, so its abort finish is streamed back here.
+    StreamBackAbort(std::move(request_id));
   }
+  // The state of a request in the engine is kept until the engine streams back its abort finish
+  // and final usage, and is erased along with the final usage.
   return true;
 }
 
-std::string JSONFFIEngine::GetLastError() { return err_; }
+std::string JSONFFIEngine::GetLastError() {
+  std::lock_guard<std::mutex> lock(err_mutex_);
+  return err_;
+}
 
-void JSONFFIEngine::ExitBackgroundLoop() { this->engine_->ExitBackgroundLoop(); }
+void JSONFFIEngine::ExitBackgroundLoop() {
+  this->StopRequestPreparationWorkers();
+  this->engine_->ExitBackgroundLoop();
+}
 
 JSONFFIEngine::~JSONFFIEngine() { this->ExitBackgroundLoop(); }
 
@@ -157,6 +319,7 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
   TVM_MODULE_VTABLE_ENTRY("reload", &JSONFFIEngineImpl::Reload);
   TVM_MODULE_VTABLE_ENTRY("unload", &JSONFFIEngineImpl::Unload);
   TVM_MODULE_VTABLE_ENTRY("reset", &JSONFFIEngineImpl::Reset);
+  TVM_MODULE_VTABLE_ENTRY("trim_memory", &JSONFFIEngineImpl::TrimMemory);
   TVM_MODULE_VTABLE_ENTRY("chat_completion", &JSONFFIEngineImpl::ChatCompletion);
   TVM_MODULE_VTABLE_ENTRY("abort", &JSONFFIEngineImpl::Abort);
   TVM_MODULE_VTABLE_ENTRY("get_last_error", &JSONFFIEngineImpl::GetLastError);
@@ -178,7 +341,7 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
       ICHECK_EQ(args.size(), 1);
       Array<RequestStreamOutput> delta_outputs = args[0];
       std::string responses = this->GetResponseFromStreamOutput(delta_outputs);
-      this->request_stream_callback_(responses);
+      this->InvokeRequestStreamCallback(responses);
     };
 
     request_stream_callback = PackedFunc(frequest_stream_callback_wrapper);
@@ -186,6 +349,8 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
   }
 
   void Reload(String engine_config_json_str) {
+    // The preparation workers read the conversation template and the tokenizer.
+    this->WaitForRequestPreparation();
     this->engine_->Reload(engine_config_json_str);
     this->default_generation_config_ = this->engine_->GetDefaultGenerationConfig();
     auto engine_config = this->engine_->GetCompleteEngineConfig();
@@ -203,96 +368,172 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
     this->model_config_ = ModelConfig::FromJSON(
         json::Lookup<picojson::object>(model_config_json_unwrapped, "model_config"));
     this->tokenizer_ = Tokenizer::FromPath(engine_config->model);
+    this->compiled_conv_template_ =
+        CompiledConversation::Compile(this->conv_template_, this->tokenizer_);
   }
 
-  void Unload() { this->engine_->Unload(); }
+  void Unload() {
+    this->WaitForRequestPreparation();
+    this->engine_->Unload();
+  }
 
-  void Reset() { this->engine_->Reset(); }
+  void Reset() {
+    this->WaitForRequestPreparation();
+    this->engine_->Reset();
+  }
+
+  void TrimMemory(bool critical) { this->engine_->TrimMemory(critical); }
 
   void RunBackgroundLoop() { this->engine_->RunBackgroundLoop(); }
 
   void RunBackgroundStreamBackLoop() { this->engine_->RunBackgroundStreamBackLoop(); }
 
+  /*!
+   * \brief Format the stream response of a delta output into the given response. The streamers
+   * of a request are only touched by its own delta output, so different delta outputs can be
+   * formatted concurrently.
+   * \return Whether the response has any choice to stream back.
+   */
+  static bool FormatStreamResponse(const RequestStreamOutput& delta_output, RequestState* rstate,
+                                   ChatCompletionStreamResponse* response) {
+    ICHECK_NE(delta_output->group_finish_reason.size(), 0);
+    ICHECK_EQ(delta_output->group_delta_token_ids.size(),
+              delta_output->group_finish_reason.size());
+    ICHECK_EQ(delta_output->group_delta_token_ids.size(), rstate->streamer.size());
+
+    response->id = std::string(delta_output->request_id);
+    response->model = rstate->model;
+    response->system_fingerprint = "";
+    response->choices.clear();
+
+    for (size_t i = 0; i < delta_output->group_finish_reason.size(); ++i) {
+      // choice
+      ChatCompletionStreamResponseChoice choice;
+      Optional<String> finish_reason = delta_output->group_finish_reason[i];
+      if (finish_reason.defined()) {
+        if (finish_reason.value() == "stop") {
+          choice.finish_reason = FinishReason::stop;
+        } else if (finish_reason.value() == "length") {
+          choice.finish_reason = FinishReason::length;
+        } else if (finish_reason.value() == "tool_calls") {
+          choice.finish_reason = FinishReason::tool_calls;
+        } else if (finish_reason.value() == "error") {
+          choice.finish_reason = FinishReason::error;
+        } else if (finish_reason.value() == "abort") {
+          choice.finish_reason = FinishReason::abort;
+        }
+      } else {
+        choice.finish_reason = std::nullopt;
+      }
+      choice.index = static_cast<int>(i);
+      ChatCompletionMessage& delta = choice.delta;
+      // Size of delta_output->group_delta_token_ids Array should be 1
+      const IntTuple& delta_token_ids = delta_output->group_delta_token_ids[i];
+      std::vector<int32_t> delta_token_ids_vec(delta_token_ids.begin(), delta_token_ids.end());
+      std::string content = rstate->streamer[i]->Put(delta_token_ids_vec);
+      if (finish_reason.defined()) {
+        content += rstate->streamer[i]->Finish();
+      }
+      if (!content.empty()) {
+        delta.content = std::move(content);
+      }
+      delta.role = "assistant";
+      if (!choice.delta.content.IsNull() || choice.finish_reason.has_value()) {
+        response->choices.push_back(std::move(choice));
+      }
+    }
+    // if it is not the usage block, choices cannot be empty
+    return !response->choices.empty();
+  }
+
   String GetResponseFromStreamOutput(Array<RequestStreamOutput> delta_outputs) {
-    picojson::array json_response_arr;
-    for (const auto& delta_output : delta_outputs) {
-      std::string request_id = delta_output->request_id;
-      auto request_state_it = request_map_.find(request_id);
-      if (request_state_it == request_map_.end()) continue;
-      RequestState& rstate = request_state_it->second;
+    std::lock_guard<std::mutex> lock(request_map_mutex_);
+    int num_outputs = delta_outputs.size();
+    // - Look up the request states. The usage block is the last output of a request, so the states
+    // are erased only after all the outputs are formatted. A request with more than one delta
+    // output in the batch must be detokenized in order, so such batches are formatted serially.
+    std::vector<RequestState*> rstates(num_outputs, nullptr);
+    std::unordered_set<RequestState*> formatted_rstates;
+    bool has_repeated_request = false;
+    for (int r = 0; r < num_outputs; ++r) {
+      auto request_state_it = request_map_.find(delta_outputs[r]->request_id);
+      if (request_state_it != request_map_.end()) {
+        rstates[r] = &request_state_it->second;
+        if (!delta_outputs[r]->request_final_usage_json_str.defined() &&
+            !formatted_rstates.insert(rstates[r]).second) {
+          has_repeated_request = true;
+        }
+      }
+    }
+
+    // - Detokenize and format the delta outputs, in parallel for large batches.
+    if (static_cast<int>(stream_response_buffer_.size()) < num_outputs) {
+      stream_response_buffer_.resize(num_outputs);
+    }
+    std::vector<char> has_response(num_outputs, 0);
+    auto f_format = [&](int r) {
+      if (rstates[r] != nullptr && !delta_outputs[r]->request_final_usage_json_str.defined()) {
+        has_response[r] =
+            FormatStreamResponse(delta_outputs[r], rstates[r], &stream_response_buffer_[r]);
+      }
+    };
+    if (num_outputs < kMinNumOutputsForParallelFormat || has_repeated_request ||
+        tvm::runtime::threading::MaxConcurrency() <= 1) {
+      for (int r = 0; r < num_outputs; ++r) {
+        f_format(r);
+      }
+    } else {
+      tvm::runtime::parallel_for_with_threading_backend(f_format, 0, num_outputs);
+    }
+
+    // - Write the responses in order.
+    // The responses are written directly to the reused buffer, which avoids building the
+    // picojson values of every stream response.
+    response_buffer_.clear();
+    json::JSONWriter writer(&response_buffer_);
+    writer.BeginArray();
+    for (int r = 0; r < num_outputs; ++r) {
+      const RequestStreamOutput& delta_output = delta_outputs[r];
+      if (rstates[r] == nullptr) continue;
 
       // build the final usage messages
       // invariant, we can always let other messages to come first
       // then the final usage messages, as final usage is always last
       if (delta_output->request_final_usage_json_str.defined()) {
         ChatCompletionStreamResponse response;
-        response.id = request_id;
-        response.model = rstate.model;
+        response.id = delta_output->request_id;
+        response.model = rstates[r]->model;
         response.system_fingerprint = "";
         std::string usage_json_str = delta_output->request_final_usage_json_str.value();
         picojson::value usage_json;
         std::string err = picojson::parse(usage_json, usage_json_str);
         if (!err.empty()) {
-          err_ = err;
+          SetLastError(err);
         } else {
           response.usage = usage_json;
         }
-        json_response_arr.push_back(picojson::value(response.AsJSON()));
-        request_map_.erase(request_state_it);
+        response.WriteJSON(&writer);
         continue;
       }
-      ICHECK_NE(delta_output->group_finish_reason.size(), 0);
-      ICHECK_EQ(delta_output->group_delta_token_ids.size(),
-                delta_output->group_finish_reason.size());
-      ICHECK_EQ(delta_output->group_delta_token_ids.size(), rstate.streamer.size());
-
-      ChatCompletionStreamResponse response;
-      response.id = request_id;
-      response.model = rstate.model;
-      response.system_fingerprint = "";
-
-      for (size_t i = 0; i < delta_output->group_finish_reason.size(); ++i) {
-        // choice
-        ChatCompletionStreamResponseChoice choice;
-        Optional<String> finish_reason = delta_output->group_finish_reason[i];
-        if (finish_reason.defined()) {
-          if (finish_reason.value() == "stop") {
-            choice.finish_reason = FinishReason::stop;
-          } else if (finish_reason.value() == "length") {
-            choice.finish_reason = FinishReason::length;
-          } else if (finish_reason.value() == "tool_calls") {
-            choice.finish_reason = FinishReason::tool_calls;
-          } else if (finish_reason.value() == "error") {
-            choice.finish_reason = FinishReason::error;
-          }
-        } else {
-          choice.finish_reason = std::nullopt;
-        }
-        choice.index = static_cast<int>(i);
-        ChatCompletionMessage delta;
-        // Size of delta_output->group_delta_token_ids Array should be 1
-        const IntTuple& delta_token_ids = delta_output->group_delta_token_ids[i];
-        std::vector<int32_t> delta_token_ids_vec(delta_token_ids.begin(), delta_token_ids.end());
-        std::string content = rstate.streamer[i]->Put(delta_token_ids_vec);
-        if (finish_reason.defined()) {
-          content += rstate.streamer[i]->Finish();
-        }
-        if (!content.empty()) {
-          delta.content = content;
-        }
-        delta.role = "assistant";
-        choice.delta = delta;
-        if (!choice.delta.content.IsNull() || choice.finish_reason.has_value()) {
-          response.choices.push_back(choice);
-        }
+      if (has_response[r]) {
+        stream_response_buffer_[r].WriteJSON(&writer);
       }
-      // if it is not the usage block, choices cannot be empty
-      if (!response.choices.empty()) {
-        json_response_arr.push_back(picojson::value(response.AsJSON()));
+    }
+    writer.EndArray();
+    for (int r = 0; r < num_outputs; ++r) {
+      if (rstates[r] != nullptr && delta_outputs[r]->request_final_usage_json_str.defined()) {
+        request_map_.erase(delta_outputs[r]->request_id);
       }
     }
-    return picojson::value(json_response_arr).serialize();
+    return response_buffer_;
   }
+
+ private:
+  /*!
+   * \brief The minimum number of delta outputs to format in parallel, below which the thread pool
+   * launch overhead outweighs the detokenization work.
+   */
+  static constexpr const int kMinNumOutputsForParallelFormat = 16;
 };
 
 TVM_REGISTER_GLOBAL("mlc.json_ffi.CreateJSONFFIEngine").set_body_typed([]() {
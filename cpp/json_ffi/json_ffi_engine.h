@@ -8,7 +8,15 @@
 
 #include <tvm/runtime/packed_func.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "../serve/threaded_engine.h"
 #include "../tokenizers/streamer.h"
@@ -31,12 +39,34 @@ class JSONFFIEngine {
 
   ~JSONFFIEngine();
 
+  /*!
+   * \brief Submit a chat completion request. The request is parsed, rendered with the conversation
+   * template and tokenized by the request preparation workers, so this function returns without
+   * waiting for the preparation. Any error of the request is streamed back through the request
+   * stream callback, with the error finish reason.
+   * \return Whether the request is submitted.
+   */
   bool ChatCompletion(std::string request_json_str, std::string request_id);
 
+  /*! \brief Prepare and add a request to the engine on the calling thread. */
   bool AddRequest(std::string request_json_str, std::string request_id);
 
-  void StreamBackError(std::string request_id);
+  void StreamBackError(std::string request_id, std::string error);
 
+  /*!
+   * \brief Stream back the abort finish and the final usage of a request which is dropped before
+   * it is added to the engine, since every request ends with the final usage.
+   */
+  void StreamBackAbort(std::string request_id);
+
+  /*! \brief Stream back a choice of the finish reason and content, and a dummy final usage. */
+  void StreamBackFinish(std::string request_id, FinishReason finish_reason,
+                        std::optional<std::string> content);
+
+  /*!
+   * \brief Abort a request. The aborted request ends with the abort finish and the final usage,
+   * unless it has finished already.
+   */
   bool Abort(std::string request_id);
 
   std::string GetLastError();
@@ -52,13 +82,50 @@ class JSONFFIEngine {
     std::vector<TextStreamer> streamer;
   };
 
+  /*! \brief A request prepared for the engine, with its local state. */
+  struct PreparedRequest {
+    Request request;
+    RequestState state;
+  };
+
+  /*!
+   * \brief Parse the request, create the prompt and validate the generation config. This function
+   * only reads the engine states set by reload, and is called by the preparation workers
+   * concurrently.
+   */
+  Result<PreparedRequest> PrepareRequest(const std::string& request_json_str,
+                                         const std::string& request_id) const;
+
+  /*! \brief Register the local state of the prepared request and add it to the engine. */
+  void SubmitPreparedRequest(PreparedRequest prepared);
+
+  /*! \brief Invoke the request stream callback, which is serialized over the calling threads. */
+  void InvokeRequestStreamCallback(const std::string& responses);
+
+  void SetLastError(std::string err);
+
+  /*! \brief The main loop of the request preparation workers. */
+  void RequestPreparationLoop();
+
+  /*! \brief Wait until all the submitted requests are prepared and added to the engine. */
+  void WaitForRequestPreparation();
+
+  /*! \brief Stop and join the request preparation workers. The queued requests are dropped. */
+  void StopRequestPreparationWorkers();
+
   std::unique_ptr<ThreadedEngine> engine_;
   std::string err_;
+  // the mutex of the last error, which is set by the preparation workers and the stream back thread
+  std::mutex err_mutex_;
   PackedFunc request_stream_callback_;
+  // the mutex which serializes the request stream callback invocations
+  std::mutex request_stream_callback_mutex_;
   // tokenizer
   Tokenizer tokenizer_;
   // conversation template
   Conversation conv_template_;
+  // conversation template compiled with the tokenizer
+  std::unique_ptr<CompiledConversation> compiled_conv_template_;
   // generation config
   GenerationConfig default_generation_config_;
   // model config
@@ -67,6 +134,30 @@ class JSONFFIEngine {
   DLDevice device_;
   // request state map
   std::unordered_map<String, RequestState> request_map_;
+  // the mutex of the request state map, which is accessed by the request submission threads
+  // and the stream back thread
+  std::mutex request_map_mutex_;
+  // the reused buffer of the stream back JSON string
+  std::string response_buffer_;
+  // the reused buffer of the stream responses, which are formatted in parallel for large batches
+  std::vector<ChatCompletionStreamResponse> stream_response_buffer_;
+
+  // the request preparation workers
+  std::vector<std::thread> prep_workers_;
+  // the queue of the submitted requests to prepare, as pairs of the request JSON string and id
+  std::deque<std::pair<std::string, std::string>> prep_queue_;
+  // the ids of the submitted requests which are not added to the engine yet, reduced by abort
+  std::unordered_set<std::string> pending_request_ids_;
+  // the number of the requests being prepared by the workers
+  int num_preparing_requests_ = 0;
+  // whether the preparation workers are asked to exit
+  bool exit_prep_workers_ = false;
+  // the mutex of the preparation queue, the pending request ids and the worker states
+  std::mutex prep_mutex_;
+  // the condition variable notified when a request is queued or the workers are asked to exit
+  std::condition_variable prep_queue_cv_;
+  // the condition variable notified when a worker finishes a request
+  std::condition_variable prep_done_cv_;
 };
 
 }  // namespace json_ffi
@@ -193,7 +193,7 @@ Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::ob
       if (!item.is<picojson::object>()) {
         return TResult::Error("The content of chat completion message is not an object");
       }
-      picojson::object item_obj = item.get<picojson::object>();
+      const picojson::object& item_obj = item.get<picojson::object>();
       std::unordered_map<std::string, std::string> item_map;
       for (const auto& [key, value] : item_obj) {
         item_map[key] = value.to_str();
@@ -202,7 +202,7 @@ Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::ob
     }
     content = parts;
   }
-  message.content = content;
+  message.content = std::move(content);
 
   // role
   Result<std::string> role_str_res = json::LookupWithResultReturn<std::string>(json_obj, "role");
@@ -244,7 +244,7 @@ Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::ob
       }
       tool_calls.push_back(tool_call.Unwrap());
     }
-    message.tool_calls = tool_calls;
+    message.tool_calls = std::move(tool_calls);
   }
 
   // tool call id
@@ -255,7 +255,7 @@ Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::ob
   }
   message.tool_call_id = tool_call_id_res.Unwrap();
 
-  return TResult::Ok(message);
+  return TResult::Ok(std::move(message));
 }
 
 Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string& json_str) {
@@ -274,18 +274,20 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
     return TResult::Error(messages_arr_res.UnwrapErr());
   }
   std::vector<ChatCompletionMessage> messages;
-  for (const auto& item : messages_arr_res.Unwrap()) {
+  picojson::array messages_arr = messages_arr_res.Unwrap();
+  messages.reserve(messages_arr.size());
+  for (const auto& item : messages_arr) {
     if (!item.is<picojson::object>()) {
       return TResult::Error("A message in chat completion request is not object");
     }
-    picojson::object item_obj = item.get<picojson::object>();
+    const picojson::object& item_obj = item.get<picojson::object>();
     Result<ChatCompletionMessage> message = ChatCompletionMessage::FromJSON(item_obj);
     if (message.IsErr()) {
       return TResult::Error(message.UnwrapErr());
     }
     messages.push_back(message.Unwrap());
   }
-  request.messages = messages;
+  request.messages = std::move(messages);
 
   // model
   Result<std::optional<std::string>> model_res =
@@ -353,7 +355,7 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
   std::optional<picojson::array> stop_strs = stop_strs_res.Unwrap();
   if (stop_strs.has_value()) {
     std::vector<std::string> stop;
-    for (picojson::value stop_str_value : stop_strs.value()) {
+    for (const picojson::value& stop_str_value : stop_strs.value()) {
       if (!stop_str_value.is<std::string>()) {
         return TResult::Error("One given value in field \"stop\" is not a string.");
       }
@@ -390,7 +392,7 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
       }
       tools.push_back(tool.Unwrap());
     }
-    request.tools = tools;
+    request.tools = std::move(tools);
   }
 
   // response format
@@ -421,7 +423,7 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
   }
 
   // TODO: Other parameters
-  return TResult::Ok(request);
+  return TResult::Ok(std::move(request));
 }
 
 picojson::object ChatCompletionMessage::AsJSON() const {
@@ -459,6 +461,37 @@ picojson::object ChatCompletionMessage::AsJSON() const {
   return obj;
 }
 
+void ChatCompletionMessage::WriteJSON(json::JSONWriter* writer) const {
+  // The keys are written in the insertion order of AsJSON, which picojson serializes in.
+  writer->BeginObject();
+  if (this->content.IsText()) {
+    writer->Key("content");
+    writer->String(this->content.Text());
+  } else if (this->content.IsParts()) {
+    writer->Key("content");
+    writer->Raw(picojson::value(this->AsJSON().at("content")).serialize());
+  }
+  writer->Key("role");
+  writer->String(this->role);
+  if (this->name.has_value()) {
+    writer->Key("name");
+    writer->String(this->name.value());
+  }
+  if (this->tool_call_id.has_value()) {
+    writer->Key("tool_call_id");
+    writer->String(this->tool_call_id.value());
+  }
+  if (this->tool_calls.has_value()) {
+    writer->Key("tool_calls");
+    writer->BeginArray();
+    for (const auto& tool_call : this->tool_calls.value()) {
+      writer->Raw(picojson::value(tool_call.AsJSON()).serialize());
+    }
+    writer->EndArray();
+  }
+  writer->EndObject();
+}
+
 picojson::object ChatCompletionResponseChoice::AsJSON() const {
   picojson::object obj;
   if (!this->finish_reason.has_value()) {
@@ -472,6 +505,8 @@ picojson::object ChatCompletionResponseChoice::AsJSON() const {
       obj["finish_reason"] = picojson::value("tool_calls");
     } else if (this->finish_reason == FinishReason::error) {
       obj["finish_reason"] = picojson::value("error");
+    } else if (this->finish_reason == FinishReason::abort) {
+      obj["finish_reason"] = picojson::value("abort");
     }
   }
   obj["index"] = picojson::value((int64_t)this->index);
@@ -492,6 +527,8 @@ picojson::object ChatCompletionStreamResponseChoice::AsJSON() const {
       obj["finish_reason"] = picojson::value("tool_calls");
     } else if (this->finish_reason.value() == FinishReason::error) {
       obj["finish_reason"] = picojson::value("error");
+    } else if (this->finish_reason.value() == FinishReason::abort) {
+      obj["finish_reason"] = picojson::value("abort");
     }
   }
 
@@ -500,6 +537,29 @@ picojson::object ChatCompletionStreamResponseChoice::AsJSON() const {
   return obj;
 }
 
+void ChatCompletionStreamResponseChoice::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  writer->Key("finish_reason");
+  if (!this->finish_reason.has_value()) {
+    writer->Null();
+  } else if (this->finish_reason.value() == FinishReason::stop) {
+    writer->String("stop");
+  } else if (this->finish_reason.value() == FinishReason::length) {
+    writer->String("length");
+  } else if (this->finish_reason.value() == FinishReason::tool_calls) {
+    writer->String("tool_calls");
+  } else if (this->finish_reason.value() == FinishReason::abort) {
+    writer->String("abort");
+  } else {
+    writer->String("error");
+  }
+  writer->Key("index");
+  writer->Int(this->index);
+  writer->Key("delta");
+  this->delta.WriteJSON(writer);
+  writer->EndObject();
+}
+
 picojson::object ChatCompletionResponse::AsJSON() const {
   picojson::object obj;
   obj["id"] = picojson::value(this->id);
@@ -535,6 +595,31 @@ picojson::object ChatCompletionStreamResponse::AsJSON() const {
   return obj;
 }
 
+void ChatCompletionStreamResponse::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  writer->Key("id");
+  writer->String(this->id);
+  writer->Key("choices");
+  writer->BeginArray();
+  for (const auto& choice : this->choices) {
+    choice.WriteJSON(writer);
+  }
+  writer->EndArray();
+  writer->Key("created");
+  writer->Int(this->created);
+  writer->Key("model");
+  writer->String(this->model);
+  writer->Key("system_fingerprint");
+  writer->String(this->system_fingerprint);
+  writer->Key("object");
+  writer->String(this->object);
+  if (usage.has_value()) {
+    writer->Key("usage");
+    writer->Raw(usage.value().serialize());
+  }
+  writer->EndObject();
+}
+
 }  // namespace json_ffi
 }  // namespace llm
 }  // namespace mlc
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "../serve/config.h"
+#include "../support/json_writer.h"
 #include "../support/result.h"
 #include "picojson.h"
 
@@ -25,7 +26,7 @@ using serve::DebugConfig;
 using serve::ResponseFormat;
 
 enum class Type { text, json_object, function };
-enum class FinishReason { stop, length, tool_calls, error };
+enum class FinishReason { stop, length, tool_calls, error, abort };
 
 inline std::string GenerateUUID(size_t length) {
   auto randchar = []() -> char {
@@ -123,6 +124,8 @@ class ChatCompletionMessage {
 
   static Result<ChatCompletionMessage> FromJSON(const picojson::object& json);
   picojson::object AsJSON() const;
+  /*! \brief Write the message as JSON, which is identical to the serialized AsJSON. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 class ChatCompletionRequest {
@@ -172,6 +175,8 @@ class ChatCompletionStreamResponseChoice {
   // TODO: logprobs
 
   picojson::object AsJSON() const;
+  /*! \brief Write the choice as JSON, which is identical to the serialized AsJSON. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 class ChatCompletionResponse {
@@ -198,6 +203,11 @@ class ChatCompletionStreamResponse {
   std::optional<picojson::value> usage;
 
   picojson::object AsJSON() const;
+  /*!
+   * \brief Write the response as JSON, which is identical to the serialized AsJSON. It builds no
+   * picojson values, so it is used for the stream responses sent back for every delta.
+   */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 }  // namespace json_ffi
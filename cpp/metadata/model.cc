@@ -69,6 +69,8 @@ ModelMetadata::KVCacheMetadata ModelMetadata::KVCacheMetadata::FromJSON(
   kv_cache_metadata.head_dim = json::Lookup<int64_t>(json, "head_dim");
   kv_cache_metadata.num_attention_heads = json::Lookup<int64_t>(json, "num_attention_heads");
   kv_cache_metadata.num_key_value_heads = json::Lookup<int64_t>(json, "num_key_value_heads");
+  kv_cache_metadata.dtype = json.count("dtype") ? json::Lookup<DataType>(json, "dtype")
+                                                : DataType::Float(16);
   return kv_cache_metadata;
 }
 
@@ -99,7 +101,8 @@ ModelMetadata ModelMetadata::FromJSON(const picojson::object& metadata,
     result.kv_cache_metadata = {/*num_hidden_layers=*/0,
                                 /*head_dim=*/0,
                                 /*num_attention_heads=*/0,
-                                /*num_key_value_heads=*/0};
+                                /*num_key_value_heads=*/0,
+                                /*dtype=*/DataType::Float(16)};
   }
   {
     std::vector<ModelMetadata::Param>& params = result.params;
@@ -118,6 +121,17 @@ ModelMetadata ModelMetadata::FromJSON(const picojson::object& metadata,
       memory_usage[func_name] = json::Lookup<int64_t>(json_memory_usage, func_name);
     }
   }
+  if (metadata.count("kernel_variants")) {
+    picojson::object json_kernel_variants =
+        json::Lookup<picojson::object>(metadata, "kernel_variants");
+    for (const auto& [func_name, _] : json_kernel_variants) {
+      std::vector<std::string>& variants = result.kernel_variants[func_name];
+      for (const picojson::value& variant :
+           json::Lookup<picojson::array>(json_kernel_variants, func_name)) {
+        variants.push_back(variant.get<std::string>());
+      }
+    }
+  }
   return result;
 }
 
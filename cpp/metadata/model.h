@@ -69,6 +69,8 @@ struct ModelMetadata {
     int64_t num_attention_heads;
     int64_t num_key_value_heads;
     int64_t head_dim;
+    /*! \brief The storage dtype of the KV data, which defaults to float16 for old model libs. */
+    tvm::runtime::DataType dtype;
     static KVCacheMetadata FromJSON(const picojson::object& json);
   };
 
@@ -85,6 +87,12 @@ struct ModelMetadata {
   std::unordered_map<std::string, int64_t> memory_usage;
   KVStateKind kv_state_kind;
   KVCacheMetadata kv_cache_metadata;
+  /*!
+   * \brief The alternative variants of the model functions shipped in the model library, keyed
+   * by the name of the default function. The variant to run is selected on the device, for
+   * single-worker inference only. Multi-worker inference always runs the default function.
+   */
+  std::unordered_map<std::string, std::vector<std::string>> kernel_variants;
 
   static ModelMetadata FromJSON(const picojson::object& json_str,
                                 const picojson::object& model_config);
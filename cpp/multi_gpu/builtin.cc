@@ -6,9 +6,12 @@
 
 #include <tvm/runtime/disco/builtin.h>
 #include <tvm/runtime/disco/disco_worker.h>
+#include <tvm/runtime/profiling.h>
 #include <tvm/runtime/registry.h>
 #include <tvm/runtime/relax_vm/vm.h>
 
+#include <vector>
+
 namespace mlc {
 namespace llm {
 namespace multi_gpu {
@@ -80,10 +83,71 @@ ObjectRef SendFromLastGroupToWorker0(NDArray send, Optional<NDArray> recv, Shape
   return recv;
 }
 
+/*!
+ * \brief The device timers of the all-reduce calls on the current worker. The all-reduce
+ * function of the disco runtime, which the compiled model functions call for tensor parallelism,
+ * is wrapped to time the calls when the timing is enabled. Only worker 0 enables the timing,
+ * and the timers are resolved when the engine takes the time after each step.
+ */
+struct AllReduceTimers {
+  bool enabled = false;
+  std::vector<Timer> timers;
+
+  static AllReduceTimers* ThreadLocal() {
+    static thread_local AllReduceTimers timers;
+    return &timers;
+  }
+};
+
+/*! \brief Wrap the all-reduce function of the disco runtime with the device timers. */
+struct AllReduceTimingRegisterer {
+  AllReduceTimingRegisterer() {
+    const PackedFunc* allreduce = Registry::Get("runtime.disco.allreduce");
+    if (allreduce == nullptr) {
+      return;
+    }
+    PackedFunc original = *allreduce;
+    Registry::Register("runtime.disco.allreduce", /*can_override=*/true)
+        .set_body([original](TVMArgs args, TVMRetValue* rv) {
+          AllReduceTimers* timers = AllReduceTimers::ThreadLocal();
+          if (!timers->enabled) {
+            original.CallPacked(args, rv);
+            return;
+          }
+          NDArray send = args[0];
+          Timer timer = Timer::Start(send->device);
+          original.CallPacked(args, rv);
+          timer->Stop();
+          timers->timers.push_back(std::move(timer));
+        });
+  }
+};
+
+static AllReduceTimingRegisterer all_reduce_timing_registerer;
+
+/*! \brief Enable the all-reduce timing, which only takes effect on worker 0. */
+void EnableAllReduceTiming() {
+  if (DiscoWorker::ThreadLocal()->worker_id == 0) {
+    AllReduceTimers::ThreadLocal()->enabled = true;
+  }
+}
+
+/*! \brief Return the device time in seconds of the all-reduce calls since the last call. */
+double TakeAllReduceTime() {
+  double time = 0.0;
+  for (Timer& timer : AllReduceTimers::ThreadLocal()->timers) {
+    time += static_cast<double>(timer->SyncAndGetElapsedNanos()) / 1e9;
+  }
+  AllReduceTimers::ThreadLocal()->timers.clear();
+  return time;
+}
+
 TVM_REGISTER_GLOBAL("mlc.multi_gpu.DispatchFunctionByGroup")
     .set_body_typed(DispatchFunctionByGroup);
 TVM_REGISTER_GLOBAL("mlc.multi_gpu.SendFromLastGroupToWorker0")
     .set_body_typed(SendFromLastGroupToWorker0);
+TVM_REGISTER_GLOBAL("mlc.multi_gpu.EnableAllReduceTiming").set_body_typed(EnableAllReduceTiming);
+TVM_REGISTER_GLOBAL("mlc.multi_gpu.TakeAllReduceTime").set_body_typed(TakeAllReduceTime);
 
 }  // namespace multi_gpu
 }  // namespace llm
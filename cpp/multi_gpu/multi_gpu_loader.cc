@@ -10,10 +10,14 @@
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/relax_vm/ndarray_cache_support.h>
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <map>
+#include <mutex>
 #include <numeric>
 #include <string>
 #include <thread>
@@ -21,6 +25,7 @@
 #include <vector>
 
 #include "../metadata/model.h"
+#include "../support/mapped_file.h"
 #include "../support/progress_bar.h"
 
 namespace mlc {
@@ -32,6 +37,9 @@ using tvm::runtime::relax_vm::NDArrayCacheMetadata;
 using namespace tvm::runtime;
 using DurationType = std::chrono::microseconds;
 
+/*! \brief The max number of I/O threads reading the parameter shard files. */
+constexpr int kMaxNumShardFileIOThreads = 4;
+
 class RangeTimer {
  public:
   explicit RangeTimer(DurationType* result)
@@ -132,6 +140,142 @@ NDArray ReceiveBroadcastedOrSharded(Device device, const ModelMetadata::Param& p
   return result;
 }
 
+/*!
+ * \brief Load the parameter from the mapped shard file. The raw parameters are copied to device
+ * directly from the mapped pages, and the parameters of the other formats (which need conversion)
+ * take a copy of their own bytes through ParamRecord::Load.
+ */
+NDArray LoadParamFromMappedFile(const NDArrayCacheMetadata::FileRecord::ParamRecord& param_record,
+                                Device device, const MappedFile& file) {
+  CHECK_LE(param_record.byte_offset + param_record.nbytes, file.size())
+      << "ValueError: Encountered a corrupted parameter shard file. Parameter "
+      << param_record.name << " is out of the file range.";
+  const char* param_data = file.data() + param_record.byte_offset;
+  if (param_record.format == "raw") {
+    NDArray param = NDArray::Empty(param_record.shape, param_record.dtype, device);
+    param.CopyFromBytes(param_data, param_record.nbytes);
+    return param;
+  }
+  NDArrayCacheMetadata::FileRecord::ParamRecord record = param_record;
+  record.byte_offset = 0;
+  std::string raw_data(param_data, param_record.nbytes);
+  return record.Load(device, &raw_data);
+}
+
+/*!
+ * \brief The reader of the parameter shard files, which maps and prefetches the files ahead in
+ * order with multiple I/O threads. The disk reads of the next files overlap the host-to-device
+ * copies, the preprocessing and the scatters of the current file. At most `max_buffered_files`
+ * files are read ahead of the file being consumed. The files are read into the page cache, so the
+ * host memory of the files is reclaimable and the parameters are uploaded without extra copies.
+ */
+class ShardFileReader {
+ public:
+  explicit ShardFileReader(const std::string& model_path,
+                           const std::vector<NDArrayCacheMetadata::FileRecord>& records,
+                           int num_io_threads, int max_buffered_files)
+      : model_path_(model_path), records_(records), max_buffered_files_(max_buffered_files) {
+    num_io_threads = std::max(1, std::min(num_io_threads, static_cast<int>(records.size())));
+    io_threads_.reserve(num_io_threads);
+    for (int i = 0; i < num_io_threads; ++i) {
+      io_threads_.emplace_back([this]() { IOThreadLoop(); });
+    }
+  }
+
+  ~ShardFileReader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread& thread : io_threads_) {
+      thread.join();
+    }
+  }
+
+  /*! \brief Wait for and take the given mapped file. The files are taken in order. */
+  std::unique_ptr<MappedFile> Take(int file_index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ICHECK_EQ(file_index, next_file_to_take_);
+    cv_.wait(lock, [&]() { return ready_files_.count(file_index); });
+    ReadResult result = std::move(ready_files_.at(file_index));
+    ready_files_.erase(file_index);
+    ++next_file_to_take_;
+    lock.unlock();
+    cv_.notify_all();
+    CHECK(result.error.empty()) << result.error;
+    return std::move(result.file);
+  }
+
+ private:
+  /*! \brief The mapped file, or the error message when the read fails. */
+  struct ReadResult {
+    std::unique_ptr<MappedFile> file;
+    std::string error;
+  };
+
+  void IOThreadLoop() {
+    while (true) {
+      int file_index;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() {
+          return stopped_ || (next_file_to_read_ < static_cast<int>(records_.size()) &&
+                              next_file_to_read_ < next_file_to_take_ + max_buffered_files_);
+        });
+        if (stopped_) return;
+        file_index = next_file_to_read_++;
+      }
+      ReadResult result;
+      ReadFile(records_[file_index], &result);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_files_[file_index] = std::move(result);
+      }
+      cv_.notify_all();
+    }
+  }
+
+  void ReadFile(const NDArrayCacheMetadata::FileRecord& record, ReadResult* result) const {
+    std::string path = model_path_ + "/" + record.data_path;
+    Result<std::unique_ptr<MappedFile>> file = MappedFile::Open(path);
+    if (file.IsErr()) {
+      result->error = "ValueError: " + file.UnwrapErr();
+      return;
+    }
+    result->file = file.Unwrap();
+    if (static_cast<int64_t>(result->file->size()) != record.nbytes) {
+      result->error = "ValueError: Encountered a corrupted parameter shard file: " + path +
+                      ". It is expected to be " + std::to_string(record.nbytes) +
+                      " bytes, but got " + std::to_string(result->file->size()) + " bytes.";
+      return;
+    }
+    result->file->Prefetch();
+  }
+
+  /*! \brief The model path. */
+  const std::string& model_path_;
+  /*! \brief The records of the shard files. */
+  const std::vector<NDArrayCacheMetadata::FileRecord>& records_;
+  /*! \brief The max number of files read ahead of the next file to take. */
+  const int max_buffered_files_;
+  /*! \brief The I/O threads. */
+  std::vector<std::thread> io_threads_;
+
+  /*! \brief The mutex of the states below. */
+  std::mutex mutex_;
+  /*! \brief The condition variable notified when the states change. */
+  std::condition_variable cv_;
+  /*! \brief Whether the reader is stopped. */
+  bool stopped_ = false;
+  /*! \brief The index of the next file for the I/O threads to read. */
+  int next_file_to_read_ = 0;
+  /*! \brief The index of the next file to take. */
+  int next_file_to_take_ = 0;
+  /*! \brief The read files which are not taken yet. */
+  std::map<int, ReadResult> ready_files_;
+};
+
 std::string FormatDuration(DurationType duration) {
   std::ostringstream os;
   auto float_seconds = std::chrono::duration_cast<std::chrono::duration<float>>(duration).count();
@@ -139,8 +283,79 @@ std::string FormatDuration(DurationType duration) {
   return os.str();
 }
 
+/*!
+ * \brief Write the sharded parameters of the worker to the preshard cache. Each worker writes the
+ * raw bytes of its parameters to "worker-<id>.bin", and then the index of the parameters to
+ * "worker-<id>.json". The files are written to temporary paths and renamed, so an index file
+ * only exists when the cache of the worker is complete.
+ */
+void WritePreshardCache(const std::string& cache_path, int worker_id,
+                        const ModelMetadata& model_metadata,
+                        const std::unordered_map<std::string, NDArray>& sharded_params) {
+  std::filesystem::path cache_dir = cache_path;
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir, ec);
+  std::string file_stem = "worker-" + std::to_string(worker_id);
+  std::filesystem::path data_path = cache_dir / (file_stem + ".bin");
+  std::filesystem::path index_path = cache_dir / (file_stem + ".json");
+  std::filesystem::path tmp_data_path = cache_dir / (file_stem + ".bin.tmp");
+  std::filesystem::path tmp_index_path = cache_dir / (file_stem + ".json.tmp");
+
+  std::ofstream data_file(tmp_data_path, std::ios::binary | std::ios::trunc);
+  if (!data_file.is_open()) {
+    LOG(WARNING) << "Cannot write the preshard cache to " << cache_path;
+    return;
+  }
+  picojson::array param_records;
+  std::string buffer;
+  int64_t byte_offset = 0;
+  for (const ModelMetadata::Param& param : model_metadata.params) {
+    auto it = sharded_params.find(param.name);
+    if (it == sharded_params.end()) continue;
+    const NDArray& array = it->second;
+    size_t nbytes = GetDataSize(*array.operator->());
+    buffer.resize(nbytes);
+    array.CopyToBytes(buffer.data(), nbytes);
+    data_file.write(buffer.data(), nbytes);
+
+    picojson::array shape;
+    for (int64_t dim : array.Shape()) {
+      shape.push_back(picojson::value(dim));
+    }
+    picojson::object param_record;
+    param_record["name"] = picojson::value(param.name);
+    param_record["shape"] = picojson::value(shape);
+    param_record["dtype"] = picojson::value(DLDataType2String(array->dtype));
+    param_record["byte_offset"] = picojson::value(byte_offset);
+    param_record["nbytes"] = picojson::value(static_cast<int64_t>(nbytes));
+    param_records.push_back(picojson::value(param_record));
+    byte_offset += nbytes;
+  }
+  data_file.close();
+  if (data_file.fail()) {
+    LOG(WARNING) << "Cannot write the preshard cache to " << cache_path;
+    std::filesystem::remove(tmp_data_path, ec);
+    return;
+  }
+  picojson::object index;
+  index["params"] = picojson::value(param_records);
+  std::ofstream index_file(tmp_index_path, std::ios::trunc);
+  index_file << picojson::value(index).serialize();
+  index_file.close();
+  std::filesystem::rename(tmp_data_path, data_path, ec);
+  if (!ec) {
+    std::filesystem::rename(tmp_index_path, index_path, ec);
+  }
+  if (index_file.fail() || ec) {
+    LOG(WARNING) << "Cannot write the preshard cache to " << cache_path;
+    std::filesystem::remove(tmp_data_path, ec);
+    std::filesystem::remove(tmp_index_path, ec);
+  }
+}
+
 Array<Optional<NDArray>> LoadMultiGPU(const std::string& model_path, Module relax_vm_module,
-                                      const std::string& model_config_str) {
+                                      const std::string& model_config_str,
+                                      const std::string& preshard_cache_path) {
   DiscoWorker* worker = DiscoWorker::ThreadLocal();
   Device device = worker->default_device;
   int worker_id = worker->worker_id;
@@ -173,12 +388,23 @@ Array<Optional<NDArray>> LoadMultiGPU(const std::string& model_path, Module rela
     DurationType time_preproc(0);
     ProgressBar progress_bar(model_metadata.params.size());
     LOG(INFO) << "Loading parameters...";
-    for (const NDArrayCacheMetadata::FileRecord& record : ndarray_cache_metadata.records) {
+    // The shard files are read ahead by the I/O threads, while this thread copies the parameters
+    // to device and scatters them, which have to be in order as they are collective operations.
+    int num_io_threads = std::min(static_cast<int>(std::thread::hardware_concurrency()),
+                                  kMaxNumShardFileIOThreads);
+    ShardFileReader reader(model_path, ndarray_cache_metadata.records, num_io_threads,
+                           /*max_buffered_files=*/num_io_threads + 1);
+    for (int file_index = 0; file_index < static_cast<int>(ndarray_cache_metadata.records.size());
+         ++file_index) {
+      const NDArrayCacheMetadata::FileRecord& record = ndarray_cache_metadata.records[file_index];
       Array<NDArray> loaded_params;
       {
         RangeTimer _(&time_loading);
-        std::string raw_data_buffer;
-        loaded_params = record.Load(device, model_path, &raw_data_buffer);
+        std::unique_ptr<MappedFile> file = reader.Take(file_index);
+        loaded_params.reserve(record.records.size());
+        for (const NDArrayCacheMetadata::FileRecord::ParamRecord& param_record : record.records) {
+          loaded_params.push_back(LoadParamFromMappedFile(param_record, device, *file));
+        }
         TVMSynchronize(device.device_type, device.device_id, nullptr);
       }
       // For each parameter in the shard file, preprocess and shard it
@@ -237,6 +463,75 @@ Array<Optional<NDArray>> LoadMultiGPU(const std::string& model_path, Module rela
     const auto& it = sharded_params.find(param.name);
     shards.push_back(it == sharded_params.end() ? Optional<NDArray>() : it->second);
   }
+  // Step 4. Write the sharded parameters to the preshard cache, which the later loadings use.
+  if (!preshard_cache_path.empty()) {
+    WritePreshardCache(preshard_cache_path, worker_id, model_metadata, sharded_params);
+  }
+  return shards;
+}
+
+Array<Optional<NDArray>> LoadMultiGPUFromPreshardCache(const std::string& preshard_cache_path,
+                                                       Module relax_vm_module,
+                                                       const std::string& model_config_str) {
+  DiscoWorker* worker = DiscoWorker::ThreadLocal();
+  Device device = worker->default_device;
+  int worker_id = worker->worker_id;
+  LOG(INFO) << "[Worker #" << worker_id << "] Loading model to device: " << device
+            << " from preshard cache " << preshard_cache_path;
+  picojson::value model_config;
+  picojson::parse(model_config, model_config_str);
+  ModelMetadata model_metadata =
+      ModelMetadata::FromModule(relax_vm_module, model_config.get<picojson::object>());
+
+  std::filesystem::path cache_dir = preshard_cache_path;
+  std::string file_stem = "worker-" + std::to_string(worker_id);
+  std::ifstream index_file(cache_dir / (file_stem + ".json"));
+  CHECK(index_file.is_open()) << "ValueError: Cannot find the preshard cache of worker "
+                              << worker_id << " in " << preshard_cache_path;
+  std::string index_str((std::istreambuf_iterator<char>(index_file)),
+                        std::istreambuf_iterator<char>());
+  picojson::value index;
+  std::string err = picojson::parse(index, index_str);
+  CHECK(err.empty()) << "ValueError: Invalid preshard cache index: " << err;
+  Result<std::unique_ptr<MappedFile>> file_res =
+      MappedFile::Open((cache_dir / (file_stem + ".bin")).string());
+  CHECK(file_res.IsOk()) << "ValueError: " << file_res.UnwrapErr();
+  std::unique_ptr<MappedFile> file = file_res.Unwrap();
+
+  std::unordered_map<std::string, NDArray> sharded_params;
+  DurationType time_loading(0);
+  {
+    RangeTimer _(&time_loading);
+    for (const picojson::value& record_json :
+         index.get<picojson::object>().at("params").get<picojson::array>()) {
+      const picojson::object& record = record_json.get<picojson::object>();
+      std::vector<int64_t> shape;
+      for (const picojson::value& dim : record.at("shape").get<picojson::array>()) {
+        shape.push_back(dim.get<int64_t>());
+      }
+      int64_t byte_offset = record.at("byte_offset").get<int64_t>();
+      int64_t nbytes = record.at("nbytes").get<int64_t>();
+      CHECK_LE(byte_offset + nbytes, static_cast<int64_t>(file->size()))
+          << "ValueError: Encountered a corrupted preshard cache in " << preshard_cache_path;
+      NDArray param = NDArray::Empty(
+          ShapeTuple(shape), DataType(String2DLDataType(record.at("dtype").get<std::string>())),
+          device);
+      param.CopyFromBytes(file->data() + byte_offset, nbytes);
+      sharded_params[record.at("name").get<std::string>()] = param;
+    }
+    TVMSynchronize(device.device_type, device.device_id, nullptr);
+  }
+
+  Array<Optional<NDArray>> shards;
+  shards.reserve(model_metadata.params.size());
+  for (const ModelMetadata::Param& param : model_metadata.params) {
+    const auto& it = sharded_params.find(param.name);
+    shards.push_back(it == sharded_params.end() ? Optional<NDArray>() : it->second);
+  }
+  SyncWorker();
+  if (worker_id == 0) {
+    LOG(INFO) << "Loading done. Time used: " << FormatDuration(time_loading) << ".";
+  }
   return shards;
 }
 
@@ -267,8 +562,8 @@ Array<Optional<NDArray>> LoadMultiGPUPresharded(const std::string& model_path,
   }
 
   Array<Optional<NDArray>> params;
-  const NDArrayCacheMetadata::FileRecord* current_file_;
-  std::string current_file_stream_;
+  const NDArrayCacheMetadata::FileRecord* current_file_record = nullptr;
+  std::unique_ptr<MappedFile> current_file;
   params.reserve(model_metadata.params.size());
   DurationType time_loading(0);
   for (const ModelMetadata::Param& param : model_metadata.params) {
@@ -291,12 +586,15 @@ Array<Optional<NDArray>> LoadMultiGPUPresharded(const std::string& model_path,
     const NDArrayCacheMetadata::FileRecord::ParamRecord* param_record = param_info.param;
     const NDArrayCacheMetadata::FileRecord* file_record = param_info.file;
 
-    if (file_record != current_file_) {
-      current_file_ = file_record;
-      file_record->Load(device, model_path, &current_file_stream_);
+    if (file_record != current_file_record) {
+      current_file_record = file_record;
+      std::string path = model_path + "/" + file_record->data_path;
+      Result<std::unique_ptr<MappedFile>> file = MappedFile::Open(path);
+      CHECK(file.IsOk()) << "ValueError: " << file.UnwrapErr();
+      current_file = file.Unwrap();
     }
 
-    params.push_back(param_record->Load(device, &current_file_stream_));
+    params.push_back(LoadParamFromMappedFile(*param_record, device, *current_file));
   }
   SyncWorker();
   if (worker_id == 0) {
@@ -307,6 +605,8 @@ Array<Optional<NDArray>> LoadMultiGPUPresharded(const std::string& model_path,
 
 TVM_REGISTER_GLOBAL("mlc.multi_gpu.LoadMultiGPU").set_body_typed(LoadMultiGPU);
 TVM_REGISTER_GLOBAL("mlc.multi_gpu.LoadMultiGPUPresharded").set_body_typed(LoadMultiGPUPresharded);
+TVM_REGISTER_GLOBAL("mlc.multi_gpu.LoadMultiGPUFromPreshardCache")
+    .set_body_typed(LoadMultiGPUFromPreshardCache);
 
 }  // namespace multi_gpu
 }  // namespace llm
@@ -45,10 +45,18 @@ Result<ResponseFormat> ResponseFormat::FromJSON(const picojson::object& config)
   if (schema.has_value()) {
     res.schema = schema.value();
   }
+  std::optional<std::string> regex = json::LookupOptional<std::string>(config, "regex");
+  if (regex.has_value()) {
+    res.regex = regex.value();
+  }
 
-  if (res.type != "text" && res.type != "function" && res.type != "json_object") {
+  if (res.type != "text" && res.type != "function" && res.type != "json_object" &&
+      res.type != "regex") {
     return TResult::Error("Uknonwn response_format type " + res.type);
   }
+  if (res.type == "regex" && !res.regex.defined()) {
+    return TResult::Error("The regex is required when the response_format type is \"regex\"");
+  }
 
   return TResult::Ok(res);
 }
@@ -59,6 +67,9 @@ picojson::object ResponseFormat::AsJSON() const {
   if (schema.defined()) {
     config["schema"] = picojson::value(schema.value().operator std::string());
   }
+  if (regex.defined()) {
+    config["regex"] = picojson::value(regex.value().operator std::string());
+  }
   return config;
 }
 
@@ -132,6 +143,12 @@ Result<GenerationConfig> GenerationConfig::Validate(GenerationConfig cfg) {
   if (cfg->top_p < 0 || cfg->top_p > 1) {
     return TResult::Error("\"top_p\" should be in range [0, 1]");
   }
+  if (cfg->min_p < 0 || cfg->min_p > 1) {
+    return TResult::Error("\"min_p\" should be in range [0, 1]");
+  }
+  if (cfg->typical_p <= 0 || cfg->typical_p > 1) {
+    return TResult::Error("\"typical_p\" should be in range (0, 1]");
+  }
   if (std::fabs(cfg->frequency_penalty) > 2.0) {
     return TResult::Error("frequency_penalty must be in [-2, 2]!");
   }
@@ -141,8 +158,9 @@ Result<GenerationConfig> GenerationConfig::Validate(GenerationConfig cfg) {
   if (cfg->top_logprobs < 0 || cfg->top_logprobs > 20) {
     return TResult::Error("At most 20 top logprob tokens are supported");
   }
-  if (cfg->top_logprobs != 0 && !(cfg->logprobs)) {
-    return TResult::Error("\"logprobs\" must be true to support \"top_logprobs\"");
+  if (cfg->top_logprobs != 0 && !(cfg->logprobs) && !(cfg->prompt_logprobs)) {
+    return TResult::Error(
+        "\"logprobs\" or \"prompt_logprobs\" must be true to support \"top_logprobs\"");
   }
   for (const auto& item : cfg->logit_bias) {
     double bias_value = item.second;
@@ -150,6 +168,33 @@ Result<GenerationConfig> GenerationConfig::Validate(GenerationConfig cfg) {
       return TResult::Error("Logit bias value should be in range [-100, 100].");
     }
   }
+  if (cfg->use_beam_search) {
+    // Each beam proposes `2n` candidates from the top probs returned by the sampler,
+    // which supports at most 20.
+    if (cfg->n > 10) {
+      return TResult::Error("Beam search supports at most 10 beams");
+    }
+    if (cfg->response_format.type != "text") {
+      return TResult::Error("Beam search does not support structured response formats");
+    }
+  }
+  if (cfg->prompt_logprobs && cfg->embedding_pooling != EmbeddingPooling::kNone) {
+    return TResult::Error("Embedding requests do not support \"prompt_logprobs\"");
+  }
+  if (cfg->embedding_pooling != EmbeddingPooling::kNone) {
+    if (cfg->n != 1 || cfg->use_beam_search) {
+      return TResult::Error("Embedding requests require \"n\" to be 1 without beam search");
+    }
+    if (cfg->response_format.type != "text") {
+      return TResult::Error("Embedding requests do not support structured response formats");
+    }
+  }
+  if (cfg->ttft_deadline_ms != -1 && cfg->ttft_deadline_ms <= 0) {
+    return TResult::Error("\"ttft_deadline_ms\" should be positive or -1");
+  }
+  if (cfg->tpot_deadline_ms != -1 && cfg->tpot_deadline_ms <= 0) {
+    return TResult::Error("\"tpot_deadline_ms\" should be positive or -1");
+  }
   return TResult::Ok(cfg);
 }
 
@@ -161,6 +206,12 @@ Result<GenerationConfig> GenerationConfig::FromJSON(const picojson::object& conf
   n->temperature =
       json::LookupOrDefault<double>(config, "temperature", default_config->temperature);
   n->top_p = json::LookupOrDefault<double>(config, "top_p", default_config->top_p);
+  n->min_p = json::LookupOrDefault<double>(config, "min_p", default_config->min_p);
+  n->typical_p = json::LookupOrDefault<double>(config, "typical_p", default_config->typical_p);
+  n->use_beam_search =
+      json::LookupOrDefault<bool>(config, "use_beam_search", default_config->use_beam_search);
+  n->length_penalty =
+      json::LookupOrDefault<double>(config, "length_penalty", default_config->length_penalty);
   n->frequency_penalty =
       json::LookupOrDefault<double>(config, "frequency_penalty", default_config->frequency_penalty);
   n->presence_penalty =
@@ -170,6 +221,8 @@ Result<GenerationConfig> GenerationConfig::FromJSON(const picojson::object& conf
   n->logprobs = json::LookupOrDefault<bool>(config, "logprobs", default_config->logprobs);
   n->top_logprobs =
       json::LookupOrDefault<int64_t>(config, "top_logprobs", default_config->top_logprobs);
+  n->prompt_logprobs =
+      json::LookupOrDefault<bool>(config, "prompt_logprobs", default_config->prompt_logprobs);
 
   std::optional<picojson::object> logit_bias_obj =
       json::LookupOptional<picojson::object>(config, "logit_bias");
@@ -221,6 +274,27 @@ Result<GenerationConfig> GenerationConfig::FromJSON(const picojson::object& conf
   } else {
     n->stop_token_ids = default_config->stop_token_ids;
   }
+  n->priority = json::LookupOrDefault<int64_t>(config, "priority", default_config->priority);
+  n->ttft_deadline_ms =
+      json::LookupOrDefault<double>(config, "ttft_deadline_ms", default_config->ttft_deadline_ms);
+  n->tpot_deadline_ms =
+      json::LookupOrDefault<double>(config, "tpot_deadline_ms", default_config->tpot_deadline_ms);
+  n->lora_adapter =
+      json::LookupOrDefault<std::string>(config, "lora_adapter", default_config->lora_adapter);
+  n->tenant_id = json::LookupOrDefault<std::string>(config, "tenant_id", default_config->tenant_id);
+  std::optional<std::string> embedding_pooling =
+      json::LookupOptional<std::string>(config, "embedding_pooling");
+  if (!embedding_pooling.has_value()) {
+    n->embedding_pooling = default_config->embedding_pooling;
+  } else if (embedding_pooling.value() == "none") {
+    n->embedding_pooling = EmbeddingPooling::kNone;
+  } else if (embedding_pooling.value() == "last") {
+    n->embedding_pooling = EmbeddingPooling::kLast;
+  } else if (embedding_pooling.value() == "mean") {
+    n->embedding_pooling = EmbeddingPooling::kMean;
+  } else {
+    return TResult::Error("Unknown embedding pooling " + embedding_pooling.value());
+  }
 
   std::optional<picojson::object> response_format_obj =
       json::LookupOptional<picojson::object>(config, "response_format");
@@ -266,11 +340,16 @@ picojson::object GenerationConfigNode::AsJSON() const {
   config["n"] = picojson::value(static_cast<int64_t>(this->n));
   config["temperature"] = picojson::value(this->temperature);
   config["top_p"] = picojson::value(this->top_p);
+  config["min_p"] = picojson::value(this->min_p);
+  config["typical_p"] = picojson::value(this->typical_p);
+  config["use_beam_search"] = picojson::value(this->use_beam_search);
+  config["length_penalty"] = picojson::value(this->length_penalty);
   config["frequency_penalty"] = picojson::value(this->frequency_penalty);
   config["presence_penalty"] = picojson::value(this->presence_penalty);
   config["repetition_penalty"] = picojson::value(this->repetition_penalty);
   config["logprobs"] = picojson::value(this->logprobs);
   config["top_logprobs"] = picojson::value(static_cast<int64_t>(this->top_logprobs));
+  config["prompt_logprobs"] = picojson::value(this->prompt_logprobs);
   config["max_tokens"] = picojson::value(static_cast<int64_t>(this->max_tokens));
   config["seed"] = picojson::value(static_cast<int64_t>(this->seed));
 
@@ -291,12 +370,34 @@ picojson::object GenerationConfigNode::AsJSON() const {
     stop_token_ids_arr.push_back(picojson::value(static_cast<int64_t>(stop_token_id)));
   }
   config["stop_token_ids"] = picojson::value(stop_token_ids_arr);
+  config["priority"] = picojson::value(static_cast<int64_t>(this->priority));
+  config["ttft_deadline_ms"] = picojson::value(this->ttft_deadline_ms);
+  config["tpot_deadline_ms"] = picojson::value(this->tpot_deadline_ms);
+  config["lora_adapter"] = picojson::value(this->lora_adapter);
+  config["tenant_id"] = picojson::value(this->tenant_id);
+  switch (embedding_pooling) {
+    case EmbeddingPooling::kNone: {
+      config["embedding_pooling"] = picojson::value("none");
+      break;
+    }
+    case EmbeddingPooling::kLast: {
+      config["embedding_pooling"] = picojson::value("last");
+      break;
+    }
+    case EmbeddingPooling::kMean: {
+      config["embedding_pooling"] = picojson::value("mean");
+      break;
+    }
+  }
 
   picojson::object response_format;
   response_format["type"] = picojson::value(this->response_format.type);
   response_format["schema"] = this->response_format.schema
                                   ? picojson::value(this->response_format.schema.value())
                                   : picojson::value();
+  response_format["regex"] = this->response_format.regex
+                                 ? picojson::value(this->response_format.regex.value())
+                                 : picojson::value();
   config["response_format"] = picojson::value(response_format);
   config["debug_config"] = picojson::value(debug_config.AsJSON());
   return config;
@@ -331,6 +432,18 @@ EngineConfig EngineConfig::FromJSONAndInferredConfig(
   }
   n->additional_models = additional_models;
   n->additional_model_libs = additional_model_libs;
+  std::vector<String> lora_adapters;
+  picojson::array lora_adapters_arr =
+      json::LookupOrDefault<picojson::array>(json, "lora_adapters", picojson::array());
+  lora_adapters.reserve(lora_adapters_arr.size());
+  for (int i = 0; i < static_cast<int>(lora_adapters_arr.size()); ++i) {
+    lora_adapters.push_back(json::Lookup<std::string>(lora_adapters_arr, i));
+  }
+  n->lora_adapters = lora_adapters;
+  n->max_num_resident_lora_adapters = json::LookupOrDefault<int64_t>(
+      json, "max_num_resident_lora_adapters", n->max_num_resident_lora_adapters);
+  CHECK_GT(n->max_num_resident_lora_adapters, 0)
+      << "The maximum number of resident LoRA adapters must be positive.";
   n->mode = EngineModeFromString(json::Lookup<std::string>(json, "mode"));
 
   // - Other fields with default value.
@@ -338,14 +451,62 @@ EngineConfig EngineConfig::FromJSONAndInferredConfig(
       json::LookupOrDefault<double>(json, "gpu_memory_utilization", n->gpu_memory_utilization);
   n->kv_cache_page_size =
       json::LookupOrDefault<int64_t>(json, "kv_cache_page_size", n->kv_cache_page_size);
+  n->kv_cache_dtype =
+      json::LookupOrDefault<std::string>(json, "kv_cache_dtype", n->kv_cache_dtype);
   n->speculative_mode = SpeculativeModeFromString(json::LookupOrDefault<std::string>(
       json, "speculative_mode", SpeculativeModeToString(n->speculative_mode)));
   n->spec_draft_length =
       json::LookupOrDefault<int64_t>(json, "spec_draft_length", n->spec_draft_length);
   n->spec_tree_width = json::LookupOrDefault<int64_t>(json, "spec_tree_width", n->spec_tree_width);
+  n->spec_tree_token_budget = json::LookupOrDefault<int64_t>(json, "spec_tree_token_budget",
+                                                             n->spec_tree_token_budget);
+  CHECK_GE(n->spec_tree_token_budget, 0)
+      << "The speculative decoding tree token budget must be non-negative.";
+  n->spec_auto_disable =
+      json::LookupOrDefault<bool>(json, "spec_auto_disable", n->spec_auto_disable);
+  n->spec_optimistic_draft =
+      json::LookupOrDefault<bool>(json, "spec_optimistic_draft", n->spec_optimistic_draft);
   n->prefill_mode = PrefillModeFromString(json::LookupOrDefault<std::string>(
       json, "prefill_mode", PrefillModeToString(n->prefill_mode)));
+  n->target_inter_token_latency_ms = json::LookupOrDefault<double>(
+      json, "target_inter_token_latency_ms", n->target_inter_token_latency_ms);
+  n->long_prefill_chunk_size = json::LookupOrDefault<int64_t>(json, "long_prefill_chunk_size",
+                                                              n->long_prefill_chunk_size);
+  CHECK_GE(n->long_prefill_chunk_size, 0) << "The long prefill chunk size must be non-negative.";
+  n->reserve_decode_kv_pages =
+      json::LookupOrDefault<bool>(json, "reserve_decode_kv_pages", n->reserve_decode_kv_pages);
+  n->disaggregation_role = DisaggregationRoleFromString(json::LookupOrDefault<std::string>(
+      json, "disaggregation_role", DisaggregationRoleToString(n->disaggregation_role)));
+  n->overlap_stream_callback = json::LookupOrDefault<bool>(json, "overlap_stream_callback",
+                                                           n->overlap_stream_callback);
+  picojson::array decode_batch_size_buckets_arr = json::LookupOrDefault<picojson::array>(
+      json, "decode_batch_size_buckets", picojson::array());
+  for (int i = 0; i < static_cast<int>(decode_batch_size_buckets_arr.size()); ++i) {
+    int64_t bucket = json::Lookup<int64_t>(decode_batch_size_buckets_arr, i);
+    CHECK_GT(bucket, 0) << "Decode batch size bucket must be positive, but got " << bucket;
+    n->decode_batch_size_buckets.push_back(bucket);
+  }
+  n->num_decode_steps =
+      json::LookupOrDefault<int64_t>(json, "num_decode_steps", n->num_decode_steps);
+  CHECK_GT(n->num_decode_steps, 0)
+      << "The number of decode steps must be positive, but got " << n->num_decode_steps;
+  n->batch_invariant_sampling =
+      json::LookupOrDefault<bool>(json, "batch_invariant_sampling", n->batch_invariant_sampling);
   n->verbose = json::LookupOrDefault<bool>(json, "verbose", n->verbose);
+  n->enable_device_timing =
+      json::LookupOrDefault<bool>(json, "enable_device_timing", n->enable_device_timing);
+  n->step_watchdog_threshold_ms = json::LookupOrDefault<double>(
+      json, "step_watchdog_threshold_ms", n->step_watchdog_threshold_ms);
+  CHECK_GE(n->step_watchdog_threshold_ms, 0)
+      << "Step watchdog threshold must be non-negative, but got " << n->step_watchdog_threshold_ms;
+  n->stream_flush_interval_ms = json::LookupOrDefault<double>(json, "stream_flush_interval_ms",
+                                                              n->stream_flush_interval_ms);
+  CHECK_GE(n->stream_flush_interval_ms, 0)
+      << "Stream flush interval must be non-negative, but got " << n->stream_flush_interval_ms;
+  n->stream_flush_max_outputs = json::LookupOrDefault<int64_t>(json, "stream_flush_max_outputs",
+                                                               n->stream_flush_max_outputs);
+  CHECK_GE(n->stream_flush_max_outputs, 0)
+      << "Stream flush max outputs must be non-negative, but got " << n->stream_flush_max_outputs;
 
   // - Fields from the inferred engine config.
   n->max_num_sequence = inferred_config.max_num_sequence.value();
@@ -360,6 +521,51 @@ EngineConfig EngineConfig::FromJSONAndInferredConfig(
       json, "prefix_cache_mode", PrefixCacheModeToString(n->prefix_cache_mode)));
   n->prefix_cache_max_num_recycling_seqs = json::LookupOrDefault<int64_t>(
       json, "prefix_cache_max_num_recycling_seqs", n->max_num_sequence);
+  n->prefix_cache_eviction_policy =
+      PrefixCacheEvictionPolicyFromString(json::LookupOrDefault<std::string>(
+          json, "prefix_cache_eviction_policy",
+          PrefixCacheEvictionPolicyToString(n->prefix_cache_eviction_policy)));
+  n->prefix_cache_keep_aborted_min_tokens = json::LookupOrDefault<int64_t>(
+      json, "prefix_cache_keep_aborted_min_tokens", n->prefix_cache_keep_aborted_min_tokens);
+  n->prefix_cache_compaction_max_num_tokens = json::LookupOrDefault<int64_t>(
+      json, "prefix_cache_compaction_max_num_tokens", n->prefix_cache_compaction_max_num_tokens);
+  CHECK_GE(n->prefix_cache_compaction_max_num_tokens, 0)
+      << "The prefix cache compaction token budget must be non-negative.";
+  n->prefix_cache_max_num_host_tokens = json::LookupOrDefault<int64_t>(
+      json, "prefix_cache_max_num_host_tokens", n->prefix_cache_max_num_host_tokens);
+  n->prefix_cache_max_num_disk_tokens = json::LookupOrDefault<int64_t>(
+      json, "prefix_cache_max_num_disk_tokens", n->prefix_cache_max_num_disk_tokens);
+  n->prefix_cache_disk_path = json::LookupOrDefault<std::string>(json, "prefix_cache_disk_path",
+                                                                 n->prefix_cache_disk_path);
+  n->kv_session_dir =
+      json::LookupOrDefault<std::string>(json, "kv_session_dir", n->kv_session_dir);
+  n->prefix_cache_shared_memory_name = json::LookupOrDefault<std::string>(
+      json, "prefix_cache_shared_memory_name", n->prefix_cache_shared_memory_name);
+  n->prefix_cache_shared_memory_bytes = json::LookupOrDefault<int64_t>(
+      json, "prefix_cache_shared_memory_bytes", n->prefix_cache_shared_memory_bytes);
+  n->image_embedding_cache_bytes = json::LookupOrDefault<int64_t>(
+      json, "image_embedding_cache_bytes", n->image_embedding_cache_bytes);
+  CHECK_GE(n->image_embedding_cache_bytes, 0)
+      << "The image embedding cache capacity must be non-negative.";
+  n->grammar_cache_dir =
+      json::LookupOrDefault<std::string>(json, "grammar_cache_dir", n->grammar_cache_dir);
+  n->scheduling_policy = SchedulingPolicyKindFromString(json::LookupOrDefault<std::string>(
+      json, "scheduling_policy", SchedulingPolicyKindToString(n->scheduling_policy)));
+  picojson::object tenant_weights_obj =
+      json::LookupOrDefault<picojson::object>(json, "tenant_weights", picojson::object());
+  for (const auto& [tenant_id, weight] : tenant_weights_obj) {
+    CHECK(weight.is<double>()) << "The weight of tenant " << tenant_id << " must be a number.";
+    CHECK_GT(weight.get<double>(), 0) << "The weight of tenant " << tenant_id
+                                      << " must be positive.";
+    n->tenant_weights[tenant_id] = weight.get<double>();
+  }
+  n->tenant_max_tokens_per_s = json::LookupOrDefault<double>(json, "tenant_max_tokens_per_s",
+                                                             n->tenant_max_tokens_per_s);
+  CHECK_GE(n->tenant_max_tokens_per_s, 0) << "The tenant token rate limit must be non-negative.";
+  n->preemption_mode = PreemptionModeFromString(json::LookupOrDefault<std::string>(
+      json, "preemption_mode", PreemptionModeToString(n->preemption_mode)));
+  n->kv_swap_max_num_tokens = json::LookupOrDefault<int64_t>(json, "kv_swap_max_num_tokens",
+                                                             n->max_total_sequence_length);
   return EngineConfig(n);
 }
 
@@ -405,11 +611,19 @@ String EngineConfigNode::AsJSONString() const {
                                         picojson::value(this->additional_model_libs[i])}));
   }
   config["additional_models"] = picojson::value(additional_models_arr);
+  picojson::array lora_adapters_arr;
+  for (const String& lora_adapter : this->lora_adapters) {
+    lora_adapters_arr.push_back(picojson::value(lora_adapter));
+  }
+  config["lora_adapters"] = picojson::value(lora_adapters_arr);
+  config["max_num_resident_lora_adapters"] =
+      picojson::value(static_cast<int64_t>(this->max_num_resident_lora_adapters));
 
   // - Other fields
   config["mode"] = picojson::value(EngineModeToString(this->mode));
   config["gpu_memory_utilization"] = picojson::value(this->gpu_memory_utilization);
   config["kv_cache_page_size"] = picojson::value(static_cast<int64_t>(this->kv_cache_page_size));
+  config["kv_cache_dtype"] = picojson::value(this->kv_cache_dtype);
   config["max_num_sequence"] = picojson::value(static_cast<int64_t>(this->max_num_sequence));
   config["max_total_sequence_length"] =
       picojson::value(static_cast<int64_t>(this->max_total_sequence_length));
@@ -420,10 +634,63 @@ String EngineConfigNode::AsJSONString() const {
   config["prefix_cache_mode"] = picojson::value(PrefixCacheModeToString(this->prefix_cache_mode));
   config["prefix_cache_max_num_recycling_seqs"] =
       picojson::value(static_cast<int64_t>(this->prefix_cache_max_num_recycling_seqs));
+  config["prefix_cache_eviction_policy"] =
+      picojson::value(PrefixCacheEvictionPolicyToString(this->prefix_cache_eviction_policy));
+  config["prefix_cache_keep_aborted_min_tokens"] =
+      picojson::value(static_cast<int64_t>(this->prefix_cache_keep_aborted_min_tokens));
+  config["prefix_cache_compaction_max_num_tokens"] =
+      picojson::value(static_cast<int64_t>(this->prefix_cache_compaction_max_num_tokens));
+  config["prefix_cache_max_num_host_tokens"] =
+      picojson::value(static_cast<int64_t>(this->prefix_cache_max_num_host_tokens));
+  config["prefix_cache_max_num_disk_tokens"] =
+      picojson::value(static_cast<int64_t>(this->prefix_cache_max_num_disk_tokens));
+  config["prefix_cache_disk_path"] = picojson::value(this->prefix_cache_disk_path);
+  config["kv_session_dir"] = picojson::value(this->kv_session_dir);
+  config["prefix_cache_shared_memory_name"] =
+      picojson::value(this->prefix_cache_shared_memory_name);
+  config["prefix_cache_shared_memory_bytes"] =
+      picojson::value(static_cast<int64_t>(this->prefix_cache_shared_memory_bytes));
+  config["image_embedding_cache_bytes"] =
+      picojson::value(static_cast<int64_t>(this->image_embedding_cache_bytes));
+  config["grammar_cache_dir"] = picojson::value(this->grammar_cache_dir);
+  config["scheduling_policy"] =
+      picojson::value(SchedulingPolicyKindToString(this->scheduling_policy));
+  picojson::object tenant_weights_obj;
+  for (const auto& [tenant_id, weight] : this->tenant_weights) {
+    tenant_weights_obj[tenant_id] = picojson::value(weight);
+  }
+  config["tenant_weights"] = picojson::value(tenant_weights_obj);
+  config["tenant_max_tokens_per_s"] = picojson::value(this->tenant_max_tokens_per_s);
+  config["preemption_mode"] = picojson::value(PreemptionModeToString(this->preemption_mode));
+  config["kv_swap_max_num_tokens"] =
+      picojson::value(static_cast<int64_t>(this->kv_swap_max_num_tokens));
   config["speculative_mode"] = picojson::value(SpeculativeModeToString(this->speculative_mode));
   config["spec_draft_length"] = picojson::value(static_cast<int64_t>(this->spec_draft_length));
+  config["spec_auto_disable"] = picojson::value(this->spec_auto_disable);
+  config["spec_optimistic_draft"] = picojson::value(this->spec_optimistic_draft);
   config["prefill_mode"] = picojson::value(PrefillModeToString(this->prefill_mode));
+  config["target_inter_token_latency_ms"] = picojson::value(this->target_inter_token_latency_ms);
+  config["long_prefill_chunk_size"] =
+      picojson::value(static_cast<int64_t>(this->long_prefill_chunk_size));
+  config["reserve_decode_kv_pages"] = picojson::value(this->reserve_decode_kv_pages);
+  config["disaggregation_role"] =
+      picojson::value(DisaggregationRoleToString(this->disaggregation_role));
+  config["overlap_stream_callback"] =
+      picojson::value(static_cast<bool>(this->overlap_stream_callback));
+  picojson::array decode_batch_size_buckets_arr;
+  for (int bucket : this->decode_batch_size_buckets) {
+    decode_batch_size_buckets_arr.push_back(picojson::value(static_cast<int64_t>(bucket)));
+  }
+  config["decode_batch_size_buckets"] = picojson::value(decode_batch_size_buckets_arr);
+  config["num_decode_steps"] = picojson::value(static_cast<int64_t>(this->num_decode_steps));
+  config["batch_invariant_sampling"] =
+      picojson::value(static_cast<bool>(this->batch_invariant_sampling));
   config["verbose"] = picojson::value(static_cast<bool>(this->verbose));
+  config["enable_device_timing"] = picojson::value(static_cast<bool>(this->enable_device_timing));
+  config["step_watchdog_threshold_ms"] = picojson::value(this->step_watchdog_threshold_ms);
+  config["stream_flush_interval_ms"] = picojson::value(this->stream_flush_interval_ms);
+  config["stream_flush_max_outputs"] =
+      picojson::value(static_cast<int64_t>(this->stream_flush_max_outputs));
 
   return picojson::value(config).serialize(true);
 }
@@ -539,7 +806,7 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
     const std::vector<picojson::object>& model_configs,  //
     const std::vector<ModelMetadata>& model_metadata,    //
     ModelConfigLimits model_config_limits,               //
-    InferrableEngineConfig init_config, bool verbose) {
+    InferrableEngineConfig init_config, bool require_hidden_states_workspace, bool verbose) {
   std::ostringstream os;
   InferrableEngineConfig inferred_config = init_config;
   // - 1. max_num_sequence
@@ -586,17 +853,26 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
     int64_t head_dim = model_metadata[i].kv_cache_metadata.head_dim;
     int64_t num_qo_heads = model_metadata[i].kv_cache_metadata.num_attention_heads;
     int64_t num_kv_heads = model_metadata[i].kv_cache_metadata.num_key_value_heads;
+    int64_t kv_dtype_bytes = model_metadata[i].kv_cache_metadata.dtype.bytes();
     int64_t hidden_size = head_dim * num_qo_heads;
-    kv_bytes_per_token +=
-        head_dim * num_kv_heads * (num_layers / model_metadata[i].pipeline_parallel_stages) * 4 +
-        1.25;
+    // The K and V data of each layer, in the KV storage dtype of the model lib.
+    kv_bytes_per_token += head_dim * num_kv_heads *
+                              (num_layers / model_metadata[i].pipeline_parallel_stages) * 2 *
+                              kv_dtype_bytes +
+                          1.25;
     kv_aux_workspace_bytes +=
         (max_num_sequence + 1) * 88 + prefill_chunk_size * (num_qo_heads + 1) * 8 +
         prefill_chunk_size * head_dim * (num_qo_heads + num_kv_heads) * 4 + 48 * 1024 * 1024;
-    model_workspace_bytes += prefill_chunk_size * 4 + max_num_sequence * 4 +
-                             (prefill_chunk_size * 2 + max_num_sequence) * hidden_size * 2;
-    logit_processor_workspace_bytes +=
-        max_num_sequence * 20 + max_num_sequence * vocab_size * 16.125;
+    // The embedding workspace, and the hidden states workspace only when it is required.
+    int64_t num_workspace_tensors = require_hidden_states_workspace ? 2 : 1;
+    model_workspace_bytes +=
+        prefill_chunk_size * 4 + max_num_sequence * 4 +
+        (prefill_chunk_size * num_workspace_tensors + max_num_sequence) * hidden_size * 2;
+    // The logit processor workspace, including the (max_num_sequence, vocab_size) int32 token
+    // count table of the penalties.
+    logit_processor_workspace_bytes += max_num_sequence * 20 +
+                                       max_num_sequence * vocab_size * 16.125 +
+                                       max_num_sequence * vocab_size * 4;
   }
   int64_t gpu_size_bytes = TotalDetectGlobalMemory(device);
   // Compute the maximum total sequence length under the GPU memory budget.
@@ -701,7 +977,7 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForKVCache(
     EngineMode mode, Device device, double gpu_memory_utilization,
     const std::vector<picojson::object>& model_configs,
     const std::vector<ModelMetadata>& model_metadata, InferrableEngineConfig init_config,
-    bool verbose) {
+    bool require_hidden_states_workspace, bool verbose) {
   // - Check if max_history_size is not set.
   if (init_config.max_history_size.has_value() && init_config.max_history_size.value() != 0) {
     return Result<InferrableEngineConfig>::Error(
@@ -741,13 +1017,16 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForKVCache(
   // - Infer the engine config and estimate memory usage for each mode.
   Result<MemUsageEstimationResult> local_mode_estimation_result = EstimateMemoryUsageOnMode(
       EngineMode::kLocal, device, gpu_memory_utilization, params_bytes, temp_buffer_bytes,
-      model_configs, model_metadata, model_config_limits, init_config, verbose);
+      model_configs, model_metadata, model_config_limits, init_config,
+      require_hidden_states_workspace, verbose);
   Result<MemUsageEstimationResult> interactive_mode_estimation_result = EstimateMemoryUsageOnMode(
       EngineMode::kInteractive, device, gpu_memory_utilization, params_bytes, temp_buffer_bytes,
-      model_configs, model_metadata, model_config_limits, init_config, verbose);
+      model_configs, model_metadata, model_config_limits, init_config,
+      require_hidden_states_workspace, verbose);
   Result<MemUsageEstimationResult> server_mode_estimation_result = EstimateMemoryUsageOnMode(
       EngineMode::kServer, device, gpu_memory_utilization, params_bytes, temp_buffer_bytes,
-      model_configs, model_metadata, model_config_limits, init_config, verbose);
+      model_configs, model_metadata, model_config_limits, init_config,
+      require_hidden_states_workspace, verbose);
   // - Pick the estimation result according to the mode.
   std::string mode_name;
   Result<MemUsageEstimationResult> final_estimation_result;
@@ -788,7 +1067,7 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForRNNState(
     EngineMode mode, Device device, double gpu_memory_utilization,
     const std::vector<picojson::object>& model_configs,
     const std::vector<ModelMetadata>& model_metadata, InferrableEngineConfig init_config,
-    bool verbose) {
+    bool require_hidden_states_workspace, bool verbose) {
   // - Check max_single_sequence_length is not set.
   if (init_config.max_single_sequence_length.has_value()) {
     return Result<InferrableEngineConfig>::Error(
@@ -888,10 +1167,16 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForRNNState(
     // - Calculate RNN state memory usage.
     rnn_state_base_bytes += (max_num_sequence * hidden_size * num_layers * 2 * 2 +
                              max_num_sequence * num_heads * head_size * head_size * num_layers * 2);
-    model_workspace_bytes += prefill_chunk_size * 4 + max_num_sequence * 4 +
-                             (prefill_chunk_size * 2 + max_num_sequence) * hidden_size * 2;
-    logit_processor_workspace_bytes +=
-        max_num_sequence * 20 + max_num_sequence * vocab_size * 16.125;
+    // The embedding workspace, and the hidden states workspace only when it is required.
+    int64_t num_workspace_tensors = require_hidden_states_workspace ? 2 : 1;
+    model_workspace_bytes +=
+        prefill_chunk_size * 4 + max_num_sequence * 4 +
+        (prefill_chunk_size * num_workspace_tensors + max_num_sequence) * hidden_size * 2;
+    // The logit processor workspace, including the (max_num_sequence, vocab_size) int32 token
+    // count table of the penalties.
+    logit_processor_workspace_bytes += max_num_sequence * 20 +
+                                       max_num_sequence * vocab_size * 16.125 +
+                                       max_num_sequence * vocab_size * 4;
   }
   int64_t gpu_size_bytes = TotalDetectGlobalMemory(device);
   // Compute the maximum history size length under the GPU memory budget.
@@ -11,6 +11,8 @@
 #include <tvm/runtime/object.h>
 
 #include <optional>
+#include <string>
+#include <unordered_map>
 
 #include "../metadata/model.h"
 #include "../support/result.h"
@@ -28,6 +30,8 @@ using namespace tvm::runtime;
 struct ResponseFormat {
   String type = "text";
   Optional<String> schema = NullOpt;
+  /*! \brief The regular expression that the output should fully match when type is "regex". */
+  Optional<String> regex = NullOpt;
   /*!
    * \brief Create debug config from JSON.
    * \param config_json The json string for generation config
@@ -55,6 +59,16 @@ enum class GrammarExecutionMode : int {
   kJumpForward = 1,
 };
 
+/*! \brief The pooling of an embedding request over the hidden states of its prompt. */
+enum class EmbeddingPooling : int {
+  /*! \brief The request is not an embedding request, and generates tokens. */
+  kNone = 0,
+  /*! \brief The embedding is the last hidden states of the prompt. */
+  kLast = 1,
+  /*! \brief The embedding is the mean of the last hidden states of all prompt tokens. */
+  kMean = 2,
+};
+
 /*! \brief The debug configuration of a request. */
 class DebugConfig {
  public:
@@ -83,11 +97,38 @@ class GenerationConfigNode : public Object {
   int n = 1;
   double temperature = 1.0;
   double top_p = 1.0;
+  /*!
+   * \brief The min p value of sampling. The tokens whose probability is smaller than
+   * `min_p` times the largest probability are masked. Default as 0, which disables it.
+   */
+  double min_p = 0.0;
+  /*!
+   * \brief The typical p value of sampling (locally typical sampling). The tokens whose
+   * surprisal is the closest to the entropy are kept until their total probability
+   * reaches `typical_p`. Default as 1, which disables it.
+   */
+  double typical_p = 1.0;
+  /*!
+   * \brief Whether to decode the request with beam search, where `n` is the number
+   * of beams and also the number of returned generations.
+   */
+  bool use_beam_search = false;
+  /*!
+   * \brief The exponent of the length in the beam search score normalization.
+   * The score of a finished beam is its cumulative log probability divided by
+   * "length ^ length_penalty". Default as 1.
+   */
+  double length_penalty = 1.0;
   double frequency_penalty = 0.0;
   double presence_penalty = 0.0;
   double repetition_penalty = 1.0;
   bool logprobs = false;
   int top_logprobs = 0;
+  /*!
+   * \brief Whether to return the logprobs of the prompt tokens (except the first one) along
+   * with `top_logprobs` top tokens at each prompt position, which are computed in the prefill.
+   */
+  bool prompt_logprobs = false;
   std::vector<std::pair<int, float>> logit_bias;
   int seed;
   // -1 means infinite
@@ -95,6 +136,41 @@ class GenerationConfigNode : public Object {
   Array<String> stop_strs;
   std::vector<int> stop_token_ids;
 
+  /*!
+   * \brief The scheduling priority of the request. Requests with larger
+   * priority are admitted earlier and preempted later when the engine
+   * scheduling policy is "priority". Default as 0.
+   */
+  int priority = 0;
+  /*!
+   * \brief The time-to-first-token deadline of the request in milliseconds,
+   * counted from the time the request is added to the engine. -1 means no deadline.
+   */
+  double ttft_deadline_ms = -1;
+  /*!
+   * \brief The time-per-output-token deadline of the request in milliseconds.
+   * -1 means no deadline.
+   */
+  double tpot_deadline_ms = -1;
+  /*!
+   * \brief The tenant of the request, which the "fair" scheduling policy shares the engine
+   * among. Empty means the default tenant.
+   */
+  String tenant_id = "";
+
+  /*!
+   * \brief The name of the LoRA adapter to generate the request with, which should be
+   * one of the adapters registered in the engine config. Empty means the base model.
+   */
+  String lora_adapter = "";
+
+  /*!
+   * \brief The pooling of the prompt hidden states when the request is an embedding request,
+   * which returns the embedding of its prompt instead of generating tokens, and holds no KV
+   * cache after its prefill. Default as "none", which makes a generation request.
+   */
+  EmbeddingPooling embedding_pooling = EmbeddingPooling::kNone;
+
   ResponseFormat response_format;
   DebugConfig debug_config;
 
@@ -161,6 +237,23 @@ enum class PrefixCacheMode : int {
   kDisable = 0,
   /*! \brief The paged radix tree based prefix cache mode. */
   kRadix = 1,
+  /*!
+   * \brief The paged radix tree based prefix cache mode, which additionally shares
+   * prefixes with the engines in other processes through host shared memory.
+   */
+  kShared = 2,
+};
+
+/*! \brief The policy to pick the recycling sequence to evict from prefix cache. */
+enum class PrefixCacheEvictionPolicy : int {
+  /*! \brief Evict the least recently used recycling sequence. */
+  kLRU = 0,
+  /*!
+   * \brief Evict the recycling sequence with the lowest priority weighing the recompute cost
+   * of the tokens freed by the eviction, the number of hits and the recency, in the style of
+   * the Greedy-Dual-Size-Frequency policy.
+   */
+  kCostAware = 1,
 };
 
 /*! \brief The speculative mode. */
@@ -173,6 +266,11 @@ enum class SpeculativeMode : int {
   kEagle = 2,
   /*! \brief The Medusa-style speculative decoding. */
   kMedusa = 3,
+  /*!
+   * \brief The prompt lookup speculative decoding, which proposes the draft tokens by
+   * n-gram matching in the prompt and generated tokens, without a draft model.
+   */
+  kPromptLookup = 4,
 };
 
 /*! \brief The prefill mode. */
@@ -186,6 +284,46 @@ enum class PrefillMode : int {
   kHybrid = 1,
 };
 
+/*! \brief The request scheduling policy. */
+enum class SchedulingPolicyKind : int {
+  /*! \brief Admit requests in arrival order and preempt the latest running request. */
+  kFCFS = 0,
+  /*!
+   * \brief Admit and preempt requests by their priority first, and then by the
+   * slack to their TTFT/TPOT deadlines.
+   */
+  kPriority = 1,
+  /*!
+   * \brief Share the prefill admission and the running slots among the tenants of requests by
+   * weighted fair sharing of their processed tokens. Requests of the same tenant are FCFS.
+   */
+  kFair = 2,
+};
+
+/*! \brief The preemption mode. */
+enum class PreemptionMode : int {
+  /*! \brief Drop the KV data of preempted requests and recompute them via prefill on resume. */
+  kRecompute = 0,
+  /*!
+   * \brief Swap the KV data of preempted requests out to host memory and swap them
+   * back in on resume. Requests that cannot be swapped fall back to recompute.
+   */
+  kSwap = 1,
+};
+
+/*! \brief The role of an engine in disaggregated prefill and decode serving. */
+enum class DisaggregationRole : int {
+  /*! \brief The engine runs both the prefill and the decode of requests. */
+  kNone = 0,
+  /*!
+   * \brief The engine runs the prefill of requests, and hands the prefilled requests
+   * together with their KV data off to a paired decode engine.
+   */
+  kPrefill = 1,
+  /*! \brief The engine adopts and decodes the requests handed off by prefill engines. */
+  kDecode = 2,
+};
+
 class InferrableEngineConfig;
 
 /*! \brief The configuration of engine execution config. */
@@ -201,6 +339,16 @@ class EngineConfigNode : public Object {
   Array<String> additional_models;
   /*! \brief The path to the additional models' libraries. */
   Array<String> additional_model_libs;
+  /*!
+   * \brief The paths to the LoRA adapter directories of the model. Each adapter is named
+   * by its directory name, and requests pick an adapter by name in generation config.
+   */
+  Array<String> lora_adapters;
+  /*!
+   * \brief The maximum number of LoRA adapters whose weights stay on GPU at the same time.
+   * The other adapters are loaded on demand, evicting the least recently used ones.
+   */
+  int max_num_resident_lora_adapters = 8;
 
   /*************** KV cache config and engine capacities ***************/
 
@@ -220,6 +368,13 @@ class EngineConfigNode : public Object {
   float gpu_memory_utilization = 0.85;
   /*! \brief The number of consecutive tokens handled in each page in paged KV cache. */
   int kv_cache_page_size = 16;
+  /*!
+   * \brief The storage dtype of the KV data in KV cache, or "auto" to use the dtype the model
+   * lib is compiled with. The KV storage dtype is decided at model compilation, and the engine
+   * checks that the model lib matches the given dtype. The memory estimation of the KV cache
+   * capacity uses the KV storage dtype recorded in the model lib.
+   */
+  String kv_cache_dtype = "auto";
   /*!
    * \brief The maximum number of sequences that are allowed to be
    * processed by the KV cache at any time.
@@ -244,6 +399,85 @@ class EngineConfigNode : public Object {
   /*! \brief The maximum number of recycling sequences in prefix cache, default as max_num_sequence.
    * And set 0 to disable prefix cache, set -1 to have infinite capacity prefix cache. */
   int prefix_cache_max_num_recycling_seqs = -1;
+  /*! \brief The policy to pick the recycling sequence to evict from prefix cache. */
+  PrefixCacheEvictionPolicy prefix_cache_eviction_policy = PrefixCacheEvictionPolicy::kLRU;
+  /*!
+   * \brief The minimum number of prefilled tokens of an aborted request to keep its KV data in
+   * prefix cache as a recycling sequence, as a long aborted prompt is likely to be sent again by
+   * a retrying client. The KV data of the other aborted requests are released immediately.
+   * Set 0 to always release the KV data of aborted requests.
+   */
+  int64_t prefix_cache_keep_aborted_min_tokens = 0;
+  /*!
+   * \brief The maximum number of tokens whose KV data are compacted per idle engine step.
+   * The recycling sequences of prefix cache whose KV data span several forked blocks are
+   * copied into fresh pages when the engine has no request, reclaiming the partially filled
+   * pages at the fork boundaries. It requires the KV swap support of the model.
+   * Set 0 to disable the compaction.
+   */
+  int64_t prefix_cache_compaction_max_num_tokens = 0;
+  /*!
+   * \brief The maximum number of tokens whose KV data are offloaded to host memory when
+   * evicted from prefix cache, so that they can be restored instead of recomputed.
+   * Set 0 to disable the host memory tier.
+   */
+  int64_t prefix_cache_max_num_host_tokens = 0;
+  /*!
+   * \brief The maximum number of tokens whose KV data are further offloaded to disk when
+   * evicted from the host memory tier. Set 0 to disable the disk tier.
+   */
+  int64_t prefix_cache_max_num_disk_tokens = 0;
+  /*! \brief The directory to store the prefix cache KV data offloaded to disk. */
+  String prefix_cache_disk_path = "";
+  /*!
+   * \brief The directory to store the KV snapshots of conversation sessions, which are
+   * restored into prefix cache when the sessions resume. Empty to disable the snapshots.
+   */
+  String kv_session_dir = "";
+  /*!
+   * \brief The name of the host shared memory to share prefixes across engine processes
+   * under the "shared" prefix cache mode. Engines must run the same model to share a name.
+   */
+  String prefix_cache_shared_memory_name = "mlc_llm_prefix_cache";
+  /*! \brief The capacity in bytes of the host shared memory under the "shared" mode. */
+  int64_t prefix_cache_shared_memory_bytes = 1LL << 30;
+  /*!
+   * \brief The capacity in bytes of the device-resident LRU cache of image embeddings per model,
+   * which reuses the embedding of an image sent again. Set 0 to disable the cache.
+   */
+  int64_t image_embedding_cache_bytes = 0;
+
+  /*************** Grammar ***************/
+
+  /*!
+   * \brief The directory to persist the grammar preprocessing results in, so that the
+   * preprocessing of a grammar is reused across engine restarts. Empty means no persistence.
+   */
+  String grammar_cache_dir = "";
+
+  /*************** Scheduling ***************/
+
+  /*! \brief The policy to order request admission and preemption. */
+  SchedulingPolicyKind scheduling_policy = SchedulingPolicyKind::kFCFS;
+  /*!
+   * \brief The weights of tenants under the "fair" scheduling policy. A tenant gets a share of
+   * the processed tokens proportional to its weight. The tenants not listed have weight 1.
+   */
+  std::unordered_map<std::string, double> tenant_weights;
+  /*!
+   * \brief The maximum rate of processed tokens per second of each tenant under the "fair"
+   * scheduling policy, with a burst of one second worth of tokens. A tenant exceeding the rate
+   * has no new request admitted until its rate drops. Set 0 for no limit.
+   */
+  double tenant_max_tokens_per_s = 0;
+  /*! \brief The preemption mode. */
+  PreemptionMode preemption_mode = PreemptionMode::kRecompute;
+  /*!
+   * \brief The maximum total number of tokens whose KV data are allowed to be swapped
+   * out to host memory at any time under the "swap" preemption mode.
+   * Default as max_total_sequence_length.
+   */
+  int64_t kv_swap_max_num_tokens = -1;
 
   /*************** Speculative decoding ***************/
 
@@ -252,19 +486,134 @@ class EngineConfigNode : public Object {
   /*!
    * \brief The number of tokens to generate in speculative proposal (draft).
    * Being 0 means to enable adaptive speculative mode, where the draft length
-   * will be automatically adjusted based on engine state.
+   * will be automatically adjusted based on engine state. The prompt lookup mode does not
+   * support the adaptive draft length, where being 0 means the fixed draft length 4.
    */
   int spec_draft_length = 0;
   /*! \brief The number of tokens to generate in speculative tree decoding */
   int spec_tree_width = 1;
+  /*!
+   * \brief The max number of draft tokens of each request in a speculative decoding step
+   * under the token tree mode. When positive, the token tree grows in a dynamic shape: each
+   * draft round adds the `spec_tree_width` candidates with the highest draft path probabilities,
+   * rather than expanding every leaf by `spec_tree_width`. Being 0 means the fixed tree shape.
+   */
+  int spec_tree_token_budget = 0;
+  /*!
+   * \brief Whether to switch to normal mode batch decode in the steps where the cost model of
+   * the measured draft, verify and decode times expects speculative decoding to be slower.
+   * It applies to the "small draft" speculative mode.
+   */
+  bool spec_auto_disable = true;
+  /*!
+   * \brief Whether to feed the last draft token of each request into the draft model right
+   * after launching the verification, optimistically assuming the draft is fully accepted.
+   * The draft model forward is then no longer launched after the verification result arrives,
+   * and is rolled back for the rejected drafts. It applies to the chain drafts of the
+   * "small draft" speculative mode.
+   */
+  bool spec_optimistic_draft = false;
 
   /*************** Prefill mode ***************/
 
   /*! \brief The prefill mode. */
   PrefillMode prefill_mode = PrefillMode::kHybrid;
+  /*!
+   * \brief The target inter-token latency in milliseconds of the running requests under the
+   * hybrid prefill mode. When positive, the per-step prefill token budget is tuned online from
+   * the measured step latency, so that the decode requests fused into prefill keep the target
+   * latency. The budget never exceeds the prefill chunk size. Set 0 to always use the prefill
+   * chunk size as the budget.
+   */
+  double target_inter_token_latency_ms = 0;
+  /*!
+   * \brief The maximum number of prompt tokens of a single request to prefill in a step when
+   * there are running requests. Longer prompts are chunked across steps and interleaved with the
+   * decode of the running requests, which are fused into the prefill under the hybrid prefill
+   * mode and run in alternate steps otherwise, so that a long prompt does not stall decode for
+   * its whole prefill. Set 0 to chunk prompts only by the prefill token budget.
+   */
+  int64_t long_prefill_chunk_size = 0;
+  /*!
+   * \brief Whether to reserve KV cache pages for the expected decode growth of the running
+   * requests when admitting new requests to prefill. The output length of each request is
+   * predicted from the average output length of the finished requests, capped by its
+   * `max_tokens`, so that the admitted requests are less likely to be preempted later.
+   */
+  bool reserve_decode_kv_pages = true;
+
+  /*************** Disaggregated serving ***************/
+
+  /*!
+   * \brief The role of the engine in disaggregated prefill and decode serving.
+   * Prefill engines and decode engines are paired by the threaded engine, and the KV data
+   * of prefilled requests are transferred through host memory.
+   */
+  DisaggregationRole disaggregation_role = DisaggregationRole::kNone;
+
+  /*************** Engine step pipelining ***************/
+
+  /*!
+   * \brief Whether to defer the request stream callback of each engine step until the next
+   * step has launched its GPU work, so that the callback overhead (e.g., the detokenization
+   * in the callback of Python engines) overlaps with the GPU execution instead of leaving the
+   * GPU idle between steps.
+   */
+  bool overlap_stream_callback = false;
+  /*!
+   * \brief The batch size buckets of batch decode. When specified, the batch decode pads the
+   * batch size to the smallest bucket covering it, so that the CUDA graphs captured by the model
+   * library (compiled with "cudagraph=1") are replayed at a small fixed set of batch sizes
+   * instead of being captured for every batch size. Empty means no padding.
+   */
+  std::vector<int> decode_batch_size_buckets;
+  /*!
+   * \brief The number of decode steps the batch decode runs back-to-back on device in an
+   * engine step, when none of the running requests needs its tokens on host in every step
+   * (e.g., for stop strings, grammars, penalties or logprobs). The tokens are sampled and the
+   * stop conditions are checked on device, and the tokens of all the steps are post-processed
+   * at once, which trades streaming granularity for throughput at small batch sizes.
+   * Value 1 means one decode step per engine step.
+   */
+  int num_decode_steps = 1;
+
+  /*************** Determinism ***************/
+
+  /*!
+   * \brief Whether to sample every request in the same way regardless of the other requests
+   * in the batch, so that the outputs of a request with a fixed seed are reproducible under
+   * any batch composition. The sampler applies the top-p (and min-p, typical-p) filters and
+   * the sorted sampling to every distribution instead of only when a request of the batch
+   * needs them, the tokens are always sampled on host (which disables multi-step decode), and
+   * the random stream of each request restarts at its number of committed tokens in every
+   * engine step. It costs sampling throughput.
+   */
+  bool batch_invariant_sampling = false;
 
   /*************** Debug ***************/
   bool verbose = false;
+  /*!
+   * \brief Whether to time the device work (embedding, prefill, decode, logit processing
+   * and sampling) of each engine step with device timers, so that the device time is
+   * reported separately from the host time in the engine metrics.
+   */
+  bool enable_device_timing = false;
+  /*!
+   * \brief The latency threshold in milliseconds of an engine step, beyond which the engine
+   * logs the latency breakdown of the step as a warning. Zero disables the step watchdog.
+   */
+  double step_watchdog_threshold_ms = 0;
+  /*!
+   * \brief The max time in milliseconds to hold the stream outputs before invoking the
+   * request stream callback. The outputs of a request held in the meantime are merged into one.
+   * Zero means invoking the callback as soon as there are outputs.
+   */
+  double stream_flush_interval_ms = 0;
+  /*!
+   * \brief The number of held request stream outputs which triggers the callback invocation
+   * before the flush interval elapses. Zero means no limit.
+   */
+  int stream_flush_max_outputs = 0;
 
   String AsJSONString() const;
 
@@ -298,22 +647,29 @@ struct InferrableEngineConfig {
   std::optional<int64_t> prefill_chunk_size;
   std::optional<int64_t> max_history_size;
 
-  /*! \brief Infer the config for KV cache from a given initial config. */
+  /*!
+   * \brief Infer the config for KV cache from a given initial config.
+   * The hidden states workspace of the models is counted only when
+   * `require_hidden_states_workspace` is true, as it is not allocated otherwise.
+   */
   static Result<InferrableEngineConfig> InferForKVCache(
       EngineMode mode, Device device, double gpu_memory_utilization,
       const std::vector<picojson::object>& model_configs,
       const std::vector<ModelMetadata>& model_metadata, InferrableEngineConfig init_config,
-      bool verbose);
+      bool require_hidden_states_workspace, bool verbose);
   /*! \brief Infer the config for RNN state from a given initial config. */
   static Result<InferrableEngineConfig> InferForRNNState(
       EngineMode mode, Device device, double gpu_memory_utilization,
       const std::vector<picojson::object>& model_configs,
       const std::vector<ModelMetadata>& model_metadata, InferrableEngineConfig init_config,
-      bool verbose);
+      bool require_hidden_states_workspace, bool verbose);
 };
 
 /****************** Config utils ******************/
 
+/*! \brief Get the total global memory in bytes of the device. */
+uint64_t TotalDetectGlobalMemory(DLDevice device);
+
 /*! \brief Check if the models use KV cache or RNN state. */
 Result<bool> ModelsUseKVCache(const std::vector<picojson::object>& model_configs);
 
@@ -348,6 +704,8 @@ inline std::string PrefixCacheModeToString(PrefixCacheMode prefix_cache_mode) {
     return "disable";
   } else if (prefix_cache_mode == PrefixCacheMode::kRadix) {
     return "radix";
+  } else if (prefix_cache_mode == PrefixCacheMode::kShared) {
+    return "shared";
   } else {
     LOG(FATAL) << "Invalid prefix cache mode: " << static_cast<int>(prefix_cache_mode);
   }
@@ -358,12 +716,35 @@ inline PrefixCacheMode PrefixCacheModeFromString(const std::string& prefix_cache
     return PrefixCacheMode::kDisable;
   } else if (prefix_cache_mode == "radix") {
     return PrefixCacheMode::kRadix;
+  } else if (prefix_cache_mode == "shared") {
+    return PrefixCacheMode::kShared;
   } else {
     LOG(FATAL) << "Invalid prefix cache mode string: " << prefix_cache_mode;
     throw;
   }
 }
 
+inline std::string PrefixCacheEvictionPolicyToString(PrefixCacheEvictionPolicy policy) {
+  if (policy == PrefixCacheEvictionPolicy::kLRU) {
+    return "lru";
+  } else if (policy == PrefixCacheEvictionPolicy::kCostAware) {
+    return "cost_aware";
+  } else {
+    LOG(FATAL) << "Invalid prefix cache eviction policy: " << static_cast<int>(policy);
+  }
+}
+
+inline PrefixCacheEvictionPolicy PrefixCacheEvictionPolicyFromString(const std::string& policy) {
+  if (policy == "lru") {
+    return PrefixCacheEvictionPolicy::kLRU;
+  } else if (policy == "cost_aware") {
+    return PrefixCacheEvictionPolicy::kCostAware;
+  } else {
+    LOG(FATAL) << "Invalid prefix cache eviction policy string: " << policy;
+    throw;
+  }
+}
+
 inline std::string SpeculativeModeToString(SpeculativeMode speculative_mode) {
   if (speculative_mode == SpeculativeMode::kDisable) {
     return "disable";
@@ -373,11 +754,22 @@ inline std::string SpeculativeModeToString(SpeculativeMode speculative_mode) {
     return "eagle";
   } else if (speculative_mode == SpeculativeMode::kMedusa) {
     return "medusa";
+  } else if (speculative_mode == SpeculativeMode::kPromptLookup) {
+    return "prompt_lookup";
   } else {
     LOG(FATAL) << "Invalid speculative mode: " << static_cast<int>(speculative_mode);
   }
 }
 
+/*!
+ * \brief Whether the speculative mode drafts from the hidden states of the base model, which
+ * needs the hidden states workspace of the models besides the embedding workspace.
+ */
+inline bool SpeculativeModeUsesHiddenStates(SpeculativeMode speculative_mode) {
+  return speculative_mode == SpeculativeMode::kEagle ||
+         speculative_mode == SpeculativeMode::kMedusa;
+}
+
 inline SpeculativeMode SpeculativeModeFromString(const std::string& speculative_mode) {
   if (speculative_mode == "disable") {
     return SpeculativeMode::kDisable;
@@ -387,6 +779,8 @@ inline SpeculativeMode SpeculativeModeFromString(const std::string& speculative_
     return SpeculativeMode::kEagle;
   } else if (speculative_mode == "medusa") {
     return SpeculativeMode::kMedusa;
+  } else if (speculative_mode == "prompt_lookup") {
+    return SpeculativeMode::kPromptLookup;
   } else {
     LOG(FATAL) << "Invalid speculative mode string: " << speculative_mode;
     throw;
@@ -414,6 +808,77 @@ inline PrefillMode PrefillModeFromString(const std::string& prefill_mode) {
   }
 }
 
+inline std::string SchedulingPolicyKindToString(SchedulingPolicyKind scheduling_policy) {
+  if (scheduling_policy == SchedulingPolicyKind::kFCFS) {
+    return "fcfs";
+  } else if (scheduling_policy == SchedulingPolicyKind::kPriority) {
+    return "priority";
+  } else if (scheduling_policy == SchedulingPolicyKind::kFair) {
+    return "fair";
+  } else {
+    LOG(FATAL) << "Invalid scheduling policy: " << static_cast<int>(scheduling_policy);
+  }
+}
+
+inline SchedulingPolicyKind SchedulingPolicyKindFromString(const std::string& scheduling_policy) {
+  if (scheduling_policy == "fcfs") {
+    return SchedulingPolicyKind::kFCFS;
+  } else if (scheduling_policy == "priority") {
+    return SchedulingPolicyKind::kPriority;
+  } else if (scheduling_policy == "fair") {
+    return SchedulingPolicyKind::kFair;
+  } else {
+    LOG(FATAL) << "Invalid scheduling policy string: " << scheduling_policy;
+    throw;
+  }
+}
+
+inline std::string PreemptionModeToString(PreemptionMode preemption_mode) {
+  if (preemption_mode == PreemptionMode::kRecompute) {
+    return "recompute";
+  } else if (preemption_mode == PreemptionMode::kSwap) {
+    return "swap";
+  } else {
+    LOG(FATAL) << "Invalid preemption mode: " << static_cast<int>(preemption_mode);
+  }
+}
+
+inline PreemptionMode PreemptionModeFromString(const std::string& preemption_mode) {
+  if (preemption_mode == "recompute") {
+    return PreemptionMode::kRecompute;
+  } else if (preemption_mode == "swap") {
+    return PreemptionMode::kSwap;
+  } else {
+    LOG(FATAL) << "Invalid preemption mode string: " << preemption_mode;
+    throw;
+  }
+}
+
+inline std::string DisaggregationRoleToString(DisaggregationRole role) {
+  if (role == DisaggregationRole::kNone) {
+    return "none";
+  } else if (role == DisaggregationRole::kPrefill) {
+    return "prefill";
+  } else if (role == DisaggregationRole::kDecode) {
+    return "decode";
+  } else {
+    LOG(FATAL) << "Invalid disaggregation role: " << static_cast<int>(role);
+  }
+}
+
+inline DisaggregationRole DisaggregationRoleFromString(const std::string& role) {
+  if (role == "none") {
+    return DisaggregationRole::kNone;
+  } else if (role == "prefill") {
+    return DisaggregationRole::kPrefill;
+  } else if (role == "decode") {
+    return DisaggregationRole::kDecode;
+  } else {
+    LOG(FATAL) << "Invalid disaggregation role string: " << role;
+    throw;
+  }
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
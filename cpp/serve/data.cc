@@ -6,6 +6,9 @@
 
 #include <tvm/runtime/registry.h>
 
+#include <cstring>
+
+#include "../support/sha256.h"
 #include "model.h"
 
 namespace mlc {
@@ -83,17 +86,57 @@ TVM_REGISTER_GLOBAL("mlc.serve.TokenDataGetTokenIds").set_body_typed([](TokenDat
 
 TVM_REGISTER_OBJECT_TYPE(ImageDataNode);
 
-ImageData::ImageData(NDArray image, int embed_size) {
+ImageData::ImageData(NDArray image, int embed_size, std::string content_hash) {
   ObjectPtr<ImageDataNode> n = make_object<ImageDataNode>();
+  if (content_hash.empty() && image->device.device_type == kDLCPU && image.IsContiguous()) {
+    content_hash = ImageDataNode::HashContent(static_cast<const char*>(image->data) +
+                                                  image->byte_offset,
+                                              GetDataSize(*image.operator->()));
+  }
   n->image = std::move(image);
   n->embed_size = embed_size;
+  n->content_hash = std::move(content_hash);
   data_ = std::move(n);
 }
 
 int ImageDataNode::GetLength() const { return embed_size; }
 
 ObjectRef ImageDataNode::GetEmbedding(Model model, ObjectRef* dst, int offset) const {
-  return model->ImageEmbed(image, dst, offset);
+  return model->ImageEmbed(image, dst, offset, content_hash);
+}
+
+/*! \brief The splitmix64 finalizer, which mixes all bits of the input. */
+inline uint64_t MixBits(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+std::vector<int32_t> ImageDataNode::GetPrefixCacheTokenIds() const {
+  if (content_hash.empty()) {
+    return {};
+  }
+  ICHECK_EQ(content_hash.size(), SHA256Hasher::kDigestSize);
+  // The first ids carry 31 bits of a digest word each, 248 bits in total, so that different
+  // images do not collide in prefix cache. The rest ids only need to be determined by the digest.
+  constexpr int kNumDigestWords = SHA256Hasher::kDigestSize / 4;
+  uint32_t digest_words[kNumDigestWords];
+  std::memcpy(digest_words, content_hash.data(), SHA256Hasher::kDigestSize);
+  std::vector<int32_t> token_ids(embed_size);
+  for (int i = 0; i < embed_size; ++i) {
+    uint32_t bits = i < kNumDigestWords
+                        ? digest_words[i]
+                        : static_cast<uint32_t>(MixBits(
+                              (static_cast<uint64_t>(digest_words[i % kNumDigestWords]) << 32) |
+                              static_cast<uint64_t>(i)));
+    // Set the sign bit, so that the pseudo token id is negative.
+    token_ids[i] = static_cast<int32_t>(bits | 0x80000000U);
+  }
+  return token_ids;
+}
+
+std::string ImageDataNode::HashContent(const void* data, size_t num_bytes) {
+  return SHA256(data, num_bytes);
 }
 
 TVM_REGISTER_GLOBAL("mlc.serve.ImageData").set_body_typed([](NDArray image, int embed_size) {
@@ -214,7 +257,9 @@ TVM_REGISTER_GLOBAL("mlc.serve.RequestStreamOutputUnpack")
                                   : Optional<Array<Array<String>>>(),
                               Array<Optional<String>>(output->group_finish_reason),
                               output->request_final_usage_json_str,
-                              Array<String>(output->group_extra_prefix_string)};
+                              Array<String>(output->group_extra_prefix_string),
+                              output->embedding,
+                              Array<String>(output->prompt_logprob_json_strs)};
       output->unpacked = true;
       return ret;
     });
@@ -13,6 +13,8 @@
 
 #include <atomic>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include "../tokenizers/tokenizers.h"
 
@@ -111,17 +113,40 @@ class ImageDataNode : public DataNode {
   /*! \brief The pixel values. */
   NDArray image;
   int embed_size;
+  /*!
+   * \brief The SHA-256 digest of the image content, with which the image embedding is cached
+   * and the image is matched in prefix cache. Being empty means the content hash is unknown.
+   */
+  std::string content_hash;
 
   int GetLength() const final;
   ObjectRef GetEmbedding(Model model, ObjectRef* dst = nullptr, int offset = 0) const final;
 
+  /*!
+   * \brief Get the pseudo token ids that stand for the image in prefix cache, one for each
+   * embedding position. The ids are negative, so they never collide with the vocabulary, and
+   * the first ids carry the bits of the content hash, so only the same image has the same ids.
+   * \return The pseudo token ids, or empty when the content hash is unknown.
+   */
+  std::vector<int32_t> GetPrefixCacheTokenIds() const;
+
+  /*! \brief Hash the given image content bytes into their 32-byte SHA-256 digest. */
+  static std::string HashContent(const void* data, size_t num_bytes);
+
   static constexpr const char* _type_key = "mlc.serve.ImageData";
   TVM_DECLARE_BASE_OBJECT_INFO(ImageDataNode, DataNode);
 };
 
 class ImageData : public Data {
  public:
-  explicit ImageData(NDArray image, int embed_size);
+  /*!
+   * \brief Create an image data.
+   * \param image The pixel values.
+   * \param embed_size The number of embedding positions of the image.
+   * \param content_hash The hash of the image content (see ImageDataNode::HashContent). When it
+   * is empty and the image is on CPU, the hash is computed from the pixel values.
+   */
+  explicit ImageData(NDArray image, int embed_size, std::string content_hash = "");
 
   TVM_DEFINE_OBJECT_REF_METHODS(ImageData, Data, ImageDataNode);
 };
@@ -191,6 +216,18 @@ class RequestStreamOutputObj : public Object {
    */
   std::vector<String> group_extra_prefix_string;
 
+  /*!
+   * \brief The float32 prompt embedding of an embedding request when it is finished,
+   * or None otherwise.
+   */
+  Optional<NDArray> embedding;
+
+  /*!
+   * \brief The logprobs JSON strings of the prompt tokens computed since last invocation,
+   * for the requests with `prompt_logprobs`.
+   */
+  std::vector<String> prompt_logprob_json_strs;
+
   std::atomic<bool> unpacked = false;
 
   static constexpr const char* _type_key = "mlc.serve.RequestStreamOutput";
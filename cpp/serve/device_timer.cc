@@ -0,0 +1,26 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/device_timer.cc
+ */
+#include "device_timer.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+thread_local DeviceTimerRecorder* DeviceTimerRecorder::current_ = nullptr;
+
+void DeviceTimerRecorder::Flush(double step_time, DeviceTimeMetrics* metrics) {
+  double total_device_time = 0.0;
+  for (auto& [kind, timer] : pending_timers_) {
+    double device_time = static_cast<double>(timer->SyncAndGetElapsedNanos()) / 1e9;
+    metrics->UpdateDeviceTime(kind, device_time);
+    total_device_time += device_time;
+  }
+  pending_timers_.clear();
+  metrics->UpdateStep(step_time, total_device_time);
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
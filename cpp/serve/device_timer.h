@@ -0,0 +1,95 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/device_timer.h
+ * \brief The optional device timers of the device work in engine steps.
+ */
+#ifndef MLC_LLM_SERVE_DEVICE_TIMER_H_
+#define MLC_LLM_SERVE_DEVICE_TIMER_H_
+
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/profiling.h>
+
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using tvm::Device;
+using tvm::runtime::Timer;
+
+/*!
+ * \brief The recorder of the device timers in engine steps.
+ * The engine activates its recorder on the engine thread during each step, and the
+ * DeviceTimerScopes in the model, the logit processor and the sampler start device timers
+ * (e.g., CUDA events) on the active recorder. The timers are only resolved at the end of
+ * the step in `Flush`, so the timed device work is not synchronized eagerly.
+ */
+class DeviceTimerRecorder {
+ public:
+  /*! \brief Add a stopped timer of the given kind to the recorder. */
+  void AddTimer(DeviceTimeKind kind, Timer timer) {
+    pending_timers_.emplace_back(kind, std::move(timer));
+  }
+
+  /*!
+   * \brief Resolve the pending timers of the step into the metrics.
+   * \param step_time The wall time of the step in seconds.
+   * \param metrics The device time metrics to update.
+   */
+  void Flush(double step_time, DeviceTimeMetrics* metrics);
+
+  /*! \return The active recorder of the current thread, or nullptr if there is none. */
+  static DeviceTimerRecorder* Current() { return current_; }
+
+  /*! \brief The RAII scope that activates a recorder on the current thread. */
+  class ActiveScope {
+   public:
+    explicit ActiveScope(DeviceTimerRecorder* recorder) : prev_(current_) { current_ = recorder; }
+    ~ActiveScope() { current_ = prev_; }
+
+   private:
+    DeviceTimerRecorder* prev_;
+  };
+
+ private:
+  /*! \brief The timers started in the current step. */
+  std::vector<std::pair<DeviceTimeKind, Timer>> pending_timers_;
+  /*! \brief The active recorder of each thread. */
+  static thread_local DeviceTimerRecorder* current_;
+};
+
+/*!
+ * \brief The RAII scope that times the device work launched in the scope onto the active
+ * device timer recorder. It does nothing when there is no active recorder.
+ */
+class DeviceTimerScope {
+ public:
+  explicit DeviceTimerScope(DeviceTimeKind kind, Device device)
+      : recorder_(DeviceTimerRecorder::Current()), kind_(kind) {
+    if (recorder_ != nullptr) {
+      timer_ = Timer::Start(device);
+    }
+  }
+
+  ~DeviceTimerScope() {
+    if (recorder_ != nullptr) {
+      timer_->Stop();
+      recorder_->AddTimer(kind_, std::move(timer_));
+    }
+  }
+
+ private:
+  DeviceTimerRecorder* recorder_;
+  DeviceTimeKind kind_;
+  Timer timer_;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_DEVICE_TIMER_H_
@@ -22,8 +22,10 @@ DraftTokenWorkspaceManagerObj::DraftTokenWorkspaceManagerObj(int max_num_tokens,
       hidden_states_dtype_(hidden_states_dtype),
       device_(device),
       ft_(ft) {
+  // The slots are handed out from the back, so that the lower slots are used first.
   free_slots_.resize(max_num_tokens);
-  std::iota(free_slots_.begin(), free_slots_.end(), 0);
+  std::iota(free_slots_.rbegin(), free_slots_.rend(), 0);
+  ref_count_.assign(max_num_tokens, 0);
 }
 
 void DraftTokenWorkspaceManagerObj::AllocSlots(int num_slots, std::vector<int>* result) {
@@ -31,6 +33,7 @@ void DraftTokenWorkspaceManagerObj::AllocSlots(int num_slots, std::vector<int>*
   result->assign(free_slots_.rbegin(), free_slots_.rbegin() + num_slots);
   free_slots_.resize(free_slots_.size() - num_slots);
   for (int slot : (*result)) {
+    ICHECK_EQ(ref_count_[slot], 0);
     ref_count_[slot] = 1;
   }
 }
@@ -45,15 +48,16 @@ void DraftTokenWorkspaceManagerObj::AllocSlots(int num_slots,
   for (int i = 0; i < num_slots; ++i) {
     int slot = (*result)[i];
     ICHECK(initial_ref_count[i] > 0);
+    ICHECK_EQ(ref_count_[slot], 0);
     ref_count_[slot] = initial_ref_count[i];
   }
 }
 
 void DraftTokenWorkspaceManagerObj::FreeSlots(const std::vector<int>& slots) {
   for (int slot : slots) {
-    if (--ref_count_.at(slot) == 0) {
+    ICHECK_GT(ref_count_[slot], 0) << "The slot " << slot << " is freed more than allocated.";
+    if (--ref_count_[slot] == 0) {
       free_slots_.push_back(slot);
-      ref_count_.erase(slot);
     }
   }
 }
@@ -76,6 +76,7 @@ class DraftTokenWorkspaceManagerObj : public Object {
   static constexpr const char* _type_key = "mlc.serve.DraftTokenWorkspaceManager";
 
  private:
+  /*! \brief The free slots, used as a stack so that the recently freed slots are reused first. */
   std::vector<int> free_slots_;
   int max_num_tokens_;
   int vocab_size_;
@@ -83,7 +84,8 @@ class DraftTokenWorkspaceManagerObj : public Object {
   DataType hidden_states_dtype_;
   DLDevice device_;
   const FunctionTable& ft_;
-  std::unordered_map<int, int> ref_count_;
+  /*! \brief The reference count of each slot, which is 0 for the free slots. */
+  std::vector<int> ref_count_;
 };
 
 class DraftTokenWorkspaceManager : public ObjectRef {
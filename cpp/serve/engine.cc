@@ -14,10 +14,18 @@
 #include <tvm/runtime/registry.h>
 #include <tvm/runtime/threading_backend.h>
 
+#include <array>
+#include <cctype>
+#include <chrono>
 #include <cstdlib>
+#include <filesystem>
 #include <functional>
+#include <future>
+#include <limits>
+#include <memory>
 #include <numeric>
 #include <optional>
+#include <sstream>
 #include <tuple>
 #include <unordered_set>
 
@@ -28,6 +36,7 @@
 #include "../tokenizers/tokenizers.h"
 #include "engine_actions/action.h"
 #include "engine_actions/action_commons.h"
+#include "device_timer.h"
 #include "engine_state.h"
 #include "event_trace_recorder.h"
 #include "logit_processor.h"
@@ -45,6 +54,9 @@ using namespace tvm::runtime;
 
 class EngineModule;
 
+/*! \brief The draft length of the prompt lookup speculative mode when it is not specified. */
+constexpr int kDefaultPromptLookupDraftLength = 4;
+
 // get tokenizer info from model config
 inline std::optional<TokenizerInfo> GetTokenizerInfo(const picojson::object& model_config) {
   if (model_config.count("tokenizer_info") == 0) {
@@ -80,6 +92,25 @@ inline std::pair<std::optional<std::string>, int> GetEnvSocketHostPort() {
   return {host, std::atoi(port_str)};
 }
 
+/*!
+ * \brief Get the identity hash of the model of the engine, from the absolute model path and the
+ * model library. The KV data shared across processes or saved to files record this hash, so that
+ * they are only restored by the same model.
+ */
+inline uint64_t GetModelIdentityHash(const EngineConfig& engine_config) {
+  std::error_code error;
+  std::filesystem::path model_path =
+      std::filesystem::weakly_canonical(std::string(engine_config->model), error);
+  std::string identity = (error ? std::string(engine_config->model) : model_path.string()) +
+                         "\n" + std::string(engine_config->model_lib);
+  // FNV-1a, which is stable across processes and builds.
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : identity) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
 /*!
  *  \brief This a mock engine that always echo back the inputs
  *   and attaches the generation config to usage.extra
@@ -116,11 +147,19 @@ class MockEchoEngineImpl : public Engine {
     // - Get the default generation config from the first model.
     GenerationConfig default_generation_cfg =
         GenerationConfig::GetDefaultFromModelConfig(model_config);
-    return TResult::Ok({std::move(n), std::move(engine_config), std::move(default_generation_cfg)});
+    Tokenizer tokenizer = n->tokenizer_;
+    return TResult::Ok({std::move(n), std::move(engine_config), std::move(default_generation_cfg),
+                        std::move(tokenizer)});
   }
 
   void Reset() final {}
 
+  void TrimMemory(bool critical) final {}
+
+  bool StartHotSwap(const std::string& engine_config_json_str) final { return false; }
+
+  bool FinishHotSwap(bool wait, EngineCreationOutput* output) final { return false; }
+
   bool Empty() final { return request_map_.empty(); }
 
   void SetRequestStreamCallback(FRequestStreamCallback request_stream_callback) final {
@@ -190,6 +229,12 @@ class MockEchoEngineImpl : public Engine {
     request_map_[request->id] = MockRequestState{request, std::move(outputs)};
   }
 
+  void PreloadPrefix(IntTuple token_ids) final {}
+
+  void SaveSession(String session_id, IntTuple token_ids) final {}
+
+  void RestoreSession(String session_id) final {}
+
   void AbortRequest(const String& request_id) {
     auto it = request_map_.find(request_id);
     if (it == request_map_.end()) return;
@@ -213,6 +258,12 @@ class MockEchoEngineImpl : public Engine {
     }
   }
 
+  void SetPrefillHandoffCallback(FPrefillHandoffCallback callback) final {}
+
+  void AdoptRequest(RequestState rstate) final {
+    LOG(FATAL) << "The mock echo engine does not support disaggregated serving.";
+  }
+
   void AbortAllRequests() final {
     // avoid deletion during iteraton
     std::vector<String> request_ids;
@@ -300,7 +351,7 @@ class EngineImpl : public Engine {
     ICHECK_GE(num_model, 1);
     // - Initialize singleton states inside the engine.
     n->estate_->Reset();
-    n->request_stream_callback_ = std::move(request_stream_callback);
+    n->SetRequestStreamCallbackImpl(std::move(request_stream_callback));
     n->trace_recorder_ = trace_recorder;
     n->device_ = device;
     // - Load model config, create a shared disco session when tensor
@@ -337,6 +388,9 @@ class EngineImpl : public Engine {
                                   /*trace_enabled=*/trace_recorder.defined());
       n->models_.push_back(model);
     }
+    n->models_and_model_libs_ = models_and_model_libs;
+    n->model_configs_ = model_configs;
+    n->use_disco_ = session.defined();
     // - Automatically infer the missing fields in EngineConfig JSON strings
     // and get the final EngineConfig.
     Result<EngineConfig> engine_config_res =
@@ -346,19 +400,7 @@ class EngineImpl : public Engine {
     }
     EngineConfig engine_config = engine_config_res.Unwrap();
     {
-      if (engine_config->prefix_cache_mode == PrefixCacheMode::kRadix) {
-        n->estate_->prefix_cache = PrefixCache::CreateRadixPrefixCache(
-            static_cast<size_t>(engine_config->prefix_cache_max_num_recycling_seqs),
-            [engine_ptr = n.get()](int64_t seq_id) {
-              RemoveRequestFromModel(engine_ptr->estate_, seq_id, engine_ptr->models_);
-              engine_ptr->estate_->id_manager.RecycleId(seq_id);
-            });
-      } else if (engine_config->prefix_cache_mode == PrefixCacheMode::kDisable) {
-        n->estate_->prefix_cache = PrefixCache::CreateNoPrefixCache();
-      } else {
-        LOG(FATAL) << "Unsupported prefix cache mode: "
-                   << static_cast<int>(engine_config->prefix_cache_mode);
-      }
+      n->estate_->scheduling_policy = SchedulingPolicy::Create(engine_config);
       if (engine_config->speculative_mode != SpeculativeMode::kDisable &&
           engine_config->prefill_mode == PrefillMode::kHybrid) {
         engine_config->prefill_mode = PrefillMode::kChunked;
@@ -367,27 +409,239 @@ class EngineImpl : public Engine {
                "enabled and not implemented with hybrid prefill yet.";
       }
     }
+    // - Decode batch padding only applies to the batch decode action of the
+    // single model without speculative decoding.
+    std::vector<int> decode_batch_size_buckets;
+    if (!engine_config->decode_batch_size_buckets.empty()) {
+      if (n->models_.size() == 1 &&
+          engine_config->speculative_mode == SpeculativeMode::kDisable &&
+          n->models_[0]->GetMetadata().kv_state_kind == KVStateKind::kKVCache) {
+        // A bucket cannot exceed the number of sequences or tokens a decode can run.
+        int64_t max_bucket = std::min(static_cast<int64_t>(engine_config->max_num_sequence),
+                                      engine_config->prefill_chunk_size);
+        for (int bucket : engine_config->decode_batch_size_buckets) {
+          if (bucket <= max_bucket) {
+            decode_batch_size_buckets.push_back(bucket);
+          }
+        }
+      } else {
+        LOG(WARNING) << "Decode batch size buckets are only supported by a single KV cache "
+                        "model without speculative decoding. The buckets are ignored.";
+      }
+    }
+    // - The KV storage dtype is compiled into the model libs.
+    if (engine_config->kv_cache_dtype != "auto") {
+      for (int i = 0; i < num_model; ++i) {
+        const ModelMetadata& metadata = n->models_[i]->GetMetadata();
+        if (metadata.kv_state_kind != KVStateKind::kKVCache) {
+          continue;
+        }
+        std::string kv_dtype = DLDataType2String(metadata.kv_cache_metadata.dtype);
+        if (kv_dtype != engine_config->kv_cache_dtype) {
+          return TResult::Error("Model " + std::to_string(i) + " stores the KV data in " +
+                                kv_dtype + ", while the KV cache dtype \"" +
+                                engine_config->kv_cache_dtype +
+                                "\" is specified. Please compile the model with the KV "
+                                "cache dtype, or set the KV cache dtype to \"auto\".");
+        }
+      }
+    }
+    // - Disaggregated serving transfers the KV data through the KV swap of a single model.
+    if (engine_config->disaggregation_role != DisaggregationRole::kNone &&
+        (n->models_.size() != 1 || !n->models_[0]->SupportKVSwap())) {
+      return TResult::Error(
+          "Disaggregated prefill and decode serving requires a single model which supports KV "
+          "swap, i.e., a KV cache model without tensor parallelism or sliding window.");
+    }
+    // - LoRA adapters are served by the main model without speculative decoding.
+    // The prefix cache is disabled, since the KV data of a prefix differ across adapters.
+    if (!engine_config->lora_adapters.empty()) {
+      if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
+        return TResult::Error("LoRA adapters are not supported with speculative decoding yet.");
+      }
+      if (engine_config->prefix_cache_mode != PrefixCacheMode::kDisable) {
+        engine_config->prefix_cache_mode = PrefixCacheMode::kDisable;
+        LOG(WARNING) << "Prefix cache is disabled, due to LoRA adapters are enabled and the "
+                        "prefixes cannot be shared across adapters.";
+      }
+    }
+    // - The prompt lookup drafts are verified by the main model, without a draft model.
+    if (engine_config->speculative_mode == SpeculativeMode::kPromptLookup) {
+      if (n->models_.size() != 1) {
+        return TResult::Error(
+            "The prompt lookup speculative mode proposes draft tokens without a draft model. "
+            "Please do not specify additional models.");
+      }
+      if (engine_config->spec_tree_width != 1) {
+        return TResult::Error(
+            "The prompt lookup speculative mode only supports chain-style draft tokens. "
+            "Please set \"spec_tree_width\" to 1.");
+      }
+      // The adaptive draft length is not supported by prompt lookup, and the default draft
+      // length 0 resolves to a fixed draft length.
+      if (engine_config->spec_draft_length < 0) {
+        return TResult::Error("The prompt lookup speculative mode requires a positive "
+                              "\"spec_draft_length\", while " +
+                              std::to_string(engine_config->spec_draft_length) + " is given.");
+      }
+      if (engine_config->spec_draft_length == 0) {
+        engine_config->spec_draft_length = kDefaultPromptLookupDraftLength;
+        LOG(INFO) << "The prompt lookup speculative mode uses the draft length "
+                  << kDefaultPromptLookupDraftLength
+                  << ", since the adaptive draft length is not supported.";
+      }
+    }
+    // - Load the tokenizer and create the grammar init context cache on a worker thread, in
+    // parallel with the weight loading and the KV cache creation. The cache preprocesses the
+    // JSON grammar on the token table, which takes a while for large vocabularies.
+    std::future<std::tuple<Tokenizer, std::vector<std::string>, GrammarInitContextCache>>
+        tokenizer_future = std::async(
+            std::launch::async,
+            [model = std::string(engine_config->model),
+             tokenizer_info = GetTokenizerInfo(model_configs[0]),
+             grammar_cache_dir = std::string(engine_config->grammar_cache_dir)]() {
+              Tokenizer tokenizer = Tokenizer::FromPath(model, tokenizer_info);
+              std::vector<std::string> token_table = tokenizer->PostProcessedTokenTable();
+              GrammarInitContextCache grammar_init_context_cache(token_table, grammar_cache_dir);
+              return std::make_tuple(std::move(tokenizer), std::move(token_table),
+                                     std::move(grammar_init_context_cache));
+            });
     // - Load model weights, create KV cache and workspace.
     n->model_workspaces_.clear();
     for (const Model& model : n->models_) {
       model->LoadParams();
       model->SetMaxNumSequence(engine_config->max_num_sequence);
       model->SetPrefillChunkSize(engine_config->prefill_chunk_size);
+      model->SetImageEmbeddingCacheCapacity(engine_config->image_embedding_cache_bytes);
+      model->SetDecodeBatchSizeBuckets(decode_batch_size_buckets);
       model->CreateKVCache(engine_config->kv_cache_page_size, engine_config->max_num_sequence,
                            engine_config->max_total_sequence_length,
                            engine_config->prefill_chunk_size, engine_config->max_history_size);
-      n->model_workspaces_.push_back(
-          ModelWorkspace{model->AllocEmbeddingTensor(), model->AllocHiddenStatesTensor()});
+      // The hidden states workspace is not allocated when it is never used, so that the memory
+      // goes to KV cache.
+      n->model_workspaces_.push_back(ModelWorkspace{
+          model->AllocEmbeddingTensor(),
+          n->RequireHiddenStatesWorkspace(engine_config->speculative_mode)
+              ? model->AllocHiddenStatesTensor()
+              : ObjectRef{nullptr}});
     }
-    // - Initialize tokenizer and grammar
-    n->tokenizer_ = Tokenizer::FromPath(engine_config->model, GetTokenizerInfo(model_configs[0]));
-    n->token_table_ = n->tokenizer_->PostProcessedTokenTable();
-    n->grammar_init_context_cache_ = GrammarInitContextCache(n->token_table_);
+    // - Record the number of KV cache pages, which are all available now.
+    int num_available_pages = n->models_[0]->GetNumAvailablePages();
+    n->num_total_kv_cache_pages_ =
+        num_available_pages == std::numeric_limits<int>::max() ? 0 : num_available_pages;
+    if (!engine_config->lora_adapters.empty()) {
+      n->models_[0]->RegisterLoRAAdapters(engine_config->lora_adapters,
+                                          engine_config->max_num_resident_lora_adapters);
+    }
+    // - Create the prefix cache. The host memory and disk tiers of prefix cache
+    // require the KV swap support of the model.
+    if (engine_config->prefix_cache_mode == PrefixCacheMode::kRadix ||
+        engine_config->prefix_cache_mode == PrefixCacheMode::kShared) {
+      PrefixCacheTierConfig tier_config{engine_config->prefix_cache_max_num_host_tokens,
+                                        engine_config->prefix_cache_max_num_disk_tokens,
+                                        engine_config->prefix_cache_disk_path};
+      if (engine_config->prefix_cache_mode == PrefixCacheMode::kShared) {
+        tier_config.shared_memory_name = engine_config->prefix_cache_shared_memory_name;
+        tier_config.shared_memory_bytes = engine_config->prefix_cache_shared_memory_bytes;
+      }
+      // The KV swap callbacks also serve the session snapshots when the tiers are disabled.
+      PrefixCacheOffloadCallbacks offload_callbacks;
+      bool use_tiers =
+          tier_config.max_num_host_tokens > 0 || !tier_config.shared_memory_name.empty();
+      if (use_tiers || !engine_config->kv_session_dir.empty()) {
+        if (n->models_.size() == 1 && n->models_[0]->SupportKVSwap()) {
+          tier_config.kv_swap_layout = n->models_[0]->GetKVSwapLayout();
+          tier_config.kv_swap_layout.model_hash = GetModelIdentityHash(engine_config);
+          offload_callbacks.swap_out = [engine_ptr = n.get()](int64_t seq_id, int64_t num_tokens) {
+            return engine_ptr->models_[0]->SwapOutSequence(seq_id, num_tokens);
+          };
+          offload_callbacks.swap_in = [engine_ptr = n.get()](ObjectRef kv_data,
+                                                             int64_t num_pop_tokens) {
+            int64_t seq_id = engine_ptr->estate_->id_manager.GetNewId();
+            engine_ptr->models_[0]->SwapInSequence(seq_id, kv_data);
+            if (num_pop_tokens > 0) {
+              engine_ptr->models_[0]->PopNFromKVCache(seq_id, num_pop_tokens);
+            }
+            return seq_id;
+          };
+          offload_callbacks.synchronize = [engine_ptr = n.get()]() {
+            engine_ptr->models_[0]->SynchronizeKVSwap();
+          };
+          offload_callbacks.has_capacity = [engine_ptr = n.get()](int64_t num_tokens) {
+            int64_t page_size = engine_ptr->engine_config_->kv_cache_page_size;
+            int64_t num_require_pages = (num_tokens + page_size - 1) / page_size;
+            // Leave one page for the next decode of each running request.
+            int64_t num_running_rsentries =
+                engine_ptr->estate_->GetRunningRequestStateEntries().size();
+            return num_require_pages + num_running_rsentries + 1 <=
+                   engine_ptr->models_[0]->GetNumAvailablePages();
+          };
+        } else if (use_tiers) {
+          tier_config.max_num_host_tokens = 0;
+          tier_config.max_num_disk_tokens = 0;
+          tier_config.shared_memory_name.clear();
+          engine_config->prefix_cache_mode = PrefixCacheMode::kRadix;
+          LOG(WARNING) << "The host memory and disk tiers and the shared mode of prefix cache are "
+                          "disabled, due to the KV swap is not supported by the model or "
+                          "speculative decoding is enabled.";
+        }
+      }
+      if (engine_config->prefix_cache_compaction_max_num_tokens > 0) {
+        if (n->models_.size() == 1 && n->models_[0]->SupportKVSwap()) {
+          offload_callbacks.compact = [engine_ptr = n.get()](int64_t seq_id, int64_t num_tokens) {
+            // Round trip the KV data through host memory, which re-allocates the sequence in
+            // contiguous fresh pages.
+            const Model& model = engine_ptr->models_[0];
+            ObjectRef kv_data = model->SwapOutSequence(seq_id, num_tokens);
+            model->RemoveSequence(seq_id);
+            model->SwapInSequence(seq_id, kv_data);
+          };
+        } else {
+          engine_config->prefix_cache_compaction_max_num_tokens = 0;
+          LOG(WARNING) << "The prefix cache compaction is disabled, due to the KV swap is not "
+                          "supported by the model or speculative decoding is enabled.";
+        }
+      }
+      n->estate_->prefix_cache = PrefixCache::CreateRadixPrefixCache(
+          static_cast<size_t>(engine_config->prefix_cache_max_num_recycling_seqs),
+          [engine_ptr = n.get()](int64_t seq_id) {
+            RemoveRequestFromModel(engine_ptr->estate_, seq_id, engine_ptr->models_);
+            engine_ptr->estate_->id_manager.RecycleId(seq_id);
+          },
+          std::move(tier_config), std::move(offload_callbacks),
+          engine_config->prefix_cache_eviction_policy, &n->estate_->metrics.prefix_cache);
+    } else if (engine_config->prefix_cache_mode == PrefixCacheMode::kDisable) {
+      n->estate_->prefix_cache = PrefixCache::CreateNoPrefixCache();
+    } else {
+      LOG(FATAL) << "Unsupported prefix cache mode: "
+                 << static_cast<int>(engine_config->prefix_cache_mode);
+    }
+    // - Enable the KV swap on preemption when supported by the model.
+    if (engine_config->preemption_mode == PreemptionMode::kSwap) {
+      if (n->models_.size() == 1 && n->models_[0]->SupportKVSwap()) {
+        n->estate_->max_num_swapped_kv_tokens = engine_config->kv_swap_max_num_tokens;
+      } else {
+        engine_config->preemption_mode = PreemptionMode::kRecompute;
+        if (n->models_.size() != 1) {
+          LOG(WARNING) << "Swap preemption mode fallbacks to recompute, since the KV swap only "
+                          "supports engines with a single model, while the engine has "
+                       << n->models_.size() << " models.";
+        } else {
+          LOG(WARNING) << "Swap preemption mode fallbacks to recompute, since the model does not "
+                          "support the KV swap, which requires a paged KV cache with the debug "
+                          "get/set builtins, without disco or sliding window.";
+        }
+      }
+    }
+    // - Wait for the tokenizer and grammar initialization.
+    std::tie(n->tokenizer_, n->token_table_, n->grammar_init_context_cache_) =
+        tokenizer_future.get();
     // - Create the logit processor and sampler, and
     // the DraftTokenWorkspaceManager for speculative decoding.
     int max_num_tokens = engine_config->max_num_sequence;
     DraftTokenWorkspaceManager draft_token_workspace_manager{nullptr};
-    if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
+    if (engine_config->speculative_mode != SpeculativeMode::kDisable &&
+        engine_config->speculative_mode != SpeculativeMode::kPromptLookup) {
       // multiply max num_tokens by two so we can do ping-pong swaping during draft/verify process
       draft_token_workspace_manager =
           n->models_[0]->CreateDraftTokenWorkspaceManager(max_num_tokens * 2);
@@ -397,8 +651,9 @@ class EngineImpl : public Engine {
     }
     LogitProcessor logit_processor =
         n->models_[0]->CreateLogitProcessor(max_num_tokens, trace_recorder);
-    Sampler sampler = n->models_[0]->CreateSampler(
-        max_num_tokens, static_cast<int>(n->models_.size()), trace_recorder);
+    Sampler sampler =
+        n->models_[0]->CreateSampler(max_num_tokens, static_cast<int>(n->models_.size()),
+                                     trace_recorder, engine_config->batch_invariant_sampling);
     // - Initialize engine actions that represent state transitions.
     if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
       n->estate_->spec_draft_length = engine_config->spec_draft_length;
@@ -410,28 +665,316 @@ class EngineImpl : public Engine {
     // - Automatically set the threading backend max concurrency.
     n->engine_config_ = engine_config;
     n->SetThreadMaxConcurrency();
+    if (engine_config->enable_device_timing) {
+      n->device_timer_recorder_ = std::make_unique<DeviceTimerRecorder>();
+      for (const Model& model : n->models_) {
+        model->EnableAllReduceTiming();
+      }
+    }
     // - Get the default generation config from the first model.
     GenerationConfig default_generation_cfg =
         GenerationConfig::GetDefaultFromModelConfig(model_configs[0]);
-    return TResult::Ok({std::move(n), std::move(engine_config), std::move(default_generation_cfg)});
+    Tokenizer tokenizer = n->tokenizer_;
+    return TResult::Ok({std::move(n), std::move(engine_config), std::move(default_generation_cfg),
+                        std::move(tokenizer)});
   }
 
   void Reset() final {
+    estate_->InvokeDeferredStreamCallback();
     AbortAllRequests();
     estate_->Reset();
     for (Model model : models_) {
       model->Reset();
     }
+    // The pinned prefixes are cleared from prefix cache, and are preloaded again.
+    num_issued_prefix_preloads_ = 0;
+  }
+
+  void TrimMemory(bool critical) final {
+    estate_->prefix_cache->ReleaseRecyclingSequences();
+    for (const Model& model : models_) {
+      model->ReleaseCachedMemory();
+    }
+    if (critical) {
+      pending_kv_cache_shrink_ = true;
+      if (estate_->request_states.empty() && compiling_requests_.empty()) {
+        ShrinkKVCache();
+      }
+    }
   }
 
-  bool Empty() final { return estate_->request_states.empty(); }
+  bool StartHotSwap(const std::string& engine_config_json_str) final {
+    Result<std::vector<std::pair<std::string, std::string>>> models_and_model_libs_res =
+        EngineConfig::GetModelsAndModelLibsFromJSONString(engine_config_json_str);
+    if (models_and_model_libs_res.IsErr() || pending_hot_swap_.has_value()) {
+      return false;
+    }
+    std::vector<std::pair<std::string, std::string>> models_and_model_libs =
+        models_and_model_libs_res.Unwrap();
+    if (models_and_model_libs.size() != models_and_model_libs_.size()) {
+      return false;
+    }
+    PendingHotSwap hot_swap;
+    for (int i = 0; i < static_cast<int>(models_and_model_libs.size()); ++i) {
+      const auto& [model_str, model_lib] = models_and_model_libs[i];
+      if (model_lib != models_and_model_libs_[i].second) {
+        return false;
+      }
+      Result<picojson::object> model_config_res = Model::LoadModelConfig(model_str);
+      if (model_config_res.IsErr() ||
+          !IsHotSwapCompatible(model_configs_[i], model_config_res.Unwrap())) {
+        return false;
+      }
+      hot_swap.model_paths.push_back(model_str);
+      hot_swap.model_configs.push_back(model_config_res.Unwrap());
+    }
+    // The new weights are loaded while the current weights are in use, so the second copy of
+    // the weights must fit in the GPU memory left out of the memory budget of the engine.
+    int64_t params_bytes = 0;
+    for (const Model& model : models_) {
+      params_bytes += GetParamsBytes(model->GetMetadata());
+    }
+    int64_t unbudgeted_bytes = static_cast<int64_t>(TotalDetectGlobalMemory(device_) *
+                                                    (1 - engine_config_->gpu_memory_utilization));
+    if (params_bytes > unbudgeted_bytes) {
+      LOG(WARNING) << "The hot swap needs " << params_bytes / 1024 / 1024
+                   << " MB for the new weights, more than the " << unbudgeted_bytes / 1024 / 1024
+                   << " MB of GPU memory out of the engine memory budget. Please lower "
+                      "gpu_memory_utilization to hot swap the weights.";
+      return false;
+    }
+    auto fload_params = [models = models_, model_paths = hot_swap.model_paths]() {
+      std::vector<ObjectRef> params;
+      params.reserve(models.size());
+      for (int i = 0; i < static_cast<int>(models.size()); ++i) {
+        params.push_back(models[i]->LoadParamsFromPath(model_paths[i]));
+      }
+      return params;
+    };
+    // The disco session is driven by the engine thread only, so the weights are loaded here.
+    hot_swap.params = std::async(use_disco_ ? std::launch::deferred : std::launch::async,
+                                 std::move(fload_params));
+    pending_hot_swap_ = std::move(hot_swap);
+    return true;
+  }
+
+  bool FinishHotSwap(bool wait, EngineCreationOutput* output) final {
+    ICHECK(pending_hot_swap_.has_value()) << "There is no started hot swap.";
+    if (!wait && !use_disco_ &&
+        pending_hot_swap_->params.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      return false;
+    }
+    PendingHotSwap hot_swap = std::move(pending_hot_swap_.value());
+    pending_hot_swap_ = std::nullopt;
+    std::vector<ObjectRef> params;
+    bool params_loaded = true;
+    try {
+      params = hot_swap.params.get();
+    } catch (const std::exception& e) {
+      // The running requests are not affected, and the engine keeps the current weights.
+      LOG(ERROR) << "Failed to load the weights of the hot swap to " << hot_swap.model_paths[0]
+                 << ", keeping the current weights: " << e.what();
+      params_loaded = false;
+    }
+    if (params_loaded) {
+      // The KV data of the running requests and the prefix cache are computed with the
+      // previous weights, so the requests are aborted and the engine state is reset.
+      Reset();
+      for (int i = 0; i < static_cast<int>(models_.size()); ++i) {
+        models_[i]->SwapParams(hot_swap.model_paths[i], std::move(params[i]));
+        models_and_model_libs_[i].first = hot_swap.model_paths[i];
+        model_configs_[i] = std::move(hot_swap.model_configs[i]);
+      }
+      engine_config_->model = hot_swap.model_paths[0];
+      Array<String> additional_models;
+      for (int i = 1; i < static_cast<int>(hot_swap.model_paths.size()); ++i) {
+        additional_models.push_back(hot_swap.model_paths[i]);
+      }
+      engine_config_->additional_models = std::move(additional_models);
+    }
+    output->completed_engine_config = engine_config_;
+    output->default_generation_cfg = GenerationConfig::GetDefaultFromModelConfig(model_configs_[0]);
+    output->tokenizer = tokenizer_;
+    return true;
+  }
+
+  bool Empty() final {
+    return estate_->request_states.empty() && compiling_requests_.empty() &&
+           num_issued_prefix_preloads_ == preloaded_prefixes_.size() && !HasPendingCompaction() &&
+           !pending_kv_cache_shrink_;
+  }
 
   String JSONMetrics() final { return picojson::value(estate_->metrics.AsJSON()).serialize(true); }
 
-  FRequestStreamCallback GetRequestStreamCallback() final { return request_stream_callback_; }
+  FRequestStreamCallback GetRequestStreamCallback() final { return user_request_stream_callback_; }
 
   void SetRequestStreamCallback(FRequestStreamCallback request_stream_callback) final {
-    request_stream_callback_ = std::move(request_stream_callback);
+    estate_->InvokeDeferredStreamCallback();
+    SetRequestStreamCallbackImpl(std::move(request_stream_callback));
+  }
+
+  /*!
+   * \brief Set the request stream callback, wrapped to drop the outputs of the internal prefix
+   * preload requests, which have no receiver.
+   */
+  void SetRequestStreamCallbackImpl(FRequestStreamCallback request_stream_callback) {
+    user_request_stream_callback_ = request_stream_callback;
+    if (request_stream_callback == nullptr) {
+      request_stream_callback_ = nullptr;
+      return;
+    }
+    request_stream_callback_ = FRequestStreamCallback(
+        [callback = std::move(request_stream_callback)](Array<RequestStreamOutput> outputs) {
+          Array<RequestStreamOutput> user_outputs;
+          for (const RequestStreamOutput& output : outputs) {
+            if (!IsPrefixPreloadRequest(output->request_id)) {
+              user_outputs.push_back(output);
+            }
+          }
+          if (!user_outputs.empty() || outputs.empty()) {
+            callback(user_outputs);
+          }
+        });
+  }
+
+  void PreloadPrefix(IntTuple token_ids) final {
+    if (estate_->prefix_cache->Mode() == PrefixCacheMode::kDisable) {
+      LOG(WARNING) << "The prefix is not preloaded since the prefix cache is disabled.";
+      return;
+    }
+    if (token_ids.size() == 0) {
+      return;
+    }
+    // The pinned prefixes are never evicted, so they are capped to half of the sequence slots
+    // and the KV cache capacity, leaving the rest to the requests.
+    if (static_cast<int64_t>(preloaded_prefixes_.size()) + 1 >
+            engine_config_->max_num_sequence / 2 ||
+        num_preloaded_prefix_tokens_ + token_ids.size() >
+            engine_config_->max_total_sequence_length / 2) {
+      LOG(WARNING) << "The prefix of " << token_ids.size()
+                   << " tokens is not preloaded since the pinned prefixes would take more than "
+                      "half of max_num_sequence or max_total_sequence_length.";
+      return;
+    }
+    num_preloaded_prefix_tokens_ += token_ids.size();
+    preloaded_prefixes_.push_back(std::move(token_ids));
+  }
+
+  void SaveSession(String session_id, IntTuple token_ids) final {
+    std::string file = GetSessionSnapshotFile(session_id);
+    if (file.empty()) {
+      return;
+    }
+    std::vector<int32_t> tokens(token_ids.begin(), token_ids.end());
+    if (estate_->prefix_cache->SaveSnapshot(tokens, file) == 0) {
+      LOG(WARNING) << "The session \"" << session_id
+                   << "\" is not saved, since its tokens are not in prefix cache or the KV swap "
+                      "is not supported by the model.";
+    }
+  }
+
+  void RestoreSession(String session_id) final {
+    std::string file = GetSessionSnapshotFile(session_id);
+    if (file.empty()) {
+      return;
+    }
+    // The restored KV data only take the free KV cache pages.
+    int64_t max_num_tokens = std::numeric_limits<int64_t>::max();
+    if (num_total_kv_cache_pages_ > 0) {
+      max_num_tokens = static_cast<int64_t>(models_[0]->GetNumAvailablePages()) *
+                       engine_config_->kv_cache_page_size;
+    }
+    estate_->prefix_cache->RestoreSnapshot(file, max_num_tokens);
+  }
+
+  /*!
+   * \brief Return the snapshot file of the given session under `kv_session_dir`, or an empty
+   * string when the session snapshots are disabled or the session id is invalid.
+   */
+  std::string GetSessionSnapshotFile(const String& session_id) {
+    if (engine_config_->kv_session_dir.empty()) {
+      LOG(WARNING) << "The session snapshots are disabled since kv_session_dir is not set.";
+      return "";
+    }
+    // The session id is used as the file name, so it must not contain path separators.
+    if (session_id.empty() || !std::all_of(session_id.begin(), session_id.end(), [](char c) {
+          return std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+        })) {
+      LOG(WARNING) << "Invalid session id \"" << session_id
+                   << "\", which may only consist of letters, digits, '-' and '_'.";
+      return "";
+    }
+    std::string dir = engine_config_->kv_session_dir;
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error) {
+      LOG(WARNING) << "The session snapshot is skipped since the session directory \"" << dir
+                   << "\" cannot be created: " << error.message();
+      return "";
+    }
+    return dir + "/session_" + std::string(session_id) + ".kv";
+  }
+
+  /*!
+   * \brief Recreate the KV cache of the models with half of the current capacity, which drops all
+   * the sequences in KV cache. It requires the engine to have no request.
+   */
+  void ShrinkKVCache() {
+    pending_kv_cache_shrink_ = false;
+    if (models_[0]->GetMetadata().kv_state_kind != KVStateKind::kKVCache) {
+      return;
+    }
+    int64_t max_total_sequence_length = std::max(engine_config_->max_total_sequence_length / 2,
+                                                 engine_config_->prefill_chunk_size);
+    if (max_total_sequence_length >= engine_config_->max_total_sequence_length) {
+      return;
+    }
+    LOG(INFO) << "Shrinking the KV cache under memory pressure: max_total_sequence_length "
+              << engine_config_->max_total_sequence_length << " -> "
+              << max_total_sequence_length;
+    engine_config_->max_total_sequence_length = max_total_sequence_length;
+    engine_config_->max_single_sequence_length =
+        std::min(engine_config_->max_single_sequence_length, max_total_sequence_length);
+    estate_->InvokeDeferredStreamCallback();
+    estate_->prefix_cache->Reset();
+    estate_->id_manager.Reset();
+    for (const Model& model : models_) {
+      model->CreateKVCache(engine_config_->kv_cache_page_size, engine_config_->max_num_sequence,
+                           engine_config_->max_total_sequence_length,
+                           engine_config_->prefill_chunk_size, engine_config_->max_history_size);
+      model->Reset();
+    }
+    int num_available_pages = models_[0]->GetNumAvailablePages();
+    num_total_kv_cache_pages_ =
+        num_available_pages == std::numeric_limits<int>::max() ? 0 : num_available_pages;
+    // The pinned prefixes are dropped with the KV cache, and are preloaded again.
+    num_issued_prefix_preloads_ = 0;
+  }
+
+  /*! \brief Return whether prefix cache has fragmented KV data to compact in idle steps. */
+  bool HasPendingCompaction() {
+    return engine_config_->prefix_cache_compaction_max_num_tokens > 0 &&
+           estate_->prefix_cache->HasFragmentedRecyclingSequence();
+  }
+
+  /*!
+   * \brief Add the internal request prefilling the next preloaded prefix, which is pinned in
+   * prefix cache after the request finishes.
+   */
+  void AddPrefixPreloadRequest() {
+    picojson::object generation_cfg_json;
+    generation_cfg_json["max_tokens"] = picojson::value(static_cast<int64_t>(1));
+    generation_cfg_json["temperature"] = picojson::value(0.0);
+    picojson::object debug_config_json;
+    debug_config_json["pinned_system_prompt"] = picojson::value(true);
+    generation_cfg_json["debug_config"] = picojson::value(debug_config_json);
+    Result<GenerationConfig> generation_cfg = GenerationConfig::FromJSON(
+        generation_cfg_json, GenerationConfig::GetDefaultFromModelConfig(model_configs_[0]));
+    ICHECK(generation_cfg.IsOk()) << generation_cfg.UnwrapErr();
+    String request_id =
+        kPrefixPreloadRequestIdPrefix + std::to_string(num_issued_prefix_preloads_);
+    IntTuple token_ids = preloaded_prefixes_[num_issued_prefix_preloads_++];
+    AddRequest(Request(request_id, {TokenData(token_ids)}, generation_cfg.Unwrap()));
   }
 
   // string back error node
@@ -489,19 +1032,109 @@ class EngineImpl : public Engine {
       this->StreamBackError(request, "length");
       return;
     }
+    if (request->generation_cfg->use_beam_search &&
+        engine_config_->speculative_mode != SpeculativeMode::kDisable) {
+      LOG(WARNING) << "Request " << request->id
+                   << " uses beam search, which is not supported in speculative mode";
+      this->StreamBackError(request, "error");
+      return;
+    }
+    if ((request->generation_cfg->embedding_pooling != EmbeddingPooling::kNone ||
+         request->generation_cfg->prompt_logprobs) &&
+        (models_.size() != 1 || !models_[0]->CanPoolHiddenStates())) {
+      LOG(WARNING) << "Request " << request->id
+                   << " is an embedding request or requests prompt logprobs, which requires a "
+                      "single model that can keep the prefilled hidden states";
+      this->StreamBackError(request, "error");
+      return;
+    }
+    int lora_adapter_index = -1;
+    if (!request->generation_cfg->lora_adapter.empty()) {
+      lora_adapter_index = models_[0]->GetLoRAAdapterIndex(request->generation_cfg->lora_adapter);
+      if (lora_adapter_index == -1) {
+        LOG(WARNING) << "Request " << request->id << " uses unknown LoRA adapter \""
+                     << request->generation_cfg->lora_adapter << "\"";
+        this->StreamBackError(request, "error");
+        return;
+      }
+    }
+
+    // A request whose JSON schema or regex is not preprocessed yet waits in the compiling state,
+    // so that the preprocessing runs off the engine thread and does not stall the running
+    // requests.
+    const ResponseFormat& response_format = request->generation_cfg->response_format;
+    std::optional<std::shared_future<std::shared_ptr<GrammarStateInitContext>>> init_ctx;
+    std::optional<std::shared_ptr<GrammarStateInitContext>> grammar_state_init_ctx;
+    try {
+      if (response_format.type == "json_object" && response_format.schema) {
+        init_ctx = grammar_init_context_cache_->GetInitContextForJSONSchemaAsync(
+            response_format.schema.value());
+      } else if (response_format.type == "regex") {
+        init_ctx =
+            grammar_init_context_cache_->GetInitContextForRegexAsync(response_format.regex.value());
+      } else if (response_format.type == "json_object") {
+        grammar_state_init_ctx = grammar_init_context_cache_->GetInitContextForJSON();
+      }
+    } catch (const std::exception& e) {
+      LOG(WARNING) << "Request " << request->id
+                   << " fails to look up its grammar init context: " << e.what();
+      this->StreamBackError(request, "error");
+      return;
+    }
+    if (init_ctx.has_value()) {
+      if (init_ctx->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        RECORD_EVENT(trace_recorder_, request->id, "start grammar compiling");
+        compiling_requests_.push_back(
+            {request, std::move(init_ctx.value()), add_time_point, lora_adapter_index});
+        return;
+      }
+      grammar_state_init_ctx = GetCompiledGrammarInitCtx(request, init_ctx.value());
+      if (!grammar_state_init_ctx.has_value()) {
+        return;
+      }
+    }
+    AddRequestState(request, add_time_point, lora_adapter_index, grammar_state_init_ctx);
+  }
+
+  /*!
+   * \brief Get the init context of the request whose grammar preprocessing has finished. If the
+   * preprocessing failed, stream back the error to the request.
+   * \return The init context, or std::nullopt if the preprocessing failed.
+   */
+  std::optional<std::shared_ptr<GrammarStateInitContext>> GetCompiledGrammarInitCtx(
+      const Request& request,
+      const std::shared_future<std::shared_ptr<GrammarStateInitContext>>& init_ctx) {
+    try {
+      return init_ctx.get();
+    } catch (const std::exception& e) {
+      bool is_regex = request->generation_cfg->response_format.type == "regex";
+      LOG(WARNING) << "Request " << request->id << " fails to compile its "
+                   << (is_regex ? "regex" : "JSON schema") << ": " << e.what();
+      this->StreamBackError(request, "error");
+      return std::nullopt;
+    }
+  }
 
+  /*!
+   * \brief Append the tokenized request to the waiting queue and create its request state.
+   * \param grammar_state_init_ctx The grammar init context of the request, or std::nullopt if
+   * the request has no grammar.
+   */
+  void AddRequestState(
+      Request request, std::chrono::high_resolution_clock::time_point add_time_point,
+      int lora_adapter_index,
+      const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx) {
     // Append to the waiting queue and create the request state.
     estate_->waiting_queue.push_back(request);
 
     int n = request->generation_cfg->n;
     int rng_seed = request->generation_cfg->seed;
-    auto grammar_state_init_ctx =
-        GetGrammarInitCtxFromResponseFormat(request->generation_cfg->response_format);
 
     std::vector<RequestStateEntry> rsentries;
-    // Create the request state entry for the input.
-    rsentries.emplace_back(request, models_.size(), estate_->id_manager.GetNewId(), rng_seed,
-                           token_table_, grammar_state_init_ctx);
+    // Create the request state entry for the input, reusing the entries of finished requests.
+    rsentries.push_back(estate_->rsentry_pool.Get(request, models_.size(),
+                                                  estate_->id_manager.GetNewId(), rng_seed,
+                                                  token_table_, grammar_state_init_ctx));
     if (n > 1) {
       // Then create a request state entry for each parallel generation branch.
       // We add a offset to the rng seed so that to make generations different.
@@ -509,9 +1142,9 @@ class EngineImpl : public Engine {
       rsentries[0]->child_indices.reserve(n);
       for (int i = 0; i < n; ++i) {
         rsentries[0]->child_indices.push_back(rsentries.size());
-        rsentries.emplace_back(request, models_.size(), estate_->id_manager.GetNewId(),
-                               rng_seed + i + 1, token_table_, grammar_state_init_ctx,
-                               /*parent_idx=*/0);
+        rsentries.push_back(estate_->rsentry_pool.Get(
+            request, models_.size(), estate_->id_manager.GetNewId(), rng_seed + i + 1,
+            token_table_, grammar_state_init_ctx, /*parent_idx=*/0));
       }
     }
     RequestState rstate = RequestState(std::move(rsentries), n, add_time_point);
@@ -519,12 +1152,50 @@ class EngineImpl : public Engine {
       // Set the back reference.
       // note, we avoid cyclic reference and use raw ptr.
       rsentry->rstate = rstate.operator->();
+      // LoRA adapters only apply to the main model.
+      rsentry->mstates[0]->lora_adapter_index = lora_adapter_index;
     }
     request->rstate = rstate.operator->();
     estate_->request_states.emplace(request->id, rstate);
   }
 
+  /*!
+   * \brief Move the compiling requests whose grammar preprocessing has finished to the
+   * waiting queue, keeping their arrival order.
+   */
+  void AddCompiledRequests() {
+    std::vector<CompilingRequest> compiling_requests;
+    for (CompilingRequest& compiling_request : compiling_requests_) {
+      if (compiling_request.init_ctx.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        compiling_requests.push_back(std::move(compiling_request));
+        continue;
+      }
+      Request request = compiling_request.request;
+      RECORD_EVENT(trace_recorder_, request->id, "finish grammar compiling");
+      std::optional<std::shared_ptr<GrammarStateInitContext>> grammar_state_init_ctx =
+          GetCompiledGrammarInitCtx(request, compiling_request.init_ctx);
+      if (!grammar_state_init_ctx.has_value()) {
+        continue;
+      }
+      AddRequestState(request, compiling_request.add_time_point,
+                      compiling_request.lora_adapter_index, grammar_state_init_ctx);
+    }
+    compiling_requests_ = std::move(compiling_requests);
+  }
+
   void AbortRequest(const String& request_id) final {
+    auto it_compiling =
+        std::find_if(compiling_requests_.begin(), compiling_requests_.end(),
+                     [&](const CompilingRequest& c) { return c.request->id == request_id; });
+    if (it_compiling != compiling_requests_.end()) {
+      // The request to abort is still waiting for its grammar.
+      Request request = it_compiling->request;
+      compiling_requests_.erase(it_compiling);
+      this->StreamBackError(request, "abort");
+      return;
+    }
+
     auto it_rstate = estate_->request_states.find(request_id);
     if (it_rstate == estate_->request_states.end()) {
       // The request to abort does not exist.
@@ -533,6 +1204,8 @@ class EngineImpl : public Engine {
 
     RequestState rstate = it_rstate->second;
     Request request = rstate->entries[0]->request;
+    // - Deliver the deferred stream outputs before the abortion notice.
+    estate_->InvokeDeferredStreamCallback();
 
     // - Check if the request is running or pending.
     auto it_running =
@@ -547,8 +1220,14 @@ class EngineImpl : public Engine {
 
       for (int i = static_cast<int>(rstate->entries.size()) - 1; i >= 0; --i) {
         if (estate_->prefix_cache->HasSequence(rstate->entries[i]->mstates[0]->internal_id)) {
+          // The prefix cache already holds exactly the prefilled chunks of a request aborted in
+          // the middle of its chunked prefill. Keep them only when they are long enough.
+          bool keep_prefix =
+              engine_config_->prefix_cache_keep_aborted_min_tokens > 0 &&
+              rstate->entries[i]->mstates[0]->num_prefilled_tokens >=
+                  engine_config_->prefix_cache_keep_aborted_min_tokens;
           estate_->prefix_cache->RecycleSequence(rstate->entries[i]->mstates[0]->internal_id,
-                                                 /*lazy=*/false);
+                                                 /*lazy=*/keep_prefix);
         } else {
           if (rstate->entries[i]->status != RequestStateStatus::kAlive) {
             estate_->id_manager.RecycleId(rstate->entries[i]->mstates[0]->internal_id);
@@ -562,6 +1241,12 @@ class EngineImpl : public Engine {
     if (it_waiting != estate_->waiting_queue.end()) {
       // The request to abort is in waiting queue
       estate_->waiting_queue.erase(it_waiting);
+      // Release the swap space of its KV data swapped out to host, if any.
+      for (const RequestStateEntry& rsentry : rstate->entries) {
+        estate_->num_swapped_kv_tokens -= rsentry->mstates[0]->num_swapped_kv_tokens;
+        rsentry->mstates[0]->swapped_kv_data = NullOpt;
+        rsentry->mstates[0]->num_swapped_kv_tokens = 0;
+      }
     }
 
     // Send a callback to notice the abortion.
@@ -572,40 +1257,311 @@ class EngineImpl : public Engine {
   void AbortAllRequests() final {
     // - Collect all the request ids.
     std::vector<String> request_ids;
-    request_ids.reserve(estate_->request_states.size());
+    request_ids.reserve(estate_->request_states.size() + compiling_requests_.size());
     for (const auto& kv : estate_->request_states) {
       request_ids.push_back(kv.first);
     }
+    for (const CompilingRequest& compiling_request : compiling_requests_) {
+      request_ids.push_back(compiling_request.request->id);
+    }
     // - Abort all the requests.
     for (const String& request_id : request_ids) {
       AbortRequest(request_id);
     }
   }
 
+  void SetPrefillHandoffCallback(FPrefillHandoffCallback callback) final {
+    prefill_handoff_callback_ = std::move(callback);
+  }
+
+  void AdoptRequest(RequestState rstate) final {
+    CHECK(engine_config_->disaggregation_role == DisaggregationRole::kDecode)
+        << "Only the engines of the \"decode\" disaggregation role can adopt requests.";
+    ICHECK_EQ(rstate->entries.size(), 1);
+    RequestStateEntry rsentry = rstate->entries[0];
+    RequestModelState mstate = rsentry->mstates[0];
+    Request request = rsentry->request;
+    ICHECK(mstate->swapped_kv_data.defined());
+    // The KV length is derived from the prompt length on the prefill engine, so a request with
+    // an unknown prompt length or an out-of-range KV length cannot be admitted.
+    if (request->prompt_tokens < 0 || mstate->num_swapped_kv_tokens <= 0 ||
+        mstate->num_swapped_kv_tokens > engine_config_->max_single_sequence_length) {
+      LOG(WARNING) << "Request " << request->id << " with " << request->prompt_tokens
+                   << " prompt tokens and " << mstate->num_swapped_kv_tokens
+                   << " KV tokens is rejected by the decode engine, whose "
+                      "max_single_sequence_length is "
+                   << engine_config_->max_single_sequence_length;
+      this->StreamBackError(request, "error");
+      return;
+    }
+    RECORD_EVENT(trace_recorder_, request->id, "request adopted by engine");
+    // The LoRA adapter index is specific to the models of each engine.
+    mstate->lora_adapter_index = -1;
+    if (!request->generation_cfg->lora_adapter.empty()) {
+      mstate->lora_adapter_index =
+          models_[0]->GetLoRAAdapterIndex(request->generation_cfg->lora_adapter);
+      if (mstate->lora_adapter_index == -1) {
+        this->StreamBackError(request, "error");
+        return;
+      }
+    }
+    // Assign the sequence id of this engine. The KV data are swapped in by the
+    // swap-in action, after which the request directly continues decoding.
+    mstate->internal_id = estate_->id_manager.GetNewId();
+    rsentry->status = RequestStateStatus::kPending;
+    estate_->num_swapped_kv_tokens += mstate->num_swapped_kv_tokens;
+    estate_->waiting_queue.push_back(request);
+    estate_->request_states.emplace(request->id, rstate);
+  }
+
   /*********************** Engine Action ***********************/
 
   void Step() final {
+    step_phase_times_.clear();
+    std::array<double, DeviceTimeMetrics::kNumKinds> device_time_before =
+        estate_->metrics.device_time.device_time_sum;
+    auto tstart = std::chrono::high_resolution_clock::now();
+    if (device_timer_recorder_ == nullptr) {
+      StepImpl();
+    } else {
+      {
+        DeviceTimerRecorder::ActiveScope device_timer_scope(device_timer_recorder_.get());
+        StepImpl();
+      }
+      auto tend = std::chrono::high_resolution_clock::now();
+      device_timer_recorder_->Flush(static_cast<double>((tend - tstart).count()) / 1e9,
+                                    &estate_->metrics.device_time);
+      // The all-reduce time is timed on worker 0 and is already included in the forward time.
+      double all_reduce_time = 0.0;
+      for (const Model& model : models_) {
+        all_reduce_time += model->TakeAllReduceTime();
+      }
+      if (all_reduce_time > 0) {
+        estate_->metrics.device_time.UpdateDeviceTime(DeviceTimeKind::kCommunication,
+                                                      all_reduce_time);
+      }
+    }
+    if (engine_config_->step_watchdog_threshold_ms > 0) {
+      auto tend = std::chrono::high_resolution_clock::now();
+      double step_time = static_cast<double>((tend - tstart).count()) / 1e9;
+      if (step_time * 1e3 > engine_config_->step_watchdog_threshold_ms) {
+        ReportSlowStep(step_time, device_time_before);
+      }
+    }
+  }
+
+  /*!
+   * \brief Log the latency breakdown of an engine step exceeding the step watchdog threshold.
+   * \param step_time The wall time of the step in seconds.
+   * \param device_time_before The device time sums of the engine metrics before the step.
+   */
+  void ReportSlowStep(double step_time,
+                      const std::array<double, DeviceTimeMetrics::kNumKinds>& device_time_before) {
+    estate_->metrics.num_slow_steps += 1;
+    std::ostringstream os;
+    os << "Engine step took " << step_time * 1e3 << " ms, exceeding the watchdog threshold "
+       << engine_config_->step_watchdog_threshold_ms << " ms. Running requests: "
+       << estate_->running_queue.size() << ", waiting requests: " << estate_->waiting_queue.size();
+    if (num_total_kv_cache_pages_ > 0) {
+      os << ", KV cache utilization: "
+         << 1.0 - static_cast<double>(models_[0]->GetNumAvailablePages()) /
+                      num_total_kv_cache_pages_;
+    }
+    os << ". Host time (ms):";
+    for (const auto& [phase, time] : step_phase_times_) {
+      os << " " << phase << "=" << time * 1e3;
+    }
+    // The device time is only available when the device timers are enabled, since the host
+    // time of a phase does not include its asynchronously launched device work.
+    if (device_timer_recorder_ != nullptr) {
+      os << ". Device time (ms):";
+      const auto& device_time_sum = estate_->metrics.device_time.device_time_sum;
+      for (int i = 0; i < DeviceTimeMetrics::kNumKinds; ++i) {
+        if (device_time_sum[i] > device_time_before[i]) {
+          os << " " << DeviceTimeMetrics::KindName(i) << "="
+             << (device_time_sum[i] - device_time_before[i]) * 1e3;
+        }
+      }
+    }
+    LOG(WARNING) << os.str();
+  }
+
+  /*! \brief The implementation of an engine step. */
+  void StepImpl() {
     CHECK(request_stream_callback_ != nullptr)
         << "The request stream callback is not set. Engine cannot execute.";
+    if (num_total_kv_cache_pages_ > 0 && !estate_->running_queue.empty()) {
+      estate_->metrics.UpdateKVCacheUtilization(
+          1.0 - static_cast<double>(models_[0]->GetNumAvailablePages()) /
+                    num_total_kv_cache_pages_);
+    }
+    AddCompiledRequests();
+    // Shrink the KV cache requested under critical memory pressure once the requests are done.
+    if (pending_kv_cache_shrink_ && estate_->request_states.empty() &&
+        compiling_requests_.empty()) {
+      ShrinkKVCache();
+    }
+    if (estate_->request_states.empty() && !compiling_requests_.empty()) {
+      // Only grammar preprocessing is pending. Wait for it briefly instead of spinning.
+      compiling_requests_.front().init_ctx.wait_for(std::chrono::milliseconds(10));
+      AddCompiledRequests();
+    }
+    // Prefill the preloaded prefixes one at a time when there is no other request.
+    if (estate_->request_states.empty() && compiling_requests_.empty() &&
+        num_issued_prefix_preloads_ < preloaded_prefixes_.size()) {
+      AddPrefixPreloadRequest();
+    }
+    // Compact the fragmented KV data of prefix cache when there is no other request.
+    if (estate_->request_states.empty() && compiling_requests_.empty() && HasPendingCompaction()) {
+      estate_->prefix_cache->CompactRecyclingSequences(
+          engine_config_->prefix_cache_compaction_max_num_tokens);
+    }
+    if (engine_config_->batch_invariant_sampling) {
+      // Restart the random stream of each request at its number of committed tokens, so that
+      // the random numbers of a token do not depend on how the earlier tokens were batched,
+      // preempted or speculated.
+      for (const auto& [request_id, rstate] : estate_->request_states) {
+        for (const RequestStateEntry& rsentry : rstate->entries) {
+          rsentry->rng.ResetStream(rsentry->mstates[0]->committed_tokens.size());
+        }
+      }
+    }
     for (EngineAction action : actions_) {
       Array<Request> processed_requests;
+      auto tstart = std::chrono::high_resolution_clock::now();
       {
         NVTXScopedRange nvtx_scope("Action step");
         processed_requests = action->Step(estate_);
       }
+      auto tend = std::chrono::high_resolution_clock::now();
+      double action_time = static_cast<double>((tend - tstart).count()) / 1e9;
+      step_phase_times_.emplace_back(action->Name(), action_time);
       if (!processed_requests.empty()) {
+        estate_->metrics.UpdateStepPhaseTime(action->Name(), action_time);
+        tstart = std::chrono::high_resolution_clock::now();
         ActionStepPostProcess(processed_requests, estate_, models_, tokenizer_,
                               request_stream_callback_, engine_config_->max_single_sequence_length,
-                              draft_token_workspace_manager_, trace_recorder_);
+                              draft_token_workspace_manager_, trace_recorder_,
+                              /*defer_stream_callback=*/engine_config_->overlap_stream_callback);
+        tend = std::chrono::high_resolution_clock::now();
+        double post_process_time = static_cast<double>((tend - tstart).count()) / 1e9;
+        step_phase_times_.emplace_back("post_process", post_process_time);
+        estate_->metrics.UpdateStepPhaseTime("post_process", post_process_time);
+        if (engine_config_->disaggregation_role == DisaggregationRole::kPrefill &&
+            prefill_handoff_callback_ != nullptr) {
+          HandOffPrefilledRequests();
+        }
+        if (estate_->running_queue.empty()) {
+          // There may be no next step to overlap with, so invoke the callback now.
+          estate_->InvokeDeferredStreamCallback();
+        }
         return;
       }
     }
+    estate_->InvokeDeferredStreamCallback();
     ICHECK(estate_->running_queue.empty())
         << "Internal assumption violated: It is expected that an engine step takes at least one "
            "action (e.g. prefill, decode, etc.) but it does not.";
   }
 
+  /*!
+   * \brief Hand the running requests whose prefill has finished off to a decode engine,
+   * under the "prefill" disaggregation role. The KV data of the requests are copied out to
+   * host memory, and the requests are released from this engine.
+   * The requests with parallel generation branches are decoded by this engine.
+   */
+  void HandOffPrefilledRequests() {
+    std::vector<RequestState> handoff_rstates;
+    for (const Request& request : estate_->running_queue) {
+      RequestState rstate = estate_->GetRequestState(request);
+      if (rstate->entries.size() != 1) {
+        continue;
+      }
+      const RequestStateEntry& rsentry = rstate->entries[0];
+      const RequestModelState& mstate = rsentry->mstates[0];
+      // The requests with an unknown prompt length are decoded by this engine, as their KV
+      // length cannot be derived.
+      if (rsentry->status == RequestStateStatus::kAlive && mstate->inputs.empty() &&
+          !mstate->committed_tokens.empty() && rsentry->request->prompt_tokens >= 0) {
+        handoff_rstates.push_back(rstate);
+      }
+    }
+    if (handoff_rstates.empty()) {
+      return;
+    }
+    // - Deliver the outputs of this engine before the decode engine takes over.
+    estate_->InvokeDeferredStreamCallback();
+    for (const RequestState& rstate : handoff_rstates) {
+      RequestStateEntry rsentry = rstate->entries[0];
+      RequestModelState mstate = rsentry->mstates[0];
+      Request request = rsentry->request;
+      // The tokens for the next decode have not been written into KV cache yet.
+      int64_t num_kv_tokens = request->prompt_tokens +
+                              static_cast<int64_t>(mstate->committed_tokens.size()) -
+                              mstate->num_tokens_for_next_decode;
+      RECORD_EVENT(trace_recorder_, request->id, "hand off");
+      mstate->swapped_kv_data = models_[0]->SwapOutSequence(mstate->internal_id, num_kv_tokens);
+      mstate->num_swapped_kv_tokens = num_kv_tokens;
+      // - Release the sequence. The prefix cache keeps the prefix for reuse.
+      if (estate_->prefix_cache->HasSequence(mstate->internal_id)) {
+        estate_->prefix_cache->RecycleSequence(mstate->internal_id, /*lazy=*/true);
+      } else {
+        RemoveRequestFromModel(estate_, mstate->internal_id, models_);
+        estate_->id_manager.RecycleId(mstate->internal_id);
+      }
+      mstate->internal_id = -1;
+      mstate->prefilled_inputs.clear();
+      mstate->cached_committed_tokens = 0;
+      estate_->running_queue.erase(
+          std::find(estate_->running_queue.begin(), estate_->running_queue.end(), request));
+      estate_->request_states.erase(request->id);
+    }
+    estate_->running_rsentries_changed = true;
+    // - The host KV data must be ready before the decode engine reads them.
+    models_[0]->SynchronizeKVSwap();
+    for (RequestState rstate : handoff_rstates) {
+      prefill_handoff_callback_(std::move(rstate));
+    }
+  }
+
   /************** Utility Functions **************/
+  /*!
+   * \brief Check if the model of the new model config can be hot swapped in for the model of
+   * the current model config, which requires the same architecture, quantization and shapes.
+   */
+  static bool IsHotSwapCompatible(const picojson::object& current_config,
+                                  const picojson::object& new_config) {
+    static const char* keys[] = {
+        "model_type",          "quantization",        "model_config",
+        "vocab_size",          "context_window_size", "sliding_window_size",
+        "prefill_chunk_size",  "attention_sink_size", "tensor_parallel_shards",
+        "pipeline_parallel_stages"};
+    for (const char* key : keys) {
+      auto current_it = current_config.find(key);
+      auto new_it = new_config.find(key);
+      picojson::value current_value =
+          current_it != current_config.end() ? current_it->second : picojson::value();
+      picojson::value new_value = new_it != new_config.end() ? new_it->second : picojson::value();
+      if (current_value != new_value) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*! \brief Get the size in bytes of the weight parameters of the model on a single GPU. */
+  static int64_t GetParamsBytes(const ModelMetadata& metadata) {
+    int64_t params_bytes = 0;
+    for (const ModelMetadata::Param& param : metadata.params) {
+      int64_t param_size = param.dtype.bytes();
+      for (int64_t v : param.shape) {
+        param_size *= v;
+      }
+      params_bytes += param_size;
+    }
+    return params_bytes / metadata.pipeline_parallel_stages;
+  }
+
   std::tuple<Optional<Session>, int, std::vector<int>> CreateDiscoSession(
       const std::vector<std::string>& model_libs,
       const std::vector<picojson::object>& model_configs, Device device) {
@@ -727,6 +1683,17 @@ class EngineImpl : public Engine {
   }
 
  private:
+  /*!
+   * \brief Whether the models need the hidden states workspace, which is used by the speculative
+   * modes drafting from hidden states, and by the prompt logprobs of a single model that keeps
+   * the prefilled hidden states. The memory estimate counts the workspace under the same
+   * condition.
+   */
+  bool RequireHiddenStatesWorkspace(SpeculativeMode speculative_mode) {
+    return SpeculativeModeUsesHiddenStates(speculative_mode) ||
+           (models_.size() == 1 && models_[0]->CanPoolHiddenStates());
+  }
+
   Result<EngineConfig> AutoDecideEngineConfig(const std::string& engine_config_json_str,
                                               const std::vector<picojson::object>& model_configs) {
     using TResult = Result<EngineConfig>;
@@ -743,6 +1710,9 @@ class EngineImpl : public Engine {
     double gpu_memory_utilization =
         json::LookupOrDefault<double>(config, "gpu_memory_utilization", n->gpu_memory_utilization);
     bool verbose = json::LookupOrDefault<bool>(config, "verbose", n->verbose);
+    SpeculativeMode speculative_mode = SpeculativeModeFromString(json::LookupOrDefault<std::string>(
+        config, "speculative_mode", SpeculativeModeToString(n->speculative_mode)));
+    bool require_hidden_states_workspace = RequireHiddenStatesWorkspace(speculative_mode);
 
     // - Get the config fields that can be automatically inferred.
     std::optional<int64_t> max_num_sequence =
@@ -776,12 +1746,12 @@ class EngineImpl : public Engine {
       // - Infer configuration.
       inferrable_cfg_res = InferrableEngineConfig::InferForKVCache(
           mode, device_, gpu_memory_utilization, model_configs, model_metadata, inferrable_cfg,
-          verbose);
+          require_hidden_states_workspace, verbose);
     } else {
       // - Infer configuration.
       inferrable_cfg_res = InferrableEngineConfig::InferForRNNState(
           mode, device_, gpu_memory_utilization, model_configs, model_metadata, inferrable_cfg,
-          verbose);
+          require_hidden_states_workspace, verbose);
     }
 
     if (inferrable_cfg_res.IsErr()) {
@@ -812,20 +1782,6 @@ class EngineImpl : public Engine {
     }
   }
 
-  /*! \brief Create a grammar init context according to the response format. If the response format
-   * is not JSON, return std::nullopt. */
-  std::optional<std::shared_ptr<GrammarStateInitContext>> GetGrammarInitCtxFromResponseFormat(
-      const ResponseFormat& response_format) {
-    if (response_format.type != "json_object") {
-      return std::nullopt;
-    } else if (!response_format.schema) {
-      return grammar_init_context_cache_->GetInitContextForJSON();
-    } else {
-      return grammar_init_context_cache_->GetInitContextForJSONSchema(
-          response_format.schema.value());
-    }
-  }
-
   // Engine state, managing requests and request states.
   EngineState estate_;
   // Configurations and singletons
@@ -835,20 +1791,64 @@ class EngineImpl : public Engine {
   std::vector<std::string> token_table_;
   // Helper to get the grammar init context for requests.
   GrammarInitContextCache grammar_init_context_cache_;
+  // A request waiting for the preprocessing of its grammar.
+  struct CompilingRequest {
+    Request request;
+    std::shared_future<std::shared_ptr<GrammarStateInitContext>> init_ctx;
+    std::chrono::high_resolution_clock::time_point add_time_point;
+    int lora_adapter_index;
+  };
+  // The requests waiting for the preprocessing of their grammar, in arrival order.
+  // It is destructed before the grammar init context cache, whose workers it may wait for.
+  std::vector<CompilingRequest> compiling_requests_;
   // Models
   Array<Model> models_;
+  // The paths and libs of the models.
+  std::vector<std::pair<std::string, std::string>> models_and_model_libs_;
+  // The configs of the models.
+  std::vector<picojson::object> model_configs_;
+  // A boolean indicating if the models run on a disco session.
+  bool use_disco_ = false;
+  // A started hot swap of the model weights.
+  struct PendingHotSwap {
+    std::vector<std::string> model_paths;
+    std::vector<picojson::object> model_configs;
+    // The new weights of each model, loaded in background.
+    std::future<std::vector<ObjectRef>> params;
+  };
+  // The started hot swap, if any. It is declared after the models, so that it is destructed
+  // first and waits for the background loading which uses the models.
+  std::optional<PendingHotSwap> pending_hot_swap_;
   // Device that the models run on.
   Device device_;
   // Workspace of each model.
   std::vector<ModelWorkspace> model_workspaces_;
-  // Request stream callback function
+  // Request stream callback function, which skips the outputs of the prefix preload requests.
   FRequestStreamCallback request_stream_callback_;
+  // The request stream callback function set by the user.
+  FRequestStreamCallback user_request_stream_callback_;
+  // The prefixes to preload into prefix cache, in the order of preloading.
+  std::vector<IntTuple> preloaded_prefixes_;
+  // The number of preloaded prefixes whose preload requests are added.
+  size_t num_issued_prefix_preloads_ = 0;
+  // The total number of tokens of the preloaded prefixes.
+  int64_t num_preloaded_prefix_tokens_ = 0;
   // Engine actions.
   Array<EngineAction> actions_;
   // Draft token workspace manager for speculative decoding.
   Optional<DraftTokenWorkspaceManager> draft_token_workspace_manager_;
+  // The callback to hand prefilled requests off under the "prefill" disaggregation role.
+  FPrefillHandoffCallback prefill_handoff_callback_;
   // Event trace recorder.
   Optional<EventTraceRecorder> trace_recorder_;
+  // Device timer recorder, when the device timing is enabled.
+  std::unique_ptr<DeviceTimerRecorder> device_timer_recorder_;
+  // The host time in seconds of the phases of the current engine step, in the order run.
+  std::vector<std::pair<std::string, double>> step_phase_times_;
+  // The total number of KV cache pages of the first model, or 0 when it has no KV cache.
+  int num_total_kv_cache_pages_ = 0;
+  // Whether the KV cache is to be shrunk under critical memory pressure once the engine is idle.
+  bool pending_kv_cache_shrink_ = false;
 };
 
 Result<EngineCreationOutput> Engine::Create(const std::string& engine_config_json_str,
@@ -876,9 +1876,16 @@ class EngineModule : public ModuleNode {
   TVM_MODULE_VTABLE_ENTRY("abort_request", &EngineModule::Abort);
   TVM_MODULE_VTABLE_ENTRY("step", &EngineModule::Step);
   TVM_MODULE_VTABLE_ENTRY("reset", &EngineModule::Reset);
+  TVM_MODULE_VTABLE_ENTRY("preload_prefix", &EngineModule::PreloadPrefix);
+  TVM_MODULE_VTABLE_ENTRY("trim_memory", &EngineModule::TrimMemory);
+  TVM_MODULE_VTABLE_ENTRY("save_session", &EngineModule::SaveSession);
+  TVM_MODULE_VTABLE_ENTRY("restore_session", &EngineModule::RestoreSession);
+  TVM_MODULE_VTABLE_ENTRY("empty", &EngineModule::Empty);
   TVM_MODULE_VTABLE_ENTRY("json_metrics", &EngineModule::JSONMetrics);
   TVM_MODULE_VTABLE_ENTRY("get_request_stream_callback", &EngineModule::GetRequestStreamCallback);
   TVM_MODULE_VTABLE_ENTRY("set_request_stream_callback", &EngineModule::SetRequestStreamCallback);
+  TVM_MODULE_VTABLE_ENTRY("get_complete_engine_config",
+                          &EngineModule::GetCompleteEngineConfigJSONString);
   TVM_MODULE_VTABLE_END();
 
   /*! \brief Initialize the engine with config and other fields. */
@@ -890,6 +1897,7 @@ class EngineModule : public ModuleNode {
     CHECK(output_res.IsOk()) << output_res.UnwrapErr();
     EngineCreationOutput output = output_res.Unwrap();
     this->engine_ = std::move(output.reloaded_engine);
+    this->complete_engine_config_ = std::move(output.completed_engine_config);
     this->default_generation_config_ = output.default_generation_cfg;
   }
   /*! \brief Construct an EngineModule. */
@@ -917,9 +1925,26 @@ class EngineModule : public ModuleNode {
   }
   /*! \brief Redirection to `Engine::Reset`. */
   void Reset() { return GetEngine()->Reset(); }
+  /*! \brief Redirection to `Engine::PreloadPrefix`. */
+  void PreloadPrefix(IntTuple token_ids) { return GetEngine()->PreloadPrefix(token_ids); }
+  /*! \brief Redirection to `Engine::TrimMemory`. */
+  void TrimMemory(bool critical) { return GetEngine()->TrimMemory(critical); }
+  /*! \brief Redirection to `Engine::SaveSession`. */
+  void SaveSession(String session_id, IntTuple token_ids) {
+    return GetEngine()->SaveSession(session_id, token_ids);
+  }
+  /*! \brief Redirection to `Engine::RestoreSession`. */
+  void RestoreSession(String session_id) { return GetEngine()->RestoreSession(session_id); }
+  /*! \brief Redirection to `Engine::Empty`. */
+  bool Empty() { return GetEngine()->Empty(); }
 
   /*! \brief Redirection to `Engine::JSONMetrics`. */
   String JSONMetrics() { return GetEngine()->JSONMetrics(); }
+  /*! \brief Return the complete engine config of the engine in JSON string. */
+  String GetCompleteEngineConfigJSONString() {
+    CHECK(complete_engine_config_.defined()) << "Engine is not initialized via init";
+    return complete_engine_config_.value()->AsJSONString();
+  }
 
  private:
   Engine* GetEngine() {
@@ -928,6 +1953,7 @@ class EngineModule : public ModuleNode {
   }
 
   std::unique_ptr<Engine> engine_ = nullptr;
+  Optional<EngineConfig> complete_engine_config_;
   GenerationConfig default_generation_config_;
 };
 
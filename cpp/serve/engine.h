@@ -8,6 +8,8 @@
 
 #include <tvm/runtime/packed_func.h>
 
+#include <functional>
+
 #include "data.h"
 #include "event_trace_recorder.h"
 #include "request.h"
@@ -20,6 +22,12 @@ namespace serve {
 using namespace tvm::runtime;
 
 typedef TypedPackedFunc<void(Array<RequestStreamOutput>)> FRequestStreamCallback;
+/*!
+ * \brief The callback that hands a request off from a prefill engine to a decode engine
+ * in disaggregated serving. The KV data of the request are held on host by the request
+ * state, in the `swapped_kv_data` of its model state.
+ */
+typedef std::function<void(RequestState)> FPrefillHandoffCallback;
 
 class Engine;
 
@@ -31,6 +39,8 @@ struct EngineCreationOutput {
   std::unique_ptr<Engine> reloaded_engine;
   EngineConfig completed_engine_config;
   GenerationConfig default_generation_cfg;
+  /*! \brief The tokenizer of the engine, with which requests can be tokenized off the engine. */
+  Tokenizer tokenizer;
 };
 
 /*!
@@ -76,6 +86,41 @@ class Engine {
   /*! \brief Reset the engine, clean up all running data and metrics. */
   virtual void Reset() = 0;
 
+  /*!
+   * \brief Release memory in reaction to the memory pressure of the system, e.g., the memory
+   * warnings of mobile OS. The recycling sequences of prefix cache and the memory cached by the
+   * models are released. Under critical pressure, the KV cache is further recreated with half of
+   * its capacity once the engine has no request, which lowers `max_total_sequence_length`.
+   * \param critical Whether the memory pressure is critical.
+   */
+  virtual void TrimMemory(bool critical) = 0;
+
+  /*!
+   * \brief Start to hot swap the model weights to the models of the given engine config,
+   * keeping the KV cache allocation and the model workspace. The new models must use the same
+   * model libs as the current models and have the same model configs in architecture and
+   * shapes, such as the fine-tuned variants of the current models. The options other than the
+   * models in the given engine config are not changed, and neither is the tokenizer.
+   * The new weights are loaded in background while the engine keeps serving, except for the
+   * models using disco, whose weights are loaded before returning.
+   * \param engine_config_json_str The serialized JSON string of the new engine config.
+   * \return A boolean indicating if the hot swap is started. It is false when the new models
+   * are not compatible, in which case the engine should be reloaded instead.
+   * \sa FinishHotSwap
+   */
+  virtual bool StartHotSwap(const std::string& engine_config_json_str) = 0;
+
+  /*!
+   * \brief Finish the started hot swap when the new weights are loaded, aborting the running
+   * requests and switching the models to the new weights. When the new weights fail to load,
+   * the error is logged and the hot swap finishes with the current weights kept.
+   * \param wait A boolean indicating if to wait for the new weights to be loaded.
+   * \param output The output with the completed engine config, the default generation config
+   * and the tokenizer after the swap. The engine pointer in output is left null.
+   * \return A boolean indicating if the hot swap has finished.
+   */
+  virtual bool FinishHotSwap(bool wait, EngineCreationOutput* output) = 0;
+
   /*! \brief Check if the engine has no request to process. */
   virtual bool Empty() = 0;
 
@@ -90,12 +135,51 @@ class Engine {
   /*! \brief Add a new request to the engine. */
   virtual void AddRequest(Request request) = 0;
 
+  /*!
+   * \brief Preload the given token sequence into prefix cache and pin it there, so that the
+   * requests starting with the sequence reuse its KV data instead of prefilling it. The sequence
+   * is prefilled in the engine steps when there is no request to process, and is preloaded again
+   * after the engine is reset.
+   * \param token_ids The token ids of the sequence to preload.
+   */
+  virtual void PreloadPrefix(IntTuple token_ids) = 0;
+
+  /*!
+   * \brief Save the KV data of the given conversation tokens cached in prefix cache into the
+   * snapshot of the session under `kv_session_dir`, so that a session resumed after its prefix
+   * is evicted does not prefill the conversation history again.
+   * \param session_id The session id, which consists of letters, digits, '-' and '_'.
+   * \param token_ids The token ids of the conversation so far.
+   */
+  virtual void SaveSession(String session_id, IntTuple token_ids) = 0;
+
+  /*!
+   * \brief Restore the snapshot of the session saved by `SaveSession` into prefix cache, so
+   * that the next request of the session reuses the restored KV data.
+   * \param session_id The session id.
+   */
+  virtual void RestoreSession(String session_id) = 0;
+
   /*! \brief Abort the input request (specified by id string) from engine. */
   virtual void AbortRequest(const String& request_id) = 0;
 
   /*! \brief Abort all requests from the engine. */
   virtual void AbortAllRequests() = 0;
 
+  /*!
+   * \brief Set the callback to hand the prefilled requests off to a decode engine.
+   * It only takes effect under the "prefill" disaggregation role. When no callback is set,
+   * the prefill engine decodes the requests by itself.
+   */
+  virtual void SetPrefillHandoffCallback(FPrefillHandoffCallback callback) = 0;
+
+  /*!
+   * \brief Adopt a request handed off by a prefill engine. The KV data of the request are
+   * imported to the models of this engine, and the request continues with decode.
+   * \param rstate The request state handed off by the prefill engine.
+   */
+  virtual void AdoptRequest(RequestState rstate) = 0;
+
   /*********************** Engine Action ***********************/
 
   /*!
@@ -37,6 +37,9 @@ class EngineActionObj : public Object {
    */
   virtual Array<Request> Step(EngineState estate) = 0;
 
+  /*! \brief The name of the action, which keys the action time in engine metrics. */
+  virtual String Name() const = 0;
+
   static constexpr const char* _type_key = "mlc.serve.EngineAction";
   static constexpr const bool _type_has_method_sequal_reduce = false;
   static constexpr const bool _type_has_method_shash_reduce = false;
@@ -125,6 +128,17 @@ class EngineAction : public ObjectRef {
                                  EngineConfig engine_config,
                                  Optional<EventTraceRecorder> trace_recorder);
 
+  /*!
+   * \brief Create the action that runs one-step prompt lookup draft proposal for
+   * requests in the `running_queue` of engine state. The draft tokens are proposed by
+   * n-gram matching in the prompt and generated tokens of each request, without a model.
+   * \param engine_config The engine config.
+   * \param trace_recorder The event trace recorder for requests.
+   * \return The created action object.
+   */
+  static EngineAction PromptLookupDraft(EngineConfig engine_config,
+                                        Optional<EventTraceRecorder> trace_recorder);
+
   /*!
    * \brief Create the action that runs one-step speculative draft proposal for
    * requests in the `running_queue` of engine state. Preempt low-priority requests
@@ -185,17 +199,33 @@ class EngineAction : public ObjectRef {
   /*!
    * \brief Create the action that executes the jump-forward decoding to predict the next tokens
    * according to the grammar constraint. Does nothing for the requests without grammar. The
-   * predicted tokens will be fed to the next BatchDecode action. Retokenization may happen when
+   * predicted tokens are written into the KV cache by chunked prefills, except the last one,
+   * which will be fed to the next BatchDecode action. Retokenization may happen when
    * the predicted string breaks the tokenization boundary.
    * \param models The model to run decode in. When there are multiple
    * models, the `Step` function of the created action will not take effect.
    * \param tokenizer The tokenizer of the engine.
+   * \param engine_config The engine config.
    * \param trace_recorder The event trace recorder for requests.
    * \return The created action object.
    */
   static EngineAction BatchJumpForward(Array<Model> models, Tokenizer tokenizer,
+                                       EngineConfig engine_config,
                                        Optional<EventTraceRecorder> trace_recorder);
 
+  /*!
+   * \brief Create the action that swaps the KV data of the preempted requests back in
+   * from host memory, and moves the requests from `waiting_queue` to `running_queue`.
+   * It only takes effect when the engine preemption mode is swap.
+   * \param models The model to swap in the KV data. When there are multiple
+   * models, the `Step` function of the created action will not take effect.
+   * \param engine_config The engine config.
+   * \param trace_recorder The event trace recorder for requests.
+   * \return The created action object.
+   */
+  static EngineAction BatchSwapIn(Array<Model> models, EngineConfig engine_config,
+                                  Optional<EventTraceRecorder> trace_recorder);
+
   /*!
    * \brief Create the action that first makes a decision on whether to run speculative
    * decoding or normal mode batch decode, and then runs the selected actions.
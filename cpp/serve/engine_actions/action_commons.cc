@@ -6,6 +6,7 @@
 #include "action_commons.h"
 
 #include <tvm/runtime/nvtx.h>
+#include <tvm/runtime/threading_backend.h>
 
 namespace mlc {
 namespace llm {
@@ -18,6 +19,24 @@ Array<EngineAction> CreateEngineActions(Array<Model> models, EngineConfig engine
                                         DraftTokenWorkspaceManager draft_token_workspace_manager,
                                         Tokenizer tokenizer,
                                         Optional<EventTraceRecorder> trace_recorder) {
+  if (engine_config->speculative_mode == SpeculativeMode::kPromptLookup) {
+    // The prompt lookup drafts are verified by the only model.
+    ICHECK_EQ(models.size(), 1U);
+    // The draft length and tree width are resolved and validated in the engine creation.
+    ICHECK_GT(engine_config->spec_draft_length, 0);
+    ICHECK_EQ(engine_config->spec_tree_width, 1);
+    return {EngineAction::NewRequestPrefill(models,            //
+                                            logit_processor,   //
+                                            sampler,           //
+                                            model_workspaces,  //
+                                            engine_config,     //
+                                            model_configs,     //
+                                            trace_recorder),
+            EngineAction::PromptLookupDraft(engine_config, trace_recorder),
+            EngineAction::BatchVerify(models, logit_processor, sampler, model_workspaces,
+                                      draft_token_workspace_manager, engine_config,
+                                      trace_recorder)};
+  }
   if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
     // Speculative decoding is only possible for more than one model.
     ICHECK_GT(models.size(), 1U);
@@ -56,7 +75,7 @@ Array<EngineAction> CreateEngineActions(Array<Model> models, EngineConfig engine
     }
 
     // The "small draft" mode speculative decoding.
-    if (engine_config->spec_draft_length > 0) {
+    if (engine_config->spec_draft_length > 0 && !engine_config->spec_auto_disable) {
       // If "engine_config->spec_draft_length" > 0, it means the draft length is
       // configured to be a fixed value.
       return {
@@ -74,7 +93,8 @@ Array<EngineAction> CreateEngineActions(Array<Model> models, EngineConfig engine
     } else {
       // "engine_config->spec_draft_length" being 0 means we want to enable
       // automatic speculative decoding, which decides the spec decoding draft length
-      // automatically.
+      // automatically. With a fixed draft length, the action still switches to normal
+      // mode batch decode when speculative decoding is expected to be slower.
       return {EngineAction::NewRequestPrefill(models,            //
                                               logit_processor,   //
                                               sampler,           //
@@ -99,16 +119,25 @@ Array<EngineAction> CreateEngineActions(Array<Model> models, EngineConfig engine
   }
 
   // The normal mode.
-  return {EngineAction::NewRequestPrefill(models,            //
-                                          logit_processor,   //
-                                          sampler,           //
-                                          model_workspaces,  //
-                                          engine_config,     //
-                                          model_configs,     //
-                                          trace_recorder),
-          EngineAction::BatchJumpForward(models, tokenizer, trace_recorder),
-          EngineAction::BatchDecode(models, tokenizer, logit_processor, sampler, engine_config,
-                                    trace_recorder)};
+  std::vector<EngineAction> actions;
+  if (engine_config->preemption_mode == PreemptionMode::kSwap ||
+      engine_config->disaggregation_role == DisaggregationRole::kDecode) {
+    // Swapped out requests are resumed ahead of the prefill of new requests.
+    // The requests adopted from prefill engines are imported by swap-in as well.
+    actions.push_back(EngineAction::BatchSwapIn(models, engine_config, trace_recorder));
+  }
+  actions.push_back(EngineAction::NewRequestPrefill(models,            //
+                                                    logit_processor,   //
+                                                    sampler,           //
+                                                    model_workspaces,  //
+                                                    engine_config,     //
+                                                    model_configs,     //
+                                                    trace_recorder));
+  actions.push_back(
+      EngineAction::BatchJumpForward(models, tokenizer, engine_config, trace_recorder));
+  actions.push_back(EngineAction::BatchDecode(models, tokenizer, logit_processor, sampler,
+                                              engine_config, trace_recorder));
+  return actions;
 }
 
 void RemoveRequestFromModel(EngineState estate, int64_t req_internal_id,
@@ -202,7 +231,12 @@ void ProcessFinishedRequestStateEntries(
       auto trequest_finish = std::chrono::high_resolution_clock::now();
 
       rstate->metrics.finish_time_point = trequest_finish;
-      estate->metrics.RequestFinishUpdate(rstate->metrics);
+      // The internal prefix preload requests are not accounted in the engine metrics.
+      if (!IsPrefixPreloadRequest(rsentry->request->id)) {
+        estate->metrics.RequestFinishUpdate(rstate->metrics,
+                                             rsentry->request->generation_cfg->tenant_id);
+      }
+      estate->rsentry_pool.Recycle(rstate->entries);
 
       // always stream back usage in backend
       callback_delta_outputs->push_back(RequestStreamOutput::Usage(
@@ -212,41 +246,113 @@ void ProcessFinishedRequestStateEntries(
   }
 }
 
+bool UseOptimisticDraft(const EngineConfig& engine_config, bool has_draft_model) {
+  return engine_config->spec_optimistic_draft && has_draft_model &&
+         engine_config->spec_tree_width == 1;
+}
+
+int GetDraftModelRollbackLength(int verify_length, int accept_length, bool optimistic_draft) {
+  int rollback_length = std::max(verify_length - accept_length, 0);
+  if (rollback_length == 0 || optimistic_draft) {
+    return rollback_length;
+  }
+  // The last draft token is not yet added into the draft model, so the draft model rolls back
+  // one token less.
+  return rollback_length - 1;
+}
+
+void ParallelForRequests(int num_requests, int min_num_requests_for_parallel,
+                         const std::function<void(int)>& fprocess) {
+  if (num_requests < min_num_requests_for_parallel ||
+      tvm::runtime::threading::MaxConcurrency() <= 1) {
+    for (int r = 0; r < num_requests; ++r) {
+      fprocess(r);
+    }
+  } else {
+    NVTXScopedRange nvtx_scope("Parallel for requests");
+    tvm::runtime::parallel_for_with_threading_backend(fprocess, 0, num_requests);
+  }
+}
+
+/*!
+ * \brief The minimum number of requests to collect the delta outputs in parallel, below which
+ * the thread pool launch overhead outweighs the per-request work.
+ */
+constexpr int kMinNumRequestsForParallelPostProcess = 16;
+
 void ActionStepPostProcess(Array<Request> requests, EngineState estate, const Array<Model>& models,
                            const Tokenizer& tokenizer,
                            FRequestStreamCallback request_stream_callback,
                            int64_t max_single_sequence_length,
                            Optional<DraftTokenWorkspaceManager> draft_token_workspace_manager,
-                           Optional<EventTraceRecorder> trace_recorder) {
+                           Optional<EventTraceRecorder> trace_recorder,
+                           bool defer_stream_callback) {
   NVTXScopedRange nvtx_scope("EngineAction postproc");
+  // Deliver the stream outputs deferred by the previous step first, to keep the output order.
+  estate->InvokeDeferredStreamCallback();
   int num_requests = requests.size();
   estate->postproc_workspace.finished_rsentries.clear();
   estate->postproc_workspace.callback_delta_outputs.clear();
   estate->postproc_workspace.finished_rsentries.reserve(num_requests);
   estate->postproc_workspace.callback_delta_outputs.reserve(num_requests * 2);
 
-  // - Collect new generated tokens and finish reasons for requests.
-  for (int r = 0; r < num_requests; ++r) {
-    Request request = requests[r];
-    int n = request->generation_cfg->n;
-    RequestState rstate = estate->GetRequestState(requests[r]);
-
+  // - Collect new generated tokens and finish reasons for requests. The stop string matching
+  // and logprob JSON formatting of a request only touch the states of the request itself, so
+  // the requests are processed in parallel, and their results are gathered in order after.
+  std::vector<RequestState>& rstates = estate->postproc_workspace.rstates;
+  std::vector<RequestStreamOutput>& stream_outputs = estate->postproc_workspace.stream_outputs;
+  std::vector<char>& invoke_callbacks = estate->postproc_workspace.invoke_callbacks;
+  rstates.clear();
+  rstates.reserve(num_requests);
+  for (const Request& request : requests) {
+    rstates.push_back(estate->GetRequestState(request));
+  }
+  stream_outputs.assign(num_requests, RequestStreamOutput{nullptr});
+  invoke_callbacks.assign(num_requests, 0);
+  // The token table is built lazily, which must not happen in the parallel stage.
+  tokenizer->PostProcessedTokenTable();
+  auto f_collect_delta = [&](int r) {
+    const RequestState& rstate = rstates[r];
+    int n = requests[r]->generation_cfg->n;
     bool invoke_callback = false;
     RequestStreamOutput stream_output = rstate->postproc_states.GetStreamOutput();
     for (int i = 0; i < n; ++i) {
       const RequestStateEntry& rsentry = n == 1 ? rstate->entries[0] : rstate->entries[i + 1];
       rsentry->GetDeltaRequestReturn(tokenizer, max_single_sequence_length, &stream_output, i);
-      if (stream_output->group_finish_reason[i].defined()) {
-        invoke_callback = true;
-        estate->postproc_workspace.finished_rsentries.push_back(rsentry);
-      }
-      if (!stream_output->group_delta_token_ids[i].empty() ||
+      if (stream_output->group_finish_reason[i].defined() ||
+          !stream_output->group_delta_token_ids[i].empty() ||
           !stream_output->group_extra_prefix_string[i].empty()) {
         invoke_callback = true;
       }
     }
 
-    if (invoke_callback) {
+    // The prompt logprobs are computed for the root entry, which holds the prompt.
+    stream_output->prompt_logprob_json_strs.clear();
+    if (!rstate->entries[0]->prompt_token_probs.empty()) {
+      invoke_callback = true;
+      for (const SampleResult& prompt_token_prob : rstate->entries[0]->prompt_token_probs) {
+        stream_output->prompt_logprob_json_strs.push_back(
+            prompt_token_prob.GetLogProbJSON(tokenizer, /*logprob=*/true));
+      }
+      rstate->entries[0]->prompt_token_probs.clear();
+    }
+    invoke_callbacks[r] = invoke_callback;
+    stream_outputs[r] = std::move(stream_output);
+  };
+  ParallelForRequests(num_requests, kMinNumRequestsForParallelPostProcess, f_collect_delta);
+
+  for (int r = 0; r < num_requests; ++r) {
+    Request request = requests[r];
+    int n = request->generation_cfg->n;
+    RequestState rstate = rstates[r];
+    RequestStreamOutput& stream_output = stream_outputs[r];
+    for (int i = 0; i < n; ++i) {
+      if (stream_output->group_finish_reason[i].defined()) {
+        estate->postproc_workspace.finished_rsentries.push_back(
+            n == 1 ? rstate->entries[0] : rstate->entries[i + 1]);
+      }
+    }
+    if (invoke_callbacks[r]) {
       stream_output->unpacked = false;
       estate->postproc_workspace.callback_delta_outputs.push_back(std::move(stream_output));
     }
@@ -258,6 +364,12 @@ void ActionStepPostProcess(Array<Request> requests, EngineState estate, const Ar
       if (!rsentry->mstates[0]->prefilled_inputs.empty()) {
         // Notify the prefix cache of the newly prefilled data.
         for (const Data& data : rsentry->mstates[0]->prefilled_inputs) {
+          if (const auto* image_data = data.as<ImageDataNode>()) {
+            // The images are in prefix cache as their pseudo token ids.
+            std::vector<int32_t> image_token_ids = image_data->GetPrefixCacheTokenIds();
+            token_ids.insert(token_ids.end(), image_token_ids.begin(), image_token_ids.end());
+            continue;
+          }
           const TokenDataNode* token_data = data.as<TokenDataNode>();
           if (token_data == nullptr) continue;
           token_ids.insert(token_ids.end(), token_data->token_ids->data,
@@ -280,25 +392,83 @@ void ActionStepPostProcess(Array<Request> requests, EngineState estate, const Ar
         estate->prefix_cache->ExtendSequence(rsentry->mstates[0]->internal_id, token_ids);
       }
     }
+    // Account the newly processed tokens to the tenant of the request.
+    int64_t num_processed_tokens = rstate->metrics.prefill_tokens +
+                                   rstate->metrics.completion_tokens;
+    if (num_processed_tokens > rstate->num_tenant_accounted_tokens &&
+        !IsPrefixPreloadRequest(request->id)) {
+      int64_t num_new_tokens = num_processed_tokens - rstate->num_tenant_accounted_tokens;
+      estate->metrics.UpdateTenantServedTokens(request->generation_cfg->tenant_id, num_new_tokens);
+      estate->scheduling_policy->UpdateServedTokens(request, num_new_tokens);
+      rstate->num_tenant_accounted_tokens = num_processed_tokens;
+    }
   }
+  rstates.clear();
+  stream_outputs.clear();
 
   ProcessFinishedRequestStateEntries(estate->postproc_workspace.finished_rsentries, estate, models,
                                      max_single_sequence_length, draft_token_workspace_manager,
                                      &estate->postproc_workspace.callback_delta_outputs);
 
   if (!estate->postproc_workspace.callback_delta_outputs.empty()) {
+    if (defer_stream_callback) {
+      // - Defer the stream callback so that it overlaps with the GPU execution of next step.
+      // The stream outputs are not reused until they are unpacked by the callback.
+      Array<RequestStreamOutput> delta_outputs =
+          std::move(estate->postproc_workspace.callback_delta_outputs);
+      estate->postproc_workspace.callback_delta_outputs = Array<RequestStreamOutput>();
+      estate->deferred_stream_callback = [request_stream_callback,
+                                          delta_outputs = std::move(delta_outputs)]() {
+        NVTXScopedRange nvtx_scope("Call deferred request stream callback");
+        request_stream_callback(delta_outputs);
+      };
+      return;
+    }
     NVTXScopedRange nvtx_scope("Call request stream callback");
     // - Invoke the stream callback function once for all collected requests.
     request_stream_callback(estate->postproc_workspace.callback_delta_outputs);
   }
 }  // namespace serve
 
+/*!
+ * \brief Try to swap out the KV data of the given request state entry to host memory,
+ * so that the entry can be resumed later without recomputing its KV data.
+ * The swap is only applicable to fully prefilled requests with a single entry
+ * running on a single model, and is subject to the host swap space capacity.
+ * \return A boolean indicating whether the KV data is swapped out.
+ */
+bool TrySwapOutRequestStateEntry(EngineState estate, const Array<Model>& models,
+                                 const RequestStateEntry& rsentry, bool partially_alive,
+                                 Optional<EventTraceRecorder> trace_recorder) {
+  if (estate->max_num_swapped_kv_tokens <= 0 || models.size() != 1 || partially_alive ||
+      rsentry->parent_idx != -1 || !rsentry->child_indices.empty() ||
+      rsentry->request->prompt_tokens < 0 || !models[0]->SupportKVSwap()) {
+    return false;
+  }
+  RequestModelState mstate = rsentry->mstates[0];
+  // The tokens for the next decode have not been written into KV cache yet.
+  int64_t num_kv_tokens = rsentry->request->prompt_tokens +
+                          static_cast<int64_t>(mstate->committed_tokens.size()) -
+                          mstate->num_tokens_for_next_decode;
+  if (num_kv_tokens <= 0 ||
+      estate->num_swapped_kv_tokens + num_kv_tokens > estate->max_num_swapped_kv_tokens) {
+    return false;
+  }
+  RECORD_EVENT(trace_recorder, rsentry->request->id, "swap out");
+  mstate->swapped_kv_data = models[0]->SwapOutSequence(mstate->internal_id, num_kv_tokens);
+  mstate->num_swapped_kv_tokens = num_kv_tokens;
+  estate->num_swapped_kv_tokens += num_kv_tokens;
+  return true;
+}
+
 RequestStateEntry PreemptLastRunningRequestStateEntry(
     EngineState estate, const Array<Model>& models,
     Optional<DraftTokenWorkspaceManager> draft_token_workspace_manager,
     Optional<EventTraceRecorder> trace_recorder) {
   ICHECK(!estate->running_queue.empty());
-  Request request = estate->running_queue.back();
+  int victim_idx = estate->scheduling_policy->SelectPreemptionVictim(estate->running_queue);
+  ICHECK(victim_idx >= 0 && victim_idx < static_cast<int>(estate->running_queue.size()));
+  Request request = estate->running_queue[victim_idx];
 
   // Find the last alive request state entry, which is what we want to preempt.
   RequestState rstate = estate->GetRequestState(request);
@@ -318,14 +488,25 @@ RequestStateEntry PreemptLastRunningRequestStateEntry(
   // Remove from models.
   // - Clear model speculation draft.
   // - Update `inputs` for future prefill.
+  // - Swap out the KV data to host memory when possible, in which case
+  //   the inputs are kept empty and the entry is resumed by swap-in.
   RECORD_EVENT(trace_recorder, rsentry->request->id, "preempt");
   rsentry->status = RequestStateStatus::kPending;
+  // The partial embedding of an embedding request is recomputed with its prompt.
+  rsentry->embedding.clear();
+  bool swapped_out =
+      TrySwapOutRequestStateEntry(estate, models, rsentry, partially_alive, trace_recorder);
   std::vector<int> draft_token_slots;
   for (RequestModelState mstate : rsentry->mstates) {
     if (draft_token_workspace_manager.defined()) {
       mstate->RemoveAllDraftTokens(&draft_token_slots);
       draft_token_workspace_manager.value()->FreeSlots(draft_token_slots);
     }
+    if (swapped_out) {
+      mstate->prefilled_inputs.clear();
+      mstate->cached_committed_tokens = 0;
+      continue;
+    }
 
     // If the commited tokens of the current model lags behind the
     // committed tokens of the main model (models[0]), we commit those
@@ -375,7 +556,7 @@ RequestStateEntry PreemptLastRunningRequestStateEntry(
 
   if (preempt_rstate_idx == 0) {
     // Remove from running queue.
-    estate->running_queue.erase(estate->running_queue.end() - 1);
+    estate->running_queue.erase(estate->running_queue.begin() + victim_idx);
   }
   if (!partially_alive && preempt_rstate_idx == static_cast<int>(rstate->entries.size()) - 1) {
     // Add to the front of waiting queue.
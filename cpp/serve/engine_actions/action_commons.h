@@ -8,6 +8,8 @@
 
 #include <tvm/runtime/container/array.h>
 
+#include <functional>
+
 #include "../../tokenizers/tokenizers.h"
 #include "../draft_token_workspace_manager.h"
 #include "../engine.h"
@@ -31,6 +33,48 @@ Array<EngineAction> CreateEngineActions(Array<Model> models, EngineConfig engine
                                         Tokenizer tokenizer,
                                         Optional<EventTraceRecorder> trace_recorder);
 
+/*!
+ * \brief Look up the prompt lookup draft tokens of a request, which are the tokens following
+ * the latest earlier occurrence of the last n-gram of the history tokens. The longer n-grams
+ * are tried first.
+ * \param history_tokens The prompt and committed tokens of the request, where -1 stands for
+ * the non-token data that break the n-grams.
+ * \param max_num_draft_tokens The max number of draft tokens to propose.
+ * \param draft_tokens The proposed draft tokens.
+ * \return The number of proposed draft tokens.
+ */
+int LookupPromptDraftTokens(const std::vector<int32_t>& history_tokens, int max_num_draft_tokens,
+                            std::vector<int32_t>* draft_tokens);
+
+/*!
+ * \brief Check if the verification optimistically feeds the last draft tokens into the draft
+ * model, which applies to the chain drafts of a separate draft model.
+ * \param engine_config The engine config.
+ * \param has_draft_model Whether the drafts are proposed by a separate draft model.
+ */
+bool UseOptimisticDraft(const EngineConfig& engine_config, bool has_draft_model);
+
+/*!
+ * \brief Get the number of tokens to pop from the draft model KV cache after verifying a chain
+ * draft. The last draft token is only in the draft model KV cache when it is fed optimistically.
+ * \param verify_length The number of verified tokens, which is the draft length plus one.
+ * \param accept_length The number of accepted tokens.
+ * \param optimistic_draft Whether the last draft token is fed optimistically.
+ * \return The number of tokens to pop.
+ */
+int GetDraftModelRollbackLength(int verify_length, int accept_length, bool optimistic_draft);
+
+/*!
+ * \brief Run the given function on each request index in [0, num_requests). It runs in parallel
+ * on the TVM threading backend when there are at least `min_num_requests_for_parallel` requests
+ * and more than one thread, and runs serially in order otherwise.
+ * \param num_requests The number of requests.
+ * \param min_num_requests_for_parallel The minimum number of requests to run in parallel.
+ * \param fprocess The function to run, which must only touch the states of the given request.
+ */
+void ParallelForRequests(int num_requests, int min_num_requests_for_parallel,
+                         const std::function<void(int)>& fprocess);
+
 /*!
  * \brief Remove the given request from models.
  * \param estate The engine state to update after removal.
@@ -55,16 +99,22 @@ void RemoveRequestFromModel(EngineState estate, int64_t req_internal_id,
  * \param draft_token_workspace_manager The draft token workspace manager.
  * \param trace_recorder The event trace recorder for requests.
  * if a request is finished.
+ * \param defer_stream_callback Whether to defer the request stream callback invocation to
+ * `EngineStateObj::deferred_stream_callback`, which the next action invokes after launching
+ * its GPU work.
  */
 void ActionStepPostProcess(Array<Request> requests, EngineState estate, const Array<Model>& models,
                            const Tokenizer& tokenizer,
                            FRequestStreamCallback request_stream_callback,
                            int64_t max_single_sequence_length,
                            Optional<DraftTokenWorkspaceManager> draft_token_workspace_manager,
-                           Optional<EventTraceRecorder> trace_recorder);
+                           Optional<EventTraceRecorder> trace_recorder,
+                           bool defer_stream_callback = false);
 
 /*!
- * \brief Preempt the last running request state entry from `running_queue`.
+ * \brief Preempt the last running request state entry of the request selected by
+ * the engine scheduling policy from `running_queue`. By default (FCFS), the
+ * selected request is the last one in `running_queue`.
  * If all entries of the selected request have been preempted,
  * remove it from running request.
  * If it is not in the waiting request queue, add it to the waiting queue.
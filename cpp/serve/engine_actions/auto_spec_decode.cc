@@ -5,6 +5,7 @@
 
 #include <tvm/runtime/nvtx.h>
 
+#include <algorithm>
 #include <numeric>
 
 #include "../config.h"
@@ -17,6 +18,9 @@ namespace serve {
 /*!
  * \brief The action that first makes a decision on whether to run speculative
  * decoding or normal mode batch decode, and then runs the selected actions.
+ * Besides the draft length table of the adaptive draft length, the decision
+ * follows a live cost model of the measured draft, verify and decode times,
+ * so that speculative decoding is skipped in the steps where it is slower.
  */
 class AutoSpecDecodeActionObj : public EngineActionObj {
  public:
@@ -27,15 +31,24 @@ class AutoSpecDecodeActionObj : public EngineActionObj {
         batch_decode_actions_(std::move(batch_decode_actions)),
         engine_config_(std::move(engine_config)) {}
 
+  String Name() const final { return "auto_spec_decode"; }
+
   Array<Request> Step(EngineState estate) final {
-    int num_running_rsentries = estate->GetRunningRequestStateEntries().size();
-    if (num_running_rsentries == 0) {
+    std::vector<RequestStateEntry> running_rsentries = estate->GetRunningRequestStateEntries();
+    if (running_rsentries.empty()) {
       return {};
     }
 
     // Calculate the draft length to use for the next round decode.
-    estate->spec_draft_length = CalculateDraftLength(estate, num_running_rsentries);
+    // A positive draft length in the engine config is a fixed draft length.
+    estate->spec_draft_length = engine_config_->spec_draft_length > 0
+                                    ? engine_config_->spec_draft_length
+                                    : CalculateDraftLength(estate, running_rsentries);
     ICHECK_GE(estate->spec_draft_length, 0);
+    if (estate->spec_draft_length > 0 && engine_config_->spec_auto_disable &&
+        !SpecDecodeIsFaster(estate, running_rsentries)) {
+      estate->spec_draft_length = 0;
+    }
     Array<Request> processed_requests;
     // Use speculative decoding when the computed draft length is positive.
     // Otherwise use normal mode batch decode.
@@ -46,29 +59,155 @@ class AutoSpecDecodeActionObj : public EngineActionObj {
     }
 
     // Reset the draft length.
-    estate->spec_draft_length = 0;
+    estate->spec_draft_length = std::max(engine_config_->spec_draft_length, 0);
     return processed_requests;
   }
 
  private:
-  int CalculateDraftLength(EngineState estate, int num_running_rsentries) {
-    // Right now we use the fixed table to select the draft length (only based on
-    // the batch size). We will follow up to adopt powerful draft length selection.
-    int draft_length = 0;
+  /*!
+   * \brief Calculate the draft length of each running request for the next round decode,
+   * and return the max draft length of the requests.
+   */
+  int CalculateDraftLength(EngineState estate,
+                           const std::vector<RequestStateEntry>& running_rsentries) {
+    // The fixed table selects the default draft length by the batch size.
+    int num_running_rsentries = running_rsentries.size();
+    int default_draft_length = 0;
     if (num_running_rsentries < 10) {
-      draft_length = 4;
+      default_draft_length = 4;
     } else if (num_running_rsentries < 20) {
-      draft_length = 3;
+      default_draft_length = 3;
     } else if (num_running_rsentries < 30) {
-      draft_length = 2;
+      default_draft_length = 2;
     } else {
-      draft_length = 0;
+      default_draft_length = 0;
+    }
+    if (default_draft_length == 0) {
+      return 0;
+    }
+
+    // Each request then drafts as long as its next draft token is likely to be accepted
+    // according to its recent acceptance rate. Requests without enough verified drafts
+    // use the default draft length.
+    int max_draft_length = 0;
+    int effective_batch_size = 0;
+    for (const RequestStateEntry& rsentry : running_rsentries) {
+      RequestModelState mstate = rsentry->mstates[draft_model_id_];
+      int draft_length = default_draft_length;
+      double accept_rate = mstate->GetSpecAcceptRate();
+      if (accept_rate >= 0) {
+        draft_length = 0;
+        double accept_prob = accept_rate;
+        while (draft_length < default_draft_length * 2 && accept_prob >= kMinDraftAcceptProb) {
+          ++draft_length;
+          accept_prob *= accept_rate;
+        }
+      }
+      if (draft_length == 0) {
+        // The counts of a request skipping drafting decay as if verifying empty drafts,
+        // so that the request drafts with the default draft length again later.
+        mstate->UpdateSpecAcceptRate(/*draft_depth=*/0, /*num_accepted=*/0);
+      }
+      mstate->spec_draft_length = draft_length;
+      max_draft_length = std::max(max_draft_length, draft_length);
+      effective_batch_size += draft_length + 1;
     }
 
-    int effective_batch_size = num_running_rsentries * (draft_length + 1);
-    return effective_batch_size > engine_config_->max_num_sequence ? 0 : draft_length;
+    return effective_batch_size > engine_config_->max_num_sequence ? 0 : max_draft_length;
+  }
+
+  /*!
+   * \brief Check with the cost model of the measured step times whether speculative decoding
+   * with the draft length in the engine state commits tokens faster than normal mode batch
+   * decode. The mode whose step time is not measured yet for the current batch size is picked,
+   * so that the decision follows the measurements afterwards.
+   */
+  bool SpecDecodeIsFaster(EngineState estate,
+                          const std::vector<RequestStateEntry>& running_rsentries) {
+    const EngineMetrics& metrics = estate->metrics;
+    const SpecDecodeMetrics& spec_metrics = metrics.spec_decode;
+    int batch_size = running_rsentries.size();
+    int max_draft_length = estate->spec_draft_length;
+    bool tree_mode = engine_config_->spec_tree_width > 1;
+
+    // The number of tokens to verify and the expected number of committed tokens in the step.
+    int effective_batch_size = 0;
+    double expected_num_tokens = 0;
+    for (const RequestStateEntry& rsentry : running_rsentries) {
+      RequestModelState mstate = rsentry->mstates[draft_model_id_];
+      int draft_length = mstate->spec_draft_length >= 0
+                             ? std::min(mstate->spec_draft_length, max_draft_length)
+                             : max_draft_length;
+      if (tree_mode) {
+        if (spec_metrics.num_trees == 0) {
+          return true;
+        }
+        effective_batch_size += 1 + spec_metrics.tree_draft_tokens / spec_metrics.num_trees;
+        expected_num_tokens +=
+            static_cast<double>(spec_metrics.tree_accept_tokens) / spec_metrics.num_trees;
+        continue;
+      }
+      effective_batch_size += draft_length + 1;
+      // The base model prediction is always committed. The j-th draft token is committed
+      // when all the draft tokens up to it are accepted.
+      double accept_rate = mstate->GetSpecAcceptRate();
+      // Requests without a recent acceptance rate use the global acceptance by draft position.
+      double accept_prob = 1.0;
+      expected_num_tokens += accept_prob;
+      for (int j = 1; j <= draft_length; ++j) {
+        if (accept_rate >= 0) {
+          accept_prob *= accept_rate;
+        } else if (j < static_cast<int>(spec_metrics.draft_count.size()) &&
+                   spec_metrics.draft_count[j] > 0) {
+          accept_prob = static_cast<double>(spec_metrics.accept_count[j]) /
+                        spec_metrics.draft_count[j];
+        } else {
+          return true;
+        }
+        expected_num_tokens += accept_prob;
+      }
+    }
+
+    double draft_time = EstimateStepTime(metrics.draft_time_by_batch_size, batch_size);
+    double verify_time = EstimateStepTime(metrics.verify_time_by_batch_size, effective_batch_size);
+    if (draft_time < 0 || verify_time < 0) {
+      return true;
+    }
+    int decode_index =
+        std::min(batch_size, static_cast<int>(EngineMetrics::kEndFineGrainedTrackingBatchSize) - 1);
+    if (metrics.decode_time_by_batch_size[decode_index].count == 0) {
+      return false;
+    }
+    double decode_time = EstimateStepTime(metrics.decode_time_by_batch_size, batch_size);
+    // Compare the committed tokens per second of the two modes.
+    double spec_time = max_draft_length * draft_time + verify_time;
+    return expected_num_tokens * decode_time >= batch_size * spec_time;
+  }
+
+  /*!
+   * \brief Estimate the step time of the given batch size from the measured times by batch size.
+   * The measurement of the nearest smaller batch size is used when the batch size is not
+   * measured, and is scaled by the batch size beyond the largest tracked batch size.
+   * \return The estimated step time in seconds, or -1 if there is no measurement.
+   */
+  static double EstimateStepTime(const std::vector<TimeCost>& time_by_batch_size,
+                                 int batch_size) {
+    int max_tracked_batch_size =
+        static_cast<int>(EngineMetrics::kEndFineGrainedTrackingBatchSize) - 1;
+    for (int i = std::min(batch_size, max_tracked_batch_size); i > 0; --i) {
+      const TimeCost& time_cost = time_by_batch_size[i];
+      if (time_cost.count > 0) {
+        double time = time_cost.sum / time_cost.count;
+        return batch_size > max_tracked_batch_size ? time * batch_size / i : time;
+      }
+    }
+    return -1;
   }
 
+  /*! \brief The min acceptance probability of a draft token worth drafting. */
+  static constexpr double kMinDraftAcceptProb = 0.3;
+  /*! \brief The id of the draft model, whose states hold the acceptance rates. */
+  const int draft_model_id_ = 1;
   /*! \brief The speculative decode actions. */
   Array<EngineAction> spec_decode_actions_;
   /*! \brief The normal mode decode actions. */
@@ -13,6 +13,7 @@
 #include "../sampler/sampler.h"
 #include "action.h"
 #include "action_commons.h"
+#include "beam_search.h"
 
 namespace mlc {
 namespace llm {
@@ -39,6 +40,8 @@ class BatchDecodeActionObj : public EngineActionObj {
         engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)) {}
 
+  String Name() const final { return "batch_decode"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Do not run decode when there is no running request.
     if (estate->running_queue.empty()) {
@@ -54,8 +57,9 @@ class BatchDecodeActionObj : public EngineActionObj {
         if (estate->prefix_cache->TryFreeMemory()) continue;
         RequestStateEntry preempted =
             PreemptLastRunningRequestStateEntry(estate, models_, NullOpt, trace_recorder_);
-        if (preempted.same_as(running_rsentries.back())) {
-          running_rsentries.pop_back();
+        auto it = std::find(running_rsentries.begin(), running_rsentries.end(), preempted);
+        if (it != running_rsentries.end()) {
+          running_rsentries.erase(it);
         }
       }
     }
@@ -71,31 +75,25 @@ class BatchDecodeActionObj : public EngineActionObj {
         << "The number of running requests exceeds the max number of sequence in EngineConfig. "
            "Possible failure reason: the prefill action allows new sequence in regardless of the "
            "max num sequence.";
-    // Collect
-    // - the last committed token,
-    // - the request id,
-    // - the generation config,
-    // - the random number generator,
-    // of each request state entry.
+    // Copy the request ids, the internal ids, the generation configs and the random number
+    // generators from the running request table, which is only rebuilt when the running
+    // entries change, and collect the last committed tokens of each request state entry.
+    const RunningRequestTable& running_table = estate->GetRunningRequestTable();
+    ICHECK_EQ(static_cast<int>(running_table.mstates.size()), num_rsentries);
+    Array<String> request_ids = running_table.request_ids;
+    std::vector<int64_t> request_internal_ids = running_table.request_internal_ids;
+    Array<RequestModelState> mstates = running_table.mstates;
+    Array<GenerationConfig> generation_cfg = running_table.generation_cfg;
+    const std::vector<RandomGenerator*>& rngs = running_table.rngs;
+    bool use_lora = running_table.use_lora;
     std::vector<int> input_tokens;
     std::vector<int> lengths;
-    Array<String> request_ids;
-    std::vector<int64_t> request_internal_ids;
-    Array<RequestModelState> mstates;
-    Array<GenerationConfig> generation_cfg;
-    std::vector<RandomGenerator*> rngs;
-
     input_tokens.reserve(num_rsentries);
-    request_ids.reserve(num_rsentries);
-    request_internal_ids.reserve(num_rsentries);
-    mstates.reserve(num_rsentries);
-    generation_cfg.reserve(num_rsentries);
-    rngs.reserve(num_rsentries);
+    lengths.reserve(num_rsentries);
 
     {
       NVTXScopedRange nvtx_scope("BatchDecode setting batch info");
-      for (const RequestStateEntry& rsentry : running_rsentries) {
-        auto mstate = rsentry->mstates[0];
+      for (RequestModelState mstate : mstates) {
         ICHECK(mstate->num_tokens_for_next_decode > 0 &&
                mstate->num_tokens_for_next_decode <=
                    static_cast<int>(mstate->committed_tokens.size()));
@@ -107,15 +105,35 @@ class BatchDecodeActionObj : public EngineActionObj {
 
         lengths.push_back(mstate->num_tokens_for_next_decode);
         mstate->num_tokens_for_next_decode = 0;
+      }
+    }
 
-        request_ids.push_back(rsentry->request->id);
-        request_internal_ids.push_back(mstate->internal_id);
-        mstates.push_back(mstate);
-        generation_cfg.push_back(rsentry->request->generation_cfg);
-        rngs.push_back(&rsentry->rng);
+    // If every request only requires to process one token, batch decode kernel is called.
+    // Otherwise, batch prefill kernel is called.
+    bool is_every_request_single_token =
+        std::all_of(lengths.begin(), lengths.end(), [](int len) { return len == 1; });
+    int num_decode_steps = 1;
+    if (is_every_request_single_token) {
+      // - Pad the batch to the decode batch size bucket with padding sequences,
+      // whose logits are discarded.
+      std::vector<int64_t> padding_seq_ids =
+          models_[0]->GetDecodePaddingSequenceIds(num_rsentries);
+      input_tokens.resize(input_tokens.size() + padding_seq_ids.size(), 0);
+      request_internal_ids.insert(request_internal_ids.end(), padding_seq_ids.begin(),
+                                  padding_seq_ids.end());
+      if (padding_seq_ids.empty() && !use_lora) {
+        num_decode_steps = GetNumDecodeSteps(running_rsentries, generation_cfg);
       }
     }
 
+    // - Run multiple decode steps without host synchronization when applicable.
+    if (num_decode_steps > 1) {
+      MultiStepDecode(estate, running_rsentries, input_tokens, request_internal_ids, request_ids,
+                      mstates, generation_cfg, rngs, num_decode_steps);
+      UpdateDecodeTime(estate, tstart, num_rsentries, num_decode_steps);
+      return estate->running_queue;
+    }
+
     // - Compute embeddings.
     RECORD_EVENT(trace_recorder_, request_ids, "start embedding");
     ObjectRef embeddings =
@@ -123,16 +141,15 @@ class BatchDecodeActionObj : public EngineActionObj {
     RECORD_EVENT(trace_recorder_, request_ids, "finish embedding");
 
     // - Invoke model decode.
-    // If every request only requires to process one token, batch decode kernel is called.
-    // Otherwise, batch prefill kernel is called.
-    bool is_every_request_single_token =
-        std::all_of(lengths.begin(), lengths.end(), [](int len) { return len == 1; });
     RECORD_EVENT(trace_recorder_, request_ids, "start decode");
+    if (use_lora) {
+      models_[0]->SetBatchLoRAAdapters(running_table.lora_adapter_indices);
+    }
     NDArray logits;
     if (is_every_request_single_token) {
       logits = models_[0]->BatchDecode(embeddings, request_internal_ids);
       ICHECK_EQ(logits->ndim, 3);
-      ICHECK_EQ(logits->shape[0], num_rsentries);
+      ICHECK_EQ(logits->shape[0], request_internal_ids.size());
       ICHECK_EQ(logits->shape[1], 1);
     } else {
       logits = models_[0]->BatchPrefill(embeddings, request_internal_ids, lengths);
@@ -153,16 +170,23 @@ class BatchDecodeActionObj : public EngineActionObj {
     // - Commit the prefix cache changes from previous round of action.
     // Note: we commit prefix cache changes here to overlap this commit with the GPU execution.
     estate->prefix_cache->CommitSequenceExtention();
+    // - Invoke the deferred stream callback of previous step, also overlapping with the GPU.
+    estate->InvokeDeferredStreamCallback();
 
     // - Sample tokens.
-    // Fill range [0, num_rsentries) into `sample_indices`.
-    std::vector<int> sample_indices(num_rsentries);
-    std::iota(sample_indices.begin(), sample_indices.end(), 0);
+    // Fill range [0, num_rsentries) into `sample_indices_`, which is kept across the steps of
+    // the same batch size, so that the steady decode steps build no index array.
+    if (static_cast<int>(sample_indices_.size()) != num_rsentries) {
+      sample_indices_.resize(num_rsentries);
+      std::iota(sample_indices_.begin(), sample_indices_.end(), 0);
+    }
     NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
-        probs_on_device, sample_indices, request_ids, generation_cfg);
+        probs_on_device, sample_indices_, request_ids, generation_cfg);
     std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
-        renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
+        renormalized_probs, sample_indices_, request_ids, generation_cfg, rngs);
     ICHECK_EQ(sample_results.size(), num_rsentries);
+    SelectBeamSearchTokens(estate, models_, running_rsentries, sample_indices_, &sample_results,
+                           engine_config_->max_single_sequence_length);
 
     // - Update the committed tokens of states.
     for (int i = 0; i < num_rsentries; ++i) {
@@ -180,7 +204,17 @@ class BatchDecodeActionObj : public EngineActionObj {
 
       running_rsentries[i]->rstate->metrics.decode_tokens += lengths[i];
     }
+    FinalizeBeamSearch(running_rsentries);
 
+    UpdateDecodeTime(estate, tstart, num_rsentries, /*num_decode_steps=*/1);
+    return estate->running_queue;
+  }
+
+ private:
+  /*! \brief Update the decode time metrics with the time since the start of the decode. */
+  void UpdateDecodeTime(EngineState estate,
+                        std::chrono::high_resolution_clock::time_point tstart, int num_rsentries,
+                        int num_decode_steps) {
     double elapsed_time;
     {
       NVTXScopedRange nvtx_scope("BatchDecode get time");
@@ -188,16 +222,168 @@ class BatchDecodeActionObj : public EngineActionObj {
       elapsed_time = static_cast<double>((tend - tstart).count()) / 1e9;
     }
     estate->metrics.engine_decode_time_sum += elapsed_time;
-    estate->metrics.UpdateDecodeTimeByBatchSize(num_rsentries, elapsed_time);
+    // The decode time by batch size is the time of a single decode step.
+    estate->metrics.UpdateDecodeTimeByBatchSize(num_rsentries, elapsed_time / num_decode_steps);
+  }
 
-    return estate->running_queue;
+  /*!
+   * \brief Return the number of decode steps to run back-to-back for the running request
+   * state entries, which is 1 when any of the entries needs its tokens on host in every step,
+   * or when the KV cache cannot hold the tokens of the steps.
+   */
+  int GetNumDecodeSteps(const std::vector<RequestStateEntry>& rsentries,
+                        const Array<GenerationConfig>& generation_cfg) {
+    int num_decode_steps = engine_config_->num_decode_steps;
+    if (num_decode_steps <= 1 || !sampler_->SupportSampleOnDevice()) {
+      return 1;
+    }
+    // The tokens sampled on device are embedded on device, and the KV data of the steps
+    // after an entry finishes are popped, which a single-worker KV cache supports.
+    ModelMetadata metadata = models_[0]->GetMetadata();
+    if (metadata.tensor_parallel_shards != 1 || metadata.pipeline_parallel_stages != 1 ||
+        metadata.kv_state_kind != KVStateKind::kKVCache ||
+        models_[0]->GetSlidingWindowSize() != -1) {
+      return 1;
+    }
+    int num_rsentries = rsentries.size();
+    for (int i = 0; i < num_rsentries; ++i) {
+      const GenerationConfig& cfg = generation_cfg[i];
+      const RequestModelState& mstate = rsentries[i]->mstates[0];
+      if (!cfg->stop_strs.empty() || mstate->grammar_state_matcher.defined() || cfg->logprobs ||
+          cfg->use_beam_search || !cfg->logit_bias.empty() || cfg->frequency_penalty != 0.0 ||
+          cfg->presence_penalty != 0.0 || cfg->repetition_penalty != 1.0 ||
+          mstate->require_retokenization_in_next_decode) {
+        return 1;
+      }
+      // Every step extends the KV cache, including the steps after the entry finishes.
+      int64_t num_tokens_to_max_length = engine_config_->max_single_sequence_length -
+                                         rsentries[i]->request->prompt_tokens -
+                                         static_cast<int64_t>(mstate->committed_tokens.size());
+      num_decode_steps = std::min<int64_t>(num_decode_steps, num_tokens_to_max_length);
+    }
+    int page_size = engine_config_->kv_cache_page_size;
+    int num_required_pages = num_rsentries * ((num_decode_steps + page_size - 1) / page_size);
+    if (num_decode_steps <= 1 || num_required_pages > models_[0]->GetNumAvailablePages()) {
+      return 1;
+    }
+    return num_decode_steps;
+  }
+
+  /*!
+   * \brief Run the given number of decode steps back-to-back, and commit the tokens of all
+   * the steps after a single host synchronization at the end. The tokens sampled in a step
+   * are embedded on device as the inputs of the next step, and the stop conditions are
+   * checked on device. The entries finished in an earlier step keep decoding till the last
+   * step, and their KV data of the tokens after the finish are popped afterwards.
+   */
+  void MultiStepDecode(EngineState estate, const std::vector<RequestStateEntry>& rsentries,
+                       const std::vector<int>& input_tokens,
+                       const std::vector<int64_t>& request_internal_ids,
+                       const Array<String>& request_ids, const Array<RequestModelState>& mstates,
+                       const Array<GenerationConfig>& generation_cfg,
+                       const std::vector<RandomGenerator*>& rngs, int num_decode_steps) {
+    NVTXScopedRange nvtx_scope("BatchDecode multi-step decode");
+    int num_rsentries = rsentries.size();
+    std::vector<int> sample_indices(num_rsentries);
+    std::iota(sample_indices.begin(), sample_indices.end(), 0);
+    // The number of tokens each entry can generate, including the token of the current step.
+    std::vector<int> num_remaining_tokens(num_rsentries);
+    for (int i = 0; i < num_rsentries; ++i) {
+      int64_t num_committed_tokens = mstates[i]->committed_tokens.size();
+      int64_t num_tokens = engine_config_->max_single_sequence_length -
+                           rsentries[i]->request->prompt_tokens - num_committed_tokens;
+      if (generation_cfg[i]->max_tokens >= 0) {
+        num_tokens = std::min(num_tokens, generation_cfg[i]->max_tokens - num_committed_tokens);
+      }
+      num_remaining_tokens[i] = num_tokens;
+    }
+
+    // The token ids and the finished masks of each step on device, in order.
+    std::vector<NDArray> device_arrays;
+    device_arrays.reserve(num_decode_steps * 2);
+    NDArray sampled_token_ids_on_device{nullptr};
+    for (int step = 0; step < num_decode_steps; ++step) {
+      // - Compute embeddings.
+      RECORD_EVENT(trace_recorder_, request_ids, "start embedding");
+      ObjectRef embeddings =
+          step == 0 ? models_[0]->TokenEmbed({IntTuple(input_tokens.begin(), input_tokens.end())})
+                    : models_[0]->TokenEmbedOnDevice(sampled_token_ids_on_device);
+      ICHECK(embeddings.defined());
+      RECORD_EVENT(trace_recorder_, request_ids, "finish embedding");
+
+      // - Invoke model decode.
+      RECORD_EVENT(trace_recorder_, request_ids, "start decode");
+      NDArray logits = models_[0]->BatchDecode(embeddings, request_internal_ids);
+      ICHECK_EQ(logits->ndim, 3);
+      ICHECK_EQ(logits->shape[0], num_rsentries);
+      ICHECK_EQ(logits->shape[1], 1);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish decode");
+
+      // - Update logits, which only depends on the committed tokens in the first step,
+      // since the entries use neither penalties nor logit bias.
+      logits = logits.CreateView({num_rsentries, logits->shape[2]}, logits->dtype);
+      if (step == 0) {
+        logit_processor_->InplaceUpdateLogits(logits, generation_cfg, mstates, request_ids);
+      }
+
+      // - Compute probability distributions.
+      NDArray probs_on_device =
+          logit_processor_->ComputeProbsFromLogits(logits, generation_cfg, request_ids);
+
+      if (step == 0) {
+        // - Commit the prefix cache changes from previous round of action, and invoke the
+        // deferred stream callback of previous step, overlapping with the GPU execution.
+        estate->prefix_cache->CommitSequenceExtention();
+        estate->InvokeDeferredStreamCallback();
+      }
+
+      // - Sample tokens and check the stop conditions on device.
+      NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
+          probs_on_device, sample_indices, request_ids, generation_cfg);
+      sampled_token_ids_on_device = sampler_->BatchSampleTokensOnDevice(
+          renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
+      NDArray finished_on_device =
+          sampler_->BatchCheckStopOnDevice(generation_cfg, num_remaining_tokens);
+      ICHECK(finished_on_device.defined());
+      device_arrays.push_back(sampled_token_ids_on_device);
+      device_arrays.push_back(finished_on_device);
+      for (int& num_tokens : num_remaining_tokens) {
+        --num_tokens;
+      }
+    }
+
+    // - Copy the results of all the steps to host, and commit the tokens of each entry until
+    // it finishes.
+    std::vector<std::vector<int32_t>> host_arrays = sampler_->CopyInt32ArraysToHost(device_arrays);
+    for (int i = 0; i < num_rsentries; ++i) {
+      RequestModelState mstate = mstates[i];
+      int num_committed_steps = 0;
+      while (num_committed_steps < num_decode_steps) {
+        const std::vector<int32_t>& token_ids = host_arrays[num_committed_steps * 2];
+        const std::vector<int32_t>& finished = host_arrays[num_committed_steps * 2 + 1];
+        mstate->CommitToken({{token_ids[i], 1.0}, {}});
+        ++num_committed_steps;
+        if (finished[i]) {
+          break;
+        }
+      }
+      rsentries[i]->rstate->metrics.completion_tokens += num_committed_steps;
+      rsentries[i]->rstate->metrics.decode_tokens += num_committed_steps;
+      // The KV cache holds the inputs of all the steps, i.e., all the committed tokens but the
+      // last one, plus the tokens decoded after the entry finishes.
+      if (num_committed_steps < num_decode_steps) {
+        models_[0]->PopNFromKVCache(mstate->internal_id, num_decode_steps - num_committed_steps);
+      }
+      mstate->num_tokens_for_next_decode = 1;
+    }
   }
 
- private:
   /*! \brief Check if the input request state entries can be decoded under conditions. */
   bool CanDecode(int num_rsentries) {
     int num_available_pages = models_[0]->GetNumAvailablePages();
-    return num_rsentries <= num_available_pages;
+    // The padding sequences of the decode batch size bucket also take one page each.
+    int num_padding_seqs = models_[0]->GetNumDecodePaddingSequences(num_rsentries);
+    return num_rsentries + num_padding_seqs <= num_available_pages;
   }
 
   /*!
@@ -306,6 +492,8 @@ class BatchDecodeActionObj : public EngineActionObj {
   Optional<EventTraceRecorder> trace_recorder_;
   /*! \brief The maximum number of tokens to retokenize and may be rolled back. */
   const int MAX_ROLLBACK_TOKENS_ = 10;
+  /*! \brief The sample indices [0, batch size) of the last decode step. */
+  std::vector<int> sample_indices_;
 };
 
 EngineAction EngineAction::BatchDecode(Array<Model> models, Tokenizer tokenizer,
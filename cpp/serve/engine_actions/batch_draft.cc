@@ -3,7 +3,9 @@
  * \file serve/engine_actions/batch_draft.cc
  */
 
+#include <algorithm>
 #include <numeric>
+#include <tuple>
 
 #include "../config.h"
 #include "../model.h"
@@ -35,6 +37,8 @@ class BatchDraftActionObj : public EngineActionObj {
         engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)) {}
 
+  String Name() const final { return "batch_draft"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
     if (models_.size() != 2 || estate->running_queue.empty()) {
@@ -47,9 +51,30 @@ class BatchDraftActionObj : public EngineActionObj {
       if (estate->prefix_cache->TryFreeMemory()) continue;
       RequestStateEntry preempted = PreemptLastRunningRequestStateEntry(
           estate, models_, draft_token_workspace_manager_, trace_recorder_);
-      if (preempted.same_as(running_rsentries.back())) {
-        running_rsentries.pop_back();
+      auto it = std::find(running_rsentries.begin(), running_rsentries.end(), preempted);
+      if (it != running_rsentries.end()) {
+        running_rsentries.erase(it);
+      }
+    }
+
+    // The request state entries with zero draft length skip the draft proposal, and are
+    // decoded by the verification alone.
+    std::vector<int> draft_lengths;
+    {
+      std::vector<RequestStateEntry> draft_rsentries;
+      draft_rsentries.reserve(running_rsentries.size());
+      draft_lengths.reserve(running_rsentries.size());
+      for (const RequestStateEntry& rsentry : running_rsentries) {
+        int draft_length = GetDraftLength(estate, rsentry);
+        if (draft_length > 0) {
+          draft_rsentries.push_back(rsentry);
+          draft_lengths.push_back(draft_length);
+        }
+      }
+      if (draft_rsentries.empty()) {
+        return {};
       }
+      running_rsentries = std::move(draft_rsentries);
     }
 
     auto tstart = std::chrono::high_resolution_clock::now();
@@ -86,6 +111,10 @@ class BatchDraftActionObj : public EngineActionObj {
 
     ICHECK_GT(estate->spec_draft_length, 0)
         << "The speculative decoding draft length must be positive.";
+    // Under the dynamic tree shape, each round only expands the draft tokens with the
+    // highest path probabilities, within the per-step token budget of each request.
+    const bool dynamic_tree =
+        engine_config_->spec_tree_width > 1 && engine_config_->spec_tree_token_budget > 0;
     // The first model doesn't get involved in draft proposal.
     for (int model_id = 1; model_id < static_cast<int>(models_.size()); ++model_id) {
       // Collect
@@ -97,6 +126,9 @@ class BatchDraftActionObj : public EngineActionObj {
       std::vector<int> input_tokens;
       Array<RequestModelState> mstates;
       std::vector<int> input_lengths;
+      // The index of the first draft token added in the last round of each request.
+      // The draft tokens added in the last round are the inputs of the current round.
+      std::vector<int> last_round_begin(num_rsentries, 0);
       input_tokens.reserve(num_rsentries);
       mstates.reserve(num_rsentries);
       input_lengths.reserve(num_rsentries);
@@ -164,23 +196,29 @@ class BatchDraftActionObj : public EngineActionObj {
             request_ids_per_leaf_node.push_back(request_ids[i]);
             num_leaf_nodes = 1;
             cum_num_tokens.push_back(cum_num_tokens.back() + 1);
+          } else if (draft_id >= draft_lengths[i]) {
+            // This request entry has finished its draft proposal.
+            draft_token_indices.emplace_back(std::vector<int>{});
+            input_lengths.push_back(0);
+            cum_num_tokens.push_back(cum_num_tokens.back());
           } else {
             CHECK_EQ(mstates[i]->committed_tokens.size(),
                      running_rsentries[i]->mstates[0]->committed_tokens.size());
             ICHECK(!mstates[i]->draft_output_tokens.empty());
             draft_token_indices.emplace_back(std::vector<int>{});
-            // Get all leaf nodes
-            for (int j = 0; j < static_cast<int>(mstates[i]->draft_output_tokens.size()); ++j) {
-              if (mstates[i]->draft_token_first_child_idx[j] == -1) {
-                int64_t parent_idx = mstates[i]->draft_token_parent_idx[j];
-                token_tree_parent_ptr.push_back(parent_idx);
-                input_tokens.push_back(mstates[i]->draft_output_tokens[j].GetTokenId());
-                draft_token_indices.back().push_back(j);
-                rngs.push_back(&running_rsentries[i]->rng);
-                num_leaf_nodes++;
-                request_ids_per_leaf_node.push_back(request_ids[i]);
-                draft_token_parent_idx.push_back(j);
-              }
+            // Get the leaf nodes added in the last round. Under the fixed tree shape they are
+            // all the leaf nodes. Under the dynamic tree shape, a request may have no new leaf
+            // node when its token budget runs out.
+            for (int j = last_round_begin[i];
+                 j < static_cast<int>(mstates[i]->draft_output_tokens.size()); ++j) {
+              int64_t parent_idx = mstates[i]->draft_token_parent_idx[j];
+              token_tree_parent_ptr.push_back(parent_idx);
+              input_tokens.push_back(mstates[i]->draft_output_tokens[j].GetTokenId());
+              draft_token_indices.back().push_back(j);
+              rngs.push_back(&running_rsentries[i]->rng);
+              num_leaf_nodes++;
+              request_ids_per_leaf_node.push_back(request_ids[i]);
+              draft_token_parent_idx.push_back(j);
             }
             input_lengths.push_back(num_leaf_nodes);
             cum_num_tokens.push_back(cum_num_tokens.back() + input_lengths.back());
@@ -202,6 +240,22 @@ class BatchDraftActionObj : public EngineActionObj {
           generation_cfg_for_logitproc.push_back(generation_cfg_for_draft);
         }
 
+        if (input_tokens.empty()) {
+          // All the requests finish their draft proposal or run out of their token budgets.
+          break;
+        }
+        // The request entries without input tokens skip the model forward in this round.
+        std::vector<int64_t> forward_internal_ids;
+        std::vector<int> forward_lengths;
+        forward_internal_ids.reserve(num_rsentries);
+        forward_lengths.reserve(num_rsentries);
+        for (int i = 0; i < num_rsentries; ++i) {
+          if (input_lengths[i] > 0) {
+            forward_internal_ids.push_back(request_internal_ids[i]);
+            forward_lengths.push_back(input_lengths[i]);
+          }
+        }
+
         // - Compute embeddings.
         RECORD_EVENT(trace_recorder_, request_ids, "start proposal embedding");
         ICHECK_LE(input_tokens.size(), engine_config_->prefill_chunk_size);
@@ -213,13 +267,20 @@ class BatchDraftActionObj : public EngineActionObj {
         RECORD_EVENT(trace_recorder_, request_ids, "start proposal decode");
         NDArray logits{nullptr};
 
-        if (input_tokens.size() == num_rsentries) {
+        if (draft_id > 0 && engine_config_->spec_tree_width > 1) {
+          logits = models_[model_id]->BatchTreeDecode(embeddings, forward_internal_ids,
+                                                      forward_lengths, token_tree_parent_ptr);
+          ICHECK_EQ(logits->ndim, 3);
+          ICHECK_EQ(logits->shape[0], cum_num_tokens.back());
+          ICHECK_EQ(logits->shape[1], 1);
+        } else if (input_tokens.size() == forward_internal_ids.size()) {
           // Each request entry only has one token to feed into the draft model.
-          logits = models_[model_id]->BatchDecode(embeddings, request_internal_ids);
+          logits = models_[model_id]->BatchDecode(embeddings, forward_internal_ids);
           ICHECK_EQ(logits->ndim, 3);
-          ICHECK_EQ(logits->shape[0], num_rsentries);
+          ICHECK_EQ(logits->shape[0], static_cast<int64_t>(forward_internal_ids.size()));
           ICHECK_EQ(logits->shape[1], 1);
-        } else if (draft_id == 0) {
+        } else {
+          ICHECK_EQ(draft_id, 0);
           // There exists some request entry which has more than one token to feed.
           // It may happen when the engine just switches from the normal batch decode
           // mode to the speculative decoding mode.
@@ -227,13 +288,6 @@ class BatchDraftActionObj : public EngineActionObj {
           ICHECK_EQ(logits->ndim, 3);
           ICHECK_EQ(logits->shape[0], 1);
           ICHECK_EQ(logits->shape[1], num_rsentries);
-        } else {
-          ICHECK_GT(engine_config_->spec_tree_width, 1);
-          logits = models_[model_id]->BatchTreeDecode(embeddings, request_internal_ids,
-                                                      input_lengths, token_tree_parent_ptr);
-          ICHECK_EQ(logits->ndim, 3);
-          ICHECK_EQ(logits->shape[0], cum_num_tokens.back());
-          ICHECK_EQ(logits->shape[1], 1);
         }
         CHECK_EQ(input_lengths.size(), num_rsentries);
         RECORD_EVENT(trace_recorder_, request_ids, "finish proposal decode");
@@ -252,6 +306,8 @@ class BatchDraftActionObj : public EngineActionObj {
         // - Commit the prefix cache changes from previous round of action.
         // Note: we commit prefix cache changes here to overlap this commit with the GPU execution.
         estate->prefix_cache->CommitSequenceExtention();
+        // - Invoke the deferred stream callback of previous step, also overlapping with the GPU.
+        estate->InvokeDeferredStreamCallback();
 
         // - Sample tokens.
         // Fill range [0, num_rsentries) into `sample_indices`.
@@ -269,6 +325,12 @@ class BatchDraftActionObj : public EngineActionObj {
         models_[model_id]->ScatterDraftProbs(probs_on_device, draft_token_slots_,
                                              &model_workspaces_[0].draft_probs_storage);
         for (int i = 0; i < num_rsentries; ++i) {
+          last_round_begin[i] = mstates[i]->draft_output_tokens.size();
+          if (dynamic_tree) {
+            AddDynamicTreeDraftTokens(mstates[i], sample_results, draft_token_parent_idx,
+                                      cum_num_tokens[i], cum_num_tokens[i + 1]);
+            continue;
+          }
           for (int j = cum_num_tokens[i]; j < cum_num_tokens[i + 1]; ++j) {
             int parent_idx = draft_token_parent_idx[j];
             if (engine_config_->spec_tree_width == 1) {
@@ -276,6 +338,9 @@ class BatchDraftActionObj : public EngineActionObj {
               continue;
             }
             for (int k = 0; k < sample_results[j].top_prob_tokens.size(); ++k) {
+              if (IsMaskedOutByGrammar(mstates[i], sample_results[j].top_prob_tokens[k])) {
+                continue;
+              }
               SampleResult top_k_token{sample_results[j].top_prob_tokens[k]};
               mstates[i]->AddDraftToken(top_k_token, draft_token_slots_[j], parent_idx);
             }
@@ -308,6 +373,81 @@ class BatchDraftActionObj : public EngineActionObj {
     return true;
   }
 
+  /*!
+   * \brief Return the draft length of the request state entry in this step, which is the
+   * draft length chosen for the request if any, capped by the draft length of the engine state.
+   */
+  int GetDraftLength(const EngineState& estate, const RequestStateEntry& rsentry) {
+    int draft_length = rsentry->mstates[1]->spec_draft_length;
+    if (draft_length == -1) {
+      return estate->spec_draft_length;
+    }
+    return std::min(draft_length, estate->spec_draft_length);
+  }
+
+  /*!
+   * \brief Check whether a top prob token of a draft step is masked out by the grammar of the
+   * request. The top prob tokens of a tree step may include the masked out tokens with zero
+   * probability, when the grammar allows fewer tokens than the tree width. Such tokens can never
+   * pass the grammar-constrained verification, so they are not drafted.
+   */
+  bool IsMaskedOutByGrammar(const RequestModelState& mstate, const TokenProbPair& top_prob_token) {
+    return mstate->RequireNextTokenBitmask() && top_prob_token.second <= 0.0f;
+  }
+
+  /*!
+   * \brief Add the draft tokens of a round under the dynamic tree shape. Among the top prob
+   * tokens of all the input leaf nodes, the ones with the highest path probabilities from the
+   * root are added, at most `spec_tree_width` of them and within the token budget.
+   * \param mstate The draft model state of the request.
+   * \param sample_results The sample results of all input leaf nodes of the round.
+   * \param draft_token_parent_idx The draft token index of each input leaf node.
+   * \param begin The first input leaf node of the request.
+   * \param end The end of the input leaf nodes of the request.
+   */
+  void AddDynamicTreeDraftTokens(const RequestModelState& mstate,
+                                 const std::vector<SampleResult>& sample_results,
+                                 const std::vector<int>& draft_token_parent_idx, int begin,
+                                 int end) {
+    int num_new_tokens =
+        std::min(engine_config_->spec_tree_width,
+                 engine_config_->spec_tree_token_budget -
+                     static_cast<int>(mstate->draft_output_tokens.size()));
+    if (num_new_tokens <= 0) {
+      return;
+    }
+    // (path prob, input leaf node, top prob rank)
+    std::vector<std::tuple<double, int, int>> candidates;
+    for (int j = begin; j < end; ++j) {
+      double parent_path_prob = 1.0;
+      for (int64_t idx = draft_token_parent_idx[j]; idx != -1;
+           idx = mstate->draft_token_parent_idx[idx]) {
+        parent_path_prob *= mstate->draft_output_tokens[idx].sampled_token_id.second;
+      }
+      for (int k = 0; k < static_cast<int>(sample_results[j].top_prob_tokens.size()); ++k) {
+        if (IsMaskedOutByGrammar(mstate, sample_results[j].top_prob_tokens[k])) {
+          continue;
+        }
+        candidates.emplace_back(parent_path_prob * sample_results[j].top_prob_tokens[k].second, j,
+                                k);
+      }
+    }
+    num_new_tokens = std::min(num_new_tokens, static_cast<int>(candidates.size()));
+    std::partial_sort(candidates.begin(), candidates.begin() + num_new_tokens, candidates.end(),
+                      [](const auto& a, const auto& b) { return std::get<0>(a) > std::get<0>(b); });
+    // Add the selected tokens in the order of their parents, so that siblings stay together.
+    std::sort(candidates.begin(), candidates.begin() + num_new_tokens,
+              [](const auto& a, const auto& b) {
+                return std::make_pair(std::get<1>(a), std::get<2>(a)) <
+                       std::make_pair(std::get<1>(b), std::get<2>(b));
+              });
+    for (int c = 0; c < num_new_tokens; ++c) {
+      auto [path_prob, j, k] = candidates[c];
+      SampleResult top_k_token{sample_results[j].top_prob_tokens[k]};
+      mstate->AddDraftToken(top_k_token, draft_token_slots_[j], draft_token_parent_idx[j]);
+    }
+  }
+
   void PrefillLaggedTokensByChunk(const Array<RequestModelState>& mstates,
                                   const std::vector<RequestStateEntry>& running_rsentries,
                                   Model model, int remaining_prefill_length) {
@@ -1,6 +1,6 @@
 /*!
  *  Copyright (c) 2023 by Contributors
- * \file serve/engine_actions/batch_verify.cc
+ * \file serve/engine_actions/batch_jumpforward.cc
  */
 
 #include <tvm/runtime/nvtx.h>
@@ -27,11 +27,15 @@ namespace serve {
 class BatchJumpForwardActionObj : public EngineActionObj {
  public:
   explicit BatchJumpForwardActionObj(Array<Model> models, Tokenizer tokenizer,
+                                     EngineConfig engine_config,
                                      Optional<EventTraceRecorder> trace_recorder)
       : models_(std::move(models)),
         tokenizer_(tokenizer),
+        engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)) {}
 
+  String Name() const final { return "batch_jump_forward"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Do not run decode when there are multiple models or no running requests.
     if (models_.size() > 1 || estate->running_queue.empty()) {
@@ -47,8 +51,9 @@ class BatchJumpForwardActionObj : public EngineActionObj {
         if (estate->prefix_cache->TryFreeMemory()) continue;
         RequestStateEntry preempted =
             PreemptLastRunningRequestStateEntry(estate, models_, NullOpt, trace_recorder_);
-        if (preempted.same_as(running_rsentries.back())) {
-          running_rsentries.pop_back();
+        auto it = std::find(running_rsentries.begin(), running_rsentries.end(), preempted);
+        if (it != running_rsentries.end()) {
+          running_rsentries.erase(it);
         }
       }
     }
@@ -59,6 +64,7 @@ class BatchJumpForwardActionObj : public EngineActionObj {
 
     auto tstart = std::chrono::high_resolution_clock::now();
 
+    std::vector<RequestStateEntry> jumped_rsentries;
     for (auto rsentry : running_rsentries) {
       if (!CanJumpForward(rsentry)) {
         continue;
@@ -76,12 +82,13 @@ class BatchJumpForwardActionObj : public EngineActionObj {
 
       HandleRollback(rsentry, mstate, rollback_cnt, new_tokens, new_string);
 
-      // Commit new tokens (kv cache is handled in the next decode)
+      // Commit new tokens (kv cache is handled in PrefillJumpForwardSpans and the next decode)
       for (auto token_id : new_tokens) {
         mstate->CommitToken({{token_id, 1.0}, {}});
       }
 
       mstate->require_retokenization_in_next_decode = true;
+      jumped_rsentries.push_back(rsentry);
 
       // Update metrics
       rsentry->rstate->metrics.jump_forward_tokens +=
@@ -90,6 +97,7 @@ class BatchJumpForwardActionObj : public EngineActionObj {
       rsentry->rstate->metrics.completion_tokens +=
           static_cast<int>(new_tokens.size()) - rollback_cnt;
     }
+    PrefillJumpForwardSpans(jumped_rsentries);
 
     auto tend = std::chrono::high_resolution_clock::now();
     estate->metrics.engine_jump_forward_time_sum +=
@@ -215,6 +223,68 @@ class BatchJumpForwardActionObj : public EngineActionObj {
     }
   }
 
+  /*!
+   * \brief Write the pending tokens of the jump-forward spans into the KV cache, except the last
+   * pending token of each request, with chunked prefills of at most the prefill chunk size.
+   * The forced tokens need no sampling, so their logits are discarded. The last token is left
+   * to the next decode, which then stays a single-token batch decode rather than turning into
+   * a batch prefill of the whole running batch.
+   * \param rsentries The request state entries that jump forward in this step.
+   */
+  void PrefillJumpForwardSpans(const std::vector<RequestStateEntry>& rsentries) {
+    std::vector<int> input_tokens;
+    std::vector<int64_t> request_internal_ids;
+    std::vector<int> lengths;
+    std::vector<int> lora_adapter_indices;
+    bool use_lora = false;
+    int chunk_size = engine_config_->prefill_chunk_size;
+
+    auto f_prefill = [&]() {
+      if (input_tokens.empty()) {
+        return;
+      }
+      ObjectRef embeddings =
+          models_[0]->TokenEmbed({IntTuple(input_tokens.begin(), input_tokens.end())});
+      if (use_lora) {
+        models_[0]->SetBatchLoRAAdapters(std::move(lora_adapter_indices));
+      }
+      models_[0]->BatchPrefill(embeddings, request_internal_ids, lengths);
+      input_tokens.clear();
+      request_internal_ids.clear();
+      lengths.clear();
+      lora_adapter_indices.clear();
+      use_lora = false;
+    };
+
+    for (const RequestStateEntry& rsentry : rsentries) {
+      RequestModelState mstate = rsentry->mstates[0];
+      int num_span_tokens = mstate->num_tokens_for_next_decode - 1;
+      if (num_span_tokens <= 0) {
+        continue;
+      }
+      RECORD_EVENT(trace_recorder_, rsentry->request->id, "jump-forward prefill");
+      auto span_begin = mstate->committed_tokens.end() - mstate->num_tokens_for_next_decode;
+      for (int pos = 0; pos < num_span_tokens;) {
+        int length =
+            std::min(num_span_tokens - pos, chunk_size - static_cast<int>(input_tokens.size()));
+        for (int i = 0; i < length; ++i) {
+          input_tokens.push_back((span_begin + pos + i)->GetTokenId());
+        }
+        request_internal_ids.push_back(mstate->internal_id);
+        lengths.push_back(length);
+        lora_adapter_indices.push_back(mstate->lora_adapter_index);
+        use_lora |= mstate->lora_adapter_index != -1;
+        pos += length;
+        // A sequence appears at most once in a prefill, since a full chunk is flushed at once.
+        if (static_cast<int>(input_tokens.size()) == chunk_size) {
+          f_prefill();
+        }
+      }
+      mstate->num_tokens_for_next_decode = 1;
+    }
+    f_prefill();
+  }
+
   /*!
    * \brief The model to run jump-forward decoding. When there are multiple
    * models, the `Step` function of the created action will not take effect.
@@ -222,6 +292,8 @@ class BatchJumpForwardActionObj : public EngineActionObj {
   Array<Model> models_;
   /*! \brief Tokenizer for retokenization. */
   Tokenizer tokenizer_;
+  /*! \brief The engine config. */
+  EngineConfig engine_config_;
   /*! \brief Event trace recorder. */
   Optional<EventTraceRecorder> trace_recorder_;
   /*! \brief The maximum number of tokens to rollback. */
@@ -229,9 +301,11 @@ class BatchJumpForwardActionObj : public EngineActionObj {
 };
 
 EngineAction EngineAction::BatchJumpForward(Array<Model> models, Tokenizer tokenizer,
+                                            EngineConfig engine_config,
                                             Optional<EventTraceRecorder> trace_recorder) {
   return EngineAction(make_object<BatchJumpForwardActionObj>(
-      std::move(models), std::move(tokenizer), std::move(trace_recorder)));
+      std::move(models), std::move(tokenizer), std::move(engine_config),
+      std::move(trace_recorder)));
 }
 
 }  // namespace serve
@@ -23,13 +23,68 @@ bool HasPrefillSpace(int num_required_pages, bool sliding_window_enabled, int ne
               max_total_sequence_length);
 }
 
+/*!
+ * \brief Estimate the decode latency of the given batch size from the measured decode time.
+ * The measurement of the nearest smaller batch size is used when the batch size is not measured.
+ * \return The estimated decode latency in seconds, or 0 if there is no measurement.
+ */
+double EstimateDecodeLatency(const EngineMetrics& metrics, int batch_size) {
+  int max_tracked_batch_size =
+      static_cast<int>(EngineMetrics::kEndFineGrainedTrackingBatchSize) - 1;
+  for (int i = std::min(batch_size, max_tracked_batch_size); i > 0; --i) {
+    const TimeCost& time_cost = metrics.decode_time_by_batch_size[i];
+    if (time_cost.count > 0) {
+      return time_cost.sum / time_cost.count;
+    }
+  }
+  return 0;
+}
+
+/*!
+ * \brief Estimate the number of KV cache pages to reserve for the tokens the request state entry
+ * is still expected to generate. The output length is predicted as the average output length of
+ * the finished requests, capped by the `max_tokens` of the request.
+ * \return The number of pages to reserve, or 0 if no request has finished yet.
+ */
+int EstimateDecodeReservedPages(const EngineMetrics& metrics, const RequestStateEntry& rsentry,
+                                int page_size) {
+  if (metrics.num_finished_requests == 0) {
+    return 0;
+  }
+  int64_t predicted_length = metrics.completion_tokens_sum / metrics.num_finished_requests;
+  int max_tokens = rsentry->request->generation_cfg->max_tokens;
+  if (max_tokens >= 0) {
+    predicted_length = std::min(predicted_length, static_cast<int64_t>(max_tokens));
+  }
+  int64_t remaining_length =
+      predicted_length - static_cast<int64_t>(rsentry->mstates[0]->committed_tokens.size());
+  return remaining_length > 0 ? (remaining_length + page_size - 1) / page_size : 0;
+}
+
+std::pair<int, bool> CapLongPrefillChunk(int input_length, int64_t long_prefill_chunk_size,
+                                         int num_decode_inputs) {
+  if (long_prefill_chunk_size > 0 && num_decode_inputs > 0 &&
+      input_length > long_prefill_chunk_size) {
+    return {static_cast<int>(long_prefill_chunk_size), true};
+  }
+  return {input_length, false};
+}
+
+bool ShouldDeferPrefillForDecode(const EngineConfig& engine_config, int num_decode_inputs,
+                                 int last_prefill_length, int last_input_length) {
+  return engine_config->prefill_mode != PrefillMode::kHybrid &&
+         engine_config->long_prefill_chunk_size > 0 && num_decode_inputs > 0 &&
+         last_prefill_length < last_input_length;
+}
+
 BatchPrefillBaseActionObj::BatchPrefillBaseActionObj(Array<Model> models,
                                                      EngineConfig engine_config,
                                                      std::vector<picojson::object> model_configs,
                                                      Optional<EventTraceRecorder> trace_recorder)
     : models_(std::move(models)),
       engine_config_(std::move(engine_config)),
-      trace_recorder_(std::move(trace_recorder)) {
+      trace_recorder_(std::move(trace_recorder)),
+      prefill_token_budget_(engine_config_->prefill_chunk_size) {
   ICHECK_EQ(models_.size(), model_configs.size());
   sliding_window_sizes_.reserve(models_.size());
   for (const picojson::object& model_config : model_configs) {
@@ -63,9 +118,21 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
     // No request to prefill.
     return {};
   }
+  if (deferred_decode_for_long_prefill_) {
+    // The last step prefilled a capped chunk of a long prompt without the decode of the running
+    // requests. Skip prefill in this step so that the running requests decode in between.
+    deferred_decode_for_long_prefill_ = false;
+    if (!running_rsentries->empty()) {
+      return {};
+    }
+  }
+  // Let the scheduling policy decide the admission order of the waiting requests.
+  estate->scheduling_policy->SortWaitingQueue(&estate->waiting_queue);
+  prefill_token_budget_ = ComputePrefillTokenBudget(estate, *running_rsentries);
 
   std::vector<std::vector<PrefillInput>> prefill_inputs_for_all_models;
   prefill_inputs_for_all_models.reserve(models_.size());
+  admitted_.clear();
 
   int num_decode_inputs = static_cast<int>(running_rsentries->size());
 
@@ -79,6 +146,16 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
       total_input_length += rsentry->mstates[i]->num_tokens_for_next_decode;
     }
     int total_required_pages = num_decode_inputs;
+    // Reserve the pages for the expected decode growth of the running requests, which is not
+    // needed under sliding window where the pages in use of a request are bounded.
+    bool reserve_decode_pages =
+        engine_config_->reserve_decode_kv_pages && sliding_window_sizes_[i] == -1;
+    if (reserve_decode_pages) {
+      for (const RequestStateEntry& rsentry : *running_rsentries) {
+        total_required_pages += EstimateDecodeReservedPages(estate->metrics, rsentry,
+                                                            engine_config_->kv_cache_page_size);
+      }
+    }
     int num_available_pages;
     int num_running_rsentries = num_decode_inputs;
     int current_total_seq_len;
@@ -92,11 +169,27 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
     }
 
     int num_prefill_rsentries = 0;
-    for (const Request& request : estate->waiting_queue) {
+    for (int r = 0; r < static_cast<int>(estate->waiting_queue.size()); ++r) {
+      const Request& request = estate->waiting_queue[r];
       NVTXScopedRange nvtx_scope("Process request " + request->id);
       RequestState rstate = estate->GetRequestState(request);
+      // The admission of a request not yet prefilled is decided by the scheduling policy once
+      // for all models, so that the models agree on the requests to prefill.
+      if (r == static_cast<int>(admitted_.size())) {
+        admitted_.push_back(rstate->entries[0]->status != RequestStateStatus::kPending ||
+                            estate->scheduling_policy->CanAdmit(request));
+      }
+      if (!admitted_[r]) {
+        continue;
+      }
       bool prefill_stops = false;
       for (const RequestStateEntry& rsentry : rstate->entries) {
+        // The request state entry whose KV data is swapped out is resumed by
+        // swap-in. Stop here so that the later requests do not overtake it.
+        if (rsentry->mstates[i]->swapped_kv_data.defined()) {
+          prefill_stops = true;
+          break;
+        }
         // A request state entry can be prefilled only when:
         // - it has inputs, and
         // - it has no parent or its parent is alive and has no remaining input.
@@ -107,7 +200,9 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
           continue;
         }
 
-        int input_length = rsentry->mstates[i]->GetInputLength();
+        auto [input_length, long_prefill_capped] =
+            CapLongPrefillChunk(rsentry->mstates[i]->GetInputLength(),
+                                engine_config_->long_prefill_chunk_size, num_decode_inputs);
         int num_require_pages = (input_length + engine_config_->kv_cache_page_size - 1) /
                                 engine_config_->kv_cache_page_size;
         bool sliding_window_enabled = sliding_window_sizes_[i] != -1;
@@ -134,8 +229,16 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
           ICHECK_GE(num_require_pages, 0);
         }
 
+        // The first request admitted into an empty batch reserves no page, so that it is always
+        // admitted when it fits.
+        int num_reserved_pages = 0;
+        if (reserve_decode_pages && num_running_rsentries + num_prefill_rsentries > 0) {
+          num_reserved_pages = EstimateDecodeReservedPages(estate->metrics, rsentry,
+                                                           engine_config_->kv_cache_page_size);
+        }
+
         total_input_length += input_length;
-        total_required_pages += num_require_pages;
+        total_required_pages += num_require_pages + num_reserved_pages;
         // - Attempt 1. Check if the entire request state entry can fit for prefill.
         bool can_prefill = false;
         {
@@ -164,25 +267,31 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
           }
         }
         if (can_prefill) {
+          if (long_prefill_capped) {
+            // The capped entry still has remaining input, and the later requests are not
+            // supposed to overtake it.
+            prefill_stops = true;
+            break;
+          }
           continue;
         }
         total_input_length -= input_length;
-        total_required_pages -= num_require_pages;
+        total_required_pages -= num_require_pages + num_reserved_pages;
 
         // - Attempt 2. Check if the request state entry can partially fit by input chunking.
-        ICHECK_LE(total_input_length, engine_config_->prefill_chunk_size);
-        if (engine_config_->prefill_chunk_size - total_input_length >= input_length ||
-            engine_config_->prefill_chunk_size == total_input_length) {
+        ICHECK_LE(total_input_length, prefill_token_budget_);
+        if (prefill_token_budget_ - total_input_length >= input_length ||
+            prefill_token_budget_ == total_input_length) {
           // 1. If the input length can fit the remaining prefill chunk size,
           // it means the failure of attempt 1 is not because of the input
           // length being too long, and thus chunking does not help.
-          // 2. If the total input length already reaches the prefill chunk size,
+          // 2. If the total input length already reaches the prefill token budget,
           // the current request state entry will not be able to be processed.
           // So we can safely return in either case.
           prefill_stops = true;
           break;
         }
-        input_length = engine_config_->prefill_chunk_size - total_input_length;
+        input_length = prefill_token_budget_ - total_input_length;
         num_require_pages = (input_length + engine_config_->kv_cache_page_size - 1) /
                             engine_config_->kv_cache_page_size;
         if (sliding_window_enabled) {
@@ -194,7 +303,7 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
         {
           NVTXScopedRange nvtx_scope("Attempt 2");
           total_input_length += input_length;
-          total_required_pages += num_require_pages;
+          total_required_pages += num_require_pages + num_reserved_pages;
           if (CanPrefill(estate, num_prefill_rsentries + 1, total_input_length,
                          total_required_pages, num_available_pages, current_total_seq_len,
                          num_running_rsentries, kv_state_kind_, sliding_window_enabled)) {
@@ -259,9 +368,70 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
     }
   }
 
+  // Let the running requests decode in the next step if the prompt is not fully prefilled.
+  const PrefillInput& last_input = prefill_inputs[num_prefill_inputs - 1];
+  deferred_decode_for_long_prefill_ = ShouldDeferPrefillForDecode(
+      engine_config_, num_decode_inputs, last_input.max_prefill_length,
+      last_input.rsentry->mstates[0]->GetInputLength());
   return prefill_inputs;
 }
 
+int64_t BatchPrefillBaseActionObj::ComputePrefillTokenBudget(
+    const EngineState& estate, const std::vector<RequestStateEntry>& running_rsentries) {
+  if (engine_config_->prefill_mode != PrefillMode::kHybrid ||
+      engine_config_->target_inter_token_latency_ms <= 0 || running_rsentries.empty() ||
+      prefill_latency_per_token_ <= 0) {
+    // The budget is not tuned when there is no decode to keep the latency for,
+    // or when the prefill latency has not been measured yet.
+    return engine_config_->prefill_chunk_size;
+  }
+  int64_t num_decode_tokens = 0;
+  for (const RequestStateEntry& rsentry : running_rsentries) {
+    num_decode_tokens += rsentry->mstates[0]->num_tokens_for_next_decode;
+  }
+  // The step latency is modeled as the decode latency of running requests
+  // plus the per-token latency times the number of prefill tokens.
+  double remaining_latency =
+      engine_config_->target_inter_token_latency_ms / 1e3 -
+      EstimateDecodeLatency(estate->metrics, static_cast<int>(running_rsentries.size()));
+  double num_prefill_tokens =
+      std::min(std::max(remaining_latency, 0.0) / prefill_latency_per_token_,
+               static_cast<double>(engine_config_->prefill_chunk_size));
+  return std::min(engine_config_->prefill_chunk_size,
+                  num_decode_tokens + std::max(static_cast<int64_t>(num_prefill_tokens),
+                                               kMinNumPrefillTokensPerStep));
+}
+
+void BatchPrefillBaseActionObj::UpdatePrefillLatencyEstimate(
+    const EngineState& estate, const std::vector<PrefillInput>& prefill_inputs,
+    const std::vector<int>& prefill_lengths, double elapsed_time) {
+  if (engine_config_->prefill_mode != PrefillMode::kHybrid ||
+      engine_config_->target_inter_token_latency_ms <= 0) {
+    return;
+  }
+  ICHECK_EQ(prefill_inputs.size(), prefill_lengths.size());
+  int num_decode_inputs = 0;
+  int64_t num_prefill_tokens = 0;
+  for (int i = 0; i < static_cast<int>(prefill_inputs.size()); ++i) {
+    if (prefill_inputs[i].is_decode) {
+      ++num_decode_inputs;
+    } else {
+      num_prefill_tokens += prefill_lengths[i];
+    }
+  }
+  if (num_prefill_tokens == 0) {
+    return;
+  }
+  double latency_per_token =
+      std::max(elapsed_time - EstimateDecodeLatency(estate->metrics, num_decode_inputs), 0.0) /
+      num_prefill_tokens;
+  prefill_latency_per_token_ =
+      prefill_latency_per_token_ == 0
+          ? latency_per_token
+          : (1 - kPrefillLatencySmoothing) * prefill_latency_per_token_ +
+                kPrefillLatencySmoothing * latency_per_token;
+}
+
 bool BatchPrefillBaseActionObj::CanPrefill(EngineState estate, int num_prefill_rsentries,
                                            int total_input_length, int num_required_pages,
                                            int num_available_pages, int current_total_seq_len,
@@ -286,12 +456,12 @@ bool BatchPrefillBaseActionObj::CanPrefill(EngineState estate, int num_prefill_r
   }
 
   // NOTE: The conditions are heuristic and can be revised.
-  // Cond 1: total input length <= prefill chunk size.
+  // Cond 1: total input length <= prefill token budget.
   // Cond 2: at least one decode can be performed after prefill.
   // Cond 3: number of total tokens after 8 times of decode does not
   // exceed the limit, where 8 is a watermark number can
   // be configured and adjusted in the future.
-  return total_input_length <= engine_config_->prefill_chunk_size &&
+  return total_input_length <= prefill_token_budget_ &&
          HasPrefillSpace(num_required_pages, sliding_window_enabled,
                          (num_running_rsentries + num_prefill_rsentries), num_available_pages,
                          current_total_seq_len, total_input_length,
@@ -391,6 +561,7 @@ void BatchPrefillBaseActionObj::UpdateRequestToAlive(
   request_ids->reserve(num_rsentries);
   rstates_of_entries->reserve(num_rsentries);
   status_before_prefill->reserve(num_rsentries);
+  auto tnow = std::chrono::high_resolution_clock::now();
   for (const PrefillInput& prefill_input : prefill_inputs) {
     const RequestStateEntry& rsentry = prefill_input.rsentry;
     const Request& request = rsentry->request;
@@ -411,6 +582,10 @@ void BatchPrefillBaseActionObj::UpdateRequestToAlive(
       if (!alive_state_existed) {
         estate->running_queue.push_back(request);
       }
+      // Record the end of queue waiting when the request is scheduled for the first time.
+      if (!request_rstate->metrics.HasPrefillStarted()) {
+        request_rstate->metrics.prefill_start_time_point = tnow;
+      }
     }
     rstates_of_entries->push_back(std::move(request_rstate));
   }
@@ -491,12 +666,16 @@ void BatchPrefillBaseActionObj::UpdateRequestStateEntriesWithSampleResults(
 }
 
 std::vector<int32_t> BatchPrefillBaseActionObj::GetConcatPrefillInputData(
-    const RequestModelState& mstate) {
+    const RequestModelState& mstate, bool include_image_data) {
   std::vector<int32_t> tokens;
   for (Data data : mstate->inputs) {
     if (const TokenDataNode* token_data = data.as<TokenDataNode>()) {
       tokens.reserve(tokens.size() + token_data->GetLength());
       tokens.insert(tokens.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+    } else if (const ImageDataNode* image_data = data.as<ImageDataNode>();
+               include_image_data && image_data != nullptr && !image_data->content_hash.empty()) {
+      std::vector<int32_t> image_token_ids = image_data->GetPrefixCacheTokenIds();
+      tokens.insert(tokens.end(), image_token_ids.begin(), image_token_ids.end());
     } else {
       return {};
     }
@@ -504,6 +683,97 @@ std::vector<int32_t> BatchPrefillBaseActionObj::GetConcatPrefillInputData(
   return tokens;
 }
 
+void BatchPrefillBaseActionObj::AlignPrefixCacheMatchToInputData(
+    EngineState estate, const RequestModelState& mstate, PrefixCacheMatchedResult* result) {
+  size_t aligned_offset = result->prefilled_offset;
+  size_t offset = 0;
+  for (const Data& data : mstate->inputs) {
+    size_t length = data->GetLength();
+    if (offset + length > result->prefilled_offset) {
+      if (data->IsInstance<ImageDataNode>() && offset < result->prefilled_offset) {
+        aligned_offset = offset;
+      }
+      break;
+    }
+    offset += length;
+  }
+  size_t num_rollback_tokens = result->prefilled_offset - aligned_offset;
+  if (num_rollback_tokens == 0) {
+    return;
+  }
+  if (result->reused_seq_id != -1) {
+    estate->prefix_cache->RollBackSequence(result->reused_seq_id, num_rollback_tokens);
+    result->reused_seq_pop_last_tokens += num_rollback_tokens;
+  } else {
+    ICHECK_NE(result->forked_seq_id, -1);
+    estate->prefix_cache->RollBackSequence(mstate->internal_id, num_rollback_tokens);
+    if (aligned_offset == 0) {
+      // Nothing is left to fork, and the sequence is added as a new one.
+      result->forked_seq_id = -1;
+    }
+  }
+  result->prefilled_offset = aligned_offset;
+}
+
+void BatchPrefillBaseActionObj::MatchPrefixCacheAndDeferSharedPrefix(
+    EngineState estate, std::vector<PrefillInput>* prefill_inputs) {
+  // Sequences are forked from the matched prefix only when the sliding window is disabled.
+  bool defer_shared_prefix = estate->prefix_cache->Mode() != PrefixCacheMode::kDisable &&
+                             models_[0]->GetSlidingWindowSize() == -1;
+  // The tokens of each input to be prefilled in this step, and the range [begin, end) of the
+  // tokens prefilled by the input in this step.
+  std::vector<std::vector<int32_t>> batch_tokens;
+  std::vector<std::pair<int, int>> batch_prefill_ranges;
+  std::vector<PrefillInput> kept_inputs;
+  kept_inputs.reserve(prefill_inputs->size());
+  for (PrefillInput& input : *prefill_inputs) {
+    const RequestModelState& mstate = input.rsentry->mstates[0];
+    bool is_new_sequence = !input.is_decode && input.rsentry->parent_idx == -1 &&
+                           input.rsentry->status == RequestStateStatus::kPending &&
+                           !estate->prefix_cache->HasSequence(mstate->internal_id);
+    // The embedding and prompt logprobs requests neither match nor enter the prefix cache, so
+    // they neither wait for a shared prefix nor provide one.
+    const GenerationConfig& generation_cfg = input.rsentry->request->generation_cfg;
+    bool uses_prefix_cache = generation_cfg->embedding_pooling == EmbeddingPooling::kNone &&
+                             !generation_cfg->prompt_logprobs;
+    std::vector<int32_t> tokens;
+    if (defer_shared_prefix && is_new_sequence && uses_prefix_cache) {
+      tokens = GetConcatPrefillInputData(mstate);
+    }
+    if (!tokens.empty()) {
+      bool deferred = false;
+      for (int i = 0; i < static_cast<int>(batch_tokens.size()); ++i) {
+        const std::vector<int32_t>& prev_tokens = batch_tokens[i];
+        int common_length = 0;
+        int max_common_length = static_cast<int>(std::min(prev_tokens.size(), tokens.size()));
+        while (common_length < max_common_length &&
+               prev_tokens[common_length] == tokens[common_length]) {
+          ++common_length;
+        }
+        auto [prefill_begin, prefill_end] = batch_prefill_ranges[i];
+        if (std::min(common_length, prefill_end) - prefill_begin >=
+            engine_config_->kv_cache_page_size) {
+          deferred = true;
+          break;
+        }
+      }
+      if (deferred) {
+        continue;
+      }
+    }
+    int input_length = mstate->GetInputLength();
+    MatchPrefixCache(estate, &input);
+    if (!tokens.empty()) {
+      int prefilled_offset = input_length - mstate->GetInputLength();
+      batch_prefill_ranges.emplace_back(prefilled_offset,
+                                        prefilled_offset + input.max_prefill_length);
+      batch_tokens.push_back(std::move(tokens));
+    }
+    kept_inputs.push_back(std::move(input));
+  }
+  *prefill_inputs = std::move(kept_inputs);
+}
+
 void BatchPrefillBaseActionObj::PopPrefillInputData(const RequestModelState& mstate,
                                                     size_t num_tokens) {
   while (mstate->inputs[0]->GetLength() <= num_tokens) {
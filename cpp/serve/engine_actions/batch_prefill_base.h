@@ -5,6 +5,8 @@
 
 #include <tvm/runtime/nvtx.h>
 
+#include <utility>
+
 #include "../config.h"
 #include "../model.h"
 #include "action.h"
@@ -14,6 +16,29 @@ namespace mlc {
 namespace llm {
 namespace serve {
 
+/*!
+ * \brief Cap the prefill length of a request in a step by the long prefill chunk size. A prompt
+ * longer than the chunk size is capped only when there are running requests to interleave with.
+ * \param input_length The remaining input length of the request.
+ * \param long_prefill_chunk_size The long prefill chunk size, where 0 means no cap.
+ * \param num_decode_inputs The number of running requests to decode.
+ * \return The prefill length of the request, and whether the length is capped.
+ */
+std::pair<int, bool> CapLongPrefillChunk(int input_length, int64_t long_prefill_chunk_size,
+                                         int num_decode_inputs);
+
+/*!
+ * \brief Check if the next step should skip prefill so that the running requests decode, which
+ * is the case when the long prompt prefilled last is not fully prefilled in a step whose decode
+ * is not fused into prefill.
+ * \param engine_config The engine config.
+ * \param num_decode_inputs The number of running requests to decode.
+ * \param last_prefill_length The prefill length of the last prefill input in the step.
+ * \param last_input_length The remaining input length of the last prefill input before the step.
+ */
+bool ShouldDeferPrefillForDecode(const EngineConfig& engine_config, int num_decode_inputs,
+                                 int last_prefill_length, int last_input_length);
+
 /*!
  * \brief The base action of that prefills requests in the `waiting_queue` of
  * the engine state.
@@ -39,6 +64,30 @@ class BatchPrefillBaseActionObj : public EngineActionObj {
    */
   std::vector<PrefillInput> GetRequestStateEntriesToPrefill(EngineState estate);
 
+  /*!
+   * \brief Compute the prefill token budget of the current step, which includes the tokens of
+   * the decode requests fused into prefill under the hybrid prefill mode. The budget is the
+   * largest one whose estimated step latency stays within the target inter-token latency.
+   * \param estate The engine state.
+   * \param running_rsentries The running request state entries to decode in the step.
+   * \return The prefill token budget, which never exceeds the prefill chunk size.
+   */
+  int64_t ComputePrefillTokenBudget(const EngineState& estate,
+                                    const std::vector<RequestStateEntry>& running_rsentries);
+
+  /*!
+   * \brief Update the estimated per-token prefill latency with the measured latency of a
+   * prefill step. It takes effect only under the hybrid prefill mode with a positive target
+   * inter-token latency.
+   * \param estate The engine state.
+   * \param prefill_inputs The prefill inputs of the step.
+   * \param prefill_lengths The actual prefill length of each prefill input.
+   * \param elapsed_time The measured latency of the step in seconds.
+   */
+  void UpdatePrefillLatencyEstimate(const EngineState& estate,
+                                    const std::vector<PrefillInput>& prefill_inputs,
+                                    const std::vector<int>& prefill_lengths, double elapsed_time);
+
   /*! \brief Check if the input requests can be prefilled under conditions. */
   bool CanPrefill(EngineState estate, int num_prefill_rsentries, int total_input_length,
                   int num_required_pages, int num_available_pages, int current_total_seq_len,
@@ -100,9 +149,24 @@ class BatchPrefillBaseActionObj : public EngineActionObj {
    * \brief Get the concatenated IntTuple of RequestModelState input data, return empty IntTuple if
    * there is untokenized data.
    * \param mstate The RequestModelState whose input data is to be concatenated.
+   * \param include_image_data Whether the image data with content hash are concatenated as their
+   * pseudo token ids (see ImageDataNode::GetPrefixCacheTokenIds). Otherwise, the image data are
+   * regarded as untokenized data.
    * \return The concatenate IntTuple.
    */
-  std::vector<int32_t> GetConcatPrefillInputData(const RequestModelState& mstate);
+  std::vector<int32_t> GetConcatPrefillInputData(const RequestModelState& mstate,
+                                                 bool include_image_data = false);
+
+  /*!
+   * \brief Align the prefix cache matched result to the input data, so that the matched prefix
+   * does not end inside an image, as an image can only be embedded as a whole. The matched part
+   * of such image is rolled back in prefix cache, and is to be prefilled again.
+   * \param estate The engine state.
+   * \param mstate The RequestModelState matched with prefix cache.
+   * \param[in, out] result The matched result to align.
+   */
+  void AlignPrefixCacheMatchToInputData(EngineState estate, const RequestModelState& mstate,
+                                        PrefixCacheMatchedResult* result);
 
   /*!
    * \brief Pop the prefix tokens of the RequestModelState input data array.
@@ -120,6 +184,18 @@ class BatchPrefillBaseActionObj : public EngineActionObj {
    */
   virtual void MatchPrefixCache(EngineState estate, PrefillInput* input) = 0;
 
+  /*!
+   * \brief Match all the prefill inputs with prefix cache. A pending input which shares an
+   * uncached prefix of at least one KV cache page with an earlier input in the same batch is
+   * removed from the batch and stays in the waiting queue. It is prefilled in a later step by
+   * forking the shared prefix from the earlier input, so that the shared prefix is prefilled
+   * only once.
+   * \param estate The engine state.
+   * \param[in, out] prefill_inputs The prefill inputs to be matched and updated.
+   */
+  void MatchPrefixCacheAndDeferSharedPrefix(EngineState estate,
+                                            std::vector<PrefillInput>* prefill_inputs);
+
   /*! \brief The models to run prefill in. */
   Array<Model> models_;
   /*! \brief The engine config. */
@@ -130,6 +206,28 @@ class BatchPrefillBaseActionObj : public EngineActionObj {
   std::vector<int> sliding_window_sizes_;
   /*! \brief Event trace recorder. */
   Optional<EventTraceRecorder> trace_recorder_;
+  /*!
+   * \brief The prefill token budget of the current step. It is the prefill chunk size unless
+   * tuned by the target inter-token latency under the hybrid prefill mode.
+   */
+  int64_t prefill_token_budget_;
+  /*! \brief The estimated latency in seconds to prefill one token. Value 0 means unmeasured. */
+  double prefill_latency_per_token_ = 0;
+  /*!
+   * \brief Whether the last step prefilled a chunk of a long prompt without the decode of the
+   * running requests, so that the next step skips prefill for the decode to run.
+   */
+  bool deferred_decode_for_long_prefill_ = false;
+  /*!
+   * \brief Whether each waiting request is admitted by the scheduling policy in the current step,
+   * decided once for all models. Kept as a member to avoid repetitive allocation.
+   */
+  std::vector<bool> admitted_;
+
+  /*! \brief The minimum number of prefill tokens in the tuned prefill token budget. */
+  static constexpr const int64_t kMinNumPrefillTokensPerStep = 32;
+  /*! \brief The smoothing factor of the exponential moving average of per-token latency. */
+  static constexpr const double kPrefillLatencySmoothing = 0.2;
 };
 
 }  // namespace serve
@@ -0,0 +1,107 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/batch_swap_in.cc
+ */
+
+#include <tvm/runtime/nvtx.h>
+
+#include "../config.h"
+#include "../model.h"
+#include "action.h"
+#include "action_commons.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*!
+ * \brief The action that swaps the KV data of preempted requests back in from
+ * host memory, and moves the requests from `waiting_queue` to `running_queue`.
+ * The swapped-in requests directly continue decoding without prefill.
+ */
+class BatchSwapInActionObj : public EngineActionObj {
+ public:
+  explicit BatchSwapInActionObj(Array<Model> models, EngineConfig engine_config,
+                                Optional<EventTraceRecorder> trace_recorder)
+      : models_(std::move(models)),
+        engine_config_(std::move(engine_config)),
+        trace_recorder_(std::move(trace_recorder)) {}
+
+  String Name() const final { return "batch_swap_in"; }
+
+  Array<Request> Step(EngineState estate) final {
+    // - Do not run swap-in when there are multiple models or no swapped out requests.
+    if (models_.size() > 1 || estate->num_swapped_kv_tokens == 0) {
+      return {};
+    }
+    estate->scheduling_policy->SortWaitingQueue(&estate->waiting_queue);
+
+    // - Swap in the requests at the front of the waiting queue whose KV data
+    // is swapped out, as long as the KV cache has enough capacity.
+    int num_running_rsentries = estate->GetRunningRequestStateEntries().size();
+    int num_available_pages = models_[0]->GetNumAvailablePages();
+    int num_swapped_in = 0;
+    for (const Request& request : estate->waiting_queue) {
+      RequestState rstate = estate->GetRequestState(request);
+      if (rstate->entries.size() != 1 ||
+          !rstate->entries[0]->mstates[0]->swapped_kv_data.defined()) {
+        break;
+      }
+      RequestStateEntry rsentry = rstate->entries[0];
+      RequestModelState mstate = rsentry->mstates[0];
+      int num_require_pages =
+          (mstate->num_swapped_kv_tokens + engine_config_->kv_cache_page_size - 1) /
+          engine_config_->kv_cache_page_size;
+      if (num_running_rsentries + 1 > engine_config_->max_num_sequence) {
+        break;
+      }
+      // Leave one page for the next decode of each running request.
+      while (num_require_pages + num_running_rsentries + 1 > num_available_pages) {
+        if (!estate->prefix_cache->TryFreeMemory()) break;
+        num_available_pages = models_[0]->GetNumAvailablePages();
+      }
+      if (num_require_pages + num_running_rsentries + 1 > num_available_pages) {
+        break;
+      }
+
+      RECORD_EVENT(trace_recorder_, request->id, "swap in");
+      models_[0]->SwapInSequence(mstate->internal_id, mstate->swapped_kv_data.value());
+      estate->num_swapped_kv_tokens -= mstate->num_swapped_kv_tokens;
+      mstate->swapped_kv_data = NullOpt;
+      mstate->num_swapped_kv_tokens = 0;
+      rsentry->status = RequestStateStatus::kAlive;
+      estate->running_queue.push_back(request);
+      num_available_pages -= num_require_pages;
+      ++num_running_rsentries;
+      ++num_swapped_in;
+    }
+
+    if (num_swapped_in > 0) {
+      estate->waiting_queue.erase(estate->waiting_queue.begin(),
+                                  estate->waiting_queue.begin() + num_swapped_in);
+      estate->running_rsentries_changed = true;
+    }
+    return {};
+  }
+
+ private:
+  /*!
+   * \brief The model to swap in the KV data. When there are multiple
+   * models, the `Step` function of the created action will not take effect.
+   */
+  Array<Model> models_;
+  /*! \brief The engine config. */
+  EngineConfig engine_config_;
+  /*! \brief Event trace recorder. */
+  Optional<EventTraceRecorder> trace_recorder_;
+};
+
+EngineAction EngineAction::BatchSwapIn(Array<Model> models, EngineConfig engine_config,
+                                       Optional<EventTraceRecorder> trace_recorder) {
+  return EngineAction(make_object<BatchSwapInActionObj>(
+      std::move(models), std::move(engine_config), std::move(trace_recorder)));
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -39,11 +39,17 @@ class BatchVerifyActionObj : public EngineActionObj {
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)),
         engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)),
-        rng_(RandomGenerator::GetInstance()) {}
+        rng_(RandomGenerator::GetInstance()),
+        draft_model_id_(engine_config_->speculative_mode == SpeculativeMode::kPromptLookup
+                            ? verify_model_id_
+                            : 1) {}
+
+  String Name() const final { return "batch_verify"; }
 
   Array<Request> Step(EngineState estate) final {
-    // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
-    if (models_.size() != 2 || estate->running_queue.empty()) {
+    // - Only run spec decode when there are two models (llm+ssm), or only the llm whose drafts
+    // are proposed without a model, and >=1 running requests.
+    if (static_cast<int>(models_.size()) != draft_model_id_ + 1 || estate->running_queue.empty()) {
       return {};
     }
 
@@ -90,7 +96,8 @@ class BatchVerifyActionObj : public EngineActionObj {
       ICHECK_EQ(verify_lengths[i], draft_mstate->draft_token_slots.size() + 1);
       // the last committed token + all the draft tokens.
       draft_token_slots_.push_back(0);  // placeholder for the last committed token
-      all_tokens_to_verify.push_back(draft_mstate->committed_tokens.back().GetTokenId());
+      // The draft model lags behind when the request skips the draft proposal.
+      all_tokens_to_verify.push_back(verify_mstate->committed_tokens.back().GetTokenId());
       token_tree_parent_ptr.push_back(-1);
       generation_cfg_for_top_p_norm.push_back(rsentries[i]->request->generation_cfg);
       std::vector<int> cur_draft_token_indices;
@@ -109,9 +116,13 @@ class BatchVerifyActionObj : public EngineActionObj {
       rngs.push_back(&rsentries[i]->rng);
       draft_output_tokens.push_back(draft_mstate->draft_output_tokens);
     }
-    NDArray draft_probs_on_device = models_[draft_model_id_]->GatherDraftProbs(
-        model_workspaces_[verify_model_id_].draft_probs_storage, draft_token_slots_,
-        &model_workspaces_[verify_model_id_].draft_probs);
+    // The drafts proposed without a draft model have no draft probs.
+    NDArray draft_probs_on_device{nullptr};
+    if (HasDraftModel()) {
+      draft_probs_on_device = models_[draft_model_id_]->GatherDraftProbs(
+          model_workspaces_[verify_model_id_].draft_probs_storage, draft_token_slots_,
+          &model_workspaces_[verify_model_id_].draft_probs);
+    }
 
     RECORD_EVENT(trace_recorder_, request_ids, "start verify embedding");
     ObjectRef embeddings = models_[verify_model_id_]->TokenEmbed(
@@ -141,9 +152,18 @@ class BatchVerifyActionObj : public EngineActionObj {
     NDArray probs_on_device = logit_processor_->ComputeProbsFromLogits(
         logits, generation_cfg, request_ids, &cum_verify_lengths);
 
+    // - Optimistically feed the last draft tokens into the draft model before waiting for the
+    // verification, so that the draft model forward is launched while the device verifies.
+    const bool optimistic_draft = UseOptimisticDraft(engine_config_, HasDraftModel());
+    if (optimistic_draft) {
+      FeedLastDraftTokens(rsentries);
+    }
+
     // - Commit the prefix cache changes from previous round of action.
     // Note: we commit prefix cache changes here to overlap this commit with the GPU execution.
     estate->prefix_cache->CommitSequenceExtention();
+    // - Invoke the deferred stream callback of previous step, also overlapping with the GPU.
+    estate->InvokeDeferredStreamCallback();
 
     // Fill range [0, total_verify_length) into `sample_indices`.
     std::vector<int> sample_indices(total_verify_length);
@@ -175,24 +195,44 @@ class BatchVerifyActionObj : public EngineActionObj {
     for (int i = 0; i < num_rsentries; ++i) {
       const std::vector<SampleResult>& sample_results = sample_results_arr[i];
       int accept_length = sample_results.size();
+      RequestModelState draft_mstate = rsentries[i]->mstates[draft_model_id_];
+      // A request without draft tokens skipped the draft proposal in this step.
+      // Its tokens are committed into the draft model in the next draft proposal.
+      bool has_draft = !draft_mstate->draft_output_tokens.empty();
       for (SampleResult sample_result : sample_results) {
         rsentries[i]->mstates[verify_model_id_]->CommitToken(sample_result);
-        rsentries[i]->mstates[draft_model_id_]->CommitToken(sample_result);
+        if (has_draft && HasDraftModel()) {
+          draft_mstate->CommitToken(sample_result);
+        }
       }
       // Metrics update
       // live update the output metrics
       rsentries[i]->rstate->metrics.completion_tokens += accept_length;
-      estate->metrics.spec_decode.Update(cum_verify_lengths[i + 1] - cum_verify_lengths[i],
-                                         accept_length);
-      if (engine_config_->spec_tree_width == 1) {
+      if (has_draft) {
+        int draft_depth = draft_mstate->draft_output_tokens.size();
+        if (engine_config_->spec_tree_width == 1) {
+          estate->metrics.spec_decode.Update(cum_verify_lengths[i + 1] - cum_verify_lengths[i],
+                                             accept_length);
+        } else {
+          const std::vector<int64_t>& parent_idx = draft_mstate->draft_token_parent_idx;
+          // The parent of a draft token always comes before it.
+          std::vector<int> depth(parent_idx.size());
+          draft_depth = 0;
+          for (int j = 0; j < static_cast<int>(parent_idx.size()); ++j) {
+            depth[j] = parent_idx[j] == -1 ? 1 : depth[parent_idx[j]] + 1;
+            draft_depth = std::max(draft_depth, depth[j]);
+          }
+          estate->metrics.spec_decode.UpdateTree(draft_depth, parent_idx.size(), accept_length);
+        }
+        draft_mstate->UpdateSpecAcceptRate(draft_depth, accept_length - 1);
+      }
+      if (engine_config_->spec_tree_width == 1 && HasDraftModel()) {
         // The roll back is needed for the chain draft case.
-        int rollback_length =
-            std::max(cum_verify_lengths[i + 1] - cum_verify_lengths[i] - accept_length, 0);
+        int rollback_length = GetDraftModelRollbackLength(
+            cum_verify_lengths[i + 1] - cum_verify_lengths[i], accept_length, optimistic_draft);
         if (rollback_length > 0) {
-          // The last accepted token is not yet added into the draft model.
-          // Therefore, the rollback length for the draft model is one less.
           models_[draft_model_id_]->PopNFromKVCache(
-              rsentries[i]->mstates[draft_model_id_]->internal_id, rollback_length - 1);
+              rsentries[i]->mstates[draft_model_id_]->internal_id, rollback_length);
         }
       }
       // Commit accepted tokens to the "verify_model", rollback kv cache
@@ -200,9 +240,13 @@ class BatchVerifyActionObj : public EngineActionObj {
       // NOTE: when number of small models is more than 1 (in the future),
       // it is possible to re-compute prefill for the small models.
       verify_model_seq_internal_ids.push_back(rsentries[i]->mstates[verify_model_id_]->internal_id);
-      draft_model_seq_internal_ids.push_back(rsentries[i]->mstates[draft_model_id_]->internal_id);
       int last_accepted = last_accepted_tree_node_verify_model[i] -
                           1;  // minus one to get the index in the draft tokens
+      if (!has_draft || !HasDraftModel()) {
+        // Nothing is added into the draft model's KV cache in this step.
+        continue;
+      }
+      draft_model_seq_internal_ids.push_back(draft_mstate->internal_id);
       if (last_accepted >= 0 &&
           rsentries[i]->mstates[draft_model_id_]->draft_token_first_child_idx[last_accepted] ==
               -1) {  // minus one to get the index in the draft tokens
@@ -218,12 +262,12 @@ class BatchVerifyActionObj : public EngineActionObj {
         verify_model_seq_internal_ids,
         std::vector<int64_t>{last_accepted_tree_node_verify_model.begin(),
                              last_accepted_tree_node_verify_model.end()});
-    if (engine_config_->spec_tree_width > 1) {
+    if (engine_config_->spec_tree_width > 1 && !draft_model_seq_internal_ids.empty()) {
       models_[draft_model_id_]->CommitAcceptedTokenTreeNodesToKVCache(
           draft_model_seq_internal_ids, last_accepted_tree_node_draft_model);
     }
 
-    if (!fully_accepted_rsentries.empty()) {
+    if (!fully_accepted_rsentries.empty() && !optimistic_draft) {
       // - Run a step of batch decode for requests whose drafts are fully accepted.
       // When a request's draft is fully accepted, there is an extra token proposed
       // by the draft model but not added into the draft model's KV cache.
@@ -260,7 +304,9 @@ class BatchVerifyActionObj : public EngineActionObj {
     // clear the draft model state entries
     for (int i = 0; i < num_rsentries; ++i) {
       rsentries[i]->mstates[draft_model_id_]->RemoveAllDraftTokens(&draft_token_slots_);
-      draft_token_workspace_manager_->FreeSlots(draft_token_slots_);
+      if (HasDraftModel()) {
+        draft_token_workspace_manager_->FreeSlots(draft_token_slots_);
+      }
       // reset num_tokens_for_next_decode to 1
       rsentries[i]->mstates[verify_model_id_]->num_tokens_for_next_decode = 1;
       rsentries[i]->mstates[draft_model_id_]->num_tokens_for_next_decode = 1;
@@ -275,6 +321,32 @@ class BatchVerifyActionObj : public EngineActionObj {
   }
 
  private:
+  /*!
+   * \brief Feed the last draft token of each request with drafts into the draft model, as if
+   * the drafts are fully accepted. The logits are not sampled, and the token ids staging buffer
+   * of the draft model is not reused before the verification synchronizes the device.
+   */
+  void FeedLastDraftTokens(const Array<RequestStateEntry>& rsentries) {
+    std::vector<int> input_tokens;
+    std::vector<int64_t> internal_ids;
+    input_tokens.reserve(rsentries.size());
+    internal_ids.reserve(rsentries.size());
+    for (const RequestStateEntry& rsentry : rsentries) {
+      const RequestModelState& draft_mstate = rsentry->mstates[draft_model_id_];
+      if (draft_mstate->draft_output_tokens.empty()) {
+        continue;
+      }
+      input_tokens.push_back(draft_mstate->draft_output_tokens.back().GetTokenId());
+      internal_ids.push_back(draft_mstate->internal_id);
+    }
+    if (input_tokens.empty()) {
+      return;
+    }
+    ObjectRef embeddings =
+        models_[draft_model_id_]->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
+    models_[draft_model_id_]->BatchDecode(embeddings, internal_ids);
+  }
+
   struct DraftRequestStateEntries {
     /*! \brief The request state entries to verify. */
     Array<RequestStateEntry> draft_rsentries;
@@ -313,18 +385,23 @@ class BatchVerifyActionObj : public EngineActionObj {
       if (estate->prefix_cache->TryFreeMemory()) continue;
       RequestStateEntry preempted = PreemptLastRunningRequestStateEntry(
           estate, models_, draft_token_workspace_manager_, trace_recorder_);
-      if (preempted.same_as(running_rsentries.back())) {
-        total_verify_length -= verify_lengths.back();
-        total_required_pages -= num_page_requirement.back();
-        verify_lengths.pop_back();
-        num_page_requirement.pop_back();
-        running_rsentries.pop_back();
+      auto it = std::find(running_rsentries.begin(), running_rsentries.end(), preempted);
+      if (it != running_rsentries.end()) {
+        int preempted_idx = std::distance(running_rsentries.begin(), it);
+        total_verify_length -= verify_lengths[preempted_idx];
+        total_required_pages -= num_page_requirement[preempted_idx];
+        verify_lengths.erase(verify_lengths.begin() + preempted_idx);
+        num_page_requirement.erase(num_page_requirement.begin() + preempted_idx);
+        running_rsentries.erase(it);
       }
     }
 
     return {running_rsentries, verify_lengths, total_verify_length};
   }
 
+  /*! \brief Whether the drafts are proposed by a draft model, rather than without a model. */
+  bool HasDraftModel() const { return draft_model_id_ != verify_model_id_; }
+
   bool CanVerify(int num_required_pages) {
     int num_available_pages = models_[0]->GetNumAvailablePages();
     return num_required_pages <= num_available_pages;
@@ -349,9 +426,12 @@ class BatchVerifyActionObj : public EngineActionObj {
   Optional<EventTraceRecorder> trace_recorder_;
   /*! \brief Random number generator. */
   RandomGenerator& rng_;
-  /*! \brief The ids of verify/draft models. */
+  /*!
+   * \brief The ids of verify/draft models. The draft tokens live in the states of the
+   * verify model when they are proposed without a draft model.
+   */
   const int verify_model_id_ = 0;
-  const int draft_model_id_ = 1;
+  const int draft_model_id_;
   const float eps_ = 1e-5;
   /*! \brief Temporary buffer to store the slots of the current draft tokens */
   std::vector<int> draft_token_slots_;
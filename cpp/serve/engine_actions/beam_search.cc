@@ -0,0 +1,320 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/beam_search.cc
+ */
+
+#include "beam_search.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+GenerationConfig GetSamplingGenerationConfig(const RequestStateEntry& rsentry) {
+  const GenerationConfig& generation_cfg = rsentry->request->generation_cfg;
+  if (!generation_cfg->use_beam_search) {
+    return generation_cfg;
+  }
+  BeamSearchState& beam_search = rsentry->rstate->beam_search;
+  if (!beam_search.candidate_generation_cfg.defined()) {
+    // The beams are scored with the unmodified distribution, while the logit bias
+    // and the penalties still apply. Each beam proposes up to `2n` candidates,
+    // so that the stop tokens among them do not starve the next beams.
+    ObjectPtr<GenerationConfigNode> n = make_object<GenerationConfigNode>(*generation_cfg.get());
+    n->temperature = 1.0;
+    n->top_p = 1.0;
+    n->min_p = 0.0;
+    n->typical_p = 1.0;
+    n->logprobs = true;
+    n->top_logprobs = 2 * generation_cfg->n;
+    beam_search.candidate_generation_cfg = GenerationConfig(n);
+  }
+  return beam_search.candidate_generation_cfg.value();
+}
+
+namespace {
+
+/*! \brief A beam candidate, which extends a beam with one token. */
+struct BeamCandidate {
+  /*! \brief The cumulative log probability after extending the beam. */
+  double score;
+  /*! \brief The index of the prob distribution of the extended beam. */
+  int row;
+  /*! \brief The extending token. */
+  TokenProbPair token;
+};
+
+/*! \brief Return the beam score normalized by the generation length. */
+double NormalizeBeamScore(double score, int64_t length, double length_penalty) {
+  return score / std::pow(static_cast<double>(std::max<int64_t>(length, 1)), length_penalty);
+}
+
+/*!
+ * \brief Make the target beam a copy of the source beam, by forking the KV cache of the
+ * source beam and copying the committed tokens.
+ */
+void CopyBeam(EngineState estate, const Array<Model>& models, const RequestStateEntry& source,
+              const RequestStateEntry& target) {
+  int64_t internal_id = target->mstates[0]->internal_id;
+  if (estate->prefix_cache->HasSequence(internal_id)) {
+    // The prefix cache removes the sequence from the models and recycles the id.
+    estate->prefix_cache->RecycleSequence(internal_id, /*lazy=*/false);
+    internal_id = estate->id_manager.GetNewId();
+    for (RequestModelState mstate : target->mstates) {
+      mstate->internal_id = internal_id;
+    }
+    // The running request table caches the internal ids.
+    estate->running_rsentries_changed = true;
+  } else {
+    RemoveRequestFromModel(estate, internal_id, models);
+  }
+  for (int model_id = 0; model_id < static_cast<int>(models.size()); ++model_id) {
+    models[model_id]->ForkSequence(source->mstates[model_id]->internal_id, internal_id);
+    models[model_id]->EnableSlidingWindowForSeq(internal_id);
+  }
+
+  for (int model_id = 0; model_id < static_cast<int>(target->mstates.size()); ++model_id) {
+    RequestModelState src = source->mstates[model_id];
+    RequestModelState dst = target->mstates[model_id];
+    if (dst->penalty_slot != -1) {
+      // Both the counts of the old tokens and the new tokens change.
+      for (const auto& [token_id, count] : dst->appeared_token_ids) {
+        dst->penalty_dirty_tokens.push_back(token_id);
+      }
+      for (const auto& [token_id, count] : src->appeared_token_ids) {
+        dst->penalty_dirty_tokens.push_back(token_id);
+      }
+    }
+    dst->committed_tokens = src->committed_tokens;
+    dst->appeared_token_ids = src->appeared_token_ids;
+    dst->cached_committed_tokens = src->cached_committed_tokens;
+    dst->num_tokens_for_next_decode = src->num_tokens_for_next_decode;
+  }
+}
+
+/*!
+ * \brief Run one beam search step for the beams of a request.
+ * \param positions The positions of the beams in the samples.
+ */
+void BeamSearchStep(EngineState estate, const Array<Model>& models,
+                    const std::vector<RequestStateEntry>& rsentries,
+                    const std::vector<int>& sample_indices, const std::vector<int>& positions,
+                    std::vector<SampleResult>* sample_results,
+                    int64_t max_single_sequence_length) {
+  RequestStateNode* rstate = rsentries[positions[0]]->rstate;
+  BeamSearchState& beam_search = rstate->beam_search;
+  const GenerationConfig& generation_cfg = rsentries[positions[0]]->request->generation_cfg;
+  const int num_beams = generation_cfg->n;
+  const int num_top_logprobs = generation_cfg->logprobs ? generation_cfg->top_logprobs : 0;
+
+  // - Group the beams by their prob distributions.
+  std::vector<std::vector<int>> row_positions;
+  std::unordered_map<int, int> row_of_sample_index;
+  for (int pos : positions) {
+    auto [it, inserted] = row_of_sample_index.emplace(sample_indices[pos], row_positions.size());
+    if (inserted) {
+      row_positions.emplace_back();
+    }
+    row_positions[it->second].push_back(pos);
+  }
+
+  // - Collect and rank the candidates.
+  std::vector<BeamCandidate> candidates;
+  for (int row = 0; row < static_cast<int>(row_positions.size()); ++row) {
+    int pos = row_positions[row][0];
+    for (const TokenProbPair& token : (*sample_results)[pos].top_prob_tokens) {
+      if (token.second > 0) {
+        candidates.push_back({rsentries[pos]->beam_score + std::log(token.second), row, token});
+      }
+    }
+  }
+  std::stable_sort(
+      candidates.begin(), candidates.end(),
+      [](const BeamCandidate& a, const BeamCandidate& b) { return a.score > b.score; });
+
+  auto f_make_sample_result = [&](const BeamCandidate& candidate) {
+    const std::vector<TokenProbPair>& top_prob_tokens =
+        (*sample_results)[row_positions[candidate.row][0]].top_prob_tokens;
+    SampleResult result;
+    result.sampled_token_id = candidate.token;
+    result.top_prob_tokens.assign(
+        top_prob_tokens.begin(),
+        top_prob_tokens.begin() +
+            std::min(num_top_logprobs, static_cast<int>(top_prob_tokens.size())));
+    return result;
+  };
+  auto f_is_stop_token = [&](int32_t token_id) {
+    return !generation_cfg->debug_config.ignore_eos &&
+           std::find(generation_cfg->stop_token_ids.begin(), generation_cfg->stop_token_ids.end(),
+                     token_id) != generation_cfg->stop_token_ids.end();
+  };
+  auto f_add_hypothesis = [&](std::vector<SampleResult> tokens, double score) {
+    double normalized_score =
+        NormalizeBeamScore(score, tokens.size(), generation_cfg->length_penalty);
+    auto it = std::find_if(
+        beam_search.hypotheses.begin(), beam_search.hypotheses.end(),
+        [normalized_score](const auto& hypothesis) { return hypothesis.score < normalized_score; });
+    beam_search.hypotheses.insert(it, {std::move(tokens), normalized_score});
+    if (static_cast<int>(beam_search.hypotheses.size()) > num_beams) {
+      beam_search.hypotheses.pop_back();
+    }
+  };
+
+  // - Select the next beams. A candidate ending with a stop token finishes its beam,
+  // when it ranks among the top `num_beams` candidates.
+  std::vector<const BeamCandidate*> selected;
+  for (int rank = 0; rank < static_cast<int>(candidates.size()); ++rank) {
+    const BeamCandidate& candidate = candidates[rank];
+    if (f_is_stop_token(candidate.token.first)) {
+      if (rank < num_beams) {
+        const RequestStateEntry& beam = rsentries[row_positions[candidate.row][0]];
+        std::vector<SampleResult> tokens = beam->mstates[0]->committed_tokens;
+        tokens.push_back(f_make_sample_result(candidate));
+        f_add_hypothesis(std::move(tokens), candidate.score);
+      }
+      continue;
+    }
+    selected.push_back(&candidate);
+    if (static_cast<int>(selected.size()) == static_cast<int>(positions.size())) {
+      break;
+    }
+  }
+
+  // - Place the next beams. A beam stays in place when it is extended, and a pruned
+  // beam takes over the candidate of another beam by forking it.
+  if (!selected.empty()) {
+    int num_positions = positions.size();
+    std::vector<int> assigned_pos(num_positions, -1);
+    std::vector<int> num_used_in_row(row_positions.size(), 0);
+    std::vector<bool> pos_used(rsentries.size(), false);
+    for (int j = 0; j < num_positions; ++j) {
+      // Duplicate the best candidates if there are not enough candidates.
+      const BeamCandidate& candidate = *selected[j % selected.size()];
+      int& num_used = num_used_in_row[candidate.row];
+      if (num_used < static_cast<int>(row_positions[candidate.row].size())) {
+        assigned_pos[j] = row_positions[candidate.row][num_used++];
+        pos_used[assigned_pos[j]] = true;
+      }
+    }
+    int next_free = 0;
+    for (int j = 0; j < num_positions; ++j) {
+      const BeamCandidate& candidate = *selected[j % selected.size()];
+      if (assigned_pos[j] == -1) {
+        while (pos_used[positions[next_free]]) {
+          ++next_free;
+        }
+        assigned_pos[j] = positions[next_free];
+        pos_used[assigned_pos[j]] = true;
+        CopyBeam(estate, models, rsentries[row_positions[candidate.row][0]],
+                 rsentries[assigned_pos[j]]);
+      }
+    }
+    for (int j = 0; j < num_positions; ++j) {
+      const BeamCandidate& candidate = *selected[j % selected.size()];
+      rsentries[assigned_pos[j]]->beam_score = candidate.score;
+      (*sample_results)[assigned_pos[j]] = f_make_sample_result(candidate);
+    }
+  }
+
+  // - Check if the beam search finishes. The beams finish together, so we wait
+  // for the preempted beams to come back before finishing.
+  if (static_cast<int>(positions.size()) != num_beams) {
+    return;
+  }
+  const RequestStateEntry& first_beam = rsentries[positions[0]];
+  int64_t length = first_beam->mstates[0]->committed_tokens.size() + 1;
+  bool reach_max_length =
+      (generation_cfg->max_tokens >= 0 && length >= generation_cfg->max_tokens) ||
+      first_beam->request->prompt_tokens + length >= max_single_sequence_length;
+  if (!reach_max_length && !selected.empty() &&
+      static_cast<int>(beam_search.hypotheses.size()) < num_beams) {
+    return;
+  }
+  beam_search.finished = true;
+  if (selected.empty() || static_cast<int>(beam_search.hypotheses.size()) < num_beams) {
+    // The unfinished beams compete with the finished ones when there are not enough of them.
+    std::vector<std::pair<std::vector<SampleResult>, double>> beams;
+    for (int pos : positions) {
+      std::vector<SampleResult> tokens = rsentries[pos]->mstates[0]->committed_tokens;
+      tokens.push_back((*sample_results)[pos]);
+      beams.emplace_back(std::move(tokens), rsentries[pos]->beam_score);
+    }
+    for (auto& [tokens, score] : beams) {
+      f_add_hypothesis(std::move(tokens), score);
+    }
+  }
+  for (const BeamSearchState::Hypothesis& hypothesis : beam_search.hypotheses) {
+    beam_search.outputs.push_back(hypothesis.tokens);
+  }
+  while (static_cast<int>(beam_search.outputs.size()) < num_beams) {
+    beam_search.outputs.push_back(beam_search.outputs.back());
+  }
+}
+
+}  // namespace
+
+void SelectBeamSearchTokens(EngineState estate, const Array<Model>& models,
+                            const std::vector<RequestStateEntry>& rsentries,
+                            const std::vector<int>& sample_indices,
+                            std::vector<SampleResult>* sample_results,
+                            int64_t max_single_sequence_length) {
+  ICHECK_EQ(sample_indices.size(), rsentries.size());
+  ICHECK_EQ(sample_results->size(), rsentries.size());
+  // - Group the samples by requests.
+  std::vector<std::vector<int>> request_positions;
+  std::unordered_map<RequestStateNode*, int> request_index;
+  for (int i = 0; i < static_cast<int>(rsentries.size()); ++i) {
+    // The beams not activated in prefill yet join the search when they are activated.
+    if (!rsentries[i]->request->generation_cfg->use_beam_search ||
+        rsentries[i]->status != RequestStateStatus::kAlive ||
+        rsentries[i]->rstate->beam_search.finished) {
+      continue;
+    }
+    auto [it, inserted] = request_index.emplace(rsentries[i]->rstate, request_positions.size());
+    if (inserted) {
+      request_positions.emplace_back();
+    }
+    request_positions[it->second].push_back(i);
+  }
+  for (const std::vector<int>& positions : request_positions) {
+    BeamSearchStep(estate, models, rsentries, sample_indices, positions, sample_results,
+                   max_single_sequence_length);
+  }
+}
+
+void FinalizeBeamSearch(const std::vector<RequestStateEntry>& rsentries) {
+  for (const RequestStateEntry& rsentry : rsentries) {
+    BeamSearchState& beam_search = rsentry->rstate->beam_search;
+    if (!rsentry->request->generation_cfg->use_beam_search || beam_search.outputs.empty()) {
+      continue;
+    }
+    // The beams are the leaf entries of the request.
+    RequestStateNode* rstate = rsentry->rstate;
+    int num_beams = rsentry->request->generation_cfg->n;
+    ICHECK_EQ(static_cast<int>(beam_search.outputs.size()), num_beams);
+    rstate->metrics.completion_tokens = 0;
+    for (int i = 0; i < num_beams; ++i) {
+      const RequestStateEntry& beam = num_beams == 1 ? rstate->entries[0] : rstate->entries[i + 1];
+      for (RequestModelState mstate : beam->mstates) {
+        mstate->RollbackTokens(mstate->committed_tokens.size());
+        for (const SampleResult& token : beam_search.outputs[i]) {
+          mstate->CommitToken(token);
+        }
+        // Only a single-beam search keeps its beam in the prefix cache. Its generation is a
+        // prefix of its path in the KV cache plus one token, so the prefix cache stays
+        // consistent as long as it does not go beyond the generation.
+        mstate->cached_committed_tokens =
+            std::min<int64_t>(mstate->cached_committed_tokens, mstate->committed_tokens.size());
+      }
+      rstate->metrics.completion_tokens += beam_search.outputs[i].size();
+    }
+    beam_search.outputs.clear();
+  }
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,61 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/beam_search.h
+ * \brief The beam search functions shared by the engine actions that sample tokens.
+ */
+#ifndef MLC_LLM_SERVE_ENGINE_ACTIONS_BEAM_SEARCH_H_
+#define MLC_LLM_SERVE_ENGINE_ACTIONS_BEAM_SEARCH_H_
+
+#include <vector>
+
+#include "../engine_state.h"
+#include "../model.h"
+#include "../request_state.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*!
+ * \brief Return the generation config to process the logits and sample the tokens of the
+ * given request state entry with. For beam search requests, it is the config that computes
+ * the beam candidates. Otherwise, it is the generation config of the request.
+ */
+GenerationConfig GetSamplingGenerationConfig(const RequestStateEntry& rsentry);
+
+/*!
+ * \brief Run one beam search step over the sample results of the beams, before the sampled
+ * tokens are committed. The beam candidates are the top prob tokens of each sample result.
+ * Each step keeps the `n` best candidates as the new beams, and records the candidates
+ * ending with a stop token as finished beams.
+ * A beam that continues a pruned beam's slot forks the KV cache of its origin beam, so that
+ * the KV pages of the shared prefix are shared rather than copied.
+ * The sample results of the beams are updated in place to the tokens to commit.
+ * The entries of requests not using beam search are left untouched.
+ * \param estate The engine state.
+ * \param models The models whose KV cache the beams live in.
+ * \param rsentries The request state entry of each sample.
+ * \param sample_indices The prob distribution index of each sample. Samples sharing a prob
+ * distribution are still at the same state, e.g., the beams right after the prompt prefill.
+ * \param sample_results The sample results to update.
+ * \param max_single_sequence_length The max single sequence length of the engine.
+ */
+void SelectBeamSearchTokens(EngineState estate, const Array<Model>& models,
+                            const std::vector<RequestStateEntry>& rsentries,
+                            const std::vector<int>& sample_indices,
+                            std::vector<SampleResult>* sample_results,
+                            int64_t max_single_sequence_length);
+
+/*!
+ * \brief Write the selected generations of the finished beam searches into the beams,
+ * after the tokens of the beam search step are committed. The beams then return the
+ * generations and finish in the action post-process.
+ * \param rsentries The request state entries processed in the step.
+ */
+void FinalizeBeamSearch(const std::vector<RequestStateEntry>& rsentries);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_ENGINE_ACTIONS_BEAM_SEARCH_H_
@@ -35,6 +35,8 @@ class EagleBatchDraftActionObj : public EngineActionObj {
         engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)) {}
 
+  String Name() const final { return "eagle_batch_draft"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
     if (models_.size() != 2 || estate->running_queue.empty()) {
@@ -47,8 +49,9 @@ class EagleBatchDraftActionObj : public EngineActionObj {
       if (estate->prefix_cache->TryFreeMemory()) continue;
       RequestStateEntry preempted = PreemptLastRunningRequestStateEntry(
           estate, models_, draft_token_workspace_manager_, trace_recorder_);
-      if (preempted.same_as(running_rsentries.back())) {
-        running_rsentries.pop_back();
+      auto it = std::find(running_rsentries.begin(), running_rsentries.end(), preempted);
+      if (it != running_rsentries.end()) {
+        running_rsentries.erase(it);
       }
     }
 
@@ -105,6 +108,12 @@ class EagleBatchDraftActionObj : public EngineActionObj {
         hidden_states = models_[model_id]->GatherHiddenStates(
             model_workspaces_[0].draft_hidden_states_storage, draft_token_slots_, &hidden_states);
       }
+      // The draft tokens sampled on device in the previous round, which are fed to the
+      // embedding of the next round directly.
+      NDArray sampled_token_ids_on_device{nullptr};
+      // Fill range [0, num_rsentries) into `sample_indices`.
+      std::vector<int> sample_indices(num_rsentries);
+      std::iota(sample_indices.begin(), sample_indices.end(), 0);
       // The first draft token has been generated in prefill/verify stage
       for (int draft_id = 1; draft_id < estate->spec_draft_length; ++draft_id) {
         draft_token_indices.clear();
@@ -120,8 +129,14 @@ class EagleBatchDraftActionObj : public EngineActionObj {
 
         // - Compute embeddings.
         RECORD_EVENT(trace_recorder_, request_ids, "start proposal embedding");
-        ObjectRef embeddings =
-            models_[model_id]->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
+        ObjectRef embeddings{nullptr};
+        if (sampled_token_ids_on_device.defined()) {
+          embeddings = models_[model_id]->TokenEmbedOnDevice(sampled_token_ids_on_device);
+        }
+        if (!embeddings.defined()) {
+          embeddings =
+              models_[model_id]->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
+        }
         RECORD_EVENT(trace_recorder_, request_ids, "finish proposal embedding");
 
         // - Invoke model decode.
@@ -152,16 +167,16 @@ class EagleBatchDraftActionObj : public EngineActionObj {
         // - Commit the prefix cache changes from previous round of action.
         // Note: we commit prefix cache changes here to overlap this commit with the GPU execution.
         estate->prefix_cache->CommitSequenceExtention();
+        // - Invoke the deferred stream callback of previous step, also overlapping with the GPU.
+        estate->InvokeDeferredStreamCallback();
 
         // - Sample tokens.
-        // Fill range [0, num_rsentries) into `sample_indices`.
-        std::vector<int> sample_indices(num_rsentries);
-        std::iota(sample_indices.begin(), sample_indices.end(), 0);
         NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
             probs_on_device, sample_indices, request_ids, generation_cfg);
         std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
             renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
         ICHECK_EQ(sample_results.size(), num_rsentries);
+        sampled_token_ids_on_device = sampler_->GetLastSampledTokenIdsOnDevice();
 
         // - Add draft token to the state.
         draft_token_workspace_manager_->AllocSlots(num_rsentries, &draft_token_slots_);
@@ -41,6 +41,8 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
         trace_recorder_(std::move(trace_recorder)),
         rng_(RandomGenerator::GetInstance()) {}
 
+  String Name() const final { return "eagle_batch_verify"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
     if (models_.size() != 2 || estate->running_queue.empty()) {
@@ -144,6 +146,8 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
     // - Commit the prefix cache changes from previous round of action.
     // Note: we commit prefix cache changes here to overlap this commit with the GPU execution.
     estate->prefix_cache->CommitSequenceExtention();
+    // - Invoke the deferred stream callback of previous step, also overlapping with the GPU.
+    estate->InvokeDeferredStreamCallback();
 
     std::vector<int> sample_indices(num_rsentries);
     std::iota(sample_indices.begin(), sample_indices.end(), 0);
@@ -382,12 +386,14 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
       if (estate->prefix_cache->TryFreeMemory()) continue;
       RequestStateEntry preempted = PreemptLastRunningRequestStateEntry(
           estate, models_, draft_token_workspace_manager_, trace_recorder_);
-      if (preempted.same_as(running_rsentries.back())) {
-        total_draft_length -= draft_lengths.back();
-        total_required_pages -= num_page_requirement.back();
-        draft_lengths.pop_back();
-        num_page_requirement.pop_back();
-        running_rsentries.pop_back();
+      auto it = std::find(running_rsentries.begin(), running_rsentries.end(), preempted);
+      if (it != running_rsentries.end()) {
+        int preempted_idx = std::distance(running_rsentries.begin(), it);
+        total_draft_length -= draft_lengths[preempted_idx];
+        total_required_pages -= num_page_requirement[preempted_idx];
+        draft_lengths.erase(draft_lengths.begin() + preempted_idx);
+        num_page_requirement.erase(num_page_requirement.begin() + preempted_idx);
+        running_rsentries.erase(it);
       }
     }
 
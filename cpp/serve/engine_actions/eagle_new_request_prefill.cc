@@ -30,6 +30,8 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         model_workspaces_(std::move(model_workspaces)),
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)) {}
 
+  String Name() const final { return "eagle_new_request_prefill"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Find the requests in `waiting_queue` that can prefill in this step.
     std::vector<PrefillInput> prefill_inputs;
@@ -41,13 +43,11 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       }
     }
 
-    int num_rsentries = prefill_inputs.size();
     {
       NVTXScopedRange nvtx_scope("NewRequestPrefill matching prefix");
-      for (int i = 0; i < num_rsentries; ++i) {
-        MatchPrefixCache(estate, &prefill_inputs[i]);
-      }
+      MatchPrefixCacheAndDeferSharedPrefix(estate, &prefill_inputs);
     }
+    int num_rsentries = prefill_inputs.size();
 
     auto tstart = std::chrono::high_resolution_clock::now();
 
@@ -333,7 +333,10 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     }
 
     auto tend = std::chrono::high_resolution_clock::now();
-    estate->metrics.engine_prefill_time_sum += static_cast<double>((tend - tstart).count()) / 1e9;
+    double elapsed_time = static_cast<double>((tend - tstart).count()) / 1e9;
+    estate->metrics.engine_prefill_time_sum += elapsed_time;
+    estate->metrics.UpdatePrefillTimeByBatchSize(num_rsentries, elapsed_time);
+    UpdatePrefillLatencyEstimate(estate, prefill_inputs, prefill_lengths, elapsed_time);
 
     std::vector<Request> processed_requests =
         RemoveProcessedRequests(prefill_inputs, estate, rstates_of_entries);
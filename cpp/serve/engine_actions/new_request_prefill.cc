@@ -5,6 +5,7 @@
 
 #include "../sampler/sampler.h"
 #include "batch_prefill_base.h"
+#include "beam_search.h"
 
 namespace mlc {
 namespace llm {
@@ -27,6 +28,8 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         sampler_(std::move(sampler)),
         model_workspaces_(std::move(model_workspaces)) {}
 
+  String Name() const final { return "new_request_prefill"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Find the requests in `waiting_queue` that can prefill in this step.
     std::vector<PrefillInput> prefill_inputs;
@@ -38,13 +41,11 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       }
     }
 
-    int num_rsentries = prefill_inputs.size();
     {
       NVTXScopedRange nvtx_scope("NewRequestPrefill matching prefix");
-      for (int i = 0; i < num_rsentries; ++i) {
-        MatchPrefixCache(estate, &prefill_inputs[i]);
-      }
+      MatchPrefixCacheAndDeferSharedPrefix(estate, &prefill_inputs);
     }
+    int num_rsentries = prefill_inputs.size();
 
     auto tstart = std::chrono::high_resolution_clock::now();
 
@@ -55,10 +56,30 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     UpdateRequestToAlive(prefill_inputs, estate, &request_ids, &rstates_of_entries,
                          &status_before_prefill);
 
+    // - Collect the pooling of the embedding requests in the batch. The hidden states of all
+    // prefilled tokens are kept for the embedding requests and the prompt logprobs.
+    bool has_embedding_request = false;
+    bool has_prompt_logprobs = false;
+    std::vector<bool> use_mean_pooling;
+    use_mean_pooling.reserve(num_rsentries);
+    for (const PrefillInput& prefill_input : prefill_inputs) {
+      const GenerationConfig& cfg = prefill_input.rsentry->request->generation_cfg;
+      has_embedding_request |= cfg->embedding_pooling != EmbeddingPooling::kNone;
+      has_prompt_logprobs |= cfg->prompt_logprobs && !prefill_input.is_decode;
+      use_mean_pooling.push_back(cfg->embedding_pooling == EmbeddingPooling::kMean);
+    }
+    bool keep_hidden_states = has_embedding_request || has_prompt_logprobs;
+    // The start position and the tokens of the prefilled chunk of each input, followed by
+    // the next prompt token, from which the prompt logprobs are computed.
+    std::vector<int64_t> prompt_chunk_begins(num_rsentries, 0);
+    std::vector<std::vector<int32_t>> prompt_chunk_token_ids(num_rsentries);
+
     // - Get embedding and run prefill for each model.
     std::vector<int> prefill_lengths;
     prefill_lengths.resize(/*size=*/num_rsentries, /*value=*/-1);
     NDArray logits_for_sample{nullptr};
+    NDArray pooled_hidden_states{nullptr};
+    ObjectRef prefilled_hidden_states{nullptr};
     for (int model_id = 0; model_id < static_cast<int>(models_.size()); ++model_id) {
       std::vector<int64_t> request_internal_ids;
       request_internal_ids.reserve(num_rsentries);
@@ -67,9 +88,13 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       bool single_input =
           num_rsentries == 1 && prefill_inputs[0].rsentry->mstates[model_id]->inputs.size() == 1;
       std::vector<int64_t> cached_token_data;
+      std::vector<int> lora_adapter_indices;
+      bool use_lora = false;
       for (int i = 0; i < num_rsentries; ++i) {
         const RequestStateEntry& rsentry = prefill_inputs[i].rsentry;
         RequestModelState mstate = rsentry->mstates[model_id];
+        lora_adapter_indices.push_back(mstate->lora_adapter_index);
+        use_lora |= mstate->lora_adapter_index != -1;
         auto [input_data, input_length] =
             ChunkPrefillInputData(mstate, prefill_inputs[i].max_prefill_length);
         if (prefill_lengths[i] == -1) {
@@ -77,6 +102,11 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         } else {
           ICHECK_EQ(prefill_lengths[i], input_length);
         }
+        if (model_id == 0 && !prefill_inputs[i].is_decode &&
+            rsentry->request->generation_cfg->prompt_logprobs) {
+          prompt_chunk_begins[i] = mstate->num_prefilled_tokens;
+          prompt_chunk_token_ids[i] = GetPromptChunkTokenIds(input_data, mstate);
+        }
         mstate->num_prefilled_tokens += input_length;
 
         ICHECK(mstate->draft_output_tokens.empty());
@@ -134,8 +164,24 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       }
 
       RECORD_EVENT(trace_recorder_, request_ids, "start prefill");
-      NDArray logits =
-          models_[model_id]->BatchPrefill(embeddings, request_internal_ids, prefill_lengths);
+      if (use_lora) {
+        models_[model_id]->SetBatchLoRAAdapters(std::move(lora_adapter_indices));
+      }
+      NDArray logits{nullptr};
+      if (!keep_hidden_states) {
+        logits = models_[model_id]->BatchPrefill(embeddings, request_internal_ids, prefill_lengths);
+      } else {
+        // The hidden states of the embedding requests are pooled on device, together with the
+        // last hidden states of the others.
+        ICHECK_EQ(models_.size(), 1U);
+        prefilled_hidden_states = models_[model_id]->BatchPrefillToLastHidden(
+            embeddings, request_internal_ids, prefill_lengths);
+        auto [pooled, pooled_f32] = models_[model_id]->PoolHiddenStates(
+            prefilled_hidden_states, prefill_lengths, use_mean_pooling);
+        pooled_hidden_states = pooled_f32;
+        logits = models_[model_id]->GetLogits(pooled);
+        logits = logits.CreateView({1, num_rsentries, logits->shape[1]}, logits->dtype);
+      }
       RECORD_EVENT(trace_recorder_, request_ids, "finish prefill");
       ICHECK_EQ(logits->ndim, 3);
       ICHECK_EQ(logits->shape[0], 1);
@@ -154,7 +200,7 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     generation_cfg.reserve(num_rsentries);
     mstates_for_logitproc.reserve(num_rsentries);
     for (int i = 0; i < num_rsentries; ++i) {
-      generation_cfg.push_back(prefill_inputs[i].rsentry->request->generation_cfg);
+      generation_cfg.push_back(GetSamplingGenerationConfig(prefill_inputs[i].rsentry));
       mstates_for_logitproc.push_back(prefill_inputs[i].rsentry->mstates[0]);
     }
     logits_for_sample = logits_for_sample.CreateView({num_rsentries, logits_for_sample->shape[2]},
@@ -169,6 +215,8 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     // - Commit the prefix cache changes from previous round of action.
     // Note: we commit prefix cache changes here to overlap this commit with the GPU execution.
     estate->prefix_cache->CommitSequenceExtention();
+    // - Invoke the deferred stream callback of previous step, also overlapping with the GPU.
+    estate->InvokeDeferredStreamCallback();
 
     // - Sample tokens.
     //   For rsentries which have children, sample
@@ -186,8 +234,9 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     generation_cfg.clear();
     for (int i = 0; i < num_rsentries; ++i) {
       const RequestStateEntry& rsentry = prefill_inputs[i].rsentry;
-      // No sample for rsentries with remaining inputs.
-      if (!rsentry->mstates[0]->inputs.empty()) {
+      // No sample for rsentries with remaining inputs, or for embedding requests.
+      if (!rsentry->mstates[0]->inputs.empty() ||
+          rsentry->request->generation_cfg->embedding_pooling != EmbeddingPooling::kNone) {
         continue;
       }
 
@@ -204,7 +253,7 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         sample_indices.push_back(i);
         rsentries_for_sample.push_back(rstates_of_entries[i]->entries[child_idx]);
         request_ids.push_back(rsentry->request->id);
-        generation_cfg.push_back(rsentry->request->generation_cfg);
+        generation_cfg.push_back(GetSamplingGenerationConfig(rsentry));
         rngs.push_back(&rstates_of_entries[i]->entries[child_idx]->rng);
 
         ICHECK(rstates_of_entries[i]->entries[child_idx]->status == RequestStateStatus::kPending);
@@ -235,7 +284,7 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         sample_indices.push_back(i);
         rsentries_for_sample.push_back(rsentry);
         request_ids.push_back(rsentry->request->id);
-        generation_cfg.push_back(rsentry->request->generation_cfg);
+        generation_cfg.push_back(GetSamplingGenerationConfig(rsentry));
         rngs.push_back(&rsentry->rng);
         rsentry_activated.push_back(true);
       }
@@ -245,14 +294,27 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
         renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
     ICHECK_EQ(sample_results.size(), rsentries_for_sample.size());
+    SelectBeamSearchTokens(estate, models_, rsentries_for_sample, sample_indices, &sample_results,
+                           engine_config_->max_single_sequence_length);
 
     // - Update the committed tokens of states.
     // - If a request is first-time prefilled, set the prefill finish time.
     UpdateRequestStateEntriesWithSampleResults(rsentries_for_sample, rsentry_activated,
                                                sample_results);
+    FinalizeBeamSearch(rsentries_for_sample);
+    if (has_embedding_request) {
+      UpdateEmbeddings(prefill_inputs, prefill_lengths, pooled_hidden_states);
+    }
+    if (has_prompt_logprobs) {
+      ComputePromptLogProbs(prefill_inputs, prefill_lengths, prompt_chunk_begins,
+                            prompt_chunk_token_ids, prefilled_hidden_states);
+    }
 
     auto tend = std::chrono::high_resolution_clock::now();
-    estate->metrics.engine_prefill_time_sum += static_cast<double>((tend - tstart).count()) / 1e9;
+    double elapsed_time = static_cast<double>((tend - tstart).count()) / 1e9;
+    estate->metrics.engine_prefill_time_sum += elapsed_time;
+    estate->metrics.UpdatePrefillTimeByBatchSize(num_rsentries, elapsed_time);
+    UpdatePrefillLatencyEstimate(estate, prefill_inputs, prefill_lengths, elapsed_time);
 
     std::vector<Request> processed_requests =
         RemoveProcessedRequests(prefill_inputs, estate, rstates_of_entries);
@@ -268,6 +330,143 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
   /*! \brief Workspace of each model. */
   std::vector<ModelWorkspace> model_workspaces_;
 
+  /*!
+   * \brief Get the tokens of the prefilled chunk, followed by the next prompt token when the
+   * prompt has remaining inputs. The chunks with non-token data have no prompt logprobs.
+   * \param input_data The prefilled chunk.
+   * \param mstate The model state, whose inputs are the remaining inputs after the chunk.
+   * \return The tokens, or an empty vector when the chunk has non-token data.
+   */
+  static std::vector<int32_t> GetPromptChunkTokenIds(const Array<Data>& input_data,
+                                                     const RequestModelState& mstate) {
+    std::vector<int32_t> token_ids;
+    for (const Data& data : input_data) {
+      const auto* token_data = data.as<TokenDataNode>();
+      if (token_data == nullptr) {
+        return {};
+      }
+      token_ids.insert(token_ids.end(), token_data->token_ids.begin(),
+                       token_data->token_ids.end());
+    }
+    if (!mstate->inputs.empty()) {
+      const auto* next_token_data = mstate->inputs[0].as<TokenDataNode>();
+      if (next_token_data != nullptr && next_token_data->token_ids.size() > 0) {
+        token_ids.push_back(next_token_data->token_ids[0]);
+      }
+    }
+    return token_ids;
+  }
+
+  /*!
+   * \brief Compute the probabilities of the prompt tokens from the hidden states of the
+   * prefilled chunks, for the requests with `prompt_logprobs`. The logits of the positions are
+   * computed in batches of at most `max_num_sequence` positions and reduced to the token
+   * probabilities and the top probabilities on device, so that the logits of a whole chunk are
+   * never materialized at once.
+   * \param prefill_inputs The prefill inputs of the batch.
+   * \param prefill_lengths The prefill length of each input.
+   * \param prompt_chunk_begins The start position in the prompt of each prefilled chunk.
+   * \param prompt_chunk_token_ids The tokens of each prefilled chunk followed by the next token.
+   * \param hidden_states The hidden states of all the prefilled tokens.
+   */
+  void ComputePromptLogProbs(const std::vector<PrefillInput>& prefill_inputs,
+                             const std::vector<int>& prefill_lengths,
+                             const std::vector<int64_t>& prompt_chunk_begins,
+                             const std::vector<std::vector<int32_t>>& prompt_chunk_token_ids,
+                             const ObjectRef& hidden_states) {
+    NVTXScopedRange nvtx_scope("NewRequestPrefill prompt logprobs");
+    // The engine allocates the workspace for the models that keep the prefilled hidden states.
+    ICHECK(model_workspaces_[0].hidden_states.defined());
+    int max_num_positions = engine_config_->max_num_sequence;
+    // The prompt logprobs are taken from the model distribution, with no sampling parameters.
+    GenerationConfig model_distribution_cfg(make_object<GenerationConfigNode>());
+    int hidden_offset = 0;
+    for (int i = 0; i < static_cast<int>(prefill_inputs.size()); ++i) {
+      const RequestStateEntry& rsentry = prefill_inputs[i].rsentry;
+      const std::vector<int32_t>& token_ids = prompt_chunk_token_ids[i];
+      // Position k of the chunk predicts the token k + 1 of the chunk.
+      std::vector<int> positions;
+      std::vector<int32_t> next_token_ids;
+      for (int k = 0; k + 1 < static_cast<int>(token_ids.size()); ++k) {
+        int64_t prompt_pos = prompt_chunk_begins[i] + k;
+        if (prompt_pos < rsentry->num_prompt_logprob_positions ||
+            prompt_pos + 1 >= rsentry->request->prompt_tokens) {
+          continue;
+        }
+        positions.push_back(hidden_offset + k);
+        next_token_ids.push_back(token_ids[k + 1]);
+        rsentry->num_prompt_logprob_positions = prompt_pos + 1;
+      }
+      hidden_offset += prefill_lengths[i];
+
+      for (int begin = 0; begin < static_cast<int>(positions.size());
+           begin += max_num_positions) {
+        int end = std::min(begin + max_num_positions, static_cast<int>(positions.size()));
+        ObjectRef position_hidden_states = models_[0]->GatherHiddenStates(
+            hidden_states, std::vector<int>(positions.begin() + begin, positions.begin() + end),
+            &model_workspaces_[0].hidden_states);
+        NDArray logits = models_[0]->GetLogits(position_hidden_states);
+        Array<GenerationConfig> generation_cfg(end - begin, model_distribution_cfg);
+        Array<String> request_ids(end - begin, rsentry->request->id);
+        NDArray probs = logit_processor_->ComputeProbsFromLogits(logits, generation_cfg,
+                                                                 request_ids);
+        std::vector<SampleResult> token_probs = sampler_->BatchTakeTokenProbs(
+            probs,
+            std::vector<int32_t>(next_token_ids.begin() + begin, next_token_ids.begin() + end),
+            rsentry->request->generation_cfg->top_logprobs);
+        rsentry->prompt_token_probs.insert(rsentry->prompt_token_probs.end(),
+                                           token_probs.begin(), token_probs.end());
+      }
+    }
+  }
+
+  /*!
+   * \brief Accumulate the pooled hidden states of the embedding requests in the prefill batch,
+   * whose embeddings are complete once their prompts are fully prefilled. The embedding
+   * requests then finish in the action post-process, which removes them from the KV cache.
+   * \param prefill_inputs The prefill inputs of the batch.
+   * \param prefill_lengths The prefill length of each input.
+   * \param pooled_hidden_states The float32 pooled hidden states of each input.
+   */
+  void UpdateEmbeddings(const std::vector<PrefillInput>& prefill_inputs,
+                        const std::vector<int>& prefill_lengths,
+                        const NDArray& pooled_hidden_states) {
+    // The copy synchronizes with the prefill, which the sampling has already waited for.
+    NDArray pooled_host = pooled_hidden_states.CopyTo(Device{DLDeviceType::kDLCPU, 0});
+    ICHECK_EQ(pooled_host->ndim, 2);
+    ICHECK_EQ(pooled_host->shape[0], static_cast<int64_t>(prefill_inputs.size()));
+    int hidden_size = pooled_host->shape[1];
+    const float* p_pooled = static_cast<const float*>(pooled_host->data);
+    auto tnow = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < static_cast<int>(prefill_inputs.size()); ++i) {
+      const RequestStateEntry& rsentry = prefill_inputs[i].rsentry;
+      EmbeddingPooling pooling = rsentry->request->generation_cfg->embedding_pooling;
+      if (pooling == EmbeddingPooling::kNone) {
+        continue;
+      }
+      const float* p_row = p_pooled + static_cast<int64_t>(i) * hidden_size;
+      std::vector<float>& embedding = rsentry->embedding;
+      embedding.resize(hidden_size, 0.0f);
+      if (pooling == EmbeddingPooling::kMean) {
+        for (int j = 0; j < hidden_size; ++j) {
+          embedding[j] += p_row[j] * prefill_lengths[i];
+        }
+      } else {
+        std::copy(p_row, p_row + hidden_size, embedding.begin());
+      }
+      if (!rsentry->mstates[0]->inputs.empty()) {
+        continue;
+      }
+      if (pooling == EmbeddingPooling::kMean) {
+        float num_prefilled_tokens = rsentry->mstates[0]->num_prefilled_tokens;
+        for (float& value : embedding) {
+          value /= num_prefilled_tokens;
+        }
+      }
+      rsentry->rstate->metrics.prefill_end_time_point = tnow;
+    }
+  }
+
   /*!
    * \brief Match the request state entry with prefix cache, to skip prefilling common prefix
    * tokens. If the request state entry is not added to KVCache yet, this method will add/fork the
@@ -277,12 +476,21 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
    */
   void MatchPrefixCache(EngineState estate, PrefillInput* input) final {
     RequestStateEntry rsentry = input->rsentry;
-    if (estate->prefix_cache->Mode() == PrefixCacheMode::kDisable) {
+    // Embedding requests pool the hidden states of the entire prompt, and hold no KV cache
+    // after the prefill, so they do not match or enter the prefix cache. The prompt logprobs
+    // also need the hidden states of the entire prompt.
+    if (estate->prefix_cache->Mode() == PrefixCacheMode::kDisable ||
+        rsentry->request->generation_cfg->embedding_pooling != EmbeddingPooling::kNone ||
+        rsentry->request->generation_cfg->prompt_logprobs) {
       return;
     }
     if (rsentry->parent_idx == -1 && rsentry->status == RequestStateStatus::kPending &&
         !estate->prefix_cache->HasSequence(rsentry->mstates[0]->internal_id)) {
-      std::vector<int32_t> tokens = GetConcatPrefillInputData(rsentry->mstates[0]);
+      // The images are matched as prefix content, unless the sliding window is enabled, under
+      // which no prefix cache roll back is allowed to align the match to the images.
+      bool include_image_data = models_[0]->GetSlidingWindowSize() == -1;
+      std::vector<int32_t> tokens =
+          GetConcatPrefillInputData(rsentry->mstates[0], include_image_data);
       if (tokens.empty()) {
         // If the RequestStateEntry is of empty input data, or not fully tokenized, do nothing
         // and return.
@@ -291,11 +499,13 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       PrefixCacheMatchedResult result = estate->prefix_cache->InsertSequence(
           rsentry->mstates[0]->internal_id, tokens, models_[0]->GetSlidingWindowSize(),
           models_[0]->GetAttentionSinkSize());
+      if (include_image_data) {
+        AlignPrefixCacheMatchToInputData(estate, rsentry->mstates[0], &result);
+      }
 
-      if (result.prefilled_offset == 0) {
+      if (result.forked_seq_id == -1 && result.reused_seq_id == -1) {
         // Add new sequence
-        CHECK_EQ(result.forked_seq_id, -1);
-        CHECK_EQ(result.reused_seq_id, -1);
+        CHECK_EQ(result.prefilled_offset, 0);
         CHECK_EQ(result.reused_seq_pop_last_tokens, 0);
         for (Model model : models_) {
           model->AddNewSequence(rsentry->mstates[0]->internal_id);
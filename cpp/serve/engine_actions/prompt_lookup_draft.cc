@@ -0,0 +1,156 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/prompt_lookup_draft.cc
+ */
+
+#include <tvm/runtime/nvtx.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "../config.h"
+#include "action.h"
+#include "action_commons.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The max size of the n-grams to match. */
+constexpr int kMaxNgramSize = 3;
+/*! \brief The min size of the n-grams to match. */
+constexpr int kMinNgramSize = 2;
+
+int LookupPromptDraftTokens(const std::vector<int32_t>& history_tokens, int max_num_draft_tokens,
+                            std::vector<int32_t>* draft_tokens) {
+  draft_tokens->clear();
+  int num_tokens = history_tokens.size();
+  for (int ngram_size = std::min(kMaxNgramSize, num_tokens - 1); ngram_size >= kMinNgramSize;
+       --ngram_size) {
+    const int32_t* suffix = history_tokens.data() + num_tokens - ngram_size;
+    if (std::find(suffix, suffix + ngram_size, -1) != suffix + ngram_size) {
+      continue;
+    }
+    // The occurrence must be followed by at least one token.
+    for (int i = num_tokens - ngram_size - 1; i >= 0; --i) {
+      if (!std::equal(suffix, suffix + ngram_size, history_tokens.data() + i)) {
+        continue;
+      }
+      int end = std::min(i + ngram_size + max_num_draft_tokens, num_tokens);
+      for (int j = i + ngram_size; j < end && history_tokens[j] != -1; ++j) {
+        draft_tokens->push_back(history_tokens[j]);
+      }
+      if (!draft_tokens->empty()) {
+        return draft_tokens->size();
+      }
+    }
+  }
+  return 0;
+}
+
+/*!
+ * \brief The action that runs one-step prompt lookup draft proposal for requests in the
+ * `running_queue` of engine state. The draft tokens of a request are the tokens following
+ * the latest earlier occurrence of its last n-gram in its prompt and generated tokens.
+ * No model is involved, and the drafts are verified by the main model.
+ */
+class PromptLookupDraftActionObj : public EngineActionObj {
+ public:
+  explicit PromptLookupDraftActionObj(EngineConfig engine_config,
+                                      Optional<EventTraceRecorder> trace_recorder)
+      : engine_config_(std::move(engine_config)), trace_recorder_(std::move(trace_recorder)) {}
+
+  String Name() const final { return "prompt_lookup_draft"; }
+
+  Array<Request> Step(EngineState estate) final {
+    if (estate->running_queue.empty()) {
+      return {};
+    }
+    NVTXScopedRange nvtx_scope("PromptLookupDraft");
+    ICHECK_GT(estate->spec_draft_length, 0)
+        << "The speculative decoding draft length must be positive.";
+
+    auto tstart = std::chrono::high_resolution_clock::now();
+    std::vector<RequestStateEntry> running_rsentries = estate->GetRunningRequestStateEntries();
+    for (const RequestStateEntry& rsentry : running_rsentries) {
+      RequestModelState mstate = rsentry->mstates[0];
+      ICHECK(mstate->draft_output_tokens.empty());
+      CollectHistoryTokens(rsentry);
+      int num_draft_tokens =
+          LookupPromptDraftTokens(history_tokens_, estate->spec_draft_length, &draft_tokens_);
+      if (mstate->RequireNextTokenBitmask()) {
+        num_draft_tokens = TruncateDraftTokensByGrammar(mstate, num_draft_tokens);
+      }
+      // The draft tokens form a chain. They are proposed deterministically, so they have
+      // probability one and no draft prob storage slots.
+      for (int i = 0; i < num_draft_tokens; ++i) {
+        mstate->AddDraftToken(SampleResult{{draft_tokens_[i], 1.0f}}, /*draft_token_slot=*/-1,
+                              /*parent_idx=*/i - 1);
+      }
+    }
+    auto tend = std::chrono::high_resolution_clock::now();
+    estate->metrics.UpdateDraftTimeByBatchSize(
+        running_rsentries.size(), static_cast<double>((tend - tstart).count()) / 1e9);
+    return {};
+  }
+
+ private:
+  /*! \brief Collect the prompt tokens and the committed tokens of the request state entry. */
+  void CollectHistoryTokens(const RequestStateEntry& rsentry) {
+    history_tokens_.clear();
+    for (const Data& data : rsentry->request->inputs) {
+      // Only the token data can be matched. The other data (e.g., images) break the n-grams.
+      if (const auto* token_data = data.as<TokenDataNode>()) {
+        history_tokens_.insert(history_tokens_.end(), token_data->token_ids.begin(),
+                               token_data->token_ids.end());
+      } else {
+        history_tokens_.push_back(-1);
+      }
+    }
+    for (const SampleResult& committed_token : rsentry->mstates[0]->committed_tokens) {
+      history_tokens_.push_back(committed_token.GetTokenId());
+    }
+  }
+
+  /*!
+   * \brief Truncate the draft tokens before the first token rejected by the grammar of the
+   * request, since the tokens after it can never be accepted in verification. The grammar
+   * state matcher is rolled back to its original state afterwards.
+   * \param mstate The model state of the request.
+   * \param num_draft_tokens The number of draft tokens.
+   * \return The number of draft tokens matching the grammar.
+   */
+  int TruncateDraftTokensByGrammar(const RequestModelState& mstate, int num_draft_tokens) {
+    GrammarStateMatcher matcher = mstate->grammar_state_matcher.value();
+    num_draft_tokens = std::min(num_draft_tokens, matcher->MaxRollbackSteps());
+    int num_accepted = 0;
+    while (num_accepted < num_draft_tokens && !matcher->IsTerminated() &&
+           matcher->AcceptToken(draft_tokens_[num_accepted])) {
+      ++num_accepted;
+    }
+    if (num_accepted > 0) {
+      matcher->Rollback(num_accepted);
+    }
+    return num_accepted;
+  }
+
+  /*! \brief The engine config. */
+  EngineConfig engine_config_;
+  /*! \brief Event trace recorder. */
+  Optional<EventTraceRecorder> trace_recorder_;
+  /*! \brief Temporary buffer of the history tokens of a request. */
+  std::vector<int32_t> history_tokens_;
+  /*! \brief Temporary buffer of the draft tokens of a request. */
+  std::vector<int32_t> draft_tokens_;
+};
+
+EngineAction EngineAction::PromptLookupDraft(EngineConfig engine_config,
+                                             Optional<EventTraceRecorder> trace_recorder) {
+  return EngineAction(make_object<PromptLookupDraftActionObj>(std::move(engine_config),
+                                                              std::move(trace_recorder)));
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -4,12 +4,35 @@
  */
 #include "engine_state.h"
 
+#include "engine_actions/beam_search.h"
+
 namespace mlc {
 namespace llm {
 namespace serve {
 
 TVM_REGISTER_OBJECT_TYPE(EngineStateObj);
 
+void RunningRequestTable::Clear() {
+  request_ids.clear();
+  request_internal_ids.clear();
+  mstates.clear();
+  generation_cfg.clear();
+  rngs.clear();
+  lora_adapter_indices.clear();
+  use_lora = false;
+}
+
+void RunningRequestTable::Append(const RequestStateEntry& rsentry) {
+  const RequestModelState& mstate = rsentry->mstates[0];
+  request_ids.push_back(rsentry->request->id);
+  request_internal_ids.push_back(mstate->internal_id);
+  mstates.push_back(mstate);
+  generation_cfg.push_back(GetSamplingGenerationConfig(rsentry));
+  rngs.push_back(&rsentry->rng);
+  lora_adapter_indices.push_back(mstate->lora_adapter_index);
+  use_lora |= mstate->lora_adapter_index != -1;
+}
+
 EngineState::EngineState() { data_ = make_object<EngineStateObj>(); }
 
 void EngineStateObj::Reset() {
@@ -21,8 +44,20 @@ void EngineStateObj::Reset() {
   if (prefix_cache.defined()) {
     prefix_cache->Reset();
   }
+  num_swapped_kv_tokens = 0;
   running_rsentries_changed = true;
   postproc_workspace = ActionPostProcessWorkspace();
+  rsentry_pool.Clear();
+  deferred_stream_callback = nullptr;
+}
+
+void EngineStateObj::InvokeDeferredStreamCallback() {
+  if (deferred_stream_callback != nullptr) {
+    // Reset the member before invoking, in case the callback re-enters the engine.
+    std::function<void()> callback = std::move(deferred_stream_callback);
+    deferred_stream_callback = nullptr;
+    callback();
+  }
 }
 
 RequestState EngineStateObj::GetRequestState(Request request) {
@@ -33,6 +68,7 @@ RequestState EngineStateObj::GetRequestState(Request request) {
 const std::vector<RequestStateEntry>& EngineStateObj::GetRunningRequestStateEntries() {
   if (running_rsentries_changed) {
     cached_running_rsentries_.clear();
+    cached_running_table_.Clear();
     for (const Request& request : running_queue) {
       for (const RequestStateEntry& rsentry : GetRequestState(request)->entries) {
         // One request entry is considered as running for decode if it is a leaf and has
@@ -40,6 +76,7 @@ const std::vector<RequestStateEntry>& EngineStateObj::GetRunningRequestStateEntr
         if (rsentry->status == RequestStateStatus::kAlive && rsentry->child_indices.empty() &&
             rsentry->mstates[0]->inputs.empty()) {
           cached_running_rsentries_.push_back(rsentry);
+          cached_running_table_.Append(rsentry);
         }
       }
     }
@@ -49,6 +86,11 @@ const std::vector<RequestStateEntry>& EngineStateObj::GetRunningRequestStateEntr
   //
 }
 
+const RunningRequestTable& EngineStateObj::GetRunningRequestTable() {
+  GetRunningRequestStateEntries();
+  return cached_running_table_;
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -8,11 +8,14 @@
 #include <picojson.h>
 #include <tvm/runtime/container/string.h>
 
+#include <functional>
+
 #include "config.h"
 #include "metrics.h"
 #include "prefix_cache.h"
 #include "request.h"
 #include "request_state.h"
+#include "scheduling_policy.h"
 
 namespace mlc {
 namespace llm {
@@ -50,6 +53,39 @@ struct EngineInternalIDManager {
 struct ActionPostProcessWorkspace {
   std::vector<RequestStateEntry> finished_rsentries;
   Array<RequestStreamOutput> callback_delta_outputs;
+  /*! \brief The per-request states, stream outputs and callback flags of the parallel stage. */
+  std::vector<RequestState> rstates;
+  std::vector<RequestStreamOutput> stream_outputs;
+  std::vector<char> invoke_callbacks;
+};
+
+/*!
+ * \brief The structure-of-arrays table of the running request state entries, whose i-th
+ * element of each array belongs to the i-th running request state entry.
+ * The table only holds the fields that stay unchanged while an entry keeps running, and is
+ * rebuilt only when the running entry list changes, so that the batch actions assemble their
+ * inputs by copying the arrays instead of visiting every entry in every step.
+ */
+struct RunningRequestTable {
+  /*! \brief The request id of each entry. */
+  Array<String> request_ids;
+  /*! \brief The internal sequence id of each entry. */
+  std::vector<int64_t> request_internal_ids;
+  /*! \brief The model state of the main model of each entry. */
+  Array<RequestModelState> mstates;
+  /*! \brief The generation config to sample the tokens of each entry. */
+  Array<GenerationConfig> generation_cfg;
+  /*! \brief The random number generator of each entry. */
+  std::vector<RandomGenerator*> rngs;
+  /*! \brief The LoRA adapter index of each entry. */
+  std::vector<int> lora_adapter_indices;
+  /*! \brief A boolean flag denoting whether any entry uses a LoRA adapter. */
+  bool use_lora = false;
+
+  /*! \brief Clear the table. */
+  void Clear();
+  /*! \brief Append the given request state entry to the table. */
+  void Append(const RequestStateEntry& rsentry);
 };
 
 /*!
@@ -70,6 +106,16 @@ class EngineStateObj : public Object {
   EngineMetrics metrics;
   /*! \brief The prefix cache. */
   PrefixCache prefix_cache{nullptr};
+  /*! \brief The scheduling policy for request admission and preemption. */
+  SchedulingPolicy scheduling_policy{nullptr};
+  /*!
+   * \brief The maximum total number of tokens whose KV data can be swapped out to
+   * host memory on preemption. Value 0 means the KV swap is disabled and preempted
+   * requests are always recomputed.
+   */
+  int64_t max_num_swapped_kv_tokens = 0;
+  /*! \brief The total number of tokens whose KV data is currently swapped out. */
+  int64_t num_swapped_kv_tokens = 0;
   /*! \brief A boolean flag denoting whether the running request state entry list has changed. */
   bool running_rsentries_changed = true;
   /*!
@@ -84,13 +130,28 @@ class EngineStateObj : public Object {
    * We make it a workspace to avoid repetitive memory allocation/free in the action post process.
    */
   ActionPostProcessWorkspace postproc_workspace;
+  /*! \brief The pool of the request state entries of finished requests for reuse. */
+  RequestStateEntryPool rsentry_pool;
+  /*!
+   * \brief The request stream callback invocation deferred from the last action post-process
+   * under the overlapped post-process mode. The next action invokes it right after launching
+   * its GPU work, so that the callback overlaps with the GPU execution.
+   */
+  std::function<void()> deferred_stream_callback = nullptr;
 
   /*! \brief Reset the engine state and clear the metrics. */
   void Reset();
+  /*! \brief Invoke and clear the deferred request stream callback if there is any. */
+  void InvokeDeferredStreamCallback();
   /*! \brief Get the request state of the given request. */
   RequestState GetRequestState(Request request);
   /*! \brief Return the running request state entries*/
   const std::vector<RequestStateEntry>& GetRunningRequestStateEntries();
+  /*!
+   * \brief Return the structure-of-arrays table of the running request state entries,
+   * which is in the same order as GetRunningRequestStateEntries.
+   */
+  const RunningRequestTable& GetRunningRequestTable();
 
   static constexpr const char* _type_key = "mlc.serve.EngineState";
   static constexpr const bool _type_has_method_sequal_reduce = false;
@@ -99,6 +160,7 @@ class EngineStateObj : public Object {
 
  private:
   std::vector<RequestStateEntry> cached_running_rsentries_;
+  RunningRequestTable cached_running_table_;
 };
 
 /*!
@@ -9,8 +9,13 @@
 #include <tvm/runtime/registry.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -19,97 +24,116 @@ namespace mlc {
 namespace llm {
 namespace serve {
 
-namespace detail {
+TVM_REGISTER_OBJECT_TYPE(EventTraceRecorderObj);
 
-struct PairHash {
-  template <class T1, class T2>
-  std::size_t operator()(const std::pair<T1, T2>& p) const {
-    auto h1 = std::hash<T1>{}(p.first);
-    auto h2 = std::hash<T2>{}(p.second);
-    return h1 ^ h2;
-  }
+/*! \brief The phase of events, following the Chrome Trace Event Format. */
+enum class EventPhase : uint32_t {
+  kBegin = 0,
+  kEnd = 1,
+  kInstant = 2,
 };
 
-}  // namespace detail
-
-TVM_REGISTER_OBJECT_TYPE(EventTraceRecorderObj);
-
-/*! \brief The implementation of event trace recorder. */
+/*!
+ * \brief The implementation of event trace recorder.
+ *
+ * Each recording thread owns a ring buffer of fixed size, to which it is the only writer.
+ * An event only stores its steady-clock timestamp, the interned index of the request id and
+ * the interned index of the event name, so recording an event is a few relaxed atomic stores
+ * once the request id and event name are in the local caches of the recording thread.
+ * The global intern tables are only locked on cache misses, i.e., when a thread first sees a
+ * request or an event name, and when dumping.
+ */
 class EventTraceRecorderImpl : public EventTraceRecorderObj {
  public:
-  void AddEvent(const String& request_id, const std::string& event) final {
-    double event_time = std::chrono::duration_cast<std::chrono::duration<double>>(
-                            std::chrono::system_clock::now().time_since_epoch())
-                            .count();
+  explicit EventTraceRecorderImpl(int64_t buffer_size_per_thread, double sample_ratio)
+      : recorder_id_(next_recorder_id_.fetch_add(1)),
+        buffer_size_(buffer_size_per_thread),
+        sample_ratio_(sample_ratio),
+        request_ids_(buffer_size_per_thread) {
+    CHECK_GT(buffer_size_per_thread, 0) << "The trace buffer size per thread must be positive.";
+    CHECK(sample_ratio > 0 && sample_ratio <= 1)
+        << "The trace sample ratio must be in (0, 1], but got " << sample_ratio;
+  }
 
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      AddEventInternal(request_id, event, event_time);
-    }
+  void AddEvent(const String& request_id, const std::string& event) final {
+    int64_t event_time = GetTimestampInNs();
+    ThreadBuffer* buffer = GetThreadBuffer();
+    uint32_t name_and_phase = InternEvent(buffer, event);
+    AddEventInternal(buffer, request_id, name_and_phase, event_time);
   }
 
   void AddEvent(const Array<String>& request_ids, const std::string& event) final {
-    double event_time = std::chrono::duration_cast<std::chrono::duration<double>>(
-                            std::chrono::system_clock::now().time_since_epoch())
-                            .count();  // in seconds
-
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      for (const String& request_id : request_ids) {
-        AddEventInternal(request_id, event, event_time);
-      }
+    int64_t event_time = GetTimestampInNs();
+    ThreadBuffer* buffer = GetThreadBuffer();
+    uint32_t name_and_phase = InternEvent(buffer, event);
+    for (const String& request_id : request_ids) {
+      AddEventInternal(buffer, request_id, name_and_phase, event_time);
     }
   }
 
   std::string DumpJSON() final {
-    std::unordered_map<std::string, std::vector<std::pair<std::string, double>>> local_events;
+    struct EventRecord {
+      int64_t time_in_ns;
+      uint32_t name_and_phase;
+    };
+    // The events of each request, keyed by the request index which is in time order.
+    std::map<uint64_t, std::vector<EventRecord>> request_events;
+    std::unordered_map<uint64_t, std::string> request_id_names;
+    std::vector<std::string> event_names;
     {
       std::lock_guard<std::mutex> lock(mutex_);
-      local_events = events_;
+      uint64_t num_request_ids = num_request_ids_.load(std::memory_order_acquire);
+      for (const std::unique_ptr<ThreadBuffer>& buffer : thread_buffers_) {
+        uint64_t end = buffer->num_events.load(std::memory_order_acquire);
+        uint64_t begin = end > buffer_size_ ? end - buffer_size_ : 0;
+        std::vector<std::pair<uint64_t, EventRecord>> records;
+        records.reserve(end - begin);
+        for (uint64_t i = begin; i < end; ++i) {
+          const EventSlot& slot = buffer->slots[i % buffer_size_];
+          uint64_t request_index = slot.request_index.load(std::memory_order_relaxed);
+          EventRecord record{slot.time_in_ns.load(std::memory_order_relaxed),
+                             slot.name_and_phase.load(std::memory_order_relaxed)};
+          records.push_back({request_index, record});
+        }
+        // Drop the events that the writer may have overwritten during the read.
+        // The slot of the event being written may also be partially updated.
+        uint64_t new_end = buffer->num_events.load(std::memory_order_acquire);
+        uint64_t first_valid = new_end + 1 > buffer_size_ ? new_end + 1 - buffer_size_ : 0;
+        for (uint64_t i = std::max(begin, first_valid); i < end; ++i) {
+          auto [request_index, record] = records[i - begin];
+          // Drop the events whose request ids have been evicted from the intern table.
+          if (request_index + buffer_size_ < num_request_ids) continue;
+          request_events[request_index].push_back(record);
+        }
+      }
+      for (const auto& [request_index, events] : request_events) {
+        request_id_names[request_index] = request_ids_[request_index % buffer_size_];
+      }
+      event_names = event_names_;
     }
 
-    auto fcmp_events = [](const std::pair<int64_t, picojson::value>& lhs,
-                          const std::pair<int64_t, picojson::value>& rhs) {
-      return lhs.first < rhs.first;
-    };
-
     picojson::array event_array;
-    for (const std::string& request_id : request_id_in_order_) {
-      std::vector<std::pair<std::string, double>> event_pairs = local_events.at(request_id);
-      std::vector<std::pair<int64_t, picojson::value>> events_to_sort;
-      events_to_sort.reserve(event_pairs.size());
-      for (int i = 0; i < static_cast<int>(event_pairs.size()); ++i) {
-        std::string event = event_pairs[i].first;
-        double event_time = event_pairs[i].second;
-        std::string name;
-        std::string phase;
-        if (event.compare(0, 6, "start ") == 0) {
-          // Duration begin.
-          name = event.substr(6);
-          phase = "B";
-        } else if (event.compare(0, 7, "finish ") == 0) {
-          // Duration end.
-          name = event.substr(7);
-          phase = "E";
-        } else {
-          // Instant event.
-          name = event;
-          phase = "i";
-        }
-        int64_t event_time_in_us = static_cast<int64_t>(event_time * 1e6);
+    for (auto& [request_index, events] : request_events) {
+      const std::string& request_id = request_id_names.at(request_index);
+      std::stable_sort(events.begin(), events.end(),
+                       [](const EventRecord& lhs, const EventRecord& rhs) {
+                         return lhs.time_in_ns < rhs.time_in_ns;
+                       });
+      // The number of a certain event of the request, which pairs the "starts" and "finishes".
+      std::unordered_map<uint32_t, int> event_counter;
+      for (const EventRecord& record : events) {
+        int event_cnt = event_counter[record.name_and_phase]++;
+        EventPhase phase = static_cast<EventPhase>(record.name_and_phase & kPhaseMask);
+        const std::string& name = event_names[record.name_and_phase >> kPhaseBits];
 
         picojson::object event_json;
-        event_json["name"] = picojson::value(name);
-        event_json["ph"] = picojson::value(phase);
-        event_json["ts"] = picojson::value(event_time_in_us);
+        event_json["name"] = picojson::value(name + " (" + std::to_string(event_cnt) + ")");
+        event_json["ph"] = picojson::value(
+            phase == EventPhase::kBegin ? "B" : (phase == EventPhase::kEnd ? "E" : "i"));
+        event_json["ts"] = picojson::value(record.time_in_ns / 1000);
         event_json["pid"] = picojson::value(static_cast<int64_t>(1));
         event_json["tid"] = picojson::value(request_id);
-
-        events_to_sort.push_back({event_time_in_us, picojson::value(event_json)});
-      }
-      std::sort(events_to_sort.begin(), events_to_sort.end(), fcmp_events);
-      for (auto [timestamp, event] : events_to_sort) {
-        event_array.push_back(std::move(event));
+        event_array.push_back(picojson::value(event_json));
       }
     }
     return picojson::value(event_array).serialize();
@@ -118,36 +142,196 @@ class EventTraceRecorderImpl : public EventTraceRecorderObj {
   TVM_DECLARE_BASE_OBJECT_INFO(EventTraceRecorderImpl, EventTraceRecorderObj);
 
  private:
-  /*! \brief The internal impl of AddEvent, taking the event time as input. */
-  void AddEventInternal(const std::string& request_id, const std::string& event,
-                        double event_time) {
-    if (std::find(request_id_in_order_.begin(), request_id_in_order_.end(), request_id) ==
-        request_id_in_order_.end()) {
-      request_id_in_order_.push_back(request_id);
+  /*! \brief An event slot in the ring buffers. */
+  struct EventSlot {
+    std::atomic<int64_t> time_in_ns{0};
+    std::atomic<uint64_t> request_index{0};
+    std::atomic<uint32_t> name_and_phase{0};
+  };
+
+  /*! \brief The local cache entry of an interned request id. */
+  struct RequestIdCacheEntry {
+    std::string request_id;
+    uint64_t request_index = 0;
+    bool sampled = false;
+    bool valid = false;
+  };
+
+  /*! \brief The ring buffer and the local intern caches of a recording thread. */
+  struct ThreadBuffer {
+    explicit ThreadBuffer(int64_t buffer_size) : slots(buffer_size) {}
+
+    /*! \brief The event slots. The i-th event is stored at slot i % buffer_size. */
+    std::vector<EventSlot> slots;
+    /*! \brief The number of events ever recorded by the thread. */
+    std::atomic<uint64_t> num_events{0};
+
+    /************** Only accessed by the owner thread **************/
+    /*! \brief The direct-mapped cache of the interned request ids. */
+    std::vector<RequestIdCacheEntry> request_id_cache =
+        std::vector<RequestIdCacheEntry>(kRequestIdCacheSize);
+    /*! \brief The cache of the interned event names and phases. */
+    std::unordered_map<std::string, uint32_t> event_cache;
+  };
+
+  /*! \brief The number of low bits of the phase in the packed event name and phase. */
+  static constexpr const int kPhaseBits = 2;
+  static constexpr const uint32_t kPhaseMask = (1 << kPhaseBits) - 1;
+  /*! \brief The number of entries in the local request id cache of each thread. */
+  static constexpr const int kRequestIdCacheSize = 256;
+
+  /*! \brief Get the current steady-clock timestamp in nanoseconds. */
+  static int64_t GetTimestampInNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /*! \brief Get the ring buffer of the current thread, creating it for the first event. */
+  ThreadBuffer* GetThreadBuffer() {
+    // The recorder ids are never reused, so the cached pointer of a destructed recorder
+    // is never returned for a new recorder.
+    thread_local uint64_t cached_recorder_id = 0;
+    thread_local ThreadBuffer* cached_buffer = nullptr;
+    if (cached_recorder_id == recorder_id_) {
+      return cached_buffer;
     }
-    int event_cnt = event_counter_[{request_id, event}]++;
-    events_[request_id].push_back({event + " (" + std::to_string(event_cnt) + ")", event_time});
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThreadBuffer*& buffer = thread_buffer_map_[std::this_thread::get_id()];
+    if (buffer == nullptr) {
+      thread_buffers_.push_back(std::make_unique<ThreadBuffer>(buffer_size_));
+      buffer = thread_buffers_.back().get();
+    }
+    cached_recorder_id = recorder_id_;
+    cached_buffer = buffer;
+    return buffer;
   }
 
-  /*! \brief The mutex ensuring only one thread can access critical regions. */
+  /*! \brief Intern the event with its "start "/"finish " prefix parsed into the phase. */
+  uint32_t InternEvent(ThreadBuffer* buffer, const std::string& event) {
+    auto it = buffer->event_cache.find(event);
+    if (it != buffer->event_cache.end()) {
+      return it->second;
+    }
+    std::string name;
+    EventPhase phase;
+    if (event.compare(0, 6, "start ") == 0) {
+      // Duration begin.
+      name = event.substr(6);
+      phase = EventPhase::kBegin;
+    } else if (event.compare(0, 7, "finish ") == 0) {
+      // Duration end.
+      name = event.substr(7);
+      phase = EventPhase::kEnd;
+    } else {
+      // Instant event.
+      name = event;
+      phase = EventPhase::kInstant;
+    }
+    uint32_t name_index;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto [name_it, inserted] = event_name_indices_.emplace(name, event_names_.size());
+      if (inserted) {
+        event_names_.push_back(name);
+      }
+      name_index = name_it->second;
+    }
+    uint32_t name_and_phase = (name_index << kPhaseBits) | static_cast<uint32_t>(phase);
+    buffer->event_cache.emplace(event, name_and_phase);
+    return name_and_phase;
+  }
+
+  /*! \brief The internal impl of AddEvent, taking the interned event and event time as input. */
+  void AddEventInternal(ThreadBuffer* buffer, const String& request_id, uint32_t name_and_phase,
+                        int64_t event_time) {
+    size_t hash = std::hash<std::string_view>()(
+        std::string_view(request_id.data(), request_id.size()));
+    RequestIdCacheEntry& entry = buffer->request_id_cache[hash % kRequestIdCacheSize];
+    if (!entry.valid || entry.request_id != request_id ||
+        (entry.sampled && entry.request_index + buffer_size_ <
+                              num_request_ids_.load(std::memory_order_relaxed))) {
+      // Cache miss, or the cached request id has been evicted from the intern table.
+      entry.request_id = request_id;
+      entry.valid = true;
+      entry.sampled = sample_ratio_ >= 1.0 ||
+                      static_cast<double>(hash >> 11) * 0x1.0p-53 < sample_ratio_;
+      if (entry.sampled) {
+        entry.request_index = InternRequestId(request_id);
+      }
+    }
+    if (!entry.sampled) {
+      return;
+    }
+    uint64_t event_index = buffer->num_events.load(std::memory_order_relaxed);
+    EventSlot& slot = buffer->slots[event_index % buffer_size_];
+    slot.time_in_ns.store(event_time, std::memory_order_relaxed);
+    slot.request_index.store(entry.request_index, std::memory_order_relaxed);
+    slot.name_and_phase.store(name_and_phase, std::memory_order_relaxed);
+    buffer->num_events.store(event_index + 1, std::memory_order_release);
+  }
+
+  /*!
+   * \brief Intern the request id into the global ring of request ids.
+   * The oldest request id is evicted when the ring is full.
+   */
+  uint64_t InternRequestId(const std::string& request_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = request_id_indices_.find(request_id);
+    if (it != request_id_indices_.end()) {
+      return it->second;
+    }
+    uint64_t num_request_ids = num_request_ids_.load(std::memory_order_relaxed);
+    std::string& slot = request_ids_[num_request_ids % buffer_size_];
+    if (num_request_ids >= buffer_size_) {
+      request_id_indices_.erase(slot);
+    }
+    slot = request_id;
+    request_id_indices_[request_id] = num_request_ids;
+    num_request_ids_.store(num_request_ids + 1, std::memory_order_release);
+    return num_request_ids;
+  }
+
+  /*! \brief The global counter of recorder ids. Zero is reserved for "no recorder". */
+  static inline std::atomic<uint64_t> next_recorder_id_{1};
+
+  /*! \brief The unique id of this recorder. */
+  const uint64_t recorder_id_;
+  /*! \brief The ring buffer size of each thread, and the capacity of the request id ring. */
+  const uint64_t buffer_size_;
+  /*! \brief The ratio of requests to trace. */
+  const double sample_ratio_;
+  /*! \brief The number of request ids ever interned. */
+  std::atomic<uint64_t> num_request_ids_{0};
+
+  /*! \brief The mutex guarding the thread buffer list and the intern tables. */
   std::mutex mutex_;
 
   /************** Critical Regions **************/
-  /*! \brief The request ids in time order. Each id only appears once. */
-  std::vector<std::string> request_id_in_order_;
-  /*! \brief The number of a certain event for a request. */
-  std::unordered_map<std::pair<std::string, std::string>, int, detail::PairHash> event_counter_;
-  /*! \brief The event list of each request together with the timestamps. */
-  std::unordered_map<std::string, std::vector<std::pair<std::string, double>>> events_;
+  /*! \brief The ring buffers of all recording threads. */
+  std::vector<std::unique_ptr<ThreadBuffer>> thread_buffers_;
+  /*! \brief The ring buffer of each recording thread. */
+  std::unordered_map<std::thread::id, ThreadBuffer*> thread_buffer_map_;
+  /*! \brief The ring of the latest interned request ids. Request i is at slot i % buffer_size. */
+  std::vector<std::string> request_ids_;
+  /*! \brief The index of each request id in the ring. */
+  std::unordered_map<std::string, uint64_t> request_id_indices_;
+  /*! \brief The interned event names. */
+  std::vector<std::string> event_names_;
+  /*! \brief The index of each event name. */
+  std::unordered_map<std::string, uint32_t> event_name_indices_;
 };
 
-EventTraceRecorder EventTraceRecorder::Create() {
-  return EventTraceRecorder(make_object<EventTraceRecorderImpl>());
+EventTraceRecorder EventTraceRecorder::Create(int64_t buffer_size_per_thread,
+                                              double sample_ratio) {
+  return EventTraceRecorder(
+      make_object<EventTraceRecorderImpl>(buffer_size_per_thread, sample_ratio));
 }
 
-TVM_REGISTER_GLOBAL("mlc.serve.EventTraceRecorder").set_body_typed([]() {
-  return EventTraceRecorder::Create();
-});
+TVM_REGISTER_GLOBAL("mlc.serve.EventTraceRecorder")
+    .set_body_typed([](int64_t buffer_size_per_thread, double sample_ratio) {
+      return EventTraceRecorder::Create(buffer_size_per_thread, sample_ratio);
+    });
 
 TVM_REGISTER_GLOBAL("mlc.serve.EventTraceRecorderAddEvent")
     .set_body_typed([](const EventTraceRecorder& trace_recorder, const String& request_id,
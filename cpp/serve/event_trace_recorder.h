@@ -18,7 +18,12 @@ namespace serve {
 
 using namespace tvm::runtime;
 
-/*! \brief The event trace recorder for requests. */
+/*!
+ * \brief The event trace recorder for requests.
+ * The events are recorded into fixed-size per-thread ring buffers without locking,
+ * so that the recorder is cheap enough to be always on. Only the latest events of each
+ * thread are kept, and requests can be sampled so that only part of them are traced.
+ */
 class EventTraceRecorderObj : public Object {
  public:
   /*!
@@ -51,8 +56,17 @@ class EventTraceRecorderObj : public Object {
  */
 class EventTraceRecorder : public ObjectRef {
  public:
-  /*! \brief Create an event trace recorder. */
-  static EventTraceRecorder Create();
+  /*!
+   * \brief Create an event trace recorder.
+   * \param buffer_size_per_thread The number of latest events kept for each recording thread.
+   * \param sample_ratio The ratio of requests whose events are recorded, in (0, 1].
+   * The sampling is decided by the hash of request id, so a traced request has all its events.
+   */
+  static EventTraceRecorder Create(int64_t buffer_size_per_thread = kDefaultBufferSizePerThread,
+                                   double sample_ratio = 1.0);
+
+  /*! \brief The default number of latest events kept for each recording thread. */
+  static constexpr const int64_t kDefaultBufferSizePerThread = 1 << 16;
 
   TVM_DEFINE_MUTABLE_NOTNULLABLE_OBJECT_REF_METHODS(EventTraceRecorder, ObjectRef,
                                                     EventTraceRecorderObj);
@@ -13,9 +13,16 @@
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../support/load_bytes_from_file.h"
@@ -74,6 +81,7 @@ void FunctionTable::Init(String reload_lib_path, Device device, picojson::object
   local_gpu_device = device;
   Device null_device{DLDeviceType(0), 0};
   this->model_config = model_config;
+  this->lib_path = reload_lib_path;
   this->cached_buffers = Map<String, ObjectRef>();
 
   int num_workers = num_shards * num_stages;
@@ -83,15 +91,25 @@ void FunctionTable::Init(String reload_lib_path, Device device, picojson::object
     this->use_disco = true;
     this->disco_mod = sess->CallPacked(sess->GetGlobalFunc("runtime.disco.load_vm_module"),
                                        reload_lib_path, null_device);
-    this->mod_get_func = [this,
+    // Worker 0 runs in the local process, so the existence of a function is checked on its
+    // module without a round trip to the workers. The function is only looked up on all the
+    // workers at its first call, so that the rarely used functions cost nothing at startup.
+    Module worker0_mod = this->disco_mod->DebugGetFromRemote(0);
+    this->mod_get_func = [this, worker0_mod,
                           fmodule_get_function = sess->GetGlobalFunc("runtime.ModuleGetFunction")](
                              const std::string& name) -> PackedFunc {
-      DRef func = sess->CallPacked(fmodule_get_function, this->disco_mod, name, true);
-      bool exists = (func->DebugGetFromRemote(0).operator PackedFunc()) != nullptr;
-      if (!exists) {
+      if (worker0_mod->GetFunction(name, true) == nullptr) {
         return PackedFunc(nullptr);
       }
-      return SessionFuncAsPackedFunc(sess, func, name);
+      auto func = std::make_shared<PackedFunc>(nullptr);
+      return PackedFunc([this, fmodule_get_function, name, func](TVMArgs args,
+                                                                 TVMRetValue* rv) -> void {
+        if (*func == nullptr) {
+          DRef remote_func = sess->CallPacked(fmodule_get_function, this->disco_mod, name, true);
+          *func = SessionFuncAsPackedFunc(sess, remote_func, name);
+        }
+        func->CallPacked(args, rv);
+      });
     };
     if (num_stages == 1) {
       if (Optional<IntTuple> cpu_ids = GetDiscoWorkerCPUBinding(/*num_workers=*/num_shards)) {
@@ -140,7 +158,21 @@ void FunctionTable::Init(String reload_lib_path, Device device, picojson::object
         static_cast<int>(tvm::runtime::memory::AllocatorType::kPooled), static_cast<int>(kDLCPU), 0,
         static_cast<int>(tvm::runtime::memory::AllocatorType::kPooled));
     this->mod_get_func = [this](const std::string& name) -> PackedFunc {
-      return this->local_vm->GetFunction(name, true);
+      PackedFunc func = this->local_vm->GetFunction(name, true);
+      auto it = this->model_metadata_.kernel_variants.find(name);
+      if (!func.defined() || it == this->model_metadata_.kernel_variants.end()) {
+        return func;
+      }
+      // Dispatch to the fastest variant of the function on the device.
+      std::vector<std::pair<std::string, PackedFunc>> variants{{name, func}};
+      for (const std::string& variant_name : it->second) {
+        if (PackedFunc variant = this->local_vm->GetFunction(variant_name, true);
+            variant.defined()) {
+          variants.emplace_back(variant_name, variant);
+        }
+      }
+      return CreateKernelVariantDispatcher(name, std::move(variants), this->local_gpu_device,
+                                           this->kernel_variant_cache_);
     };
     this->get_global_func = [](const std::string& name) -> PackedFunc {
       const auto* f = tvm::runtime::Registry::Get(name);
@@ -148,12 +180,122 @@ void FunctionTable::Init(String reload_lib_path, Device device, picojson::object
       return *f;
     };
     this->model_metadata_ = ModelMetadata::FromModule(this->local_vm, std::move(model_config));
+    if (!this->model_metadata_.kernel_variants.empty()) {
+      String metadata = this->local_vm->GetFunction("_metadata")();
+      this->kernel_variant_cache_ = std::make_shared<KernelVariantCache>(
+          GetKernelVariantCachePath(reload_lib_path, metadata, device));
+    }
     this->_InitFunctions();
   }
   ICHECK_EQ(this->model_metadata_.tensor_parallel_shards, num_shards);
   ICHECK_EQ(this->model_metadata_.pipeline_parallel_stages, num_stages);
 }
 
+/*!
+ * \brief Get the path of the preshard cache of the model, which is enabled by environment variable
+ * MLC_PRESHARD_CACHE_DIR. The cache is keyed by the model directory, the parameter metadata, the
+ * model config (which contains the tensor parallel shards and the pipeline stages), and the path,
+ * size and modification time of the model library, whose preprocessing functions shard the
+ * parameters.
+ * \return The path of the cache, or the empty string when the cache is not enabled.
+ */
+std::string GetPreshardCachePath(const std::string& model_path, const std::string& lib_path,
+                                 const picojson::object& model_config) {
+  const char* cache_dir = std::getenv("MLC_PRESHARD_CACHE_DIR");
+  if (cache_dir == nullptr || std::string(cache_dir).empty()) {
+    return "";
+  }
+  std::filesystem::path fs_model_path = std::filesystem::absolute(model_path);
+  std::string ndarray_cache_metadata =
+      LoadBytesFromFile((fs_model_path / "ndarray-cache.json").string());
+  std::error_code error;
+  uintmax_t lib_size = std::filesystem::file_size(lib_path, error);
+  if (error) lib_size = 0;
+  auto lib_mtime = std::filesystem::last_write_time(lib_path, error).time_since_epoch().count();
+  if (error) lib_mtime = 0;
+  std::ostringstream key_os;
+  key_os << fs_model_path.string() << "\n"
+         << ndarray_cache_metadata << "\n"
+         << picojson::value(model_config).serialize() << "\n"
+         << lib_path << "\n"
+         << lib_size << "\n"
+         << lib_mtime;
+  size_t key = std::hash<std::string>()(key_os.str());
+  std::ostringstream os;
+  os << fs_model_path.filename().string() << "-" << std::hex << key;
+  return (std::filesystem::path(cache_dir) / os.str()).string();
+}
+
+/*!
+ * \brief The lock of the global ndarray cache of TVM runtime, which has no lock itself. The
+ * weights are loaded through the cache on the engine thread and on the hot swap thread.
+ */
+std::mutex& NDArrayCacheMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+/*!
+ * \brief Check if the preshard cache is complete for all the workers, and if each cached parameter
+ * has the shape and the dtype of its shard in the model metadata.
+ */
+bool IsPreshardCacheValid(const std::string& preshard_cache_path,
+                          const ModelMetadata& model_metadata) {
+  int num_shards = model_metadata.tensor_parallel_shards;
+  int num_workers = num_shards * model_metadata.pipeline_parallel_stages;
+  for (int worker_id = 0; worker_id < num_workers; ++worker_id) {
+    std::filesystem::path index_path = std::filesystem::path(preshard_cache_path) /
+                                       ("worker-" + std::to_string(worker_id) + ".json");
+    if (!std::filesystem::exists(index_path)) {
+      return false;
+    }
+    picojson::value index;
+    if (!picojson::parse(index, LoadBytesFromFile(index_path.string())).empty() ||
+        !index.is<picojson::object>() || !index.contains("params") ||
+        !index.get("params").is<picojson::array>()) {
+      return false;
+    }
+    std::unordered_map<std::string, std::pair<picojson::value, std::string>> records;
+    for (const picojson::value& record : index.get("params").get<picojson::array>()) {
+      if (!record.is<picojson::object>() || !record.contains("name") ||
+          !record.contains("shape") || !record.contains("dtype")) {
+        return false;
+      }
+      records[record.get("name").to_str()] = {record.get("shape"), record.get("dtype").to_str()};
+    }
+    int group_id = worker_id / num_shards;
+    size_t num_worker_params = 0;
+    for (const ModelMetadata::Param& param : model_metadata.params) {
+      if (std::find(param.pipeline_stages.begin(), param.pipeline_stages.end(), group_id) ==
+          param.pipeline_stages.end()) {
+        continue;
+      }
+      ++num_worker_params;
+      // The sharded parameters drop the leading shard dimension of the preprocessing output.
+      std::vector<int64_t> shape(param.shape.begin(), param.shape.end());
+      DataType dtype = param.dtype;
+      if (!param.preprocs.empty()) {
+        ShapeTuple out_shape = param.preprocs.back().out_shape;
+        shape.assign(out_shape.begin() + 1, out_shape.end());
+        dtype = param.preprocs.back().out_dtype;
+      }
+      picojson::array shape_json;
+      for (int64_t dim : shape) {
+        shape_json.push_back(picojson::value(dim));
+      }
+      auto it = records.find(param.name);
+      if (it == records.end() || it->second.first != picojson::value(shape_json) ||
+          it->second.second != DLDataType2String(dtype)) {
+        return false;
+      }
+    }
+    if (records.size() != num_worker_params) {
+      return false;
+    }
+  }
+  return true;
+}
+
 ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device) {
   if (this->use_disco) {
     DRef params{nullptr};
@@ -169,15 +311,28 @@ ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device
       CHECK(loader_load_all != nullptr);
       DRef loader = loader_create(metadata_path, ndarray_cache_metadata, "", this->disco_mod);
       params = loader_load_all(loader);
-    } else {
-      auto load_func_name = getenv("MLC_INTERNAL_PRESHARD_NUM") == nullptr
-                                ? "mlc.multi_gpu.LoadMultiGPU"
-                                : "mlc.multi_gpu.LoadMultiGPUPresharded";
-      PackedFunc loader = this->get_global_func(load_func_name);
+    } else if (getenv("MLC_INTERNAL_PRESHARD_NUM") != nullptr) {
+      PackedFunc loader = this->get_global_func("mlc.multi_gpu.LoadMultiGPUPresharded");
       params = loader(model_path, this->disco_mod, picojson::value(this->model_config).serialize());
+    } else {
+      // Load from the preshard cache when it is complete for all workers and matches the model
+      // metadata, or otherwise shard the parameters and write the cache.
+      std::string preshard_cache_path =
+          GetPreshardCachePath(model_path, this->lib_path, this->model_config);
+      if (!preshard_cache_path.empty() &&
+          IsPreshardCacheValid(preshard_cache_path, this->model_metadata_)) {
+        PackedFunc loader = this->get_global_func("mlc.multi_gpu.LoadMultiGPUFromPreshardCache");
+        params = loader(preshard_cache_path, this->disco_mod,
+                        picojson::value(this->model_config).serialize());
+      } else {
+        PackedFunc loader = this->get_global_func("mlc.multi_gpu.LoadMultiGPU");
+        params = loader(model_path, this->disco_mod,
+                        picojson::value(this->model_config).serialize(), preshard_cache_path);
+      }
     }
     return params;
   } else {
+    std::lock_guard<std::mutex> lock(NDArrayCacheMutex());
     const PackedFunc* fload_cache = tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.load");
     ICHECK(fload_cache) << "TVM runtime cannot find vm.builtin.ndarray_cache.load";
     (*fload_cache)(model_path, static_cast<int32_t>(device.device_type), device.device_id);
@@ -208,6 +363,23 @@ ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device
   }
 }
 
+Array<NDArray> FunctionTable::LoadLoRAParams(const std::string& adapter_path, Device device) {
+  CHECK(!this->use_disco) << "LoRA adapters are not supported with multi-GPU inference yet.";
+  std::lock_guard<std::mutex> lock(NDArrayCacheMutex());
+  const PackedFunc* fload_cache = tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.load");
+  ICHECK(fload_cache) << "TVM runtime cannot find vm.builtin.ndarray_cache.load";
+  (*fload_cache)(adapter_path, static_cast<int32_t>(device.device_type), device.device_id);
+  constexpr const char* name_loader = "vm.builtin.param_array_from_cache";
+  const PackedFunc* fload_params = tvm::runtime::Registry::Get(name_loader);
+  ICHECK(fload_params) << "Cannot find env function: " << name_loader;
+  Array<NDArray> params = (*fload_params)("param", -1);
+  const PackedFunc* fclear_ndarray_cache =
+      tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.clear");
+  ICHECK(fclear_ndarray_cache) << "Cannot find env function vm.builtin.ndarray_cache.clear";
+  (*fclear_ndarray_cache)();
+  return params;
+}
+
 void FunctionTable::_InitFunctions() {
   this->embed_func_ = mod_get_func("embed");
   this->image_embed_func_ = mod_get_func("image_embed");
@@ -216,6 +388,8 @@ void FunctionTable::_InitFunctions() {
   this->prefill_func_ = mod_get_func("batch_prefill");
   this->decode_func_ = mod_get_func("batch_decode");
   this->verify_func_ = mod_get_func("batch_verify");
+  this->prefill_lora_func_ = mod_get_func("batch_prefill_lora");
+  this->decode_lora_func_ = mod_get_func("batch_decode_lora");
   this->single_batch_prefill_to_last_hidden_func_ = mod_get_func("prefill_to_last_hidden_states");
   this->single_batch_decode_to_last_hidden_func_ = mod_get_func("decode_to_last_hidden_states");
   this->prefill_to_last_hidden_func_ = mod_get_func("batch_prefill_to_last_hidden_states");
@@ -229,7 +403,12 @@ void FunctionTable::_InitFunctions() {
   this->softmax_func_ = mod->GetFunction("softmax_with_temperature", true);
   this->apply_logit_bias_func_ = mod->GetFunction("apply_logit_bias_inplace", true);
   this->apply_penalty_func_ = mod->GetFunction("apply_penalty_inplace", true);
+  this->update_token_counts_func_ = mod->GetFunction("update_token_counts_inplace", true);
+  this->apply_penalty_with_counts_func_ =
+      mod->GetFunction("apply_penalty_with_counts_inplace", true);
   this->apply_bitmask_func_ = mod->GetFunction("apply_bitmask_inplace", true);
+  this->apply_logit_bias_csr_func_ = mod->GetFunction("apply_logit_bias_csr_inplace", true);
+  this->apply_compact_bitmask_func_ = mod->GetFunction("apply_compact_bitmask_inplace", true);
   this->alloc_embedding_tensor_func_ = mod_get_func("alloc_embedding_tensor");
   this->create_kv_cache_func_ = mod_get_func("create_flashinfer_paged_kv_cache");
   if (!this->create_kv_cache_func_.defined()) {
@@ -255,17 +434,33 @@ void FunctionTable::_InitFunctions() {
       *tvm::runtime::Registry::Get("vm.builtin.attention_kv_cache_get_num_available_pages");
   this->kv_cache_get_total_sequence_length_func_ =
       *tvm::runtime::Registry::Get("vm.builtin.attention_kv_cache_get_total_sequence_length");
+  if (!use_disco) {
+    // The KV data copy functions are optional, and are used for KV swap only.
+    if (const PackedFunc* f = Registry::Get("vm.builtin.attention_kv_cache_debug_get_kv")) {
+      this->kv_cache_debug_get_kv_func_ = *f;
+    }
+    if (const PackedFunc* f = Registry::Get("vm.builtin.attention_kv_cache_debug_set_kv")) {
+      this->kv_cache_debug_set_kv_func_ = *f;
+    }
+  }
   if (Sampler::SupportGPUSampler(local_gpu_device)) {
     gpu_multinomial_from_uniform_func_ = mod->GetFunction("multinomial_from_uniform", true);
     gpu_argsort_probs_func_ = mod->GetFunction("argsort_probs", true);
     gpu_sample_with_top_p_func_ = mod->GetFunction("sample_with_top_p", true);
     gpu_sampler_take_probs_func_ = mod->GetFunction("sampler_take_probs", true);
+    gpu_sampler_top_k_probs_func_ = mod->GetFunction("sampler_top_k_probs", true);
     gpu_verify_draft_tokens_func_ = mod->GetFunction("sampler_verify_draft_tokens", true);
+    gpu_verify_deterministic_draft_tokens_func_ =
+        mod->GetFunction("sampler_verify_deterministic_draft_tokens", true);
     gpu_renormalize_by_top_p_func_ = mod->GetFunction("renormalize_by_top_p", true);
+    gpu_renormalize_by_min_p_func_ = mod->GetFunction("renormalize_by_min_p", true);
+    gpu_renormalize_by_typical_p_func_ = mod->GetFunction("renormalize_by_typical_p", true);
+    gpu_check_stop_func_ = mod->GetFunction("sampler_check_stop", true);
   }
   this->nd_view_func_ = get_global_func("vm.builtin.reshape");
   this->nd_get_shape_func_ = get_global_func("vm.builtin.shape_of");
   this->nd_copy_embedding_to_offset_func_ = get_global_func("mlc.copy_embedding_to_offset");
+  this->nd_copy_embedding_from_offset_func_ = get_global_func("mlc.copy_embedding_from_offset");
   support_backtracking_kv_ = true;
   this->tuple_getitem_func_ = get_global_func("vm.builtin.tuple_getitem");
   if (use_disco) {
@@ -277,6 +472,7 @@ void FunctionTable::_InitFunctions() {
   this->scatter_probs_func_ = mod->GetFunction("scatter_probs", true);
   this->gather_hidden_states_func_ = mod_get_func("gather_hidden_states");
   this->scatter_hidden_states_func_ = mod_get_func("scatter_hidden_states");
+  this->pool_hidden_states_func_ = mod_get_func("pool_hidden_states");
 }
 
 ObjectRef FunctionTable::Empty(ShapeTuple shape, DataType dtype, Device device,
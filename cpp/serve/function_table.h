@@ -13,9 +13,11 @@
 #include <tvm/runtime/ndarray.h>
 #include <tvm/runtime/packed_func.h>
 
+#include <memory>
 #include <string>
 
 #include "../metadata/model.h"
+#include "kernel_variant.h"
 
 namespace mlc {
 namespace llm {
@@ -46,6 +48,13 @@ struct FunctionTable {
 
   ObjectRef LoadParams(const std::string& model_path, Device device);
 
+  /*!
+   * \brief Load the weights of a LoRA adapter from the adapter directory to the device.
+   * The adapter weights are named "param_0", "param_1", ... in the ndarray cache, in the
+   * order of the LoRA parameters expected by the LoRA functions of the model library.
+   */
+  Array<NDArray> LoadLoRAParams(const std::string& adapter_path, Device device);
+
   void _InitFunctions();
 
   ObjectRef Empty(ShapeTuple shape, DataType dtype, Device device, bool worker0_only) const;
@@ -72,11 +81,15 @@ struct FunctionTable {
   Map<String, ObjectRef> cached_buffers{nullptr};
   tvm::runtime::Module local_vm{nullptr};
   picojson::object model_config;
+  /*! \brief The path of the model library, which is a part of the preshard cache key. */
+  std::string lib_path;
 
   TypedPackedFunc<PackedFunc(const std::string&)> mod_get_func;
   TypedPackedFunc<PackedFunc(const std::string&)> get_global_func;
 
   ModelMetadata model_metadata_;
+  /*! \brief The cache of the selected kernel variants, when the model ships kernel variants. */
+  std::shared_ptr<KernelVariantCache> kernel_variant_cache_;
 
   PackedFunc embed_func_;
   PackedFunc image_embed_func_;
@@ -85,6 +98,8 @@ struct FunctionTable {
   PackedFunc prefill_func_;
   PackedFunc decode_func_;
   PackedFunc verify_func_;
+  PackedFunc prefill_lora_func_;
+  PackedFunc decode_lora_func_;
   PackedFunc single_batch_prefill_to_last_hidden_func_;
   PackedFunc single_batch_decode_to_last_hidden_func_;
   PackedFunc prefill_to_last_hidden_func_;
@@ -97,7 +112,11 @@ struct FunctionTable {
   PackedFunc softmax_func_;
   PackedFunc apply_logit_bias_func_;
   PackedFunc apply_penalty_func_;
+  PackedFunc update_token_counts_func_;
+  PackedFunc apply_penalty_with_counts_func_;
   PackedFunc apply_bitmask_func_;
+  PackedFunc apply_logit_bias_csr_func_;
+  PackedFunc apply_compact_bitmask_func_;
   PackedFunc alloc_embedding_tensor_func_;
   PackedFunc create_kv_cache_func_;
   PackedFunc reset_kv_cache_func_;
@@ -112,15 +131,23 @@ struct FunctionTable {
   PackedFunc kv_cache_commit_accepted_token_tree_nodes_func_;
   PackedFunc kv_cache_get_num_available_pages_func_;
   PackedFunc kv_cache_get_total_sequence_length_func_;
+  PackedFunc kv_cache_debug_get_kv_func_;
+  PackedFunc kv_cache_debug_set_kv_func_;
   PackedFunc gpu_multinomial_from_uniform_func_;
   PackedFunc gpu_argsort_probs_func_;
   PackedFunc gpu_sample_with_top_p_func_;
   PackedFunc gpu_sampler_take_probs_func_;
+  PackedFunc gpu_sampler_top_k_probs_func_;
   PackedFunc gpu_verify_draft_tokens_func_;
+  PackedFunc gpu_verify_deterministic_draft_tokens_func_;
   PackedFunc gpu_renormalize_by_top_p_func_;
+  PackedFunc gpu_renormalize_by_min_p_func_;
+  PackedFunc gpu_renormalize_by_typical_p_func_;
+  PackedFunc gpu_check_stop_func_;
   PackedFunc nd_view_func_;
   PackedFunc nd_get_shape_func_;
   PackedFunc nd_copy_embedding_to_offset_func_;
+  PackedFunc nd_copy_embedding_from_offset_func_;
   PackedFunc tuple_getitem_func_;
   PackedFunc last_group_send_to_worker_0_;
   // Auxiliary functions for speculative decoding.
@@ -128,6 +155,8 @@ struct FunctionTable {
   PackedFunc scatter_probs_func_;
   PackedFunc gather_hidden_states_func_;
   PackedFunc scatter_hidden_states_func_;
+  // Auxiliary function for embedding requests.
+  PackedFunc pool_hidden_states_func_;
 };
 
 }  // namespace serve
@@ -0,0 +1,225 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/kernel_variant.cc
+ */
+#include "kernel_variant.h"
+
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/ndarray.h>
+#include <tvm/runtime/profiling.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <unordered_map>
+
+#include "../support/load_bytes_from_file.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+KernelVariantCache::KernelVariantCache(std::string path) : path_(std::move(path)) {
+  if (path_.empty() || !std::filesystem::exists(path_)) {
+    return;
+  }
+  picojson::value cache_json;
+  std::string err = picojson::parse(cache_json, LoadBytesFromFile(path_));
+  if (!err.empty() || !cache_json.is<picojson::object>()) {
+    LOG(WARNING) << "Ignore the malformed kernel variant cache file " << path_;
+    return;
+  }
+  selections_ = cache_json.get<picojson::object>();
+}
+
+std::optional<std::string> KernelVariantCache::Lookup(const std::string& func_name,
+                                                      int64_t bucket) const {
+  auto it_func = selections_.find(func_name);
+  if (it_func == selections_.end() || !it_func->second.is<picojson::object>()) {
+    return std::nullopt;
+  }
+  const picojson::object& func_selections = it_func->second.get<picojson::object>();
+  auto it_bucket = func_selections.find(std::to_string(bucket));
+  if (it_bucket == func_selections.end() || !it_bucket->second.is<std::string>()) {
+    return std::nullopt;
+  }
+  return it_bucket->second.get<std::string>();
+}
+
+void KernelVariantCache::Update(const std::string& func_name, int64_t bucket,
+                                const std::string& variant_name) {
+  picojson::value& func_selections = selections_[func_name];
+  if (!func_selections.is<picojson::object>()) {
+    func_selections = picojson::value(picojson::object());
+  }
+  func_selections.get<picojson::object>()[std::to_string(bucket)] = picojson::value(variant_name);
+  if (path_.empty()) {
+    return;
+  }
+  // Write to a temporary file and rename, so that concurrent readers never see a partial file.
+  std::error_code error;
+  std::filesystem::create_directories(std::filesystem::path(path_).parent_path(), error);
+  std::string tmp_path = path_ + ".tmp";
+  {
+    std::ofstream fout(tmp_path);
+    fout << picojson::value(selections_).serialize(/*prettify=*/true);
+    if (!fout.good()) {
+      LOG(WARNING) << "Failed to write the kernel variant cache file " << tmp_path;
+      fout.close();
+      std::filesystem::remove(tmp_path, error);
+      return;
+    }
+  }
+  std::filesystem::rename(tmp_path, path_, error);
+  if (error) {
+    std::filesystem::remove(tmp_path, error);
+  }
+}
+
+int64_t GetKernelVariantBucket(int64_t num_tokens) {
+  int64_t bucket = 1;
+  while (bucket < num_tokens) {
+    bucket <<= 1;
+  }
+  return bucket;
+}
+
+std::string GetKernelVariantCachePath(const std::string& lib_path, const std::string& metadata,
+                                      Device device) {
+  const char* cache_dir = std::getenv("MLC_KERNEL_VARIANT_CACHE_DIR");
+  if (cache_dir == nullptr || std::string(cache_dir).empty()) {
+    return "";
+  }
+  TVMRetValue device_name;
+  DeviceAPI::Get(device)->GetAttr(device, kDeviceName, &device_name);
+  std::ostringstream key_os;
+  key_os << static_cast<int>(device.device_type) << "\n";
+  if (device_name.type_code() == kTVMStr) {
+    key_os << device_name.operator std::string() << "\n";
+  }
+  std::error_code error;
+  uintmax_t lib_size = std::filesystem::file_size(lib_path, error);
+  key_os << lib_path << "\n" << (error ? 0 : lib_size) << "\n" << metadata;
+  std::ostringstream os;
+  os << std::filesystem::path(lib_path).stem().string() << "-" << std::hex
+     << std::hash<std::string>()(key_os.str()) << ".json";
+  return (std::filesystem::path(cache_dir) / os.str()).string();
+}
+
+/*! \brief The state of a kernel variant dispatcher. */
+struct KernelVariantDispatcher {
+  /*! \brief The timing state of an input size bucket. */
+  struct Bucket {
+    /*! \brief The index of the selected variant, or -1 when the variants are under timing. */
+    int selected = -1;
+    /*! \brief The index of the variant to time in the next call. */
+    int next_variant = 0;
+    /*! \brief The number of calls of each variant, including the warmup call. */
+    std::vector<int> num_calls;
+    /*! \brief The total device time of each variant, excluding the warmup call. */
+    std::vector<double> time_sum;
+  };
+
+  /*!
+   * \brief The number of timed calls of each variant in a bucket, after one warmup call which
+   * may capture CUDA graphs or allocate workspaces.
+   */
+  static constexpr const int kNumTimedCalls = 3;
+
+  std::string func_name;
+  std::vector<std::pair<std::string, PackedFunc>> variants;
+  Device device;
+  std::shared_ptr<KernelVariantCache> cache;
+  std::unordered_map<int64_t, Bucket> buckets;
+
+  /*! \brief Get the bucket of the call by the number of input tokens of the first argument. */
+  static int64_t GetBucket(TVMArgs args) {
+    if (args.num_args == 0 || args.type_codes[0] != kTVMNDArrayHandle) {
+      return 0;
+    }
+    NDArray input = args[0];
+    int64_t num_tokens = 1;
+    for (int i = 0; i + 1 < input->ndim; ++i) {
+      num_tokens *= input->shape[i];
+    }
+    return GetKernelVariantBucket(num_tokens);
+  }
+
+  Bucket& GetOrCreateBucket(int64_t bucket_key) {
+    auto it = buckets.find(bucket_key);
+    if (it != buckets.end()) {
+      return it->second;
+    }
+    Bucket& bucket = buckets[bucket_key];
+    bucket.num_calls.assign(variants.size(), 0);
+    bucket.time_sum.assign(variants.size(), 0.0);
+    if (std::optional<std::string> cached = cache->Lookup(func_name, bucket_key)) {
+      for (int i = 0; i < static_cast<int>(variants.size()); ++i) {
+        if (variants[i].first == cached.value()) {
+          bucket.selected = i;
+        }
+      }
+    }
+    return bucket;
+  }
+
+  void operator()(TVMArgs args, TVMRetValue* rv) {
+    int64_t bucket_key = GetBucket(args);
+    Bucket& bucket = GetOrCreateBucket(bucket_key);
+    if (bucket.selected != -1) {
+      variants[bucket.selected].second.CallPacked(args, rv);
+      return;
+    }
+
+    int variant = bucket.next_variant;
+    bucket.next_variant = (variant + 1) % variants.size();
+    Timer timer = Timer::Start(device);
+    variants[variant].second.CallPacked(args, rv);
+    timer->Stop();
+    double time = static_cast<double>(timer->SyncAndGetElapsedNanos()) / 1e9;
+    if (bucket.num_calls[variant]++ > 0) {
+      bucket.time_sum[variant] += time;
+    }
+    if (bucket.num_calls.back() <= kNumTimedCalls) {
+      return;
+    }
+
+    // All variants are timed. Select the fastest one.
+    int selected = 0;
+    for (int i = 1; i < static_cast<int>(variants.size()); ++i) {
+      if (bucket.time_sum[i] < bucket.time_sum[selected]) {
+        selected = i;
+      }
+    }
+    bucket.selected = selected;
+    cache->Update(func_name, bucket_key, variants[selected].first);
+    LOG(INFO) << "Select kernel variant \"" << variants[selected].first << "\" for function \""
+              << func_name << "\" with up to " << bucket_key << " input tokens, mean time "
+              << bucket.time_sum[selected] / kNumTimedCalls * 1e3 << " ms.";
+  }
+};
+
+PackedFunc CreateKernelVariantDispatcher(std::string func_name,
+                                         std::vector<std::pair<std::string, PackedFunc>> variants,
+                                         Device device, std::shared_ptr<KernelVariantCache> cache) {
+  ICHECK(!variants.empty());
+  if (variants.size() == 1) {
+    return variants[0].second;
+  }
+  auto dispatcher = std::make_shared<KernelVariantDispatcher>();
+  dispatcher->func_name = std::move(func_name);
+  dispatcher->variants = std::move(variants);
+  dispatcher->device = device;
+  dispatcher->cache = std::move(cache);
+  return PackedFunc(
+      [dispatcher](TVMArgs args, TVMRetValue* rv) -> void { (*dispatcher)(args, rv); });
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
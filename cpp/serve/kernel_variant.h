@@ -0,0 +1,88 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/kernel_variant.h
+ * \brief The selection of the kernel variants of model functions on the serving device.
+ */
+#ifndef MLC_LLM_SERVE_KERNEL_VARIANT_H_
+#define MLC_LLM_SERVE_KERNEL_VARIANT_H_
+
+#include <picojson.h>
+#include <tvm/runtime/packed_func.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using tvm::Device;
+using tvm::runtime::PackedFunc;
+
+/*!
+ * \brief The cache of the selected kernel variants, which maps each model function and input
+ * size bucket to the name of the fastest variant. The cache is persisted to a JSON file when
+ * the path is not empty, so that the following runs on the same device skip the timing.
+ */
+class KernelVariantCache {
+ public:
+  /*!
+   * \brief Constructor. Load the cache file when it exists.
+   * \param path The path of the cache file. Empty means the cache is only kept in memory.
+   */
+  explicit KernelVariantCache(std::string path);
+
+  /*! \return The selected variant of the function for the bucket, if selected already. */
+  std::optional<std::string> Lookup(const std::string& func_name, int64_t bucket) const;
+
+  /*! \brief Record the selected variant of the function for the bucket and save the cache. */
+  void Update(const std::string& func_name, int64_t bucket, const std::string& variant_name);
+
+ private:
+  /*! \brief The path of the cache file. */
+  std::string path_;
+  /*! \brief The selections, as {func_name: {bucket: variant_name}}. */
+  picojson::object selections_;
+};
+
+/*!
+ * \brief Get the input size bucket of the kernel variant selection, which is the number of input
+ * tokens rounded up to a power of two.
+ */
+int64_t GetKernelVariantBucket(int64_t num_tokens);
+
+/*!
+ * \brief Get the path of the kernel variant cache of the model on the device, which is enabled
+ * by environment variable MLC_KERNEL_VARIANT_CACHE_DIR. The cache is keyed by the device name
+ * and the model library (its path, size and metadata).
+ * \return The path of the cache, or the empty string when the cache is not enabled.
+ */
+std::string GetKernelVariantCachePath(const std::string& lib_path, const std::string& metadata,
+                                      Device device);
+
+/*!
+ * \brief Create the dispatcher of the variants of a model function. The model library
+ * may ship several variants of a function (e.g. with different weight-only quantized GEMM
+ * schedules), and the fastest one differs across devices and input sizes.
+ * The calls are bucketed by the number of input tokens (the product of the dimensions of the
+ * first argument except the last, rounded up to a power of two). For the first calls of a
+ * bucket, the dispatcher runs the variants in turn and times them on the device. After all
+ * variants are timed, the calls of the bucket go to the fastest variant.
+ * \param func_name The name of the model function.
+ * \param variants The names and functions of the variants, the first of which is the default.
+ * \param device The device the functions run on.
+ * \param cache The cache of the selections shared by all functions of the model.
+ * \return The dispatcher, which has the same signature as the variants.
+ */
+PackedFunc CreateKernelVariantDispatcher(std::string func_name,
+                                         std::vector<std::pair<std::string, PackedFunc>> variants,
+                                         Device device, std::shared_ptr<KernelVariantCache> cache);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_KERNEL_VARIANT_H_
@@ -0,0 +1,81 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/kv_swap_layout.h
+ * \brief The layout of the KV data swapped out to host memory.
+ */
+#ifndef MLC_LLM_SERVE_KV_SWAP_LAYOUT_H_
+#define MLC_LLM_SERVE_KV_SWAP_LAYOUT_H_
+
+#include <tvm/runtime/container/array.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <cstdint>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The layout of the host KV data swapped out by `ModelObj::SwapOutSequence`, which is
+ * organized as the chunks [k_0, v_0, k_1, v_1, ...] of shape
+ * (num_layers, num_chunk_tokens, num_kv_heads, head_dim). Every chunk except the last one holds
+ * `chunk_size` tokens. The layout is recorded by the KV data shared across processes or saved
+ * to files, and validated before the KV data are written into the KV cache.
+ */
+struct KVSwapLayout {
+  /*!
+   * \brief The identity hash of the model, computed from the model path and library. Only the KV
+   * data produced by the same model can be restored.
+   */
+  uint64_t model_hash = 0;
+  int64_t num_layers = 0;
+  int64_t num_kv_heads = 0;
+  int64_t head_dim = 0;
+  int64_t chunk_size = 0;
+  DLDataType dtype{0, 0, 0};
+
+  bool operator==(const KVSwapLayout& other) const {
+    return model_hash == other.model_hash && num_layers == other.num_layers &&
+           num_kv_heads == other.num_kv_heads && head_dim == other.head_dim &&
+           chunk_size == other.chunk_size && dtype.code == other.dtype.code &&
+           dtype.bits == other.dtype.bits && dtype.lanes == other.dtype.lanes;
+  }
+
+  bool operator!=(const KVSwapLayout& other) const { return !(*this == other); }
+
+  /*! \brief The shape of a chunk with the given number of tokens. */
+  ShapeTuple ChunkShape(int64_t num_chunk_tokens) const {
+    return {num_layers, num_chunk_tokens, num_kv_heads, head_dim};
+  }
+
+  /*!
+   * \brief Check whether the given host KV data chunks are in this layout.
+   * \param kv_data The KV data chunks to check.
+   * \return Whether the chunks are non-empty, paired and all of this layout.
+   */
+  bool Matches(const Array<NDArray>& kv_data) const {
+    if (kv_data.empty() || kv_data.size() % 2 != 0) {
+      return false;
+    }
+    for (int i = 0; i < static_cast<int>(kv_data.size()); ++i) {
+      const NDArray& chunk = kv_data[i];
+      bool is_last = i + 2 >= static_cast<int>(kv_data.size());
+      if (chunk->ndim != 4 || chunk->shape[0] != num_layers || chunk->shape[2] != num_kv_heads ||
+          chunk->shape[3] != head_dim || chunk->shape[1] <= 0 || chunk->shape[1] > chunk_size ||
+          (!is_last && chunk->shape[1] != chunk_size) ||
+          chunk->shape[1] != kv_data[i - i % 2]->shape[1] || chunk->dtype.code != dtype.code ||
+          chunk->dtype.bits != dtype.bits || chunk->dtype.lanes != dtype.lanes) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_KV_SWAP_LAYOUT_H_
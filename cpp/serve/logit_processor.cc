@@ -7,11 +7,18 @@
 
 #include <picojson.h>
 #include <tvm/runtime/device_api.h>
+#include <tvm/runtime/memory/memory_manager.h>
 #include <tvm/runtime/nvtx.h>
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 #include <tvm/runtime/threading_backend.h>
 
+#include <algorithm>
+#include <unordered_set>
+
+#include "../support/dynamic_bitset.h"
+#include "device_timer.h"
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -48,31 +55,18 @@ class LogitProcessorImpl : public LogitProcessorObj {
         apply_logit_bias_func_(ft->apply_logit_bias_func_),
         apply_penalty_func_(ft->apply_penalty_func_),
         apply_bitmask_func_(ft->apply_bitmask_func_),
+        update_token_counts_func_(ft->update_token_counts_func_),
+        apply_penalty_with_counts_func_(ft->apply_penalty_with_counts_func_),
+        apply_logit_bias_csr_func_(ft->apply_logit_bias_csr_func_),
+        apply_compact_bitmask_func_(ft->apply_compact_bitmask_func_),
+        preferred_host_device_(GetPreferredHostDevice(device)),
         trace_recorder_(std::move(trace_recorder)) {
-    Device preferred_host_device = GetPreferredHostDevice(device);
     // Initialize auxiliary arrays on CPU.
-    seq_ids_host_ = NDArray::Empty({max_num_token}, dtype_i32_, preferred_host_device);
-    pos2seq_id_host_ =
-        NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, preferred_host_device);
-    token_ids_host_ =
-        NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, preferred_host_device);
-    token_cnt_host_ =
-        NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, preferred_host_device);
-    token_logit_bias_host_ =
-        NDArray::Empty({max_num_token * vocab_size}, dtype_f32_, preferred_host_device);
-    penalties_host_ = NDArray::Empty({max_num_token, 3}, dtype_f32_, preferred_host_device);
-    bitmask_host_ =
-        NDArray::Empty({max_num_token, bitmask_size_}, dtype_u32_, preferred_host_device);
-    temperature_host_ = NDArray::Empty({max_num_token}, dtype_f32_, preferred_host_device);
+    temperature_host_ = NDArray::Empty({max_num_token}, dtype_f32_, preferred_host_device_);
     // Initialize auxiliary arrays on GPU.
-    seq_ids_device_ = NDArray::Empty({max_num_token}, dtype_i32_, device);
-    pos2seq_id_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device);
-    token_ids_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device);
-    token_cnt_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device);
-    token_logit_bias_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_f32_, device);
-    penalties_device_ = NDArray::Empty({max_num_token, 3}, dtype_f32_, device);
-    bitmask_device_ = NDArray::Empty({max_num_token, bitmask_size_}, dtype_i32_, device);
     temperature_device_ = NDArray::Empty({max_num_token}, dtype_f32_, device);
+    // The packed auxiliary buffers of logit updates grow on demand.
+    ReserveAuxCapacity(kInitialAuxCapacityBytes);
 
     CHECK(apply_logit_bias_func_.defined())
         << "Function \"apply_logit_bias_inplace\" not found in model";
@@ -104,6 +98,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
                            const Array<RequestModelState>* draft_mstates,  //
                            const std::vector<std::vector<int>>* draft_token_indices) final {
     NVTXScopedRange nvtx_scope("Logit inplace update");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kLogitProcessing, device_);
     CHECK_EQ(logits->ndim, 2);
     CHECK_EQ(logits->shape[1], vocab_size_);
     CHECK(logits.DataType() == DataType::Float(32));
@@ -128,15 +123,74 @@ class LogitProcessorImpl : public LogitProcessorObj {
 
     RECORD_EVENT(trace_recorder_, request_ids, "start update logits");
 
+    // - Pack the auxiliary arrays of all the updates into one host buffer,
+    // so that they are copied to device with a single transfer.
+    aux_num_bytes_ = 0;
+    LogitBiasArgs bias_args = PackLogitBias(generation_cfg, cum_num_token);
+    // The device token count table applies when every sequence has one token without drafts.
+    bool use_token_counts = update_token_counts_func_.defined() &&
+                            apply_penalty_with_counts_func_.defined() &&
+                            cum_num_token == nullptr && draft_mstates == nullptr;
+    PenaltyArgs penalty_args =
+        use_token_counts
+            ? PackPenaltyWithTokenCounts(generation_cfg, mstates)
+            : PackPenalty(generation_cfg, mstates, cum_num_token, draft_mstates,
+                          draft_token_indices);
+    MaskArgs mask_args =
+        PackMask(num_total_token, mstates, cum_num_token, draft_mstates, draft_token_indices);
+    if (aux_num_bytes_ > 0) {
+      NVTXScopedRange nvtx_scope("Copy packed auxiliary arrays");
+      NDArray aux_host = aux_host_storage_->AllocNDArray(0, {aux_num_bytes_ / 4}, dtype_i32_);
+      NDArray aux_device = aux_device_storage_->AllocNDArray(0, {aux_num_bytes_ / 4}, dtype_i32_);
+      CopyArray(/*src=*/aux_host, /*dst=*/aux_device, copy_stream_);
+      SyncCopyStream(device_, compute_stream_, copy_stream_);
+    }
+
     // Update 1. logit bias
     RECORD_EVENT(trace_recorder_, request_ids, "start apply logit bias");
-    UpdateWithLogitBias(logits, generation_cfg, cum_num_token);
+    if (bias_args.num_token > 0 && bias_args.csr) {
+      apply_logit_bias_csr_func_(logits, AuxDevice(bias_args.row_ids, bias_args.num_row),
+                                 AuxDevice(bias_args.pos2seq_id, bias_args.num_row),
+                                 AuxDevice(bias_args.indptr, bias_args.num_seq + 1),
+                                 AuxDevice(bias_args.token_ids, bias_args.num_token),
+                                 AuxDevice(bias_args.logit_bias, bias_args.num_token, dtype_f32_));
+      SyncForTrace();
+    } else if (bias_args.num_token > 0) {
+      apply_logit_bias_func_(logits, AuxDevice(bias_args.pos2seq_id, bias_args.num_token),
+                             AuxDevice(bias_args.token_ids, bias_args.num_token),
+                             AuxDevice(bias_args.logit_bias, bias_args.num_token, dtype_f32_));
+      SyncForTrace();
+    }
     RECORD_EVENT(trace_recorder_, request_ids, "finish apply logit bias");
 
     // Update 2. penalties
     RECORD_EVENT(trace_recorder_, request_ids, "start apply penalty");
-    UpdateWithPenalty(logits, generation_cfg, mstates, cum_num_token, draft_mstates,
-                      draft_token_indices);
+    if (penalty_args.num_seq > 0 && penalty_args.with_token_counts) {
+      int num_seq = penalty_args.num_seq;
+      int num_update = penalty_args.num_token;
+      NDArray token_counts = token_counts_storage_->AllocNDArray(
+          0, {static_cast<int64_t>(slot_stamps_.size()), vocab_size_}, dtype_i32_);
+      if (num_update > 0) {
+        update_token_counts_func_(token_counts, AuxDevice(penalty_args.pos2seq_id, num_update),
+                                  AuxDevice(penalty_args.token_ids, num_update),
+                                  AuxDevice(penalty_args.token_cnt, num_update));
+      }
+      apply_penalty_with_counts_func_(logits, AuxDevice(penalty_args.seq_ids, num_seq),
+                                      AuxDevice(penalty_args.slot_ids, num_seq), token_counts,
+                                      aux_device_storage_->AllocNDArray(
+                                          penalty_args.penalties, {num_seq, 3}, dtype_f32_));
+      SyncForTrace();
+    } else if (penalty_args.num_seq > 0) {
+      int num_seq = penalty_args.num_seq;
+      int num_token = penalty_args.num_token;
+      apply_penalty_func_(logits, AuxDevice(penalty_args.seq_ids, num_seq),
+                          AuxDevice(penalty_args.pos2seq_id, num_token),
+                          AuxDevice(penalty_args.token_ids, num_token),
+                          AuxDevice(penalty_args.token_cnt, num_token),
+                          aux_device_storage_->AllocNDArray(penalty_args.penalties, {num_seq, 3},
+                                                            dtype_f32_));
+      SyncForTrace();
+    }
     RECORD_EVENT(trace_recorder_, request_ids, "finish apply penalty");
 
     // Update 3. Vocabulary mask.
@@ -144,7 +198,18 @@ class LogitProcessorImpl : public LogitProcessorObj {
     // This is because the masked logits are set to the minimal value.
     // Further logit subtraction may cause issue such as underflow.
     RECORD_EVENT(trace_recorder_, request_ids, "start apply logit mask");
-    UpdateWithMask(logits, mstates, cum_num_token, draft_mstates, draft_token_indices);
+    if (mask_args.num_seq > 0 && mask_args.compact) {
+      apply_compact_bitmask_func_(
+          logits, AuxDevice(mask_args.seq_ids, mask_args.num_seq),
+          aux_device_storage_->AllocNDArray(mask_args.bitmask, {mask_args.num_seq, bitmask_size_},
+                                            dtype_i32_));
+      SyncForTrace();
+    } else if (mask_args.num_seq > 0) {
+      apply_bitmask_func_(logits, AuxDevice(mask_args.seq_ids, mask_args.num_seq),
+                          aux_device_storage_->AllocNDArray(
+                              mask_args.bitmask, {num_total_token, bitmask_size_}, dtype_i32_));
+      SyncForTrace();
+    }
     RECORD_EVENT(trace_recorder_, request_ids, "finish apply logit mask");
 
     RECORD_EVENT(trace_recorder_, request_ids, "finish update logits");
@@ -154,6 +219,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
                                  const Array<String>& request_ids,
                                  const std::vector<int>* cum_num_token) final {
     NVTXScopedRange nvtx_scope("Compute probs from logits");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kLogitProcessing, device_);
     // logits: (n, v)
     CHECK_EQ(logits->ndim, 2);
     CHECK_LE(logits->shape[0], max_num_token_);
@@ -208,94 +274,229 @@ class LogitProcessorImpl : public LogitProcessorObj {
   }
 
  private:
-  void UpdateWithLogitBias(NDArray logits, const Array<GenerationConfig>& generation_cfg,
-                           const std::vector<int>* cum_num_token) {
-    NVTXScopedRange nvtx_scope("UpdateWithLogitBias");
-    // Construct:
-    // - pos2seq_id (max_num_token * vocab_size,) int32
-    // - token_ids (max_num_token * vocab_size,) int32
-    // - token_logit_bias (max_num_token * vocab_size,) float32
-    int* p_pos2seq_id = static_cast<int*>(pos2seq_id_host_->data);
-    int* p_token_ids = static_cast<int*>(token_ids_host_->data);
-    float* p_token_logit_bias = static_cast<float*>(token_logit_bias_host_->data);
+  /*!
+   * \brief The packed byte offsets of the logit bias kernel arguments.
+   * In CSR format, `num_token` is the number of bias entries, which are stored once per
+   * sequence with `indptr` and shared by the `num_row` logit rows of the sequence, where
+   * `pos2seq_id` maps each row in `row_ids` to its sequence.
+   */
+  struct LogitBiasArgs {
+    bool csr = false;
+    int num_token = 0;
+    int num_row = 0;
+    int num_seq = 0;
+    int64_t row_ids = 0;
+    int64_t indptr = 0;
+    int64_t pos2seq_id = 0;
+    int64_t token_ids = 0;
+    int64_t logit_bias = 0;
+  };
+
+  /*!
+   * \brief The packed byte offsets of the penalty kernel arguments.
+   * With the device token count table, `num_token`, `pos2seq_id`, `token_ids` and `token_cnt`
+   * describe the count table entries to set, where `pos2seq_id` holds the slot ids.
+   */
+  struct PenaltyArgs {
+    bool with_token_counts = false;
+    int num_seq = 0;
+    int num_token = 0;
+    int64_t seq_ids = 0;
+    int64_t slot_ids = 0;
+    int64_t pos2seq_id = 0;
+    int64_t token_ids = 0;
+    int64_t token_cnt = 0;
+    int64_t penalties = 0;
+  };
+
+  /*!
+   * \brief The packed byte offsets of the bitmask kernel arguments.
+   * A compact bitmask holds only the `num_seq` rows in `seq_ids` instead of every row.
+   */
+  struct MaskArgs {
+    bool compact = false;
+    int num_seq = 0;
+    int64_t seq_ids = 0;
+    int64_t bitmask = 0;
+  };
+
+  LogitBiasArgs PackLogitBias(const Array<GenerationConfig>& generation_cfg,
+                              const std::vector<int>* cum_num_token) {
+    NVTXScopedRange nvtx_scope("PackLogitBias");
+    if (apply_logit_bias_csr_func_.defined()) {
+      return PackLogitBiasCSR(generation_cfg, cum_num_token);
+    }
+    // Count the bias entries to reserve:
+    // - pos2seq_id (num_bias_token,) int32
+    // - token_ids (num_bias_token,) int32
+    // - token_logit_bias (num_bias_token,) float32
+    int num_bias_token = 0;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      int num_token_to_process =
+          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+      num_bias_token += num_token_to_process * generation_cfg[i]->logit_bias.size();
+    }
+    LogitBiasArgs args;
+    if (num_bias_token == 0) {
+      return args;
+    }
+    args.num_token = num_bias_token;
+    args.pos2seq_id = ReserveAux(num_bias_token);
+    args.token_ids = ReserveAux(num_bias_token);
+    args.logit_bias = ReserveAux(num_bias_token);
+    int* p_pos2seq_id = AuxHost<int>(args.pos2seq_id);
+    int* p_token_ids = AuxHost<int>(args.token_ids);
+    float* p_token_logit_bias = AuxHost<float>(args.logit_bias);
 
     // - Set arrays.
-    int num_token_for_bias = 0;
-    int num_bias_token = 0;
+    int pos = 0;
     for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
       int num_token_to_process =
           cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
       int token_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
       for (int j = 0; j < num_token_to_process; ++j) {
-        if (!generation_cfg[i]->logit_bias.empty()) {
-          for (auto [token_id, bias] : generation_cfg[i]->logit_bias) {
-            p_pos2seq_id[num_bias_token] = token_offset + j;
-            p_token_ids[num_bias_token] = token_id;
-            p_token_logit_bias[num_bias_token] = bias;
-            ++num_bias_token;
-          }
-          ++num_token_for_bias;
+        for (auto [token_id, bias] : generation_cfg[i]->logit_bias) {
+          p_pos2seq_id[pos] = token_offset + j;
+          p_token_ids[pos] = token_id;
+          p_token_logit_bias[pos] = bias;
+          ++pos;
         }
       }
     }
+    ICHECK_EQ(pos, num_bias_token);
+    return args;
+  }
 
-    if (num_token_for_bias == 0) {
-      return;
+  /*!
+   * \brief Pack the logit bias in CSR format, where the bias entries of a sequence are not
+   * repeated for each of its tokens.
+   */
+  LogitBiasArgs PackLogitBiasCSR(const Array<GenerationConfig>& generation_cfg,
+                                 const std::vector<int>* cum_num_token) {
+    // Count the entries to reserve:
+    // - row_ids (num_row,) int32
+    // - row2seq_id (num_row,) int32
+    // - indptr (num_seq + 1,) int32
+    // - token_ids (num_entry,) int32
+    // - token_logit_bias (num_entry,) float32
+    LogitBiasArgs args;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      if (generation_cfg[i]->logit_bias.empty()) {
+        continue;
+      }
+      int num_token_to_process =
+          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+      args.num_token += generation_cfg[i]->logit_bias.size();
+      args.num_row += num_token_to_process;
+      ++args.num_seq;
     }
+    if (args.num_token == 0) {
+      return LogitBiasArgs();
+    }
+    args.csr = true;
+    args.row_ids = ReserveAux(args.num_row);
+    args.pos2seq_id = ReserveAux(args.num_row);
+    args.indptr = ReserveAux(args.num_seq + 1);
+    args.token_ids = ReserveAux(args.num_token);
+    args.logit_bias = ReserveAux(args.num_token);
+    int* p_row_ids = AuxHost<int>(args.row_ids);
+    int* p_row2seq_id = AuxHost<int>(args.pos2seq_id);
+    int* p_indptr = AuxHost<int>(args.indptr);
+    int* p_token_ids = AuxHost<int>(args.token_ids);
+    float* p_token_logit_bias = AuxHost<float>(args.logit_bias);
 
-    // - View arrays.
-    int num_token = num_bias_token;
-    NDArray pos2seq_id_host = pos2seq_id_host_.CreateView({num_token}, dtype_i32_);
-    NDArray pos2seq_id_device = pos2seq_id_device_.CreateView({num_token}, dtype_i32_);
-    NDArray token_ids_host = token_ids_host_.CreateView({num_token}, dtype_i32_);
-    NDArray token_ids_device = token_ids_device_.CreateView({num_token}, dtype_i32_);
-    NDArray token_logit_bias_host = token_logit_bias_host_.CreateView({num_token}, dtype_f32_);
-    NDArray token_logit_bias_device = token_logit_bias_device_.CreateView({num_token}, dtype_f32_);
-
-    // - Copy arrays to GPU.
-    CopyArray(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device, copy_stream_);
-    CopyArray(/*src=*/token_ids_host, /*dst=*/token_ids_device, copy_stream_);
-    CopyArray(/*src=*/token_logit_bias_host, /*dst=*/token_logit_bias_device, copy_stream_);
-    SyncCopyStream(device_, compute_stream_, copy_stream_);
-
-    // - Call kernel.
-    apply_logit_bias_func_(logits, pos2seq_id_device, token_ids_device, token_logit_bias_device);
-    if (trace_recorder_.defined()) {
-      TVMSynchronize(device_.device_type, device_.device_id, /*stream=*/nullptr);
+    // - Set arrays.
+    int row = 0;
+    int seq = 0;
+    int entry = 0;
+    p_indptr[0] = 0;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      if (generation_cfg[i]->logit_bias.empty()) {
+        continue;
+      }
+      int num_token_to_process =
+          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+      int token_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
+      for (int j = 0; j < num_token_to_process; ++j) {
+        p_row_ids[row] = token_offset + j;
+        p_row2seq_id[row] = seq;
+        ++row;
+      }
+      for (auto [token_id, bias] : generation_cfg[i]->logit_bias) {
+        p_token_ids[entry] = token_id;
+        p_token_logit_bias[entry] = bias;
+        ++entry;
+      }
+      p_indptr[++seq] = entry;
     }
+    ICHECK_EQ(row, args.num_row);
+    ICHECK_EQ(seq, args.num_seq);
+    ICHECK_EQ(entry, args.num_token);
+    return args;
   }
 
-  void UpdateWithPenalty(NDArray logits, const Array<GenerationConfig>& generation_cfg,
-                         const Array<RequestModelState>& mstates,
-                         const std::vector<int>* cum_num_token,
-                         const Array<RequestModelState>* draft_mstates,
-                         const std::vector<std::vector<int>>* draft_token_indices) {
-    NVTXScopedRange nvtx_scope("UpdateWithPenalty");
-    // Construct:
-    // - seq_ids (max_num_token,) int32
-    // - pos2seq_id (max_num_token * vocab_size,) int32
-    // - token_ids (max_num_token * vocab_size,) int32
-    // - token_cnt (max_num_token * vocab_size,) int32
-    // - penalties (max_num_token, 3) float32
-    int* p_seq_ids = static_cast<int*>(seq_ids_host_->data);
-    int* p_pos2seq_id = static_cast<int*>(pos2seq_id_host_->data);
-    int* p_token_ids = static_cast<int*>(token_ids_host_->data);
-    int* p_token_cnt = static_cast<int*>(token_cnt_host_->data);
-    float* p_penalties = static_cast<float*>(penalties_host_->data);
+  PenaltyArgs PackPenalty(const Array<GenerationConfig>& generation_cfg,
+                          const Array<RequestModelState>& mstates,
+                          const std::vector<int>* cum_num_token,
+                          const Array<RequestModelState>* draft_mstates,
+                          const std::vector<std::vector<int>>* draft_token_indices) {
+    NVTXScopedRange nvtx_scope("PackPenalty");
+    auto f_has_penalty = [](const GenerationConfig& cfg) {
+      return cfg->frequency_penalty != 0.0 || cfg->presence_penalty != 0.0 ||
+             cfg->repetition_penalty != 1.0;
+    };
+    // Bound the number of entries to reserve:
+    // - seq_ids (num_seq,) int32
+    // - pos2seq_id (num_token,) int32
+    // - token_ids (num_token,) int32
+    // - token_cnt (num_token,) int32
+    // - penalties (num_seq, 3) float32
+    // The appeared tokens of a draft token are at most the committed appeared tokens
+    // plus all the draft tokens.
+    int max_num_seq = 0;
+    int max_num_token = 0;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      if (f_has_penalty(generation_cfg[i])) {
+        int num_token_to_process =
+            cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+        int num_draft_token =
+            draft_mstates == nullptr ? 0 : (*draft_mstates)[i]->draft_output_tokens.size();
+        max_num_seq += num_token_to_process;
+        max_num_token +=
+            num_token_to_process * (mstates[i]->appeared_token_ids.size() + num_draft_token);
+      }
+    }
+    PenaltyArgs args;
+    if (max_num_seq == 0) {
+      return args;
+    }
+    args.seq_ids = ReserveAux(max_num_seq);
+    args.pos2seq_id = ReserveAux(max_num_token);
+    args.token_ids = ReserveAux(max_num_token);
+    args.token_cnt = ReserveAux(max_num_token);
+    args.penalties = ReserveAux(max_num_seq * 3);
+    int* p_seq_ids = AuxHost<int>(args.seq_ids);
+    int* p_pos2seq_id = AuxHost<int>(args.pos2seq_id);
+    int* p_token_ids = AuxHost<int>(args.token_ids);
+    int* p_token_cnt = AuxHost<int>(args.token_cnt);
+    float* p_penalties = AuxHost<float>(args.penalties);
 
     // - Set arrays.
     int num_token_for_penalty = 0;
     int num_penalty_appeared_token = 0;
     for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
-      if (generation_cfg[i]->frequency_penalty != 0.0 ||
-          generation_cfg[i]->presence_penalty != 0.0 ||
-          generation_cfg[i]->repetition_penalty != 1.0) {
+      if (f_has_penalty(generation_cfg[i])) {
         int num_token_to_process =
             cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
         int token_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
-        CHECK(num_token_to_process == 1 || mstates[i]->draft_output_tokens.empty());
+        // The draft tokens may live in the same states when proposed without a draft model.
+        CHECK(num_token_to_process == 1 || mstates[i]->draft_output_tokens.empty() ||
+              (draft_mstates != nullptr && (*draft_mstates)[i].same_as(mstates[i])));
         ICHECK(draft_token_indices == nullptr ||
                draft_token_indices->at(i).size() == num_token_to_process);
+        // The device token count slot is not synced on this path, so release it.
+        mstates[i]->penalty_slot = -1;
+        mstates[i]->penalty_dirty_tokens.clear();
         for (int j = 0; j < num_token_to_process; ++j) {
           p_seq_ids[num_token_for_penalty] = token_offset + j;
 
@@ -332,69 +533,235 @@ class LogitProcessorImpl : public LogitProcessorObj {
         }
       }
     }
+    ICHECK_LE(num_penalty_appeared_token, max_num_token);
+    args.num_seq = num_token_for_penalty;
+    args.num_token = num_penalty_appeared_token;
+    return args;
+  }
 
-    if (num_token_for_penalty == 0) {
-      return;
+  /*!
+   * \brief Pack the penalty arguments with the device token count table, where each penalized
+   * sequence owns a table slot. Only the counts changed since the last step are uploaded, so the
+   * host work is proportional to the new tokens instead of all the appeared tokens.
+   */
+  PenaltyArgs PackPenaltyWithTokenCounts(const Array<GenerationConfig>& generation_cfg,
+                                         const Array<RequestModelState>& mstates) {
+    NVTXScopedRange nvtx_scope("PackPenaltyWithTokenCounts");
+    ++num_token_count_updates_;
+    std::vector<int> penalized_seqs;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      if (generation_cfg[i]->frequency_penalty != 0.0 ||
+          generation_cfg[i]->presence_penalty != 0.0 ||
+          generation_cfg[i]->repetition_penalty != 1.0) {
+        penalized_seqs.push_back(i);
+      }
+    }
+    PenaltyArgs args;
+    args.with_token_counts = true;
+    if (penalized_seqs.empty()) {
+      return args;
+    }
+    ReserveTokenCountSlots(penalized_seqs.size());
+
+    // - Collect the count table entries to set and the slot of each sequence.
+    std::vector<int32_t> slot_ids;
+    std::vector<int32_t> update_slot_ids;
+    std::vector<int32_t> update_token_ids;
+    std::vector<int32_t> update_counts;
+    auto f_set_count = [&](int slot, int32_t token_id, int32_t count) {
+      update_slot_ids.push_back(slot);
+      update_token_ids.push_back(token_id);
+      update_counts.push_back(count);
+      if (count > 0) {
+        slot_nonzero_tokens_[slot].insert(token_id);
+      } else {
+        slot_nonzero_tokens_[slot].erase(token_id);
+      }
+    };
+    for (int i : penalized_seqs) {
+      const RequestModelState& mstate = mstates[i];
+      int slot = mstate->penalty_slot;
+      if (slot >= 0 && slot < static_cast<int>(slot_stamps_.size()) &&
+          slot_stamps_[slot] == mstate->penalty_slot_stamp) {
+        // The slot is still owned by the state. Set the changed counts only.
+        // Duplicated tokens set the same count, which is benign.
+        for (int32_t token_id : mstate->penalty_dirty_tokens) {
+          auto it = mstate->appeared_token_ids.find(token_id);
+          f_set_count(slot, token_id, it == mstate->appeared_token_ids.end() ? 0 : it->second);
+        }
+      } else {
+        // Take a new slot, clearing the counts of its previous owner.
+        slot = TakeTokenCountSlot();
+        std::vector<int32_t> stale_tokens;
+        for (int32_t token_id : slot_nonzero_tokens_[slot]) {
+          if (!mstate->appeared_token_ids.count(token_id)) {
+            stale_tokens.push_back(token_id);
+          }
+        }
+        for (int32_t token_id : stale_tokens) {
+          f_set_count(slot, token_id, 0);
+        }
+        for (auto [token_id, count] : mstate->appeared_token_ids) {
+          f_set_count(slot, token_id, count);
+        }
+        slot_stamps_[slot] = next_slot_stamp_++;
+        mstate->penalty_slot = slot;
+        mstate->penalty_slot_stamp = slot_stamps_[slot];
+      }
+      mstate->penalty_dirty_tokens.clear();
+      slot_last_used_[slot] = num_token_count_updates_;
+      slot_ids.push_back(slot);
     }
 
-    // - View arrays.
-    int num_seq = num_token_for_penalty;
-    int num_token = num_penalty_appeared_token;
-    NDArray seq_ids_host = seq_ids_host_.CreateView({num_seq}, dtype_i32_);
-    NDArray seq_ids_device = seq_ids_device_.CreateView({num_seq}, dtype_i32_);
-    NDArray pos2seq_id_host = pos2seq_id_host_.CreateView({num_token}, dtype_i32_);
-    NDArray pos2seq_id_device = pos2seq_id_device_.CreateView({num_token}, dtype_i32_);
-    NDArray token_ids_host = token_ids_host_.CreateView({num_token}, dtype_i32_);
-    NDArray token_ids_device = token_ids_device_.CreateView({num_token}, dtype_i32_);
-    NDArray token_cnt_host = token_cnt_host_.CreateView({num_token}, dtype_i32_);
-    NDArray token_cnt_device = token_cnt_device_.CreateView({num_token}, dtype_i32_);
-    NDArray penalties_host = penalties_host_.CreateView({num_seq, 3}, dtype_f32_);
-    NDArray penalties_device = penalties_device_.CreateView({num_seq, 3}, dtype_f32_);
-
-    // - Copy arrays to GPU.
-    CopyArray(/*src=*/seq_ids_host, /*dst=*/seq_ids_device, copy_stream_);
-    CopyArray(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device, copy_stream_);
-    CopyArray(/*src=*/token_ids_host, /*dst=*/token_ids_device, copy_stream_);
-    CopyArray(/*src=*/token_cnt_host, /*dst=*/token_cnt_device, copy_stream_);
-    CopyArray(/*src=*/penalties_host, /*dst=*/penalties_device, copy_stream_);
-    SyncCopyStream(device_, compute_stream_, copy_stream_);
+    // - Set arrays.
+    int num_seq = penalized_seqs.size();
+    int num_update = update_slot_ids.size();
+    args.num_seq = num_seq;
+    args.num_token = num_update;
+    args.seq_ids = ReserveAux(num_seq);
+    args.slot_ids = ReserveAux(num_seq);
+    args.penalties = ReserveAux(num_seq * 3);
+    args.pos2seq_id = ReserveAux(num_update);
+    args.token_ids = ReserveAux(num_update);
+    args.token_cnt = ReserveAux(num_update);
+    int* p_seq_ids = AuxHost<int>(args.seq_ids);
+    float* p_penalties = AuxHost<float>(args.penalties);
+    for (int j = 0; j < num_seq; ++j) {
+      const GenerationConfig& cfg = generation_cfg[penalized_seqs[j]];
+      p_seq_ids[j] = penalized_seqs[j];
+      p_penalties[j * 3] = cfg->presence_penalty;
+      p_penalties[j * 3 + 1] = cfg->frequency_penalty;
+      p_penalties[j * 3 + 2] = cfg->repetition_penalty;
+    }
+    std::copy(slot_ids.begin(), slot_ids.end(), AuxHost<int32_t>(args.slot_ids));
+    std::copy(update_slot_ids.begin(), update_slot_ids.end(), AuxHost<int32_t>(args.pos2seq_id));
+    std::copy(update_token_ids.begin(), update_token_ids.end(), AuxHost<int32_t>(args.token_ids));
+    std::copy(update_counts.begin(), update_counts.end(), AuxHost<int32_t>(args.token_cnt));
+    return args;
+  }
 
-    // - Call kernel.
-    apply_penalty_func_(logits, seq_ids_device, pos2seq_id_device, token_ids_device,
-                        token_cnt_device, penalties_device);
-    if (trace_recorder_.defined()) {
-      TVMSynchronize(device_.device_type, device_.device_id, /*stream=*/nullptr);
+  /*!
+   * \brief Make sure the device token count table has at least the given number of slots.
+   * Growing the table zeroes it and invalidates all the slots, so that every state resyncs.
+   */
+  void ReserveTokenCountSlots(int num_slots) {
+    int cur_num_slots = slot_stamps_.size();
+    if (num_slots <= cur_num_slots) {
+      return;
     }
+    int new_num_slots = std::min(std::max(num_slots, cur_num_slots * 2), max_num_token_);
+    ICHECK_GE(new_num_slots, num_slots);
+    memory::Allocator* allocator =
+        memory::MemoryManager::GetOrCreateAllocator(device_, memory::AllocatorType::kNaive);
+    ICHECK_NOTNULL(allocator);
+    token_counts_storage_ = memory::Storage(
+        allocator->Alloc(device_, {new_num_slots, vocab_size_}, dtype_i32_), allocator);
+    NDArray zeros =
+        NDArray::Empty({new_num_slots, vocab_size_}, dtype_i32_, DLDevice{kDLCPU, 0});
+    std::memset(zeros->data, 0, static_cast<size_t>(new_num_slots) * vocab_size_ * 4);
+    NDArray token_counts =
+        token_counts_storage_->AllocNDArray(0, {new_num_slots, vocab_size_}, dtype_i32_);
+    token_counts.CopyFrom(zeros);
+    slot_stamps_.assign(new_num_slots, -1);
+    slot_last_used_.assign(new_num_slots, 0);
+    slot_nonzero_tokens_.assign(new_num_slots, {});
   }
 
-  void UpdateWithMask(NDArray logits, const Array<RequestModelState>& mstates,
-                      const std::vector<int>* cum_num_token,
-                      const Array<RequestModelState>* draft_mstates,
-                      const std::vector<std::vector<int>>* draft_token_indices) {
-    NVTXScopedRange nvtx_scope("UpdateWithMask");
-    // Construct:
-    // - seq_ids (max_num_token,) int32
-    // - bitmask (max_num_token, ceildiv(vocab_size, 32)), int32
-    int32_t* p_seq_ids = static_cast<int32_t*>(seq_ids_host_->data);
-    uint32_t* p_bitmask = static_cast<uint32_t*>(bitmask_host_->data);
+  /*! \brief Take a free slot, or the least recently used slot not used by the current update. */
+  int TakeTokenCountSlot() {
+    int slot = -1;
+    for (int i = 0; i < static_cast<int>(slot_stamps_.size()); ++i) {
+      if (slot_last_used_[i] == num_token_count_updates_) {
+        continue;
+      }
+      if (slot_stamps_[i] == -1) {
+        return i;
+      }
+      if (slot == -1 || slot_last_used_[i] < slot_last_used_[slot]) {
+        slot = i;
+      }
+    }
+    ICHECK_NE(slot, -1) << "No token count slot is available.";
+    return slot;
+  }
 
-    // - Set arrays.
-    int batch_size = logits->shape[0];
+  MaskArgs PackMask(int batch_size, const Array<RequestModelState>& mstates,
+                    const std::vector<int>* cum_num_token,
+                    const Array<RequestModelState>* draft_mstates,
+                    const std::vector<std::vector<int>>* draft_token_indices) {
+    NVTXScopedRange nvtx_scope("PackMask");
     ICHECK((cum_num_token == nullptr && batch_size == mstates.size()) ||
            (cum_num_token != nullptr && batch_size == cum_num_token->back()));
+    MaskArgs args;
+    bool any_require_mask = false;
+    for (const RequestModelState& mstate : mstates) {
+      any_require_mask |= mstate->RequireNextTokenBitmask();
+    }
+    if (!any_require_mask) {
+      return args;
+    }
+    // Reserve:
+    // - seq_ids (batch_size,) int32
+    // - bitmask (batch_size, ceildiv(vocab_size, 32)), int32
+    args.seq_ids = ReserveAux(batch_size);
+    args.bitmask = ReserveAux(static_cast<int64_t>(batch_size) * bitmask_size_);
+    int32_t* p_seq_ids = AuxHost<int32_t>(args.seq_ids);
+    uint32_t* p_bitmask = AuxHost<uint32_t>(args.bitmask);
 
+    // - Set arrays.
     std::memset(p_seq_ids, 0, batch_size * sizeof(int32_t));
 
-    for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
-      int token_start_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
-      int token_number =
-          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
-      bool require_mask = mstates[i]->RequireNextTokenBitmask();
-      ICHECK(draft_token_indices == nullptr || draft_token_indices->at(i).size() == token_number);
-      for (int j = 0; j < token_number; ++j) {
-        if (require_mask) {
-          std::vector<SampleResult> draft_token_seq;
-          if (draft_token_indices != nullptr) {
+    if (draft_token_indices == nullptr) {
+      // Without draft tokens, every token of a sequence has the same bitmask. Find the bitmasks
+      // of all the sequences in one batch, and copy them to the other tokens.
+      std::vector<GrammarStateMatcher> matchers;
+      std::vector<int> rows;
+      for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
+        if (mstates[i]->RequireNextTokenBitmask()) {
+          matchers.push_back(mstates[i]->grammar_state_matcher.value());
+          rows.push_back(cum_num_token == nullptr ? i : cum_num_token->at(i));
+        }
+      }
+      int64_t bitmask_shape[] = {batch_size, bitmask_size_};
+      DLTensor bitmask_dltensor;
+      bitmask_dltensor.data = p_bitmask;
+      bitmask_dltensor.device = preferred_host_device_;
+      bitmask_dltensor.ndim = 2;
+      bitmask_dltensor.dtype = dtype_u32_;
+      bitmask_dltensor.shape = bitmask_shape;
+      bitmask_dltensor.strides = nullptr;
+      bitmask_dltensor.byte_offset = 0;
+      GrammarStateMatcher::BatchFindNextTokenBitmask(matchers, &bitmask_dltensor, rows);
+
+      for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
+        if (!mstates[i]->RequireNextTokenBitmask()) {
+          continue;
+        }
+        int token_start_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
+        if (IsAllAcceptingBitmask(p_bitmask + token_start_offset * bitmask_size_)) {
+          // The grammar accepts every token, so the mask does not need to be applied.
+          continue;
+        }
+        int token_end_offset = cum_num_token == nullptr ? i + 1 : cum_num_token->at(i + 1);
+        for (int j = token_start_offset; j < token_end_offset; ++j) {
+          if (j > token_start_offset) {
+            std::memcpy(p_bitmask + j * bitmask_size_,
+                        p_bitmask + token_start_offset * bitmask_size_,
+                        bitmask_size_ * sizeof(uint32_t));
+          }
+          p_seq_ids[j] = 1;
+        }
+      }
+    } else {
+      for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
+        int token_start_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
+        int token_number =
+            cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+        bool require_mask = mstates[i]->RequireNextTokenBitmask();
+        ICHECK(draft_token_indices->at(i).size() == token_number);
+        for (int j = 0; j < token_number; ++j) {
+          if (require_mask) {
+            std::vector<SampleResult> draft_token_seq;
             int cur_draft_token_index = draft_token_indices->at(i)[j];
             while (cur_draft_token_index != -1) {
               draft_token_seq.push_back(
@@ -402,53 +769,123 @@ class LogitProcessorImpl : public LogitProcessorObj {
               cur_draft_token_index =
                   (*draft_mstates)[i]->draft_token_parent_idx[cur_draft_token_index];
             }
+            // Only the draft tokens accepted by the grammar are rolled back afterwards. A draft
+            // token rejected by the grammar is never accepted in sampling, as it is masked out
+            // in its parent's bitmask, so the bitmask of its descendants does not matter.
+            int num_accepted_draft_tokens = 0;
             for (auto it = draft_token_seq.rbegin(); it != draft_token_seq.rend(); ++it) {
-              mstates[i]->grammar_state_matcher.value()->AcceptToken(it->GetTokenId());
+              if (!mstates[i]->grammar_state_matcher.value()->AcceptToken(it->GetTokenId())) {
+                break;
+              }
+              ++num_accepted_draft_tokens;
+            }
+            // Find a slice of the packed bitmask: bitmask[token_start_offset + j, :]
+            int64_t bitmask_shape[] = {bitmask_size_};
+            DLTensor bitmask_dltensor;
+            bitmask_dltensor.data = p_bitmask + (token_start_offset + j) * bitmask_size_;
+            bitmask_dltensor.device = preferred_host_device_;
+            bitmask_dltensor.ndim = 1;
+            bitmask_dltensor.dtype = dtype_u32_;
+            bitmask_dltensor.shape = bitmask_shape;
+            bitmask_dltensor.strides = nullptr;
+            bitmask_dltensor.byte_offset = 0;
+
+            mstates[i]->FindNextTokenBitmask(&bitmask_dltensor);
+            if (!IsAllAcceptingBitmask(p_bitmask + (token_start_offset + j) * bitmask_size_)) {
+              p_seq_ids[token_start_offset + j] = 1;
+            }
+
+            if (num_accepted_draft_tokens > 0) {
+              mstates[i]->grammar_state_matcher.value()->Rollback(num_accepted_draft_tokens);
             }
-          }
-          // Find a slice of bitmask_host_: bitmask_host_[num_token_for_mask, :]
-          auto bitmask_dltensor = *bitmask_host_.operator->();
-          int64_t bitmask_shape[] = {bitmask_size_};
-          bitmask_dltensor.data = p_bitmask + (token_start_offset + j) * bitmask_size_;
-          bitmask_dltensor.shape = bitmask_shape;
-          bitmask_dltensor.ndim = 1;
-
-          mstates[i]->FindNextTokenBitmask(&bitmask_dltensor);
-          p_seq_ids[token_start_offset + j] = 1;
-
-          if (draft_token_seq.size() > 0) {
-            mstates[i]->grammar_state_matcher.value()->Rollback(draft_token_seq.size());
           }
         }
       }
     }
 
+    // The compact bitmask moves the masked rows to the front, which never overlap as
+    // `num_token_for_mask <= i`.
+    args.compact = apply_compact_bitmask_func_.defined();
     int num_token_for_mask = 0;
     for (int i = 0; i < batch_size; ++i) {
       if (p_seq_ids[i] == 1) {
         p_seq_ids[num_token_for_mask] = i;
+        if (args.compact && num_token_for_mask != i) {
+          std::memcpy(p_bitmask + num_token_for_mask * bitmask_size_, p_bitmask + i * bitmask_size_,
+                      bitmask_size_ * sizeof(uint32_t));
+        }
         ++num_token_for_mask;
       }
     }
-
+    args.num_seq = num_token_for_mask;
+    // The mask is packed last, so the unused tail of its reservation is not copied to device.
     if (num_token_for_mask == 0) {
+      aux_num_bytes_ = args.seq_ids;
+    } else if (args.compact) {
+      aux_num_bytes_ = args.bitmask + AlignAuxBytes(static_cast<int64_t>(num_token_for_mask) *
+                                                    bitmask_size_);
+    }
+    return args;
+  }
+
+  /*! \brief Check if the bitmask of one token accepts all the tokens in the vocabulary. */
+  bool IsAllAcceptingBitmask(uint32_t* bitmask) const {
+    return DynamicBitset(vocab_size_, bitmask).All();
+  }
+
+  /*!
+   * \brief Reserve a region of `num_elem` 4-byte elements in the packed auxiliary buffer.
+   * \return The byte offset of the region. Host pointers into the buffer must be taken
+   * after all the reservations, since the buffer may grow.
+   */
+  int64_t ReserveAux(int64_t num_elem) {
+    int64_t offset = aux_num_bytes_;
+    int64_t num_bytes = AlignAuxBytes(num_elem);
+    ReserveAuxCapacity(offset + num_bytes);
+    aux_num_bytes_ = offset + num_bytes;
+    return offset;
+  }
+
+  /*! \brief Return the aligned bytes of `num_elem` 4-byte elements in the packed buffer. */
+  static int64_t AlignAuxBytes(int64_t num_elem) {
+    return (num_elem * 4 + kAuxAlignment - 1) / kAuxAlignment * kAuxAlignment;
+  }
+
+  /*! \brief Grow the packed auxiliary buffers to at least the given bytes, keeping the data. */
+  void ReserveAuxCapacity(int64_t num_bytes) {
+    if (num_bytes <= aux_capacity_bytes_) {
       return;
     }
+    int64_t new_capacity = std::max(num_bytes, aux_capacity_bytes_ * 2);
+    auto f_alloc = [new_capacity](Device device) {
+      memory::Allocator* allocator =
+          memory::MemoryManager::GetOrCreateAllocator(device, memory::AllocatorType::kNaive);
+      ICHECK_NOTNULL(allocator);
+      return memory::Storage(allocator->Alloc(device, {new_capacity / 4}, DataType::Int(32)),
+                             allocator);
+    };
+    memory::Storage new_host_storage = f_alloc(preferred_host_device_);
+    if (aux_num_bytes_ > 0) {
+      std::memcpy(new_host_storage->buffer.data, aux_host_storage_->buffer.data, aux_num_bytes_);
+    }
+    aux_host_storage_ = std::move(new_host_storage);
+    aux_device_storage_ = f_alloc(device_);
+    aux_capacity_bytes_ = new_capacity;
+  }
 
-    // - View arrays.
-    int num_seq = num_token_for_mask;
-    NDArray seq_ids_host = seq_ids_host_.CreateView({num_seq}, dtype_i32_);
-    NDArray seq_ids_device = seq_ids_device_.CreateView({num_seq}, dtype_i32_);
-    NDArray bitmask_host = bitmask_host_.CreateView({batch_size, bitmask_size_}, dtype_i32_);
-    NDArray bitmask_device = bitmask_device_.CreateView({batch_size, bitmask_size_}, dtype_i32_);
+  /*! \brief Return the host pointer at the byte offset of the packed auxiliary buffer. */
+  template <typename T>
+  T* AuxHost(int64_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(aux_host_storage_->buffer.data) + offset);
+  }
 
-    // - Copy arrays to GPU.
-    CopyArray(/*src=*/seq_ids_host, /*dst=*/seq_ids_device, copy_stream_);
-    CopyArray(/*src=*/bitmask_host, /*dst=*/bitmask_device, copy_stream_);
-    SyncCopyStream(device_, compute_stream_, copy_stream_);
+  /*! \brief Return the 1-D device array at the byte offset of the packed auxiliary buffer. */
+  NDArray AuxDevice(int64_t offset, int64_t num_elem, DLDataType dtype = DataType::Int(32)) {
+    return aux_device_storage_->AllocNDArray(offset, {num_elem}, dtype);
+  }
 
-    // - Call kernel.
-    apply_bitmask_func_(logits, seq_ids_device, bitmask_device);
+  /*! \brief Synchronize the device when tracing, so that the events reflect the kernel time. */
+  void SyncForTrace() {
     if (trace_recorder_.defined()) {
       TVMSynchronize(device_.device_type, device_.device_id, /*stream=*/nullptr);
     }
@@ -467,24 +904,39 @@ class LogitProcessorImpl : public LogitProcessorObj {
   PackedFunc apply_logit_bias_func_;
   PackedFunc apply_penalty_func_;
   PackedFunc apply_bitmask_func_;
+  PackedFunc update_token_counts_func_;
+  PackedFunc apply_penalty_with_counts_func_;
+  // The optional kernels reading the bias entries in CSR format and the compact bitmask.
+  PackedFunc apply_logit_bias_csr_func_;
+  PackedFunc apply_compact_bitmask_func_;
+  // The preferred host device for the auxiliary arrays.
+  Device preferred_host_device_;
   // Auxiliary NDArrays on CPU
-  NDArray seq_ids_host_;
-  NDArray pos2seq_id_host_;
-  NDArray token_ids_host_;
-  NDArray token_cnt_host_;
-  NDArray token_logit_bias_host_;
-  NDArray penalties_host_;
-  NDArray bitmask_host_;
   NDArray temperature_host_;
   // Auxiliary NDArrays on GPU
-  NDArray seq_ids_device_;
-  NDArray pos2seq_id_device_;
-  NDArray token_ids_device_;
-  NDArray token_cnt_device_;
-  NDArray token_logit_bias_device_;
-  NDArray penalties_device_;
-  NDArray bitmask_device_;
   NDArray temperature_device_;
+  // The packed auxiliary buffers on CPU and GPU with the same layout, holding the
+  // arguments of the logit bias, penalty and bitmask kernels of one update.
+  static constexpr int64_t kAuxAlignment = 256;
+  static constexpr int64_t kInitialAuxCapacityBytes = 1 << 20;
+  memory::Storage aux_host_storage_{nullptr};
+  memory::Storage aux_device_storage_{nullptr};
+  int64_t aux_capacity_bytes_ = 0;
+  int64_t aux_num_bytes_ = 0;
+  // The device token count table of shape (num_slots, vocab_size), where each penalized
+  // sequence owns a slot. The table grows on demand up to max_num_token slots, which are
+  // counted in the logit processor workspace of the engine memory estimation.
+  memory::Storage token_counts_storage_{nullptr};
+  // The ownership stamp of each slot, or -1 if the slot is free.
+  std::vector<int64_t> slot_stamps_;
+  // The index of the last update using each slot.
+  std::vector<int64_t> slot_last_used_;
+  // The tokens with nonzero counts in each slot.
+  std::vector<std::unordered_set<int32_t>> slot_nonzero_tokens_;
+  // The next slot ownership stamp to assign.
+  int64_t next_slot_stamp_ = 0;
+  // The number of updates with the token count table.
+  int64_t num_token_count_updates_ = 0;
   // Event trace recorder.
   Optional<EventTraceRecorder> trace_recorder_;
   // The device stream for the default computation operations.
@@ -22,6 +22,35 @@ picojson::object TimeCost::AsJSON() const {
   return config;
 }
 
+picojson::object LatencyHistogram::AsJSON() const {
+  picojson::object result;
+  int64_t total = Count();
+  result["count"] = picojson::value(total);
+  result["sum"] = picojson::value(Sum());
+  if (total == 0) {
+    return result;
+  }
+  result["mean"] = picojson::value(Sum() / total);
+  result["p50"] = picojson::value(Quantile(0.5));
+  result["p90"] = picojson::value(Quantile(0.9));
+  result["p99"] = picojson::value(Quantile(0.99));
+  // NOTE: the buckets are in the format of prometheus "le" buckets,
+  // i.e., cumulative counts keyed by (inclusive) upper bounds in seconds.
+  picojson::array buckets;
+  int64_t cumulative = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    int64_t count = counts_[i].load(std::memory_order_relaxed);
+    if (count == 0) continue;
+    cumulative += count;
+    picojson::array bucket;
+    bucket.push_back(picojson::value(BucketUpperBound(i) / 1e6));
+    bucket.push_back(picojson::value(cumulative));
+    buckets.push_back(picojson::value(bucket));
+  }
+  result["buckets"] = picojson::value(buckets);
+  return result;
+}
+
 picojson::object SpecDecodeMetrics::AsJSON() const {
   picojson::object metrics;
   auto f_vector_to_array = [](const std::vector<int64_t>& vec) {
@@ -68,10 +97,78 @@ picojson::object SpecDecodeMetrics::AsJSON() const {
   metrics["accept_prob"] = picojson::value(accept_prob_metrics);
   metrics["accept_rate"] = picojson::value(accept_rate_metrics);
   metrics["accept_len"] = picojson::value(accept_len_metrics);
+  if (num_trees > 0) {
+    metrics["num_trees"] = picojson::value(num_trees);
+    metrics["tree_draft_tokens"] = picojson::value(tree_draft_tokens);
+    metrics["tree_accept_tokens"] = picojson::value(tree_accept_tokens);
+    metrics["tree_avg_draft_tokens"] =
+        picojson::value(static_cast<double>(tree_draft_tokens) / num_trees);
+    metrics["tree_avg_accept_len"] =
+        picojson::value(static_cast<double>(tree_accept_tokens) / num_trees);
+  }
 
   return metrics;
 }
 
+picojson::object PrefixCacheMetrics::AsJSON() const {
+  picojson::object metrics;
+  metrics["num_lookups"] = picojson::value(num_lookups);
+  metrics["num_hits"] = picojson::value(num_hits);
+  metrics["lookup_tokens"] = picojson::value(lookup_tokens);
+  metrics["hit_tokens"] = picojson::value(hit_tokens);
+  metrics["num_evictions"] = picojson::value(num_evictions);
+  metrics["evicted_tokens"] = picojson::value(evicted_tokens);
+  metrics["num_compactions"] = picojson::value(num_compactions);
+  metrics["compacted_tokens"] = picojson::value(compacted_tokens);
+  if (num_lookups > 0) {
+    metrics["hit_rate"] = picojson::value(static_cast<double>(num_hits) / num_lookups);
+  }
+  if (lookup_tokens > 0) {
+    metrics["token_hit_rate"] = picojson::value(static_cast<double>(hit_tokens) / lookup_tokens);
+  }
+  return metrics;
+}
+
+picojson::object TenantMetrics::AsJSON() const {
+  picojson::object metrics;
+  metrics["served_tokens"] = picojson::value(served_tokens);
+  metrics["prompt_tokens_sum"] = picojson::value(prompt_tokens_sum);
+  metrics["completion_tokens_sum"] = picojson::value(completion_tokens_sum);
+  metrics["num_finished_requests"] = picojson::value(num_finished_requests);
+  if (queue_wait_time_count > 0) {
+    metrics["queue_wait_time_mean"] = picojson::value(queue_wait_time_sum / queue_wait_time_count);
+  }
+  return metrics;
+}
+
+const char* DeviceTimeMetrics::KindName(int kind) {
+  static const char* kind_names[kNumKinds] = {
+      "embed", "prefill", "decode", "logit_processing", "sampling", "communication"};
+  return kind_names[kind];
+}
+
+picojson::object DeviceTimeMetrics::AsJSON() const {
+  picojson::object metrics;
+  metrics["num_steps"] = picojson::value(num_steps);
+  metrics["step_time_sum"] = picojson::value(step_time_sum);
+  metrics["host_time_sum"] = picojson::value(host_time_sum);
+  double total_device_time = 0.0;
+  for (int i = 0; i < kNumKinds; ++i) {
+    if (device_time_count[i] == 0) continue;
+    if (i != static_cast<int>(DeviceTimeKind::kCommunication)) {
+      total_device_time += device_time_sum[i];
+    }
+    std::ostringstream label_sum;
+    label_sum << "device_time_sum{kind=" << KindName(i) << "}";
+    metrics[label_sum.str()] = picojson::value(device_time_sum[i]);
+    std::ostringstream label_count;
+    label_count << "device_time_count{kind=" << KindName(i) << "}";
+    metrics[label_count.str()] = picojson::value(device_time_count[i]);
+  }
+  metrics["device_time_sum"] = picojson::value(total_device_time);
+  return metrics;
+}
+
 picojson::object RequestMetrics::AsJSON() const {
   picojson::object metrics;
   metrics["prompt_tokens"] = picojson::value(prompt_tokens);
@@ -89,6 +186,9 @@ picojson::object RequestMetrics::AsJSON() const {
   metrics["end_to_end_latency_s"] = picojson::value(this->GetTotalTime());
   metrics["ttft_s"] = picojson::value(this->GetTTFT());
   metrics["inter_token_latency_s"] = picojson::value(this->GetInterTokenLatency());
+  if (this->HasPrefillStarted()) {
+    metrics["queue_wait_s"] = picojson::value(this->GetQueueWaitTime());
+  }
   return metrics;
 }
 
@@ -113,6 +213,7 @@ picojson::object EngineMetrics::AsJSON() const {
   metrics["prefill_tokens_sum"] = picojson::value(prefill_tokens_sum);
   metrics["decode_tokens_sum"] = picojson::value(decode_tokens_sum);
   metrics["jump_forward_tokens_sum"] = picojson::value(jump_forward_tokens_sum);
+  metrics["num_finished_requests"] = picojson::value(num_finished_requests);
 
   if (prefill_tokens_sum != 0) {
     metrics["prefill_tokens_per_s"] = picojson::value(prefill_tokens_sum / engine_prefill_time_sum);
@@ -121,10 +222,34 @@ picojson::object EngineMetrics::AsJSON() const {
     metrics["decode_tokens_per_s"] = picojson::value(decode_tokens_sum / engine_decode_time_sum);
   }
 
+  if (kv_cache_utilization_count != 0) {
+    metrics["kv_cache_utilization"] = picojson::value(kv_cache_utilization_last);
+    metrics["kv_cache_utilization_mean"] =
+        picojson::value(kv_cache_utilization_sum / kv_cache_utilization_count);
+    metrics["kv_cache_utilization_max"] = picojson::value(kv_cache_utilization_max);
+  }
+
   metrics["last_finished_request"] = picojson::value(last_finished_request.AsJSON());
   if (!spec_decode.IsEmpty()) {
     metrics["spec_decode"] = picojson::value(spec_decode.AsJSON());
   }
+  if (!prefix_cache.IsEmpty()) {
+    metrics["prefix_cache"] = picojson::value(prefix_cache.AsJSON());
+  }
+  if (!device_time.IsEmpty()) {
+    metrics["device_time"] = picojson::value(device_time.AsJSON());
+  }
+  // The per-tenant metrics are only reported when some request carries a tenant id.
+  if (tenants.size() > 1 || (tenants.size() == 1 && tenants.count("") == 0)) {
+    picojson::object tenant_metrics;
+    for (const auto& [tenant_id, tenant] : tenants) {
+      tenant_metrics[tenant_id.empty() ? "default" : tenant_id] = picojson::value(tenant.AsJSON());
+    }
+    metrics["tenants"] = picojson::value(tenant_metrics);
+  }
+  if (other_tenants.served_tokens > 0 || other_tenants.num_finished_requests > 0) {
+    metrics["other_tenants"] = picojson::value(other_tenants.AsJSON());
+  }
 
   auto f_create_time_list = [](const std::vector<TimeCost>& time_list) {
     picojson::object result;
@@ -146,6 +271,39 @@ picojson::object EngineMetrics::AsJSON() const {
   metrics["draft_time_by_batch_size"] = f_create_time_list(draft_time_by_batch_size);
   metrics["verify_time_by_batch_size"] = f_create_time_list(verify_time_by_batch_size);
 
+  picojson::object phase_time;
+  for (const auto& [phase, item] : step_phase_time) {
+    if (item.count == 0) continue;
+    phase_time["mean{phase=" + phase + "}"] = picojson::value(item.sum / item.count);
+    phase_time["count{phase=" + phase + "}"] = picojson::value(item.count);
+  }
+  metrics["step_phase_time"] = picojson::value(phase_time);
+  metrics["num_slow_steps"] = picojson::value(num_slow_steps);
+
+  // NOTE: the histograms are kept in a separate scope with prometheus style labels,
+  // so that they can be exported as prometheus histograms.
+  picojson::object histograms;
+  histograms["ttft_s"] = picojson::value(ttft_histogram.AsJSON());
+  histograms["inter_token_latency_s"] = picojson::value(inter_token_latency_histogram.AsJSON());
+  histograms["queue_wait_s"] = picojson::value(queue_wait_histogram.AsJSON());
+  auto f_add_step_histograms = [&histograms](const std::string& name, const auto& list) {
+    for (int i = 0; i < kNumBatchSizeBuckets; ++i) {
+      if (list[i].Count() == 0) continue;
+      std::ostringstream label;
+      label << name << "{batch_size=" << (1 << i);
+      if (i + 1 == kNumBatchSizeBuckets) {
+        label << "+";
+      } else if (i != 0) {
+        label << "-" << ((1 << (i + 1)) - 1);
+      }
+      label << "}";
+      histograms[label.str()] = picojson::value(list[i].AsJSON());
+    }
+  };
+  f_add_step_histograms("prefill_step_time_s", prefill_step_histograms);
+  f_add_step_histograms("decode_step_time_s", decode_step_histograms);
+  metrics["latency_histograms"] = picojson::value(histograms);
+
   return metrics;
 }
 
@@ -170,14 +328,34 @@ void EngineMetrics::Reset() {
   prefill_tokens_sum = 0;
   decode_tokens_sum = 0;
   jump_forward_tokens_sum = 0;
+  num_finished_requests = 0;
   last_finished_request.Reset();
   spec_decode.Reset();
+  prefix_cache.Reset();
+  device_time.Reset();
+  tenants.clear();
+  other_tenants = TenantMetrics();
+  kv_cache_utilization_sum = 0.0;
+  kv_cache_utilization_max = 0.0;
+  kv_cache_utilization_last = 0.0;
+  kv_cache_utilization_count = 0;
+  for (auto& [phase, item] : step_phase_time) {
+    item.Reset();
+  }
+  num_slow_steps = 0;
   decode_time_by_batch_size.clear();
   draft_time_by_batch_size.clear();
   verify_time_by_batch_size.clear();
   decode_time_by_batch_size.resize(kEndFineGrainedTrackingBatchSize);
   draft_time_by_batch_size.resize(kEndFineGrainedTrackingBatchSize);
   verify_time_by_batch_size.resize(kEndFineGrainedTrackingBatchSize);
+  ttft_histogram.Reset();
+  inter_token_latency_histogram.Reset();
+  queue_wait_histogram.Reset();
+  for (int i = 0; i < kNumBatchSizeBuckets; ++i) {
+    prefill_step_histograms[i].Reset();
+    decode_step_histograms[i].Reset();
+  }
 }
 
 }  // namespace serve
@@ -9,8 +9,13 @@
 #include <picojson.h>
 #include <tvm/runtime/logging.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <string>
+#include <unordered_map>
 
 namespace mlc {
 namespace llm {
@@ -55,12 +60,151 @@ struct TimeCost {
   picojson::object AsJSON() const;
 };
 
+/*!
+ * \brief Log-linear (HDR-style) histogram of latency values, used for percentile metrics.
+ * - Values are recorded in microseconds. Values below `kNumSubBuckets` us get exact buckets,
+ *   and every power-of-two range above is split into `kNumSubBuckets` linear sub-buckets,
+ *   so the relative error of the reported quantiles is bounded by 1 / kNumSubBuckets.
+ * - The counters are relaxed atomics, so recording is lock-free and the histogram can be
+ *   read or merged into another histogram while it is being updated.
+ */
+class LatencyHistogram {
+ public:
+  /*! \brief The number of bits of the linear sub-buckets in each power-of-two range. */
+  static constexpr const int kSubBucketBits = 4;
+  /*! \brief The number of linear sub-buckets in each power-of-two range. */
+  static constexpr const int64_t kNumSubBuckets = 1 << kSubBucketBits;
+  /*! \brief Values greater than or equal to 2^kMaxExponent us (about 19 hours) are clamped. */
+  static constexpr const int kMaxExponent = 36;
+  /*! \brief The total number of buckets. */
+  static constexpr const int kNumBuckets = (kMaxExponent - kSubBucketBits + 1) * kNumSubBuckets;
+
+  LatencyHistogram() { Reset(); }
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  /*! \brief Record the given latency in seconds, clamped to [0, 2^kMaxExponent) us. */
+  void Update(double seconds) {
+    // The clamp happens before the conversion, as converting an out-of-range (e.g. infinite)
+    // double to int64_t is undefined behavior, and the clamped values keep the sum bounded.
+    constexpr double kMaxMicros =
+        static_cast<double>((static_cast<int64_t>(1) << kMaxExponent) - 1);
+    int64_t micros = seconds > 0 ? static_cast<int64_t>(std::min(seconds * 1e6, kMaxMicros)) : 0;
+    counts_[BucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_micros_.fetch_add(micros, std::memory_order_relaxed);
+  }
+
+  /*! \brief Add all the recorded values of the other histogram into this histogram. */
+  void Merge(const LatencyHistogram& other) {
+    for (int i = 0; i < kNumBuckets; ++i) {
+      int64_t count = other.counts_[i].load(std::memory_order_relaxed);
+      if (count != 0) {
+        counts_[i].fetch_add(count, std::memory_order_relaxed);
+      }
+    }
+    count_.fetch_add(other.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sum_micros_.fetch_add(other.sum_micros_.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  }
+
+  /*! \brief Reset the histogram. */
+  void Reset() {
+    for (std::atomic<int64_t>& count : counts_) {
+      count.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_micros_.store(0, std::memory_order_relaxed);
+  }
+
+  /*! \return The number of recorded values. */
+  int64_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+  /*! \return The sum of the recorded values in seconds. */
+  double Sum() const { return sum_micros_.load(std::memory_order_relaxed) / 1e6; }
+
+  /*!
+   * \brief Get the value at the given quantile, taken as the midpoint of the bucket holding it.
+   * \param quantile The quantile in [0, 1].
+   * \return The value in seconds, or 0 when the histogram is empty.
+   */
+  double Quantile(double quantile) const {
+    int64_t total = Count();
+    if (total == 0) {
+      return 0.0;
+    }
+    // The rank of the value at the quantile, in [1, total].
+    int64_t rank = std::max(static_cast<int64_t>(std::ceil(quantile * total)), int64_t(1));
+    int64_t cumulative = 0;
+    int last_nonempty = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      int64_t count = counts_[i].load(std::memory_order_relaxed);
+      if (count == 0) continue;
+      cumulative += count;
+      last_nonempty = i;
+      if (cumulative >= rank) break;
+    }
+    // NOTE: under concurrent updates the bucket counts may not sum up to the total count
+    // we read, in which case we fall back to the last non-empty bucket.
+    return (BucketLowerBound(last_nonempty) + BucketUpperBound(last_nonempty)) / 2.0 / 1e6;
+  }
+
+  /*! \return The bucket index of the given value in microseconds. */
+  static int BucketIndex(int64_t micros) {
+    if (micros < kNumSubBuckets) {
+      return static_cast<int>(micros);
+    }
+    micros = std::min(micros, (static_cast<int64_t>(1) << kMaxExponent) - 1);
+    int exponent = 63;
+    while (!(micros >> exponent)) {
+      --exponent;
+    }
+    int shift = exponent - kSubBucketBits;
+    return static_cast<int>((shift << kSubBucketBits) + (micros >> shift));
+  }
+
+  /*! \return The inclusive lower bound in microseconds of the values in the given bucket. */
+  static int64_t BucketLowerBound(int index) {
+    if (index < kNumSubBuckets) {
+      return index;
+    }
+    int shift = (index >> kSubBucketBits) - 1;
+    return (kNumSubBuckets + (index & (kNumSubBuckets - 1))) << shift;
+  }
+
+  /*! \return The exclusive upper bound in microseconds of the values in the given bucket. */
+  static int64_t BucketUpperBound(int index) {
+    return index + 1 < kNumBuckets ? BucketLowerBound(index + 1)
+                                   : static_cast<int64_t>(1) << kMaxExponent;
+  }
+
+  /*!
+   * \brief Dump the histogram as JSON, including the count, sum, p50/p90/p99 and the cumulative
+   * counts of the non-empty buckets keyed by their upper bounds in seconds.
+   */
+  picojson::object AsJSON() const;
+
+ private:
+  /*! \brief The number of values in each bucket. */
+  std::array<std::atomic<int64_t>, kNumBuckets> counts_;
+  /*! \brief The total number of recorded values. */
+  std::atomic<int64_t> count_;
+  /*! \brief The sum of the recorded values in microseconds. */
+  std::atomic<int64_t> sum_micros_;
+};
+
 /*! \brief Runtime metrics for speculative decoding */
 struct SpecDecodeMetrics {
   /*! \brief The number of draft tokens in speculative decoding, per step */
   std::vector<int64_t> draft_count;
   /*! \brief The number of accepted tokens in speculative decoding, per step */
   std::vector<int64_t> accept_count;
+  /*! \brief The number of token trees verified in the token tree mode. */
+  int64_t num_trees = 0;
+  /*! \brief The total number of draft tokens of the token trees verified. */
+  int64_t tree_draft_tokens = 0;
+  /*! \brief The total number of accepted tokens of the token trees verified. */
+  int64_t tree_accept_tokens = 0;
 
   /*!
    * \brief Update the metrics of speculative decoding.
@@ -82,11 +226,167 @@ struct SpecDecodeMetrics {
     }
   }
 
+  /*!
+   * \brief Update the metrics of a token tree in speculative decoding.
+   * The per-step counts are updated by the depth of the tree.
+   * \param tree_depth The depth of the draft token tree.
+   * \param num_tree_tokens The number of draft tokens in the tree.
+   * \param accept_length The number of accepted tokens in the speculative decoding.
+   */
+  void UpdateTree(int tree_depth, int num_tree_tokens, int accept_length) {
+    Update(tree_depth + 1, accept_length);
+    ++this->num_trees;
+    this->tree_draft_tokens += num_tree_tokens;
+    this->tree_accept_tokens += accept_length;
+  }
+
   bool IsEmpty() const { return draft_count.size() == 0; }
 
   void Reset() {
     accept_count.clear();
     draft_count.clear();
+    num_trees = 0;
+    tree_draft_tokens = 0;
+    tree_accept_tokens = 0;
+  }
+  picojson::object AsJSON() const;
+};
+
+/*! \brief Runtime metrics of prefix cache. */
+struct PrefixCacheMetrics {
+  /*! \brief The number of sequences looked up in prefix cache. */
+  int64_t num_lookups = 0;
+  /*! \brief The number of looked up sequences reusing a matched prefix. */
+  int64_t num_hits = 0;
+  /*! \brief The total number of tokens of the looked up sequences. */
+  int64_t lookup_tokens = 0;
+  /*! \brief The total number of reused prefix tokens, whose prefill is saved. */
+  int64_t hit_tokens = 0;
+  /*! \brief The number of recycling sequences evicted from prefix cache. */
+  int64_t num_evictions = 0;
+  /*! \brief The total number of tokens freed by the evictions. */
+  int64_t evicted_tokens = 0;
+  /*! \brief The number of recycling sequences whose KV data are compacted. */
+  int64_t num_compactions = 0;
+  /*! \brief The total number of tokens of the compacted sequences. */
+  int64_t compacted_tokens = 0;
+
+  /*! \brief Update the metrics with the result of a lookup. */
+  void UpdateLookup(int64_t num_tokens, int64_t num_matched_tokens) {
+    ++num_lookups;
+    lookup_tokens += num_tokens;
+    if (num_matched_tokens > 0) {
+      ++num_hits;
+      hit_tokens += num_matched_tokens;
+    }
+  }
+
+  /*! \brief Update the metrics with an eviction freeing the given number of tokens. */
+  void UpdateEviction(int64_t num_freed_tokens) {
+    ++num_evictions;
+    evicted_tokens += num_freed_tokens;
+  }
+
+  /*! \brief Update the metrics with a compaction of the given number of tokens. */
+  void UpdateCompaction(int64_t num_tokens) {
+    ++num_compactions;
+    compacted_tokens += num_tokens;
+  }
+
+  bool IsEmpty() const { return num_lookups == 0 && num_evictions == 0 && num_compactions == 0; }
+
+  void Reset() {
+    num_lookups = 0;
+    num_hits = 0;
+    lookup_tokens = 0;
+    hit_tokens = 0;
+    num_evictions = 0;
+    evicted_tokens = 0;
+    num_compactions = 0;
+    compacted_tokens = 0;
+  }
+  picojson::object AsJSON() const;
+};
+
+/*! \brief The metrics of the requests of a tenant, keyed by the tenant id in engine metrics. */
+struct TenantMetrics {
+  /*! \brief The total number of tokens processed for the tenant, in both prefill and decode. */
+  int64_t served_tokens = 0;
+  /*! \brief The total number of input tokens of the finished requests. */
+  int64_t prompt_tokens_sum = 0;
+  /*! \brief The total number of output tokens of the finished requests. */
+  int64_t completion_tokens_sum = 0;
+  /*! \brief The number of finished requests. */
+  int64_t num_finished_requests = 0;
+  /*! \brief The total time the finished requests waited in queue before their first prefill. */
+  double queue_wait_time_sum = 0.0;
+  /*! \brief The number of finished requests contributing to `queue_wait_time_sum`. */
+  int64_t queue_wait_time_count = 0;
+
+  picojson::object AsJSON() const;
+};
+
+/*! \brief The kinds of device work timed by the optional device timers. */
+enum class DeviceTimeKind : int {
+  /*! \brief The token/image embedding. */
+  kEmbed = 0,
+  /*! \brief The model forward of prefill. */
+  kPrefill = 1,
+  /*! \brief The model forward of decode, tree decode and verification. */
+  kDecode = 2,
+  /*! \brief The logit processing and the probability computation. */
+  kLogitProcessing = 3,
+  /*! \brief The GPU sampling. */
+  kSampling = 4,
+  /*!
+   * \brief The tensor-parallel all-reduce in the model forwards, timed on worker 0. It is a
+   * part of the prefill and decode time, and is not counted in the total device time.
+   */
+  kCommunication = 5,
+};
+
+/*!
+ * \brief The metrics of the device time in engine steps, measured by device timer events.
+ * The host time of a step is its wall time excluding the timed device work.
+ */
+struct DeviceTimeMetrics {
+  /*! \brief The number of device time kinds. */
+  static constexpr const int kNumKinds = 6;
+  /*! \brief The total device time of each kind, in seconds. */
+  std::array<double, kNumKinds> device_time_sum = {};
+  /*! \brief The number of timed device work of each kind. */
+  std::array<int64_t, kNumKinds> device_time_count = {};
+  /*! \brief The total wall time of the timed engine steps, in seconds. */
+  double step_time_sum = 0.0;
+  /*! \brief The total host time of the timed engine steps, in seconds. */
+  double host_time_sum = 0.0;
+  /*! \brief The number of timed engine steps. */
+  int64_t num_steps = 0;
+
+  /*! \brief Update the device time of the given kind. */
+  void UpdateDeviceTime(DeviceTimeKind kind, double time) {
+    device_time_sum[static_cast<int>(kind)] += time;
+    device_time_count[static_cast<int>(kind)] += 1;
+  }
+
+  /*! \brief Update the step time, given the total timed device time in the step. */
+  void UpdateStep(double step_time, double device_time) {
+    step_time_sum += step_time;
+    host_time_sum += std::max(step_time - device_time, 0.0);
+    num_steps += 1;
+  }
+
+  bool IsEmpty() const { return num_steps == 0; }
+
+  /*! \return The name of the given device time kind. */
+  static const char* KindName(int kind);
+
+  void Reset() {
+    device_time_sum.fill(0.0);
+    device_time_count.fill(0);
+    step_time_sum = 0.0;
+    host_time_sum = 0.0;
+    num_steps = 0;
   }
   picojson::object AsJSON() const;
 };
@@ -111,6 +411,8 @@ struct RequestMetrics {
 
   /*! \brief The time of adding the request to engine. */
   std::chrono::high_resolution_clock::time_point add_time_point;
+  /*! \brief The time when the request is first scheduled for prefill. */
+  std::chrono::high_resolution_clock::time_point prefill_start_time_point;
   /*! \brief The time of finishing prefill stage. */
   std::chrono::high_resolution_clock::time_point prefill_end_time_point;
   /*! \brief The time of finishing all decode. */
@@ -134,6 +436,21 @@ struct RequestMetrics {
     return static_cast<double>((prefill_end_time_point - add_time_point).count()) / 1e9;
   }
 
+  /*! \brief check whether the request has been scheduled for prefill */
+  bool HasPrefillStarted() const {
+    return prefill_start_time_point != std::chrono::high_resolution_clock::time_point();
+  }
+
+  /*! \return the time the request waits in queue before its first prefill, in seconds */
+  double GetQueueWaitTime() const {
+    return static_cast<double>((prefill_start_time_point - add_time_point).count()) / 1e9;
+  }
+
+  /*! \return the average decode time per output token after the first one, in seconds */
+  double GetTimePerOutputToken() const {
+    return completion_tokens > 1 ? GetDecodeTime() / (completion_tokens - 1) : 0.0;
+  }
+
   /*! \return the prefill time in seconds */
   double GetTotalTime() const {
     return static_cast<double>((finish_time_point - add_time_point).count()) / 1e9;
@@ -182,10 +499,42 @@ struct EngineMetrics {
   int64_t decode_tokens_sum = 0;
   /*! \brief The total number of tokens predicted by jump-forward decoding. */
   int64_t jump_forward_tokens_sum = 0;
+  /*! \brief The total number of finished requests. */
+  int64_t num_finished_requests = 0;
   /*! \brief metrics from last finished request. */
   RequestMetrics last_finished_request;
   /*! \brief speculative decoding metrics */
   SpecDecodeMetrics spec_decode;
+  /*! \brief prefix cache metrics */
+  PrefixCacheMetrics prefix_cache;
+  /*! \brief device time metrics, when the device timing is enabled */
+  DeviceTimeMetrics device_time;
+  /*!
+   * \brief The metrics of each tenant, keyed by the tenant id of requests.
+   * Requests without tenant id are accounted to the default tenant with empty id.
+   * The tenant ids come from the clients, so at most `kMaxNumTenants` tenants are kept, and
+   * the requests of the other tenants are accounted to `other_tenants`.
+   */
+  std::unordered_map<std::string, TenantMetrics> tenants;
+  /*! \brief The metrics of the tenants beyond the first `kMaxNumTenants` ones. */
+  TenantMetrics other_tenants;
+  /*! \brief The max number of tenants with their own metrics. */
+  static constexpr const int kMaxNumTenants = 1024;
+  /*! \brief The sum of the KV cache utilization (ratio of used pages) sampled at engine steps. */
+  double kv_cache_utilization_sum = 0.0;
+  /*! \brief The maximum KV cache utilization sampled at engine steps. */
+  double kv_cache_utilization_max = 0.0;
+  /*! \brief The KV cache utilization sampled at the last engine step. */
+  double kv_cache_utilization_last = 0.0;
+  /*! \brief The number of KV cache utilization samples. */
+  int64_t kv_cache_utilization_count = 0;
+  /*!
+   * \brief The host time of the phases of engine steps, keyed by the phase name.
+   * A phase is either an engine action which processes requests, or the step post-process.
+   */
+  std::unordered_map<std::string, TimeCost> step_phase_time;
+  /*! \brief The number of engine steps exceeding the step watchdog threshold. */
+  int64_t num_slow_steps = 0;
 
   /*! \brief The maximum batch size we track for batch decode time. */
   static constexpr const int64_t kEndFineGrainedTrackingBatchSize = 65;
@@ -199,6 +548,31 @@ struct EngineMetrics {
   std::vector<TimeCost> verify_time_by_batch_size =
       std::vector<TimeCost>(kEndFineGrainedTrackingBatchSize);
 
+  /*! \brief The histogram of time to first token of finished requests. */
+  LatencyHistogram ttft_histogram;
+  /*! \brief The histogram of per-request time per output token (excluding the first token). */
+  LatencyHistogram inter_token_latency_histogram;
+  /*! \brief The histogram of time requests wait in queue before their first prefill. */
+  LatencyHistogram queue_wait_histogram;
+  /*!
+   * \brief The number of batch size buckets of the step time histograms.
+   * Bucket `i` covers batch sizes in [2^i, 2^(i+1)), and the last bucket covers all larger ones.
+   */
+  static constexpr const int kNumBatchSizeBuckets = 9;
+  /*! \brief The histograms of prefill step time under different batch size buckets. */
+  std::array<LatencyHistogram, kNumBatchSizeBuckets> prefill_step_histograms;
+  /*! \brief The histograms of decode step time under different batch size buckets. */
+  std::array<LatencyHistogram, kNumBatchSizeBuckets> decode_step_histograms;
+
+  /*! \return The batch size bucket of the step time histograms for the given batch size. */
+  static int BatchSizeBucket(int batch_size) {
+    int bucket = 0;
+    while (bucket + 1 < kNumBatchSizeBuckets && (batch_size >> (bucket + 1)) != 0) {
+      ++bucket;
+    }
+    return bucket;
+  }
+
   // NOTE: we keep most update function in header
   // so they can be inlined effectively
   /*!
@@ -209,6 +583,18 @@ struct EngineMetrics {
     if (batch_size < kEndFineGrainedTrackingBatchSize) {
       decode_time_by_batch_size[batch_size].Update(time);
     }
+    decode_step_histograms[BatchSizeBucket(batch_size)].Update(time);
+  }
+  /*! \brief Update the KV cache utilization with the sample of an engine step. */
+  void UpdateKVCacheUtilization(double utilization) {
+    kv_cache_utilization_sum += utilization;
+    kv_cache_utilization_max = std::max(kv_cache_utilization_max, utilization);
+    kv_cache_utilization_last = utilization;
+    kv_cache_utilization_count += 1;
+  }
+  /*! \brief Update the batch prefill step time for the given number of prefilled entries. */
+  void UpdatePrefillTimeByBatchSize(int batch_size, double time) {
+    prefill_step_histograms[BatchSizeBucket(batch_size)].Update(time);
   }
   /*!
    * \brief Update the single-step batch draft time for the given batch size.
@@ -230,16 +616,56 @@ struct EngineMetrics {
     }
   }
 
+  /*! \brief Update the host time of the given engine step phase. */
+  void UpdateStepPhaseTime(const std::string& phase, double time) {
+    step_phase_time[phase].Update(time);
+  }
+
+  /*! \brief Get the metrics of the given tenant, or `other_tenants` when the tenants are full. */
+  TenantMetrics& GetTenantMetrics(const std::string& tenant_id) {
+    auto it = tenants.find(tenant_id);
+    if (it != tenants.end()) {
+      return it->second;
+    }
+    if (static_cast<int>(tenants.size()) >= kMaxNumTenants) {
+      return other_tenants;
+    }
+    return tenants[tenant_id];
+  }
+
+  /*! \brief Update the number of tokens processed for the given tenant. */
+  void UpdateTenantServedTokens(const std::string& tenant_id, int64_t num_tokens) {
+    GetTenantMetrics(tenant_id).served_tokens += num_tokens;
+  }
+
   /*!
    * \brief Update global engine metrics as we finish a request
    *  by including the information from the finished request.
+   * \param request_metrics The metrics of the finished request.
+   * \param tenant_id The tenant id of the finished request.
    */
-  void RequestFinishUpdate(const RequestMetrics& request_metrics) {
+  void RequestFinishUpdate(const RequestMetrics& request_metrics,
+                           const std::string& tenant_id = "") {
     prompt_tokens_sum += request_metrics.prompt_tokens;
     prefill_tokens_sum += request_metrics.prefill_tokens;
     completion_tokens_sum += request_metrics.completion_tokens;
     decode_tokens_sum += request_metrics.decode_tokens;
     jump_forward_tokens_sum += request_metrics.jump_forward_tokens;
+    num_finished_requests += 1;
+    ttft_histogram.Update(request_metrics.GetTTFT());
+    if (request_metrics.completion_tokens > 1) {
+      inter_token_latency_histogram.Update(request_metrics.GetTimePerOutputToken());
+    }
+    TenantMetrics& tenant = GetTenantMetrics(tenant_id);
+    tenant.prompt_tokens_sum += request_metrics.prompt_tokens;
+    tenant.completion_tokens_sum += request_metrics.completion_tokens;
+    tenant.num_finished_requests += 1;
+    if (request_metrics.HasPrefillStarted()) {
+      double queue_wait_time = request_metrics.GetQueueWaitTime();
+      queue_wait_histogram.Update(queue_wait_time);
+      tenant.queue_wait_time_sum += queue_wait_time;
+      tenant.queue_wait_time_count += 1;
+    }
     last_finished_request = request_metrics;
   }
   /*!
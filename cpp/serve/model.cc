@@ -5,15 +5,23 @@
  */
 #include "model.h"
 
+#include <tvm/runtime/device_api.h>
 #include <tvm/runtime/memory/memory_manager.h>
 #include <tvm/runtime/nvtx.h>
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <list>
+#include <numeric>
+#include <string>
+#include <unordered_map>
 
 #include "../support/json_parser.h"
 #include "config.h"
+#include "device_timer.h"
 #include "logit_processor.h"
 
 namespace mlc {
@@ -72,19 +80,41 @@ class ModelImpl : public ModelObj {
     this->Reset();
     // Step 4. Set model type
     this->kind = GetMetadata().kv_state_kind;
+    // Step 5. Create the stream to copy the input token ids to device asynchronously.
+    if (!ft_.use_disco && (device_.device_type == DLDeviceType::kDLCUDA ||
+                           device_.device_type == DLDeviceType::kDLROCM)) {
+      input_copy_stream_ = DeviceAPI::Get(device_)->CreateStream(device_);
+    }
+  }
+
+  ~ModelImpl() {
+    if (kv_swap_stream_ != nullptr) {
+      DeviceAPI::Get(device_)->FreeStream(device_, kv_swap_stream_);
+    }
+    if (input_copy_stream_ != nullptr) {
+      DeviceAPI::Get(device_)->FreeStream(device_, input_copy_stream_);
+    }
   }
 
   /*********************** Model Computation  ***********************/
 
   ObjectRef TokenEmbed(IntTuple token_ids, ObjectRef* dst, int offset) final {
     NVTXScopedRange nvtx_scope("TokenEmbed");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kEmbed, device_);
     int num_tokens = token_ids.size();
     // Copy input token ids to device.
     DLDataType dtype(DataType::Int(32));
+    if (offset == 0) {
+      // A new batch of token ids starts. Switch to the other staging buffer, which the copy and
+      // the embedding of the batch before last no longer use, as every step synchronizes the
+      // compute stream to fetch the sampling results.
+      token_ids_buffer_index_ ^= 1;
+    }
     NDArray token_ids_nd;
     {
       NVTXScopedRange nvtx_scope("Allocate token_ids at offset");
-      token_ids_nd = token_ids_storage_->AllocNDArray(offset * 4, {num_tokens}, dtype);
+      token_ids_nd = token_ids_storages_[token_ids_buffer_index_]->AllocNDArray(
+          offset * 4, {num_tokens}, dtype);
       int* p_token_ids = static_cast<int*>(token_ids_nd->data) + (token_ids_nd->byte_offset) / 4;
       for (int i = 0; i < num_tokens; ++i) {
         p_token_ids[i] = token_ids[i];
@@ -96,7 +126,22 @@ class ModelImpl : public ModelObj {
     ObjectRef token_ids_dref_or_nd;
     {
       NVTXScopedRange nvtx_scope("Copy to worker 0");
-      token_ids_dref_or_nd = ft_.CopyToWorker0(token_ids_nd, "token_ids", {prefill_chunk_size_});
+      if (input_copy_stream_ != nullptr) {
+        // Copy on the input copy stream to the same offset of the device buffer, so that the
+        // copy neither blocks the host nor overwrites the token ids of an earlier embedding.
+        NDArray token_ids_device =
+            token_ids_device_storages_[token_ids_buffer_index_]->AllocNDArray(
+                offset * 4, {num_tokens}, dtype);
+        NDArray::CopyFromTo(token_ids_nd.operator->(),
+                            const_cast<DLTensor*>(token_ids_device.operator->()),
+                            input_copy_stream_);
+        DeviceAPI::Get(device_)->SyncStreamFromTo(device_, input_copy_stream_,
+                                                  /*event_dst=*/nullptr);
+        token_ids_dref_or_nd = token_ids_device;
+      } else {
+        token_ids_dref_or_nd =
+            ft_.CopyToWorker0(token_ids_nd, "token_ids", {prefill_chunk_size_});
+      }
     }
 
     ObjectRef embeddings = ft_.embed_func_(token_ids_dref_or_nd, params_);
@@ -110,11 +155,30 @@ class ModelImpl : public ModelObj {
     }
   }
 
-  ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst, int offset) final {
+  ObjectRef TokenEmbedOnDevice(const NDArray& token_ids_on_device) final {
+    if (ft_.use_disco) {
+      return ObjectRef(nullptr);
+    }
+    NVTXScopedRange nvtx_scope("TokenEmbedOnDevice");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kEmbed, device_);
+    ICHECK_EQ(token_ids_on_device->ndim, 1);
+    ICHECK_EQ(token_ids_on_device->device.device_type, device_.device_type);
+    ICHECK_EQ(token_ids_on_device->device.device_id, device_.device_id);
+    return ft_.embed_func_(token_ids_on_device, params_);
+  }
+
+  ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst, int offset,
+                       const std::string& image_hash) final {
     NVTXScopedRange nvtx_scope("ImageEmbed");
-    CHECK(ft_.image_embed_func_.defined()) << "`image_embed` function is not found in the model. ";
-    auto image_dref_or_nd = ft_.CopyToWorker0(image, "image", image.Shape());
-    ObjectRef embeddings = ft_.image_embed_func_(image_dref_or_nd, params_);
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kEmbed, device_);
+    ObjectRef embeddings = LookupImageEmbedding(image_hash);
+    if (!embeddings.defined()) {
+      CHECK(ft_.image_embed_func_.defined())
+          << "`image_embed` function is not found in the model. ";
+      auto image_dref_or_nd = ft_.CopyToWorker0(image, "image", image.Shape());
+      embeddings = ft_.image_embed_func_(image_dref_or_nd, params_);
+      InsertImageEmbedding(image_hash, embeddings);
+    }
     if (dst != nullptr) {
       CHECK(dst->defined());
       ft_.nd_copy_embedding_to_offset_func_(embeddings, *dst, offset);
@@ -145,6 +209,9 @@ class ModelImpl : public ModelObj {
     }
     NDArray logits{nullptr};
     if (ft_.use_disco) {
+      // The lm_head is replicated on all the workers rather than sharded by vocabulary, so the
+      // full logits are already on worker 0, which lives in the controller process. No gather
+      // across the interconnect happens here.
       logits = Downcast<DRef>(ret)->DebugGetFromRemote(0);
     } else {
       logits = Downcast<NDArray>(ret);
@@ -168,9 +235,50 @@ class ModelImpl : public ModelObj {
     return logits;
   }
 
+  bool CanPoolHiddenStates() final {
+    return ft_.pool_hidden_states_func_.defined() && ft_.prefill_to_last_hidden_func_.defined() &&
+           ft_.single_batch_prefill_to_last_hidden_func_.defined() && CanGetLogits();
+  }
+
+  std::pair<ObjectRef, NDArray> PoolHiddenStates(const ObjectRef& hidden_states,
+                                                 const std::vector<int>& lengths,
+                                                 const std::vector<bool>& use_mean) final {
+    NVTXScopedRange nvtx_scope("PoolHiddenStates");
+    CHECK(ft_.pool_hidden_states_func_.defined())
+        << "`pool_hidden_states` function is not found in the model.";
+    int num_sequences = lengths.size();
+    ICHECK_EQ(use_mean.size(), lengths.size());
+    ICHECK_NE(max_num_sequence_, -1);
+    ICHECK_LE(num_sequences, max_num_sequence_);
+    int* p_pool_info = static_cast<int*>(pool_info_arr_->data);
+    int begin = 0;
+    for (int i = 0; i < num_sequences; ++i) {
+      p_pool_info[i * 3] = begin;
+      p_pool_info[i * 3 + 1] = begin + lengths[i];
+      p_pool_info[i * 3 + 2] = use_mean[i];
+      begin += lengths[i];
+    }
+    NDArray pool_info_nd = pool_info_arr_.CreateView({num_sequences, 3}, DataType::Int(32));
+    ObjectRef pool_info_dref_or_nd =
+        ft_.CopyToWorker0(pool_info_nd, "pool_info", {max_num_sequence_, 3});
+
+    ObjectRef ret = ft_.pool_hidden_states_func_(hidden_states, pool_info_dref_or_nd);
+    if (trace_enabled_) {
+      TVMSynchronize(device_.device_type, device_.device_id, nullptr);
+    }
+    ObjectRef pooled = ft_.tuple_getitem_func_(ret, 0);
+    ObjectRef pooled_f32 = ft_.tuple_getitem_func_(ret, 1);
+    if (ft_.use_disco) {
+      return {pooled, Downcast<DRef>(pooled_f32)->DebugGetFromRemote(0)};
+    } else {
+      return {pooled, Downcast<NDArray>(pooled_f32)};
+    }
+  }
+
   ObjectRef FuseEmbedHidden(const ObjectRef& embeddings, const ObjectRef& previous_hidden_states,
                             int batch_size, int seq_len) final {
     NVTXScopedRange nvtx_scope("FuseEmbedHidden");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kEmbed, device_);
 
     ObjectRef embeddings_dref_or_nd{nullptr};
     if (!embeddings->IsInstance<DRefObj>()) {
@@ -224,6 +332,7 @@ class ModelImpl : public ModelObj {
     }
     NVTXScopedRange nvtx_scope("BatchPrefill num_seq=" + std::to_string(num_sequences) +
                                " total_len=" + std::to_string(total_length));
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kPrefill, device_);
     NDArray logit_pos_nd = logit_pos_arr_.CreateView({num_sequences}, DataType::Int(32));
 
     CHECK(ft_.prefill_func_.defined())
@@ -233,6 +342,12 @@ class ModelImpl : public ModelObj {
     ICHECK(ft_.kv_cache_end_forward_func_.defined());
     ICHECK(kv_cache_.defined()) << "KV cache has not been initialized.";
 
+    if (total_length >= 2 * kMinPrefillMicroBatchLength && UsePipelineMicroBatches(embeddings)) {
+      return PipelinedBatchForward(embeddings,
+                                   SplitPrefillMicroBatches(seq_ids, lengths, total_length),
+                                   /*is_decode=*/false);
+    }
+
     // Begin forward with the sequence ids and new lengths.
     IntTuple seq_ids_tuple(seq_ids);
     IntTuple lengths_tuple(lengths.begin(), lengths.end());
@@ -259,7 +374,12 @@ class ModelImpl : public ModelObj {
         ft_.CopyToWorker0(logit_pos_nd, "logit_pos", {max_num_sequence_});
     // args: embeddings, logit_pos, kv_cache, params
     ObjectRef ret;
-    if (seq_ids.size() == 1) {
+    ObjectRef lora_params{nullptr};
+    ObjectRef lora_indices{nullptr};
+    if (PrepareBatchLoRA(num_sequences, &lora_params, &lora_indices)) {
+      ret = ft_.prefill_lora_func_(embeddings_dref_or_nd, logit_pos_dref_or_nd, kv_cache_, params_,
+                                   lora_params, lora_indices);
+    } else if (seq_ids.size() == 1) {
       ret = ft_.single_batch_prefill_func_(embeddings_dref_or_nd, kv_cache_, params_);
     } else {
       ret = ft_.prefill_func_(embeddings_dref_or_nd, logit_pos_dref_or_nd, kv_cache_, params_);
@@ -293,6 +413,7 @@ class ModelImpl : public ModelObj {
                                      const std::vector<int64_t>& seq_ids,
                                      const std::vector<int>& lengths) final {
     NVTXScopedRange nvtx_scope("BatchPrefillToLastHidden");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kPrefill, device_);
     CHECK(!seq_ids.empty());
     CHECK_EQ(seq_ids.size(), lengths.size());
     int num_sequences = seq_ids.size();
@@ -357,6 +478,7 @@ class ModelImpl : public ModelObj {
 
   NDArray BatchDecode(const ObjectRef& embeddings, const std::vector<int64_t>& seq_ids) final {
     NVTXScopedRange nvtx_scope("BatchDecode num_seqs=" + std::to_string(seq_ids.size()));
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kDecode, device_);
     int num_sequence = seq_ids.size();
 
     CHECK(ft_.decode_func_.defined())
@@ -366,11 +488,26 @@ class ModelImpl : public ModelObj {
     ICHECK(ft_.kv_cache_end_forward_func_.defined());
     ICHECK(kv_cache_.defined()) << "KV cache has not been initialized.";
 
+    if (num_sequence > 1 && UsePipelineMicroBatches(embeddings)) {
+      NDArray logits = PipelinedBatchForward(embeddings, SplitDecodeMicroBatches(seq_ids),
+                                             /*is_decode=*/true);
+      PopDecodePaddingTokens(seq_ids);
+      return logits;
+    }
+
     // Reserve in KV cache for the lengths of the input.
-    // Begin forward with the sequence ids and new lengths.
-    IntTuple seq_ids_tuple(seq_ids);
-    IntTuple lengths_tuple(std::vector<int64_t>(/*n=*/seq_ids.size(), /*v=*/1));
-    ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+    // Begin forward with the sequence ids and new lengths. The tuples of the single-sequence
+    // decode, which runs every step in local mode, are reused across steps.
+    if (num_sequence == 1) {
+      if (single_decode_seq_ids_.size() != 1 || single_decode_seq_ids_[0] != seq_ids[0]) {
+        single_decode_seq_ids_ = IntTuple{seq_ids[0]};
+      }
+      ft_.kv_cache_begin_forward_func_(kv_cache_, single_decode_seq_ids_, single_decode_lengths_);
+    } else {
+      IntTuple seq_ids_tuple(seq_ids);
+      IntTuple lengths_tuple(std::vector<int64_t>(/*n=*/seq_ids.size(), /*v=*/1));
+      ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+    }
 
     ObjectRef embeddings_dref_or_nd;
     if (!embeddings->IsInstance<DRefObj>()) {
@@ -391,7 +528,12 @@ class ModelImpl : public ModelObj {
 
     // args: embeddings, kv_cache, params
     ObjectRef ret;
-    if (seq_ids.size() == 1) {
+    ObjectRef lora_params{nullptr};
+    ObjectRef lora_indices{nullptr};
+    if (PrepareBatchLoRA(num_sequence, &lora_params, &lora_indices)) {
+      ret = ft_.decode_lora_func_(embeddings_dref_or_nd, kv_cache_, params_, lora_params,
+                                  lora_indices);
+    } else if (seq_ids.size() == 1) {
       ret = ft_.single_batch_decode_func_(embeddings_dref_or_nd, kv_cache_, params_);
     } else {
       ret = ft_.decode_func_(embeddings_dref_or_nd, kv_cache_, params_);
@@ -413,6 +555,7 @@ class ModelImpl : public ModelObj {
       TVMSynchronize(device_.device_type, device_.device_id, nullptr);
     }
     ft_.kv_cache_end_forward_func_(kv_cache_);
+    PopDecodePaddingTokens(seq_ids);
 
     // logits: (b, 1, v)
     ICHECK_EQ(logits->ndim, 3);
@@ -427,6 +570,7 @@ class ModelImpl : public ModelObj {
     // This is similar to BatchDecode, except that it takes 'length', so that each sequence can have
     // multiple leaf nodes for decoding.
     NVTXScopedRange nvtx_scope("BatchTreeDecode num_seqs=" + std::to_string(seq_ids.size()));
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kDecode, device_);
     int num_sequence = seq_ids.size();
     int total_length = 0;
     for (int i = 0; i < num_sequence; ++i) {
@@ -497,6 +641,7 @@ class ModelImpl : public ModelObj {
                                     const std::vector<int64_t>& seq_ids) final {
     NVTXScopedRange nvtx_scope("BatchDecodeToLastHidden num_seqs=" +
                                std::to_string(seq_ids.size()));
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kDecode, device_);
     int num_sequence = seq_ids.size();
 
     CHECK(ft_.decode_to_last_hidden_func_.defined())
@@ -555,6 +700,7 @@ class ModelImpl : public ModelObj {
     CHECK_EQ(total_length, token_tree_parent_ptr.size());
 
     NVTXScopedRange nvtx_scope("BatchVerify num_tokens=" + std::to_string(total_length));
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kDecode, device_);
 
     CHECK(ft_.verify_func_.defined())
         << "`verify_with_embed` function is not found in the model. Please make sure the model is "
@@ -627,6 +773,7 @@ class ModelImpl : public ModelObj {
     CHECK_EQ(total_length, token_tree_parent_ptr.size());
     NVTXScopedRange nvtx_scope("BatchVerifyToLastHidden num_tokens=" +
                                std::to_string(total_length));
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kDecode, device_);
 
     CHECK(ft_.verify_to_last_hidden_func_.defined())
         << "`batch_verify_to_last_hidden_states` function is not found in the model.";
@@ -682,9 +829,14 @@ class ModelImpl : public ModelObj {
 
   void CreateKVCache(int page_size, int max_num_sequence, int64_t max_total_sequence_length,
                      int64_t prefill_chunk_size, int max_history_size) final {
+    // Release the existing KV cache first when it is recreated, so that its memory is freed
+    // before the new one is allocated.
+    kv_cache_ = ObjectRef(nullptr);
+    local_kv_cache_ = ObjectRef(nullptr);
     KVStateKind kv_state_kind = GetMetadata().kv_state_kind;
     if (kv_state_kind == KVStateKind::kKVCache) {
-      IntTuple max_num_sequence_tuple{max_num_sequence};
+      // Reserve the sequences for decode batch padding.
+      IntTuple max_num_sequence_tuple{max_num_sequence + num_decode_padding_seqs_};
       IntTuple max_total_sequence_length_tuple{max_total_sequence_length};
       IntTuple prefill_chunk_size_tuple{prefill_chunk_size};
       IntTuple page_size_tuple{page_size};
@@ -735,6 +887,102 @@ class ModelImpl : public ModelObj {
     ft_.kv_cache_popn_func_(kv_cache_, seq_id, num_tokens);
   }
 
+  bool SupportKVSwap() const final {
+    return this->kind == KVStateKind::kKVCache && !ft_.use_disco && sliding_window_size_ == -1 &&
+           ft_.kv_cache_debug_get_kv_func_.defined() && ft_.kv_cache_debug_set_kv_func_.defined();
+  }
+
+  ObjectRef SwapOutSequence(int64_t seq_id, int64_t num_tokens) final {
+    NVTXScopedRange nvtx_scope("SwapOutSequence");
+    ICHECK(SupportKVSwap()) << "The model does not support KV swap.";
+    ICHECK_GT(num_tokens, 0);
+    InitKVSwapWorkspace();
+    DeviceAPI* device_api = DeviceAPI::Get(device_);
+    // The swapped-out data are organized as [k_0, v_0, k_1, v_1, ...] for every chunk of tokens.
+    Array<NDArray> swapped_kv_data;
+    int num_chunks = (num_tokens + kKVSwapChunkSize - 1) / kKVSwapChunkSize;
+    swapped_kv_data.reserve(num_chunks * 2);
+    for (int i = 0; i < num_chunks; ++i) {
+      int64_t begin = i * kKVSwapChunkSize;
+      int64_t length = std::min(num_tokens - begin, kKVSwapChunkSize);
+      NDArray k_staging = kv_swap_staging_[(i % 2) * 2].CreateView(
+          GetKVSwapChunkShape(length), kv_swap_staging_[0]->dtype);
+      NDArray v_staging = kv_swap_staging_[(i % 2) * 2 + 1].CreateView(
+          GetKVSwapChunkShape(length), kv_swap_staging_[0]->dtype);
+      // - The staging buffer may still be in use by the copy of two chunks ago.
+      device_api->SyncStreamFromTo(device_, kv_swap_stream_, /*event_dst=*/nullptr);
+      ft_.kv_cache_debug_get_kv_func_(kv_cache_, seq_id, begin, begin + length, k_staging,
+                                      v_staging);
+      // - The device-to-host copy waits for the KV data read on the compute stream.
+      device_api->SyncStreamFromTo(device_, /*event_src=*/nullptr, kv_swap_stream_);
+      NDArray k_host = AllocKVSwapHostChunk();
+      NDArray v_host = AllocKVSwapHostChunk();
+      k_host = k_host.CreateView(GetKVSwapChunkShape(length), k_host->dtype);
+      v_host = v_host.CreateView(GetKVSwapChunkShape(length), v_host->dtype);
+      NDArray::CopyFromTo(k_staging.operator->(), const_cast<DLTensor*>(k_host.operator->()),
+                          kv_swap_stream_);
+      NDArray::CopyFromTo(v_staging.operator->(), const_cast<DLTensor*>(v_host.operator->()),
+                          kv_swap_stream_);
+      swapped_kv_data.push_back(k_host);
+      swapped_kv_data.push_back(v_host);
+    }
+    return swapped_kv_data;
+  }
+
+  void SwapInSequence(int64_t seq_id, ObjectRef swapped_kv_data) final {
+    NVTXScopedRange nvtx_scope("SwapInSequence");
+    ICHECK(SupportKVSwap()) << "The model does not support KV swap.";
+    Array<NDArray> kv_data = Downcast<Array<NDArray>>(swapped_kv_data);
+    ICHECK(!kv_data.empty() && kv_data.size() % 2 == 0);
+    InitKVSwapWorkspace();
+    DeviceAPI* device_api = DeviceAPI::Get(device_);
+    int64_t num_tokens = 0;
+    for (int i = 0; i < static_cast<int>(kv_data.size()); i += 2) {
+      num_tokens += kv_data[i]->shape[1];
+    }
+    // - Add the sequence and reserve the KV cache slots for the swapped-in tokens.
+    AddNewSequence(seq_id);
+    ft_.kv_cache_begin_forward_func_(kv_cache_, IntTuple{seq_id}, IntTuple{num_tokens});
+    ft_.kv_cache_end_forward_func_(kv_cache_);
+    int64_t begin = 0;
+    for (int i = 0; i < static_cast<int>(kv_data.size()); i += 2) {
+      int64_t length = kv_data[i]->shape[1];
+      NDArray k_staging = kv_swap_staging_[(i / 2 % 2) * 2].CreateView(
+          GetKVSwapChunkShape(length), kv_swap_staging_[0]->dtype);
+      NDArray v_staging = kv_swap_staging_[(i / 2 % 2) * 2 + 1].CreateView(
+          GetKVSwapChunkShape(length), kv_swap_staging_[0]->dtype);
+      // - The host-to-device copy waits for the staging buffer write of two chunks ago.
+      device_api->SyncStreamFromTo(device_, /*event_src=*/nullptr, kv_swap_stream_);
+      NDArray::CopyFromTo(kv_data[i].operator->(), const_cast<DLTensor*>(k_staging.operator->()),
+                          kv_swap_stream_);
+      NDArray::CopyFromTo(kv_data[i + 1].operator->(),
+                          const_cast<DLTensor*>(v_staging.operator->()), kv_swap_stream_);
+      // - The KV data write on the compute stream waits for the host-to-device copy.
+      device_api->SyncStreamFromTo(device_, kv_swap_stream_, /*event_dst=*/nullptr);
+      ft_.kv_cache_debug_set_kv_func_(kv_cache_, seq_id, begin, k_staging, v_staging);
+      begin += length;
+    }
+    // - The host chunks of the pool are reused once the KV data holding their views are freed.
+    // Later device-to-host copies into them are ordered after the copies above on the swap stream.
+  }
+
+  void SynchronizeKVSwap() final {
+    if (kv_swap_stream_ != nullptr) {
+      DeviceAPI::Get(device_)->StreamSync(device_, kv_swap_stream_);
+    }
+  }
+
+  KVSwapLayout GetKVSwapLayout() const final {
+    const ModelMetadata::KVCacheMetadata& kv_metadata = ft_.model_metadata_.kv_cache_metadata;
+    KVSwapLayout layout;
+    layout.num_layers = kv_metadata.num_hidden_layers;
+    layout.num_kv_heads = kv_metadata.num_key_value_heads;
+    layout.head_dim = kv_metadata.head_dim;
+    layout.chunk_size = kKVSwapChunkSize;
+    layout.dtype = hidden_states_dtype_;
+    return layout;
+  }
+
   void CommitAcceptedTokenTreeNodesToKVCache(
       const std::vector<int64_t>& seq_ids,
       const std::vector<int64_t>& accepted_leaf_indices) final {
@@ -780,10 +1028,138 @@ class ModelImpl : public ModelObj {
 
   void LoadParams() final { this->params_ = ft_.LoadParams(model_, device_); }
 
+  ObjectRef LoadParamsFromPath(const String& model_path) final {
+    return ft_.LoadParams(model_path, device_);
+  }
+
+  void SwapParams(const String& model_path, ObjectRef params) final {
+    this->model_ = model_path;
+    this->params_ = std::move(params);
+    this->Reset();
+    // The cached image embeddings are computed with the previous parameters.
+    image_embedding_cache_.clear();
+    image_embedding_lru_.clear();
+    image_embedding_cache_bytes_ = 0;
+  }
+
+  void RegisterLoRAAdapters(const Array<String>& adapter_paths, int max_num_resident) final {
+    CHECK(ft_.prefill_lora_func_.defined() && ft_.decode_lora_func_.defined())
+        << "The model library does not contain the `batch_prefill_lora` and `batch_decode_lora` "
+           "functions. Please compile the model with LoRA support to serve LoRA adapters.";
+    CHECK(!ft_.use_disco) << "LoRA adapters are not supported with multi-GPU inference yet.";
+    CHECK_GT(max_num_resident, 0);
+    for (const String& adapter_path : adapter_paths) {
+      std::filesystem::path path = std::string(adapter_path);
+      std::string name = path.filename().string();
+      if (name.empty()) {
+        // The path ends with a separator.
+        name = path.parent_path().filename().string();
+      }
+      CHECK(GetLoRAAdapterIndex(name) == -1)
+          << "Duplicate LoRA adapter name \"" << name << "\" from path " << adapter_path;
+      lora_adapter_names_.push_back(name);
+      lora_adapter_paths_.push_back(adapter_path);
+    }
+    max_num_resident_lora_adapters_ = max_num_resident;
+  }
+
+  int GetLoRAAdapterIndex(const String& name) const final {
+    for (int i = 0; i < static_cast<int>(lora_adapter_names_.size()); ++i) {
+      if (lora_adapter_names_[i] == name) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void SetBatchLoRAAdapters(std::vector<int> adapter_indices) final {
+    batch_lora_adapters_ = std::move(adapter_indices);
+  }
+
   void SetMaxNumSequence(int max_num_sequence) final {
     this->max_num_sequence_ = max_num_sequence;
     this->logit_pos_arr_ =
         NDArray::Empty({max_num_sequence}, DataType::Int(32), Device{DLDeviceType::kDLCPU, 0});
+    this->lora_indices_arr_ =
+        NDArray::Empty({max_num_sequence}, DataType::Int(32), Device{DLDeviceType::kDLCPU, 0});
+    this->pool_info_arr_ =
+        NDArray::Empty({max_num_sequence, 3}, DataType::Int(32), Device{DLDeviceType::kDLCPU, 0});
+  }
+
+  void SetDecodeBatchSizeBuckets(std::vector<int> buckets) final {
+    ICHECK(!kv_cache_.defined())
+        << "The decode batch size buckets must be set before creating the KV cache.";
+    std::sort(buckets.begin(), buckets.end());
+    buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+    // The number of padding sequences needed is the largest gap between adjacent buckets.
+    num_decode_padding_seqs_ = 0;
+    int prev_bucket = 0;
+    for (int bucket : buckets) {
+      ICHECK_GT(bucket, 0);
+      num_decode_padding_seqs_ = std::max(num_decode_padding_seqs_, bucket - prev_bucket - 1);
+      prev_bucket = bucket;
+    }
+    decode_batch_size_buckets_ = std::move(buckets);
+  }
+
+  int GetNumDecodePaddingSequences(int num_sequence) const final {
+    auto it = std::lower_bound(decode_batch_size_buckets_.begin(),
+                               decode_batch_size_buckets_.end(), num_sequence);
+    return it == decode_batch_size_buckets_.end() ? 0 : *it - num_sequence;
+  }
+
+  std::vector<int64_t> GetDecodePaddingSequenceIds(int num_sequence) final {
+    int num_padding = GetNumDecodePaddingSequences(num_sequence);
+    if (num_padding == 0) {
+      return {};
+    }
+    ICHECK_LE(num_padding, num_decode_padding_seqs_);
+    std::vector<int64_t> padding_seq_ids;
+    padding_seq_ids.reserve(num_padding);
+    for (int i = 0; i < num_padding; ++i) {
+      int64_t seq_id = kDecodePaddingSeqIdBase + i;
+      if (i >= num_added_decode_padding_seqs_) {
+        // Padding sequences are added lazily and stay empty between decodes.
+        ft_.kv_cache_add_sequence_func_(kv_cache_, seq_id);
+        ++num_added_decode_padding_seqs_;
+      }
+      padding_seq_ids.push_back(seq_id);
+    }
+    return padding_seq_ids;
+  }
+
+  void EnableAllReduceTiming() final {
+    if (!ft_.use_disco || num_shards_ == 1) {
+      return;
+    }
+    ft_.get_global_func("mlc.multi_gpu.EnableAllReduceTiming")();
+    all_reduce_timing_enabled_ = true;
+  }
+
+  double TakeAllReduceTime() final {
+    if (!all_reduce_timing_enabled_) {
+      return 0.0;
+    }
+    ObjectRef time = ft_.get_global_func("mlc.multi_gpu.TakeAllReduceTime")();
+    return Downcast<DRef>(time)->DebugGetFromRemote(0);
+  }
+
+  void SetImageEmbeddingCacheCapacity(int64_t num_bytes) final {
+    CHECK_GE(num_bytes, 0);
+    image_embedding_cache_capacity_ = num_bytes;
+    EvictImageEmbeddings();
+  }
+
+  void ReleaseCachedMemory() final {
+    image_embedding_cache_.clear();
+    image_embedding_lru_.clear();
+    image_embedding_cache_bytes_ = 0;
+    // The host chunks in use are held by the swapped-out KV data, and are not released here.
+    kv_swap_host_chunks_.erase(
+        std::remove_if(kv_swap_host_chunks_.begin(), kv_swap_host_chunks_.end(),
+                       [](const NDArray& host_chunk) { return host_chunk.use_count() == 1; }),
+        kv_swap_host_chunks_.end());
+    kv_swap_host_chunk_cursor_ = 0;
   }
 
   void SetPrefillChunkSize(int prefill_chunk_size) final {
@@ -792,9 +1168,21 @@ class ModelImpl : public ModelObj {
     memory::Allocator* allocator = memory::MemoryManager::GetOrCreateAllocator(
         preferred_host_device, memory::AllocatorType::kNaive);
     ICHECK_NOTNULL(allocator);
-    token_ids_storage_ = memory::Storage(
-        allocator->Alloc(preferred_host_device, {prefill_chunk_size_}, DataType::Int(32)),
-        allocator);
+    for (int i = 0; i < 2; ++i) {
+      token_ids_storages_[i] = memory::Storage(
+          allocator->Alloc(preferred_host_device, {prefill_chunk_size_}, DataType::Int(32)),
+          allocator);
+    }
+    if (input_copy_stream_ != nullptr) {
+      memory::Allocator* device_allocator =
+          memory::MemoryManager::GetOrCreateAllocator(device_, memory::AllocatorType::kNaive);
+      ICHECK_NOTNULL(device_allocator);
+      for (int i = 0; i < 2; ++i) {
+        token_ids_device_storages_[i] = memory::Storage(
+            device_allocator->Alloc(device_, {prefill_chunk_size_}, DataType::Int(32)),
+            device_allocator);
+      }
+    }
     if (this->num_stages_ > 1) {
       // Create a remote NDArray for logits when pipeline parallelism is enabled.
       disco_logits_arr_ =
@@ -810,10 +1198,11 @@ class ModelImpl : public ModelObj {
   }
 
   Sampler CreateSampler(int max_num_sample, int num_models,
-                        Optional<EventTraceRecorder> trace_recorder) final {
+                        Optional<EventTraceRecorder> trace_recorder,
+                        bool batch_invariant) final {
     if (Sampler::SupportGPUSampler(device_)) {
       return Sampler::CreateGPUSampler(max_num_sample, vocab_size_, &this->ft_, device_,
-                                       std::move(trace_recorder));
+                                       std::move(trace_recorder), batch_invariant);
     } else {
       return Sampler::CreateCPUSampler(std::move(trace_recorder));
     }
@@ -834,20 +1223,22 @@ class ModelImpl : public ModelObj {
     }
     // Allocate the embedding tensor.
     ObjectRef embedding = ft_.alloc_embedding_tensor_func_();
-    // Get the shape of the embedding tensor for hidden size.
-    ShapeTuple embedding_shape;
+    // Get the shape and dtype of the embedding tensor for hidden size.
+    NDArray embedding_nd{nullptr};
     if (ft_.use_disco) {
       ICHECK(embedding->IsInstance<DRefObj>());
-      ObjectRef shape_ref = ft_.nd_get_shape_func_(embedding);
-      embedding_shape = Downcast<DRef>(shape_ref)->DebugGetFromRemote(0);
+      embedding_nd = Downcast<DRef>(embedding)->DebugGetFromRemote(0);
     } else {
-      NDArray embedding_nd = Downcast<NDArray>(embedding);
-      embedding_shape = embedding_nd.Shape();
+      embedding_nd = Downcast<NDArray>(embedding);
     }
+    ShapeTuple embedding_shape = embedding_nd.Shape();
     ICHECK_NE(prefill_chunk_size_, -1);
     ICHECK_EQ(embedding_shape.size(), 2);
     ICHECK_GE(embedding_shape[0], prefill_chunk_size_);
     this->hidden_size_ = embedding_shape[1];
+    // The hidden states share the dtype of embeddings, as they are allocated by the same
+    // function. The dtype is set here since the hidden states workspace may not be allocated.
+    this->hidden_states_dtype_ = embedding_nd->dtype;
     return embedding;
   }
 
@@ -880,11 +1271,14 @@ class ModelImpl : public ModelObj {
     if (kv_cache_.defined()) {
       ft_.reset_kv_cache_func_(kv_cache_);
     }
+    num_added_decode_padding_seqs_ = 0;
+    batch_lora_adapters_.clear();
   }
 
   /********************** Utilities for speculative decoding **********************/
 
   DraftTokenWorkspaceManager CreateDraftTokenWorkspaceManager(int max_num_tokens) {
+    draft_index_capacity_ = std::max(draft_index_capacity_, static_cast<int64_t>(max_num_tokens));
     return DraftTokenWorkspaceManager(max_num_tokens, vocab_size_, hidden_size_,
                                       hidden_states_dtype_, device_, ft_);
   }
@@ -899,22 +1293,14 @@ class ModelImpl : public ModelObj {
       NDArray dst_nd = Downcast<NDArray>(*dst);
       dst_view = dst_nd.CreateView(out_shape, hidden_states_dtype_);
     }
-    NDArray indices_nd =
-        logit_pos_arr_.CreateView({static_cast<int64_t>(indices.size())}, DataType::Int(32));
-    indices_nd.CopyFromBytes(indices.data(), indices.size() * sizeof(int));
-    ICHECK_NE(max_num_sequence_, -1);
-    ObjectRef indices_device = ft_.CopyToWorker0(indices_nd, "logit_pos", {max_num_sequence_});
+    ObjectRef indices_device = CopyDraftIndicesToDevice(indices, /*local_only=*/false);
     ft_.gather_hidden_states_func_(input, indices_device, dst_view);
     return dst_view;
   }
 
   void ScatterHiddenStates(const ObjectRef& input, const std::vector<int>& indices,
                            ObjectRef* dst) final {
-    NDArray indices_nd =
-        logit_pos_arr_.CreateView({static_cast<int64_t>(indices.size())}, DataType::Int(32));
-    indices_nd.CopyFromBytes(indices.data(), indices.size() * sizeof(int));
-    ICHECK_NE(max_num_sequence_, -1);
-    ObjectRef indices_device = ft_.CopyToWorker0(indices_nd, "logit_pos", {max_num_sequence_});
+    ObjectRef indices_device = CopyDraftIndicesToDevice(indices, /*local_only=*/false);
     ft_.scatter_hidden_states_func_(input, indices_device, *dst);
   }
 
@@ -922,24 +1308,14 @@ class ModelImpl : public ModelObj {
                            NDArray* dst) final {
     NDArray dst_view =
         dst->CreateView({static_cast<int64_t>(indices.size()), vocab_size_}, DataType::Float(32));
-    NDArray indices_nd =
-        logit_pos_arr_.CreateView({static_cast<int64_t>(indices.size())}, DataType::Int(32));
-    indices_nd.CopyFromBytes(indices.data(), indices.size() * sizeof(int));
-    ICHECK_NE(max_num_sequence_, -1);
-    ObjectRef indices_device =
-        ft_.CopyToWorker0(indices_nd, "logit_pos_local", {max_num_sequence_}, /*local_only=*/true);
+    ObjectRef indices_device = CopyDraftIndicesToDevice(indices, /*local_only=*/true);
     ft_.gather_probs_func_(input, indices_device, dst_view);
     return dst_view;
   }
 
   void ScatterDraftProbs(const NDArray& input, const std::vector<int>& indices,
                          NDArray* dst) final {
-    NDArray indices_nd =
-        logit_pos_arr_.CreateView({static_cast<int64_t>(indices.size())}, DataType::Int(32));
-    indices_nd.CopyFromBytes(indices.data(), indices.size() * sizeof(int));
-    ICHECK_NE(max_num_sequence_, -1);
-    ObjectRef indices_device =
-        ft_.CopyToWorker0(indices_nd, "logit_pos_local", {max_num_sequence_}, /*local_only=*/true);
+    ObjectRef indices_device = CopyDraftIndicesToDevice(indices, /*local_only=*/true);
     ft_.scatter_probs_func_(input, indices_device, *dst);
   }
 
@@ -961,6 +1337,453 @@ class ModelImpl : public ModelObj {
   }
 
  private:
+  /*!
+   * \brief Consume the LoRA adapters set for the next batch forward, page in the adapter weights
+   * used by the batch, and prepare the LoRA arguments of the forward function.
+   * \param num_sequence The number of sequences in the batch, including the padding sequences.
+   * \param lora_params The weights of the adapters used by the batch, as an array of arrays.
+   * \param lora_indices The int32 array of each sequence's position in `lora_params`,
+   * where -1 means the base model.
+   * \return Whether any sequence in the batch uses a LoRA adapter. When false, the outputs
+   * are not set and the base model functions are expected to be called.
+   */
+  bool PrepareBatchLoRA(int num_sequence, ObjectRef* lora_params, ObjectRef* lora_indices) {
+    std::vector<int> batch_adapters = std::move(batch_lora_adapters_);
+    batch_lora_adapters_.clear();
+    if (std::all_of(batch_adapters.begin(), batch_adapters.end(),
+                    [](int adapter) { return adapter == -1; })) {
+      return false;
+    }
+    ICHECK_LE(batch_adapters.size(), num_sequence);
+    ICHECK_NE(max_num_sequence_, -1);
+    // The trailing sequences without an adapter set (e.g., decode padding) use the base model.
+    std::vector<int> used_adapters;
+    int* p_lora_indices = static_cast<int*>(lora_indices_arr_->data);
+    for (int i = 0; i < num_sequence; ++i) {
+      int adapter = i < static_cast<int>(batch_adapters.size()) ? batch_adapters[i] : -1;
+      if (adapter == -1) {
+        p_lora_indices[i] = -1;
+        continue;
+      }
+      ICHECK_LT(adapter, static_cast<int>(lora_adapter_paths_.size()));
+      auto it = std::find(used_adapters.begin(), used_adapters.end(), adapter);
+      p_lora_indices[i] = it - used_adapters.begin();
+      if (it == used_adapters.end()) {
+        used_adapters.push_back(adapter);
+      }
+    }
+    ++lora_step_;
+    Array<Array<NDArray>> params;
+    params.reserve(used_adapters.size());
+    for (int adapter : used_adapters) {
+      params.push_back(GetResidentLoRAParams(adapter, used_adapters));
+    }
+    *lora_params = params;
+    NDArray lora_indices_nd = lora_indices_arr_.CreateView({num_sequence}, DataType::Int(32));
+    *lora_indices = ft_.CopyToWorker0(lora_indices_nd, "lora_indices", {max_num_sequence_});
+    return true;
+  }
+
+  /*!
+   * \brief Return the device weights of the given LoRA adapter, loading them when the adapter
+   * is not resident. Loading evicts the least recently used adapters outside the current batch
+   * when the number of resident adapters reaches the limit.
+   */
+  const Array<NDArray>& GetResidentLoRAParams(int adapter, const std::vector<int>& batch_adapters) {
+    auto it = resident_lora_adapters_.find(adapter);
+    if (it == resident_lora_adapters_.end()) {
+      while (static_cast<int>(resident_lora_adapters_.size()) >= max_num_resident_lora_adapters_) {
+        auto victim = resident_lora_adapters_.end();
+        for (auto jt = resident_lora_adapters_.begin(); jt != resident_lora_adapters_.end(); ++jt) {
+          if (std::find(batch_adapters.begin(), batch_adapters.end(), jt->first) ==
+                  batch_adapters.end() &&
+              (victim == resident_lora_adapters_.end() ||
+               jt->second.last_used_step < victim->second.last_used_step)) {
+            victim = jt;
+          }
+        }
+        if (victim == resident_lora_adapters_.end()) {
+          // All the resident adapters are used by the current batch.
+          break;
+        }
+        resident_lora_adapters_.erase(victim);
+      }
+      ResidentLoRAAdapter resident;
+      resident.params = ft_.LoadLoRAParams(lora_adapter_paths_[adapter], device_);
+      it = resident_lora_adapters_.emplace(adapter, std::move(resident)).first;
+    }
+    it->second.last_used_step = lora_step_;
+    return it->second.params;
+  }
+
+  /*! \brief Return the shape of a KV swap chunk of the given number of tokens. */
+  ShapeTuple GetKVSwapChunkShape(int64_t num_tokens) const {
+    const ModelMetadata::KVCacheMetadata& kv_metadata = ft_.model_metadata_.kv_cache_metadata;
+    return {kv_metadata.num_hidden_layers, num_tokens, kv_metadata.num_key_value_heads,
+            kv_metadata.head_dim};
+  }
+
+  /*! \brief Lazily create the stream and the device staging arrays of KV swap. */
+  void InitKVSwapWorkspace() {
+    if (!kv_swap_staging_.empty()) {
+      return;
+    }
+    kv_swap_stream_ = DeviceAPI::Get(device_)->CreateStream(device_);
+    ShapeTuple shape = GetKVSwapChunkShape(kKVSwapChunkSize);
+    for (int i = 0; i < 4; ++i) {
+      kv_swap_staging_.push_back(NDArray::Empty(shape, hidden_states_dtype_, device_));
+    }
+  }
+
+  /*!
+   * \brief Get a full-size host chunk for KV swap, reusing a free chunk of the pool if possible.
+   * The swapped-out KV data hold views of the pool chunks, which keep the chunks alive. So a pool
+   * chunk is free when the pool holds the only reference to it. The KV data not allocated by the
+   * pool, e.g. loaded from disk or shared memory, are never reused.
+   */
+  NDArray AllocKVSwapHostChunk() {
+    for (size_t i = 0; i < kv_swap_host_chunks_.size(); ++i) {
+      size_t index = (kv_swap_host_chunk_cursor_ + i) % kv_swap_host_chunks_.size();
+      if (kv_swap_host_chunks_[index].use_count() == 1) {
+        kv_swap_host_chunk_cursor_ = index + 1;
+        return kv_swap_host_chunks_[index];
+      }
+    }
+    Device host_device{kDLCPU, 0};
+    if (device_.device_type == kDLCUDA) {
+      host_device.device_type = kDLCUDAHost;
+    } else if (device_.device_type == kDLROCM) {
+      host_device.device_type = kDLROCMHost;
+    }
+    kv_swap_host_chunks_.push_back(
+        NDArray::Empty(GetKVSwapChunkShape(kKVSwapChunkSize), hidden_states_dtype_, host_device));
+    return kv_swap_host_chunks_.back();
+  }
+
+  /*!
+   * \brief Look up the image embedding of the given image hash in the cache.
+   * \return The cached embedding, or undefined when it is not cached.
+   */
+  ObjectRef LookupImageEmbedding(const std::string& image_hash) {
+    if (image_hash.empty() || image_embedding_cache_capacity_ == 0) {
+      return ObjectRef(nullptr);
+    }
+    auto it = image_embedding_cache_.find(image_hash);
+    if (it == image_embedding_cache_.end()) {
+      return ObjectRef(nullptr);
+    }
+    // Move the entry to the most recently used end.
+    image_embedding_lru_.splice(image_embedding_lru_.end(), image_embedding_lru_,
+                                it->second.lru_it);
+    return it->second.embeddings;
+  }
+
+  /*!
+   * \brief Insert the image embedding into the cache, and evict the least recently used
+   * embeddings beyond the capacity. Only the embeddings on the local device are cached, as the
+   * sizes of the remote embeddings under disco are not known here.
+   */
+  void InsertImageEmbedding(const std::string& image_hash, const ObjectRef& embeddings) {
+    if (image_hash.empty() || image_embedding_cache_capacity_ == 0) {
+      return;
+    }
+    const auto* embeddings_nd = embeddings.as<NDArray::ContainerType>();
+    if (embeddings_nd == nullptr) {
+      return;
+    }
+    int64_t num_bytes = GetDataSize(embeddings_nd->dl_tensor);
+    if (num_bytes > image_embedding_cache_capacity_) {
+      return;
+    }
+    image_embedding_lru_.push_back(image_hash);
+    image_embedding_cache_.emplace(
+        image_hash, ImageEmbeddingCacheEntry{Downcast<NDArray>(embeddings), num_bytes,
+                                             std::prev(image_embedding_lru_.end())});
+    image_embedding_cache_bytes_ += num_bytes;
+    EvictImageEmbeddings();
+  }
+
+  /*! \brief Evict the least recently used image embeddings until they fit the capacity. */
+  void EvictImageEmbeddings() {
+    while (image_embedding_cache_bytes_ > image_embedding_cache_capacity_) {
+      auto it = image_embedding_cache_.find(image_embedding_lru_.front());
+      ICHECK(it != image_embedding_cache_.end());
+      image_embedding_cache_bytes_ -= it->second.num_bytes;
+      image_embedding_cache_.erase(it);
+      image_embedding_lru_.pop_front();
+    }
+  }
+
+  /*!
+   * \brief Copy the gather/scatter indices of the draft token states to the device. The
+   * indices are staged in dedicated buffers reserved for the draft token workspace capacity and
+   * reused across steps, and the copy is skipped when the indices equal the ones last copied,
+   * such as the slots of the draft probabilities and the hidden states scattered in turn.
+   * For the indices used on the local device only, just the range of positions that differ from
+   * the indices last copied is uploaded.
+   * \param indices The indices to copy.
+   * \param local_only A boolean indicating if the indices are only used on the local device.
+   * \return The indices on device.
+   */
+  ObjectRef CopyDraftIndicesToDevice(const std::vector<int>& indices, bool local_only) {
+    ICHECK_NE(max_num_sequence_, -1);
+    if (!draft_indices_host_.defined()) {
+      draft_index_capacity_ =
+          std::max({draft_index_capacity_, static_cast<int64_t>(max_num_sequence_) * 2,
+                    static_cast<int64_t>(prefill_chunk_size_)});
+      draft_indices_host_ = NDArray::Empty({draft_index_capacity_}, DataType::Int(32),
+                                           Device{DLDeviceType::kDLCPU, 0});
+    }
+    CHECK_LE(static_cast<int64_t>(indices.size()), draft_index_capacity_)
+        << "The number of draft token indices exceeds the draft token workspace capacity.";
+    // Under disco, the indices used by the model functions are copied to all workers.
+    local_only = local_only || !ft_.use_disco;
+    DraftIndicesBuffer& buffer = draft_indices_buffers_[local_only ? 1 : 0];
+    if (buffer.device.defined() && buffer.indices == indices) {
+      return buffer.device;
+    }
+    if (local_only) {
+      if (!draft_indices_device_local_.defined()) {
+        draft_indices_device_local_ = NDArray::Empty({draft_index_capacity_}, DataType::Int(32),
+                                                     ft_.local_gpu_device);
+      }
+      // Find the range of positions that differ from the indices last copied.
+      int64_t begin = 0;
+      int64_t end = indices.size();
+      if (buffer.device.defined()) {
+        int64_t num_common = std::min(indices.size(), buffer.indices.size());
+        while (begin < num_common && indices[begin] == buffer.indices[begin]) {
+          ++begin;
+        }
+        if (indices.size() == buffer.indices.size()) {
+          while (end > begin && indices[end - 1] == buffer.indices[end - 1]) {
+            --end;
+          }
+        }
+      }
+      if (begin < end) {
+        NDArray changed_nd = draft_indices_host_.CreateView({end - begin}, DataType::Int(32));
+        changed_nd.CopyFromBytes(indices.data() + begin, (end - begin) * sizeof(int));
+        DLTensor copy_dst = *(draft_indices_device_local_.operator->());
+        copy_dst.shape = changed_nd->shape;
+        copy_dst.byte_offset += begin * sizeof(int);
+        NDArray::CopyFromTo(changed_nd.operator->(), &copy_dst);
+      }
+      buffer.device = draft_indices_device_local_.CreateView(
+          {static_cast<int64_t>(indices.size())}, DataType::Int(32));
+      buffer.indices = indices;
+      return buffer.device;
+    }
+    NDArray indices_nd =
+        draft_indices_host_.CreateView({static_cast<int64_t>(indices.size())}, DataType::Int(32));
+    indices_nd.CopyFromBytes(indices.data(), indices.size() * sizeof(int));
+    buffer.device =
+        ft_.CopyToWorker0(indices_nd, local_only ? "draft_indices_local" : "draft_indices",
+                          {draft_index_capacity_}, local_only);
+    buffer.indices = indices;
+    return buffer.device;
+  }
+
+  /*! \brief A micro-batch of the pipelined batch forward, which is a contiguous token range. */
+  struct MicroBatch {
+    /*! \brief The sequences of the micro-batch. */
+    std::vector<int64_t> seq_ids;
+    /*! \brief The number of tokens of each sequence in the micro-batch. */
+    std::vector<int> lengths;
+    /*! \brief The offset of the first token of the micro-batch in the batch embeddings. */
+    int token_offset = 0;
+    /*!
+     * \brief The number of leading sequences of the micro-batch whose last token is in the
+     * micro-batch. The logits of these sequences are the logits of the batch.
+     */
+    int num_finished_seqs = 0;
+  };
+
+  /*!
+   * \brief Whether to run the batch forward in micro-batches across the pipeline stages. The
+   * embeddings must be remote, and the forward must not use LoRA adapters.
+   */
+  bool UsePipelineMicroBatches(const ObjectRef& embeddings) const {
+    return ft_.use_disco && num_stages_ > 1 && embeddings->IsInstance<DRefObj>() &&
+           batch_lora_adapters_.empty();
+  }
+
+  /*! \brief Split the decode batch into one micro-batch per pipeline stage. */
+  std::vector<MicroBatch> SplitDecodeMicroBatches(const std::vector<int64_t>& seq_ids) const {
+    int num_sequence = seq_ids.size();
+    int num_micro_batches = std::min(num_stages_, num_sequence);
+    std::vector<MicroBatch> micro_batches(num_micro_batches);
+    for (int i = 0; i < num_micro_batches; ++i) {
+      int begin = num_sequence * i / num_micro_batches;
+      int end = num_sequence * (i + 1) / num_micro_batches;
+      micro_batches[i].seq_ids.assign(seq_ids.begin() + begin, seq_ids.begin() + end);
+      micro_batches[i].lengths.assign(end - begin, 1);
+      micro_batches[i].token_offset = begin;
+      micro_batches[i].num_finished_seqs = end - begin;
+    }
+    return micro_batches;
+  }
+
+  /*!
+   * \brief Split the prefill batch into one micro-batch per pipeline stage with the same number
+   * of tokens. A sequence crossing a micro-batch boundary is split, and its leading tokens are
+   * added to KV cache in the earlier micro-batch like a prefill chunk.
+   */
+  std::vector<MicroBatch> SplitPrefillMicroBatches(const std::vector<int64_t>& seq_ids,
+                                                   const std::vector<int>& lengths,
+                                                   int total_length) const {
+    int num_micro_batches = std::min(num_stages_, total_length / kMinPrefillMicroBatchLength);
+    std::vector<MicroBatch> micro_batches;
+    micro_batches.reserve(num_micro_batches);
+    int seq_index = 0;
+    // The number of tokens of the current sequence in the earlier micro-batches.
+    int seq_consumed_length = 0;
+    for (int i = 0; i < num_micro_batches; ++i) {
+      MicroBatch micro_batch;
+      micro_batch.token_offset = static_cast<int64_t>(total_length) * i / num_micro_batches;
+      int token_end = static_cast<int64_t>(total_length) * (i + 1) / num_micro_batches;
+      int num_tokens = token_end - micro_batch.token_offset;
+      while (num_tokens > 0) {
+        int length = std::min(lengths[seq_index] - seq_consumed_length, num_tokens);
+        micro_batch.seq_ids.push_back(seq_ids[seq_index]);
+        micro_batch.lengths.push_back(length);
+        num_tokens -= length;
+        seq_consumed_length += length;
+        if (seq_consumed_length == lengths[seq_index]) {
+          ++micro_batch.num_finished_seqs;
+          ++seq_index;
+          seq_consumed_length = 0;
+        }
+      }
+      micro_batches.push_back(std::move(micro_batch));
+    }
+    ICHECK_EQ(seq_index, static_cast<int>(seq_ids.size()));
+    return micro_batches;
+  }
+
+  /*!
+   * \brief Run the batch forward in micro-batches interleaved across the pipeline stages. The
+   * forwards of all micro-batches are issued to the disco session before any logits are sent
+   * back to worker 0, so the worker group of each stage proceeds to the next micro-batch while
+   * the later stages work on the earlier ones, instead of idling until the whole batch finishes.
+   * \param embeddings The remote embeddings of the batch, of shape (total_length, hidden_size).
+   * \param micro_batches The micro-batches in the token order.
+   * \param is_decode Whether the forward is decode, or otherwise prefill.
+   * \return The logits of the batch, of shape (b, 1, v) for decode and (1, b, v) for prefill.
+   */
+  NDArray PipelinedBatchForward(const ObjectRef& embeddings,
+                                const std::vector<MicroBatch>& micro_batches, bool is_decode) {
+    int num_micro_batches = micro_batches.size();
+    if (static_cast<int>(micro_batch_embeddings_.size()) < num_micro_batches) {
+      micro_batch_embeddings_.resize(num_micro_batches, ObjectRef{nullptr});
+      micro_batch_logits_.resize(num_micro_batches, ObjectRef{nullptr});
+      micro_batch_logits_capacity_.resize(num_micro_batches, 0);
+      micro_batch_logit_pos_.resize(num_micro_batches, NDArray{nullptr});
+    }
+    std::vector<ObjectRef> rets;
+    rets.reserve(num_micro_batches);
+    for (int i = 0; i < num_micro_batches; ++i) {
+      const MicroBatch& micro_batch = micro_batches[i];
+      int64_t num_sequences = micro_batch.seq_ids.size();
+      int64_t num_tokens =
+          std::accumulate(micro_batch.lengths.begin(), micro_batch.lengths.end(), 0);
+      ft_.kv_cache_begin_forward_func_(
+          kv_cache_, IntTuple(micro_batch.seq_ids),
+          IntTuple(micro_batch.lengths.begin(), micro_batch.lengths.end()));
+      // Copy the embeddings of the micro-batch to its own buffer.
+      if (!micro_batch_embeddings_[i].defined()) {
+        micro_batch_embeddings_[i] = ft_.alloc_embedding_tensor_func_();
+      }
+      ObjectRef embeddings_view =
+          ft_.nd_view_func_(micro_batch_embeddings_[i], ShapeTuple{num_tokens, hidden_size_});
+      ft_.nd_copy_embedding_from_offset_func_(embeddings, embeddings_view,
+                                              micro_batch.token_offset);
+      ObjectRef ret;
+      if (is_decode) {
+        embeddings_view =
+            ft_.nd_view_func_(embeddings_view, ShapeTuple{num_sequences, 1, hidden_size_});
+        ret = num_sequences == 1 && ft_.single_batch_decode_func_.defined()
+                  ? ft_.single_batch_decode_func_(embeddings_view, kv_cache_, params_)
+                  : ft_.decode_func_(embeddings_view, kv_cache_, params_);
+      } else {
+        embeddings_view =
+            ft_.nd_view_func_(embeddings_view, ShapeTuple{1, num_tokens, hidden_size_});
+        // Each micro-batch has its own logit positions, as the copies to worker 0 are in flight
+        // together.
+        if (!micro_batch_logit_pos_[i].defined()) {
+          micro_batch_logit_pos_[i] = NDArray::Empty({max_num_sequence_ + num_stages_},
+                                                     DataType::Int(32), logit_pos_arr_->device);
+        }
+        int* p_logit_pos = static_cast<int*>(micro_batch_logit_pos_[i]->data);
+        int cum_length = 0;
+        for (int j = 0; j < num_sequences; ++j) {
+          cum_length += micro_batch.lengths[j];
+          p_logit_pos[j] = cum_length - 1;
+        }
+        NDArray logit_pos_nd =
+            micro_batch_logit_pos_[i].CreateView({num_sequences}, DataType::Int(32));
+        ObjectRef logit_pos_dref =
+            ft_.CopyToWorker0(logit_pos_nd, "micro_batch_logit_pos_" + std::to_string(i),
+                              {max_num_sequence_ + num_stages_});
+        ret = ft_.prefill_func_(embeddings_view, logit_pos_dref, kv_cache_, params_);
+      }
+      rets.push_back(ft_.tuple_getitem_func_(ret, 0));
+      ft_.kv_cache_end_forward_func_(kv_cache_);
+    }
+
+    // Send the logits of all micro-batches from the last worker group to worker 0.
+    std::vector<ObjectRef> micro_batch_logits;
+    micro_batch_logits.reserve(num_micro_batches);
+    for (int i = 0; i < num_micro_batches; ++i) {
+      int64_t num_sequences = micro_batches[i].seq_ids.size();
+      if (micro_batch_logits_capacity_[i] < num_sequences) {
+        micro_batch_logits_capacity_[i] =
+            std::max(num_sequences, micro_batch_logits_capacity_[i] * 2);
+        micro_batch_logits_[i] =
+            ft_.Empty({micro_batch_logits_capacity_[i], vocab_size_}, DataType::Float(32),
+                      device_, /*worker0_only=*/true);
+      }
+      ShapeTuple shape = is_decode ? ShapeTuple{num_sequences, 1, vocab_size_}
+                                   : ShapeTuple{1, num_sequences, vocab_size_};
+      micro_batch_logits.push_back(ft_.last_group_send_to_worker_0_(
+          rets[i], micro_batch_logits_[i], shape, DataType::Float(32)));
+    }
+    // Gather the logits of the finished sequences into the batch logits on worker 0.
+    NDArray logits = Downcast<DRef>(disco_logits_arr_)->DebugGetFromRemote(0);
+    int64_t row_bytes = vocab_size_ * sizeof(float);
+    int64_t num_logits = 0;
+    for (int i = 0; i < num_micro_batches; ++i) {
+      int64_t num_rows = micro_batches[i].num_finished_seqs;
+      if (num_rows == 0) continue;
+      NDArray src = Downcast<DRef>(micro_batch_logits[i])->DebugGetFromRemote(0);
+      std::vector<int64_t> copy_shape{num_rows, vocab_size_};
+      DLTensor copy_src = *src.operator->();
+      copy_src.ndim = 2;
+      copy_src.shape = copy_shape.data();
+      copy_src.strides = nullptr;
+      DLTensor copy_dst = *logits.operator->();
+      copy_dst.ndim = 2;
+      copy_dst.shape = copy_shape.data();
+      copy_dst.strides = nullptr;
+      copy_dst.byte_offset += num_logits * row_bytes;
+      NDArray::CopyFromTo(&copy_src, &copy_dst);
+      num_logits += num_rows;
+    }
+    if (trace_enabled_) {
+      TVMSynchronize(device_.device_type, device_.device_id, nullptr);
+    }
+    return is_decode ? logits.CreateView({num_logits, 1, vocab_size_}, DataType::Float(32))
+                     : logits.CreateView({1, num_logits, vocab_size_}, DataType::Float(32));
+  }
+
+  /*! \brief Drop the token just appended to the decode padding sequences, which are at the end. */
+  void PopDecodePaddingTokens(const std::vector<int64_t>& seq_ids) {
+    for (auto it = seq_ids.rbegin(); it != seq_ids.rend() && *it >= kDecodePaddingSeqIdBase;
+         ++it) {
+      ft_.kv_cache_popn_func_(kv_cache_, *it, 1);
+    }
+  }
+
   /*! \brief Load model configuration from JSON. */
   void LoadModelConfigJSON(const picojson::object& config) {
     this->sliding_window_size_ =
@@ -982,6 +1805,17 @@ class ModelImpl : public ModelObj {
   int num_shards_ = -1;
   int num_stages_ = -1;
   int max_num_sequence_ = -1;
+  /*! \brief The sorted batch size buckets of batch decode. */
+  std::vector<int> decode_batch_size_buckets_;
+  /*! \brief The number of padding sequences reserved in KV cache for decode batch padding. */
+  int num_decode_padding_seqs_ = 0;
+  /*! \brief The number of padding sequences that have been added to KV cache. */
+  int num_added_decode_padding_seqs_ = 0;
+  /*!
+   * \brief The sequence id of the first decode padding sequence, which is far beyond the
+   * internal ids of requests.
+   */
+  static constexpr const int64_t kDecodePaddingSeqIdBase = 1LL << 40;
   int prefill_chunk_size_ = -1;
   int hidden_size_ = -1;
   DLDataType hidden_states_dtype_;
@@ -1005,11 +1839,98 @@ class ModelImpl : public ModelObj {
   // Model parameters
   ObjectRef params_;
   // Shared NDArray
-  memory::Storage token_ids_storage_{nullptr};
+  // The double-buffered host staging and device storage of the input token ids, where the
+  // device storage is used only with the input copy stream.
+  memory::Storage token_ids_storages_[2];
+  memory::Storage token_ids_device_storages_[2];
+  int token_ids_buffer_index_ = 0;
+  // The sequence ids and lengths of the last single-sequence decode, reused across steps.
+  IntTuple single_decode_seq_ids_;
+  IntTuple single_decode_lengths_{1};
+  // The stream to copy the input token ids to device, which is defined on CUDA/ROCm without disco.
+  TVMStreamHandle input_copy_stream_ = nullptr;
   NDArray logit_pos_arr_{nullptr};
+  // The (begin, end, use_mean) of each sequence to pool hidden states.
+  NDArray pool_info_arr_{nullptr};
   ObjectRef disco_logits_arr_{nullptr};
+  //----------------------------
+  // Pipeline micro-batch workspace
+  //----------------------------
+  /*! \brief The min number of tokens of a prefill micro-batch. */
+  static constexpr const int kMinPrefillMicroBatchLength = 64;
+  // The embeddings, logits, logits capacities and logit positions of each micro-batch.
+  std::vector<ObjectRef> micro_batch_embeddings_;
+  std::vector<ObjectRef> micro_batch_logits_;
+  std::vector<int64_t> micro_batch_logits_capacity_;
+  std::vector<NDArray> micro_batch_logit_pos_;
+  //----------------------------
+  // Draft token index workspace
+  //----------------------------
+  // The capacity of the draft token gather/scatter indices.
+  int64_t draft_index_capacity_ = 0;
+  // The host staging buffer of the draft token indices.
+  NDArray draft_indices_host_{nullptr};
+  // The draft token indices last copied to device, and their device view.
+  struct DraftIndicesBuffer {
+    std::vector<int> indices;
+    ObjectRef device{nullptr};
+  };
+  // The index buffers used by all workers (0) and by the local device only (1).
+  DraftIndicesBuffer draft_indices_buffers_[2];
+  // The device storage of the indices used by the local device only, updated in place.
+  NDArray draft_indices_device_local_{nullptr};
   // A boolean indicating if tracing is enabled.
   bool trace_enabled_;
+  // A boolean indicating if the all-reduce calls are timed on worker 0.
+  bool all_reduce_timing_enabled_ = false;
+  //----------------------------
+  // KV swap workspace
+  //----------------------------
+  // The number of tokens in each chunk of KV swap.
+  static constexpr const int64_t kKVSwapChunkSize = 256;
+  // The stream for asynchronous KV data copy between host and device.
+  TVMStreamHandle kv_swap_stream_ = nullptr;
+  // The double-buffered device staging arrays of KV swap, as [k_0, v_0, k_1, v_1].
+  std::vector<NDArray> kv_swap_staging_;
+  // The full-size host chunks allocated for KV swap, in pinned memory when available. The chunks
+  // held only by this pool are free.
+  std::vector<NDArray> kv_swap_host_chunks_;
+  // The position in kv_swap_host_chunks_ to start the search of a free chunk from.
+  size_t kv_swap_host_chunk_cursor_ = 0;
+  //----------------------------
+  // Image embedding cache
+  //----------------------------
+  struct ImageEmbeddingCacheEntry {
+    NDArray embeddings;
+    int64_t num_bytes;
+    std::list<std::string>::iterator lru_it;
+  };
+  // The capacity in bytes of the image embedding cache, and the bytes cached.
+  int64_t image_embedding_cache_capacity_ = 0;
+  int64_t image_embedding_cache_bytes_ = 0;
+  // The image embedding cache keyed by image content hash, and its LRU order.
+  std::unordered_map<std::string, ImageEmbeddingCacheEntry> image_embedding_cache_;
+  std::list<std::string> image_embedding_lru_;
+  //----------------------------
+  // LoRA adapters
+  //----------------------------
+  /*! \brief The device weights of a resident LoRA adapter. */
+  struct ResidentLoRAAdapter {
+    Array<NDArray> params;
+    /*! \brief The last batch forward that uses the adapter, for LRU eviction. */
+    int64_t last_used_step = 0;
+  };
+  // The names and the directory paths of the registered adapters.
+  std::vector<std::string> lora_adapter_names_;
+  std::vector<std::string> lora_adapter_paths_;
+  int max_num_resident_lora_adapters_ = 0;
+  // The resident adapters, keyed by the adapter index.
+  std::unordered_map<int, ResidentLoRAAdapter> resident_lora_adapters_;
+  // The number of batch forwards with LoRA adapters.
+  int64_t lora_step_ = 0;
+  // The adapter index of each sequence in the next batch forward.
+  std::vector<int> batch_lora_adapters_;
+  NDArray lora_indices_arr_{nullptr};
   // An enum indicating whether it's RNN-based.
   KVStateKind kind;
 };
@@ -1031,6 +1952,21 @@ TVM_REGISTER_GLOBAL("mlc.copy_embedding_to_offset")
       NDArray::CopyFromTo(&copy_src, &copy_dst);
     });
 
+TVM_REGISTER_GLOBAL("mlc.copy_embedding_from_offset")
+    .set_body_typed([](NDArray embedding, NDArray dst, int offset) {
+      // embedding: (prefill_chunk_size, hidden_size)
+      // dst: (m, hidden_size)
+      ICHECK_EQ(embedding->ndim, 2);
+      ICHECK_EQ(dst->ndim, 2);
+      ICHECK_LE(dst->shape[0] + offset, embedding->shape[0]);
+      ICHECK_EQ(embedding->shape[1], dst->shape[1]);
+      DLTensor copy_src = *(embedding.operator->());
+      copy_src.shape = dst->shape;
+      copy_src.byte_offset +=
+          offset * embedding->shape[1] * ((embedding->dtype.bits * embedding->dtype.lanes + 7) / 8);
+      NDArray::CopyFromTo(&copy_src, dst.operator->());
+    });
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -11,12 +11,16 @@
 #include <tvm/runtime/container/string.h>
 #include <tvm/runtime/ndarray.h>
 
+#include <string>
+#include <utility>
+
 #include "../base.h"
 #include "../support/result.h"
 #include "config.h"
 #include "draft_token_workspace_manager.h"
 #include "event_trace_recorder.h"
 #include "function_table.h"
+#include "kv_swap_layout.h"
 #include "logit_processor.h"
 #include "sampler/sampler.h"
 
@@ -108,12 +112,24 @@ class ModelObj : public Object {
   virtual ObjectRef TokenEmbed(IntTuple batch_token_ids, ObjectRef* dst = nullptr,
                                int offset = 0) = 0;
 
+  /*!
+   * \brief Compute embeddings for the token ids which already reside on the model device,
+   * such as the tokens sampled on GPU, without copying the token ids from host.
+   * \param token_ids_on_device The 1-D int32 token ids on the model device.
+   * \return The computed embeddings, or undefined when the model runs on a disco session,
+   * where the token ids should be copied from host with `TokenEmbed`.
+   */
+  virtual ObjectRef TokenEmbedOnDevice(const NDArray& token_ids_on_device) = 0;
+
   /*!
    * \brief Compute embeddings for the input image.
    * \param image The image to compute embedding for.
+   * \param image_hash The content hash of the image. When it is non-empty and the image
+   * embedding cache is enabled, the embedding is looked up from and inserted into the cache.
    * \return The computed embeddings.
    */
-  virtual ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst = nullptr, int offset = 0) = 0;
+  virtual ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst = nullptr, int offset = 0,
+                               const std::string& image_hash = "") = 0;
 
   /*!
    * \brief Fuse the embeddings and hidden_states.
@@ -141,6 +157,26 @@ class ModelObj : public Object {
 
   virtual Array<NDArray> GetMultiStepLogits(const ObjectRef& last_hidden_states) = 0;
 
+  /*!
+   * \brief Return if the model can pool the prefilled hidden states of sequences,
+   * which embedding requests require.
+   */
+  virtual bool CanPoolHiddenStates() = 0;
+
+  /*!
+   * \brief Pool the hidden states of each sequence into a single vector, which is either
+   * the hidden states of its last token or the mean of the hidden states of its tokens.
+   * \param hidden_states The hidden states of all the tokens, in shape (total_length, hidden).
+   * \param lengths The number of tokens of each sequence.
+   * \param use_mean Whether to take the mean of each sequence, or its last token otherwise.
+   * \return The pooled hidden states in the model dtype, which can be passed to `GetLogits`,
+   * and the pooled hidden states in float32 on the device (of worker 0 under disco).
+   * Both are in shape (num_sequences, hidden).
+   */
+  virtual std::pair<ObjectRef, NDArray> PoolHiddenStates(const ObjectRef& hidden_states,
+                                                         const std::vector<int>& lengths,
+                                                         const std::vector<bool>& use_mean) = 0;
+
   /*!
    * \brief Batch prefill function. Embedding in, logits out.
    * The embedding order of sequences in `embedding_arr` follows
@@ -254,6 +290,39 @@ class ModelObj : public Object {
   /*! \brief Pop out N pages from KV cache. */
   virtual void PopNFromKVCache(int64_t seq_id, int num_tokens) = 0;
 
+  /*! \brief Return whether the KV data of sequences can be swapped out to host memory. */
+  virtual bool SupportKVSwap() const = 0;
+
+  /*!
+   * \brief Copy the KV data of the given sequence out to host memory.
+   * The device-to-host copy runs asynchronously on a separate stream.
+   * The sequence is kept in the KV cache, and is supposed to be removed by the caller.
+   * \param seq_id The id of the sequence to swap out.
+   * \param num_tokens The number of tokens of the sequence in the KV cache.
+   * \return The swapped-out KV data on host, which is to be passed to `SwapInSequence`.
+   */
+  virtual ObjectRef SwapOutSequence(int64_t seq_id, int64_t num_tokens) = 0;
+
+  /*!
+   * \brief Add a new sequence with the given sequence id to the KV cache, and restore its
+   * KV data from the host data swapped out by `SwapOutSequence`.
+   * \param seq_id The id of the new sequence.
+   * \param swapped_kv_data The swapped-out KV data on host.
+   */
+  virtual void SwapInSequence(int64_t seq_id, ObjectRef swapped_kv_data) = 0;
+
+  /*!
+   * \brief Block until all the issued KV swap copies complete, after which
+   * the swapped-out KV data on host can be read directly.
+   */
+  virtual void SynchronizeKVSwap() = 0;
+
+  /*!
+   * \brief Get the layout of the KV data swapped out by `SwapOutSequence`. The model hash of the
+   * returned layout is left zero, to be filled by the engine.
+   */
+  virtual KVSwapLayout GetKVSwapLayout() const = 0;
+
   /*!
    * \brief Commit the accepted token tree nodes to KV cache.
    * The unaccepted token tree node will be removed from KV cache.
@@ -287,6 +356,48 @@ class ModelObj : public Object {
   /*! \brief Load the model's weight parameters, which is not loaded at construction time. */
   virtual void LoadParams() = 0;
 
+  /*!
+   * \brief Load the weight parameters of the model at the given path with the function table
+   * of this model, without replacing the parameters in use. The model at the path should share
+   * the architecture and the parameter shapes with this model.
+   * \param model_path The path to the model weights.
+   * \return The loaded parameters, which are installed by `SwapParams`.
+   * \note When the model does not use disco, it can be called on a thread other than the
+   * engine thread while the engine keeps running the model. It is serialized with the other
+   * weight loads, such as the LoRA adapter loads, which go through the same global ndarray cache.
+   */
+  virtual ObjectRef LoadParamsFromPath(const String& model_path) = 0;
+
+  /*!
+   * \brief Replace the weight parameters with the given ones loaded by `LoadParamsFromPath`.
+   * The KV cache allocation is kept, and the KV cache is reset, since its data are computed
+   * with the previous parameters.
+   * \param model_path The path to the model weights of the parameters.
+   * \param params The parameters loaded by `LoadParamsFromPath`.
+   */
+  virtual void SwapParams(const String& model_path, ObjectRef params) = 0;
+
+  /*!
+   * \brief Register the LoRA adapters of the model. Each adapter is a directory of converted
+   * adapter weights, and is named by the directory name. The adapter weights are loaded to
+   * device on demand, and at most the given number of adapters stay resident at the same time.
+   * \param adapter_paths The paths to the adapter directories.
+   * \param max_num_resident The maximum number of resident adapters.
+   * \throw Error if the model library is not compiled with LoRA support.
+   */
+  virtual void RegisterLoRAAdapters(const Array<String>& adapter_paths, int max_num_resident) = 0;
+
+  /*! \brief Return the index of the registered LoRA adapter of the given name, or -1 if none. */
+  virtual int GetLoRAAdapterIndex(const String& name) const = 0;
+
+  /*!
+   * \brief Set the LoRA adapter index of each sequence for the next BatchPrefill or BatchDecode,
+   * where -1 means the base model. The setting is consumed by the next batch forward.
+   * Sequences of different adapters are computed in the same batch.
+   * \param adapter_indices The adapter index of each sequence in the next batch.
+   */
+  virtual void SetBatchLoRAAdapters(std::vector<int> adapter_indices) = 0;
+
   /*!
    * \brief Set the maximum number of sequences to be processed for the model,
    * which is not initialized at construction time.
@@ -299,13 +410,68 @@ class ModelObj : public Object {
    */
   virtual void SetPrefillChunkSize(int prefill_chunk_size) = 0;
 
+  /*!
+   * \brief Set the capacity in bytes of the LRU cache of image embeddings on the device.
+   * Being 0 disables the cache.
+   */
+  virtual void SetImageEmbeddingCacheCapacity(int64_t num_bytes) = 0;
+
+  /*!
+   * \brief Release the memory held by the caches of the model, i.e., the cached image embeddings
+   * and the free host chunks of KV swap, which are allocated again on demand.
+   */
+  virtual void ReleaseCachedMemory() = 0;
+
+  /*!
+   * \brief Enable timing the tensor-parallel all-reduce calls of the model functions on
+   * worker 0. It does nothing when the model does not use tensor parallelism.
+   */
+  virtual void EnableAllReduceTiming() = 0;
+
+  /*!
+   * \brief Return the device time in seconds of the timed all-reduce calls since the last call,
+   * which synchronizes the calls. Being 0 when the timing is not enabled.
+   */
+  virtual double TakeAllReduceTime() = 0;
+
+  /*!
+   * \brief Set the batch size buckets of batch decode. It must be called before creating
+   * the KV cache, which additionally reserves the padding sequences for the buckets.
+   * \param buckets The batch size buckets.
+   * \sa GetDecodePaddingSequenceIds
+   */
+  virtual void SetDecodeBatchSizeBuckets(std::vector<int> buckets) = 0;
+
+  /*!
+   * \brief Get the padding sequences to pad a batch decode of the given number of sequences
+   * to the smallest batch size bucket covering it. The padding sequences are appended to
+   * the sequences of `BatchDecode`, which drops their KV data after decode.
+   * \param num_sequence The number of sequences to decode.
+   * \return The ids of padding sequences, which is empty when no padding is needed.
+   */
+  virtual std::vector<int64_t> GetDecodePaddingSequenceIds(int num_sequence) = 0;
+
+  /*!
+   * \brief Get the number of padding sequences to pad a batch decode of the given number of
+   * sequences, without adding the padding sequences. Every padding sequence takes one KV cache
+   * page during the decode.
+   * \param num_sequence The number of sequences to decode.
+   * \sa GetDecodePaddingSequenceIds
+   */
+  virtual int GetNumDecodePaddingSequences(int num_sequence) const = 0;
+
   /*! \brief Create a logit processor from this model. */
   virtual LogitProcessor CreateLogitProcessor(int max_num_token,
                                               Optional<EventTraceRecorder> trace_recorder) = 0;
 
-  /*! \brief Create a sampler from this model. */
+  /*!
+   * \brief Create a sampler from this model.
+   * \param batch_invariant Whether the sampler samples each distribution in the same way
+   * regardless of the other distributions of the batch.
+   */
   virtual Sampler CreateSampler(int max_num_sample, int num_models,
-                                Optional<EventTraceRecorder> trace_recorder) = 0;
+                                Optional<EventTraceRecorder> trace_recorder,
+                                bool batch_invariant) = 0;
 
   /*!
    * \brief Estimate number of CPU units required to drive the model
@@ -0,0 +1,124 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/prefix_affinity_router.cc
+ */
+#include "prefix_affinity_router.h"
+
+#include <tvm/runtime/logging.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+PrefixAffinityRouter::PrefixAffinityRouter(int max_blocks_per_replica, int max_load_imbalance)
+    : max_blocks_per_replica_(max_blocks_per_replica), max_load_imbalance_(max_load_imbalance) {
+  ICHECK_GT(max_blocks_per_replica, 0);
+  ICHECK_GE(max_load_imbalance, 0);
+}
+
+int PrefixAffinityRouter::AddReplica() {
+  replicas_.emplace_back();
+  return static_cast<int>(replicas_.size()) - 1;
+}
+
+std::vector<uint64_t> PrefixAffinityRouter::ComputeBlockHashes(const std::vector<int32_t>& prompt,
+                                                               int block_size) {
+  ICHECK_GT(block_size, 0);
+  std::vector<uint64_t> block_hashes;
+  block_hashes.reserve(prompt.size() / block_size);
+  // FNV-1a over the elements, chained across blocks.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i + block_size <= prompt.size(); i += block_size) {
+    for (size_t j = i; j < i + block_size; ++j) {
+      hash = (hash ^ static_cast<uint32_t>(prompt[j])) * 1099511628211ULL;
+    }
+    block_hashes.push_back(hash);
+  }
+  return block_hashes;
+}
+
+std::pair<int, int> PrefixAffinityRouter::Route(const std::vector<uint64_t>& block_hashes,
+                                                const std::vector<int>& candidates) {
+  ICHECK(!candidates.empty()) << "There is no replica to route the request to.";
+  int64_t min_load = std::numeric_limits<int64_t>::max();
+  for (int replica : candidates) {
+    ICHECK(replica >= 0 && replica < static_cast<int>(replicas_.size()));
+    min_load = std::min(min_load, replicas_[replica].load);
+  }
+
+  int best_replica = -1;
+  int best_num_matched = 0;
+  int64_t best_load = std::numeric_limits<int64_t>::max();
+  int num_candidates = candidates.size();
+  for (int i = 0; i < num_candidates; ++i) {
+    // Rotate the scan start so that the ties of the replicas with no match are spread.
+    int replica = candidates[(num_routed_ + i) % num_candidates];
+    const ReplicaState& state = replicas_[replica];
+    if (state.load > min_load + max_load_imbalance_) {
+      continue;
+    }
+    int num_matched = CountMatchedBlocks(state, block_hashes);
+    if (num_matched > best_num_matched ||
+        (num_matched == best_num_matched && state.load < best_load)) {
+      best_replica = replica;
+      best_num_matched = num_matched;
+      best_load = state.load;
+    }
+  }
+  ICHECK_NE(best_replica, -1);
+
+  ++num_routed_;
+  ++replicas_[best_replica].load;
+  TouchBlocks(&replicas_[best_replica], block_hashes);
+  return {best_replica, best_num_matched};
+}
+
+void PrefixAffinityRouter::Finish(int replica) {
+  ICHECK(replica >= 0 && replica < static_cast<int>(replicas_.size()));
+  ICHECK_GT(replicas_[replica].load, 0);
+  --replicas_[replica].load;
+}
+
+int PrefixAffinityRouter::CountMatchedBlocks(const ReplicaState& replica,
+                                             const std::vector<uint64_t>& block_hashes) const {
+  int num_matched = 0;
+  while (num_matched < static_cast<int>(block_hashes.size()) &&
+         replica.block_last_use.count(block_hashes[num_matched])) {
+    ++num_matched;
+  }
+  return num_matched;
+}
+
+void PrefixAffinityRouter::TouchBlocks(ReplicaState* replica,
+                                       const std::vector<uint64_t>& block_hashes) {
+  // The blocks are touched backwards, so that the deeper blocks of a prompt are evicted first.
+  for (auto it = block_hashes.rbegin(); it != block_hashes.rend(); ++it) {
+    uint64_t block_hash = *it;
+    int64_t stamp = ++use_stamp_;
+    replica->block_last_use[block_hash] = stamp;
+    replica->use_events.emplace_back(block_hash, stamp);
+  }
+  // Pop the stale front events, and evict the LRU blocks when the shadow is full. The LRU block
+  // is also evicted when there are too many stale events behind it, to bound the events.
+  while (!replica->use_events.empty()) {
+    auto [block_hash, stamp] = replica->use_events.front();
+    auto it = replica->block_last_use.find(block_hash);
+    bool is_live = it != replica->block_last_use.end() && it->second == stamp;
+    if (is_live &&
+        static_cast<int>(replica->block_last_use.size()) <= max_blocks_per_replica_ &&
+        static_cast<int64_t>(replica->use_events.size()) <= 2LL * max_blocks_per_replica_) {
+      break;
+    }
+    if (is_live) {
+      replica->block_last_use.erase(it);
+    }
+    replica->use_events.pop_front();
+  }
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
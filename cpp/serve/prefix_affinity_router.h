@@ -0,0 +1,106 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/prefix_affinity_router.h
+ * \brief The router that dispatches requests to engine replicas by prefix affinity.
+ */
+#ifndef MLC_LLM_SERVE_PREFIX_AFFINITY_ROUTER_H_
+#define MLC_LLM_SERVE_PREFIX_AFFINITY_ROUTER_H_
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*!
+ * \brief The router that dispatches requests to the engine replica which most likely has the
+ * longest prefix of the request in its prefix cache, without looking into the engines.
+ * \details The router keeps a shadow of the prefix cache of each replica: the chained hashes of
+ * the prompt blocks recently routed to the replica, in an LRU set of bounded size. A request
+ * goes to the replica with the most leading prompt blocks in its shadow, among the replicas
+ * whose loads are within `max_load_imbalance` of the least loaded one, and ties go to the less
+ * loaded replica. The load of a replica is the number of its unfinished routed requests.
+ *
+ * The router is not thread-safe.
+ */
+class PrefixAffinityRouter {
+ public:
+  /*!
+   * \param max_blocks_per_replica The max number of prompt blocks in the shadow of a replica.
+   * \param max_load_imbalance The max load difference to the least loaded replica for which
+   * the prefix affinity is respected.
+   */
+  explicit PrefixAffinityRouter(int max_blocks_per_replica = 1 << 16, int max_load_imbalance = 8);
+
+  /*! \brief Add a replica to route requests to. Returns the index of the replica. */
+  int AddReplica();
+
+  /*!
+   * \brief Compute the chained hashes of the full blocks of a prompt. The hash of a block
+   * covers all the prompt before the block end, so that equal hashes mean equal prefixes.
+   * \param prompt The prompt, either token ids or bytes.
+   * \param block_size The number of elements per block.
+   */
+  static std::vector<uint64_t> ComputeBlockHashes(const std::vector<int32_t>& prompt,
+                                                  int block_size);
+
+  /*!
+   * \brief Route a request and record its prompt blocks in the shadow of the chosen replica.
+   * The load of the chosen replica is increased by one.
+   * \param block_hashes The block hashes of the request prompt.
+   * \param candidates The indices of the replicas that can serve the request.
+   * \return The pair of the chosen replica and the number of matched prompt blocks.
+   */
+  std::pair<int, int> Route(const std::vector<uint64_t>& block_hashes,
+                            const std::vector<int>& candidates);
+
+  /*! \brief Notify that a request routed to the replica finishes. */
+  void Finish(int replica);
+
+  /*! \brief Return the number of unfinished routed requests of the replica. */
+  int64_t GetLoad(int replica) const { return replicas_[replica].load; }
+
+  /*! \brief Return the number of prompt blocks in the shadow of the replica. */
+  int64_t GetNumBlocks(int replica) const { return replicas_[replica].block_last_use.size(); }
+
+ private:
+  /*! \brief The routing states of a replica. */
+  struct ReplicaState {
+    /*! \brief The number of unfinished routed requests. */
+    int64_t load = 0;
+    /*! \brief The last use stamp of each prompt block in the shadow. */
+    std::unordered_map<uint64_t, int64_t> block_last_use;
+    /*!
+     * \brief The use events of the blocks in stamp order. An event is the latest use of its
+     * block iff its stamp equals the last use stamp, so the front such event is the LRU block.
+     */
+    std::deque<std::pair<uint64_t, int64_t>> use_events;
+  };
+
+  /*! \brief Return the number of leading blocks in the shadow of the replica. */
+  int CountMatchedBlocks(const ReplicaState& replica,
+                         const std::vector<uint64_t>& block_hashes) const;
+  /*! \brief Mark the blocks as most recently used in the shadow, and evict the LRU blocks. */
+  void TouchBlocks(ReplicaState* replica, const std::vector<uint64_t>& block_hashes);
+
+  /*! \brief The max number of prompt blocks in the shadow of a replica. */
+  int max_blocks_per_replica_;
+  /*! \brief The max load difference to the least loaded replica to respect prefix affinity. */
+  int max_load_imbalance_;
+  /*! \brief The routing states of the replicas. */
+  std::vector<ReplicaState> replicas_;
+  /*! \brief The stamp of the latest block use. */
+  int64_t use_stamp_ = 0;
+  /*! \brief The counter to break the ties of replicas with no match and the same load. */
+  int64_t num_routed_ = 0;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_PREFIX_AFFINITY_ROUTER_H_
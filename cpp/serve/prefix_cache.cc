@@ -7,6 +7,14 @@
 #include <tvm/runtime/nvtx.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <map>
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -22,18 +30,46 @@ class PrefixCacheImpl : public PrefixCacheObj {
    * \brief Constructor of paged radix tree.
    * \param max_num_recycling_seqs The maximum number of sequences in prefix cache.
    * \param remove_callback The optional callback function to call when removing a sequence.
+   * \param tier_config The capacity config of the host memory and disk tiers.
+   * \param offload_callbacks The callbacks to offload and restore KV data.
+   * \param eviction_policy The policy to pick the recycling sequence to evict.
+   * \param metrics The metrics to record the lookups and evictions into, or nullptr.
    */
-  explicit PrefixCacheImpl(size_t max_num_recycling_seqs, PrefixCacheRemoveCallback remove_callback)
+  explicit PrefixCacheImpl(size_t max_num_recycling_seqs, PrefixCacheRemoveCallback remove_callback,
+                           PrefixCacheTierConfig tier_config,
+                           PrefixCacheOffloadCallbacks offload_callbacks,
+                           PrefixCacheEvictionPolicy eviction_policy, PrefixCacheMetrics* metrics)
       : radix_tree_(PagedRadixTree::Create()),
         max_num_recycling_seqs_(max_num_recycling_seqs),
-        remove_callback_(std::move(remove_callback)) {
+        remove_callback_(std::move(remove_callback)),
+        tier_config_(std::move(tier_config)),
+        offload_callbacks_(std::move(offload_callbacks)),
+        eviction_policy_(eviction_policy),
+        metrics_(metrics) {
     recycling_seq_lrus_.clear();
     reversed_recycling_seq_lrus_.clear();
     seq_states_.clear();
     seq_sliding_window_infos_.clear();
     lru_counter_ = 0;
+    if (tier_config_.max_num_host_tokens > 0 || !tier_config_.shared_memory_name.empty()) {
+      CHECK(offload_callbacks_.swap_out != nullptr && offload_callbacks_.swap_in != nullptr &&
+            offload_callbacks_.synchronize != nullptr)
+          << "The offload callbacks must be provided when the host memory tier or the shared "
+             "prefix store is enabled.";
+    }
+    if (!tier_config_.shared_memory_name.empty()) {
+      shared_store_ =
+          SharedPrefixStore::Open(tier_config_.shared_memory_name,
+                                  tier_config_.shared_memory_bytes, tier_config_.kv_swap_layout);
+      shared_publish_refill_time_ = std::chrono::steady_clock::now();
+    }
+    if (tier_config_.max_num_disk_tokens > 0 && !tier_config_.disk_path.empty()) {
+      std::filesystem::create_directories(tier_config_.disk_path);
+    }
   }
 
+  ~PrefixCacheImpl() { ClearOffloadedSequences(); }
+
   /*!
    * \brief Insert a new tokenized sequence into Prefix Cache.
    * \param seq_id The sequence ID.
@@ -45,15 +81,38 @@ class PrefixCacheImpl : public PrefixCacheObj {
    */
   PrefixCacheMatchedResult InsertSequence(int64_t seq_id, std::vector<int32_t> tokens,
                                           int sliding_window_size, int attention_sink_size) final {
+    int64_t num_tokens = tokens.size();
+    PrefixCacheMatchedResult result =
+        MatchAndInsertSequence(seq_id, std::move(tokens), sliding_window_size, attention_sink_size);
+    if (metrics_ != nullptr) {
+      metrics_->UpdateLookup(num_tokens, result.prefilled_offset);
+    }
+    return result;
+  }
+
+  /*!
+   * \brief Match the longest prefix of a new sequence, and insert the sequence by reusing a
+   * recycling sequence, forking from a matched sequence or adding a new sequence.
+   */
+  PrefixCacheMatchedResult MatchAndInsertSequence(int64_t seq_id, std::vector<int32_t> tokens,
+                                                  int sliding_window_size,
+                                                  int attention_sink_size) {
     CHECK_NE(sliding_window_size, 0);
     CHECK_GE(attention_sink_size, 0);
     CHECK(seq_states_.find(seq_id) == seq_states_.end());
     CHECK(seq_sliding_window_infos_.find(seq_id) == seq_sliding_window_infos_.end());
     CHECK(!tokens.empty());
     CommitSequenceExtention();
+    PublishPendingSharedSequences();
     tokens.pop_back();
-    auto [matched_offset, matched_seqs] = radix_tree_->MatchPrefix(tokens);
     std::pair<int, size_t> sliding_window_info{sliding_window_size, attention_sink_size};
+    if (sliding_window_size == -1) {
+      // Restore the offloaded sequence into radix tree as a recycling sequence, if it matches a
+      // longer prefix than the sequences in radix tree, so that it can be reused below.
+      RestoreOffloadedSequence(tokens, sliding_window_info);
+      ImportSharedSequence(tokens, sliding_window_info);
+    }
+    auto [matched_offset, matched_seqs] = radix_tree_->MatchPrefix(tokens);
     // No prefix matched, directly adding new sequence.
     if (!matched_offset) {
       radix_tree_->AddSequence(seq_id);
@@ -67,8 +126,13 @@ class PrefixCacheImpl : public PrefixCacheObj {
     // The reusage of recycling sequences logic is different between with/without sliding window
     // enabled.
     if (sliding_window_size != -1) {
-      // If sliding window enabled, the reusage of recycling sequences should be limited to exactly
-      // matched. And no rolling back is allowed due to the sliding window.
+      // If sliding window enabled, a recycling sequence whose window has slid keeps only the
+      // attention sinks and the trailing window of its tokens, so it can only be reused when
+      // exactly matched, with no rolling back. A recycling sequence that has not slid yet still
+      // holds all its tokens, and is reused with rolling back the unmatched trailing tokens,
+      // in the same way as the sequences without sliding window.
+      size_t shortest_unslid_seq_length = 0;
+      int64_t shortest_unslid_seq_id = -1;
       for (int64_t matched_seq_id : matched_seqs) {
         if (seq_states_.at(matched_seq_id) == SequenceState::kRecycling &&
             seq_sliding_window_infos_.at(matched_seq_id) == sliding_window_info) {
@@ -77,8 +141,22 @@ class PrefixCacheImpl : public PrefixCacheObj {
             ReuseRecyclingSequence(matched_seq_id);
             return PrefixCacheMatchedResult{matched_offset, -1, matched_seq_id, 0};
           }
+          if (matched_seq_length <= static_cast<size_t>(sliding_window_size) &&
+              (shortest_unslid_seq_id == -1 || matched_seq_length < shortest_unslid_seq_length)) {
+            shortest_unslid_seq_id = matched_seq_id;
+            shortest_unslid_seq_length = matched_seq_length;
+          }
         }
       }
+      if (shortest_unslid_seq_id != -1 && matched_offset > shortest_unslid_seq_length * 0.9) {
+        ReuseRecyclingSequence(shortest_unslid_seq_id);
+        if (shortest_unslid_seq_length > matched_offset) {
+          radix_tree_->RollBackSequence(shortest_unslid_seq_id,
+                                        shortest_unslid_seq_length - matched_offset);
+        }
+        return PrefixCacheMatchedResult{matched_offset, -1, shortest_unslid_seq_id,
+                                        shortest_unslid_seq_length - matched_offset};
+      }
     } else {
       // If sliding window is not enabled, we can greedily reuse the shortest recycling sequence
       // without sliding window, so that the loss or roll back of trailing tokens will be minimum.
@@ -125,7 +203,14 @@ class PrefixCacheImpl : public PrefixCacheObj {
         }
       }
       if (longest_forking_offset > 0) {
+        // The forked sequence continues in a new KV block. The parent is also split into two
+        // blocks when it is forked in the middle.
+        fragmented_seq_ids_.insert(seq_id);
+        if (longest_forking_offset < radix_tree_->GetSequenceLength(longest_forking_seq_id)) {
+          fragmented_seq_ids_.insert(longest_forking_seq_id);
+        }
         radix_tree_->ForkSequence(seq_id, longest_forking_seq_id, longest_forking_offset);
+        ++seq_num_hits_[longest_forking_seq_id];
         seq_states_.emplace(seq_id, SequenceState::kActive);
         seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
         return PrefixCacheMatchedResult{longest_forking_offset, longest_forking_seq_id, -1, 0};
@@ -197,10 +282,9 @@ class PrefixCacheImpl : public PrefixCacheObj {
         CHECK(TryFreeMemory());
         CHECK_EQ(recycling_seq_lrus_.size(), max_num_recycling_seqs_ - 1);
       }
+      PublishToSharedStore(seq_id);
       seq_states_.at(seq_id) = SequenceState::kRecycling;
-      ++lru_counter_;
-      recycling_seq_lrus_.emplace(seq_id, lru_counter_);
-      reversed_recycling_seq_lrus_.emplace(lru_counter_, seq_id);
+      TrackRecyclingSequence(seq_id);
     } else {
       // Remove the sequence intermediately.
       radix_tree_->RemoveSequence(seq_id);
@@ -209,12 +293,14 @@ class PrefixCacheImpl : public PrefixCacheObj {
       }
       CHECK(seq_states_.erase(seq_id));
       CHECK(seq_sliding_window_infos_.erase(seq_id));
+      seq_num_hits_.erase(seq_id);
+      fragmented_seq_ids_.erase(seq_id);
     }
   }
 
   /*!
-   * \brief Try to remove recycling sequence to free up memory. It will remove the oldest recycling
-   sequence.
+   * \brief Try to remove recycling sequence to free up memory. It will remove the recycling
+   sequence picked by the eviction policy.
    * \return The flag if there is a sequence removed. In other word, return true when memory is
    freed successfully.
    * \throw Error if the given sequence id is not valid.
@@ -225,20 +311,19 @@ class PrefixCacheImpl : public PrefixCacheObj {
       // There is no recycling sequence. No memory can be freed.
       return false;
     }
-    auto [lru, seq_id] = *reversed_recycling_seq_lrus_.begin();
-    CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
-    CHECK_EQ(recycling_seq_lrus_.at(seq_id), lru);
-    radix_tree_->RemoveSequence(seq_id);
-    if (remove_callback_ != nullptr) {
-      remove_callback_(seq_id);
-    }
-    CHECK(seq_states_.erase(seq_id));
-    CHECK(recycling_seq_lrus_.erase(seq_id));
-    CHECK(reversed_recycling_seq_lrus_.erase(lru));
-    CHECK(seq_sliding_window_infos_.erase(seq_id));
+    RemoveRecyclingSequence(PickEvictedSequence(), /*offload=*/true);
     return true;
   }
 
+  void ReleaseRecyclingSequences() final {
+    NVTXScopedRange nvtx_scope("PrefixCache ReleaseRecyclingSequences");
+    while (!reversed_recycling_seq_lrus_.empty()) {
+      RemoveRecyclingSequence(reversed_recycling_seq_lrus_.begin()->second, /*offload=*/false);
+    }
+    ClearOffloadedSequences();
+    pending_shared_seqs_.clear();
+  }
+
   /*!
    * \brief Check if a sequence exists.
    * \param seq_id The sequence ID for index.
@@ -258,11 +343,525 @@ class PrefixCacheImpl : public PrefixCacheObj {
     seq_sliding_window_infos_.clear();
     uncommitted_extended_token_ids_.clear();
     lru_counter_ = 0;
+    seq_num_hits_.clear();
+    recycling_seq_base_priorities_.clear();
+    eviction_clock_ = 0;
+    fragmented_seq_ids_.clear();
+    ClearOffloadedSequences();
+    pending_shared_seqs_.clear();
+  }
+
+  PrefixCacheMode Mode() final {
+    return shared_store_ != nullptr ? PrefixCacheMode::kShared : PrefixCacheMode::kRadix;
   }
 
-  PrefixCacheMode Mode() final { return PrefixCacheMode::kRadix; }
+  int64_t CompactRecyclingSequences(int64_t max_num_tokens) final {
+    if (offload_callbacks_.compact == nullptr) {
+      return 0;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache CompactRecyclingSequences");
+    int64_t num_compacted_tokens = 0;
+    for (auto it = fragmented_seq_ids_.begin(); it != fragmented_seq_ids_.end();) {
+      int64_t seq_id = *it;
+      if (!IsCompactable(seq_id)) {
+        ++it;
+        continue;
+      }
+      int64_t num_tokens = radix_tree_->GetSequenceLength(seq_id);
+      if (num_compacted_tokens > 0 && num_compacted_tokens + num_tokens > max_num_tokens) {
+        break;
+      }
+      offload_callbacks_.compact(seq_id, num_tokens);
+      if (metrics_ != nullptr) {
+        metrics_->UpdateCompaction(num_tokens);
+      }
+      num_compacted_tokens += num_tokens;
+      it = fragmented_seq_ids_.erase(it);
+    }
+    return num_compacted_tokens;
+  }
+
+  bool HasFragmentedRecyclingSequence() final {
+    if (offload_callbacks_.compact == nullptr) {
+      return false;
+    }
+    return std::any_of(fragmented_seq_ids_.begin(), fragmented_seq_ids_.end(),
+                       [this](int64_t seq_id) { return IsCompactable(seq_id); });
+  }
+
+  int64_t SaveSnapshot(const std::vector<int32_t>& tokens, const std::string& file) final {
+    if (offload_callbacks_.swap_out == nullptr) {
+      return 0;
+    }
+    auto [length, seq_ids] = radix_tree_->MatchPrefix(tokens);
+    // Pick a matched sequence without sliding window, whose KV data of the prefix are complete.
+    auto it = std::find_if(seq_ids.begin(), seq_ids.end(), [this](int64_t seq_id) {
+      return seq_sliding_window_infos_.at(seq_id).first == -1;
+    });
+    if (length == 0 || it == seq_ids.end()) {
+      return 0;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache save snapshot");
+    const KVSwapLayout& layout = tier_config_.kv_swap_layout;
+    Array<NDArray> kv_data = Downcast<Array<NDArray>>(offload_callbacks_.swap_out(*it, length));
+    offload_callbacks_.synchronize();
+    if (!layout.Matches(kv_data)) {
+      LOG(WARNING) << "The prefix cache snapshot is not saved to file \"" << file
+                   << "\", since the swapped out KV data are not in the KV layout of the model.";
+      return 0;
+    }
+    // Write to a temporary file first, so that a partially written snapshot is never restored.
+    // Layout: magic, KV layout, num_tokens, num_kv_tokens, tokens, data of each chunk. The chunk
+    // shapes follow from the KV layout and num_kv_tokens.
+    std::string temp_file = file + ".tmp";
+    std::ofstream fout(temp_file, std::ios::binary);
+    auto f_write = [&fout](const void* data, size_t num_bytes) {
+      fout.write(static_cast<const char*>(data), num_bytes);
+    };
+    int64_t num_tokens = length;
+    int64_t num_kv_tokens = 0;
+    for (int i = 0; i < static_cast<int>(kv_data.size()); i += 2) {
+      num_kv_tokens += kv_data[i]->shape[1];
+    }
+    f_write(&kSnapshotMagic, sizeof(kSnapshotMagic));
+    f_write(&layout, sizeof(layout));
+    f_write(&num_tokens, sizeof(num_tokens));
+    f_write(&num_kv_tokens, sizeof(num_kv_tokens));
+    f_write(tokens.data(), length * sizeof(int32_t));
+    for (const NDArray& chunk : kv_data) {
+      f_write(static_cast<const char*>(chunk->data) + chunk->byte_offset,
+              GetDataSize(*chunk.operator->()));
+    }
+    fout.close();
+    if (!fout.good() || std::rename(temp_file.c_str(), file.c_str()) != 0) {
+      LOG(WARNING) << "Failed to save prefix cache snapshot to file \"" << file << "\"";
+      std::remove(temp_file.c_str());
+      return 0;
+    }
+    return length;
+  }
+
+  int64_t RestoreSnapshot(const std::string& file, int64_t max_num_tokens) final {
+    if (offload_callbacks_.swap_in == nullptr) {
+      return 0;
+    }
+    std::error_code ec;
+    uint64_t file_size = std::filesystem::file_size(file, ec);
+    std::ifstream fin(file, std::ios::binary);
+    if (ec || !fin.is_open()) {
+      return 0;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache restore snapshot");
+    auto f_read = [&fin](void* data, size_t num_bytes) {
+      fin.read(static_cast<char*>(data), num_bytes);
+      return fin.good();
+    };
+    const KVSwapLayout& layout = tier_config_.kv_swap_layout;
+    uint64_t magic = 0;
+    KVSwapLayout saved_layout;
+    int64_t num_tokens = 0;
+    int64_t num_kv_tokens = 0;
+    if (!f_read(&magic, sizeof(magic)) || magic != kSnapshotMagic ||
+        !f_read(&saved_layout, sizeof(saved_layout)) || !f_read(&num_tokens, sizeof(num_tokens)) ||
+        !f_read(&num_kv_tokens, sizeof(num_kv_tokens)) || num_tokens <= 0 ||
+        num_kv_tokens < num_tokens) {
+      LOG(WARNING) << "Invalid prefix cache snapshot file \"" << file << "\"";
+      return 0;
+    }
+    if (saved_layout != layout || layout.chunk_size <= 0) {
+      LOG(WARNING) << "The prefix cache snapshot \"" << file << "\" is not restored, since it is "
+                   << "saved by a different model or KV layout.";
+      return 0;
+    }
+    if (num_kv_tokens > max_num_tokens) {
+      LOG(WARNING) << "The prefix cache snapshot \"" << file << "\" of " << num_kv_tokens
+                   << " tokens is not restored, since only " << max_num_tokens
+                   << " tokens can be restored now.";
+      return 0;
+    }
+    // Check the file size against the sizes in the header before allocating anything.
+    uint64_t elem_bytes = (layout.dtype.bits * layout.dtype.lanes + 7) / 8;
+    uint64_t kv_bytes = static_cast<uint64_t>(num_kv_tokens) * 2 * layout.num_layers *
+                        layout.num_kv_heads * layout.head_dim * elem_bytes;
+    uint64_t header_bytes = sizeof(magic) + sizeof(saved_layout) + sizeof(num_tokens) +
+                            sizeof(num_kv_tokens);
+    if (file_size != header_bytes + num_tokens * sizeof(int32_t) + kv_bytes) {
+      LOG(WARNING) << "The prefix cache snapshot file \"" << file << "\" is truncated or corrupt.";
+      return 0;
+    }
+    std::vector<int32_t> tokens(num_tokens);
+    if (!f_read(tokens.data(), num_tokens * sizeof(int32_t))) {
+      LOG(WARNING) << "Failed to read prefix cache snapshot file \"" << file << "\"";
+      return 0;
+    }
+    if (radix_tree_->MatchPrefix(tokens).first >= tokens.size()) {
+      // The saved prefix is still cached.
+      return 0;
+    }
+    Array<NDArray> kv_data;
+    for (int64_t begin = 0; begin < num_kv_tokens; begin += layout.chunk_size) {
+      ShapeTuple shape = layout.ChunkShape(std::min(layout.chunk_size, num_kv_tokens - begin));
+      for (int kv = 0; kv < 2; ++kv) {
+        NDArray chunk = NDArray::Empty(shape, layout.dtype, Device{kDLCPU, 0});
+        if (!f_read(chunk->data, GetDataSize(*chunk.operator->()))) {
+          LOG(WARNING) << "Failed to read prefix cache snapshot file \"" << file << "\"";
+          return 0;
+        }
+        kv_data.push_back(chunk);
+      }
+    }
+    if (!AddRestoredSequence(kv_data, tokens, {-1, 0})) {
+      LOG(WARNING) << "The prefix cache snapshot \"" << file << "\" is not restored, since the KV "
+                   << "cache does not have enough free pages.";
+      return 0;
+    }
+    return num_tokens;
+  }
 
  private:
+  /*!
+   * \brief The magic number at the beginning of the snapshot files, bumped with the snapshot
+   * layout.
+   */
+  static constexpr uint64_t kSnapshotMagic = 0x3230304B53434C4DULL;  // "MLCSK002"
+
+  /*! \brief The evicted sequence whose KV data is offloaded to host memory or disk. */
+  struct OffloadedSequence {
+    /*! \brief The tokens of the sequence. */
+    std::vector<int32_t> tokens;
+    /*! \brief The KV data on host memory, or NullOpt when the KV data is on disk. */
+    Optional<ObjectRef> host_kv_data;
+    /*! \brief The file storing the KV data on disk. */
+    std::string disk_file;
+    /*! \brief The shapes of the KV data chunks stored on disk. */
+    std::vector<ShapeTuple> disk_chunk_shapes;
+    /*! \brief The data type of the KV data stored on disk. */
+    DLDataType disk_dtype;
+  };
+
+  /*!
+   * \brief Offload the KV data of the given recycling sequence to host memory before it is
+   * removed, when the host memory tier is enabled.
+   */
+  void OffloadSequence(int64_t seq_id) {
+    if (tier_config_.max_num_host_tokens <= 0 || seq_sliding_window_infos_.at(seq_id).first != -1) {
+      return;
+    }
+    int64_t length = radix_tree_->GetSequenceLength(seq_id);
+    if (length == 0 || length > tier_config_.max_num_host_tokens) {
+      return;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache offload sequence");
+    IntTuple tokens = radix_tree_->GetSequence(seq_id);
+    OffloadedSequence offloaded;
+    offloaded.tokens = std::vector<int32_t>(tokens.begin(), tokens.end());
+    offloaded.host_kv_data = offload_callbacks_.swap_out(seq_id, length);
+    offloaded_seqs_.push_front(std::move(offloaded));
+    num_host_tokens_ += length;
+
+    // Demote the least recently offloaded sequences on host memory to disk when the
+    // host memory tier runs out of capacity, and drop them when disk tier is disabled.
+    for (auto it = offloaded_seqs_.end();
+         num_host_tokens_ > tier_config_.max_num_host_tokens && it != offloaded_seqs_.begin();) {
+      --it;
+      if (!it->host_kv_data.defined()) {
+        continue;
+      }
+      if (!DemoteToDisk(&*it)) {
+        it = EraseOffloadedSequence(it);
+      }
+    }
+    // Drop the least recently offloaded sequences on disk when disk tier runs out of capacity.
+    for (auto it = offloaded_seqs_.end();
+         num_disk_tokens_ > tier_config_.max_num_disk_tokens && it != offloaded_seqs_.begin();) {
+      --it;
+      if (!it->host_kv_data.defined()) {
+        it = EraseOffloadedSequence(it);
+      }
+    }
+  }
+
+  /*!
+   * \brief Find the offloaded sequence with the longest common prefix with the given tokens. If the
+   * prefix is longer than the prefix matched in radix tree, restore the KV data of the prefix into
+   * a new recycling sequence.
+   */
+  void RestoreOffloadedSequence(const std::vector<int32_t>& tokens,
+                                const std::pair<int, size_t>& sliding_window_info) {
+    if (offloaded_seqs_.empty()) {
+      return;
+    }
+    size_t longest_offset = 0;
+    auto longest_it = offloaded_seqs_.end();
+    for (auto it = offloaded_seqs_.begin(); it != offloaded_seqs_.end(); ++it) {
+      size_t offset =
+          std::mismatch(it->tokens.begin(), it->tokens.end(), tokens.begin(), tokens.end()).first -
+          it->tokens.begin();
+      if (offset > longest_offset) {
+        longest_offset = offset;
+        longest_it = it;
+      }
+    }
+    if (longest_it == offloaded_seqs_.end() ||
+        longest_offset <= radix_tree_->MatchPrefix(tokens).first) {
+      return;
+    }
+    // The whole offloaded sequence bounds the KV data chunks restored for the prefix. When the KV
+    // cache cannot hold them, keep the offloaded sequence and let the prefix be recomputed.
+    if (!CanRestore(longest_it->tokens.size())) {
+      return;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache restore sequence");
+    OffloadedSequence offloaded = std::move(*longest_it);
+    if (offloaded.host_kv_data.defined()) {
+      num_host_tokens_ -= offloaded.tokens.size();
+    } else {
+      num_disk_tokens_ -= offloaded.tokens.size();
+    }
+    offloaded_seqs_.erase(longest_it);
+    Array<NDArray> kv_data;
+    if (offloaded.host_kv_data.defined()) {
+      kv_data = Downcast<Array<NDArray>>(offloaded.host_kv_data.value());
+    } else {
+      kv_data = LoadFromDisk(offloaded);
+      std::remove(offloaded.disk_file.c_str());
+    }
+    offloaded.tokens.resize(longest_offset);
+    AddRestoredSequence(kv_data, offloaded.tokens, sliding_window_info);
+  }
+
+  /*!
+   * \brief Check if the KV data of the given number of tokens can be restored as a new recycling
+   * sequence, which needs a recycling sequence slot and enough free KV cache pages.
+   */
+  bool CanRestore(int64_t num_tokens) {
+    if (max_num_recycling_seqs_ == 0 ||
+        (recycling_seq_lrus_.size() == max_num_recycling_seqs_ &&
+         reversed_recycling_seq_lrus_.empty())) {
+      return false;
+    }
+    return offload_callbacks_.has_capacity == nullptr ||
+           offload_callbacks_.has_capacity(num_tokens);
+  }
+
+  /*!
+   * \brief Restore the given KV data into a new recycling sequence of the given tokens.
+   * \param kv_data The host KV data chunks to restore, whose leading tokens are the given tokens.
+   * \param tokens The tokens of the restored sequence.
+   * \param sliding_window_info The sliding window information of the restored sequence.
+   * \return The flag if the sequence is restored. The restoration is skipped when the KV cache
+   * cannot hold the KV data, in which case the prefix is recomputed.
+   */
+  bool AddRestoredSequence(Array<NDArray> kv_data, const std::vector<int32_t>& tokens,
+                           const std::pair<int, size_t>& sliding_window_info) {
+    // Only restore the KV data chunks covering the tokens.
+    int64_t num_tokens = 0;
+    int num_chunks = 0;
+    while (num_tokens < static_cast<int64_t>(tokens.size()) &&
+           num_chunks < static_cast<int>(kv_data.size())) {
+      num_tokens += kv_data[num_chunks]->shape[1];
+      num_chunks += 2;
+    }
+    if (num_tokens < static_cast<int64_t>(tokens.size())) {
+      LOG(WARNING) << "The KV data to restore cover " << num_tokens << " tokens, fewer than the "
+                   << tokens.size() << " tokens of the sequence. Skip the restoration.";
+      return false;
+    }
+    if (num_chunks < static_cast<int>(kv_data.size())) {
+      kv_data = Array<NDArray>(kv_data.begin(), kv_data.begin() + num_chunks);
+    }
+    if (!CanRestore(num_tokens)) {
+      return false;
+    }
+    // Make room for the restored sequence among the recycling sequences.
+    if (recycling_seq_lrus_.size() == max_num_recycling_seqs_ && !TryFreeMemory()) {
+      return false;
+    }
+    int64_t seq_id = offload_callbacks_.swap_in(kv_data, num_tokens - tokens.size());
+    radix_tree_->AddSequence(seq_id);
+    radix_tree_->ExtendSequence(seq_id, tokens);
+    seq_states_.emplace(seq_id, SequenceState::kRecycling);
+    seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
+    TrackRecyclingSequence(seq_id);
+    return true;
+  }
+
+  /*!
+   * \brief Copy the KV data of the given sequence out, to be published to the shared prefix
+   * store later, when the shared store does not have the sequence yet.
+   */
+  void PublishToSharedStore(int64_t seq_id) {
+    if (shared_store_ == nullptr || seq_sliding_window_infos_.at(seq_id).first != -1) {
+      return;
+    }
+    int64_t length = radix_tree_->GetSequenceLength(seq_id);
+    if (length < kMinSharedSequenceLength) {
+      return;
+    }
+    // The device-to-host copies of the published sequences are budgeted by a token bucket, so
+    // that recycling many sequences does not flood the copy stream and the host memory.
+    auto now = std::chrono::steady_clock::now();
+    double elapsed_seconds =
+        std::chrono::duration<double>(now - shared_publish_refill_time_).count();
+    shared_publish_refill_time_ = now;
+    shared_publish_budget_ =
+        std::min(static_cast<double>(kSharedPublishBudgetNumTokens),
+                 shared_publish_budget_ + elapsed_seconds * kSharedPublishBudgetNumTokens);
+    if (length > shared_publish_budget_) {
+      return;
+    }
+    IntTuple tokens_tuple = radix_tree_->GetSequence(seq_id);
+    std::vector<int32_t> tokens(tokens_tuple.begin(), tokens_tuple.end());
+    if (shared_store_->HasSequence(tokens)) {
+      return;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache copy out sequence to share");
+    ObjectRef kv_data = offload_callbacks_.swap_out(seq_id, length);
+    pending_shared_seqs_.emplace_back(std::move(tokens), std::move(kv_data));
+    shared_publish_budget_ -= length;
+  }
+
+  /*!
+   * \brief Publish the pending sequences to the shared prefix store. It is deferred from
+   * `PublishToSharedStore`, so that the device-to-host copies overlap with the model execution.
+   */
+  void PublishPendingSharedSequences() {
+    if (pending_shared_seqs_.empty()) {
+      return;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache publish shared sequences");
+    offload_callbacks_.synchronize();
+    for (const auto& [tokens, kv_data] : pending_shared_seqs_) {
+      shared_store_->Publish(tokens, Downcast<Array<NDArray>>(kv_data));
+    }
+    pending_shared_seqs_.clear();
+  }
+
+  /*!
+   * \brief Import the sequence in the shared prefix store which matches a longer prefix with the
+   * given tokens than the sequences in radix tree, as a new recycling sequence.
+   */
+  void ImportSharedSequence(const std::vector<int32_t>& tokens,
+                            const std::pair<int, size_t>& sliding_window_info) {
+    if (shared_store_ == nullptr) {
+      return;
+    }
+    size_t matched_offset = radix_tree_->MatchPrefix(tokens).first;
+    auto [shared_offset, kv_data] = shared_store_->MatchAndImport(tokens, matched_offset);
+    if (!kv_data.defined()) {
+      return;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache import shared sequence");
+    AddRestoredSequence(kv_data.value(),
+                        std::vector<int32_t>(tokens.begin(), tokens.begin() + shared_offset),
+                        sliding_window_info);
+  }
+
+  /*!
+   * \brief Write the KV data of the given offloaded sequence from host memory to disk.
+   * \return The flag if the KV data is written to disk successfully.
+   */
+  bool DemoteToDisk(OffloadedSequence* offloaded) {
+    int64_t length = offloaded->tokens.size();
+    if (tier_config_.disk_path.empty() || length > tier_config_.max_num_disk_tokens) {
+      return false;
+    }
+    NVTXScopedRange nvtx_scope("PrefixCache demote sequence to disk");
+    Array<NDArray> kv_data = Downcast<Array<NDArray>>(offloaded->host_kv_data.value());
+    // The host KV data may still be being copied out from device.
+    offload_callbacks_.synchronize();
+    std::string file = tier_config_.disk_path + "/prefix_cache_" +
+                       std::to_string(disk_file_counter_++) + ".kv";
+    std::vector<ShapeTuple> chunk_shapes;
+    chunk_shapes.reserve(kv_data.size());
+    std::ofstream fout(file, std::ios::binary);
+    for (const NDArray& chunk : kv_data) {
+      fout.write(static_cast<const char*>(chunk->data) + chunk->byte_offset,
+                 GetDataSize(*chunk.operator->()));
+      chunk_shapes.push_back(chunk.Shape());
+    }
+    fout.close();
+    if (!fout.good()) {
+      // Failed to write to disk, e.g., when the disk is full.
+      LOG(WARNING) << "Failed to offload prefix cache to file \"" << file << "\"";
+      std::remove(file.c_str());
+      return false;
+    }
+    offloaded->disk_chunk_shapes = std::move(chunk_shapes);
+    offloaded->disk_dtype = kv_data[0]->dtype;
+    offloaded->disk_file = std::move(file);
+    offloaded->host_kv_data = NullOpt;
+    num_host_tokens_ -= length;
+    num_disk_tokens_ += length;
+    return true;
+  }
+
+  /*! \brief Read the KV data of the given offloaded sequence from disk to host memory. */
+  Array<NDArray> LoadFromDisk(const OffloadedSequence& offloaded) {
+    std::ifstream fin(offloaded.disk_file, std::ios::binary);
+    CHECK(fin.is_open()) << "Cannot open prefix cache file \"" << offloaded.disk_file << "\"";
+    Array<NDArray> kv_data;
+    kv_data.reserve(offloaded.disk_chunk_shapes.size());
+    for (const ShapeTuple& shape : offloaded.disk_chunk_shapes) {
+      NDArray chunk = NDArray::Empty(shape, offloaded.disk_dtype, Device{kDLCPU, 0});
+      fin.read(static_cast<char*>(chunk->data), GetDataSize(*chunk.operator->()));
+      kv_data.push_back(chunk);
+    }
+    CHECK(fin.good()) << "Failed to read prefix cache file \"" << offloaded.disk_file << "\"";
+    return kv_data;
+  }
+
+  /*! \brief Erase the given offloaded sequence and return the iterator following it. */
+  std::list<OffloadedSequence>::iterator EraseOffloadedSequence(
+      std::list<OffloadedSequence>::iterator it) {
+    if (it->host_kv_data.defined()) {
+      num_host_tokens_ -= it->tokens.size();
+    } else {
+      num_disk_tokens_ -= it->tokens.size();
+      if (!it->disk_file.empty()) {
+        std::remove(it->disk_file.c_str());
+      }
+    }
+    return offloaded_seqs_.erase(it);
+  }
+
+  /*! \brief Clear all the offloaded sequences and their files on disk. */
+  void ClearOffloadedSequences() {
+    for (auto it = offloaded_seqs_.begin(); it != offloaded_seqs_.end();) {
+      it = EraseOffloadedSequence(it);
+    }
+    CHECK_EQ(num_host_tokens_, 0);
+    CHECK_EQ(num_disk_tokens_, 0);
+  }
+
+  /*!
+   * \brief Remove a recycling sequence from prefix cache and KV cache.
+   * \param seq_id The recycling sequence to remove.
+   * \param offload Whether to offload its KV data to the lower storage tiers first.
+   */
+  void RemoveRecyclingSequence(int64_t seq_id, bool offload) {
+    size_t lru = recycling_seq_lrus_.at(seq_id);
+    CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
+    CHECK_EQ(reversed_recycling_seq_lrus_.at(lru), seq_id);
+    if (metrics_ != nullptr) {
+      metrics_->UpdateEviction(radix_tree_->GetSequenceExclusiveLength(seq_id));
+    }
+    if (offload) {
+      OffloadSequence(seq_id);
+    }
+    radix_tree_->RemoveSequence(seq_id);
+    if (remove_callback_ != nullptr) {
+      remove_callback_(seq_id);
+    }
+    CHECK(seq_states_.erase(seq_id));
+    CHECK(recycling_seq_lrus_.erase(seq_id));
+    CHECK(reversed_recycling_seq_lrus_.erase(lru));
+    CHECK(seq_sliding_window_infos_.erase(seq_id));
+    recycling_seq_base_priorities_.erase(seq_id);
+    seq_num_hits_.erase(seq_id);
+    fragmented_seq_ids_.erase(seq_id);
+  }
+
   void ReuseRecyclingSequence(int64_t seq_id) {
     CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
     size_t lru = recycling_seq_lrus_.at(seq_id);
@@ -270,6 +869,65 @@ class PrefixCacheImpl : public PrefixCacheObj {
     seq_states_.at(seq_id) = SequenceState::kActive;
     CHECK(recycling_seq_lrus_.erase(seq_id));
     CHECK(reversed_recycling_seq_lrus_.erase(lru));
+    recycling_seq_base_priorities_.erase(seq_id);
+    ++seq_num_hits_[seq_id];
+  }
+
+  /*!
+   * \brief Check whether a fragmented sequence can be compacted, which requires the sequence to be
+   * recycling and share no prefix with the other sequences.
+   */
+  bool IsCompactable(int64_t seq_id) {
+    if (seq_states_.at(seq_id) != SequenceState::kRecycling) {
+      return false;
+    }
+    size_t length = radix_tree_->GetSequenceLength(seq_id);
+    return length > 0 && radix_tree_->GetSequenceExclusiveLength(seq_id) == length;
+  }
+
+  /*! \brief Record the LRU time stamp and the base eviction priority of a recycling sequence. */
+  void TrackRecyclingSequence(int64_t seq_id) {
+    ++lru_counter_;
+    recycling_seq_lrus_.emplace(seq_id, lru_counter_);
+    reversed_recycling_seq_lrus_.emplace(lru_counter_, seq_id);
+    // The base priority ages the priorities of the sequences recycled earlier.
+    recycling_seq_base_priorities_[seq_id] = eviction_clock_;
+  }
+
+  /*! \brief Pick the recycling sequence to evict under the eviction policy. */
+  int64_t PickEvictedSequence() {
+    CHECK(!reversed_recycling_seq_lrus_.empty());
+    if (eviction_policy_ == PrefixCacheEvictionPolicy::kLRU) {
+      return reversed_recycling_seq_lrus_.begin()->second;
+    }
+    // The priority of a recycling sequence is its base priority plus its number of hits times
+    // the recompute cost per token freed by the eviction. The tokens shared with the other
+    // sequences are neither freed nor recomputed. The sequence with the lowest priority is
+    // evicted, and the clock advances to its priority, so that the sequences not hit for long
+    // are eventually evicted.
+    int64_t evicted_seq_id = -1;
+    double min_priority = 0;
+    for (const auto& [lru, seq_id] : reversed_recycling_seq_lrus_) {
+      size_t num_freed_tokens = radix_tree_->GetSequenceExclusiveLength(seq_id);
+      double cost_per_token = 0;
+      if (num_freed_tokens > 0) {
+        // The attention cost of a token grows with its position, so the freed tokens cost
+        // more to recompute at the tail of a longer sequence.
+        size_t length = radix_tree_->GetSequenceLength(seq_id);
+        cost_per_token = 1.0 + static_cast<double>(2 * length - num_freed_tokens) /
+                                   (2.0 * kAttentionCostEqualLength);
+      }
+      auto it = seq_num_hits_.find(seq_id);
+      int64_t num_hits = it == seq_num_hits_.end() ? 0 : it->second;
+      double priority = recycling_seq_base_priorities_.at(seq_id) + (1 + num_hits) * cost_per_token;
+      // The sequences are visited from the least recently used, which wins the ties.
+      if (evicted_seq_id == -1 || priority < min_priority) {
+        evicted_seq_id = seq_id;
+        min_priority = priority;
+      }
+    }
+    eviction_clock_ = min_priority;
+    return evicted_seq_id;
   }
 
   /*!
@@ -299,7 +957,7 @@ class PrefixCacheImpl : public PrefixCacheObj {
    * \brief The map from LRU time stamps to sequence, used to find the sequence with earliest LRU
    * time stamp.
    */
-  std::unordered_map<size_t, int64_t> reversed_recycling_seq_lrus_;
+  std::map<size_t, int64_t> reversed_recycling_seq_lrus_;
   /*!
    * \brief The maximum number of recycling sequences in prefix cache. Set -1 as infinite prefix
    * cache.
@@ -309,6 +967,26 @@ class PrefixCacheImpl : public PrefixCacheObj {
    * \brief The LRU counter.
    */
   size_t lru_counter_ = 0;
+  /*! \brief The policy to pick the recycling sequence to evict. */
+  PrefixCacheEvictionPolicy eviction_policy_;
+  /*! \brief The metrics to record the lookups and evictions into, or nullptr. */
+  PrefixCacheMetrics* metrics_;
+  /*! \brief The number of times each sequence is reused or forked from. */
+  std::unordered_map<int64_t, int64_t> seq_num_hits_;
+  /*! \brief The base eviction priority of each recycling sequence under the cost-aware policy. */
+  std::unordered_map<int64_t, double> recycling_seq_base_priorities_;
+  /*! \brief The eviction priority of the last evicted sequence, which ages the priorities. */
+  double eviction_clock_ = 0;
+  /*!
+   * \brief The sequences whose KV data may span several blocks due to forking, which are to be
+   * compacted once they are recycling and share no prefix with other sequences.
+   */
+  std::unordered_set<int64_t> fragmented_seq_ids_;
+  /*!
+   * \brief The sequence length at which the attention cost of a token is estimated to equal its
+   * other costs in prefill.
+   */
+  static constexpr double kAttentionCostEqualLength = 4096;
   /*!
    * \brief The callback function to call when removing a sequence. This can be used to
    * removing sequence in KVCache and return sequence ID to ID manager lazily
@@ -334,6 +1012,36 @@ class PrefixCacheImpl : public PrefixCacheObj {
    * each action, to avoid the uncaught changes of uncomitted extended token ids.
    */
   std::vector<std::pair<int64_t, const std::vector<int32_t>&>> uncommitted_extended_token_ids_;
+  /*! \brief The capacity config of the host memory and disk tiers. */
+  PrefixCacheTierConfig tier_config_;
+  /*! \brief The callbacks to offload and restore the KV data of evicted sequences. */
+  PrefixCacheOffloadCallbacks offload_callbacks_;
+  /*!
+   * \brief The offloaded sequences on host memory and disk, ordered from the most recently
+   * offloaded to the least recently offloaded.
+   */
+  std::list<OffloadedSequence> offloaded_seqs_;
+  /*! \brief The total number of tokens of the offloaded sequences on host memory. */
+  int64_t num_host_tokens_ = 0;
+  /*! \brief The total number of tokens of the offloaded sequences on disk. */
+  int64_t num_disk_tokens_ = 0;
+  /*! \brief The counter to name the files of offloaded sequences on disk. */
+  int64_t disk_file_counter_ = 0;
+  /*! \brief The prefix store shared with other engine processes, or nullptr if disabled. */
+  std::unique_ptr<SharedPrefixStore> shared_store_;
+  /*! \brief The sequences and their host KV data pending to be published to the shared store. */
+  std::vector<std::pair<std::vector<int32_t>, ObjectRef>> pending_shared_seqs_;
+  /*! \brief The remaining number of tokens that can be copied out to publish. */
+  double shared_publish_budget_ = kSharedPublishBudgetNumTokens;
+  /*! \brief The last time the publish budget is refilled. */
+  std::chrono::steady_clock::time_point shared_publish_refill_time_;
+  /*! \brief The minimum length of sequences to publish to the shared store. */
+  static constexpr int64_t kMinSharedSequenceLength = 64;
+  /*!
+   * \brief The number of tokens refilled to the publish budget every second, which is also the
+   * capacity of the budget. Longer sequences are not published.
+   */
+  static constexpr int64_t kSharedPublishBudgetNumTokens = 16384;
 };  // namespace serve
 
 TVM_REGISTER_OBJECT_TYPE(PrefixCacheImpl);
@@ -406,6 +1114,8 @@ class NoPrefixCache : public PrefixCacheObj {
     return false;
   }
 
+  void ReleaseRecyclingSequences() final {}
+
   /*!
    * \brief Check if a sequence exists.
    * \param seq_id The sequence ID for index.
@@ -422,14 +1132,29 @@ class NoPrefixCache : public PrefixCacheObj {
   void Reset() final {}
 
   PrefixCacheMode Mode() final { return PrefixCacheMode::kDisable; }
+
+  int64_t CompactRecyclingSequences(int64_t max_num_tokens) final { return 0; }
+
+  bool HasFragmentedRecyclingSequence() final { return false; }
+
+  int64_t SaveSnapshot(const std::vector<int32_t>& tokens, const std::string& file) final {
+    return 0;
+  }
+
+  int64_t RestoreSnapshot(const std::string& file, int64_t max_num_tokens) final { return 0; }
 };
 
 TVM_REGISTER_OBJECT_TYPE(NoPrefixCache);
 
 PrefixCache PrefixCache::CreateRadixPrefixCache(size_t max_num_recycling_seqs,
-                                                PrefixCacheRemoveCallback remove_callback) {
-  ObjectPtr<PrefixCacheImpl> n =
-      make_object<PrefixCacheImpl>(max_num_recycling_seqs, std::move(remove_callback));
+                                                PrefixCacheRemoveCallback remove_callback,
+                                                PrefixCacheTierConfig tier_config,
+                                                PrefixCacheOffloadCallbacks offload_callbacks,
+                                                PrefixCacheEvictionPolicy eviction_policy,
+                                                PrefixCacheMetrics* metrics) {
+  ObjectPtr<PrefixCacheImpl> n = make_object<PrefixCacheImpl>(
+      max_num_recycling_seqs, std::move(remove_callback), std::move(tier_config),
+      std::move(offload_callbacks), eviction_policy, metrics);
   return PrefixCache(std::move(n));
 }
 
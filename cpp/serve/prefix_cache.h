@@ -10,12 +10,15 @@
 
 #include <functional>
 #include <optional>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "metrics.h"
 #include "model.h"
 #include "radix_tree.h"
 #include "request_state.h"
+#include "shared_prefix_store.h"
 
 namespace mlc {
 namespace llm {
@@ -28,6 +31,57 @@ using namespace tvm::runtime;
  */
 using PrefixCacheRemoveCallback = std::function<void(int64_t)>;
 
+/*!
+ * \brief The callbacks for prefix cache to offload the KV data of evicted sequences
+ * to the lower storage tiers (host memory and disk), and to restore them back.
+ */
+struct PrefixCacheOffloadCallbacks {
+  /*!
+   * \brief Copy the KV data of the given sequence with the given number of tokens
+   * out to host memory, and return the host KV data.
+   */
+  std::function<ObjectRef(int64_t seq_id, int64_t num_tokens)> swap_out = nullptr;
+  /*!
+   * \brief Restore the given host KV data into a new sequence, pop the given number of
+   * trailing tokens from it, and return the new sequence ID.
+   */
+  std::function<int64_t(ObjectRef kv_data, int64_t num_pop_tokens)> swap_in = nullptr;
+  /*! \brief Block until all issued host copies complete, so that the host KV data can be read. */
+  std::function<void()> synchronize = nullptr;
+  /*!
+   * \brief Copy the KV data of the given sequence with the given number of tokens into fresh
+   * pages of the KV cache under the same sequence ID, releasing its old pages.
+   */
+  std::function<void(int64_t seq_id, int64_t num_tokens)> compact = nullptr;
+  /*!
+   * \brief Check if the KV cache has enough free pages to restore the KV data of the given number
+   * of tokens. The restoration is skipped when it returns false, and the prefix is recomputed.
+   */
+  std::function<bool(int64_t num_tokens)> has_capacity = nullptr;
+};
+
+/*! \brief The capacity config of the lower storage tiers of prefix cache. */
+struct PrefixCacheTierConfig {
+  /*! \brief The maximum number of tokens whose KV data are offloaded to host memory. */
+  int64_t max_num_host_tokens = 0;
+  /*! \brief The maximum number of tokens whose KV data are offloaded to disk. */
+  int64_t max_num_disk_tokens = 0;
+  /*! \brief The directory to store the KV data offloaded to disk. */
+  std::string disk_path;
+  /*!
+   * \brief The name of the host shared memory storing prefixes shared with the engines
+   * in other processes. Empty means the shared prefix store is disabled.
+   */
+  std::string shared_memory_name;
+  /*! \brief The capacity of the host shared memory in bytes. */
+  int64_t shared_memory_bytes = 0;
+  /*!
+   * \brief The layout and model identity of the swapped-out KV data, which the KV data imported
+   * from the shared prefix store or restored from snapshots are validated against.
+   */
+  KVSwapLayout kv_swap_layout;
+};
+
 /*!
  * \brief The matched result from prefix cache. This result describes how to pre-process the new
  * sequence, to leverage the existing data in KVCache by reusing past sequences or forking from
@@ -99,14 +153,20 @@ class PrefixCacheObj : public Object {
   virtual void RecycleSequence(int64_t seq_id, bool lazy = true) = 0;
 
   /*!
-   * \brief Try to remove recycling sequence to free up memory. It will remove the oldest recycling
-   sequence.
+   * \brief Try to remove recycling sequence to free up memory. It will remove the recycling
+   sequence picked by the eviction policy, which is the oldest one under the LRU policy.
    * \return The flag if there is a sequence removed. In other word, return true when memory is
    freed successfully.
    * \throw Error if the given sequence id is not valid.
    */
   virtual bool TryFreeMemory() = 0;
 
+  /*!
+   * \brief Remove all the recycling sequences without offloading them, and drop the offloaded
+   * sequences in the lower storage tiers, releasing their memory under memory pressure.
+   */
+  virtual void ReleaseRecyclingSequences() = 0;
+
   /*!
    * \brief Check if a sequence exists.
    * \param seq_id The sequence ID for index.
@@ -123,6 +183,39 @@ class PrefixCacheObj : public Object {
   /*! \brief Return the prefix cache mode. */
   virtual PrefixCacheMode Mode() = 0;
 
+  /*!
+   * \brief Compact the KV data of the fragmented recycling sequences. A sequence is fragmented
+   * when its KV data span several blocks due to forking, each of which may end with a partially
+   * filled page. Only the sequences sharing no prefix with others are compacted, so that the
+   * cached prefixes are kept without extra memory.
+   * \param max_num_tokens The maximum number of tokens to compact. The sequence exceeding the
+   * budget is still compacted when no other sequence is compacted in this call.
+   * \return The number of compacted tokens.
+   */
+  virtual int64_t CompactRecyclingSequences(int64_t max_num_tokens) = 0;
+
+  /*! \brief Return whether there is any fragmented recycling sequence to compact. */
+  virtual bool HasFragmentedRecyclingSequence() = 0;
+
+  /*!
+   * \brief Save the KV data of the longest cached prefix of the given tokens to a file, along
+   * with the tokens of the prefix, so that the prefix can be restored after it is evicted.
+   * \param tokens The tokens whose cached prefix is saved.
+   * \param file The file to save the snapshot to.
+   * \return The number of saved tokens, or 0 when no prefix is saved.
+   */
+  virtual int64_t SaveSnapshot(const std::vector<int32_t>& tokens, const std::string& file) = 0;
+
+  /*!
+   * \brief Restore the prefix saved by `SaveSnapshot` in the given file as a recycling sequence,
+   * unless a longer prefix of the saved tokens is already cached. Snapshots saved by a different
+   * model or KV layout, and truncated or corrupt snapshots, are skipped with a warning.
+   * \param file The snapshot file to restore.
+   * \param max_num_tokens The maximum number of tokens whose KV data can be restored.
+   * \return The number of restored tokens, or 0 when nothing is restored.
+   */
+  virtual int64_t RestoreSnapshot(const std::string& file, int64_t max_num_tokens) = 0;
+
   static constexpr const uint32_t _type_index = TypeIndex::kDynamic;
   static constexpr const char* _type_key = "mlc.serve.PrefixCache";
   TVM_DECLARE_BASE_OBJECT_INFO(PrefixCacheObj, Object)
@@ -136,9 +229,19 @@ class PrefixCache : public ObjectRef {
    * \brief Initialization of prefix cache.
    * \param max_recycling_seqs The maximum number of recycling sequences in prefix cache.
    * \param remove_callback The optional callback function to call when removing a sequence.
+   * \param tier_config The capacity config of the host memory and disk tiers. The evicted
+   * recycling sequences are offloaded to these tiers, and restored when matched again.
+   * \param offload_callbacks The callbacks to offload and restore KV data, which must be
+   * provided when the host memory tier is enabled.
+   * \param eviction_policy The policy to pick the recycling sequence to evict.
+   * \param metrics The metrics to record the lookups and evictions into, or nullptr. It must
+   * outlive the prefix cache.
    */
-  static PrefixCache CreateRadixPrefixCache(size_t max_recycling_seqs,
-                                            PrefixCacheRemoveCallback remove_callback = nullptr);
+  static PrefixCache CreateRadixPrefixCache(
+      size_t max_recycling_seqs, PrefixCacheRemoveCallback remove_callback = nullptr,
+      PrefixCacheTierConfig tier_config = {}, PrefixCacheOffloadCallbacks offload_callbacks = {},
+      PrefixCacheEvictionPolicy eviction_policy = PrefixCacheEvictionPolicy::kLRU,
+      PrefixCacheMetrics* metrics = nullptr);
   /*!
    * \brief Initialization of no prefix cache.
    */
@@ -6,6 +6,8 @@
 
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -31,10 +33,7 @@ struct SequenceIDNode {
 class SequenceIDNodePool {
  public:
   /*! \brief The constructor of sequence ID node pool, allocating a new sequence ID node block. */
-  SequenceIDNodePool() {
-    NewNodeBlock_();
-    used_nodes_.clear();
-  }
+  SequenceIDNodePool() { NewNodeBlock_(); }
 
   /*!
    * \brief Get a sequence ID node from pool, and assign the fields.
@@ -44,14 +43,12 @@ class SequenceIDNodePool {
    * \return The allocated radix page.
    */
   SequenceIDNode* Allocate(int64_t seq_id, SequenceIDNode* next) {
-    if (free_node_indices_.empty()) {
+    if (free_nodes_.empty()) {
       NewNodeBlock_();
-      CHECK(!free_node_indices_.empty());
+      CHECK(!free_nodes_.empty());
     }
-    size_t id = free_node_indices_.back();
-    free_node_indices_.pop_back();
-    SequenceIDNode* node = nodes_[id];
-    used_nodes_[node] = id;
+    SequenceIDNode* node = free_nodes_.back();
+    free_nodes_.pop_back();
     node->id = seq_id;
     node->next = next;
     return node;
@@ -61,22 +58,16 @@ class SequenceIDNodePool {
    * \brief Free a sequence ID node to pool.
    * \param node The sequence ID node to free.
    */
-  void Free(SequenceIDNode* node) {
-    CHECK(used_nodes_.find(node) != used_nodes_.end());
-    free_node_indices_.push_back(used_nodes_[node]);
-    used_nodes_.erase(node);
-  }
+  void Free(SequenceIDNode* node) { free_nodes_.push_back(node); }
 
   /*!
    * \brief Reset the sequence ID node pool to initial status.
    */
   void Reset() {
-    used_nodes_.clear();
-    free_node_indices_.reserve(nodes_.size());
-    for (size_t i = 0; i < nodes_.size(); ++i) {
-      nodes_[i]->id = 0;
-      nodes_[i]->next = nullptr;
-      free_node_indices_[i] = i;
+    free_nodes_.assign(nodes_.begin(), nodes_.end());
+    for (SequenceIDNode* node : nodes_) {
+      node->id = 0;
+      node->next = nullptr;
     }
   }
 
@@ -94,22 +85,134 @@ class SequenceIDNodePool {
   std::vector<SequenceIDNode*> node_blocks_;
   /*! \brief The sequence ID node pool, each element is a sequence ID node pointer. */
   std::vector<SequenceIDNode*> nodes_;
-  /*! \brief The indices of free sequence ID node in node pool. */
-  std::vector<size_t> free_node_indices_;
-  /*! \brief The map from used paged sequence ID node to its index in node pool. */
-  std::unordered_map<SequenceIDNode*, size_t> used_nodes_;
+  /*!
+   * \brief The free sequence ID nodes in node pool. Keeping the free nodes as pointers avoids
+   * the hash map lookup and the memory allocation in each allocation and free.
+   */
+  std::vector<SequenceIDNode*> free_nodes_;
 
   /*! \brief Allocate a new node pool block. */
   void NewNodeBlock_() {
-    size_t node_id_offset = node_blocks_.size() * kNodeBlockSize_;
     node_blocks_.push_back(new SequenceIDNode[kNodeBlockSize_]);
     nodes_.reserve(nodes_.size() + kNodeBlockSize_);
-    free_node_indices_.reserve(free_node_indices_.size() + kNodeBlockSize_);
+    free_nodes_.reserve(free_nodes_.size() + kNodeBlockSize_);
     for (size_t i = 0; i < kNodeBlockSize_; ++i) {
       nodes_.push_back(&node_blocks_.back()[i]);
-      free_node_indices_.push_back(i + node_id_offset);
+      free_nodes_.push_back(&node_blocks_.back()[i]);
+    }
+  }
+};
+
+struct RadixPage;
+
+/*!
+ * \brief The child index of paged radix tree pages, which maps a pair of parent page and first
+ * token to the child page.
+ *
+ * The child index is a flat open-addressing hash table with linear probing, shared by all pages
+ * of a paged radix tree. Finding a child page costs constant time regardless of the number of
+ * sibling pages, and no memory is allocated except when the table grows.
+ */
+class RadixPageChildIndex {
+ public:
+  RadixPageChildIndex() { slots_.resize(kInitialCapacity_); }
+
+  /*!
+   * \brief Find the child page of given parent page starting with given token.
+   * \return The child page, or nullptr if no such child page.
+   */
+  RadixPage* Find(const RadixPage* parent, int32_t token) const {
+    for (size_t i = Hash(parent, token) & Mask();; i = (i + 1) & Mask()) {
+      const Slot& slot = slots_[i];
+      if (slot.parent == nullptr) return nullptr;
+      if (slot.parent == parent && slot.token == token) return slot.child;
+    }
+  }
+
+  /*!
+   * \brief Insert a child page of given parent page starting with given token.
+   * \throw Error if the parent page already has a child page starting with the token.
+   */
+  void Insert(const RadixPage* parent, int32_t token, RadixPage* child) {
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+      // Keep the load factor below 0.75.
+      Grow();
+    }
+    size_t i = Hash(parent, token) & Mask();
+    for (; slots_[i].parent != nullptr; i = (i + 1) & Mask()) {
+      CHECK(slots_[i].parent != parent || slots_[i].token != token)
+          << "The child page starting with token " << token << " already exists.";
+    }
+    slots_[i] = Slot{parent, token, child};
+    ++size_;
+  }
+
+  /*!
+   * \brief Erase the child page of given parent page starting with given token.
+   * \throw Error if there is no such child page.
+   */
+  void Erase(const RadixPage* parent, int32_t token) {
+    size_t i = Hash(parent, token) & Mask();
+    for (; slots_[i].parent != parent || slots_[i].token != token; i = (i + 1) & Mask()) {
+      CHECK(slots_[i].parent != nullptr)
+          << "The child page starting with token " << token << " is not found.";
+    }
+    // Shift the following slots backward to fill the hole, so that no tombstone is needed.
+    for (size_t j = (i + 1) & Mask(); slots_[j].parent != nullptr; j = (j + 1) & Mask()) {
+      size_t home = Hash(slots_[j].parent, slots_[j].token) & Mask();
+      // The slot can be moved to the hole when its home position is not in the cyclic range (i, j].
+      bool in_range = i < j ? (i < home && home <= j) : (i < home || home <= j);
+      if (!in_range) {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+    slots_[i] = Slot();
+    --size_;
+  }
+
+  /*! \brief Reset the child index to empty, keeping the allocated slots. */
+  void Reset() {
+    std::fill(slots_.begin(), slots_.end(), Slot());
+    size_ = 0;
+  }
+
+ private:
+  /*! \brief The slot of hash table. The slot is empty when the parent is nullptr. */
+  struct Slot {
+    const RadixPage* parent = nullptr;
+    int32_t token = 0;
+    RadixPage* child = nullptr;
+  };
+
+  /*! \brief The initial number of slots, which must be a power of two. */
+  static constexpr size_t kInitialCapacity_ = 256;
+
+  size_t Mask() const { return slots_.size() - 1; }
+
+  static size_t Hash(const RadixPage* parent, int32_t token) {
+    uint64_t hash =
+        (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(parent)) * 0x9E3779B97F4A7C15ULL) ^
+        (static_cast<uint64_t>(static_cast<uint32_t>(token)) * 0xC2B2AE3D27D4EB4FULL);
+    return static_cast<size_t>(hash ^ (hash >> 32));
+  }
+
+  /*! \brief Double the number of slots and rehash all the child pages. */
+  void Grow() {
+    std::vector<Slot> old_slots(slots_.size() * 2);
+    old_slots.swap(slots_);
+    size_ = 0;
+    for (const Slot& slot : old_slots) {
+      if (slot.parent != nullptr) {
+        Insert(slot.parent, slot.token, slot.child);
+      }
     }
   }
+
+  /*! \brief The hash table slots. */
+  std::vector<Slot> slots_;
+  /*! \brief The number of child pages in the index. */
+  size_t size_ = 0;
 };
 
 /*!
@@ -122,7 +225,8 @@ class SequenceIDNodePool {
  * stored prefix tokens.
  *
  * And since the vocabulary size may be very large, the paged Radix tree is represented
- * as left-child, right-sibling binary tree.
+ * as left-child, right-sibling binary tree. The child page lookup by first token goes through
+ * the RadixPageChildIndex shared by the whole tree, instead of scanning the sibling list.
  *
  * Also, due to possible pop/push front/back tokens in page, the page is designed as circular
  * buffer, to make full use of each page.
@@ -278,30 +382,36 @@ struct RadixPage {
 
   /*!
    * \brief Find the child indexed by first token.
+   * \param index The child index of the tree.
+   * \param first_token The first token of the child page.
    * \return The child page started with first token, or nullptr if no such child page.
    */
-  RadixPage* FindChild(int64_t first_token) {
-    int32_t casted = first_token;
-    // Iterate all child radix pages, as the child radix pages are stored unorderly.
-    for (RadixPage* child = first_child; child; child = child->next_sibling) {
-      if ((*child)[0] == casted) return child;
-    }
-    return nullptr;
+  RadixPage* FindChild(const RadixPageChildIndex& index, int64_t first_token) {
+    return index.Find(this, static_cast<int32_t>(first_token));
   }
 
-  /*! \brief Insert a new child page. */
-  void InsertChild(RadixPage* child) {
+  /*!
+   * \brief Insert a new child page. The child page must have been filled with tokens.
+   * \param index The child index of the tree to register the child page.
+   * \param child The child page to insert.
+   */
+  void InsertChild(RadixPageChildIndex* index, RadixPage* child) {
+    CHECK_GT(child->length, 0);
     child->parent = this;
     child->next_sibling = first_child;
     first_child = child;
+    index->Insert(this, (*child)[0], child);
   }
 
   /*!
    * \brief Remove a child page.
+   * \param index The child index of the tree to unregister the child page.
+   * \param child The child page to remove.
    * \throw Error if page to be removed is not child page.
    */
-  void RemoveChild(RadixPage* child) {
+  void RemoveChild(RadixPageChildIndex* index, RadixPage* child) {
     CHECK(child->parent == this);
+    index->Erase(this, (*child)[0]);
     if (first_child == child) {
       first_child = child->next_sibling;
     } else {
@@ -336,6 +446,12 @@ struct RadixPage {
    */
   size_t MatchPrefix(const int32_t* prefix, size_t prefix_length) {
     size_t n = std::min(length, prefix_length);
+    if (offset + n <= capacity) {
+      // The tokens to match are contiguous in memory, which is always the case unless the
+      // circular buffer wraps around.
+      const int32_t* data = reinterpret_cast<const int32_t*>(this) + kDataOffset + offset;
+      return std::mismatch(data, data + n, prefix).first - data;
+    }
     for (int i = 0; i < n; ++i) {
       if ((*this)[i] != prefix[i]) return i;
     }
@@ -352,10 +468,7 @@ struct RadixPage {
 class RadixPagePool {
  public:
   /*! \brief The constructor of paged radix tree page pool, allocating memory for each page. */
-  RadixPagePool() {
-    NewPageBlock_();
-    used_pages_.clear();
-  }
+  RadixPagePool() { NewPageBlock_(); }
 
   /*!
    * \brief Get a radix page from pool.
@@ -363,14 +476,12 @@ class RadixPagePool {
    * \return The allocated radix page.
    */
   RadixPage* Allocate() {
-    if (free_page_indices_.empty()) {
+    if (free_pages_.empty()) {
       NewPageBlock_();
-      CHECK(!free_page_indices_.empty());
+      CHECK(!free_pages_.empty());
     }
-    int id = free_page_indices_.back();
-    free_page_indices_.pop_back();
-    RadixPage* page = pages_[id];
-    used_pages_[page] = id;
+    RadixPage* page = free_pages_.back();
+    free_pages_.pop_back();
     page->parent = page->first_child = page->next_sibling = nullptr;
     page->capacity = kPageCapacity_;
     page->offset = page->length = 0;
@@ -384,29 +495,25 @@ class RadixPagePool {
    */
   void Free(RadixPage* page) {
     CHECK_EQ(page->seq_ids, nullptr);
-    CHECK(used_pages_.find(page) != used_pages_.end());
-    free_page_indices_.push_back(used_pages_[page]);
-    CHECK(used_pages_.erase(page));
+    free_pages_.push_back(page);
   }
 
   /*!
    * \brief Get the token capacity of free pages.
    * \return The the token capacity of free pages.
    */
-  size_t FreeCapacity() { return free_page_indices_.size() * kPageCapacity_; }
+  size_t FreeCapacity() { return free_pages_.size() * kPageCapacity_; }
 
   /*!
    * \brief Reset the paged radix tree page pool to initial status.
    */
   void Reset() {
-    used_pages_.clear();
-    free_page_indices_.reserve(pages_.size());
-    for (int i = 0; i < pages_.size(); ++i) {
-      pages_[i]->parent = pages_[i]->first_child = pages_[i]->next_sibling = nullptr;
-      pages_[i]->capacity = kPageCapacity_;
-      pages_[i]->offset = pages_[i]->length = 0;
-      pages_[i]->seq_ids = nullptr;
-      free_page_indices_[i] = i;
+    free_pages_.assign(pages_.begin(), pages_.end());
+    for (RadixPage* page : pages_) {
+      page->parent = page->first_child = page->next_sibling = nullptr;
+      page->capacity = kPageCapacity_;
+      page->offset = page->length = 0;
+      page->seq_ids = nullptr;
     }
   }
 
@@ -430,20 +537,21 @@ class RadixPagePool {
   /*! \brief The paged radix tree page pool,
   each element is a raw paged radix tree page pointer. */
   std::vector<RadixPage*> pages_;
-  /*! \brief The indices of free paged radix page in page pool. */
-  std::vector<size_t> free_page_indices_;
-  /*! \brief The map from used paged radix tree page to its index in page pool. */
-  std::unordered_map<RadixPage*, size_t> used_pages_;
+  /*!
+   * \brief The free paged radix pages in page pool. Keeping the free pages as pointers avoids
+   * the hash map lookup and the memory allocation in each allocation and free.
+   */
+  std::vector<RadixPage*> free_pages_;
 
   /*! \brief Allocate a new page pool block. */
   void NewPageBlock_() {
-    size_t page_id_offset = page_blocks_.size() * kPageBlockSize_;
     page_blocks_.push_back(new int32_t[kPageBlockSize_ * kPageSize_]);
     pages_.reserve(pages_.size() + kPageBlockSize_);
-    free_page_indices_.reserve(free_page_indices_.size() + kPageBlockSize_);
+    free_pages_.reserve(free_pages_.size() + kPageBlockSize_);
     for (size_t i = 0; i < kPageBlockSize_; ++i) {
-      pages_.push_back(reinterpret_cast<RadixPage*>(page_blocks_.back() + i * kPageSize_));
-      free_page_indices_.push_back(i + page_id_offset);
+      RadixPage* page = reinterpret_cast<RadixPage*>(page_blocks_.back() + i * kPageSize_);
+      pages_.push_back(page);
+      free_pages_.push_back(page);
     }
   }
 };
@@ -461,6 +569,8 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   SequenceIDNodePool* seq_id_node_pool = nullptr;
   /*! \brief The radix page pool. */
   RadixPagePool* radix_page_pool = nullptr;
+  /*! \brief The child index of all radix pages. */
+  RadixPageChildIndex child_index;
   /*! \brief The root page of paged radix tree. */
   RadixPage* root = nullptr;
 
@@ -530,6 +640,27 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     return length;
   }
 
+  /*!
+   * \brief Get the number of a sequence's trailing tokens not shared with any other sequence.
+   * \param seq_id The sequence ID for index.
+   * \return The number of tokens owned by the sequence alone.
+   * \throw Error if sequence ID is not valid.
+   */
+  size_t GetSequenceExclusiveLength(int64_t seq_id) {
+    CHECK(seq2page.find(seq_id) != seq2page.end());
+    RadixPage* page = seq2page[seq_id];
+    // All the tokens are shared when other sequences end at or extend the sequence.
+    if (page->first_child || page->seq_ids->next) return 0;
+    size_t length = 0;
+    for (; page->parent; page = page->parent) {
+      length += page->length;
+      // The parent page is shared when another sequence ends at it or branches from it.
+      RadixPage* parent = page->parent;
+      if (parent->seq_ids || parent->first_child != page || page->next_sibling) break;
+    }
+    return length;
+  }
+
   /*!
    * \brief Fork a sequence from parent sequence at given position.
    * \param seq_id The new sequence ID.
@@ -598,11 +729,11 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     while (offset < length) {
       // Allocate new radix page and extend tokens
       RadixPage* new_page = radix_page_pool->Allocate();
-      page->InsertChild(new_page);
-      page = new_page;
-      size_t suffix_length = std::min(page->capacity - page->length, length - offset);
-      page->Extend(suffix + offset, suffix_length);
+      size_t suffix_length = std::min(new_page->capacity - new_page->length, length - offset);
+      new_page->Extend(suffix + offset, suffix_length);
       offset += suffix_length;
+      page->InsertChild(&child_index, new_page);
+      page = new_page;
     }
     page->AddSequence(seq_id_node_pool, seq_id);
     seq2page[seq_id] = page;
@@ -638,7 +769,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
       RadixPage* parent = page->parent;
       if (page->seq_ids == nullptr && page->first_child == nullptr) {
         // The leaf page is removable
-        parent->RemoveChild(page);
+        parent->RemoveChild(&child_index, page);
         radix_page_pool->Free(page);
       }
       page = parent;
@@ -671,7 +802,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     seq2page.erase(seq_id);
     while (page->parent && !page->seq_ids && !page->first_child) {
       RadixPage* parent = page->parent;
-      parent->RemoveChild(page);
+      parent->RemoveChild(&child_index, page);
       radix_page_pool->Free(page);
       page = parent;
     }
@@ -690,6 +821,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   void Reset() {
     radix_page_pool->Reset();
     seq_id_node_pool->Reset();
+    child_index.Reset();
     seq2page.clear();
     root->parent = root->first_child = root->next_sibling = nullptr;
     root->offset = root->length = root->capacity = 0;
@@ -713,12 +845,15 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   void MergePage(RadixPage* page) {
     CHECK(page->Mergeable());
     RadixPage* child = page->first_child;
+    child_index.Erase(page, (*child)[0]);
     for (int i = 0; i < child->length; ++i) {
       (*page)[i + page->length] = (*child)[i];
     }
     page->length += child->length;
     page->first_child = child->first_child;
     for (RadixPage* p = child->first_child; p; p = p->next_sibling) {
+      child_index.Erase(child, (*p)[0]);
+      child_index.Insert(page, (*p)[0], p);
       p->parent = page;
     }
     page->seq_ids = child->seq_ids;
@@ -742,6 +877,8 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     child->parent = page;
     child->first_child = page->first_child;
     for (RadixPage* p = page->first_child; p; p = p->next_sibling) {
+      child_index.Erase(page, (*p)[0]);
+      child_index.Insert(child, (*p)[0], p);
       p->parent = child;
     }
     page->first_child = child;
@@ -750,6 +887,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     }
     child->length = page->length - offset;
     page->length = offset;
+    child_index.Insert(page, (*child)[0], child);
     child->seq_ids = page->seq_ids;
     std::vector<int64_t> seq_ids = page->GetLocalSequence();
     for (int64_t id : seq_ids) seq2page[id] = child;
@@ -776,7 +914,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
                                                        size_t length) {
     size_t offset = 0;
     while (offset < length) {
-      if (RadixPage* child = page->FindChild(tokens[offset])) {
+      if (RadixPage* child = page->FindChild(child_index, tokens[offset])) {
         // If child page starts with offset-th token, common prefix at least ends with child page
         size_t matched_offset = child->MatchPrefix(tokens + offset, length - offset);
         offset += matched_offset;
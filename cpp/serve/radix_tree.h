@@ -53,6 +53,15 @@ class PagedRadixTreeObj : public Object {
    */
   virtual size_t GetSequenceLength(int64_t seq_id) = 0;
 
+  /*!
+   * \brief Get the number of a sequence's trailing tokens not shared with any other sequence,
+   * which are freed from the tree when the sequence is removed.
+   * \param seq_id The sequence ID for index.
+   * \return The number of tokens owned by the sequence alone.
+   * \throw Error if sequence ID is not valid.
+   */
+  virtual size_t GetSequenceExclusiveLength(int64_t seq_id) = 0;
+
   /*!
    * \brief Fork a sequence from parent sequence at given position.
    * \param seq_id The new sequence ID.
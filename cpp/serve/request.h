@@ -11,6 +11,7 @@
 #include <tvm/runtime/object.h>
 #include <tvm/runtime/packed_func.h>
 
+#include "../support/utils.h"
 #include "../tokenizers/tokenizers.h"
 #include "config.h"
 #include "data.h"
@@ -78,6 +79,14 @@ class Request : public ObjectRef {
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(Request, ObjectRef, RequestNode);
 };
 
+/*! \brief The request id prefix of the internal requests preloading prefixes into prefix cache. */
+constexpr const char* kPrefixPreloadRequestIdPrefix = "__mlc_prefix_preload_";
+
+/*! \brief Check if the request is an internal request preloading a prefix. */
+inline bool IsPrefixPreloadRequest(const String& request_id) {
+  return StartsWith(request_id, kPrefixPreloadRequestIdPrefix);
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -5,6 +5,8 @@
 
 #include "request_state.h"
 
+#include <algorithm>
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -13,10 +15,11 @@ namespace serve {
 
 TVM_REGISTER_OBJECT_TYPE(RequestModelStateNode);
 
-RequestModelState::RequestModelState(
-    Request request, int model_id, int64_t internal_id, Array<Data> inputs,
+/*! \brief Initialize the fields of a default-constructed request model state. */
+void InitRequestModelStateNode(
+    RequestModelStateNode* n, Request request, int model_id, int64_t internal_id,
+    Array<Data> inputs,
     const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx) {
-  ObjectPtr<RequestModelStateNode> n = make_object<RequestModelStateNode>();
   n->model_id = model_id;
   n->internal_id = internal_id;
   n->inputs = std::move(inputs);
@@ -27,6 +30,14 @@ RequestModelState::RequestModelState(
   }
 
   n->request = std::move(request);
+}
+
+RequestModelState::RequestModelState(
+    Request request, int model_id, int64_t internal_id, Array<Data> inputs,
+    const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx) {
+  ObjectPtr<RequestModelStateNode> n = make_object<RequestModelStateNode>();
+  InitRequestModelStateNode(n.get(), std::move(request), model_id, internal_id,
+                            std::move(inputs), grammar_state_init_ctx);
   data_ = std::move(n);
 }
 
@@ -49,6 +60,9 @@ void RequestModelStateNode::FindNextTokenBitmask(DLTensor* bitmask) {
 void RequestModelStateNode::CommitToken(SampleResult sampled_token) {
   committed_tokens.push_back(std::move(sampled_token));
   appeared_token_ids[sampled_token.GetTokenId()] += 1;
+  if (penalty_slot != -1) {
+    penalty_dirty_tokens.push_back(sampled_token.GetTokenId());
+  }
   // There will be one more token that will be processed in the next decoding.
   ++num_tokens_for_next_decode;
 
@@ -65,6 +79,9 @@ void RequestModelStateNode::RollbackTokens(int count) {
   for (int i = 0; i < count; ++i) {
     auto it = appeared_token_ids.find(committed_tokens.back().GetTokenId());
     CHECK(it != appeared_token_ids.end());
+    if (penalty_slot != -1) {
+      penalty_dirty_tokens.push_back(it->first);
+    }
     if (--it->second == 0) {
       appeared_token_ids.erase(it);
     }
@@ -105,6 +122,23 @@ void RequestModelStateNode::RemoveAllDraftTokens(std::vector<int>* removed_draft
   draft_output_tokens.clear();
 }
 
+void RequestModelStateNode::UpdateSpecAcceptRate(int draft_depth, int num_accepted) {
+  ICHECK_LE(num_accepted, draft_depth);
+  constexpr double kDecay = 0.8;
+  spec_accept_count = spec_accept_count * kDecay + num_accepted;
+  // The draft positions after the first rejected one are never verified.
+  spec_verify_count =
+      spec_verify_count * kDecay + num_accepted + (num_accepted < draft_depth ? 1 : 0);
+}
+
+double RequestModelStateNode::GetSpecAcceptRate() const {
+  constexpr double kMinVerifyCount = 1.0;
+  if (spec_verify_count < kMinVerifyCount) {
+    return -1;
+  }
+  return spec_accept_count / spec_verify_count;
+}
+
 /****************** RequestActionPostProcWorkspace ******************/
 
 RequestStreamOutput RequestActionPostProcWorkspace::GetStreamOutput() {
@@ -140,6 +174,20 @@ RequestStreamOutput RequestActionPostProcWorkspace::GetStreamOutput() {
 
 TVM_REGISTER_OBJECT_TYPE(RequestStateEntryNode);
 
+/*! \brief Initialize the fields except the model states of a default-constructed entry. */
+void InitRequestStateEntryNode(RequestStateEntryNode* n, Request request, int rng_seed,
+                               const std::vector<std::string>& token_table, int parent_idx) {
+  n->status = RequestStateStatus::kPending;
+  n->rng = RandomGenerator(rng_seed);
+  n->stop_str_handler = StopStrHandler(!request->generation_cfg->debug_config.ignore_eos
+                                           ? request->generation_cfg->stop_strs
+                                           : Array<String>(),
+                                       token_table);
+  n->request = std::move(request);
+  n->parent_idx = parent_idx;
+  n->next_callback_token_pos = 0;
+}
+
 RequestStateEntry::RequestStateEntry(
     Request request, int num_models, int64_t internal_id, int rng_seed,
     const std::vector<std::string>& token_table,
@@ -155,16 +203,8 @@ RequestStateEntry::RequestStateEntry(
   for (int i = 0; i < num_models; ++i) {
     mstates.push_back(RequestModelState(request, i, internal_id, inputs, grammar_state_init_ctx));
   }
-  n->status = RequestStateStatus::kPending;
-  n->rng = RandomGenerator(rng_seed);
-  n->stop_str_handler = StopStrHandler(!request->generation_cfg->debug_config.ignore_eos
-                                           ? request->generation_cfg->stop_strs
-                                           : Array<String>(),
-                                       token_table);
-  n->request = std::move(request);
-  n->parent_idx = parent_idx;
   n->mstates = std::move(mstates);
-  n->next_callback_token_pos = 0;
+  InitRequestStateEntryNode(n.get(), std::move(request), rng_seed, token_table, parent_idx);
   data_ = std::move(n);
 }
 
@@ -179,6 +219,24 @@ void RequestStateEntryNode::GetDeltaRequestReturn(const Tokenizer& tokenizer,
     (*delta_stream_output)->group_delta_logprob_json_strs.value()[idx].clear();
   }
   (*delta_stream_output)->group_finish_reason[idx] = NullOpt;
+  if (request->generation_cfg->embedding_pooling != EmbeddingPooling::kNone) {
+    // Embedding requests finish with their embedding once the prompt is fully prefilled.
+    (*delta_stream_output)->embedding = NullOpt;
+    (*delta_stream_output)->group_extra_prefix_string[idx] = "";
+    if (this->mstates[0]->inputs.empty() && !this->embedding.empty()) {
+      NDArray embedding_nd = NDArray::Empty({static_cast<int64_t>(this->embedding.size())},
+                                            DataType::Float(32), Device{DLDeviceType::kDLCPU, 0});
+      embedding_nd.CopyFromBytes(this->embedding.data(), this->embedding.size() * sizeof(float));
+      (*delta_stream_output)->embedding = std::move(embedding_nd);
+      (*delta_stream_output)->group_finish_reason[idx] = "stop";
+    }
+    return;
+  }
+  if (request->generation_cfg->use_beam_search && !rstate->beam_search.finished) {
+    // The beams are returned as a whole after the beam search finishes.
+    (*delta_stream_output)->group_extra_prefix_string[idx] = "";
+    return;
+  }
   (*delta_stream_output)->group_extra_prefix_string[idx] = this->extra_prefix_string;
   this->extra_prefix_string.clear();
 
@@ -291,6 +349,91 @@ RequestState::RequestState(std::vector<RequestStateEntry> entries, int num_respo
   data_ = std::move(n);
 }
 
+/****************** RequestStateEntryPool ******************/
+
+RequestStateEntry RequestStateEntryPool::Get(
+    Request request, int num_models, int64_t internal_id, int rng_seed,
+    const std::vector<std::string>& token_table,
+    const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx,
+    int parent_idx) {
+  ResetReleasedEntries();
+  auto it = std::find_if(entries_.begin(), entries_.end(), [num_models](const auto& rsentry) {
+    return static_cast<int>(rsentry->mstates.size()) == num_models;
+  });
+  if (it == entries_.end()) {
+    return RequestStateEntry(std::move(request), num_models, internal_id, rng_seed, token_table,
+                             grammar_state_init_ctx, parent_idx);
+  }
+  RequestStateEntry rsentry = std::move(*it);
+  entries_.erase(it);
+
+  Array<Data> inputs;
+  if (parent_idx == -1) {
+    inputs = request->inputs;
+  }
+  for (int i = 0; i < num_models; ++i) {
+    InitRequestModelStateNode(rsentry->mstates[i].operator->(), request, i, internal_id, inputs,
+                              grammar_state_init_ctx);
+  }
+  InitRequestStateEntryNode(rsentry.operator->(), std::move(request), rng_seed, token_table,
+                            parent_idx);
+  return rsentry;
+}
+
+void RequestStateEntryPool::Recycle(const std::vector<RequestStateEntry>& entries) {
+  ResetReleasedEntries();
+  for (const RequestStateEntry& rsentry : entries) {
+    if (static_cast<int>(recycled_entries_.size() + entries_.size()) >= kMaxNumPooledEntries) {
+      return;
+    }
+    recycled_entries_.push_back(rsentry);
+  }
+}
+
+void RequestStateEntryPool::ResetReleasedEntries() {
+  auto it = std::stable_partition(
+      recycled_entries_.begin(), recycled_entries_.end(),
+      [](const RequestStateEntry& rsentry) { return !IsUnique(rsentry); });
+  for (auto released_it = it; released_it != recycled_entries_.end(); ++released_it) {
+    ResetEntry(released_it->operator->());
+    entries_.push_back(std::move(*released_it));
+  }
+  recycled_entries_.erase(it, recycled_entries_.end());
+}
+
+void RequestStateEntryPool::ResetEntry(RequestStateEntryNode* n) {
+  // Reset the model states to the default values, which releases the request, the inputs and the
+  // grammar state matcher, keeping the capacity of the token buffer.
+  for (int i = 0; i < static_cast<int>(n->mstates.size()); ++i) {
+    RequestModelStateNode* mstate = n->mstates[i].operator->();
+    std::vector<SampleResult> committed_tokens = std::move(mstate->committed_tokens);
+    committed_tokens.clear();
+    *mstate = RequestModelStateNode();
+    mstate->committed_tokens = std::move(committed_tokens);
+  }
+  // Reset the entry to the default values, keeping the model states and the buffer capacity.
+  Array<RequestModelState> mstates = std::move(n->mstates);
+  std::vector<int> child_indices = std::move(n->child_indices);
+  std::vector<int32_t> token_ids_for_prefix_cache_update =
+      std::move(n->token_ids_for_prefix_cache_update);
+  child_indices.clear();
+  token_ids_for_prefix_cache_update.clear();
+  *n = RequestStateEntryNode();
+  n->mstates = std::move(mstates);
+  n->child_indices = std::move(child_indices);
+  n->token_ids_for_prefix_cache_update = std::move(token_ids_for_prefix_cache_update);
+}
+
+bool RequestStateEntryPool::IsUnique(const RequestStateEntry& rsentry) {
+  if (rsentry.use_count() != 1 || rsentry->mstates.use_count() != 1) {
+    return false;
+  }
+  // The array node is iterated directly, since the array iterator returns copies of the elements.
+  const ArrayNode* mstates = rsentry->mstates.GetArrayNode();
+  return std::all_of(mstates->begin(), mstates->end(),
+                     [](const ObjectRef& mstate) { return mstate.use_count() == 1; });
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
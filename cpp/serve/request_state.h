@@ -64,6 +64,19 @@ class RequestModelStateNode : public Object {
   /*! \brief Whether retokenization is needed in the next decoding. When the jump-forward decoding
    * is enabled, retokenization is needed after every jump-forward and decoding action. */
   bool require_retokenization_in_next_decode = false;
+  /*!
+   * \brief The KV data swapped out to host memory when the request is preempted
+   * under the swap preemption mode, or NullOpt when the KV data is not swapped out.
+   * The request is resumed by swapping the KV data back in instead of prefilling again.
+   */
+  Optional<ObjectRef> swapped_kv_data;
+  /*! \brief The number of tokens in the swapped out KV data. */
+  int64_t num_swapped_kv_tokens = 0;
+  /*!
+   * \brief The index of the LoRA adapter to compute the request with in the model,
+   * or -1 for the base model.
+   */
+  int lora_adapter_index = -1;
 
   // NOTE: The following fields are reserved for future speculative inference
   // settings, and are produced by the speculative small models.
@@ -80,9 +93,35 @@ class RequestModelStateNode : public Object {
   std::vector<int64_t> draft_token_parent_idx;
   /*! \brief The first child indices of the draft tokens. */
   std::vector<int64_t> draft_token_first_child_idx;
+  /*!
+   * \brief The number of accepted draft tokens in the recent verifications, decayed by
+   * the age of the verification.
+   */
+  double spec_accept_count = 0;
+  /*!
+   * \brief The number of verified draft positions in the recent verifications, decayed by
+   * the age of the verification. A draft position is verified when it is accepted or when
+   * it is the first rejected position of a draft.
+   */
+  double spec_verify_count = 0;
+  /*!
+   * \brief The draft length of the request in the next speculative decoding step,
+   * or -1 to use the draft length of the engine state.
+   */
+  int spec_draft_length = -1;
 
   /*! \brief The appeared committed and draft tokens and their occurrence times. */
   std::unordered_map<int32_t, int32_t> appeared_token_ids;
+  /*!
+   * \brief The slot of the device token count table in the logit processor holding the
+   * appeared token counts of this state, or -1 if the counts are not kept on device.
+   * The slot is valid only while the logit processor records `penalty_slot_stamp` for it.
+   */
+  int penalty_slot = -1;
+  /*! \brief The ownership stamp of `penalty_slot` assigned by the logit processor. */
+  int64_t penalty_slot_stamp = -1;
+  /*! \brief The tokens whose appeared counts changed since the last sync of `penalty_slot`. */
+  std::vector<int32_t> penalty_dirty_tokens;
 
   /*!
    * \brief The current state of the generated token matching the grammar. Used in grammar-guided
@@ -114,6 +153,18 @@ class RequestModelStateNode : public Object {
   void AddDraftToken(SampleResult sampled_token, int draft_token_slot, int64_t parent_idx);
   /*! \brief Remove all draft tokens from draft_output_tokens. Update appeared_token_ids. */
   void RemoveAllDraftTokens(std::vector<int>* removed_draft_token_slots = nullptr);
+  /*!
+   * \brief Record a verified draft into the rolling acceptance rate of speculative decoding.
+   * The existing counts decay, so that the rate follows the recent drafts of the request.
+   * \param draft_depth The number of draft tokens on the longest path of the draft.
+   * \param num_accepted The number of accepted draft tokens.
+   */
+  void UpdateSpecAcceptRate(int draft_depth, int num_accepted);
+  /*!
+   * \brief Return the rolling acceptance rate of the draft tokens in speculative decoding,
+   * or -1 if too few draft tokens are verified recently to tell.
+   */
+  double GetSpecAcceptRate() const;
 
   static constexpr const char* _type_key = "mlc.serve.RequestModelState";
   static constexpr const bool _type_has_method_sequal_reduce = false;
@@ -224,6 +275,26 @@ class RequestStateEntryNode : public Object {
 
   std::vector<int32_t> token_ids_for_prefix_cache_update;
 
+  /*! \brief The cumulative log probability of the committed tokens under beam search. */
+  double beam_score = 0.0;
+
+  /*!
+   * \brief The prompt embedding of an embedding request. Under mean pooling, it accumulates the
+   * chunk means weighted by the chunk lengths, until the prompt is fully prefilled.
+   */
+  std::vector<float> embedding;
+
+  /*!
+   * \brief The probabilities of the prompt tokens computed in the prefill and not streamed
+   * back yet, for the requests with `prompt_logprobs`.
+   */
+  std::vector<SampleResult> prompt_token_probs;
+  /*!
+   * \brief The number of prompt positions whose next token probabilities are computed.
+   * The prefill after a preemption skips these positions.
+   */
+  int64_t num_prompt_logprob_positions = 0;
+
   /*!
    * \brief Back reference to the request state.
    * Use ObjectRef to avoid circulate reference.
@@ -264,13 +335,43 @@ class RequestStateEntry : public ObjectRef {
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(RequestStateEntry, ObjectRef, RequestStateEntryNode);
 };
 
+/*! \brief The beam search state of a request, shared by all the beams of the request. */
+struct BeamSearchState {
+  /*! \brief A finished beam, whose last token is a stop token. */
+  struct Hypothesis {
+    /*! \brief The tokens of the beam. */
+    std::vector<SampleResult> tokens;
+    /*! \brief The length-normalized score of the beam. */
+    double score;
+  };
+
+  /*!
+   * \brief The generation config to compute the beam candidates with, which keeps the
+   * distribution unmodified and asks the sampler for the top candidate tokens.
+   */
+  Optional<GenerationConfig> candidate_generation_cfg;
+  /*! \brief The finished beams in descending score order. */
+  std::vector<Hypothesis> hypotheses;
+  /*! \brief The generations to return, which are written to the beams once selected. */
+  std::vector<std::vector<SampleResult>> outputs;
+  /*!
+   * \brief Whether the beam search has finished. The beams do not stream any output
+   * before the beam search finishes, since beams are pruned and forked at every step.
+   */
+  bool finished = false;
+};
+
 /*! \brief A request's state, which groups all the request state entries. */
 class RequestStateNode : public Object {
  public:
   /*! \brief the request state entries */
   std::vector<RequestStateEntry> entries;
+  /*! \brief The beam search state when the request uses beam search. */
+  BeamSearchState beam_search;
   /*! \brief tracks the request metrics. */
   RequestMetrics metrics;
+  /*! \brief The number of processed tokens of the request already accounted to its tenant. */
+  int64_t num_tenant_accounted_tokens = 0;
   /*!
    * \brief The post-process data structures.
    * We make it a state to avoid repetitive memory allocation/free in the action post process.
@@ -296,6 +397,58 @@ class RequestState : public ObjectRef {
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(RequestState, ObjectRef, RequestStateNode);
 };
 
+/*!
+ * \brief The pool of the request state entries of finished requests. The pooled entry objects
+ * and their model state objects are reset once released elsewhere, keeping only the capacity of
+ * their token buffers, and are reinitialized for newly added requests, so that admitting and
+ * finishing requests under high concurrency does not churn the allocator.
+ */
+class RequestStateEntryPool {
+ public:
+  /*!
+   * \brief Get a request state entry initialized in the same way as the RequestStateEntry
+   * constructor, reusing a pooled entry when there is one not referenced elsewhere.
+   */
+  RequestStateEntry Get(
+      Request request, int num_models, int64_t internal_id, int rng_seed,
+      const std::vector<std::string>& token_table,
+      const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx,
+      int parent_idx = -1);
+
+  /*!
+   * \brief Put the entries of a finished request into the pool. The entries may still be
+   * referenced for a while (e.g., by the post-process workspace), and are only reset and reused
+   * after all the other references are released.
+   */
+  void Recycle(const std::vector<RequestStateEntry>& entries);
+
+  /*! \brief Clear the pool. */
+  void Clear() {
+    recycled_entries_.clear();
+    entries_.clear();
+  }
+
+ private:
+  /*! \brief Reset the recycled entries which are no longer referenced elsewhere. */
+  void ResetReleasedEntries();
+
+  /*!
+   * \brief Reset the entry and its model states to the default values, releasing all the
+   * objects they reference and keeping only the capacity of their buffers.
+   */
+  static void ResetEntry(RequestStateEntryNode* n);
+
+  /*! \brief Whether the entry and its model states are only referenced by the pool. */
+  static bool IsUnique(const RequestStateEntry& rsentry);
+
+  /*! \brief The recycled entries, which may still be referenced elsewhere. */
+  std::vector<RequestStateEntry> recycled_entries_;
+  /*! \brief The reset entries, which are only referenced by the pool. */
+  std::vector<RequestStateEntry> entries_;
+  /*! \brief The maximum number of pooled request state entries. */
+  static constexpr const int kMaxNumPooledEntries = 512;
+};
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
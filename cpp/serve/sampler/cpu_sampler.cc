@@ -10,8 +10,10 @@
 
 #include <algorithm>
 #include <cmath>
+#include <limits>
 
 #include "../../support/random.h"
+#include "cpu_sampler_kernels.h"
 #include "sampler.h"
 
 namespace mlc {
@@ -47,20 +49,27 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
   const float* __restrict p_prob =
       static_cast<float*>(__builtin_assume_aligned(prob->data, 4)) + (input_prob_offset * ndata);
   constexpr double one = 1.0f - 1e-5f;
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels();
 
   if (top_p == 0) {
     // Specially handle case where top_p == 0.
     // This case is equivalent to doing argmax.
+    // The kernel skips the blocks that cannot update the max value.
     int argmax_pos = -1;
     float max_prob = 0.0;
     float sum_prob = 0.0;
-    for (int i = 0; i < ndata; ++i) {
-      if (p_prob[i] > max_prob) {
-        max_prob = p_prob[i];
-        argmax_pos = i;
+    int64_t i = 0;
+    while (i < ndata) {
+      i = kernels.skip_blocks_not_above(p_prob, i, ndata, max_prob, &sum_prob);
+      const int64_t block_end = std::min(i + CPUSamplerKernels::kBlockSize, ndata);
+      for (; i < block_end; ++i) {
+        if (p_prob[i] > max_prob) {
+          max_prob = p_prob[i];
+          argmax_pos = i;
+        }
+        sum_prob += p_prob[i];
       }
       // Early exit.
-      sum_prob += p_prob[i];
       if (1 - sum_prob <= max_prob) {
         break;
       }
@@ -70,11 +79,17 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
 
   if (top_p >= one) {
     // Specially handle case where top_p == 1.
+    // The kernel skips the blocks whose prefix sum stays below the sample.
     double prob_sum = 0.0f;
-    for (int64_t i = 0; i < ndata; ++i) {
-      prob_sum += p_prob[i];
-      if (prob_sum >= uniform_sample) {
-        return {i, p_prob[i]};
+    int64_t i = 0;
+    while (i < ndata) {
+      i = kernels.skip_blocks_below_prefix_sum(p_prob, i, ndata, uniform_sample, &prob_sum);
+      const int64_t block_end = std::min(i + CPUSamplerKernels::kBlockSize, ndata);
+      for (; i < block_end; ++i) {
+        prob_sum += p_prob[i];
+        if (prob_sum >= uniform_sample) {
+          return {i, p_prob[i]};
+        }
       }
     }
     ICHECK(false) << "Possibly prob distribution contains NAN.";
@@ -87,19 +102,10 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
 
   auto sample_top_p_with_filter = [&](float cuttoff) -> std::pair<float, int64_t> {
     data.clear();
-    // filter the data with cuttoff
-    float cutoff_sum = 0.0f;
-    for (int64_t i = 0; i < ndata; ++i) {
-      if (p_prob[i] >= cuttoff) {
-        cutoff_sum += p_prob[i];
-        data.emplace_back(std::make_pair(p_prob[i], static_cast<int>(i)));
-        if (cutoff_sum > 1 - cuttoff) {
-          // Short cut. When the remaining parts cannot have total
-          // probability larger than cutoff, we can quit.
-          break;
-        }
-      }
-    }
+    // filter the data with cuttoff.
+    // Short cut. When the remaining parts cannot have total
+    // probability larger than cutoff, we can quit.
+    CollectAtLeast(kernels, p_prob, ndata, cuttoff, /*stop_sum=*/1 - cuttoff, &data);
     if (data.size() == 0) return std::make_pair(-1, -1);
     auto fcmp = [](const std::pair<float, int>& lhs, const std::pair<float, int>& rhs) {
       return lhs.first > rhs.first;
@@ -153,8 +159,12 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
     data.reserve(256);
     std::pair<float, int64_t> sampled_index = sample_top_p_with_filter(top_p / 1024);
     if (sampled_index.second >= 0) return {sampled_index.second, sampled_index.first};
+    // rare case: filter by the exact top-p boundary found in linear time,
+    // so that we do not sort the full prob
+    sampled_index = sample_top_p_with_filter(FindTopPBoundary(p_prob, ndata, top_p));
+    if (sampled_index.second >= 0) return {sampled_index.second, sampled_index.first};
   }
-  // fallback via full prob, rare case
+  // fallback via full prob, rarer case
   data.reserve(ndata);
   std::pair<float, int64_t> sampled_index = sample_top_p_with_filter(0.0f);
   ICHECK_GE(sampled_index.second, 0);
@@ -187,107 +197,199 @@ void RenormalizeProbByTopP(NDArray prob, int unit_offset, double top_p, double e
   float* __restrict p_prob =
       static_cast<float*>(__builtin_assume_aligned(prob->data, 4)) + (unit_offset * vocab_size);
 
-  // We manually choice the cutoff values of "top_p / 256" and "top_p / 8192".
-  // In most of the cases, only one round is needed.
-  std::vector<double> cutoff_values{top_p / 256, top_p / 8192, 0.0f};
-
-  // Create the upper partition vector and the lower partition rolling vectors.
-  std::vector<float> upper_partition;
-  std::vector<float> lower_partitions[2];
-  upper_partition.reserve(vocab_size);
-  lower_partitions[0].reserve(vocab_size);
-  lower_partitions[1].reserve(vocab_size);
-  float upper_partition_sum = 0.0;
-  for (int round = 0; round < static_cast<int>(cutoff_values.size()); ++round) {
-    const float* lower_partition_begin;
-    const float* lower_partition_end;
-    if (round == 0) {
-      lower_partition_begin = p_prob;
-      lower_partition_end = p_prob + vocab_size;
-    } else {
-      int idx = (round - 1) & 1;
-      lower_partition_begin = lower_partitions[idx].data();
-      lower_partition_end = lower_partitions[idx].data() + lower_partitions[idx].size();
+  // In most of the cases, the elements no smaller than "top_p / 256" cover top p,
+  // so only these few elements need sorting to find the boundary.
+  // Otherwise, we find the boundary with the linear-time radix select.
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels();
+  thread_local std::vector<std::pair<float, int>> upper_partition;
+  upper_partition.clear();
+  float upper_partition_sum =
+      CollectAtLeast(kernels, p_prob, vocab_size, top_p / 256,
+                     /*stop_sum=*/std::numeric_limits<float>::infinity(), &upper_partition);
+  float boundary_value = -1.0;
+  if (upper_partition_sum >= top_p - eps) {
+    // - Sort the upper partition in descending order.
+    std::sort(upper_partition.begin(), upper_partition.end(), std::greater<>());
+    // - Find the top p boundary prob value.
+    upper_partition_sum = 0.0;
+    for (const auto& [upper_value, index] : upper_partition) {
+      upper_partition_sum += upper_value;
+      if (upper_partition_sum >= top_p - eps) {
+        boundary_value = upper_value;
+        break;
+      }
     }
+  } else {
+    boundary_value = FindTopPBoundary(p_prob, vocab_size, top_p - eps);
+  }
+  // - Mask all values smaller than the boundary to 0 and renormalize.
+  float renormalize_sum = kernels.sum_at_least(p_prob, vocab_size, boundary_value);
+  kernels.mask_and_scale(p_prob, vocab_size, boundary_value, 1.0f / renormalize_sum);
+}
 
-    // - Partition the last round lower partition into upper and lower
-    // based on the new cutoff value.
-    std::vector<float>& lower_partition = lower_partitions[round & 1];
-    lower_partition.clear();
-    for (const float* ptr = lower_partition_begin; ptr != lower_partition_end; ++ptr) {
-      if (*ptr >= cutoff_values[round]) {
-        upper_partition.push_back(*ptr);
-        upper_partition_sum += *ptr;
-      } else {
-        lower_partition.push_back(*ptr);
-      }
+/*!
+ * \brief Renormalize the probability distribution by the min p value, which masks
+ * the values smaller than `min_p` times the maximum probability.
+ * \param prob The input batch of probability distributions.
+ * \param unit_offset The offset specifying which distribution to output
+ * \param min_p The min p value for renormalization.
+ */
+void RenormalizeProbByMinP(NDArray prob, int unit_offset, double min_p) {
+  ICHECK(prob.IsContiguous());
+  ICHECK(prob.DataType() == DataType::Float(32));
+  ICHECK_EQ(prob->device.device_type, DLDeviceType::kDLCPU);
+
+  if (min_p <= 0.0) {
+    // No renormalization is needed if min_p is 0.
+    return;
+  }
+
+  int64_t vocab_size = prob->shape[prob->ndim - 1];
+  float* __restrict p_prob =
+      static_cast<float*>(__builtin_assume_aligned(prob->data, 4)) + (unit_offset * vocab_size);
+
+  // - Find the max prob. The kernel skips the blocks that cannot update the max value.
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels();
+  float max_prob = 0.0f;
+  float sum_prob = 0.0f;
+  int64_t i = 0;
+  while (i < vocab_size) {
+    i = kernels.skip_blocks_not_above(p_prob, i, vocab_size, max_prob, &sum_prob);
+    const int64_t block_end = std::min(i + CPUSamplerKernels::kBlockSize, vocab_size);
+    for (; i < block_end; ++i) {
+      max_prob = std::max(max_prob, p_prob[i]);
+      sum_prob += p_prob[i];
     }
-    // - If the upper partition sum is at least top p, exit the loop.
-    if (upper_partition_sum >= top_p - eps) {
+    if (1 - sum_prob <= max_prob) {
       break;
     }
   }
+  // - Mask all values smaller than the cutoff to 0 and renormalize.
+  float cutoff = static_cast<float>(min_p * max_prob);
+  float renormalize_sum = kernels.sum_at_least(p_prob, vocab_size, cutoff);
+  kernels.mask_and_scale(p_prob, vocab_size, cutoff, 1.0f / renormalize_sum);
+}
 
-  // - Sort the upper partition in descending order.
-  std::sort(upper_partition.begin(), upper_partition.end(), std::greater<>());
-  // - Find the top p boundary prob value.
-  float boundary_value = -1.0;
-  upper_partition_sum = 0.0;
-  for (float upper_value : upper_partition) {
-    upper_partition_sum += upper_value;
-    if (upper_partition_sum >= top_p - eps) {
-      boundary_value = upper_value;
-      break;
+/*!
+ * \brief Renormalize the probability distribution by the typical p value (locally typical
+ * sampling). The values whose surprisal "-log(p)" is the closest to the entropy of the
+ * distribution are kept until their total probability reaches `typical_p`.
+ * Since the distance is measured in log space, the kept values form a band
+ * [exp(-H - r), exp(-H + r)] around "exp(-H)", and we only need the radius r.
+ * \param prob The input batch of probability distributions.
+ * \param unit_offset The offset specifying which distribution to output
+ * \param typical_p The typical p value for renormalization.
+ * \param eps A small epsilon value for comparison stability.
+ */
+void RenormalizeProbByTypicalP(NDArray prob, int unit_offset, double typical_p, double eps) {
+  ICHECK(prob.IsContiguous());
+  ICHECK(prob.DataType() == DataType::Float(32));
+  ICHECK_EQ(prob->device.device_type, DLDeviceType::kDLCPU);
+
+  if (typical_p >= 1.0) {
+    // No renormalization is needed if typical_p is 1.
+    return;
+  }
+
+  int64_t vocab_size = prob->shape[prob->ndim - 1];
+  float* __restrict p_prob =
+      static_cast<float*>(__builtin_assume_aligned(prob->data, 4)) + (unit_offset * vocab_size);
+
+  // - Compute the entropy.
+  double entropy = 0.0;
+  for (int64_t i = 0; i < vocab_size; ++i) {
+    if (p_prob[i] > 0.0f) {
+      entropy -= p_prob[i] * std::log(p_prob[i]);
     }
   }
-  // - Mask all values smaller than the boundary to 0.
-  float renormalize_sum = 0.0;
-  std::vector<int> upper_partition_indices;
-  upper_partition_indices.reserve(vocab_size);
-  for (int i = 0; i < vocab_size; ++i) {
-    if (p_prob[i] >= boundary_value) {
-      upper_partition_indices.push_back(i);
-      renormalize_sum += p_prob[i];
-    } else {
-      p_prob[i] = 0.0;
+
+  // In most of the cases, the elements no smaller than "typical_p / 256" cover typical p.
+  // Every element below the cutoff is farther from the entropy than "max_exact_distance",
+  // so the candidates collected before reaching that distance are exact.
+  // Otherwise, we fall back to ranking all the nonzero elements.
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels();
+  thread_local std::vector<std::pair<float, int>> candidates;
+  thread_local std::vector<std::pair<double, float>> distances;
+  auto f_find_radius = [&](float cutoff) -> double {
+    candidates.clear();
+    distances.clear();
+    CollectAtLeast(kernels, p_prob, vocab_size, cutoff,
+                   /*stop_sum=*/std::numeric_limits<float>::infinity(), &candidates);
+    for (const auto& [value, index] : candidates) {
+      if (value > 0.0f) {
+        distances.emplace_back(std::fabs(-std::log(value) - entropy), value);
+      }
+    }
+    std::sort(distances.begin(), distances.end());
+    double max_exact_distance = cutoff > 0.0f ? -entropy - std::log(cutoff)
+                                              : std::numeric_limits<double>::infinity();
+    double sum = 0.0;
+    for (const auto& [distance, value] : distances) {
+      if (distance > max_exact_distance) {
+        return -1.0;
+      }
+      sum += value;
+      if (sum >= typical_p - eps) {
+        return distance;
+      }
     }
+    return cutoff > 0.0f ? -1.0 : std::numeric_limits<double>::infinity();
+  };
+  double radius = f_find_radius(static_cast<float>(typical_p / 256));
+  if (radius < 0) {
+    radius = f_find_radius(0.0f);
   }
-  // - Renormalize.
-  for (int idx : upper_partition_indices) {
-    p_prob[idx] /= renormalize_sum;
+
+  // - Mask all values outside of the band to 0 and renormalize.
+  // The band is slightly widened so that the boundary values survive the rounding.
+  float lower = static_cast<float>(std::exp(-entropy - radius) * (1 - eps));
+  float upper = static_cast<float>(std::exp(-entropy + radius) * (1 + eps));
+  float renormalize_sum = 0.0f;
+  for (int64_t i = 0; i < vocab_size; ++i) {
+    float value = p_prob[i] >= lower && p_prob[i] <= upper ? p_prob[i] : 0.0f;
+    renormalize_sum += value;
+    p_prob[i] = value;
   }
+  if (renormalize_sum == 0.0f) {
+    return;
+  }
+  kernels.mask_and_scale(p_prob, vocab_size, 0.0f, 1.0f / renormalize_sum);
 }
 
 namespace detail {
 
 /*! \brief Implementation of getting top probs on CPU. */
-template <int num_top_probs>
-std::vector<TokenProbPair> ComputeTopProbsImpl(const float* p_prob, int ndata) {
-  std::vector<TokenProbPair> top_probs;
-  top_probs.reserve(num_top_probs);
-  for (int i = 0; i < num_top_probs; ++i) {
-    top_probs.emplace_back(-1, -1.0f);
-  }
+inline std::vector<TokenProbPair> ComputeTopProbsImpl(const float* p_prob, int ndata,
+                                                      int num_top_probs) {
+  std::vector<TokenProbPair> top_probs(num_top_probs, {-1, -1.0f});
 
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels();
   float sum_prob = 0.0;
   // Selection argsort.
-  for (int p = 0; p < ndata; ++p) {
-    int i = num_top_probs - 1;
-    for (; i >= 0; --i) {
-      if (p_prob[p] > top_probs[i].second) {
-        if (i != num_top_probs - 1) {
-          top_probs[i + 1] = top_probs[i];
+  // The kernel skips the blocks where no element exceeds the smallest top prob.
+  int64_t p = 0;
+  while (p < ndata) {
+    p = kernels.skip_blocks_not_above(p_prob, p, ndata, top_probs[num_top_probs - 1].second,
+                                      &sum_prob);
+    const int64_t block_end = std::min<int64_t>(p + CPUSamplerKernels::kBlockSize, ndata);
+    for (; p < block_end; ++p) {
+      int i = num_top_probs - 1;
+      for (; i >= 0; --i) {
+        if (p_prob[p] > top_probs[i].second) {
+          if (i != num_top_probs - 1) {
+            top_probs[i + 1] = top_probs[i];
+          }
+        } else {
+          break;
         }
-      } else {
-        break;
       }
-    }
-    if (i != num_top_probs - 1) {
-      top_probs[i + 1] = {p, p_prob[p]};
+      if (i != num_top_probs - 1) {
+        top_probs[i + 1] = {p, p_prob[p]};
+      }
+      sum_prob += p_prob[p];
     }
 
     // Early exit.
-    sum_prob += p_prob[p];
     if (1 - sum_prob <= top_probs[num_top_probs - 1].second) {
       break;
     }
@@ -300,26 +402,15 @@ std::vector<TokenProbPair> ComputeTopProbsImpl(const float* p_prob, int ndata) {
 /*! \brief Get the probs of a few number of tokens with top probabilities. */
 inline std::vector<TokenProbPair> ComputeTopProbs(NDArray prob, int unit_offset,
                                                   int num_top_probs) {
-  ICHECK_LE(num_top_probs, 5);
+  ICHECK_LE(num_top_probs, 20);
   ICHECK_EQ(prob->ndim, 2);
+  if (num_top_probs == 0) {
+    return {};
+  }
   int ndata = prob->shape[1];
   const float* __restrict p_prob =
       static_cast<float*>(__builtin_assume_aligned(prob->data, 4)) + (unit_offset * ndata);
-  switch (num_top_probs) {
-    case 0:
-      return {};
-    case 1:
-      return detail::ComputeTopProbsImpl<1>(p_prob, ndata);
-    case 2:
-      return detail::ComputeTopProbsImpl<2>(p_prob, ndata);
-    case 3:
-      return detail::ComputeTopProbsImpl<3>(p_prob, ndata);
-    case 4:
-      return detail::ComputeTopProbsImpl<4>(p_prob, ndata);
-    case 5:
-      return detail::ComputeTopProbsImpl<5>(p_prob, ndata);
-  }
-  throw;
+  return detail::ComputeTopProbsImpl(p_prob, ndata, num_top_probs);
 }
 
 /********************* CPU Sampler *********************/
@@ -354,29 +445,42 @@ class CPUSampler : public SamplerObj {
     ICHECK_EQ(request_ids.size(), num_samples);
     ICHECK_EQ(generation_cfg.size(), num_samples);
 
-    std::vector<int> top_p_indices;
-    std::vector<double> top_p_values;
+    // The typical p, top p and min p filters are applied in order, each on the
+    // distribution renormalized by the previous ones.
+    std::vector<int> renorm_indices;
+    std::vector<int> renorm_cfg_indices;
     for (int i = 0; i < num_samples; ++i) {
-      if (top_p_indices.empty() || top_p_indices.back() != sample_indices[i]) {
-        top_p_indices.push_back(sample_indices[i]);
-        top_p_values.push_back(generation_cfg[i]->top_p);
+      if (renorm_indices.empty() || renorm_indices.back() != sample_indices[i]) {
+        renorm_indices.push_back(sample_indices[i]);
+        renorm_cfg_indices.push_back(i);
       } else {
-        CHECK(fabs(top_p_values.back() - generation_cfg[i]->top_p) < eps_)
+        const GenerationConfig& cfg = generation_cfg[renorm_cfg_indices.back()];
+        CHECK(fabs(cfg->top_p - generation_cfg[i]->top_p) < eps_)
             << "Sampler requires the top_p values for each prob distribution are the same.";
+        CHECK(fabs(cfg->min_p - generation_cfg[i]->min_p) < eps_)
+            << "Sampler requires the min_p values for each prob distribution are the same.";
+        CHECK(fabs(cfg->typical_p - generation_cfg[i]->typical_p) < eps_)
+            << "Sampler requires the typical_p values for each prob distribution are the same.";
       }
     }
-    if (top_p_indices.empty()) {
+    if (renorm_indices.empty()) {
       // Return if no top p needs to apply.
       return probs_on_host;
     }
 
-    tvm::runtime::parallel_for_with_threading_backend(
-        [this, &probs_on_host, &request_ids, &top_p_indices, &top_p_values](int i) {
-          RECORD_EVENT(this->trace_recorder_, request_ids[i], "start renormalize by top p");
-          RenormalizeProbByTopP(probs_on_host, top_p_indices[i], top_p_values[i], eps_);
-          RECORD_EVENT(this->trace_recorder_, request_ids[i], "finish renormalize by top p");
+    ParallelForEachSample(
+        [this, &probs_on_host, &request_ids, &generation_cfg, &renorm_indices,
+         &renorm_cfg_indices](int i) {
+          const GenerationConfig& cfg = generation_cfg[renorm_cfg_indices[i]];
+          RECORD_EVENT(this->trace_recorder_, request_ids[renorm_cfg_indices[i]],
+                       "start renormalize by top p");
+          RenormalizeProbByTypicalP(probs_on_host, renorm_indices[i], cfg->typical_p, eps_);
+          RenormalizeProbByTopP(probs_on_host, renorm_indices[i], cfg->top_p, eps_);
+          RenormalizeProbByMinP(probs_on_host, renorm_indices[i], cfg->min_p);
+          RECORD_EVENT(this->trace_recorder_, request_ids[renorm_cfg_indices[i]],
+                       "finish renormalize by top p");
         },
-        0, static_cast<int64_t>(top_p_indices.size()));
+        0, static_cast<int64_t>(renorm_indices.size()));
 
     return probs_on_host;
   }
@@ -408,6 +512,27 @@ class CPUSampler : public SamplerObj {
                                  /*top_p_applied=*/true);
   }
 
+  std::vector<SampleResult> BatchTakeTokenProbs(NDArray probs_on_device,
+                                                const std::vector<int32_t>& token_ids,
+                                                int num_top_probs) final {
+    // probs_on_device: (n, v)
+    CHECK_EQ(probs_on_device->ndim, 2);
+    int num_samples = token_ids.size();
+    ICHECK_EQ(probs_on_device->shape[0], num_samples);
+    NDArray probs_on_host = CopyProbsToCPU(probs_on_device);
+    int vocab_size = probs_on_host->shape[1];
+    const float* p_probs = static_cast<const float*>(probs_on_host->data);
+    std::vector<SampleResult> sample_results(num_samples);
+    ParallelForEachSample(
+        [&](int i) {
+          sample_results[i].sampled_token_id = {
+              token_ids[i], p_probs[static_cast<int64_t>(i) * vocab_size + token_ids[i]]};
+          sample_results[i].top_prob_tokens = ComputeTopProbs(probs_on_host, i, num_top_probs);
+        },
+        0, num_samples);
+    return sample_results;
+  }
+
   std::pair<std::vector<std::vector<SampleResult>>, std::vector<int>>
   BatchVerifyDraftTokensWithProbAfterTopP(
       NDArray probs_on_host, const Array<String>& request_ids,
@@ -423,7 +548,10 @@ class CPUSampler : public SamplerObj {
     CHECK_EQ(rngs.size(), num_sequence);
     CHECK_EQ(draft_output_tokens.size(), num_sequence);
 
-    NDArray draft_probs_on_host = draft_probs_on_device.CopyTo(DLDevice{kDLCPU, 0});
+    // Undefined draft probs mean the draft tokens are proposed deterministically.
+    NDArray draft_probs_on_host = draft_probs_on_device.defined()
+                                      ? draft_probs_on_device.CopyTo(DLDevice{kDLCPU, 0})
+                                      : NDArray{nullptr};
     std::vector<std::vector<SampleResult>> sample_results;
     sample_results.resize(num_sequence);
 
@@ -432,7 +560,8 @@ class CPUSampler : public SamplerObj {
     int vocab_size = probs_on_host->shape[1];
 
     std::vector<int> last_accepted_tree_node(num_sequence, 0);
-    tvm::runtime::parallel_for_with_threading_backend(
+    // Each sequence draws from its own generator sequentially, so the draws are deterministic.
+    ParallelForEachSample(
         [&](int i) {
           int verify_start = cum_verify_lengths[i];
           int verify_end = cum_verify_lengths[i + 1];
@@ -469,13 +598,20 @@ class CPUSampler : public SamplerObj {
 
             // normalize a new probability distribution
             double sum_v = 0.0;
-            const float* __restrict p_qdist =
-                static_cast<float*>(__builtin_assume_aligned(draft_probs_on_host->data, 4)) +
-                (verify_start + cur_token_idx + 1) * vocab_size;
-
-            for (int j = 0; j < vocab_size; ++j) {
-              p_probs[j] = std::max(p_probs[j] - p_qdist[j], 0.0f);
-              sum_v += p_probs[j];
+            if (draft_probs_on_host.defined()) {
+              const float* __restrict p_qdist =
+                  static_cast<float*>(__builtin_assume_aligned(draft_probs_on_host->data, 4)) +
+                  (verify_start + cur_token_idx + 1) * vocab_size;
+              for (int j = 0; j < vocab_size; ++j) {
+                p_probs[j] = std::max(p_probs[j] - p_qdist[j], 0.0f);
+                sum_v += p_probs[j];
+              }
+            } else {
+              // The one-hot draft distribution only removes the draft token.
+              p_probs[cur_token] = 0.0f;
+              for (int j = 0; j < vocab_size; ++j) {
+                sum_v += p_probs[j];
+              }
             }
             for (int j = 0; j < vocab_size; ++j) {
               p_probs[j] /= sum_v;
@@ -530,10 +666,11 @@ class CPUSampler : public SamplerObj {
 
     std::vector<SampleResult> sample_results;
     sample_results.resize(n);
+    std::vector<double> uniform_samples = DrawUniformSamples(rngs);
 
-    tvm::runtime::parallel_for_with_threading_backend(
-        [this, &sample_results, &probs_on_host, &generation_cfg, &rngs, &request_ids, top_p_applied,
-         sample_indices](int i) {
+    ParallelForEachSample(
+        [this, &sample_results, &probs_on_host, &generation_cfg, &uniform_samples, &request_ids,
+         top_p_applied, &sample_indices](int i) {
           RECORD_EVENT(this->trace_recorder_, request_ids[i], "start sample token");
           // Sample top p from probability.
           double top_p =
@@ -541,7 +678,7 @@ class CPUSampler : public SamplerObj {
                   ? 1.0f
                   : (generation_cfg[i]->temperature < eps_ ? 0.0 : generation_cfg[i]->top_p);
           sample_results[i].sampled_token_id = SampleTopPFromProb(
-              probs_on_host, i, sample_indices[i], top_p, rngs[i]->GetRandomNumber());
+              probs_on_host, i, sample_indices[i], top_p, uniform_samples[i]);
           sample_results[i].top_prob_tokens =
               ComputeTopProbs(probs_on_host, i, generation_cfg[i]->top_logprobs);
           RECORD_EVENT(this->trace_recorder_, request_ids[i], "finish sample token");
@@ -551,6 +688,36 @@ class CPUSampler : public SamplerObj {
     return sample_results;
   }
 
+  /*!
+   * \brief Draw one random number for each sample from its generator, in the sample order.
+   * A generator may be shared by multiple samples (e.g., the leaves of a draft token tree),
+   * so we draw on the calling thread to keep the results deterministic and race-free.
+   */
+  static std::vector<double> DrawUniformSamples(const std::vector<RandomGenerator*>& rngs) {
+    std::vector<double> uniform_samples;
+    uniform_samples.reserve(rngs.size());
+    for (RandomGenerator* rng : rngs) {
+      uniform_samples.push_back(rng->GetRandomNumber());
+    }
+    return uniform_samples;
+  }
+
+  /*!
+   * \brief Run the function for each sample in [begin, end) over the threading backend pool,
+   * whose concurrency is set by the engine. Small batches run inline on the calling thread,
+   * where the pool launch overhead outweighs the per-sample work.
+   */
+  template <typename FLambda>
+  static void ParallelForEachSample(FLambda f, int64_t begin, int64_t end) {
+    if (end - begin <= 1 || tvm::runtime::threading::MaxConcurrency() <= 1) {
+      for (int64_t i = begin; i < end; ++i) {
+        f(i);
+      }
+      return;
+    }
+    tvm::runtime::parallel_for_with_threading_backend(f, begin, end);
+  }
+
   /*! \brief Copy prob distributions from device to CPU. */
   NDArray CopyProbsToCPU(NDArray probs_on_device) {
     // probs_on_device: (n, v)
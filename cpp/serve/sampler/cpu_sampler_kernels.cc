@@ -0,0 +1,433 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/sampler/cpu_sampler_kernels.cc
+ * \brief The implementation of the vectorized scan kernels used by the CPU sampler.
+ * The x86 kernels are compiled with function target attributes and selected at runtime,
+ * so that the library does not require the target instruction sets at build time.
+ */
+#include "cpu_sampler_kernels.h"
+
+#include <tvm/runtime/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MLC_LLM_CPU_SAMPLER_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define MLC_LLM_CPU_SAMPLER_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+constexpr int64_t kBlockSize = CPUSamplerKernels::kBlockSize;
+
+/********************* Scalar Kernels *********************/
+
+int64_t SkipBlocksNotAboveScalar(const float* p, int64_t begin, int64_t end, float threshold,
+                                 float* skipped_sum) {
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    bool found = false;
+    float block_sum = 0.0f;
+    for (int64_t j = 0; j < kBlockSize; ++j) {
+      found |= p[i + j] > threshold;
+      block_sum += p[i + j];
+    }
+    if (found) break;
+    *skipped_sum += block_sum;
+  }
+  return i;
+}
+
+int64_t SkipBlocksBelowPrefixSumScalar(const float* p, int64_t begin, int64_t end, double target,
+                                       double* prefix_sum) {
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    float block_sum = 0.0f;
+    for (int64_t j = 0; j < kBlockSize; ++j) {
+      block_sum += p[i + j];
+    }
+    if (*prefix_sum + block_sum >= target) break;
+    *prefix_sum += block_sum;
+  }
+  return i;
+}
+
+float SumAtLeastScalar(const float* p, int64_t n, float threshold) {
+  float sum = 0.0f;
+  for (int64_t i = 0; i < n; ++i) {
+    sum += p[i] >= threshold ? p[i] : 0.0f;
+  }
+  return sum;
+}
+
+void MaskAndScaleScalar(float* p, int64_t n, float threshold, float scale) {
+  for (int64_t i = 0; i < n; ++i) {
+    p[i] = p[i] >= threshold ? p[i] * scale : 0.0f;
+  }
+}
+
+/********************* x86 Kernels *********************/
+
+#ifdef MLC_LLM_CPU_SAMPLER_X86
+
+__attribute__((target("avx2"))) inline float HorizontalSumAVX2(__m256 v) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2"))) int64_t SkipBlocksNotAboveAVX2(const float* p, int64_t begin,
+                                                               int64_t end, float threshold,
+                                                               float* skipped_sum) {
+  const __m256 vthreshold = _mm256_set1_ps(threshold);
+  __m256 vsum = _mm256_setzero_ps();
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    __m256 lo = _mm256_loadu_ps(p + i);
+    __m256 hi = _mm256_loadu_ps(p + i + 8);
+    __m256 above = _mm256_or_ps(_mm256_cmp_ps(lo, vthreshold, _CMP_GT_OQ),
+                                _mm256_cmp_ps(hi, vthreshold, _CMP_GT_OQ));
+    if (_mm256_movemask_ps(above) != 0) break;
+    vsum = _mm256_add_ps(vsum, _mm256_add_ps(lo, hi));
+  }
+  *skipped_sum += HorizontalSumAVX2(vsum);
+  return i;
+}
+
+__attribute__((target("avx2"))) int64_t SkipBlocksBelowPrefixSumAVX2(const float* p,
+                                                                     int64_t begin, int64_t end,
+                                                                     double target,
+                                                                     double* prefix_sum) {
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    float block_sum =
+        HorizontalSumAVX2(_mm256_add_ps(_mm256_loadu_ps(p + i), _mm256_loadu_ps(p + i + 8)));
+    if (*prefix_sum + block_sum >= target) break;
+    *prefix_sum += block_sum;
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) float SumAtLeastAVX2(const float* p, int64_t n,
+                                                     float threshold) {
+  const __m256 vthreshold = _mm256_set1_ps(threshold);
+  __m256 vsum = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(p + i);
+    vsum = _mm256_add_ps(vsum, _mm256_and_ps(v, _mm256_cmp_ps(v, vthreshold, _CMP_GE_OQ)));
+  }
+  return HorizontalSumAVX2(vsum) + SumAtLeastScalar(p + i, n - i, threshold);
+}
+
+__attribute__((target("avx2"))) void MaskAndScaleAVX2(float* p, int64_t n, float threshold,
+                                                      float scale) {
+  const __m256 vthreshold = _mm256_set1_ps(threshold);
+  const __m256 vscale = _mm256_set1_ps(scale);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(p + i);
+    __m256 mask = _mm256_cmp_ps(v, vthreshold, _CMP_GE_OQ);
+    _mm256_storeu_ps(p + i, _mm256_and_ps(_mm256_mul_ps(v, vscale), mask));
+  }
+  MaskAndScaleScalar(p + i, n - i, threshold, scale);
+}
+
+__attribute__((target("avx512f"))) inline float HorizontalSumAVX512(__m512 v) {
+  alignas(64) float lanes[16];
+  _mm512_store_ps(lanes, v);
+  return HorizontalSumAVX2(_mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+__attribute__((target("avx512f"))) int64_t SkipBlocksNotAboveAVX512(const float* p,
+                                                                    int64_t begin, int64_t end,
+                                                                    float threshold,
+                                                                    float* skipped_sum) {
+  const __m512 vthreshold = _mm512_set1_ps(threshold);
+  __m512 vsum = _mm512_setzero_ps();
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    __m512 v = _mm512_loadu_ps(p + i);
+    if (_mm512_cmp_ps_mask(v, vthreshold, _CMP_GT_OQ) != 0) break;
+    vsum = _mm512_add_ps(vsum, v);
+  }
+  *skipped_sum += HorizontalSumAVX512(vsum);
+  return i;
+}
+
+__attribute__((target("avx512f"))) int64_t SkipBlocksBelowPrefixSumAVX512(const float* p,
+                                                                         int64_t begin,
+                                                                         int64_t end,
+                                                                         double target,
+                                                                         double* prefix_sum) {
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    float block_sum = HorizontalSumAVX512(_mm512_loadu_ps(p + i));
+    if (*prefix_sum + block_sum >= target) break;
+    *prefix_sum += block_sum;
+  }
+  return i;
+}
+
+__attribute__((target("avx512f"))) float SumAtLeastAVX512(const float* p, int64_t n,
+                                                          float threshold) {
+  const __m512 vthreshold = _mm512_set1_ps(threshold);
+  __m512 vsum = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(p + i);
+    vsum = _mm512_mask_add_ps(vsum, _mm512_cmp_ps_mask(v, vthreshold, _CMP_GE_OQ), vsum, v);
+  }
+  return HorizontalSumAVX512(vsum) + SumAtLeastScalar(p + i, n - i, threshold);
+}
+
+__attribute__((target("avx512f"))) void MaskAndScaleAVX512(float* p, int64_t n, float threshold,
+                                                           float scale) {
+  const __m512 vthreshold = _mm512_set1_ps(threshold);
+  const __m512 vscale = _mm512_set1_ps(scale);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(p + i);
+    __mmask16 mask = _mm512_cmp_ps_mask(v, vthreshold, _CMP_GE_OQ);
+    _mm512_storeu_ps(p + i, _mm512_maskz_mul_ps(mask, v, vscale));
+  }
+  MaskAndScaleScalar(p + i, n - i, threshold, scale);
+}
+
+#endif  // MLC_LLM_CPU_SAMPLER_X86
+
+/********************* NEON Kernels *********************/
+
+#ifdef MLC_LLM_CPU_SAMPLER_NEON
+
+int64_t SkipBlocksNotAboveNEON(const float* p, int64_t begin, int64_t end, float threshold,
+                               float* skipped_sum) {
+  const float32x4_t vthreshold = vdupq_n_f32(threshold);
+  float32x4_t vsum = vdupq_n_f32(0.0f);
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    float32x4_t v0 = vld1q_f32(p + i);
+    float32x4_t v1 = vld1q_f32(p + i + 4);
+    float32x4_t v2 = vld1q_f32(p + i + 8);
+    float32x4_t v3 = vld1q_f32(p + i + 12);
+    uint32x4_t above = vorrq_u32(vorrq_u32(vcgtq_f32(v0, vthreshold), vcgtq_f32(v1, vthreshold)),
+                                 vorrq_u32(vcgtq_f32(v2, vthreshold), vcgtq_f32(v3, vthreshold)));
+    if (vmaxvq_u32(above) != 0) break;
+    vsum = vaddq_f32(vsum, vaddq_f32(vaddq_f32(v0, v1), vaddq_f32(v2, v3)));
+  }
+  *skipped_sum += vaddvq_f32(vsum);
+  return i;
+}
+
+int64_t SkipBlocksBelowPrefixSumNEON(const float* p, int64_t begin, int64_t end, double target,
+                                     double* prefix_sum) {
+  int64_t i = begin;
+  for (; i + kBlockSize <= end; i += kBlockSize) {
+    float32x4_t v = vaddq_f32(vaddq_f32(vld1q_f32(p + i), vld1q_f32(p + i + 4)),
+                              vaddq_f32(vld1q_f32(p + i + 8), vld1q_f32(p + i + 12)));
+    float block_sum = vaddvq_f32(v);
+    if (*prefix_sum + block_sum >= target) break;
+    *prefix_sum += block_sum;
+  }
+  return i;
+}
+
+float SumAtLeastNEON(const float* p, int64_t n, float threshold) {
+  const float32x4_t vthreshold = vdupq_n_f32(threshold);
+  float32x4_t vsum = vdupq_n_f32(0.0f);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vld1q_f32(p + i);
+    uint32x4_t mask = vcgeq_f32(v, vthreshold);
+    vsum = vaddq_f32(vsum, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), mask)));
+  }
+  return vaddvq_f32(vsum) + SumAtLeastScalar(p + i, n - i, threshold);
+}
+
+void MaskAndScaleNEON(float* p, int64_t n, float threshold, float scale) {
+  const float32x4_t vthreshold = vdupq_n_f32(threshold);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vld1q_f32(p + i);
+    uint32x4_t mask = vcgeq_f32(v, vthreshold);
+    uint32x4_t scaled = vreinterpretq_u32_f32(vmulq_n_f32(v, scale));
+    vst1q_f32(p + i, vreinterpretq_f32_u32(vandq_u32(scaled, mask)));
+  }
+  MaskAndScaleScalar(p + i, n - i, threshold, scale);
+}
+
+#endif  // MLC_LLM_CPU_SAMPLER_NEON
+
+/********************* Dispatch *********************/
+
+bool CPUKernelISASupported(CPUKernelISA isa) {
+  switch (isa) {
+    case CPUKernelISA::kScalar:
+      return true;
+    case CPUKernelISA::kNEON:
+#ifdef MLC_LLM_CPU_SAMPLER_NEON
+      return true;
+#else
+      return false;
+#endif
+    case CPUKernelISA::kAVX2:
+    case CPUKernelISA::kAVX512:
+#ifdef MLC_LLM_CPU_SAMPLER_X86
+      __builtin_cpu_init();
+      return isa == CPUKernelISA::kAVX2 ? __builtin_cpu_supports("avx2")
+                                        : __builtin_cpu_supports("avx512f");
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+CPUKernelISA DetectCPUKernelISA() {
+  for (CPUKernelISA isa : {CPUKernelISA::kAVX512, CPUKernelISA::kAVX2, CPUKernelISA::kNEON}) {
+    if (CPUKernelISASupported(isa)) {
+      return isa;
+    }
+  }
+  return CPUKernelISA::kScalar;
+}
+
+std::string CPUKernelISAToString(CPUKernelISA isa) {
+  switch (isa) {
+    case CPUKernelISA::kScalar:
+      return "scalar";
+    case CPUKernelISA::kNEON:
+      return "neon";
+    case CPUKernelISA::kAVX2:
+      return "avx2";
+    case CPUKernelISA::kAVX512:
+      return "avx512";
+  }
+  LOG(FATAL) << "Invalid CPU kernel ISA: " << static_cast<int>(isa);
+  throw;
+}
+
+const CPUSamplerKernels& GetCPUSamplerKernels(CPUKernelISA isa) {
+  static const CPUSamplerKernels scalar_kernels{CPUKernelISA::kScalar, SkipBlocksNotAboveScalar,
+                                                SkipBlocksBelowPrefixSumScalar, SumAtLeastScalar,
+                                                MaskAndScaleScalar};
+  CHECK(CPUKernelISASupported(isa)) << "The CPU sampler kernels of ISA \""
+                                    << CPUKernelISAToString(isa)
+                                    << "\" are not supported on this CPU.";
+  switch (isa) {
+#ifdef MLC_LLM_CPU_SAMPLER_X86
+    case CPUKernelISA::kAVX2: {
+      static const CPUSamplerKernels avx2_kernels{CPUKernelISA::kAVX2, SkipBlocksNotAboveAVX2,
+                                                  SkipBlocksBelowPrefixSumAVX2, SumAtLeastAVX2,
+                                                  MaskAndScaleAVX2};
+      return avx2_kernels;
+    }
+    case CPUKernelISA::kAVX512: {
+      static const CPUSamplerKernels avx512_kernels{
+          CPUKernelISA::kAVX512, SkipBlocksNotAboveAVX512, SkipBlocksBelowPrefixSumAVX512,
+          SumAtLeastAVX512, MaskAndScaleAVX512};
+      return avx512_kernels;
+    }
+#endif
+#ifdef MLC_LLM_CPU_SAMPLER_NEON
+    case CPUKernelISA::kNEON: {
+      static const CPUSamplerKernels neon_kernels{CPUKernelISA::kNEON, SkipBlocksNotAboveNEON,
+                                                  SkipBlocksBelowPrefixSumNEON, SumAtLeastNEON,
+                                                  MaskAndScaleNEON};
+      return neon_kernels;
+    }
+#endif
+    default:
+      return scalar_kernels;
+  }
+}
+
+const CPUSamplerKernels& GetCPUSamplerKernels() {
+  static const CPUSamplerKernels& kernels = GetCPUSamplerKernels(DetectCPUKernelISA());
+  return kernels;
+}
+
+/********************* Generic Algorithms *********************/
+
+float CollectAtLeast(const CPUSamplerKernels& kernels, const float* p, int64_t n, float cutoff,
+                     float stop_sum, std::vector<std::pair<float, int>>* out) {
+  // For non-NaN floats, "x > nextafter(cutoff, -inf)" is equivalent to "x >= cutoff".
+  const float threshold = std::nextafter(cutoff, -std::numeric_limits<float>::infinity());
+  float collected_sum = 0.0f;
+  float skipped_sum = 0.0f;
+  int64_t i = 0;
+  while (i < n) {
+    i = kernels.skip_blocks_not_above(p, i, n, threshold, &skipped_sum);
+    const int64_t block_end = std::min(i + kBlockSize, n);
+    for (; i < block_end; ++i) {
+      if (p[i] >= cutoff) {
+        collected_sum += p[i];
+        out->emplace_back(p[i], static_cast<int>(i));
+        if (collected_sum > stop_sum) {
+          return collected_sum;
+        }
+      }
+    }
+  }
+  return collected_sum;
+}
+
+float FindTopPBoundary(const float* p, int64_t n, double target) {
+  // Non-negative floats are ordered as their bit patterns, so we select the boundary
+  // digit by digit from the highest bits, weighting each bucket by its probability mass.
+  constexpr int kNumPasses = 3;
+  constexpr int kPassBits[kNumPasses] = {11, 11, 10};
+  thread_local std::vector<double> bucket_mass;
+  thread_local std::vector<float> candidates[2];
+  auto f_bucket = [](float value, int shift, uint32_t mask) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits >> shift) & mask;
+  };
+
+  const float* data = p;
+  int64_t size = n;
+  double mass_above = 0.0;
+  int shift = 32;
+  for (int pass = 0; pass < kNumPasses; ++pass) {
+    const uint32_t num_buckets = 1u << kPassBits[pass];
+    shift -= kPassBits[pass];
+    bucket_mass.assign(num_buckets, 0.0);
+    for (int64_t i = 0; i < size; ++i) {
+      bucket_mass[f_bucket(data[i], shift, num_buckets - 1)] += data[i];
+    }
+    int64_t bucket = static_cast<int64_t>(num_buckets) - 1;
+    for (; bucket >= 0; --bucket) {
+      if (bucket_mass[bucket] > 0 && mass_above + bucket_mass[bucket] >= target) break;
+      mass_above += bucket_mass[bucket];
+    }
+    if (bucket < 0) {
+      return 0.0f;
+    }
+    // Keep the elements in the selected bucket as the candidates of the next pass.
+    std::vector<float>& next_candidates = candidates[pass & 1];
+    next_candidates.clear();
+    for (int64_t i = 0; i < size; ++i) {
+      if (f_bucket(data[i], shift, num_buckets - 1) == static_cast<uint32_t>(bucket)) {
+        next_candidates.push_back(data[i]);
+      }
+    }
+    data = next_candidates.data();
+    size = next_candidates.size();
+  }
+  // All the bits are selected, so the remaining candidates have the same value.
+  return data[0];
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
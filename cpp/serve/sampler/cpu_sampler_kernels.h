@@ -0,0 +1,119 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/sampler/cpu_sampler_kernels.h
+ * \brief The vectorized scan kernels used by the CPU sampler.
+ */
+#ifndef MLC_LLM_SERVE_SAMPLER_CPU_SAMPLER_KERNELS_H_
+#define MLC_LLM_SERVE_SAMPLER_CPU_SAMPLER_KERNELS_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The instruction set a kernel table is implemented with. */
+enum class CPUKernelISA : int {
+  kScalar = 0,
+  kNEON = 1,
+  kAVX2 = 2,
+  kAVX512 = 3,
+};
+
+/*!
+ * \brief The table of scan kernels over a probability distribution on CPU.
+ * The kernels walk the input in blocks of `kBlockSize` elements and leave the
+ * incomplete tail block to the caller, so that every instruction set produces
+ * the same block boundaries.
+ */
+struct CPUSamplerKernels {
+  /*! \brief The number of elements a kernel handles per step. */
+  static constexpr int64_t kBlockSize = 16;
+
+  /*! \brief The instruction set of the kernels. */
+  CPUKernelISA isa;
+  /*!
+   * \brief Skip the blocks starting from `begin` where no element is larger than the threshold.
+   * \param p The input values.
+   * \param begin The start position of the scan.
+   * \param end The end position of the scan.
+   * \param threshold The threshold to compare with.
+   * \param skipped_sum The sum of the skipped elements, added to the existing value.
+   * \return The start of the first block having an element larger than the threshold,
+   * or the start of the incomplete tail block.
+   */
+  int64_t (*skip_blocks_not_above)(const float* p, int64_t begin, int64_t end, float threshold,
+                                   float* skipped_sum);
+  /*!
+   * \brief Skip the blocks starting from `begin` as long as the running prefix sum
+   * stays smaller than the target.
+   * \param p The input values.
+   * \param begin The start position of the scan.
+   * \param end The end position of the scan.
+   * \param target The target prefix sum.
+   * \param prefix_sum The running prefix sum, updated with the skipped elements.
+   * \return The start of the first block reaching the target,
+   * or the start of the incomplete tail block.
+   */
+  int64_t (*skip_blocks_below_prefix_sum)(const float* p, int64_t begin, int64_t end,
+                                          double target, double* prefix_sum);
+  /*! \brief Return the sum of the elements no smaller than the threshold. */
+  float (*sum_at_least)(const float* p, int64_t n, float threshold);
+  /*!
+   * \brief Multiply the elements no smaller than the threshold by the scale,
+   * and set the other elements to zero.
+   */
+  void (*mask_and_scale)(float* p, int64_t n, float threshold, float scale);
+};
+
+/*! \brief Return the most capable instruction set supported by the running CPU. */
+CPUKernelISA DetectCPUKernelISA();
+
+/*! \brief Return whether the given instruction set is supported by the running CPU. */
+bool CPUKernelISASupported(CPUKernelISA isa);
+
+/*! \brief Return the name of the instruction set. */
+std::string CPUKernelISAToString(CPUKernelISA isa);
+
+/*! \brief Return the kernel table of the most capable instruction set, detected once. */
+const CPUSamplerKernels& GetCPUSamplerKernels();
+
+/*!
+ * \brief Return the kernel table of the given instruction set.
+ * \throw Error if the instruction set is not supported by the running CPU.
+ */
+const CPUSamplerKernels& GetCPUSamplerKernels(CPUKernelISA isa);
+
+/*!
+ * \brief Collect the (value, index) pairs of the elements no smaller than the cutoff.
+ * The scan stops right after the collected sum exceeds `stop_sum`.
+ * \param kernels The kernel table to use.
+ * \param p The input values.
+ * \param n The number of input values.
+ * \param cutoff The cutoff value.
+ * \param stop_sum The collected sum to stop the scan at.
+ * \param out The output pairs, appended in index order.
+ * \return The sum of the collected values.
+ */
+float CollectAtLeast(const CPUSamplerKernels& kernels, const float* p, int64_t n, float cutoff,
+                     float stop_sum, std::vector<std::pair<float, int>>* out);
+
+/*!
+ * \brief Find the smallest value whose "no smaller than" set has a total probability of at
+ * least the target, with a mass-weighted radix select over the float bit patterns.
+ * It takes linear time regardless of how flat the distribution is.
+ * \param p The input probabilities, which should be non-negative.
+ * \param n The number of input probabilities.
+ * \param target The target total probability.
+ * \return The boundary value, or 0 when the total probability is below the target.
+ */
+float FindTopPBoundary(const float* p, int64_t n, double target);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_SAMPLER_CPU_SAMPLER_KERNELS_H_
@@ -8,7 +8,11 @@
 #include <tvm/runtime/nvtx.h>
 #include <tvm/runtime/packed_func.h>
 
+#include <algorithm>
+#include <numeric>
+
 #include "../../support/random.h"
+#include "../device_timer.h"
 #include "sampler.h"
 
 namespace mlc {
@@ -49,17 +53,24 @@ inline void SyncCopyStream(Device device, TVMStreamHandle compute_stream,
 class GPUSampler : public SamplerObj {
  public:
   explicit GPUSampler(int max_num_sample, int vocab_size, FunctionTable* ft, DLDevice device,
-                      Optional<EventTraceRecorder> trace_recorder)
+                      Optional<EventTraceRecorder> trace_recorder, bool batch_invariant)
       : max_num_sample_(max_num_sample),
         vocab_size_(vocab_size),
+        batch_invariant_(batch_invariant),
         flashinfer_sampling_available_(FlashInferSamplingAvailable(device)),
         device_(device),
         gpu_multinomial_from_uniform_func_(ft->gpu_multinomial_from_uniform_func_),
         gpu_argsort_probs_func_(ft->gpu_argsort_probs_func_),
         gpu_sample_with_top_p_func_(ft->gpu_sample_with_top_p_func_),
         gpu_sampler_take_probs_func_(ft->gpu_sampler_take_probs_func_),
+        gpu_sampler_top_k_probs_func_(ft->gpu_sampler_top_k_probs_func_),
         gpu_verify_draft_tokens_func_(ft->gpu_verify_draft_tokens_func_),
+        gpu_verify_deterministic_draft_tokens_func_(
+            ft->gpu_verify_deterministic_draft_tokens_func_),
         gpu_renormalize_by_top_p_func_(ft->gpu_renormalize_by_top_p_func_),
+        gpu_renormalize_by_min_p_func_(ft->gpu_renormalize_by_min_p_func_),
+        gpu_renormalize_by_typical_p_func_(ft->gpu_renormalize_by_typical_p_func_),
+        gpu_check_stop_func_(ft->gpu_check_stop_func_),
         trace_recorder_(std::move(trace_recorder)) {
     ICHECK(gpu_multinomial_from_uniform_func_.defined());
     ICHECK(gpu_argsort_probs_func_.defined());
@@ -70,15 +81,17 @@ class GPUSampler : public SamplerObj {
         Registry::Get("flashinfer.sampling.parallel_sampling_from_prob");
 
     Device preferred_host_device = GetPreferredHostDevice(device);
-    // We support at most 5 top prob results for each sequence.
+    // We support at most 20 top prob results for each sequence.
     // Initialize auxiliary arrays on CPU.
     uniform_samples_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, preferred_host_device);
     sample_indices_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
     top_p_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, preferred_host_device);
+    min_p_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, preferred_host_device);
+    typical_p_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, preferred_host_device);
     top_p_init_pivots_host_ = NDArray::Empty({max_num_sample, num_top_p_cutoff_pivots_}, dtype_f32_,
                                              preferred_host_device);
     top_prob_offsets_host_ =
-        NDArray::Empty({max_num_sample * 5}, dtype_i32_, preferred_host_device);
+        NDArray::Empty({max_num_sample * kMaxTopProbs}, dtype_i32_, preferred_host_device);
     draft_tokens_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
     token_tree_first_child_host_ =
         NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
@@ -87,22 +100,33 @@ class GPUSampler : public SamplerObj {
     token_tree_parent_ptr_host_ =
         NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
     sampled_token_ids_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
+    stop_token_indptr_host_ =
+        NDArray::Empty({max_num_sample + 1}, dtype_i32_, preferred_host_device);
+    stop_token_ids_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
+    num_remaining_tokens_host_ =
+        NDArray::Empty({max_num_sample}, dtype_i32_, preferred_host_device);
     sampled_probs_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, preferred_host_device);
-    top_prob_probs_host_ = NDArray::Empty({max_num_sample * 5}, dtype_f32_, preferred_host_device);
+    top_prob_probs_host_ =
+        NDArray::Empty({max_num_sample * kMaxTopProbs}, dtype_f32_, preferred_host_device);
     top_prob_indices_host_ =
-        NDArray::Empty({max_num_sample * 5}, dtype_i32_, preferred_host_device);
+        NDArray::Empty({max_num_sample * kMaxTopProbs}, dtype_i32_, preferred_host_device);
     // Initialize auxiliary arrays on GPU.
     uniform_samples_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
     sample_indices_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     top_p_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
+    min_p_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
+    typical_p_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
     top_p_init_pivots_device_ =
         NDArray::Empty({max_num_sample, num_top_p_cutoff_pivots_}, dtype_f32_, device);
-    top_prob_offsets_device_ = NDArray::Empty({max_num_sample * 5}, dtype_i32_, device);
+    top_prob_offsets_device_ = NDArray::Empty({max_num_sample * kMaxTopProbs}, dtype_i32_, device);
     draft_tokens_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     token_tree_first_child_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     token_tree_next_sibling_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     token_tree_parent_ptr_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     sampled_token_ids_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
+    stop_token_indptr_device_ = NDArray::Empty({max_num_sample + 1}, dtype_i32_, device);
+    stop_token_ids_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
+    num_remaining_tokens_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
 
     // If the device is CUDA/ROCm, we create a standalone copy stream, in
     // purpose to hide the latency of auxiliary stream copy.
@@ -126,6 +150,7 @@ class GPUSampler : public SamplerObj {
                                       const Array<String>& request_ids,        //
                                       const Array<GenerationConfig>& generation_cfg) final {
     NVTXScopedRange nvtx_scope("BatchRenormalizeProbsByTopP");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kSampling, device_);
     // probs_on_device: (n, v)
     RECORD_EVENT(trace_recorder_, request_ids, "start renormalization by top p");
     CHECK_EQ(probs_on_device->ndim, 2);
@@ -135,44 +160,58 @@ class GPUSampler : public SamplerObj {
     ICHECK_LE(num_probs, max_num_sample_);
     ICHECK_EQ(generation_cfg.size(), num_samples);
 
-    // - Check if there is need for applying top p.
+    // - Check if there is need for applying top p, min p or typical p.
     bool need_top_p = CheckTopP(generation_cfg, sample_indices, num_probs, num_samples, vocab_size);
-    if (!need_top_p) {
+    bool need_min_p =
+        CheckProbFilter(generation_cfg, sample_indices, num_probs, &GenerationConfigNode::min_p,
+                        /*disabled_value=*/0.0, "min_p", min_p_host_);
+    bool need_typical_p = CheckProbFilter(generation_cfg, sample_indices, num_probs,
+                                          &GenerationConfigNode::typical_p,
+                                          /*disabled_value=*/1.0, "typical_p", typical_p_host_);
+    if (batch_invariant_) {
+      // Renormalize every distribution, including the ones with the filters disabled, so that
+      // a distribution is renormalized whether or not the others of the batch need the filters.
+      need_top_p = true;
+      need_min_p = gpu_renormalize_by_min_p_func_.defined();
+      need_typical_p = gpu_renormalize_by_typical_p_func_.defined();
+    }
+    if (!need_top_p && !need_min_p && !need_typical_p) {
       return probs_on_device;
     }
+    CHECK(!need_min_p || gpu_renormalize_by_min_p_func_.defined())
+        << "The model library does not contain the min p renormalization function. "
+           "Please recompile the model library to use min_p with the GPU sampler.";
+    CHECK(!need_typical_p || gpu_renormalize_by_typical_p_func_.defined())
+        << "The model library does not contain the typical p renormalization function. "
+           "Please recompile the model library to use typical_p with the GPU sampler.";
 
-    // - Copy auxiliary array for top-p and initial pivots.
-    NDArray top_p_host = top_p_host_.CreateView({num_probs}, dtype_f32_);
-    NDArray top_p_device = top_p_device_.CreateView({num_probs}, dtype_f32_);
-    CopyArray(/*src=*/top_p_host, /*dst=*/top_p_device, copy_stream_);
-
-    NDArray top_p_init_pivots_host =
-        top_p_init_pivots_host_.CreateView({num_probs, num_top_p_cutoff_pivots_}, dtype_f32_);
-    NDArray top_p_init_pivots_device =
-        top_p_init_pivots_device_.CreateView({num_probs, num_top_p_cutoff_pivots_}, dtype_f32_);
-    const float* p_top_p = static_cast<const float*>(top_p_host->data);
-    float* p_top_p_init_pivots = static_cast<float*>(top_p_init_pivots_host->data);
-    for (int i = 0; i < num_probs; ++i) {
-      if (1 - p_top_p[i] >= 0.02) {
-        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_] =
-            std::min(1 - p_top_p[i], static_cast<float>(0.5));
-        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 1] = 0.02;
-        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 2] = 0.01;
-      } else {
-        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_] = 1 - p_top_p[i];
-        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 1] = (1 - p_top_p[i]) / 2;
-        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 2] = (1 - p_top_p[i]) / 4;
-      }
+    // - Copy auxiliary arrays for min p and typical p.
+    NDArray min_p_device = min_p_device_.CreateView({num_probs}, dtype_f32_);
+    NDArray typical_p_device = typical_p_device_.CreateView({num_probs}, dtype_f32_);
+    if (need_min_p) {
+      CopyArray(/*src=*/min_p_host_.CreateView({num_probs}, dtype_f32_), /*dst=*/min_p_device,
+                copy_stream_);
+    }
+    if (need_typical_p) {
+      CopyArray(/*src=*/typical_p_host_.CreateView({num_probs}, dtype_f32_),
+                /*dst=*/typical_p_device, copy_stream_);
     }
-    CopyArray(/*src=*/top_p_init_pivots_host, /*dst=*/top_p_init_pivots_device, copy_stream_);
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
-    // - Renormalize the prob with top p.
-    NDArray renormed_probs_on_device =
-        gpu_renormalize_by_top_p_func_(probs_on_device, top_p_device, top_p_init_pivots_device);
+    // - Renormalize the prob. The typical p, top p and min p filters are applied in order,
+    // each on the distribution renormalized by the previous ones.
+    if (need_typical_p) {
+      probs_on_device = gpu_renormalize_by_typical_p_func_(probs_on_device, typical_p_device);
+    }
+    if (need_top_p) {
+      probs_on_device = RenormalizeByTopP(probs_on_device, num_probs);
+    }
+    if (need_min_p) {
+      probs_on_device = gpu_renormalize_by_min_p_func_(probs_on_device, min_p_device);
+    }
 
     RECORD_EVENT(trace_recorder_, request_ids, "finish renormalization by top p");
-    return renormed_probs_on_device;
+    return probs_on_device;
   }
 
   std::vector<SampleResult> BatchSampleTokensWithProbBeforeTopP(
@@ -182,6 +221,7 @@ class GPUSampler : public SamplerObj {
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) final {
     NVTXScopedRange nvtx_scope("BatchSampleTokensWithProbBeforeTopP");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kSampling, device_);
     return BatchSampleTokensImpl(std::move(probs_on_device), sample_indices, request_ids,
                                  generation_cfg, rngs, /*top_p_applied=*/false);
   }
@@ -193,10 +233,130 @@ class GPUSampler : public SamplerObj {
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) final {
     NVTXScopedRange nvtx_scope("BatchSampleTokensWithProbAfterTopP");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kSampling, device_);
     return BatchSampleTokensImpl(std::move(probs_on_device), sample_indices, request_ids,
                                  generation_cfg, rngs, /*top_p_applied=*/true);
   }
 
+  NDArray GetLastSampledTokenIdsOnDevice() final { return last_sampled_token_ids_device_; }
+
+  bool SupportSampleOnDevice() const final {
+    // The tokens sampled on device are not sampled in the batch invariant way.
+    return gpu_check_stop_func_.defined() && !batch_invariant_;
+  }
+
+  NDArray BatchSampleTokensOnDevice(NDArray probs_on_device,                        //
+                                    const std::vector<int>& sample_indices,         //
+                                    const Array<String>& request_ids,               //
+                                    const Array<GenerationConfig>& generation_cfg,  //
+                                    const std::vector<RandomGenerator*>& rngs) final {
+    NVTXScopedRange nvtx_scope("BatchSampleTokensOnDevice");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kSampling, device_);
+    CHECK_EQ(probs_on_device->ndim, 2);
+    int num_samples = sample_indices.size();
+    ICHECK_LE(num_samples, max_num_sample_);
+    ICHECK_EQ(generation_cfg.size(), num_samples);
+    ICHECK_EQ(rngs.size(), num_samples);
+    // Without a host synchronization in between, the copy of the last call may still
+    // read the host auxiliary arrays.
+    if (copy_stream_ != nullptr) {
+      TVMSynchronize(device_.device_type, device_.device_id, copy_stream_);
+    }
+    NDArray uniform_samples_device = GenerateUniformSamples(rngs, num_samples);
+    NDArray sample_indices_device = CopySampleIndicesToGPU(sample_indices);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+    // The multinomial function allocates its output, so that the token ids of the earlier
+    // calls are not overwritten, unlike the FlashInfer sampling into the shared buffer.
+    last_sampled_token_ids_device_ = gpu_multinomial_from_uniform_func_(
+        probs_on_device, uniform_samples_device, sample_indices_device);
+    return last_sampled_token_ids_device_;
+  }
+
+  std::vector<std::vector<int32_t>> CopyInt32ArraysToHost(
+      const std::vector<NDArray>& arrays_on_device) final {
+    NVTXScopedRange nvtx_scope("CopyInt32ArraysToHost");
+    std::vector<NDArray> host_arrays;
+    host_arrays.reserve(arrays_on_device.size());
+    for (const NDArray& array_on_device : arrays_on_device) {
+      ICHECK_EQ(array_on_device->ndim, 1);
+      NDArray host_array = NDArray::Empty(array_on_device.Shape(), dtype_i32_, {kDLCPU, 0});
+      CopyArray(/*src=*/array_on_device, /*dst=*/host_array, compute_stream_);
+      host_arrays.push_back(host_array);
+    }
+    TVMSynchronize(device_.device_type, device_.device_id, compute_stream_);
+    std::vector<std::vector<int32_t>> results;
+    results.reserve(host_arrays.size());
+    for (const NDArray& host_array : host_arrays) {
+      const int32_t* p_data = static_cast<const int32_t*>(host_array->data);
+      results.emplace_back(p_data, p_data + host_array->shape[0]);
+    }
+    return results;
+  }
+
+  NDArray BatchCheckStopOnDevice(const Array<GenerationConfig>& generation_cfg,
+                                 const std::vector<int>& num_remaining_tokens) final {
+    NVTXScopedRange nvtx_scope("BatchCheckStopOnDevice");
+    if (!gpu_check_stop_func_.defined() || !last_sampled_token_ids_device_.defined()) {
+      return NDArray(nullptr);
+    }
+    int num_samples = last_sampled_token_ids_device_->shape[0];
+    ICHECK_EQ(generation_cfg.size(), num_samples);
+    ICHECK_EQ(num_remaining_tokens.size(), num_samples);
+    // The copy of the last call may still read the host auxiliary arrays.
+    if (copy_stream_ != nullptr) {
+      TVMSynchronize(device_.device_type, device_.device_id, copy_stream_);
+    }
+
+    // - Pack the stop tokens of the samples.
+    int* p_stop_token_indptr = static_cast<int*>(stop_token_indptr_host_->data);
+    std::vector<int> stop_token_ids;
+    p_stop_token_indptr[0] = 0;
+    for (int i = 0; i < num_samples; ++i) {
+      if (!generation_cfg[i]->debug_config.ignore_eos) {
+        stop_token_ids.insert(stop_token_ids.end(), generation_cfg[i]->stop_token_ids.begin(),
+                              generation_cfg[i]->stop_token_ids.end());
+      }
+      p_stop_token_indptr[i + 1] = static_cast<int>(stop_token_ids.size());
+    }
+    int num_stop_tokens = static_cast<int>(stop_token_ids.size());
+    if (num_stop_tokens > stop_token_ids_host_->shape[0]) {
+      int64_t capacity = stop_token_ids_host_->shape[0];
+      while (capacity < num_stop_tokens) {
+        capacity *= 2;
+      }
+      stop_token_ids_host_ = NDArray::Empty({capacity}, dtype_i32_, stop_token_ids_host_->device);
+      stop_token_ids_device_ = NDArray::Empty({capacity}, dtype_i32_, device_);
+    }
+    std::copy(stop_token_ids.begin(), stop_token_ids.end(),
+              static_cast<int*>(stop_token_ids_host_->data));
+    std::copy(num_remaining_tokens.begin(), num_remaining_tokens.end(),
+              static_cast<int*>(num_remaining_tokens_host_->data));
+
+    // - Copy the auxiliary arrays to GPU.
+    NDArray stop_token_indptr_host =
+        stop_token_indptr_host_.CreateView({num_samples + 1}, dtype_i32_);
+    NDArray stop_token_indptr_device =
+        stop_token_indptr_device_.CreateView({num_samples + 1}, dtype_i32_);
+    NDArray stop_token_ids_host = stop_token_ids_host_.CreateView({num_stop_tokens}, dtype_i32_);
+    NDArray stop_token_ids_device =
+        stop_token_ids_device_.CreateView({num_stop_tokens}, dtype_i32_);
+    NDArray num_remaining_tokens_host =
+        num_remaining_tokens_host_.CreateView({num_samples}, dtype_i32_);
+    NDArray num_remaining_tokens_device =
+        num_remaining_tokens_device_.CreateView({num_samples}, dtype_i32_);
+    CopyArray(/*src=*/stop_token_indptr_host, /*dst=*/stop_token_indptr_device, copy_stream_);
+    if (num_stop_tokens > 0) {
+      CopyArray(/*src=*/stop_token_ids_host, /*dst=*/stop_token_ids_device, copy_stream_);
+    }
+    CopyArray(/*src=*/num_remaining_tokens_host, /*dst=*/num_remaining_tokens_device,
+              copy_stream_);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+
+    // - Check the stop conditions on GPU.
+    return gpu_check_stop_func_(last_sampled_token_ids_device_, stop_token_indptr_device,
+                                stop_token_ids_device, num_remaining_tokens_device);
+  }
+
   std::pair<std::vector<std::vector<SampleResult>>, std::vector<int>>
   BatchVerifyDraftTokensWithProbAfterTopP(
       NDArray probs_on_device, const Array<String>& request_ids,
@@ -205,6 +365,7 @@ class GPUSampler : public SamplerObj {
       const std::vector<std::vector<SampleResult>>& draft_output_tokens,
       const std::vector<int64_t>& token_tree_parent_ptr, NDArray draft_probs_on_device) final {
     NVTXScopedRange nvtx_scope("BatchVerifyDraftTokensWithProbAfterTopP");
+    DeviceTimerScope device_timer_scope(DeviceTimeKind::kSampling, device_);
     std::vector<std::vector<SampleResult>> sample_results;
     // probs_on_device: (n, v)
     RECORD_EVENT(trace_recorder_, request_ids, "start draft verification");
@@ -217,7 +378,13 @@ class GPUSampler : public SamplerObj {
 
     int num_nodes = cum_verify_lengths.back();
     ICHECK(num_nodes <= max_num_sample_);
-    CHECK_EQ(draft_probs_on_device->shape[0], num_nodes);
+    if (draft_probs_on_device.defined()) {
+      CHECK_EQ(draft_probs_on_device->shape[0], num_nodes);
+    } else {
+      CHECK(gpu_verify_deterministic_draft_tokens_func_.defined())
+          << "The model library does not support verifying deterministic draft tokens. "
+             "Please recompile the model library.";
+    }
     NDArray uniform_samples_device = GenerateUniformSamples(rngs, cum_verify_lengths);
     NDArray draft_tokens_host = draft_tokens_host_.CreateView({num_nodes}, dtype_i32_);
     NDArray draft_tokens_device = draft_tokens_device_.CreateView({num_nodes}, dtype_i32_);
@@ -259,7 +426,8 @@ class GPUSampler : public SamplerObj {
       // Assuming no tree structure for now
       int start = cum_verify_lengths[i];
       int end = cum_verify_lengths[i + 1];
-      ICHECK_GE(end - start, 2);
+      // A sequence without draft tokens only samples from the last committed token.
+      ICHECK_GE(end - start, 1);
       for (int j = 0; j < end - start; j++) {
         int cur_node = j + start;
         int parent_node =
@@ -285,9 +453,15 @@ class GPUSampler : public SamplerObj {
 
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
-    gpu_verify_draft_tokens_func_(draft_probs_on_device, draft_tokens_device, probs_on_device,
-                                  token_tree_first_child_device, token_tree_next_sibling_device,
-                                  uniform_samples_device, token_tree_parent_ptr_device);
+    if (draft_probs_on_device.defined()) {
+      gpu_verify_draft_tokens_func_(draft_probs_on_device, draft_tokens_device, probs_on_device,
+                                    token_tree_first_child_device, token_tree_next_sibling_device,
+                                    uniform_samples_device, token_tree_parent_ptr_device);
+    } else {
+      gpu_verify_deterministic_draft_tokens_func_(
+          draft_tokens_device, probs_on_device, token_tree_first_child_device,
+          token_tree_next_sibling_device, uniform_samples_device, token_tree_parent_ptr_device);
+    }
 
     DeviceAPI::Get(device_)->SyncStreamFromTo(device_, compute_stream_, copy_stream_);
     CopyArray(token_tree_parent_ptr_device, token_tree_parent_ptr_host, copy_stream_);
@@ -355,6 +529,76 @@ class GPUSampler : public SamplerObj {
     return {sample_results, last_accepted_tree_node};
   }
 
+  std::vector<SampleResult> BatchTakeTokenProbs(NDArray probs_on_device,
+                                                const std::vector<int32_t>& token_ids,
+                                                int num_top_probs) final {
+    NVTXScopedRange nvtx_scope("BatchTakeTokenProbs");
+    // probs_on_device: (n, v)
+    CHECK_EQ(probs_on_device->ndim, 2);
+    int num_samples = token_ids.size();
+    ICHECK_EQ(probs_on_device->shape[0], num_samples);
+    ICHECK_LE(num_samples, max_num_sample_);
+    ICHECK_LE(num_top_probs, kMaxTopProbs);
+    if (num_samples == 0) {
+      return {};
+    }
+    // The copy of the last call may still read the host auxiliary arrays.
+    if (copy_stream_ != nullptr) {
+      TVMSynchronize(device_.device_type, device_.device_id, copy_stream_);
+    }
+    // - Each token takes the probability from its own distribution.
+    std::vector<int> sample_indices(num_samples);
+    std::iota(sample_indices.begin(), sample_indices.end(), 0);
+    NDArray sample_indices_device = CopySampleIndicesToGPU(sample_indices);
+    std::copy(token_ids.begin(), token_ids.end(), static_cast<int*>(draft_tokens_host_->data));
+    NDArray token_ids_host = draft_tokens_host_.CreateView({num_samples}, dtype_i32_);
+    NDArray token_ids_device = draft_tokens_device_.CreateView({num_samples}, dtype_i32_);
+    CopyArray(/*src=*/token_ids_host, /*dst=*/token_ids_device, copy_stream_);
+
+    std::vector<int> top_prob_offset_indptr(num_samples + 1);
+    for (int i = 0; i <= num_samples; ++i) {
+      top_prob_offset_indptr[i] = i * num_top_probs;
+    }
+    std::vector<NDArray> device_arrays;
+    if (gpu_sampler_top_k_probs_func_.defined()) {
+      SyncCopyStream(device_, compute_stream_, copy_stream_);
+      Array<NDArray> prob_value_results = gpu_sampler_top_k_probs_func_(
+          probs_on_device, sample_indices_device, token_ids_device);
+      device_arrays = {token_ids_device, prob_value_results[0], prob_value_results[1],
+                       prob_value_results[2]};
+    } else {
+      // Without the top-k function, the top probs are taken from the sorted distributions.
+      int vocab_size = probs_on_device->shape[1];
+      int* p_top_prob_offsets = static_cast<int*>(top_prob_offsets_host_->data);
+      for (int i = 0; i < num_samples; ++i) {
+        for (int j = 0; j < num_top_probs; ++j) {
+          p_top_prob_offsets[i * num_top_probs + j] = i * vocab_size + j;
+        }
+      }
+      int num_total_top_probs = top_prob_offset_indptr.back();
+      NDArray top_prob_offsets_host =
+          top_prob_offsets_host_.CreateView({num_total_top_probs}, dtype_i32_);
+      NDArray top_prob_offsets_device =
+          top_prob_offsets_device_.CreateView({num_total_top_probs}, dtype_i32_);
+      if (num_total_top_probs > 0) {
+        CopyArray(/*src=*/top_prob_offsets_host, /*dst=*/top_prob_offsets_device, copy_stream_);
+      }
+      SyncCopyStream(device_, compute_stream_, copy_stream_);
+      Array<NDArray> argsort_results = gpu_argsort_probs_func_(probs_on_device);
+      ICHECK_EQ(argsort_results.size(), 2);
+      Array<NDArray> prob_value_results =
+          gpu_sampler_take_probs_func_(probs_on_device, argsort_results[1], sample_indices_device,
+                                       token_ids_device, top_prob_offsets_device);
+      device_arrays = {token_ids_device, prob_value_results[0], prob_value_results[1],
+                       prob_value_results[2]};
+    }
+    std::vector<NDArray> host_arrays =
+        CopyArraysToCPU(device_arrays, num_samples, /*need_prob_values=*/true,
+                        top_prob_offset_indptr.back());
+    return CollectSampleResult(host_arrays, num_samples, /*need_prob_values=*/true,
+                               top_prob_offset_indptr);
+  }
+
  private:
   std::vector<SampleResult> BatchSampleTokensImpl(NDArray probs_on_device,                        //
                                                   const std::vector<int>& sample_indices,         //
@@ -370,6 +614,7 @@ class GPUSampler : public SamplerObj {
     int num_samples = sample_indices.size();
     int num_probs = probs_on_device->shape[0];
     int vocab_size = probs_on_device->shape[1];
+    last_sampled_token_ids_device_ = NDArray(nullptr);
     if (num_samples == 0) {
       // This synchronization is necessary for making sure that this round
       // of model forward is finished.
@@ -400,6 +645,8 @@ class GPUSampler : public SamplerObj {
         sample_results.insert(sample_results.end(), sample_results_chunk.begin(),
                               sample_results_chunk.end());
       }
+      // The token ids of the earlier chunks are overwritten.
+      last_sampled_token_ids_device_ = NDArray(nullptr);
     }
 
     RECORD_EVENT(trace_recorder_, request_ids, "finish sampling");
@@ -414,10 +661,14 @@ class GPUSampler : public SamplerObj {
     const float* p_sampled_probs = nullptr;
     const float* p_top_prob_probs = nullptr;
     const int* p_top_prob_indices = nullptr;
+    // The top probs of a sample are either packed by `top_prob_offset_indptr`,
+    // or at the beginning of the row of the sample.
+    bool top_probs_in_rows = false;
     if (need_prob_values) {
       p_sampled_probs = static_cast<const float*>(host_arrays[1]->data);
       p_top_prob_probs = static_cast<const float*>(host_arrays[2]->data);
       p_top_prob_indices = static_cast<const int*>(host_arrays[3]->data);
+      top_probs_in_rows = host_arrays[2]->ndim == 2;
     }
     std::vector<SampleResult> sample_results;
     sample_results.reserve(num_samples);
@@ -428,7 +679,8 @@ class GPUSampler : public SamplerObj {
       std::vector<TokenProbPair> top_prob_tokens;
       top_prob_tokens.reserve(top_prob_offset_indptr[i + 1] - top_prob_offset_indptr[i]);
       for (int j = top_prob_offset_indptr[i]; j < top_prob_offset_indptr[i + 1]; ++j) {
-        top_prob_tokens.emplace_back(p_top_prob_indices[j], p_top_prob_probs[j]);
+        int pos = top_probs_in_rows ? i * kMaxTopProbs + (j - top_prob_offset_indptr[i]) : j;
+        top_prob_tokens.emplace_back(p_top_prob_indices[pos], p_top_prob_probs[pos]);
       }
       sample_results.push_back(
           SampleResult{{p_sampled_token_ids[i], sampled_prob}, top_prob_tokens});
@@ -467,6 +719,8 @@ class GPUSampler : public SamplerObj {
         SampleOnGPU(probs_on_device, uniform_samples_device, sample_indices_device, need_top_p,
                     need_prob_values, num_probs, top_prob_offset_indptr);
 
+    last_sampled_token_ids_device_ = device_arrays[0];
+
     // - Copy the GPU sampling function results to CPU.
     std::vector<NDArray> host_arrays = CopyArraysToCPU(device_arrays, num_samples, need_prob_values,
                                                        top_prob_offset_indptr.back());
@@ -517,6 +771,67 @@ class GPUSampler : public SamplerObj {
     return sample_indices_device;
   }
 
+  /*! \brief Renormalize the probs by the top p values prepared by CheckTopP. */
+  NDArray RenormalizeByTopP(NDArray probs_on_device, int num_probs) {
+    // - Copy auxiliary array for top-p and initial pivots.
+    NDArray top_p_host = top_p_host_.CreateView({num_probs}, dtype_f32_);
+    NDArray top_p_device = top_p_device_.CreateView({num_probs}, dtype_f32_);
+    CopyArray(/*src=*/top_p_host, /*dst=*/top_p_device, copy_stream_);
+
+    NDArray top_p_init_pivots_host =
+        top_p_init_pivots_host_.CreateView({num_probs, num_top_p_cutoff_pivots_}, dtype_f32_);
+    NDArray top_p_init_pivots_device =
+        top_p_init_pivots_device_.CreateView({num_probs, num_top_p_cutoff_pivots_}, dtype_f32_);
+    const float* p_top_p = static_cast<const float*>(top_p_host->data);
+    float* p_top_p_init_pivots = static_cast<float*>(top_p_init_pivots_host->data);
+    for (int i = 0; i < num_probs; ++i) {
+      if (1 - p_top_p[i] >= 0.02) {
+        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_] =
+            std::min(1 - p_top_p[i], static_cast<float>(0.5));
+        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 1] = 0.02;
+        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 2] = 0.01;
+      } else {
+        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_] = 1 - p_top_p[i];
+        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 1] = (1 - p_top_p[i]) / 2;
+        p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 2] = (1 - p_top_p[i]) / 4;
+      }
+    }
+    CopyArray(/*src=*/top_p_init_pivots_host, /*dst=*/top_p_init_pivots_device, copy_stream_);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+
+    // - Renormalize the prob with top p.
+    return gpu_renormalize_by_top_p_func_(probs_on_device, top_p_device, top_p_init_pivots_device);
+  }
+
+  /*!
+   * \brief Check if the given prob filter is needed. Update the host array of the filter
+   * values in place, where every prob distribution requires the same filter value.
+   */
+  bool CheckProbFilter(const Array<GenerationConfig>& generation_cfg,
+                       const std::vector<int>& sample_indices, int num_probs,
+                       double GenerationConfigNode::*field, double disabled_value,
+                       const char* field_name, NDArray host_array) {
+    float* p_values = static_cast<float*>(host_array->data);
+    std::vector<bool> filled(num_probs, false);
+    for (int i = 0; i < num_probs; ++i) {
+      p_values[i] = disabled_value;
+    }
+    bool need_filter = false;
+    for (int i = 0; i < static_cast<int>(sample_indices.size()); ++i) {
+      double value = generation_cfg[i].get()->*field;
+      if (!filled[sample_indices[i]]) {
+        filled[sample_indices[i]] = true;
+        p_values[sample_indices[i]] = value;
+        need_filter |= value != disabled_value;
+      } else {
+        CHECK(fabs(p_values[sample_indices[i]] - value) < eps_)
+            << "GPU sampler requires the " << field_name
+            << " values for each prob distribution are the same.";
+      }
+    }
+    return need_filter;
+  }
+
   /*! \brief Check if top p is needed. Update host top p array in place. */
   bool CheckTopP(const Array<GenerationConfig>& generation_cfg,
                  const std::vector<int>& sample_indices, int num_probs, int num_samples,
@@ -573,6 +888,15 @@ class GPUSampler : public SamplerObj {
     NDArray top_prob_probs_device{nullptr};
     NDArray top_prob_indices_device{nullptr};
 
+    if (batch_invariant_ && !need_top_p) {
+      // Sample every distribution from its sorted probabilities, so that the sampled token does
+      // not depend on whether the other samples of the batch need top p or the prob values.
+      // The distributions are either already renormalized by top p, or have top p disabled.
+      float* p_top_p = static_cast<float*>(top_p_host_->data);
+      std::fill(p_top_p, p_top_p + num_probs, 1.0f);
+      need_top_p = true;
+    }
+
     if (!need_top_p && !need_prob_values) {
       // - Short path: If top_p and prob values are not needed, we directly sample from multinomial.
       SyncCopyStream(device_, compute_stream_, copy_stream_);
@@ -589,6 +913,27 @@ class GPUSampler : public SamplerObj {
               top_prob_indices_device};
     }
 
+    if (!need_top_p && gpu_sampler_top_k_probs_func_.defined()) {
+      // - Top-k path: If only prob values are needed, we take the tokens with top probabilities
+      // with a single scan over each distribution, rather than sorting the whole distribution.
+      SyncCopyStream(device_, compute_stream_, copy_stream_);
+      if (flashinfer_sampling_available_) {
+        sampled_token_ids_device =
+            sampled_token_ids_device_.CreateView({sample_indices_device->shape[0]}, dtype_i32_);
+        (*flashinfer_multinomial_sample_func_)(probs_on_device, uniform_samples_device,
+                                               sample_indices_device, sampled_token_ids_device);
+      } else {
+        sampled_token_ids_device = gpu_multinomial_from_uniform_func_(
+            probs_on_device, uniform_samples_device, sample_indices_device);
+      }
+      // The top probs are of shape (num_samples, kMaxTopProbs). Only the leading top probs
+      // requested by each sample are copied back to CPU.
+      Array<NDArray> prob_value_results = gpu_sampler_top_k_probs_func_(
+          probs_on_device, sample_indices_device, sampled_token_ids_device);
+      return {sampled_token_ids_device, prob_value_results[0], prob_value_results[1],
+              prob_value_results[2]};
+    }
+
     // - Argsort the probability.
     Array<NDArray> argsort_results = gpu_argsort_probs_func_(probs_on_device);
     ICHECK_EQ(argsort_results.size(), 2);
@@ -665,15 +1010,27 @@ class GPUSampler : public SamplerObj {
       ICHECK(top_prob_probs_device.defined());
       ICHECK(top_prob_indices_device.defined());
       ICHECK_EQ(sampled_probs_device->ndim, 1);
-      ICHECK_EQ(top_prob_probs_device->ndim, 1);
-      ICHECK_EQ(top_prob_indices_device->ndim, 1);
       ICHECK_EQ(sampled_probs_device->shape[0], num_samples);
-      ICHECK_EQ(top_prob_probs_device->shape[0], num_top_probs);
-      ICHECK_EQ(top_prob_indices_device->shape[0], num_top_probs);
+      ICHECK_EQ(top_prob_probs_device->ndim, top_prob_indices_device->ndim);
       sampled_probs_host = sampled_probs_host_.CreateView({num_samples}, dtype_i32_);
-      top_prob_probs_host = top_prob_probs_host_.CreateView({num_top_probs}, dtype_f32_);
-      top_prob_indices_host = top_prob_indices_host_.CreateView({num_top_probs}, dtype_i32_);
       CopyArray(/*src=*/sampled_probs_device, /*dst=*/sampled_probs_host, compute_stream_);
+      if (top_prob_probs_device->ndim == 2) {
+        // The top probs from the top-k function, which have a row for each sample.
+        ICHECK_EQ(top_prob_probs_device->shape[0], num_samples);
+        ICHECK_EQ(top_prob_probs_device->shape[1], kMaxTopProbs);
+        ICHECK_EQ(top_prob_indices_device->shape[0], num_samples);
+        ICHECK_EQ(top_prob_indices_device->shape[1], kMaxTopProbs);
+        top_prob_probs_host =
+            top_prob_probs_host_.CreateView({num_samples, kMaxTopProbs}, dtype_f32_);
+        top_prob_indices_host =
+            top_prob_indices_host_.CreateView({num_samples, kMaxTopProbs}, dtype_i32_);
+      } else {
+        ICHECK_EQ(top_prob_probs_device->ndim, 1);
+        ICHECK_EQ(top_prob_probs_device->shape[0], num_top_probs);
+        ICHECK_EQ(top_prob_indices_device->shape[0], num_top_probs);
+        top_prob_probs_host = top_prob_probs_host_.CreateView({num_top_probs}, dtype_f32_);
+        top_prob_indices_host = top_prob_indices_host_.CreateView({num_top_probs}, dtype_i32_);
+      }
       if (num_top_probs > 0) {
         CopyArray(/*src=*/top_prob_probs_device, /*dst=*/top_prob_probs_host, compute_stream_);
         CopyArray(/*src=*/top_prob_indices_device, /*dst=*/top_prob_indices_host, compute_stream_);
@@ -689,6 +1046,8 @@ class GPUSampler : public SamplerObj {
   // Model configurations
   const int max_num_sample_;
   const int vocab_size_;
+  // Whether to sample each distribution regardless of the others of the batch.
+  const bool batch_invariant_;
   const DLDataType dtype_i32_ = DataType::Int(32);
   const DLDataType dtype_f32_ = DataType::Float(32);
   const bool flashinfer_sampling_available_;
@@ -698,13 +1057,20 @@ class GPUSampler : public SamplerObj {
   PackedFunc gpu_argsort_probs_func_;
   PackedFunc gpu_sample_with_top_p_func_;
   PackedFunc gpu_sampler_take_probs_func_;
+  PackedFunc gpu_sampler_top_k_probs_func_;
   PackedFunc gpu_verify_draft_tokens_func_;
+  PackedFunc gpu_verify_deterministic_draft_tokens_func_;
   PackedFunc gpu_renormalize_by_top_p_func_;
+  PackedFunc gpu_renormalize_by_min_p_func_;
+  PackedFunc gpu_renormalize_by_typical_p_func_;
+  PackedFunc gpu_check_stop_func_;
   const PackedFunc* flashinfer_multinomial_sample_func_;
   // Auxiliary NDArrays on CPU
   NDArray uniform_samples_host_;
   NDArray sample_indices_host_;
   NDArray top_p_host_;
+  NDArray min_p_host_;
+  NDArray typical_p_host_;
   NDArray top_p_init_pivots_host_;
   NDArray top_prob_offsets_host_;
   NDArray draft_tokens_host_;
@@ -712,6 +1078,9 @@ class GPUSampler : public SamplerObj {
   NDArray token_tree_next_sibling_host_;
   NDArray token_tree_parent_ptr_host_;
   NDArray sampled_token_ids_host_;
+  NDArray stop_token_indptr_host_;
+  NDArray stop_token_ids_host_;
+  NDArray num_remaining_tokens_host_;
   NDArray sampled_probs_host_;
   NDArray top_prob_probs_host_;
   NDArray top_prob_indices_host_;
@@ -719,6 +1088,8 @@ class GPUSampler : public SamplerObj {
   NDArray uniform_samples_device_;
   NDArray sample_indices_device_;
   NDArray top_p_device_;
+  NDArray min_p_device_;
+  NDArray typical_p_device_;
   NDArray top_p_init_pivots_device_;
   NDArray top_prob_offsets_device_;
   NDArray draft_tokens_device_;
@@ -726,6 +1097,11 @@ class GPUSampler : public SamplerObj {
   NDArray token_tree_next_sibling_device_;
   NDArray token_tree_parent_ptr_device_;
   NDArray sampled_token_ids_device_;
+  NDArray stop_token_indptr_device_;
+  NDArray stop_token_ids_device_;
+  NDArray num_remaining_tokens_device_;
+  // The token ids sampled by the last sampling call on device.
+  NDArray last_sampled_token_ids_device_{nullptr};
   // The event trace recorder for requests. */
   Optional<EventTraceRecorder> trace_recorder_;
   // The device stream for the default computation operations.
@@ -733,13 +1109,16 @@ class GPUSampler : public SamplerObj {
   // The device stream for copying auxiliary data structure to GPU.
   TVMStreamHandle copy_stream_ = nullptr;
   const float eps_ = 1e-5;
+  // The max number of top prob results of each sequence, the same as the OpenAI API.
+  static constexpr int kMaxTopProbs = 20;
   const int num_top_p_cutoff_pivots_ = 3;
 };
 
 Sampler Sampler::CreateGPUSampler(int max_num_sample, int vocab_size, FunctionTable* ft,
-                                  DLDevice device, Optional<EventTraceRecorder> trace_recorder) {
-  return Sampler(
-      make_object<GPUSampler>(max_num_sample, vocab_size, ft, device, std::move(trace_recorder)));
+                                  DLDevice device, Optional<EventTraceRecorder> trace_recorder,
+                                  bool batch_invariant) {
+  return Sampler(make_object<GPUSampler>(max_num_sample, vocab_size, ft, device,
+                                         std::move(trace_recorder), batch_invariant));
 }
 
 }  // namespace serve
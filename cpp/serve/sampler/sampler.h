@@ -93,6 +93,82 @@ class SamplerObj : public Object {
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) = 0;
 
+  /*!
+   * \brief Return the token ids on device sampled by the last sampling call, in the order
+   * of the sampling results, which stay valid until the next sampling call.
+   * \return The sampled token ids on device, or undefined when the sampler does not sample on
+   * device or the last sampling did not run in a single batch.
+   */
+  virtual NDArray GetLastSampledTokenIdsOnDevice() { return NDArray(nullptr); }
+
+  /*! \brief Check if the sampler supports sampling and checking the stop conditions on device. */
+  virtual bool SupportSampleOnDevice() const { return false; }
+
+  /*!
+   * \brief Sample tokens from the input batch of prob distributions, keeping the sampled
+   * token ids on device without synchronizing with host. The input prob distributions are
+   * already applied with top-p, and no prob values of the samples are taken.
+   * \param probs The prob distributions on device to sample tokens from.
+   * \param sample_indices Index of the prob distribution slot each sample should sample from.
+   * \param request_ids The id of the request corresponding to each sample.
+   * \param generation_cfg The generation config of each sample.
+   * \param rngs The random number generator of each sequence.
+   * \return The sampled token ids on device, which are also the last sampled token ids.
+   * \sa SupportSampleOnDevice
+   */
+  virtual NDArray BatchSampleTokensOnDevice(NDArray probs,                                  //
+                                            const std::vector<int>& sample_indices,         //
+                                            const Array<String>& request_ids,               //
+                                            const Array<GenerationConfig>& generation_cfg,  //
+                                            const std::vector<RandomGenerator*>& rngs) {
+    LOG(FATAL) << "The sampler does not support sampling on device.";
+    throw;
+  }
+
+  /*!
+   * \brief Copy the given int32 arrays on device to host, with a single synchronization.
+   * \param arrays_on_device The 1-D int32 arrays on device.
+   * \return The values of the arrays.
+   */
+  virtual std::vector<std::vector<int32_t>> CopyInt32ArraysToHost(
+      const std::vector<NDArray>& arrays_on_device) {
+    LOG(FATAL) << "The sampler does not support sampling on device.";
+    throw;
+  }
+
+  /*!
+   * \brief Check the stop conditions that only depend on the sampled token for the tokens
+   * sampled by the last sampling call, on device alongside the sampling. A sample is finished
+   * when the sampled token is a stop token of the sample (unless `ignore_eos` is set), or when
+   * the sampled token is the last token the sample can generate.
+   * The check does not require the sampled tokens on host, so several decode steps can run
+   * without synchronizing with host in between.
+   * \param generation_cfg The generation config of each sample of the last sampling call.
+   * \param num_remaining_tokens The number of tokens each sample can generate, including the
+   * last sampled token.
+   * \return The int32 finished mask on device, whose value is 1 for the finished samples,
+   * or undefined when the sampler does not sample on device.
+   */
+  virtual NDArray BatchCheckStopOnDevice(const Array<GenerationConfig>& generation_cfg,
+                                         const std::vector<int>& num_remaining_tokens) {
+    return NDArray(nullptr);
+  }
+
+  /*!
+   * \brief Take the probabilities of the given tokens together with the tokens of top
+   * probabilities from the input batch of prob distributions, without sampling. It is used to
+   * compute the probabilities of the prompt tokens.
+   * \param probs The prob distributions to take the probabilities from, one for each token.
+   * It resides on GPU if the sampler is GPU sampler, or on host if hte sampler is CPU sampler.
+   * \param token_ids The token to take the probability of from each prob distribution.
+   * \param num_top_probs The number of tokens of top probabilities to take from each
+   * prob distribution.
+   * \return The token probability and the top probabilities of each prob distribution.
+   */
+  virtual std::vector<SampleResult> BatchTakeTokenProbs(NDArray probs,
+                                                        const std::vector<int32_t>& token_ids,
+                                                        int num_top_probs) = 0;
+
   /*!
    * \brief Verify draft tokens generated by small models in the large model
    * in speculative decoding. The input corresponds to a batch of sequences.
@@ -110,6 +186,8 @@ class SamplerObj : public Object {
    * \param draft_probs_on_device The probability distribution computed from the
    * small model for each sequence. Concatenated tensor of shape (total_verify_length, vocab_size).
    * It includes the slot for the last committed token that has undefined probablity value.
+   * Being undefined means the draft tokens are proposed deterministically (e.g., by n-gram
+   * lookup), i.e., the draft probability distribution of each draft token is one-hot.
    * \return The list of accepted tokens for each request and the index of the last accepted tree
    * node for each request.
    */
@@ -137,9 +215,12 @@ class Sampler : public ObjectRef {
    * \param ft The packed function table.
    * \param device The device that the model runs on.
    * \param trace_recorder The event trace recorder.
+   * \param batch_invariant Whether to sample each distribution in the same way regardless of
+   * the other distributions of the batch. See EngineConfig::batch_invariant_sampling.
    */
   static Sampler CreateGPUSampler(int max_num_sample, int vocab_size, FunctionTable* ft,
-                                  DLDevice device, Optional<EventTraceRecorder> trace_recorder);
+                                  DLDevice device, Optional<EventTraceRecorder> trace_recorder,
+                                  bool batch_invariant = false);
 
   /*! \brief Check if the given device supports GPU sampling. */
   static bool SupportGPUSampler(Device device) {
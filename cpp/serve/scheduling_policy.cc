@@ -0,0 +1,387 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/scheduling_policy.cc
+ */
+#include "scheduling_policy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+#include "request_state.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+TVM_REGISTER_OBJECT_TYPE(SchedulingPolicyObj);
+
+/****************** FCFSSchedulingPolicy ******************/
+
+/*!
+ * \brief The first-come-first-serve scheduling policy.
+ * Requests are admitted in the order of the waiting queue, and the last
+ * request in the running queue is preempted first.
+ */
+class FCFSSchedulingPolicy : public SchedulingPolicyObj {
+ public:
+  void SortWaitingQueue(std::vector<Request>* waiting_queue) final {}
+
+  int SelectPreemptionVictim(const std::vector<Request>& running_queue) final {
+    ICHECK(!running_queue.empty());
+    return static_cast<int>(running_queue.size()) - 1;
+  }
+
+  SchedulingPolicyKind Kind() final { return SchedulingPolicyKind::kFCFS; }
+
+  static constexpr const char* _type_key = "mlc.serve.FCFSSchedulingPolicy";
+  TVM_DECLARE_FINAL_OBJECT_INFO(FCFSSchedulingPolicy, SchedulingPolicyObj);
+};
+
+TVM_REGISTER_OBJECT_TYPE(FCFSSchedulingPolicy);
+
+/****************** PrioritySchedulingPolicy ******************/
+
+/*!
+ * \brief The priority and deadline aware scheduling policy.
+ * Requests are ordered by their priority first. Among the requests of the
+ * same priority, the request whose next token deadline comes earlier is
+ * admitted earlier and preempted later. The next token deadline is the TTFT
+ * deadline before the first token is generated, and the TPOT deadline of the
+ * next output token afterwards. Requests without deadline are ordered as FCFS.
+ */
+class PrioritySchedulingPolicy : public SchedulingPolicyObj {
+ public:
+  void SortWaitingQueue(std::vector<Request>* waiting_queue) final {
+    if (waiting_queue->size() <= 1) {
+      return;
+    }
+    keys_.clear();
+    keys_.reserve(waiting_queue->size());
+    for (const Request& request : *waiting_queue) {
+      keys_.emplace(request.get(), GetKey(request));
+    }
+    std::stable_sort(waiting_queue->begin(), waiting_queue->end(),
+                     [this](const Request& lhs, const Request& rhs) {
+                       const auto& [lhs_priority, lhs_deadline] = keys_.at(lhs.get());
+                       const auto& [rhs_priority, rhs_deadline] = keys_.at(rhs.get());
+                       if (lhs_priority != rhs_priority) {
+                         return lhs_priority > rhs_priority;
+                       }
+                       return lhs_deadline < rhs_deadline;
+                     });
+  }
+
+  int SelectPreemptionVictim(const std::vector<Request>& running_queue) final {
+    ICHECK(!running_queue.empty());
+    // Scan from the back, so that the latest request is preempted under ties.
+    int victim = static_cast<int>(running_queue.size()) - 1;
+    auto [victim_priority, victim_deadline] = GetKey(running_queue[victim]);
+    for (int i = victim - 1; i >= 0; --i) {
+      auto [priority, deadline] = GetKey(running_queue[i]);
+      if (priority < victim_priority ||
+          (priority == victim_priority && deadline > victim_deadline)) {
+        victim = i;
+        victim_priority = priority;
+        victim_deadline = deadline;
+      }
+    }
+    return victim;
+  }
+
+  SchedulingPolicyKind Kind() final { return SchedulingPolicyKind::kPriority; }
+
+  static constexpr const char* _type_key = "mlc.serve.PrioritySchedulingPolicy";
+  TVM_DECLARE_FINAL_OBJECT_INFO(PrioritySchedulingPolicy, SchedulingPolicyObj);
+
+ private:
+  using TimePoint = std::chrono::high_resolution_clock::time_point;
+
+  /*! \brief Return the (priority, next token deadline) pair of the request. */
+  static std::pair<int, TimePoint> GetKey(const Request& request) {
+    const GenerationConfig& cfg = request->generation_cfg;
+    ICHECK(request->rstate != nullptr) << "The state of the request has not been defined.";
+    const RequestMetrics& metrics = static_cast<RequestStateNode*>(request->rstate)->metrics;
+    TimePoint deadline = TimePoint::max();
+    if (metrics.completion_tokens == 0) {
+      if (cfg->ttft_deadline_ms != -1) {
+        deadline = metrics.add_time_point + ToDuration(cfg->ttft_deadline_ms);
+      }
+    } else if (cfg->tpot_deadline_ms != -1) {
+      deadline = metrics.prefill_end_time_point +
+                 ToDuration(cfg->tpot_deadline_ms * metrics.completion_tokens);
+    }
+    return {cfg->priority, deadline};
+  }
+
+  /*! \brief Convert milliseconds to the clock duration. */
+  static TimePoint::duration ToDuration(double ms) {
+    return std::chrono::duration_cast<TimePoint::duration>(
+        std::chrono::duration<double, std::milli>(ms));
+  }
+
+  /*! \brief The sorting keys of requests, kept as a member to avoid repetitive allocation. */
+  std::unordered_map<const Object*, std::pair<int, TimePoint>> keys_;
+};
+
+TVM_REGISTER_OBJECT_TYPE(PrioritySchedulingPolicy);
+
+/****************** FairSchedulingPolicy ******************/
+
+/*!
+ * \brief The multi-tenant fair scheduling policy.
+ * The requests are grouped by their tenant id, and the tenants share the
+ * prefill tokens and decode slots in proportion to their weights, following
+ * start-time fair queueing on the tokens served to each tenant:
+ * - each tenant has a virtual service, which grows by the tokens served to the
+ * tenant divided by the tenant weight,
+ * - the waiting queue is merged from the per-tenant FCFS queues, always taking
+ * the next request from the tenant with the least projected virtual service,
+ * - a tenant becoming backlogged has its virtual service lifted to the virtual
+ * time, the least virtual service of the tenants staying backlogged, so that
+ * idle time does not build up credits,
+ * - the latest running request of the tenant with the most virtual service is
+ * preempted first.
+ * When a token rate quota is set, each tenant is further limited by a token
+ * bucket of one second burst. A request admitted reserves its prompt tokens
+ * from the bucket until the next sort of the waiting queue, and the new
+ * requests of a tenant are not admitted while its bucket is exhausted.
+ * The tenant ids come from the clients, so the state of the idle tenants which
+ * holds no credit or debt is pruned when the waiting queue is sorted.
+ */
+class FairSchedulingPolicy : public SchedulingPolicyObj {
+ public:
+  explicit FairSchedulingPolicy(std::unordered_map<std::string, double> tenant_weights,
+                                double max_tokens_per_s)
+      : tenant_weights_(std::move(tenant_weights)), max_tokens_per_s_(max_tokens_per_s) {}
+
+  void SortWaitingQueue(std::vector<Request>* waiting_queue) final {
+    // Group the waiting requests by tenant, in the order of their first appearance.
+    tenant_ids_.clear();
+    for (const Request& request : *waiting_queue) {
+      std::string tenant_id = request->generation_cfg->tenant_id;
+      std::vector<Request>& queue = tenant_queues_[tenant_id];
+      if (queue.empty()) {
+        tenant_ids_.push_back(tenant_id);
+      }
+      queue.push_back(request);
+    }
+    // Advance the virtual time to the least virtual service of the tenants staying backlogged,
+    // and lift the newly backlogged tenants to it.
+    double min_backlogged_service = std::numeric_limits<double>::infinity();
+    for (const std::string& tenant_id : tenant_ids_) {
+      auto it = tenants_.find(tenant_id);
+      if (it != tenants_.end() && it->second.backlogged) {
+        min_backlogged_service = std::min(min_backlogged_service, it->second.virtual_service);
+      }
+    }
+    if (min_backlogged_service != std::numeric_limits<double>::infinity()) {
+      virtual_time_ = std::max(virtual_time_, min_backlogged_service);
+    }
+    for (auto& [tenant_id, tenant] : tenants_) {
+      tenant.backlogged = false;
+      // The reservations of the admitted requests are replaced by their served tokens.
+      tenant.reserved_tokens = 0;
+    }
+    for (const std::string& tenant_id : tenant_ids_) {
+      TenantState& tenant = GetTenantState(tenant_id);
+      tenant.virtual_service = std::max(tenant.virtual_service, virtual_time_);
+      tenant.backlogged = true;
+    }
+    PruneIdleTenants();
+    if (tenant_ids_.size() <= 1) {
+      ClearTenantQueues();
+      return;
+    }
+
+    // Merge the per-tenant queues by the projected virtual service.
+    int num_tenants = tenant_ids_.size();
+    projected_service_.resize(num_tenants);
+    queue_positions_.assign(num_tenants, 0);
+    for (int t = 0; t < num_tenants; ++t) {
+      projected_service_[t] = GetVirtualService(tenant_ids_[t]);
+    }
+    waiting_queue->clear();
+    while (true) {
+      int selected = -1;
+      for (int t = 0; t < num_tenants; ++t) {
+        if (queue_positions_[t] == static_cast<int>(tenant_queues_[tenant_ids_[t]].size())) {
+          continue;
+        }
+        // Ties go to the tenant appearing earlier in the waiting queue.
+        if (selected == -1 || projected_service_[t] < projected_service_[selected]) {
+          selected = t;
+        }
+      }
+      if (selected == -1) {
+        break;
+      }
+      const std::string& tenant_id = tenant_ids_[selected];
+      const Request& request = tenant_queues_[tenant_id][queue_positions_[selected]++];
+      waiting_queue->push_back(request);
+      projected_service_[selected] +=
+          std::max(request->prompt_tokens, 1) / GetTenantWeight(tenant_id);
+    }
+    ClearTenantQueues();
+  }
+
+  int SelectPreemptionVictim(const std::vector<Request>& running_queue) final {
+    ICHECK(!running_queue.empty());
+    // Scan from the back, so that the latest request is preempted under ties.
+    int victim = static_cast<int>(running_queue.size()) - 1;
+    double victim_service = GetVirtualService(running_queue[victim]->generation_cfg->tenant_id);
+    for (int i = victim - 1; i >= 0; --i) {
+      double service = GetVirtualService(running_queue[i]->generation_cfg->tenant_id);
+      if (service > victim_service) {
+        victim = i;
+        victim_service = service;
+      }
+    }
+    return victim;
+  }
+
+  bool CanAdmit(const Request& request) final {
+    if (max_tokens_per_s_ <= 0) {
+      return true;
+    }
+    TenantState& tenant = GetTenantState(request->generation_cfg->tenant_id);
+    RefillTokenBucket(&tenant);
+    if (tenant.bucket_tokens - tenant.reserved_tokens <= 0) {
+      return false;
+    }
+    // Reserve the prompt tokens, so that the requests admitted in the same step do not overrun
+    // the quota before any of them is served.
+    tenant.reserved_tokens += std::max(request->prompt_tokens, 1);
+    return true;
+  }
+
+  void UpdateServedTokens(const Request& request, int64_t num_tokens) final {
+    const std::string& tenant_id = request->generation_cfg->tenant_id;
+    TenantState& tenant = GetTenantState(tenant_id);
+    tenant.virtual_service += num_tokens / GetTenantWeight(tenant_id);
+    if (max_tokens_per_s_ > 0) {
+      RefillTokenBucket(&tenant);
+      tenant.bucket_tokens -= num_tokens;
+    }
+  }
+
+  SchedulingPolicyKind Kind() final { return SchedulingPolicyKind::kFair; }
+
+  static constexpr const char* _type_key = "mlc.serve.FairSchedulingPolicy";
+  TVM_DECLARE_FINAL_OBJECT_INFO(FairSchedulingPolicy, SchedulingPolicyObj);
+
+ private:
+  using TimePoint = std::chrono::high_resolution_clock::time_point;
+
+  /*! \brief The scheduling state of a tenant. */
+  struct TenantState {
+    /*! \brief The virtual service of the tenant. */
+    double virtual_service = 0;
+    /*! \brief Whether the tenant had waiting requests at the last sort of the waiting queue. */
+    bool backlogged = false;
+    /*! \brief The number of tokens left in the token bucket, which can go negative. */
+    double bucket_tokens = 0;
+    /*! \brief The tokens reserved by the requests admitted since the last sort. */
+    double reserved_tokens = 0;
+    /*! \brief The time of the last refill of the token bucket. */
+    TimePoint last_refill_time;
+  };
+
+  /*!
+   * \brief The number of tenants beyond which the state of the idle tenants is pruned even when
+   * they have virtual service above the virtual time.
+   */
+  static constexpr const size_t kMaxNumTenants = 4096;
+
+  double GetTenantWeight(const std::string& tenant_id) const {
+    auto it = tenant_weights_.find(tenant_id);
+    return it != tenant_weights_.end() ? it->second : 1.0;
+  }
+
+  /*! \brief Get the state of the tenant, which starts at the virtual time with a full bucket. */
+  TenantState& GetTenantState(const std::string& tenant_id) {
+    auto [it, inserted] = tenants_.try_emplace(tenant_id);
+    if (inserted) {
+      it->second.virtual_service = virtual_time_;
+      it->second.bucket_tokens = max_tokens_per_s_;
+      it->second.last_refill_time = std::chrono::high_resolution_clock::now();
+    }
+    return it->second;
+  }
+
+  double GetVirtualService(const std::string& tenant_id) const {
+    auto it = tenants_.find(tenant_id);
+    return it != tenants_.end() ? it->second.virtual_service : virtual_time_;
+  }
+
+  /*! \brief Refill the token bucket of the tenant by the time elapsed since the last refill. */
+  void RefillTokenBucket(TenantState* tenant) {
+    TimePoint now = std::chrono::high_resolution_clock::now();
+    double elapsed_s = std::chrono::duration<double>(now - tenant->last_refill_time).count();
+    tenant->bucket_tokens =
+        std::min(tenant->bucket_tokens + elapsed_s * max_tokens_per_s_, max_tokens_per_s_);
+    tenant->last_refill_time = now;
+  }
+
+  /*!
+   * \brief Remove the state of the tenants without waiting requests, whose state is the same as
+   * a new tenant: the virtual service is not above the virtual time, and the bucket is full.
+   */
+  void PruneIdleTenants() {
+    bool over_capacity = tenants_.size() > kMaxNumTenants;
+    for (auto it = tenants_.begin(); it != tenants_.end();) {
+      TenantState& tenant = it->second;
+      if (max_tokens_per_s_ > 0) {
+        RefillTokenBucket(&tenant);
+      }
+      if (!tenant.backlogged && (over_capacity || tenant.virtual_service <= virtual_time_) &&
+          (max_tokens_per_s_ <= 0 || tenant.bucket_tokens >= max_tokens_per_s_)) {
+        it = tenants_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  /*! \brief Clear the per-tenant queues, so that they do not hold the requests after sorting. */
+  void ClearTenantQueues() { tenant_queues_.clear(); }
+
+  /*! \brief The weights of tenants. The tenants not listed have weight 1. */
+  std::unordered_map<std::string, double> tenant_weights_;
+  /*! \brief The maximum token rate of each tenant. Non-positive means unlimited. */
+  double max_tokens_per_s_;
+
+  /*! \brief The scheduling state of the tenants with credit, debt or waiting requests. */
+  std::unordered_map<std::string, TenantState> tenants_;
+  /*! \brief The virtual time, which never goes back. */
+  double virtual_time_ = 0;
+
+  // The workspace of sorting, kept as members to avoid repetitive allocation.
+  std::vector<std::string> tenant_ids_;
+  std::unordered_map<std::string, std::vector<Request>> tenant_queues_;
+  std::vector<double> projected_service_;
+  std::vector<int> queue_positions_;
+};
+
+TVM_REGISTER_OBJECT_TYPE(FairSchedulingPolicy);
+
+SchedulingPolicy SchedulingPolicy::Create(const EngineConfig& engine_config) {
+  SchedulingPolicyKind kind = engine_config->scheduling_policy;
+  if (kind == SchedulingPolicyKind::kFCFS) {
+    return SchedulingPolicy(make_object<FCFSSchedulingPolicy>());
+  } else if (kind == SchedulingPolicyKind::kPriority) {
+    return SchedulingPolicy(make_object<PrioritySchedulingPolicy>());
+  } else if (kind == SchedulingPolicyKind::kFair) {
+    return SchedulingPolicy(make_object<FairSchedulingPolicy>(
+        engine_config->tenant_weights, engine_config->tenant_max_tokens_per_s));
+  } else {
+    LOG(FATAL) << "Unsupported scheduling policy: " << static_cast<int>(kind);
+    throw;
+  }
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,85 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/scheduling_policy.h
+ * \brief The request scheduling policy which decides the order of
+ * request admission (prefill) and preemption in engine.
+ */
+#ifndef MLC_LLM_SERVE_SCHEDULING_POLICY_H_
+#define MLC_LLM_SERVE_SCHEDULING_POLICY_H_
+
+#include <tvm/runtime/object.h>
+
+#include <vector>
+
+#include "config.h"
+#include "request.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The scheduling policy of engine.
+ * It is consulted by the prefill actions to decide which waiting requests
+ * are admitted first, and by the preemption to decide which running request
+ * gets preempted when the KV cache runs out of capacity.
+ */
+class SchedulingPolicyObj : public Object {
+ public:
+  /*!
+   * \brief Reorder the waiting queue in place, so that the requests to be
+   * admitted for prefill earlier come first.
+   * The relative order of requests deemed equal must be kept, since the
+   * preempted requests are inserted to the front of the waiting queue.
+   * \param waiting_queue The waiting queue to reorder.
+   */
+  virtual void SortWaitingQueue(std::vector<Request>* waiting_queue) = 0;
+
+  /*!
+   * \brief Select the request to preempt from the running queue.
+   * \param running_queue The running queue, which should not be empty.
+   * \return The index of the request to preempt in the running queue.
+   */
+  virtual int SelectPreemptionVictim(const std::vector<Request>& running_queue) = 0;
+
+  /*!
+   * \brief Check whether the given waiting request can be admitted for prefill now.
+   * A request not admitted is skipped by the prefill actions in this step.
+   * \param request The waiting request whose prefill has not started.
+   * \return Whether the request can be admitted.
+   */
+  virtual bool CanAdmit(const Request& request) { return true; }
+
+  /*!
+   * \brief Account the tokens newly processed for the given request, in both prefill and decode.
+   * \param request The request whose tokens are processed.
+   * \param num_tokens The number of newly processed tokens.
+   */
+  virtual void UpdateServedTokens(const Request& request, int64_t num_tokens) {}
+
+  /*! \brief Return the kind of the scheduling policy. */
+  virtual SchedulingPolicyKind Kind() = 0;
+
+  static constexpr const uint32_t _type_index = TypeIndex::kDynamic;
+  static constexpr const char* _type_key = "mlc.serve.SchedulingPolicy";
+  TVM_DECLARE_BASE_OBJECT_INFO(SchedulingPolicyObj, Object)
+};
+
+class SchedulingPolicy : public ObjectRef {
+ public:
+  /*!
+   * \brief Create the scheduling policy specified by the engine config.
+   * \param engine_config The engine config.
+   */
+  static SchedulingPolicy Create(const EngineConfig& engine_config);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(SchedulingPolicy, ObjectRef, SchedulingPolicyObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_SCHEDULING_POLICY_H_
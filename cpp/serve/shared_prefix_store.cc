@@ -0,0 +1,409 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/shared_prefix_store.cc
+ */
+#include "shared_prefix_store.h"
+
+#include <tvm/runtime/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MLC_LLM_SHARED_PREFIX_STORE_ENABLED 1
+#endif
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+#ifdef MLC_LLM_SHARED_PREFIX_STORE_ENABLED
+
+/*! \brief The magic number denoting the region has been initialized, bumped with the layout. */
+constexpr uint64_t kSharedPrefixStoreMagic = 0x4d4c43505245464cULL;
+/*! \brief The alignment of every entry data in the ring buffer. */
+constexpr uint64_t kSharedPrefixStoreAlignment = 64;
+
+inline uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+/*! \brief The FNV-1a hash of tokens, used to quickly check the exact match of entries. */
+inline uint64_t HashTokens(const std::vector<int32_t>& tokens) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int32_t token : tokens) {
+    hash = (hash ^ static_cast<uint32_t>(token)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/*! \brief The header at the beginning of the shared memory region. */
+struct SharedPrefixStore::Header {
+  /*! \brief The magic number, written last when the region is initialized. */
+  uint64_t magic;
+  /*! \brief The process-shared mutex guarding all the entries and data. */
+  pthread_mutex_t mutex;
+  /*! \brief The capacity of the data ring buffer in bytes. */
+  uint64_t capacity_bytes;
+  /*! \brief The number of entry slots. */
+  int64_t max_num_entries;
+  /*! \brief The offset in the data ring buffer to write the next entry. */
+  uint64_t write_offset;
+  /*! \brief The counter of entry stamps, increasing with each publish. */
+  uint64_t stamp_counter;
+  /*! \brief The number of processes attached to the region. The last one unlinks the region. */
+  int64_t num_attached;
+  /*! \brief The KV layout and the model identity of the process creating the region. */
+  KVSwapLayout layout;
+};
+
+/*!
+ * \brief The entry slot of a published sequence. The data of an entry is laid out as
+ * the int32 tokens followed by the KV data chunks [k_0, v_0, k_1, v_1, ...], starting at
+ * an aligned offset.
+ */
+struct SharedPrefixStore::Entry {
+  /*! \brief The publish stamp of the entry. Value 0 means the slot is empty. */
+  uint64_t stamp;
+  /*! \brief The hash of the entry tokens. */
+  uint64_t token_hash;
+  /*! \brief The offset of the entry data in the ring buffer. */
+  uint64_t offset;
+  /*! \brief The number of bytes of the entry data. */
+  uint64_t num_bytes;
+  /*! \brief The number of tokens. */
+  int64_t num_tokens;
+  /*! \brief The number of KV data chunks, counting both K and V. */
+  int64_t num_chunks;
+  /*! \brief The number of tokens in every chunk except the last one. */
+  int64_t chunk_size;
+  /*! \brief The (num_layers, num_kv_heads, head_dim) of the KV data chunks. */
+  int64_t chunk_dims[3];
+  /*! \brief The data type of KV data. */
+  DLDataType dtype;
+};
+
+std::unique_ptr<SharedPrefixStore> SharedPrefixStore::Open(const std::string& name,
+                                                           int64_t capacity_bytes,
+                                                           const KVSwapLayout& layout,
+                                                           int max_num_entries) {
+  CHECK_GT(capacity_bytes, 0);
+  CHECK_GT(max_num_entries, 0);
+  std::string shm_name = "/" + name;
+  size_t mapped_bytes = AlignUp(sizeof(Header), kSharedPrefixStoreAlignment) +
+                        AlignUp(sizeof(Entry) * max_num_entries, kSharedPrefixStoreAlignment) +
+                        static_cast<size_t>(capacity_bytes);
+
+  bool created = true;
+  int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    created = false;
+    fd = shm_open(shm_name.c_str(), O_RDWR, 0600);
+  }
+  CHECK_GE(fd, 0) << "Failed to open the shared memory \"" << shm_name
+                  << "\": " << std::strerror(errno);
+
+  if (created) {
+    CHECK_EQ(ftruncate(fd, mapped_bytes), 0)
+        << "Failed to resize the shared memory \"" << shm_name << "\": " << std::strerror(errno);
+  } else {
+    // Wait for the creator process to resize the region, and use the existing size.
+    struct stat st;
+    for (int retry = 0;; ++retry) {
+      CHECK_EQ(fstat(fd, &st), 0);
+      if (static_cast<size_t>(st.st_size) > sizeof(Header)) break;
+      CHECK_LT(retry, 1000) << "Timeout waiting for the shared memory \"" << shm_name
+                            << "\" to be initialized.";
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    mapped_bytes = st.st_size;
+  }
+  void* ptr = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(ptr != MAP_FAILED) << "Failed to map the shared memory \"" << shm_name
+                           << "\": " << std::strerror(errno);
+  Header* header = static_cast<Header*>(ptr);
+
+  if (created) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    header->capacity_bytes = capacity_bytes;
+    header->max_num_entries = max_num_entries;
+    header->write_offset = 0;
+    header->stamp_counter = 0;
+    header->num_attached = 1;
+    header->layout = layout;
+    __atomic_store_n(&header->magic, kSharedPrefixStoreMagic, __ATOMIC_RELEASE);
+    return std::unique_ptr<SharedPrefixStore>(
+        new SharedPrefixStore(std::move(shm_name), header, mapped_bytes, layout));
+  }
+
+  for (int retry = 0; __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != kSharedPrefixStoreMagic;
+       ++retry) {
+    if (retry == 1000) {
+      LOG(WARNING) << "Timeout waiting for the shared memory \"" << shm_name
+                   << "\" to be initialized. The shared prefix cache is disabled.";
+      munmap(ptr, mapped_bytes);
+      return nullptr;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  // Validate the region created by another process before using it.
+  std::unique_ptr<SharedPrefixStore> store(
+      new SharedPrefixStore(shm_name, header, mapped_bytes, layout));
+  store->Lock();
+  uint64_t data_begin = AlignUp(sizeof(Header), kSharedPrefixStoreAlignment);
+  bool valid_size = header->max_num_entries > 0 && header->capacity_bytes > 0 &&
+                    data_begin + AlignUp(sizeof(Entry) * header->max_num_entries,
+                                         kSharedPrefixStoreAlignment) +
+                            header->capacity_bytes <=
+                        mapped_bytes;
+  bool same_layout = header->layout == layout;
+  if (valid_size && same_layout) {
+    ++header->num_attached;
+  }
+  store->Unlock();
+  if (!valid_size || !same_layout) {
+    LOG(WARNING) << "The shared memory \"" << shm_name << "\" is "
+                 << (valid_size ? "created for a different model or KV layout"
+                                : "of an inconsistent size")
+                 << ". The shared prefix cache is disabled.";
+    // Detach without touching the region, which is still used by its creator.
+    store->header_ = nullptr;
+    munmap(header, mapped_bytes);
+    return nullptr;
+  }
+  return store;
+}
+
+SharedPrefixStore::SharedPrefixStore(std::string name, Header* header, size_t mapped_bytes,
+                                     KVSwapLayout layout)
+    : name_(std::move(name)), header_(header), mapped_bytes_(mapped_bytes), layout_(layout) {}
+
+SharedPrefixStore::~SharedPrefixStore() {
+  if (header_ == nullptr) {
+    return;
+  }
+  // The region is kept alive while other processes are attached. The last attached process
+  // unlinks the name, after which the system releases the region once everyone unmaps it.
+  // A process exiting without closing the store leaves the count behind, in which case the
+  // name stays until it is unlinked externally.
+  Lock();
+  bool last = --header_->num_attached <= 0;
+  if (last) {
+    shm_unlink(name_.c_str());
+  }
+  Unlock();
+  munmap(header_, mapped_bytes_);
+}
+
+SharedPrefixStore::Entry* SharedPrefixStore::Entries() {
+  return reinterpret_cast<Entry*>(reinterpret_cast<char*>(header_) +
+                                  AlignUp(sizeof(Header), kSharedPrefixStoreAlignment));
+}
+
+char* SharedPrefixStore::Data(uint64_t offset) {
+  return reinterpret_cast<char*>(header_) + AlignUp(sizeof(Header), kSharedPrefixStoreAlignment) +
+         AlignUp(sizeof(Entry) * header_->max_num_entries, kSharedPrefixStoreAlignment) + offset;
+}
+
+void SharedPrefixStore::Lock() {
+  int ret = pthread_mutex_lock(&header_->mutex);
+  if (ret == EOWNERDEAD) {
+    // The previous owner process died while holding the lock. The entry being written by it
+    // is not stamped yet, and hence the store remains consistent.
+    pthread_mutex_consistent(&header_->mutex);
+  } else {
+    CHECK_EQ(ret, 0) << "Failed to lock the shared prefix store: " << std::strerror(ret);
+  }
+}
+
+void SharedPrefixStore::Unlock() { pthread_mutex_unlock(&header_->mutex); }
+
+bool SharedPrefixStore::IsValidEntry(const Entry& entry) {
+  if (entry.num_tokens <= 0 || entry.chunk_size != layout_.chunk_size ||
+      entry.chunk_dims[0] != layout_.num_layers || entry.chunk_dims[1] != layout_.num_kv_heads ||
+      entry.chunk_dims[2] != layout_.head_dim || entry.dtype.code != layout_.dtype.code ||
+      entry.dtype.bits != layout_.dtype.bits || entry.dtype.lanes != layout_.dtype.lanes ||
+      entry.num_chunks != (entry.num_tokens + entry.chunk_size - 1) / entry.chunk_size * 2 ||
+      entry.offset > header_->capacity_bytes ||
+      entry.num_bytes > header_->capacity_bytes - entry.offset) {
+    return false;
+  }
+  uint64_t token_bytes = AlignUp(static_cast<uint64_t>(entry.num_tokens) * sizeof(int32_t),
+                                 kSharedPrefixStoreAlignment);
+  uint64_t elem_bytes = (layout_.dtype.bits * layout_.dtype.lanes + 7) / 8;
+  uint64_t kv_bytes = static_cast<uint64_t>(entry.num_tokens) * 2 * layout_.num_layers *
+                      layout_.num_kv_heads * layout_.head_dim * elem_bytes;
+  return entry.num_bytes == token_bytes + kv_bytes;
+}
+
+bool SharedPrefixStore::HasSequence(const std::vector<int32_t>& tokens) {
+  uint64_t hash = HashTokens(tokens);
+  bool found = false;
+  Lock();
+  Entry* entries = Entries();
+  for (int64_t i = 0; i < header_->max_num_entries && !found; ++i) {
+    const Entry& entry = entries[i];
+    found = entry.stamp != 0 && entry.token_hash == hash && IsValidEntry(entry) &&
+            entry.num_tokens == static_cast<int64_t>(tokens.size()) &&
+            std::memcmp(Data(entry.offset), tokens.data(), tokens.size() * sizeof(int32_t)) == 0;
+  }
+  Unlock();
+  return found;
+}
+
+bool SharedPrefixStore::Publish(const std::vector<int32_t>& tokens, const Array<NDArray>& kv_data) {
+  CHECK(!tokens.empty());
+  if (!layout_.Matches(kv_data)) {
+    return false;
+  }
+  int64_t num_kv_tokens = 0;
+  for (int i = 0; i < static_cast<int>(kv_data.size()); i += 2) {
+    num_kv_tokens += kv_data[i]->shape[1];
+  }
+  if (num_kv_tokens != static_cast<int64_t>(tokens.size())) {
+    return false;
+  }
+  uint64_t kv_offset = AlignUp(tokens.size() * sizeof(int32_t), kSharedPrefixStoreAlignment);
+  uint64_t num_bytes = kv_offset;
+  for (const NDArray& chunk : kv_data) {
+    num_bytes += GetDataSize(*chunk.operator->());
+  }
+  if (num_bytes > header_->capacity_bytes) {
+    return false;
+  }
+
+  Lock();
+  // - Locate the data in the ring buffer, and evict the entries whose data are overwritten.
+  if (header_->write_offset + num_bytes > header_->capacity_bytes) {
+    header_->write_offset = 0;
+  }
+  uint64_t begin = header_->write_offset;
+  uint64_t end = begin + num_bytes;
+  Entry* entries = Entries();
+  Entry* slot = nullptr;
+  for (int64_t i = 0; i < header_->max_num_entries; ++i) {
+    Entry& entry = entries[i];
+    if (entry.stamp != 0 && entry.offset < end && begin < entry.offset + entry.num_bytes) {
+      entry.stamp = 0;
+    }
+    if (slot == nullptr || entry.stamp < slot->stamp) {
+      slot = &entry;
+    }
+  }
+  // - Write the data, and stamp the entry at last.
+  slot->stamp = 0;
+  std::memcpy(Data(begin), tokens.data(), tokens.size() * sizeof(int32_t));
+  char* kv_ptr = Data(begin + kv_offset);
+  for (const NDArray& chunk : kv_data) {
+    size_t chunk_bytes = GetDataSize(*chunk.operator->());
+    std::memcpy(kv_ptr, static_cast<const char*>(chunk->data) + chunk->byte_offset, chunk_bytes);
+    kv_ptr += chunk_bytes;
+  }
+  slot->token_hash = HashTokens(tokens);
+  slot->offset = begin;
+  slot->num_bytes = num_bytes;
+  slot->num_tokens = tokens.size();
+  slot->num_chunks = kv_data.size();
+  slot->chunk_size = layout_.chunk_size;
+  slot->chunk_dims[0] = kv_data[0]->shape[0];
+  slot->chunk_dims[1] = kv_data[0]->shape[2];
+  slot->chunk_dims[2] = kv_data[0]->shape[3];
+  slot->dtype = kv_data[0]->dtype;
+  slot->stamp = ++header_->stamp_counter;
+  header_->write_offset = AlignUp(end, kSharedPrefixStoreAlignment);
+  Unlock();
+  return true;
+}
+
+std::pair<size_t, Optional<Array<NDArray>>> SharedPrefixStore::MatchAndImport(
+    const std::vector<int32_t>& tokens, size_t min_length) {
+  Lock();
+  Entry* entries = Entries();
+  const Entry* best_entry = nullptr;
+  size_t best_length = min_length;
+  for (int64_t i = 0; i < header_->max_num_entries; ++i) {
+    const Entry& entry = entries[i];
+    if (entry.stamp == 0 || !IsValidEntry(entry)) continue;
+    const int32_t* entry_tokens = reinterpret_cast<const int32_t*>(Data(entry.offset));
+    size_t max_length = std::min(static_cast<size_t>(entry.num_tokens), tokens.size());
+    if (max_length <= best_length) continue;
+    size_t length = std::mismatch(entry_tokens, entry_tokens + max_length, tokens.begin()).first -
+                    entry_tokens;
+    if (length > best_length) {
+      best_length = length;
+      best_entry = &entry;
+    }
+  }
+  if (best_entry == nullptr) {
+    Unlock();
+    return {0, NullOpt};
+  }
+
+  // Copy out the KV data chunks of the matched entry which cover the common prefix.
+  Array<NDArray> kv_data;
+  const char* kv_ptr = Data(best_entry->offset + AlignUp(best_entry->num_tokens * sizeof(int32_t),
+                                                         kSharedPrefixStoreAlignment));
+  int64_t num_remaining_tokens = best_entry->num_tokens;
+  for (int64_t i = 0;
+       i < best_entry->num_chunks && best_entry->num_tokens - num_remaining_tokens <
+                                         static_cast<int64_t>(best_length);
+       i += 2) {
+    int64_t length = std::min(num_remaining_tokens, best_entry->chunk_size);
+    num_remaining_tokens -= length;
+    for (int j = 0; j < 2; ++j) {
+      NDArray chunk = NDArray::Empty(layout_.ChunkShape(length), layout_.dtype, Device{kDLCPU, 0});
+      size_t chunk_bytes = GetDataSize(*chunk.operator->());
+      std::memcpy(chunk->data, kv_ptr, chunk_bytes);
+      kv_ptr += chunk_bytes;
+      kv_data.push_back(chunk);
+    }
+  }
+  Unlock();
+  return {best_length, kv_data};
+}
+
+#else  // MLC_LLM_SHARED_PREFIX_STORE_ENABLED
+
+struct SharedPrefixStore::Header {};
+
+std::unique_ptr<SharedPrefixStore> SharedPrefixStore::Open(const std::string& name,
+                                                           int64_t capacity_bytes,
+                                                           const KVSwapLayout& layout,
+                                                           int max_num_entries) {
+  LOG(WARNING) << "The shared prefix cache is not supported on this platform, and falls back to "
+                  "the local radix prefix cache.";
+  return nullptr;
+}
+
+SharedPrefixStore::~SharedPrefixStore() {}
+
+bool SharedPrefixStore::HasSequence(const std::vector<int32_t>& tokens) { return false; }
+
+bool SharedPrefixStore::Publish(const std::vector<int32_t>& tokens, const Array<NDArray>& kv_data) {
+  return false;
+}
+
+std::pair<size_t, Optional<Array<NDArray>>> SharedPrefixStore::MatchAndImport(
+    const std::vector<int32_t>& tokens, size_t min_length) {
+  return {0, NullOpt};
+}
+
+#endif  // MLC_LLM_SHARED_PREFIX_STORE_ENABLED
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,116 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/shared_prefix_store.h
+ * \brief The host shared memory store of prefix KV data, shared by the engines
+ * of multiple processes on the same node.
+ */
+#ifndef MLC_LLM_SERVE_SHARED_PREFIX_STORE_H_
+#define MLC_LLM_SERVE_SHARED_PREFIX_STORE_H_
+
+#include <tvm/runtime/container/array.h>
+#include <tvm/runtime/container/optional.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "kv_swap_layout.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The store of token sequences and their KV data in a named host shared memory region.
+ * Every engine process opening the store with the same name shares the same region, publishes
+ * the prefixes it has computed, and imports the prefixes published by the other processes.
+ * The region is organized as a fixed number of entry slots plus a ring buffer of entry data.
+ * Publishing a new entry evicts the oldest entries whose data get overwritten.
+ * All accesses are guarded by a process-shared mutex in the region.
+ * \note The KV data are stored in the chunked layout of `ModelObj::SwapOutSequence`. The region
+ * records the KV layout and the model identity of its creator, and a process running a different
+ * model or layout does not attach to it. The region is unlinked when the last attached process
+ * closes it.
+ */
+class SharedPrefixStore {
+ public:
+  /*!
+   * \brief Open the shared prefix store with the given name, or create it when it does not exist.
+   * \param name The name of the shared memory region.
+   * \param capacity_bytes The capacity of the entry data in bytes, used when creating the region.
+   * \param layout The KV layout and the model identity of this process.
+   * \param max_num_entries The maximum number of entries, used when creating the region.
+   * \return The opened store, or nullptr if the shared memory is not supported on the platform,
+   * or the existing region is created for a different model or KV layout.
+   * \throw Error if the shared memory fails to open.
+   */
+  static std::unique_ptr<SharedPrefixStore> Open(const std::string& name, int64_t capacity_bytes,
+                                                 const KVSwapLayout& layout,
+                                                 int max_num_entries = 4096);
+
+  ~SharedPrefixStore();
+
+  /*!
+   * \brief Check whether the store has an entry of exactly the given tokens.
+   * \param tokens The tokens to check.
+   * \return Whether there is such an entry.
+   */
+  bool HasSequence(const std::vector<int32_t>& tokens);
+
+  /*!
+   * \brief Publish the given tokens and their KV data to the store.
+   * \param tokens The tokens of the sequence.
+   * \param kv_data The host KV data chunks of the sequence, which should be ready to read.
+   * \return Whether the sequence is published. It fails when the data exceeds the capacity, or the
+   * data are not in the KV layout of the store.
+   */
+  bool Publish(const std::vector<int32_t>& tokens, const Array<NDArray>& kv_data);
+
+  /*!
+   * \brief Find the entry with the longest common prefix with the given tokens. When the common
+   * prefix is longer than the given minimum length, copy the KV data of the prefix out.
+   * \param tokens The tokens to match.
+   * \param min_length The minimum length of the common prefix to import.
+   * \return The common prefix length and the imported KV data chunks covering the common
+   * prefix, or {0, NullOpt} when nothing is imported. The returned KV data are on CPU, and
+   * only the entries consistent with the KV layout of the store are imported.
+   */
+  std::pair<size_t, Optional<Array<NDArray>>> MatchAndImport(const std::vector<int32_t>& tokens,
+                                                             size_t min_length);
+
+ private:
+  struct Header;
+  struct Entry;
+
+  SharedPrefixStore(std::string name, Header* header, size_t mapped_bytes, KVSwapLayout layout);
+
+  /*! \brief Return the entry slot array in the region. */
+  Entry* Entries();
+  /*! \brief Return the pointer to the data ring buffer at the given offset. */
+  char* Data(uint64_t offset);
+  /*! \brief Lock the process-shared mutex, recovering it if the owner process died. */
+  void Lock();
+  /*! \brief Unlock the process-shared mutex. */
+  void Unlock();
+  /*! \brief Check whether the entry is consistent with the KV layout and the region bounds. */
+  bool IsValidEntry(const Entry& entry);
+
+  /*! \brief The name of the shared memory region. */
+  std::string name_;
+  /*! \brief The mapped header of the region. */
+  Header* header_;
+  /*! \brief The total number of mapped bytes. */
+  size_t mapped_bytes_;
+  /*! \brief The KV layout and the model identity of the store. */
+  KVSwapLayout layout_;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_SHARED_PREFIX_STORE_H_
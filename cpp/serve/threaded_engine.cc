@@ -9,11 +9,20 @@
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <exception>
 #include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "../support/json_parser.h"
+#include "../support/lock_free_queue.h"
 #include "../support/result.h"
 #include "engine.h"
 #include "request.h"
@@ -33,6 +42,13 @@ enum class InstructionKind : int {
   kReloadEngine = 3,
   kResetEngine = 4,
   kDebugCallFuncOnAllAllWorker = 5,
+  kAdoptRequest = 6,
+  kPairDecodeEngines = 7,
+  kHotSwapEngine = 8,
+  kPreloadPrefix = 9,
+  kTrimMemory = 10,
+  kSaveSession = 11,
+  kRestoreSession = 12,
 };
 
 /*! \brief The implementation of ThreadedEngine. */
@@ -52,17 +68,16 @@ class ThreadedEngineImpl : public ThreadedEngine {
     // reload instruction to the other threads
     // otherwise there can be deadlocks
     reload_finished_ = false;
-    bool need_notify = false;
+    PushInstruction(InstructionKind::kReloadEngine, std::move(engine_config_json_str));
     {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kReloadEngine,
-                                      std::move(engine_config_json_str));
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+      std::unique_lock<std::mutex> lock(reload_unload_mutex_);
+      reload_unload_cv_.wait(lock, [this] { return reload_finished_; });
     }
+  }
+
+  void HotSwap(String engine_config_json_str) final {
+    reload_finished_ = false;
+    PushInstruction(InstructionKind::kHotSwapEngine, std::move(engine_config_json_str));
     {
       std::unique_lock<std::mutex> lock(reload_unload_mutex_);
       reload_unload_cv_.wait(lock, [this] { return reload_finished_; });
@@ -76,16 +91,7 @@ class ThreadedEngineImpl : public ThreadedEngine {
     // e.g. the other thread finish unload job and set the flag to true
     // then we set it back to false
     unload_finished_ = false;
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kUnloadEngine, ObjectRef(nullptr));
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
-    }
+    PushInstruction(InstructionKind::kUnloadEngine, ObjectRef(nullptr));
     {
       std::unique_lock<std::mutex> lock(reload_unload_mutex_);
       reload_unload_cv_.wait(lock, [this] { return unload_finished_; });
@@ -93,63 +99,108 @@ class ThreadedEngineImpl : public ThreadedEngine {
   }
 
   void Reset() final {
-    bool need_notify = false;
+    PushInstruction(InstructionKind::kResetEngine, ObjectRef(nullptr));
+  }
+
+  void PreloadPrefix(IntTuple token_ids) final {
+    PushInstruction(InstructionKind::kPreloadPrefix, std::move(token_ids));
+  }
+
+  void TrimMemory(bool critical) final {
+    PushInstruction(InstructionKind::kTrimMemory, IntTuple{critical});
+  }
+
+  void SaveSession(String session_id, IntTuple token_ids) final {
+    PushInstruction(InstructionKind::kSaveSession,
+                    Array<ObjectRef>{std::move(session_id), std::move(token_ids)});
+  }
+
+  void RestoreSession(String session_id) final {
+    PushInstruction(InstructionKind::kRestoreSession, std::move(session_id));
+  }
+
+  ~ThreadedEngineImpl() {
     {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kResetEngine, ObjectRef(nullptr));
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
+      std::lock_guard<std::mutex> lock(tokenize_mutex_);
+      tokenize_exit_ = true;
     }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+    tokenize_cv_.notify_all();
+    for (std::thread& thread : tokenize_threads_) {
+      thread.join();
     }
   }
 
   void AddRequest(Request request) final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kAddRequest, request);
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+    // The requests with text inputs are tokenized by the tokenize workers first, so that
+    // long prompts do not stall the background loop.
+    bool has_text_input =
+        std::any_of(request->inputs.begin(), request->inputs.end(),
+                    [](const Data& input) { return input->IsInstance<TextDataNode>(); });
+    if (has_text_input) {
+      std::lock_guard<std::mutex> lock(tokenize_mutex_);
+      if (tokenizer_.defined()) {
+        if (tokenize_threads_.empty()) {
+          int num_threads = std::clamp<int>(std::thread::hardware_concurrency() / 4, 1,
+                                            kMaxNumTokenizeThreads);
+          for (int i = 0; i < num_threads; ++i) {
+            tokenize_threads_.emplace_back([this]() { RunTokenizeLoop(); });
+          }
+        }
+        tokenizing_request_ids_.insert(request->id);
+        tokenize_queue_.push_back(std::move(request));
+        tokenize_cv_.notify_one();
+        return;
+      }
     }
+    PushAddRequestInstruction(std::move(request), /*abort_after_add=*/false);
   }
 
   void AbortRequest(const String& request_id) final {
-    bool need_notify = false;
     {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kAbortRequest, request_id);
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
+      // A request under tokenization is aborted right after it is added.
+      std::lock_guard<std::mutex> lock(tokenize_mutex_);
+      if (tokenizing_request_ids_.count(request_id)) {
+        aborted_tokenizing_request_ids_.insert(request_id);
+        return;
+      }
     }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+    PushInstruction(InstructionKind::kAbortRequest, request_id);
+  }
+
+  void AdoptRequest(RequestState rstate) final {
+    PushInstruction(InstructionKind::kAdoptRequest, std::move(rstate));
+  }
+
+  /*!
+   * \brief Pair this engine, which should run the "prefill" disaggregation role, with the
+   * given decode engines. The requests prefilled by this engine are handed off to the
+   * decode engines in turn, and the stream outputs of the decode engines are sent back
+   * through the stream callback of this engine.
+   * \param decode_engines The modules of the decode engines.
+   * \note This engine keeps the decode engines alive, and the decode engines should exit
+   * their background loops before this engine is destroyed.
+   */
+  void PairDecodeEngines(Array<Module> decode_engines) {
+    for (const Module& decode_engine : decode_engines) {
+      ThreadedEngineImpl* decode_engine_impl = FromModule(decode_engine);
+      CHECK(decode_engine_impl != this) << "An engine cannot be paired with itself.";
+      decode_engine_impl->stream_back_engine_.store(this);
     }
+    PushInstruction(InstructionKind::kPairDecodeEngines, std::move(decode_engines));
   }
 
   void RunBackgroundLoop() final {
-    // The local vectors that load the requests from critical regions.
-    std::vector<std::pair<InstructionKind, ObjectRef>> local_instruction_queue;
+    std::pair<InstructionKind, ObjectRef> instruction;
 
     while (!exit_now_.load(std::memory_order_relaxed)) {
-      {
-        std::unique_lock<std::mutex> lock(background_loop_mutex_);
-        engine_waiting_ = true;
-        background_loop_cv_.wait(lock, [this] {
-          return (background_engine_ != nullptr && !background_engine_->Empty()) ||
-                 pending_request_operation_cnt_.load() > 0 ||
-                 exit_now_.load(std::memory_order_relaxed);
-        });
-        engine_waiting_ = false;
-        local_instruction_queue = instruction_queue_;
-        instruction_queue_.clear();
-        pending_request_operation_cnt_ = 0;
+      // Sleep only when there is nothing to do. The lock is not taken otherwise.
+      if ((background_engine_ == nullptr || background_engine_->Empty()) &&
+          instruction_queue_.Empty() && !hot_swap_pending_) {
+        WaitUntil(&engine_waiting_, &background_loop_mutex_, &background_loop_cv_,
+                  [this] { return !instruction_queue_.Empty(); });
       }
-      for (const auto& [kind, arg] : local_instruction_queue) {
+      while (instruction_queue_.TryPop(&instruction)) {
+        const auto& [kind, arg] = instruction;
         if (kind == InstructionKind::kAddRequest) {
           CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
           background_engine_->AddRequest(Downcast<Request>(arg));
@@ -162,15 +213,49 @@ class ThreadedEngineImpl : public ThreadedEngine {
           if (background_engine_ != nullptr) {
             background_engine_->AbortRequest(Downcast<String>(arg));
           }
+          // The request may have been handed off to a decode engine.
+          for (const Module& decode_engine : decode_engines_) {
+            FromModule(decode_engine)->AbortRequest(Downcast<String>(arg));
+          }
+        } else if (kind == InstructionKind::kAdoptRequest) {
+          CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
+          background_engine_->AdoptRequest(Downcast<RequestState>(arg));
+        } else if (kind == InstructionKind::kPairDecodeEngines) {
+          decode_engines_ = Downcast<Array<Module>>(arg);
+          SetPrefillHandoffCallback();
         } else if (kind == InstructionKind::kUnloadEngine) {
           EngineUnloadImpl();
         } else if (kind == InstructionKind::kReloadEngine) {
           EngineUnloadImpl();
           EngineReloadImpl(Downcast<String>(arg));
+        } else if (kind == InstructionKind::kHotSwapEngine) {
+          std::string engine_config_json_str = Downcast<String>(arg);
+          if (background_engine_ != nullptr && !hot_swap_pending_ &&
+              background_engine_->StartHotSwap(engine_config_json_str)) {
+            hot_swap_pending_ = true;
+          } else {
+            EngineUnloadImpl();
+            EngineReloadImpl(engine_config_json_str);
+          }
         } else if (kind == InstructionKind::kResetEngine) {
           if (background_engine_ != nullptr) {
             background_engine_->Reset();
           }
+        } else if (kind == InstructionKind::kPreloadPrefix) {
+          CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
+          background_engine_->PreloadPrefix(Downcast<IntTuple>(arg));
+        } else if (kind == InstructionKind::kTrimMemory) {
+          // The engine may have been unloaded to free memory already.
+          if (background_engine_ != nullptr) {
+            background_engine_->TrimMemory(Downcast<IntTuple>(arg)[0] != 0);
+          }
+        } else if (kind == InstructionKind::kSaveSession) {
+          CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
+          Array<ObjectRef> args = Downcast<Array<ObjectRef>>(arg);
+          background_engine_->SaveSession(Downcast<String>(args[0]), Downcast<IntTuple>(args[1]));
+        } else if (kind == InstructionKind::kRestoreSession) {
+          CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
+          background_engine_->RestoreSession(Downcast<String>(arg));
         } else if (kind == InstructionKind::kDebugCallFuncOnAllAllWorker) {
           CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
           background_engine_->DebugCallFuncOnAllAllWorker(Downcast<String>(arg));
@@ -178,6 +263,17 @@ class ThreadedEngineImpl : public ThreadedEngine {
           LOG(FATAL) << "Cannot reach here";
         }
       }
+      if (hot_swap_pending_) {
+        // The engine keeps serving until the new weights are loaded. When there is nothing to
+        // serve, wait for the loading directly.
+        EngineCreationOutput output;
+        if (background_engine_->FinishHotSwap(/*wait=*/background_engine_->Empty(), &output)) {
+          hot_swap_pending_ = false;
+          complete_engine_config_ = output.completed_engine_config;
+          default_generation_config_ = output.default_generation_cfg;
+          NotifyReloadFinished();
+        }
+      }
       if (background_engine_ != nullptr) {
         background_engine_->Step();
       }
@@ -185,44 +281,58 @@ class ThreadedEngineImpl : public ThreadedEngine {
   }
 
   void RunBackgroundStreamBackLoop() final {
-    // The local vectors that load the request stream callback inputs from critical regions.
-    std::vector<Array<RequestStreamOutput>> local_request_stream_callback_inputs;
-    std::vector<RequestStreamOutput> flattened_callback_inputs;
+    Array<RequestStreamOutput> callback_inputs;
+    // The held outputs to pass through the next callback invocation, in arrival order.
+    std::vector<RequestStreamOutput> held_outputs;
+    // The index in `held_outputs` of the output that the next output of a request merges into.
+    std::unordered_map<String, int> merge_target_index;
+    std::chrono::steady_clock::time_point first_hold_time;
 
     while (!exit_now_.load(std::memory_order_relaxed)) {
-      {
-        std::unique_lock<std::mutex> lock(request_stream_callback_mutex_);
-        stream_callback_waiting_ = true;
-        request_stream_callback_cv_.wait(lock, [this] {
-          return pending_request_stream_callback_cnt_.load() > 0 ||
-                 exit_now_.load(std::memory_order_relaxed);
-        });
-        stream_callback_waiting_ = false;
-
-        local_request_stream_callback_inputs = request_stream_callback_inputs_;
-        request_stream_callback_inputs_.clear();
-        pending_request_stream_callback_cnt_ = 0;
+      int64_t flush_interval_us = stream_flush_interval_us_.load(std::memory_order_relaxed);
+      int max_held_outputs = stream_flush_max_outputs_.load(std::memory_order_relaxed);
+      if (request_stream_callback_inputs_.Empty()) {
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        if (!held_outputs.empty()) {
+          deadline = first_hold_time + std::chrono::microseconds(flush_interval_us);
+        }
+        WaitUntil(
+            &stream_callback_waiting_, &request_stream_callback_mutex_,
+            &request_stream_callback_cv_,
+            [this] { return !request_stream_callback_inputs_.Empty(); }, deadline);
       }
-      for (const Array<RequestStreamOutput>& callback_inputs :
-           local_request_stream_callback_inputs) {
+      while (request_stream_callback_inputs_.TryPop(&callback_inputs)) {
+        if (held_outputs.empty()) {
+          first_hold_time = std::chrono::steady_clock::now();
+        }
         for (const RequestStreamOutput& callback_input : callback_inputs) {
-          flattened_callback_inputs.push_back(callback_input);
+          HoldStreamOutput(callback_input, &held_outputs, &merge_target_index);
         }
       }
-      if (!flattened_callback_inputs.empty()) {
-        request_stream_callback_(Array<RequestStreamOutput>(flattened_callback_inputs));
+      if (held_outputs.empty()) {
+        continue;
+      }
+      if (flush_interval_us == 0 ||
+          (max_held_outputs > 0 && static_cast<int>(held_outputs.size()) >= max_held_outputs) ||
+          std::chrono::steady_clock::now() - first_hold_time >=
+              std::chrono::microseconds(flush_interval_us)) {
+        request_stream_callback_(Array<RequestStreamOutput>(held_outputs));
+        held_outputs.clear();
+        merge_target_index.clear();
       }
-      flattened_callback_inputs.clear();
     }
   }
 
   void ExitBackgroundLoop() final {
+    exit_now_.store(true);
     {
       std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      exit_now_.store(true);
+      background_loop_cv_.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+      request_stream_callback_cv_.notify_one();
     }
-    background_loop_cv_.notify_one();
-    request_stream_callback_cv_.notify_one();
   }
 
   /************** Query/Profile/Debug **************/
@@ -250,30 +360,228 @@ class ThreadedEngineImpl : public ThreadedEngine {
   }
 
   void DebugCallFuncOnAllAllWorker(const String& func_name) final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kDebugCallFuncOnAllAllWorker, func_name);
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
+    PushInstruction(InstructionKind::kDebugCallFuncOnAllAllWorker, func_name);
+  }
+
+ private:
+  /*! \brief Return the threaded engine implementation of the given threaded engine module. */
+  static ThreadedEngineImpl* FromModule(Module module);
+
+  /*!
+   * \brief Push the instruction to add the request into the instruction queue.
+   * \param request The request to add.
+   * \param abort_after_add Whether to push the instruction to abort the request right after.
+   */
+  void PushAddRequestInstruction(Request request, bool abort_after_add) {
+    String request_id = request->id;
+    instruction_queue_.Push({InstructionKind::kAddRequest, std::move(request)});
+    if (abort_after_add) {
+      // The instructions pushed by the same thread are popped in order.
+      instruction_queue_.Push({InstructionKind::kAbortRequest, request_id});
     }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+    NotifyIfWaiting(&engine_waiting_, &background_loop_mutex_, &background_loop_cv_);
+  }
+
+  /*! \brief Push the instruction into the instruction queue and wake up the background loop. */
+  void PushInstruction(InstructionKind kind, ObjectRef arg) {
+    instruction_queue_.Push({kind, std::move(arg)});
+    NotifyIfWaiting(&engine_waiting_, &background_loop_mutex_, &background_loop_cv_);
+  }
+
+  /*!
+   * \brief Block the consumer thread of a lock-free queue until the queue has elements or the
+   * engine is exiting. The waiting flag tells the producers to notify the condition variable.
+   * \param waiting The waiting flag of the consumer.
+   * \param mutex The mutex of the condition variable.
+   * \param cv The condition variable to wait on.
+   * \param has_element The function checking if the queue has elements.
+   */
+  template <typename FHasElement>
+  void WaitUntil(std::atomic<bool>* waiting, std::mutex* mutex, std::condition_variable* cv,
+                 FHasElement has_element,
+                 std::optional<std::chrono::steady_clock::time_point> deadline = std::nullopt) {
+    std::unique_lock<std::mutex> lock(*mutex);
+    waiting->store(true);
+    // Pairs with the fence in NotifyIfWaiting: either the producer sees the waiting flag, or
+    // the check below sees the pushed element.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto pred = [this, &has_element] {
+      return has_element() || exit_now_.load(std::memory_order_relaxed);
+    };
+    if (deadline.has_value()) {
+      cv->wait_until(lock, deadline.value(), pred);
+    } else {
+      cv->wait(lock, pred);
     }
+    waiting->store(false, std::memory_order_relaxed);
   }
 
- private:
-  void EngineReloadImpl(const std::string& engine_config_json_str) {
-    auto frequest_stream_callback_wrapper = [this](Array<RequestStreamOutput> delta_outputs) {
-      bool need_notify = false;
+  /*!
+   * \brief Hold the stream output until the next callback invocation. The output is merged
+   * into the held output of the same request when possible, and is then released to the engine
+   * for reuse.
+   * \param output The stream output to hold.
+   * \param held_outputs The held outputs.
+   * \param merge_target_index The index of the held output that the outputs of each request
+   * merge into.
+   */
+  static void HoldStreamOutput(const RequestStreamOutput& output,
+                               std::vector<RequestStreamOutput>* held_outputs,
+                               std::unordered_map<String, int>* merge_target_index) {
+    if (output->request_final_usage_json_str.defined()) {
+      // The usage output is the last output of a request, and is never merged.
+      merge_target_index->erase(output->request_id);
+      held_outputs->push_back(output);
+      return;
+    }
+    auto it = merge_target_index->find(output->request_id);
+    if (it != merge_target_index->end() &&
+        TryMergeStreamOutput((*held_outputs)[it->second].operator->(), output.operator->())) {
+      output->unpacked.store(true);
+      return;
+    }
+    (*merge_target_index)[output->request_id] = held_outputs->size();
+    held_outputs->push_back(output);
+  }
+
+  /*!
+   * \brief Merge the later stream output of a request into the earlier one.
+   * \return Whether the outputs can be merged. They cannot when an extra prefix string of the
+   * later output would follow the tokens of the earlier one, or when a finished group of the
+   * earlier output has more outputs.
+   */
+  static bool TryMergeStreamOutput(RequestStreamOutputObj* dst, const RequestStreamOutputObj* src) {
+    int num_groups = dst->group_delta_token_ids.size();
+    if (static_cast<int>(src->group_delta_token_ids.size()) != num_groups ||
+        dst->group_delta_logprob_json_strs.has_value() !=
+            src->group_delta_logprob_json_strs.has_value()) {
+      return false;
+    }
+    for (int i = 0; i < num_groups; ++i) {
+      bool dst_has_output =
+          !dst->group_delta_token_ids[i].empty() || dst->group_finish_reason[i].defined();
+      bool src_has_output = !src->group_delta_token_ids[i].empty() ||
+                            src->group_finish_reason[i].defined() ||
+                            !src->group_extra_prefix_string[i].empty();
+      if ((dst_has_output && !src->group_extra_prefix_string[i].empty()) ||
+          (dst->group_finish_reason[i].defined() && src_has_output)) {
+        return false;
+      }
+    }
+    for (int i = 0; i < num_groups; ++i) {
+      dst->group_extra_prefix_string[i] =
+          dst->group_extra_prefix_string[i] + src->group_extra_prefix_string[i];
+      dst->group_delta_token_ids[i].insert(dst->group_delta_token_ids[i].end(),
+                                           src->group_delta_token_ids[i].begin(),
+                                           src->group_delta_token_ids[i].end());
+      if (dst->group_delta_logprob_json_strs.has_value()) {
+        std::vector<String>& dst_logprobs = dst->group_delta_logprob_json_strs.value()[i];
+        const std::vector<String>& src_logprobs = src->group_delta_logprob_json_strs.value()[i];
+        dst_logprobs.insert(dst_logprobs.end(), src_logprobs.begin(), src_logprobs.end());
+      }
+      if (src->group_finish_reason[i].defined()) {
+        dst->group_finish_reason[i] = src->group_finish_reason[i];
+      }
+    }
+    return true;
+  }
+
+  /*!
+   * \brief Notify the consumer thread of a lock-free queue after a push if it is waiting.
+   * The lock is only taken when the consumer is waiting, so the producers do not contend with
+   * a busy consumer.
+   */
+  static void NotifyIfWaiting(std::atomic<bool>* waiting, std::mutex* mutex,
+                              std::condition_variable* cv) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting->load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(*mutex);
+      cv->notify_one();
+    }
+  }
+
+  /*! \brief The loop of a tokenize worker, which tokenizes the text inputs of requests. */
+  void RunTokenizeLoop() {
+    while (true) {
+      Request request{nullptr};
+      Tokenizer tokenizer{nullptr};
       {
-        std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
-        request_stream_callback_inputs_.push_back(std::move(delta_outputs));
-        ++pending_request_stream_callback_cnt_;
-        need_notify = stream_callback_waiting_;
+        std::unique_lock<std::mutex> lock(tokenize_mutex_);
+        tokenize_cv_.wait(lock, [this] { return tokenize_exit_ || !tokenize_queue_.empty(); });
+        if (tokenize_exit_) {
+          return;
+        }
+        request = std::move(tokenize_queue_.front());
+        tokenize_queue_.pop_front();
+        tokenizer = tokenizer_;
+      }
+      bool tokenized = true;
+      if (tokenizer.defined()) {
+        try {
+          request = Request::FromUntokenized(request, tokenizer);
+        } catch (const std::exception& e) {
+          LOG(WARNING) << "Failed to tokenize request " << request->id << ": " << e.what();
+          tokenized = false;
+        }
       }
-      if (need_notify) {
-        request_stream_callback_cv_.notify_one();
+      // The request is pushed with the tokenize lock held, so that an abort of the request is
+      // either recorded here or pushed after the request.
+      std::lock_guard<std::mutex> lock(tokenize_mutex_);
+      tokenizing_request_ids_.erase(request->id);
+      bool aborted = aborted_tokenizing_request_ids_.erase(request->id) > 0;
+      if (!tokenized) {
+        // The request never reaches the engine, so its error finish is streamed back here.
+        PushRequestStreamOutputs(GetTokenizeErrorOutputs(request));
+        continue;
+      }
+      PushAddRequestInstruction(std::move(request), /*abort_after_add=*/aborted);
+    }
+  }
+
+  /*!
+   * \brief Get the outputs finishing all the generations of the request that fails to be
+   * tokenized with the "error" finish reason, followed by the final usage.
+   */
+  static Array<RequestStreamOutput> GetTokenizeErrorOutputs(const Request& request) {
+    int n = request->generation_cfg->n;
+    return {RequestStreamOutput(request->id, std::vector<std::vector<int64_t>>(n), std::nullopt,
+                                std::vector<Optional<String>>(n, String("error")),
+                                std::vector<String>(n)),
+            RequestStreamOutput::Usage(
+                request->id, "{ \"prompt_tokens\": 0, \"completion_tokens\": 0, "
+                             "\"total_tokens\": 0 }")};
+  }
+
+  /*! \brief Push the delta outputs to the queue of the stream back loop. */
+  void PushRequestStreamOutputs(Array<RequestStreamOutput> delta_outputs) {
+    request_stream_callback_inputs_.Push(std::move(delta_outputs));
+    NotifyIfWaiting(&stream_callback_waiting_, &request_stream_callback_mutex_,
+                    &request_stream_callback_cv_);
+  }
+
+  /*!
+   * \brief Set the prefill handoff callback of the background engine, which hands the
+   * prefilled requests off to the paired decode engines in round-robin order.
+   */
+  void SetPrefillHandoffCallback() {
+    if (background_engine_ == nullptr || decode_engines_.empty()) {
+      return;
+    }
+    background_engine_->SetPrefillHandoffCallback([this](RequestState rstate) {
+      ThreadedEngineImpl* decode_engine = FromModule(decode_engines_[next_decode_engine_]);
+      next_decode_engine_ = (next_decode_engine_ + 1) % decode_engines_.size();
+      decode_engine->AdoptRequest(std::move(rstate));
+    });
+  }
+
+  void EngineReloadImpl(const std::string& engine_config_json_str) {
+    auto frequest_stream_callback_wrapper = [this](Array<RequestStreamOutput> delta_outputs) {
+      // The outputs of a paired decode engine are sent back through its prefill engine.
+      ThreadedEngineImpl* stream_back_engine = stream_back_engine_.load();
+      if (stream_back_engine != nullptr) {
+        stream_back_engine->PushRequestStreamOutputs(std::move(delta_outputs));
+      } else {
+        PushRequestStreamOutputs(std::move(delta_outputs));
       }
     };
 
@@ -285,8 +593,20 @@ class ThreadedEngineImpl : public ThreadedEngine {
     background_engine_ = std::move(output.reloaded_engine);
     default_generation_config_ = output.default_generation_cfg;
     complete_engine_config_ = output.completed_engine_config;
+    stream_flush_interval_us_.store(
+        static_cast<int64_t>(complete_engine_config_.value()->stream_flush_interval_ms * 1000));
+    stream_flush_max_outputs_.store(complete_engine_config_.value()->stream_flush_max_outputs);
+    {
+      std::lock_guard<std::mutex> lock(tokenize_mutex_);
+      tokenizer_ = output.tokenizer;
+    }
+    SetPrefillHandoffCallback();
+    NotifyReloadFinished();
+  }
+
+  /*! \brief Wake up the thread waiting for reload or hot swap finish. */
+  void NotifyReloadFinished() {
     {
-      // Wake up the thread waiting for reload finish.
       std::lock_guard<std::mutex> lock(reload_unload_mutex_);
       reload_finished_ = true;
     }
@@ -294,6 +614,11 @@ class ThreadedEngineImpl : public ThreadedEngine {
   }
 
   void EngineUnloadImpl() {
+    if (hot_swap_pending_) {
+      // The started hot swap is dropped together with the engine.
+      hot_swap_pending_ = false;
+      NotifyReloadFinished();
+    }
     if (background_engine_ != nullptr) {
       background_engine_->AbortAllRequests();
       background_engine_ = nullptr;
@@ -304,6 +629,8 @@ class ThreadedEngineImpl : public ThreadedEngine {
       (*fclear_memory_manager)();
       default_generation_config_ = NullOpt;
       complete_engine_config_ = NullOpt;
+      std::lock_guard<std::mutex> lock(tokenize_mutex_);
+      tokenizer_ = Tokenizer{nullptr};
     }
     {
       // Wake up the thread waiting for unload finish.
@@ -327,7 +654,38 @@ class ThreadedEngineImpl : public ThreadedEngine {
   /*! \brief The default generation config. */
   Optional<GenerationConfig> default_generation_config_;
 
-  /*! \brief The mutex ensuring only one thread can access critical regions. */
+  /*************** Disaggregated serving ***************/
+  /*! \brief The decode engines paired with this prefill engine. */
+  Array<Module> decode_engines_;
+  /*! \brief The index of the decode engine to hand the next request off to. */
+  int next_decode_engine_ = 0;
+  /*! \brief The prefill engine to send back the stream outputs when this is a decode engine. */
+  std::atomic<ThreadedEngineImpl*> stream_back_engine_ = nullptr;
+
+  /*************** Request tokenization ***************/
+  /*! \brief The max number of tokenize workers. */
+  static constexpr int kMaxNumTokenizeThreads = 4;
+  /*! \brief The tokenize workers, which are started on the first request with text inputs. */
+  std::vector<std::thread> tokenize_threads_;
+  /*! \brief The mutex of the tokenization states below. */
+  std::mutex tokenize_mutex_;
+  /*! \brief The condition variable to wake up the tokenize workers. */
+  std::condition_variable tokenize_cv_;
+  /*! \brief The tokenizer of the loaded engine. It is undefined when no engine is loaded. */
+  Tokenizer tokenizer_{nullptr};
+  /*! \brief The requests waiting for tokenization. */
+  std::deque<Request> tokenize_queue_;
+  /*! \brief The ids of the requests that are waiting for or under tokenization. */
+  std::unordered_set<String> tokenizing_request_ids_;
+  /*! \brief The ids of the requests that are aborted during tokenization. */
+  std::unordered_set<String> aborted_tokenizing_request_ids_;
+  /*! \brief A boolean flag denoting if the tokenize workers need to exit. */
+  bool tokenize_exit_ = false;
+
+  /*!
+   * \brief The mutexes of the condition variables. The background loop and the stream back
+   * loop only take them to sleep when their queues are empty.
+   */
   std::mutex background_loop_mutex_;
   std::mutex request_stream_callback_mutex_;
   std::mutex reload_unload_mutex_;
@@ -338,7 +696,7 @@ class ThreadedEngineImpl : public ThreadedEngine {
   /*! \brief A boolean flag denoting if the engine needs to exit background loop. */
   std::atomic<bool> exit_now_ = false;
 
-  /************** Critical Regions **************/
+  /************** Lock-free Queues **************/
   /*!
    * \brief The instruction queue for the threaded engine.
    * The instructions include:
@@ -346,34 +704,33 @@ class ThreadedEngineImpl : public ThreadedEngine {
    *  - requests to abort from the background engine,
    *  - engine unload/reload,
    *  - and other debugging instructions.
-   * Elements are sended from other threads and consumed by
+   * Elements are pushed from other threads and consumed by
    * the threaded engine in the background loop.
    */
-  std::vector<std::pair<InstructionKind, ObjectRef>> instruction_queue_;
+  MPSCQueue<std::pair<InstructionKind, ObjectRef>> instruction_queue_;
   /*!
    * \brief The delta outputs to pass through callback.
-   * Elements are sended from the background loop thread and
-   * consumed by the foreground thread.
+   * Elements are pushed from the background loop thread, and from the background loops of
+   * the paired decode engines in disaggregated serving, and consumed by the stream back loop.
    */
-  std::vector<Array<RequestStreamOutput>> request_stream_callback_inputs_;
-  /*!
-   * \brief Number of pending request operations, should be the size of
-   * `requests_to_add_` and `requests_to_abort_`.
-   */
-  std::atomic<int> pending_request_operation_cnt_ = 0;
-  /*!
-   * \brief Number of pending request stream callback invocations.
-   * It should be the size of `request_stream_callback_inputs_`.
-   */
-  std::atomic<int> pending_request_stream_callback_cnt_ = 0;
+  MPSCQueue<Array<RequestStreamOutput>> request_stream_callback_inputs_;
   /*! \brief A boolean flag indicating if the engine is waiting for new requests/aborts. */
-  bool engine_waiting_ = false;
+  std::atomic<bool> engine_waiting_ = false;
   /*! \brief A boolean flag indicating if the stream callback loop is waiting. */
-  bool stream_callback_waiting_ = false;
+  std::atomic<bool> stream_callback_waiting_ = false;
+  /*! \brief The max time in microseconds to hold the stream outputs before the callback. */
+  std::atomic<int64_t> stream_flush_interval_us_ = 0;
+  /*! \brief The number of held stream outputs which triggers the callback. Zero means no limit. */
+  std::atomic<int> stream_flush_max_outputs_ = 0;
   /*! \brief A boolean indicating if the engine reload has finished. */
   bool reload_finished_ = false;
   /*! \brief A boolean indicating if the engine unload has finished. */
   bool unload_finished_ = false;
+  /*!
+   * \brief A boolean indicating if a hot swap of the background engine is started and waits
+   * for the new weights. It is only accessed on the background loop thread.
+   */
+  bool hot_swap_pending_ = false;
 };
 
 /*! \brief The implementation of ThreadedEngine. */
@@ -382,6 +739,7 @@ class ThreadedEngineModule : public ThreadedEngineImpl, public ModuleNode {
   TVM_MODULE_VTABLE_BEGIN("mlc.serve.async_threaded_engine");
   TVM_MODULE_VTABLE_ENTRY("init_threaded_engine", &ThreadedEngineImpl::InitThreadedEngine);
   TVM_MODULE_VTABLE_ENTRY("reload", &ThreadedEngineImpl::Reload);
+  TVM_MODULE_VTABLE_ENTRY("hot_swap", &ThreadedEngineImpl::HotSwap);
   TVM_MODULE_VTABLE_ENTRY("add_request", &ThreadedEngineImpl::AddRequest);
   TVM_MODULE_VTABLE_ENTRY("create_request", &ThreadedEngineImpl::CreateRequest);
   TVM_MODULE_VTABLE_ENTRY("abort_request", &ThreadedEngineImpl::AbortRequest);
@@ -392,11 +750,22 @@ class ThreadedEngineModule : public ThreadedEngineImpl, public ModuleNode {
   TVM_MODULE_VTABLE_ENTRY("get_complete_engine_config",
                           &ThreadedEngineImpl::GetCompleteEngineConfigJSONString);
   TVM_MODULE_VTABLE_ENTRY("reset", &ThreadedEngineImpl::Reset);
+  TVM_MODULE_VTABLE_ENTRY("preload_prefix", &ThreadedEngineImpl::PreloadPrefix);
+  TVM_MODULE_VTABLE_ENTRY("trim_memory", &ThreadedEngineImpl::TrimMemory);
+  TVM_MODULE_VTABLE_ENTRY("save_session", &ThreadedEngineImpl::SaveSession);
+  TVM_MODULE_VTABLE_ENTRY("restore_session", &ThreadedEngineImpl::RestoreSession);
   TVM_MODULE_VTABLE_ENTRY("debug_call_func_on_all_worker",
                           &ThreadedEngineImpl::DebugCallFuncOnAllAllWorker);
+  TVM_MODULE_VTABLE_ENTRY("pair_decode_engines", &ThreadedEngineImpl::PairDecodeEngines);
   TVM_MODULE_VTABLE_END();
 };
 
+ThreadedEngineImpl* ThreadedEngineImpl::FromModule(Module module) {
+  auto* threaded_engine = dynamic_cast<ThreadedEngineModule*>(module.operator->());
+  CHECK(threaded_engine != nullptr) << "The module is not a threaded engine.";
+  return threaded_engine;
+}
+
 TVM_REGISTER_GLOBAL("mlc.serve.create_threaded_engine").set_body_typed([]() {
   return Module(make_object<ThreadedEngineModule>());
 });
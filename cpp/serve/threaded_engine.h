@@ -49,12 +49,51 @@ class ThreadedEngine {
    */
   virtual void Reload(String engine_config_json_str) = 0;
 
+  /*!
+   * \brief Hot swap the model weights of the engine to the models of the new engine config,
+   * keeping the KV cache allocation and the model workspace. The new weights are loaded while
+   * the engine keeps serving, and the running requests are aborted at the swap. It falls back
+   * to reload when the new models are not compatible with the current ones.
+   * \param engine_config_json_str The engine config JSON string.
+   * \sa Engine::StartHotSwap
+   */
+  virtual void HotSwap(String engine_config_json_str) = 0;
+
+  /*!
+   * \brief Preload the given token sequence into prefix cache and pin it there.
+   * \param token_ids The token ids of the sequence to preload.
+   * \sa Engine::PreloadPrefix
+   */
+  virtual void PreloadPrefix(IntTuple token_ids) = 0;
+
   /*! \brief Unload the background engine. */
   virtual void Unload() = 0;
 
   /*! \brief Reset the engine to the initial state. */
   virtual void Reset() = 0;
 
+  /*!
+   * \brief Release memory in reaction to the memory pressure of the system.
+   * \param critical Whether the memory pressure is critical.
+   * \sa Engine::TrimMemory
+   */
+  virtual void TrimMemory(bool critical) = 0;
+
+  /*!
+   * \brief Save the KV snapshot of the given conversation tokens of the session.
+   * \param session_id The session id.
+   * \param token_ids The token ids of the conversation so far.
+   * \sa Engine::SaveSession
+   */
+  virtual void SaveSession(String session_id, IntTuple token_ids) = 0;
+
+  /*!
+   * \brief Restore the KV snapshot of the session into prefix cache.
+   * \param session_id The session id.
+   * \sa Engine::RestoreSession
+   */
+  virtual void RestoreSession(String session_id) = 0;
+
   /*! \brief Starts the background request processing loop. */
   virtual void RunBackgroundLoop() = 0;
 
@@ -74,6 +113,12 @@ class ThreadedEngine {
   /*! \brief Abort the input request (specified by id string) from engine. */
   virtual void AbortRequest(const String& request_id) = 0;
 
+  /*!
+   * \brief Adopt a request handed off by a paired prefill engine in disaggregated serving.
+   * \param rstate The request state handed off, which holds the KV data on host.
+   */
+  virtual void AdoptRequest(RequestState rstate) = 0;
+
   /************** Query/Profile/Debug **************/
 
   /*! \brief Return the default generation config. */
@@ -0,0 +1,311 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/threaded_engine_pool.cc
+ * \brief The implementation of the pool of threaded engines.
+ */
+#include "threaded_engine_pool.h"
+
+#include <picojson.h>
+#include <tvm/runtime/module.h>
+#include <tvm/runtime/registry.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../support/json_parser.h"
+#include "prefix_affinity_router.h"
+#include "threaded_engine.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The implementation of ThreadedEnginePool. */
+class ThreadedEnginePoolImpl : public ThreadedEnginePool {
+ public:
+  ~ThreadedEnginePoolImpl() { Shutdown(); }
+
+  void InitThreadedEnginePool(Optional<PackedFunc> request_stream_callback,
+                              Optional<EventTraceRecorder> trace_recorder) final {
+    CHECK(request_stream_callback.defined())
+        << "ThreadedEnginePool requires request stream callback function, but it is not given.";
+    request_stream_callback_ = request_stream_callback.value();
+    trace_recorder_ = trace_recorder;
+  }
+
+  int AddReplica(String model, Device device, String engine_config_json_str) final {
+    CHECK(request_stream_callback_ != nullptr) << "The engine pool has not been initialized.";
+    // The replicas are added one at a time, so that the replica indices match the router's.
+    // Shutdown takes the same lock, so a replica is either added before the shutdown and
+    // stopped by it, or is rejected here.
+    std::lock_guard<std::mutex> add_replica_lock(add_replica_mutex_);
+    int replica_index;
+    {
+      std::lock_guard<std::mutex> lock(routing_mutex_);
+      CHECK(!shutdown_) << "The engine pool has been shut down.";
+      replica_index = router_.AddReplica();
+    }
+    auto replica = std::make_unique<Replica>();
+    replica->model = model;
+    replica->engine = ThreadedEngine::Create();
+    auto frequest_stream_callback_wrapper = [this, replica_index](TVMArgs args,
+                                                                   TVMRetValue* ret) {
+      Array<RequestStreamOutput> delta_outputs = args[0];
+      OnStreamOutputs(replica_index, delta_outputs);
+    };
+    replica->engine->InitThreadedEngine(device, PackedFunc(frequest_stream_callback_wrapper),
+                                        trace_recorder_);
+    ThreadedEngine* engine = replica->engine.get();
+    replica->background_loop_thread = std::thread([engine]() { engine->RunBackgroundLoop(); });
+    replica->stream_back_loop_thread =
+        std::thread([engine]() { engine->RunBackgroundStreamBackLoop(); });
+    engine->Reload(std::move(engine_config_json_str));
+    replica->default_generation_cfg = engine->GetDefaultGenerationConfig();
+
+    std::lock_guard<std::mutex> lock(routing_mutex_);
+    ICHECK_EQ(replica_index, replicas_.size());
+    replicas_.push_back(std::move(replica));
+    replica_stats_.emplace_back();
+    return replica_index;
+  }
+
+  Request CreateRequest(String model, String id, Array<Data> inputs,
+                        String generation_cfg_json_str) const final {
+    GenerationConfig default_generation_cfg{nullptr};
+    {
+      std::lock_guard<std::mutex> lock(routing_mutex_);
+      std::vector<int> candidates = GetCandidates(model);
+      default_generation_cfg = replicas_[candidates[0]]->default_generation_cfg;
+    }
+    picojson::object config = json::ParseToJSONObject(generation_cfg_json_str);
+    auto gen_config = GenerationConfig::FromJSON(config, default_generation_cfg);
+    CHECK(gen_config.IsOk()) << gen_config.UnwrapErr();
+    return Request(std::move(id), std::move(inputs), gen_config.Unwrap());
+  }
+
+  void AddRequest(String model, Request request) final {
+    std::vector<uint64_t> block_hashes = ComputePromptBlockHashes(request);
+    ThreadedEngine* engine;
+    {
+      std::lock_guard<std::mutex> lock(routing_mutex_);
+      if (shutdown_) {
+        LOG(WARNING) << "Request " << request->id
+                     << " is dropped, since the engine pool has been shut down.";
+        return;
+      }
+      auto [replica_index, num_matched_blocks] =
+          router_.Route(block_hashes, GetCandidates(model));
+      request_replica_[request->id] = replica_index;
+      ReplicaStats& stats = replica_stats_[replica_index];
+      ++stats.num_routed;
+      if (num_matched_blocks > 0) {
+        ++stats.num_prefix_hits;
+        stats.num_matched_blocks += num_matched_blocks;
+      }
+      stats.num_prompt_blocks += block_hashes.size();
+      engine = replicas_[replica_index]->engine.get();
+    }
+    engine->AddRequest(std::move(request));
+  }
+
+  void AbortRequest(const String& request_id) final {
+    ThreadedEngine* engine = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(routing_mutex_);
+      if (shutdown_) {
+        return;
+      }
+      auto it = request_replica_.find(request_id);
+      if (it == request_replica_.end()) {
+        // The request has finished or does not exist.
+        return;
+      }
+      engine = replicas_[it->second]->engine.get();
+    }
+    engine->AbortRequest(request_id);
+  }
+
+  void Shutdown() final {
+    // Wait for the replica being added, so that it is stopped along with the others.
+    std::lock_guard<std::mutex> add_replica_lock(add_replica_mutex_);
+    std::vector<std::unique_ptr<Replica>> replicas;
+    {
+      std::lock_guard<std::mutex> lock(routing_mutex_);
+      // The routing states index the replicas, so they are cleared together.
+      shutdown_ = true;
+      replicas = std::move(replicas_);
+      replicas_.clear();
+      replica_stats_.clear();
+      request_replica_.clear();
+      router_ = PrefixAffinityRouter();
+    }
+    for (const std::unique_ptr<Replica>& replica : replicas) {
+      replica->engine->ExitBackgroundLoop();
+    }
+    for (const std::unique_ptr<Replica>& replica : replicas) {
+      replica->background_loop_thread.join();
+      replica->stream_back_loop_thread.join();
+    }
+  }
+
+  String GetRoutingStatsJSONString() const final {
+    std::lock_guard<std::mutex> lock(routing_mutex_);
+    picojson::array replicas_json;
+    for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+      const ReplicaStats& stats = replica_stats_[i];
+      picojson::object replica_json;
+      replica_json["model"] = picojson::value(std::string(replicas_[i]->model));
+      replica_json["load"] = picojson::value(router_.GetLoad(i));
+      replica_json["num_shadow_blocks"] = picojson::value(router_.GetNumBlocks(i));
+      replica_json["num_routed"] = picojson::value(stats.num_routed);
+      replica_json["num_prefix_hits"] = picojson::value(stats.num_prefix_hits);
+      replica_json["prefix_block_hit_rate"] = picojson::value(
+          stats.num_prompt_blocks > 0
+              ? static_cast<double>(stats.num_matched_blocks) / stats.num_prompt_blocks
+              : 0.0);
+      replicas_json.push_back(picojson::value(replica_json));
+    }
+    picojson::object stats_json;
+    stats_json["replicas"] = picojson::value(replicas_json);
+    return picojson::value(stats_json).serialize(true);
+  }
+
+ private:
+  /*! \brief A replica in the pool. */
+  struct Replica {
+    /*! \brief The model name of the replica. */
+    String model;
+    /*! \brief The threaded engine of the replica. */
+    std::unique_ptr<ThreadedEngine> engine;
+    /*! \brief The default generation config of the replica. */
+    GenerationConfig default_generation_cfg{nullptr};
+    /*! \brief The thread running the background loop of the engine. */
+    std::thread background_loop_thread;
+    /*! \brief The thread running the stream back loop of the engine. */
+    std::thread stream_back_loop_thread;
+  };
+
+  /*! \brief The routing statistics of a replica. */
+  struct ReplicaStats {
+    int64_t num_routed = 0;
+    int64_t num_prefix_hits = 0;
+    int64_t num_matched_blocks = 0;
+    int64_t num_prompt_blocks = 0;
+  };
+
+  /*! \brief The number of tokens per prompt block for routing. */
+  static constexpr int kTokenBlockSize = 16;
+  /*! \brief The number of bytes per prompt block for routing, for the untokenized prompts. */
+  static constexpr int kTextBlockSize = 64;
+
+  /*!
+   * \brief Compute the block hashes of the request prompt. The prompt is the leading token data
+   * or text data of the inputs, and the other data (e.g., images) end the prompt.
+   */
+  static std::vector<uint64_t> ComputePromptBlockHashes(const Request& request) {
+    std::vector<int32_t> prompt;
+    bool is_text = false;
+    for (const Data& data : request->inputs) {
+      if (const auto* token_data = data.as<TokenDataNode>()) {
+        if (is_text) break;
+        prompt.insert(prompt.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+      } else if (const auto* text_data = data.as<TextDataNode>()) {
+        if (!prompt.empty() && !is_text) break;
+        is_text = true;
+        const std::string& text = text_data->text;
+        prompt.insert(prompt.end(), text.begin(), text.end());
+      } else {
+        break;
+      }
+    }
+    return PrefixAffinityRouter::ComputeBlockHashes(prompt,
+                                                    is_text ? kTextBlockSize : kTokenBlockSize);
+  }
+
+  /*! \brief Return the replicas of the model. An empty model means all replicas. */
+  std::vector<int> GetCandidates(const String& model) const {
+    std::vector<int> candidates;
+    for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+      if (model.empty() || replicas_[i]->model == model) {
+        candidates.push_back(i);
+      }
+    }
+    CHECK(!candidates.empty()) << "There is no replica of model \"" << model
+                               << "\" in the engine pool.";
+    return candidates;
+  }
+
+  /*!
+   * \brief The stream callback of the replicas. The replica load is released when the final
+   * usage output of a request is streamed back, which is the last output of the request.
+   */
+  void OnStreamOutputs(int replica_index, const Array<RequestStreamOutput>& delta_outputs) {
+    {
+      std::lock_guard<std::mutex> lock(routing_mutex_);
+      for (const RequestStreamOutput& delta_output : delta_outputs) {
+        if (!delta_output->request_final_usage_json_str.defined()) {
+          continue;
+        }
+        auto it = request_replica_.find(delta_output->request_id);
+        if (it != request_replica_.end() && it->second == replica_index) {
+          router_.Finish(replica_index);
+          request_replica_.erase(it);
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    request_stream_callback_(delta_outputs);
+  }
+
+  /*! \brief The request stream callback of the pool. */
+  PackedFunc request_stream_callback_;
+  /*! \brief Event trace recorder. */
+  Optional<EventTraceRecorder> trace_recorder_;
+  /*! \brief The mutex serializing the request stream callback invocations. */
+  std::mutex callback_mutex_;
+  /*! \brief The mutex serializing the replica additions and the shutdown. */
+  std::mutex add_replica_mutex_;
+
+  /*! \brief The mutex of the replicas and the routing states below. */
+  mutable std::mutex routing_mutex_;
+  /*! \brief The replicas. */
+  std::vector<std::unique_ptr<Replica>> replicas_;
+  /*! \brief The router of the requests. */
+  PrefixAffinityRouter router_;
+  /*! \brief The routing statistics of each replica. */
+  std::vector<ReplicaStats> replica_stats_;
+  /*! \brief The replica serving each unfinished request. */
+  std::unordered_map<String, int> request_replica_;
+  /*! \brief Whether the pool has been shut down, after which no request is accepted. */
+  bool shutdown_ = false;
+};
+
+/*! \brief The module of ThreadedEnginePool. */
+class ThreadedEnginePoolModule : public ThreadedEnginePoolImpl, public ModuleNode {
+ public:
+  TVM_MODULE_VTABLE_BEGIN("mlc.serve.threaded_engine_pool");
+  TVM_MODULE_VTABLE_ENTRY("init_threaded_engine_pool",
+                          &ThreadedEnginePoolImpl::InitThreadedEnginePool);
+  TVM_MODULE_VTABLE_ENTRY("add_replica", &ThreadedEnginePoolImpl::AddReplica);
+  TVM_MODULE_VTABLE_ENTRY("create_request", &ThreadedEnginePoolImpl::CreateRequest);
+  TVM_MODULE_VTABLE_ENTRY("add_request", &ThreadedEnginePoolImpl::AddRequest);
+  TVM_MODULE_VTABLE_ENTRY("abort_request", &ThreadedEnginePoolImpl::AbortRequest);
+  TVM_MODULE_VTABLE_ENTRY("shutdown", &ThreadedEnginePoolImpl::Shutdown);
+  TVM_MODULE_VTABLE_ENTRY("get_routing_stats", &ThreadedEnginePoolImpl::GetRoutingStatsJSONString);
+  TVM_MODULE_VTABLE_END();
+};
+
+TVM_REGISTER_GLOBAL("mlc.serve.create_threaded_engine_pool").set_body_typed([]() {
+  return Module(make_object<ThreadedEnginePoolModule>());
+});
+
+std::unique_ptr<ThreadedEnginePool> ThreadedEnginePool::Create() {
+  return std::make_unique<ThreadedEnginePoolImpl>();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
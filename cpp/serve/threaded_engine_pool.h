@@ -0,0 +1,84 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/threaded_engine_pool.h
+ * \brief The header of the pool of threaded engines which routes requests across replicas.
+ */
+
+#ifndef MLC_LLM_SERVE_THREADED_ENGINE_POOL_H_
+#define MLC_LLM_SERVE_THREADED_ENGINE_POOL_H_
+
+#include <tvm/runtime/packed_func.h>
+
+#include <memory>
+
+#include "data.h"
+#include "event_trace_recorder.h"
+#include "request.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The pool of threaded engines, each of which serves a replica of a model on a device.
+ * The pool owns the background loop threads of the engines. A new request goes to a replica
+ * of its model chosen by PrefixAffinityRouter, which prefers the replica that most likely has
+ * the longest prefix of the request in its prefix cache, unless the replica is overloaded.
+ * The stream outputs of all replicas are passed through the single stream callback of the pool.
+ */
+class ThreadedEnginePool {
+ public:
+  /*! \brief Create a ThreadedEnginePool. */
+  static std::unique_ptr<ThreadedEnginePool> Create();
+
+  virtual ~ThreadedEnginePool() = default;
+
+  /*!
+   * \brief Initialize the pool.
+   * \param request_stream_callback The request stream callback function of all replicas.
+   * The callback invocations are serialized.
+   * \param trace_recorder Event trace recorder for requests.
+   */
+  virtual void InitThreadedEnginePool(Optional<PackedFunc> request_stream_callback,
+                                      Optional<EventTraceRecorder> trace_recorder) = 0;
+
+  /*!
+   * \brief Add a replica, which starts a threaded engine with its background loops and loads it.
+   * \param model The model name that the requests refer to the replica with.
+   * \param device The device where to run the models of the replica.
+   * \param engine_config_json_str The engine config JSON string of the replica.
+   * \return The index of the replica.
+   */
+  virtual int AddReplica(String model, Device device, String engine_config_json_str) = 0;
+
+  /*!
+   * \brief Create a request with the default generation config of the replicas of the model.
+   * \param model The model name. It can be empty when the pool serves a single model.
+   */
+  virtual Request CreateRequest(String model, String id, Array<Data> inputs,
+                                String generation_cfg_json_str) const = 0;
+
+  /*!
+   * \brief Route the request to a replica of the model and add it to the replica.
+   * \param model The model name. It can be empty when the pool serves a single model.
+   * \param request The request to add.
+   */
+  virtual void AddRequest(String model, Request request) = 0;
+
+  /*! \brief Abort the input request (specified by id string) from the replica serving it. */
+  virtual void AbortRequest(const String& request_id) = 0;
+
+  /*! \brief Exit the background loops of all replicas and join their threads. */
+  virtual void Shutdown() = 0;
+
+  /*! \brief Return the routing statistics of the replicas in JSON string. */
+  virtual String GetRoutingStatsJSONString() const = 0;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_THREADED_ENGINE_POOL_H_
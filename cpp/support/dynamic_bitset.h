@@ -93,6 +93,14 @@ class DynamicBitset {
   /*! \brief Get the size of the bitset. */
   int Size() const { return size_; }
 
+  /*! \brief Get the size of the uint32_t buffer of the bitset. */
+  int BufferSize() const { return buffer_size_; }
+
+  /*! \brief Get the uint32_t buffer of the bitset. */
+  uint32_t* Data() { return data_; }
+  /*! \brief Get the uint32_t buffer of the bitset. */
+  const uint32_t* Data() const { return data_; }
+
   /*! \brief Set the whole bitset to true. */
   void Set() {
     DCHECK(data_);
@@ -118,6 +126,53 @@ class DynamicBitset {
   /*! \brief Set the bit at the given index to false. */
   void Reset(int index) { Set(index, false); }
 
+  /*!
+   * \brief Set the bits in the range [begin, end) to the given value. The bits are set by whole
+   * words except the partial words at both ends.
+   */
+  void SetRange(int begin, int end, bool value = true) {
+    DCHECK(data_ && begin >= 0 && begin <= end && end <= size_);
+    if (begin == end) {
+      return;
+    }
+    int begin_word = begin / 32;
+    int end_word = (end - 1) / 32;
+    uint32_t begin_mask = ~static_cast<uint32_t>(0) << (begin % 32);
+    uint32_t end_mask = ~static_cast<uint32_t>(0) >> (31 - (end - 1) % 32);
+    if (begin_word == end_word) {
+      SetWordBits(begin_word, begin_mask & end_mask, value);
+      return;
+    }
+    SetWordBits(begin_word, begin_mask, value);
+    std::memset(data_ + begin_word + 1, value ? 0xFF : 0,
+                (end_word - begin_word - 1) * sizeof(uint32_t));
+    SetWordBits(end_word, end_mask, value);
+  }
+
+  /*! \brief Get the number of bits set to true. */
+  int Count() const {
+    DCHECK(data_ || buffer_size_ == 0);
+    int count = 0;
+    for (int i = 0; i + 1 < buffer_size_; ++i) {
+      count += PopCount(data_[i]);
+    }
+    if (buffer_size_ > 0) {
+      count += PopCount(data_[buffer_size_ - 1] & LastWordMask());
+    }
+    return count;
+  }
+
+  /*! \brief Check if all the bits are set to true. */
+  bool All() const {
+    DCHECK(data_ || buffer_size_ == 0);
+    for (int i = 0; i + 1 < buffer_size_; ++i) {
+      if (data_[i] != ~static_cast<uint32_t>(0)) {
+        return false;
+      }
+    }
+    return buffer_size_ == 0 || (data_[buffer_size_ - 1] & LastWordMask()) == LastWordMask();
+  }
+
   /*! \brief Perform a bitwise OR operation between the current bitset and another bitset. */
   DynamicBitset& operator|=(const DynamicBitset& other) {
     DCHECK(buffer_size_ <= other.buffer_size_);
@@ -127,7 +182,51 @@ class DynamicBitset {
     return *this;
   }
 
+  /*! \brief Perform a bitwise AND operation between the current bitset and another bitset. */
+  DynamicBitset& operator&=(const DynamicBitset& other) {
+    DCHECK(buffer_size_ <= other.buffer_size_);
+    for (int i = 0; i < buffer_size_; ++i) {
+      data_[i] &= other.data_[i];
+    }
+    return *this;
+  }
+
+  /*! \brief Set the bits that are true in another bitset to false. */
+  DynamicBitset& AndNot(const DynamicBitset& other) {
+    DCHECK(buffer_size_ <= other.buffer_size_);
+    for (int i = 0; i < buffer_size_; ++i) {
+      data_[i] &= ~other.data_[i];
+    }
+    return *this;
+  }
+
  private:
+  /*! \brief Set the bits of the word at the given index selected by the mask. */
+  void SetWordBits(int word_index, uint32_t mask, bool value) {
+    if (value) {
+      data_[word_index] |= mask;
+    } else {
+      data_[word_index] &= ~mask;
+    }
+  }
+
+  /*! \brief The mask of the bits of the last word that are within the bitset. */
+  uint32_t LastWordMask() const {
+    return size_ % 32 == 0 ? ~static_cast<uint32_t>(0)
+                           : ~static_cast<uint32_t>(0) >> (32 - size_ % 32);
+  }
+
+  /*! \brief Count the bits set to true in a word. */
+  static int PopCount(uint32_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(word);
+#else
+    word = word - ((word >> 1) & 0x55555555);
+    word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+    return static_cast<int>((((word + (word >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#endif
+  }
+
   // The size of the bitset.
   int size_;
   // The size of the buffer.
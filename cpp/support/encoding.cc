@@ -7,17 +7,27 @@
 #include <tvm/runtime/logging.h>
 
 #include <array>
+#include <cstring>
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define MLC_LLM_ENCODING_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define MLC_LLM_ENCODING_NEON 1
+#include <arm_neon.h>
+#endif
 
 namespace mlc {
 namespace llm {
 
 std::string PrintAsUTF8(TCodepoint codepoint) {
   ICHECK(codepoint <= 0x10FFFF) << "Invalid codepoint: " << codepoint;
-  std::string utf8;
   if (codepoint <= 0x7F) {
     // 1-byte sequence
-    utf8 += static_cast<char>(codepoint);
-  } else if (codepoint <= 0x7FF) {
+    return std::string(1, static_cast<char>(codepoint));
+  }
+  std::string utf8;
+  if (codepoint <= 0x7FF) {
     // 2-byte sequence
     utf8 += static_cast<char>(0xC0 | ((codepoint >> 6) & 0x1F));
     utf8 += static_cast<char>(0x80 | (codepoint & 0x3F));
@@ -106,6 +116,10 @@ std::tuple<bool, int, TCodepoint> HandleUTF8FirstByte(uint8_t byte) {
 }
 
 std::pair<TCodepoint, const char*> ParseNextUTF8(const char* utf8, UTF8ErrorPolicy error_policy) {
+  // Fast path for ASCII, which is most of the input.
+  if (static_cast<uint8_t>(utf8[0]) < 0x80) {
+    return {static_cast<TCodepoint>(utf8[0]), utf8 + 1};
+  }
   auto [accepted, num_bytes, res] = HandleUTF8FirstByte(utf8[0]);
   if (accepted) {
     for (int i = 1; i < num_bytes; ++i) {
@@ -130,9 +144,52 @@ std::pair<TCodepoint, const char*> ParseNextUTF8(const char* utf8, UTF8ErrorPoli
   return {res, utf8 + num_bytes};
 }
 
+int64_t FindFirstNonASCII(const char* data, int64_t length) {
+  int64_t i = 0;
+#if defined(MLC_LLM_ENCODING_SSE2)
+  for (; i + 16 <= length; i += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#elif defined(MLC_LLM_ENCODING_NEON)
+  for (; i + 16 <= length; i += 16) {
+    if (vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(data + i))) >= 0x80) {
+      break;
+    }
+  }
+#endif
+  // Check eight bytes at a time for the high bits, then locate the byte.
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    if ((word & 0x8080808080808080ULL) != 0) {
+      break;
+    }
+  }
+  for (; i < length; ++i) {
+    if (static_cast<uint8_t>(data[i]) >= 0x80) {
+      return i;
+    }
+  }
+  return length;
+}
+
 std::vector<TCodepoint> ParseUTF8(const char* utf8, UTF8ErrorPolicy error_policy) {
+  int64_t length = std::strlen(utf8);
+  const char* end = utf8 + length;
   std::vector<TCodepoint> codepoints;
-  while (*utf8 != 0) {
+  codepoints.reserve(length);
+  while (utf8 != end) {
+    // Copy the ASCII run as codepoints directly.
+    int64_t num_ascii = FindFirstNonASCII(utf8, end - utf8);
+    const uint8_t* ascii_begin = reinterpret_cast<const uint8_t*>(utf8);
+    codepoints.insert(codepoints.end(), ascii_begin, ascii_begin + num_ascii);
+    utf8 += num_ascii;
+    if (utf8 == end) {
+      break;
+    }
     TCodepoint codepoint;
     std::tie(codepoint, utf8) = ParseNextUTF8(utf8, error_policy);
     if (codepoint == CharHandlingError::kInvalidUTF8) {
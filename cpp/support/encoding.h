@@ -85,6 +85,15 @@ enum class UTF8ErrorPolicy {
 std::pair<TCodepoint, const char*> ParseNextUTF8(
     const char* utf8, UTF8ErrorPolicy error_policy = UTF8ErrorPolicy::kReturnInvalid);
 
+/*!
+ * \brief Find the first byte that is not ASCII, i.e. the first byte not less than 0x80. The bytes
+ * are scanned in vectors of 16 bytes when SSE2 or NEON is available.
+ * \param data The bytes.
+ * \param length The number of bytes.
+ * \return The index of the first non-ASCII byte, or length if all the bytes are ASCII.
+ */
+int64_t FindFirstNonASCII(const char* data, int64_t length);
+
 /*!
  * \brief Parse all codepoints in a UTF-8 string.
  * \param utf8 The UTF-8 string.
@@ -0,0 +1,163 @@
+/*!
+ * \file support/json_writer.h
+ * \brief A JSON writer which appends JSON text directly to a string buffer.
+ */
+#ifndef MLC_LLM_SUPPORT_JSON_WRITER_H_
+#define MLC_LLM_SUPPORT_JSON_WRITER_H_
+
+#include <tvm/runtime/logging.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace json {
+
+/*!
+ * \brief The JSON writer, which appends the JSON text of the written values to a string buffer
+ * without building picojson values. The separators are inserted by the writer. The output is
+ * byte-identical to picojson's serialization when the object keys are written in sorted order:
+ * strings are escaped the same way and there is no whitespace.
+ */
+class JSONWriter {
+ public:
+  /*! \brief Create a writer appending to the given buffer. */
+  explicit JSONWriter(std::string* buffer) : buffer_(buffer) {}
+
+  void BeginObject() {
+    BeginValue();
+    buffer_->push_back('{');
+    scopes_.push_back(true);
+  }
+
+  void EndObject() {
+    ICHECK(!scopes_.empty() && !key_written_);
+    scopes_.pop_back();
+    buffer_->push_back('}');
+  }
+
+  void BeginArray() {
+    BeginValue();
+    buffer_->push_back('[');
+    scopes_.push_back(true);
+  }
+
+  void EndArray() {
+    ICHECK(!scopes_.empty());
+    scopes_.pop_back();
+    buffer_->push_back(']');
+  }
+
+  /*! \brief Write an object key, which must be followed by its value. */
+  void Key(const std::string& key) {
+    ICHECK(!scopes_.empty() && !key_written_);
+    WriteSeparator();
+    WriteEscapedString(key);
+    buffer_->push_back(':');
+    key_written_ = true;
+  }
+
+  void String(const std::string& value) {
+    BeginValue();
+    WriteEscapedString(value);
+  }
+
+  void Int(int64_t value) {
+    BeginValue();
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(value));
+    buffer_->append(buf, len);
+  }
+
+  void Bool(bool value) {
+    BeginValue();
+    buffer_->append(value ? "true" : "false");
+  }
+
+  void Null() {
+    BeginValue();
+    buffer_->append("null");
+  }
+
+  /*! \brief Write a value which is already serialized JSON text. */
+  void Raw(const std::string& json_text) {
+    BeginValue();
+    buffer_->append(json_text);
+  }
+
+ private:
+  void BeginValue() {
+    if (key_written_) {
+      key_written_ = false;
+    } else if (!scopes_.empty()) {
+      WriteSeparator();
+    }
+  }
+
+  void WriteSeparator() {
+    if (scopes_.back()) {
+      scopes_.back() = false;
+    } else {
+      buffer_->push_back(',');
+    }
+  }
+
+  /*! \brief Write the escaped string in the same way as picojson. */
+  void WriteEscapedString(const std::string& str) {
+    buffer_->push_back('"');
+    for (char c : str) {
+      switch (c) {
+        case '"':
+          buffer_->append("\\\"");
+          break;
+        case '\\':
+          buffer_->append("\\\\");
+          break;
+        case '/':
+          buffer_->append("\\/");
+          break;
+        case '\b':
+          buffer_->append("\\b");
+          break;
+        case '\f':
+          buffer_->append("\\f");
+          break;
+        case '\n':
+          buffer_->append("\\n");
+          break;
+        case '\r':
+          buffer_->append("\\r");
+          break;
+        case '\t':
+          buffer_->append("\\t");
+          break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+            char buf[7];
+            snprintf(buf, sizeof(buf), "\\u%04x", c & 0xff);
+            buffer_->append(buf, 6);
+          } else {
+            buffer_->push_back(c);
+          }
+          break;
+      }
+    }
+    buffer_->push_back('"');
+  }
+
+  /*! \brief The buffer to append to. */
+  std::string* buffer_;
+  /*! \brief Whether each open object or array has no element yet. */
+  std::vector<bool> scopes_;
+  /*! \brief Whether an object key is written and waiting for its value. */
+  bool key_written_ = false;
+};
+
+}  // namespace json
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_JSON_WRITER_H_
@@ -0,0 +1,90 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file support/lock_free_queue.h
+ * \brief The lock-free queue for passing data between threads.
+ */
+#ifndef MLC_LLM_SUPPORT_LOCK_FREE_QUEUE_H_
+#define MLC_LLM_SUPPORT_LOCK_FREE_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief An unbounded multi-producer single-consumer FIFO queue.
+ * \details The queue is a singly linked list with a stub node (Vyukov's MPSC queue). A push is a
+ * single atomic exchange and never blocks or retries, and a pop touches only the consumer-side
+ * end of the list, so the producers never contend with the consumer. The elements pushed by the
+ * same thread are popped in the order they are pushed, and the elements pushed by different
+ * threads are popped in the order of their exchanges.
+ *
+ * A pushed element may be invisible to the consumer for a short while when its producer is
+ * preempted between the exchange and the link. The producers which wake up the consumer after
+ * pushing should therefore check the consumer state after `Push` returns.
+ * \tparam T The element type, which must be default constructible and movable.
+ */
+template <typename T>
+class MPSCQueue {
+ public:
+  MPSCQueue() : head_(new Node()), tail_(head_.load(std::memory_order_relaxed)) {}
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  ~MPSCQueue() {
+    while (tail_ != nullptr) {
+      Node* next = tail_->next.load(std::memory_order_relaxed);
+      delete tail_;
+      tail_ = next;
+    }
+  }
+
+  /*! \brief Push an element into the queue. Thread-safe for any number of producers. */
+  void Push(T value) {
+    Node* node = new Node(std::move(value));
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  /*!
+   * \brief Pop the front element of the queue. Only the consumer thread can call this.
+   * \param value The output popped element.
+   * \return Whether an element is popped.
+   */
+  bool TryPop(T* value) {
+    Node* next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    // The popped node becomes the new stub node.
+    *value = std::move(next->value);
+    delete tail_;
+    tail_ = next;
+    return true;
+  }
+
+  /*! \brief Check if the queue has no visible element. Only the consumer thread can call this. */
+  bool Empty() const { return tail_->next.load(std::memory_order_acquire) == nullptr; }
+
+ private:
+  /*! \brief The list node. */
+  struct Node {
+    Node() = default;
+    explicit Node(T value) : value(std::move(value)) {}
+
+    T value;
+    std::atomic<Node*> next = nullptr;
+  };
+
+  /*! \brief The last pushed node, shared by the producers. */
+  alignas(64) std::atomic<Node*> head_;
+  /*! \brief The stub node before the front element, owned by the consumer. */
+  alignas(64) Node* tail_;
+};
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_LOCK_FREE_QUEUE_H_
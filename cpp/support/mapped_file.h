@@ -0,0 +1,127 @@
+/*!
+ * Copyright (c) 2024 by Contributors
+ * \file support/mapped_file.h
+ * \brief The read-only memory-mapped file.
+ */
+#ifndef MLC_LLM_SUPPORT_MAPPED_FILE_H_
+#define MLC_LLM_SUPPORT_MAPPED_FILE_H_
+
+#include <tvm/runtime/logging.h>
+
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "result.h"
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief A read-only view of a file. The file is memory mapped on POSIX systems, so that the
+ * contents are read from the page cache without being copied to the heap, and the host memory
+ * of the pages can be reclaimed by the kernel. On the other systems, the file is read into a
+ * buffer.
+ */
+class MappedFile {
+ public:
+  /*! \brief Open and map the file of the given path. */
+  static Result<std::unique_ptr<MappedFile>> Open(const std::string& path) {
+    using TResult = Result<std::unique_ptr<MappedFile>>;
+    std::unique_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+    std::ifstream fs(path, std::ios::in | std::ios::binary);
+    if (fs.fail()) {
+      return TResult::Error("Cannot open " + path);
+    }
+    fs.seekg(0, std::ios::end);
+    file->buffer_.resize(static_cast<size_t>(fs.tellg()));
+    fs.seekg(0, std::ios::beg);
+    fs.read(file->buffer_.data(), file->buffer_.size());
+    file->data_ = file->buffer_.data();
+    file->size_ = file->buffer_.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return TResult::Error("Cannot open " + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      close(fd);
+      return TResult::Error("Cannot stat " + path);
+    }
+    file->size_ = static_cast<size_t>(file_stat.st_size);
+    if (file->size_ > 0) {
+      void* data = mmap(nullptr, file->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        return TResult::Error("Cannot map " + path);
+      }
+      // The files are mostly read from the beginning to the end.
+      madvise(data, file->size_, MADV_SEQUENTIAL);
+      file->data_ = static_cast<const char*>(data);
+    }
+    // The mapping keeps the file referenced after the descriptor is closed.
+    close(fd);
+#endif
+    return TResult::Ok(std::move(file));
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (data_ != nullptr) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /*! \brief The contents of the file. */
+  const char* data() const { return data_; }
+
+  /*! \brief The size of the file in bytes. */
+  size_t size() const { return size_; }
+
+  /*!
+   * \brief Read the whole file into the page cache and fault the pages in, so that the later
+   * accesses of the contents do not wait for the disk.
+   */
+  void Prefetch() const {
+#ifndef _WIN32
+    if (data_ == nullptr) return;
+    madvise(const_cast<char*>(data_), size_, MADV_WILLNEED);
+    long page_size = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for (size_t offset = 0; offset < size_; offset += page_size) {
+      sink = sink + data_[offset];
+    }
+#endif
+  }
+
+ private:
+  MappedFile() = default;
+
+  /*! \brief The contents of the file. */
+  const char* data_ = nullptr;
+  /*! \brief The size of the file in bytes. */
+  size_t size_ = 0;
+#ifdef _WIN32
+  /*! \brief The buffer holding the file contents. */
+  std::string buffer_;
+#endif
+};
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_MAPPED_FILE_H_
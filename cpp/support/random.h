@@ -7,6 +7,7 @@
 #ifndef MLC_LLM_SUPPORT_RANDOM_H_
 #define MLC_LLM_SUPPORT_RANDOM_H_
 
+#include <cstdint>
 #include <random>
 
 namespace mlc {
@@ -17,9 +18,10 @@ class RandomGenerator {
  private:
   std::mt19937 gen;
   std::uniform_real_distribution<> dis;
+  int seed_;
 
  public:
-  RandomGenerator(int seed = std::random_device{}()) : gen(seed), dis(0.0, 1.0) {}
+  RandomGenerator(int seed = std::random_device{}()) : gen(seed), dis(0.0, 1.0), seed_(seed) {}
 
   static RandomGenerator& GetInstance(int seed = std::random_device{}()) {
     static RandomGenerator instance(seed);
@@ -28,7 +30,22 @@ class RandomGenerator {
 
   double GetRandomNumber() { return dis(gen); }
 
-  void SetSeed(int seed) { gen.seed(seed); }
+  void SetSeed(int seed) {
+    gen.seed(seed);
+    seed_ = seed;
+  }
+
+  /*!
+   * \brief Restart the generator at the stream of the given offset from the seed, so that the
+   * numbers drawn after the restart only depend on the seed and the offset, not on the numbers
+   * drawn before.
+   */
+  void ResetStream(int64_t offset) {
+    std::seed_seq seq{static_cast<uint32_t>(seed_), static_cast<uint32_t>(offset),
+                      static_cast<uint32_t>(static_cast<uint64_t>(offset) >> 32)};
+    gen.seed(seq);
+    dis.reset();
+  }
 };
 
 }  // namespace llm
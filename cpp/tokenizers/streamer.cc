@@ -8,8 +8,11 @@
 #include <tvm/runtime/registry.h>
 
 #include <algorithm>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
+#include "../support/encoding.h"
 #include "tokenizers.h"
 
 namespace mlc {
@@ -19,7 +22,8 @@ namespace llm {
 
 TVM_REGISTER_OBJECT_TYPE(TextStreamerObj);
 
-TextStreamerObj::TextStreamerObj(Tokenizer tokenizer) : tokenizer_(std::move(tokenizer)) {}
+TextStreamerObj::TextStreamerObj(Tokenizer tokenizer)
+    : tokenizer_(std::move(tokenizer)), token_table_(tokenizer_->PostProcessedTokenTable()) {}
 
 TextStreamer::TextStreamer(Tokenizer tokenizer) {
   data_ = make_object<TextStreamerObj>(std::move(tokenizer));
@@ -32,109 +36,75 @@ std::string TextStreamerObj::Put(const std::vector<int32_t>& delta_tokens) {
   }
 
   std::string ret;
-  // We process delta tokens one by one.
   for (int32_t delta_token : delta_tokens) {
-    // push to pending tokens.
-    pending_tokens_.push_back(delta_token);
-
-    // all_tokens = prefix_tokens_ + pending_tokens_
-    std::vector<int32_t> all_tokens;
-    all_tokens.reserve(prefix_tokens_.size() + pending_tokens_.size());
-    all_tokens.insert(all_tokens.end(), prefix_tokens_.begin(), prefix_tokens_.end());
-    all_tokens.insert(all_tokens.end(), pending_tokens_.begin(), pending_tokens_.end());
-
-    // Decode prefix_tokens_ and all_tokens.
-    std::string prefix_str = prefix_tokens_.empty() ? "" : tokenizer_->Decode(prefix_tokens_);
-    std::string full_str = tokenizer_->Decode(all_tokens);
-
-    std::string validated_str;
-    std::vector<int32_t> new_pending_tokens;
-    if (full_str.compare(0, prefix_str.length(), prefix_str) == 0) {
-      // Case 1. prefix_str is a prefix of `full_str`.
-      // validated_str = full_str[len(prefix_str):]
-      validated_str = full_str.substr(prefix_str.length());
-      // Pop UTF-8 replacement character from the back of pending tokens.
-      // - The UTF-8 replacement character take 3 chars.
-      // - A valid UTF-8 has 4 chars at most.
-      //   So there will be at most 3 tokens popped.
-      while (!pending_tokens_.empty() &&                         //
-             static_cast<int>(new_pending_tokens.size()) < 3 &&  //
-             validated_str.length() >= 3 &&                      //
-             validated_str.compare(validated_str.length() - 3, /*n=*/3, kReplacementCharacter) ==
-                 0) {
-        new_pending_tokens.push_back(pending_tokens_.back());
-        pending_tokens_.pop_back();
-        validated_str = validated_str.substr(0, validated_str.length() - 3);
-      }
-    } else {
-      // Case 2. prefix_str is not a prefix of `full_str`.
-      // Pop pending tokens from the back.
-      // - Pop until prefix_str is indeed a prefix of full_str.
-      // - A valid UTF-8 has 4 chars at most.
-      //   So there will be at most 3 tokens popped.
-      // - If there are no more than 3 pending tokens, skip popping.
-      //   This is because it is impossible to make full_str contain
-      //   prefix_str without popping all the pending tokens.
-      if (static_cast<int>(pending_tokens_.size()) < 3) {
-        continue;
-      }
-      bool get_valid_full_str = false;
-      while (!pending_tokens_.empty() && static_cast<int>(new_pending_tokens.size()) < 3) {
-        new_pending_tokens.push_back(pending_tokens_.back());
-        pending_tokens_.pop_back();
-        all_tokens.pop_back();
-        full_str = tokenizer_->Decode(all_tokens);
-        if (full_str.compare(0, prefix_str.length(), prefix_str) == 0) {
-          get_valid_full_str = true;
-          break;
+    // Tokens out of the token table (e.g. the padded vocab) decode to nothing.
+    if (delta_token < 0 || delta_token >= static_cast<int>(token_table_.size())) {
+      continue;
+    }
+    const std::string& token_bytes = token_table_[delta_token];
+    if (is_first_token_) {
+      is_first_token_ = false;
+      // Some tokenizers strip the leading space of the decoded text. Since only the first token
+      // is affected, it is detected by decoding the first token alone.
+      if (!token_bytes.empty() && token_bytes[0] == ' ') {
+        std::string decoded = tokenizer_->Decode({delta_token});
+        if (decoded.empty() || decoded[0] != ' ') {
+          pending_bytes_.append(token_bytes, 1, std::string::npos);
+          continue;
         }
       }
-
-      if (get_valid_full_str) {
-        // We find a full_str which starts from prefix_str.
-        // So we return the sliced full string without the prefix.
-        validated_str = full_str.substr(prefix_str.length());
-      } else {
-        // We cannot find a full_str which starts from prefix_str by
-        // popping 3 tokens.
-        // In this case, the remaining pending tokens are invalid UTF-8
-        // characters already, so we return the decoded pending tokens.
-        validated_str = tokenizer_->Decode(pending_tokens_);
-      }
     }
+    pending_bytes_ += token_bytes;
+  }
+  FlushValidatedBytes(&ret);
+  return ret;
+}
 
-    if (!pending_tokens_.empty()) {
-      // Set the new prefix.
-      prefix_tokens_ = pending_tokens_;
+void TextStreamerObj::FlushValidatedBytes(std::string* output) {
+  int num_bytes = pending_bytes_.size();
+  int pos = 0;
+  while (pos < num_bytes) {
+    // Move the ASCII run at once.
+    int num_ascii = FindFirstNonASCII(pending_bytes_.data() + pos, num_bytes - pos);
+    output->append(pending_bytes_, pos, num_ascii);
+    pos += num_ascii;
+    if (pos == num_bytes) {
+      break;
+    }
+    auto [accepted, char_num_bytes, codepoint] =
+        HandleUTF8FirstByte(static_cast<uint8_t>(pending_bytes_[pos]));
+    if (!accepted) {
+      *output += kReplacementCharacter;
+      ++pos;
+      continue;
+    }
+    // Count the continuation bytes available for the character.
+    int num_continuations = 0;
+    while (num_continuations < char_num_bytes - 1 && pos + 1 + num_continuations < num_bytes &&
+           (static_cast<uint8_t>(pending_bytes_[pos + 1 + num_continuations]) & 0xC0) == 0x80) {
+      ++num_continuations;
+    }
+    if (num_continuations == char_num_bytes - 1) {
+      output->append(pending_bytes_, pos, char_num_bytes);
+      pos += char_num_bytes;
+    } else if (pos + 1 + num_continuations == num_bytes) {
+      // The character may be completed by the following tokens.
+      break;
+    } else {
+      // The character is broken by a non-continuation byte.
+      *output += kReplacementCharacter;
+      pos += 1 + num_continuations;
     }
-    std::reverse(new_pending_tokens.begin(), new_pending_tokens.end());
-    pending_tokens_ = new_pending_tokens;
-    ret += validated_str;
   }
-  return ret;
+  pending_bytes_.erase(0, pos);
 }
 
 std::string TextStreamerObj::Finish() {
-  // all_tokens = prefix_tokens_ + pending_tokens_
-  std::vector<int32_t> all_tokens;
-  all_tokens.reserve(prefix_tokens_.size() + pending_tokens_.size());
-  all_tokens.insert(all_tokens.end(), prefix_tokens_.begin(), prefix_tokens_.end());
-  all_tokens.insert(all_tokens.end(), pending_tokens_.begin(), pending_tokens_.end());
-
-  // Decode prefix_tokens_ and all_tokens.
-  std::string prefix_str = prefix_tokens_.empty() ? "" : tokenizer_->Decode(prefix_tokens_);
-  std::string full_str = all_tokens.empty() ? "" : tokenizer_->Decode(all_tokens);
-
   finished_ = true;
-  if (full_str.compare(0, prefix_str.length(), prefix_str) == 0) {
-    // Case 1. prefix_str is a prefix of `full_str`.
-    return full_str.substr(prefix_str.length());
-  } else {
-    // Case 2. prefix_str is not a prefix of `full_str`.
-    // In this case, the remaining pending tokens are invalid UTF-8
-    // characters already, so we return the decoded pending tokens.
-    return tokenizer_->Decode(pending_tokens_);
-  }
+  // The remaining bytes are an incomplete UTF-8 character.
+  std::string ret = pending_bytes_.empty() ? "" : kReplacementCharacter;
+  pending_bytes_.clear();
+  return ret;
 }
 
 TVM_REGISTER_GLOBAL("mlc.tokenizers.TextStreamer").set_body_typed([](Tokenizer tokenizer) {
@@ -153,32 +123,123 @@ TVM_REGISTER_GLOBAL("mlc.tokenizers.TextStreamerFinish")
 
 TVM_REGISTER_OBJECT_TYPE(StopStrHandlerObj);
 
-/*! \brief Create the KMP partial match table for the input string. */
-inline std::vector<int> CreatePartialMatchTable(const String& str) {
-  int length = str.length();
-  std::vector<int> partial_match_table = {-1};
-  partial_match_table.reserve(length);
-  for (int i = 1; i < length; ++i) {
-    int ptr = partial_match_table[i - 1];
-    while (ptr != -1 && str.at(ptr) != str.at(i - 1)) {
-      ptr = partial_match_table[ptr];
+class StopStrAutomaton {
+ public:
+  /*!
+   * \brief Get the automaton of the stop strings. The automata are cached by the stop strings,
+   * and an automaton is freed when no handler uses it.
+   */
+  static std::shared_ptr<const StopStrAutomaton> Get(const Array<String>& stop_strs);
+
+  explicit StopStrAutomaton(const Array<String>& stop_strs);
+
+  /*! \brief Get the next state after the input byte. */
+  int32_t Transit(int32_t state, uint8_t byte) const {
+    return transitions_[state * kNumBytes + byte];
+  }
+
+  /*! \brief The length of the string of the state. */
+  int32_t Depth(int32_t state) const { return depths_[state]; }
+
+  /*!
+   * \brief The length of the longest stop string that is a suffix of the string of the state.
+   * Return 0 if no stop string is matched.
+   */
+  int32_t MatchLength(int32_t state) const { return match_lengths_[state]; }
+
+ private:
+  static constexpr int kNumBytes = 256;
+
+  /*! \brief The transitions of all states, flattened as state * kNumBytes + byte. */
+  std::vector<int32_t> transitions_;
+  /*! \brief The string length of each state. */
+  std::vector<int32_t> depths_;
+  /*! \brief The longest matched stop string length of each state. */
+  std::vector<int32_t> match_lengths_;
+};
+
+std::shared_ptr<const StopStrAutomaton> StopStrAutomaton::Get(const Array<String>& stop_strs) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<const StopStrAutomaton>> cache;
+
+  std::string key;
+  for (const String& stop_str : stop_strs) {
+    key += std::to_string(stop_str.size()) + ":" + stop_str.operator std::string();
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = cache.find(key);
+  if (it != cache.end()) {
+    if (std::shared_ptr<const StopStrAutomaton> automaton = it->second.lock()) {
+      return automaton;
+    }
+  }
+  // Drop the expired entries before inserting a new one.
+  for (auto iter = cache.begin(); iter != cache.end();) {
+    iter = iter->second.expired() ? cache.erase(iter) : std::next(iter);
+  }
+  auto automaton = std::make_shared<const StopStrAutomaton>(stop_strs);
+  cache[key] = automaton;
+  return automaton;
+}
+
+StopStrAutomaton::StopStrAutomaton(const Array<String>& stop_strs) {
+  // Step 1. Build the trie of the stop strings. The missing transitions are -1.
+  transitions_.assign(kNumBytes, -1);
+  depths_.push_back(0);
+  match_lengths_.push_back(0);
+  for (const String& stop_str : stop_strs) {
+    int32_t state = 0;
+    for (char ch : stop_str) {
+      int idx = state * kNumBytes + static_cast<uint8_t>(ch);
+      if (transitions_[idx] == -1) {
+        transitions_[idx] = depths_.size();
+        transitions_.resize(transitions_.size() + kNumBytes, -1);
+        depths_.push_back(depths_[state] + 1);
+        match_lengths_.push_back(0);
+      }
+      state = transitions_[idx];
+    }
+    match_lengths_[state] = stop_str.size();
+  }
+
+  // Step 2. Fill in the missing transitions through the failure links in BFS order, so that
+  // every state has a transition for every byte.
+  std::vector<int32_t> fail_links(depths_.size(), 0);
+  std::vector<int32_t> queue;
+  queue.reserve(depths_.size());
+  for (int byte = 0; byte < kNumBytes; ++byte) {
+    int32_t& next = transitions_[byte];
+    if (next == -1) {
+      next = 0;
+    } else {
+      queue.push_back(next);
+    }
+  }
+  for (int i = 0; i < static_cast<int>(queue.size()); ++i) {
+    int32_t state = queue[i];
+    int32_t fail_state = fail_links[state];
+    // The stop strings matched at the failure state are also matched at this state.
+    match_lengths_[state] = std::max(match_lengths_[state], match_lengths_[fail_state]);
+    for (int byte = 0; byte < kNumBytes; ++byte) {
+      int32_t& next = transitions_[state * kNumBytes + byte];
+      if (next == -1) {
+        next = transitions_[fail_state * kNumBytes + byte];
+      } else {
+        fail_links[next] = transitions_[fail_state * kNumBytes + byte];
+        queue.push_back(next);
+      }
     }
-    partial_match_table.push_back(ptr + 1);
   }
-  return partial_match_table;
 }
 
 StopStrHandlerObj::StopStrHandlerObj(Array<String> stop_strs,
                                      const std::vector<std::string>& token_table)
     : stop_strs_(std::move(stop_strs)), token_table_(token_table) {
-  int num_stop_strs = stop_strs_.size();
-  cur_match_lengths_.resize(num_stop_strs, 0);
-
-  // Create the KMP partial match table for each stop string.
-  partial_match_tables_.reserve(num_stop_strs);
   for (const String& stop_str : stop_strs_) {
     CHECK(!stop_str.empty()) << "Stop string cannot be empty.";
-    partial_match_tables_.push_back(CreatePartialMatchTable(stop_str));
+  }
+  if (!stop_strs_.empty()) {
+    automaton_ = StopStrAutomaton::Get(stop_strs_);
   }
 }
 
@@ -199,44 +260,25 @@ void StopStrHandlerObj::Put(int32_t token_id, std::vector<int64_t>* return_token
   pending_token_lengths_.push_back(token.length());
 
   for (char ch : token) {
-    // The earliest starting point of stop string.
-    int stop_starting_pos = std::numeric_limits<int>::max();
-    // The cutoff length that can be safely return.
-    int cutoff_length = std::numeric_limits<int>::max();
-    // The maximum matched length.
-    int max_match_length = 0;
-
-    for (int str_id = 0; str_id < static_cast<int>(stop_strs_.size()); ++str_id) {
-      // - Run one step of KMP algorithm.
-      const std::vector<int>& partial_match_table = partial_match_tables_[str_id];
-      int& cur_match_length = cur_match_lengths_[str_id];
-      while (cur_match_length != -1 && ch != stop_strs_[str_id].at(cur_match_length)) {
-        cur_match_length = partial_match_table[cur_match_length];
-      }
-      ++cur_match_length;
-
-      // Case 1. The stop string is matched.
-      if (cur_match_length == stop_strs_[str_id].length()) {
-        stop_triggered_ = true;
-        stop_starting_pos =
-            std::min(stop_starting_pos,
-                     pending_string_len_ + 1 - static_cast<int>(stop_strs_[str_id].length()));
-        continue;
-      }
+    // - Run one step of the automaton.
+    cur_state_ = automaton_->Transit(cur_state_, static_cast<uint8_t>(ch));
+    int match_length = automaton_->MatchLength(cur_state_);
+    int cur_match_length = automaton_->Depth(cur_state_);
+    ICHECK_GE(pending_string_len_ + 1, cur_match_length);
 
-      // Case 2. The stop string is not matched.
-      // - Get the cutoff length that can be safely return.
-      ICHECK_GE(pending_string_len_ + 1, cur_match_length);
-      cutoff_length = std::min(cutoff_length, pending_string_len_ + 1 - cur_match_length);
-      // - Get the updated pending string length.
-      max_match_length = std::max(max_match_length, cur_match_length);
+    // The cutoff length that can be safely return.
+    int cutoff_length;
+    if (match_length > 0) {
+      // Case 1. A stop string is matched. The earliest starting point of the matched stop
+      // strings is of the longest one.
+      stop_triggered_ = true;
+      cutoff_length = pending_string_len_ + 1 - match_length;
+    } else {
+      // Case 2. No stop string is matched. The longest partial match is kept pending.
+      cutoff_length = pending_string_len_ + 1 - cur_match_length;
     }
 
     // Collect the token ids that can be safely cut off and returned.
-    if (stop_triggered_) {
-      cutoff_length = stop_starting_pos;
-    }
-    ICHECK_NE(cutoff_length, std::numeric_limits<int>::max());
     ICHECK_GE(cutoff_length, 0);
     int cum_length = 0;
     while (!pending_token_ids_.empty() &&
@@ -252,7 +294,7 @@ void StopStrHandlerObj::Put(int32_t token_id, std::vector<int64_t>* return_token
 
     ICHECK_LE(cum_length, cutoff_length);
     // `cum_length` is the prefix length what we actually cut off.
-    pending_string_len_ = (cutoff_length - cum_length) + max_match_length;
+    pending_string_len_ = (cutoff_length - cum_length) + cur_match_length;
   }
 }
 
@@ -11,6 +11,8 @@
 #include <tvm/runtime/container/string.h>
 #include <tvm/runtime/object.h>
 
+#include <memory>
+
 #include "tokenizers.h"
 
 namespace mlc {
@@ -23,6 +25,9 @@ using namespace tvm::runtime;
 /*!
  * \brief The class that streams back validated utf-8 text strings
  * that generated by tokenizer.
+ * \details The streamer decodes incrementally: the bytes of each new token are looked up in the
+ * post-processed token table and appended to the pending bytes, and only the complete UTF-8
+ * characters are returned. No prefix tokens are decoded again.
  */
 class TextStreamerObj : public Object {
  public:
@@ -30,9 +35,9 @@ class TextStreamerObj : public Object {
 
   /*!
    * \brief Put new delta tokens into the streamer, and get the UTF-8-valid
-   * delta string. The text streamer may hold some of the input delta tokens
-   * which cannot decode into valid UTF-8 strings. The returned string
-   * is always guaranteed to be UTF-8 valid.
+   * delta string. The text streamer may hold the trailing bytes of the input
+   * delta tokens which do not form a complete UTF-8 character yet. The returned
+   * string is always guaranteed to be UTF-8 valid.
    * \param delta_tokens The new tokens to put into the streamer.
    * \return The decoded delta string after putting the input new tokens.
    */
@@ -50,9 +55,19 @@ class TextStreamerObj : public Object {
   TVM_DECLARE_BASE_OBJECT_INFO(TextStreamerObj, Object);
 
  private:
+  /*!
+   * \brief Move the complete UTF-8 characters at the front of the pending bytes to the output.
+   * An invalid byte sequence is replaced by the replacement character, as in decoding.
+   */
+  void FlushValidatedBytes(std::string* output);
+
   Tokenizer tokenizer_;
-  std::vector<int32_t> prefix_tokens_;
-  std::vector<int32_t> pending_tokens_;
+  /*! \brief The post-processed token table of the tokenizer for token byte lookup. */
+  const std::vector<std::string>& token_table_;
+  /*! \brief The bytes that do not form a complete UTF-8 character yet. */
+  std::string pending_bytes_;
+  /*! \brief Whether no token has been put into the streamer. */
+  bool is_first_token_ = true;
   bool finished_ = false;
 };
 
@@ -70,10 +85,18 @@ class TextStreamer : public ObjectRef {
 
 /****************** StopStrHandler ******************/
 
+/*!
+ * \brief The Aho-Corasick automaton of a set of stop strings. The automaton is shared by the
+ * stop string handlers with the same stop strings.
+ */
+class StopStrAutomaton;
+
 /*!
  * \brief The stop string handler in MLC LLM, which takes input delta tokens
  * one at a time, and return the output delta token before stopping due to
  * stop strings.
+ * \details All stop strings are matched together by one Aho-Corasick automaton, so the cost of
+ * each input byte does not depend on the number of stop strings.
  */
 class StopStrHandlerObj : public Object {
  public:
@@ -106,13 +129,11 @@ class StopStrHandlerObj : public Object {
  private:
   /*! \brief The stop strings. */
   Array<String> stop_strs_;
-  /*! \brief The partial match table for each stop string in the KMP algorithm. */
-  std::vector<std::vector<int>> partial_match_tables_;
+  /*! \brief The automaton matching all stop strings. */
+  std::shared_ptr<const StopStrAutomaton> automaton_;
   /*! \brief The tokenizer token table for token id lookup. */
   const std::vector<std::string>& token_table_;
 
-  /************ Global states across all stop strings. ************/
-
   /*! \brief The globally pending string length. */
   int pending_string_len_ = 0;
   /*! \brief The globally pending token ids. */
@@ -120,12 +141,12 @@ class StopStrHandlerObj : public Object {
   /*! \brief The token string length of each pending token id. */
   std::vector<int> pending_token_lengths_;
   /*! \brief A boolean flag indicating if stop has been triggered. */
-  bool stop_triggered_;
-
-  /************ Per-stop-string states. ************/
-
-  /*! \brief The current match position of the pending string to each stop string. */
-  std::vector<int> cur_match_lengths_;
+  bool stop_triggered_ = false;
+  /*!
+   * \brief The current state of the automaton, which stands for the longest suffix of the
+   * input string that is a prefix of some stop string.
+   */
+  int32_t cur_state_ = 0;
 };
 
 /*!
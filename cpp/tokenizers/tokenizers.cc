@@ -9,8 +9,10 @@
 #include <tokenizers_cpp.h>
 #include <tvm/runtime/logging.h>
 #include <tvm/runtime/registry.h>
+#include <tvm/runtime/threading_backend.h>
 
 #include <array>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <string>
@@ -68,13 +70,57 @@ Tokenizer::Tokenizer(std::unique_ptr<tokenizers::Tokenizer> tokenizer, Tokenizer
 }
 
 std::vector<int32_t> TokenizerObj::Encode(const std::string& text) const {
-  return tokenizer->Encode(text);
+  if (static_cast<int>(text.size()) < kMinCachedTextLength) {
+    std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+    return tokenizer->Encode(text);
+  }
+  size_t hash = std::hash<std::string_view>()(text);
+  {
+    std::lock_guard<std::mutex> lock(encode_cache_mutex_);
+    auto it = encode_cache_index_.find(hash);
+    if (it != encode_cache_index_.end() && it->second->text == text) {
+      encode_cache_entries_.splice(encode_cache_entries_.begin(), encode_cache_entries_,
+                                   it->second);
+      return it->second->token_ids;
+    }
+  }
+
+  std::vector<int32_t> token_ids;
+  {
+    std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+    token_ids = tokenizer->Encode(text);
+  }
+  int64_t entry_bytes = text.size() + token_ids.size() * sizeof(int32_t);
+  if (entry_bytes > kEncodeCacheCapacityBytes) {
+    return token_ids;
+  }
+  std::lock_guard<std::mutex> lock(encode_cache_mutex_);
+  // Replace the entry of the same hash, which is either the same text inserted by another
+  // thread or a hash collision.
+  auto it = encode_cache_index_.find(hash);
+  if (it != encode_cache_index_.end()) {
+    encode_cache_bytes_ -= it->second->text.size() + it->second->token_ids.size() * sizeof(int32_t);
+    encode_cache_entries_.erase(it->second);
+    encode_cache_index_.erase(it);
+  }
+  // Evict the least recently used entries.
+  while (encode_cache_bytes_ + entry_bytes > kEncodeCacheCapacityBytes) {
+    const EncodeCacheEntry& lru_entry = encode_cache_entries_.back();
+    encode_cache_bytes_ -= lru_entry.text.size() + lru_entry.token_ids.size() * sizeof(int32_t);
+    encode_cache_index_.erase(std::hash<std::string_view>()(lru_entry.text));
+    encode_cache_entries_.pop_back();
+  }
+  encode_cache_entries_.push_front({text, token_ids});
+  encode_cache_index_[hash] = encode_cache_entries_.begin();
+  encode_cache_bytes_ += entry_bytes;
+  return token_ids;
 }
 
 std::vector<int32_t> TokenizerObj::EncodeNoPrependSpace(const std::string& text) const {
   // TODO(yixin): now this only supports tokenizers with tokenizer.json
   // other tokenizers should be supported.
   static const constexpr char* kPaddingPrefix = "\x01";
+  std::lock_guard<std::mutex> lock(tokenizer_mutex_);
   if (!info_->prepend_space_in_encode) {
     return tokenizer->Encode(text);
   }
@@ -86,14 +132,25 @@ std::vector<int32_t> TokenizerObj::EncodeNoPrependSpace(const std::string& text)
 }
 
 std::vector<std::vector<int32_t>> TokenizerObj::EncodeBatch(const Array<String>& texts) const {
-  std::vector<std::string> texts_vec;
-  for (const String& text : texts) {
-    texts_vec.push_back(text);
+  int num_texts = texts.size();
+  if (num_texts <= 1 || tvm::runtime::threading::MaxConcurrency() <= 1) {
+    std::vector<std::string> texts_vec;
+    for (const String& text : texts) {
+      texts_vec.push_back(text);
+    }
+    std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+    return tokenizer->EncodeBatch(texts_vec);
   }
-  return tokenizer->EncodeBatch(texts_vec);
+  // The encoding cache is looked up in parallel, while the calls into the tokenizer are
+  // serialized by Encode.
+  std::vector<std::vector<int32_t>> results(num_texts);
+  tvm::runtime::parallel_for_with_threading_backend(
+      [&](int i) { results[i] = Encode(texts[i]); }, 0, num_texts);
+  return results;
 }
 
 std::string TokenizerObj::Decode(const std::vector<int32_t>& token_ids) const {
+  std::lock_guard<std::mutex> lock(tokenizer_mutex_);
   return tokenizer->Decode(token_ids);
 }
 
@@ -126,36 +183,64 @@ const DynamicBitset& TokenizerObj::GetPrefixTokenMask() {
   return prefix_token_mask_;
 }
 
-size_t TokenizerObj::GetVocabSize() const { return tokenizer->GetVocabSize(); }
+size_t TokenizerObj::GetVocabSize() const {
+  std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+  return tokenizer->GetVocabSize();
+}
 
 std::string TokenizerObj::IdToToken(int32_t token_id) const {
+  std::lock_guard<std::mutex> lock(tokenizer_mutex_);
   return tokenizer->IdToToken(token_id);
 }
 
 int32_t TokenizerObj::TokenToId(const std::string& token) const {
+  std::lock_guard<std::mutex> lock(tokenizer_mutex_);
   return tokenizer->TokenToId(token);
 }
 
+/*! \brief The FNV-1a hash of the tokenizer blob, which is stable across processes and builds. */
+uint64_t FingerprintTokenizerBlob(const std::string& blob) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : blob) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
 Tokenizer Tokenizer::FromPath(const String& _path, std::optional<TokenizerInfo> info) {
-  TokenizerInfo info_value = info.value_or(DetectTokenizerInfo(_path));
+  // Only detect the tokenizer info when it is not given, as the detection parses the tokenizer.
+  TokenizerInfo info_value = info.has_value() ? info.value() : DetectTokenizerInfo(_path);
   std::filesystem::path path(_path.operator std::string());
   std::filesystem::path sentencepiece;
   std::filesystem::path huggingface;
   std::filesystem::path rwkvworld;
+  std::filesystem::path token_table;
   CHECK(std::filesystem::exists(path)) << "Cannot find tokenizer via path: " << _path;
   if (std::filesystem::is_directory(path)) {
     sentencepiece = path / "tokenizer.model";
     huggingface = path / "tokenizer.json";
     rwkvworld = path / "tokenizer_model";
+    token_table = path / kTokenTableFileName;
   } else {
     sentencepiece = path.parent_path() / "tokenizer.model";
     huggingface = path.parent_path() / "tokenizer.json";
     rwkvworld = path.parent_path() / "tokenizer_model";
+    token_table = path.parent_path() / kTokenTableFileName;
   }
+  // The tokenizer blob is fingerprinted to validate the precompiled token table against it.
+  auto f_create_tokenizer = [&](std::unique_ptr<tokenizers::Tokenizer> tokenizer,
+                                const std::string& blob) {
+    Tokenizer result(std::move(tokenizer), info_value);
+    result->tokenizer_fingerprint_ = FingerprintTokenizerBlob(blob);
+    if (std::filesystem::exists(token_table)) {
+      result->token_table_path_ = token_table.string();
+    }
+    return result;
+  };
   if (std::filesystem::exists(huggingface)) {
     // Check HuggingFace
-    return Tokenizer(tokenizers::Tokenizer::FromBlobJSON(LoadBytesFromFile(huggingface.string())),
-                     info_value);
+    std::string blob = LoadBytesFromFile(huggingface.string());
+    return f_create_tokenizer(tokenizers::Tokenizer::FromBlobJSON(blob), blob);
   }
   if (std::filesystem::exists(sentencepiece)) {
     // Check SentencePiece
@@ -165,9 +250,8 @@ Tokenizer Tokenizer::FromPath(const String& _path, std::optional<TokenizerInfo>
         << "since currently, files like `added_tokens.json`, `tokenizer_config.json` are ignored.\n"
         << "Consider converting `tokenizer.model` to `tokenizer.json` by compiling the model "
         << "with MLC again, or see if MLC's huggingface provides this file.";
-    return Tokenizer(
-        tokenizers::Tokenizer::FromBlobSentencePiece(LoadBytesFromFile(sentencepiece.string())),
-        info_value);
+    std::string blob = LoadBytesFromFile(sentencepiece.string());
+    return f_create_tokenizer(tokenizers::Tokenizer::FromBlobSentencePiece(blob), blob);
   }
   {
     // Check ByteLevelBPE
@@ -180,13 +264,15 @@ Tokenizer Tokenizer::FromPath(const String& _path, std::optional<TokenizerInfo>
       std::string vocab = LoadBytesFromFile(vocab_path.string());
       std::string merges = LoadBytesFromFile(merges_path.string());
       std::string added_tokens = LoadBytesFromFile(added_tokens_path.string());
-      return Tokenizer(tokenizers::Tokenizer::FromBlobByteLevelBPE(vocab, merges, added_tokens),
-                       info_value);
+      return f_create_tokenizer(
+          tokenizers::Tokenizer::FromBlobByteLevelBPE(vocab, merges, added_tokens),
+          vocab + merges + added_tokens);
     }
   }
   if (std::filesystem::exists(rwkvworld)) {
     // Check RWKV
-    return Tokenizer(tokenizers::Tokenizer::FromBlobRWKVWorld(rwkvworld.string()), info_value);
+    return f_create_tokenizer(tokenizers::Tokenizer::FromBlobRWKVWorld(rwkvworld.string()),
+                              LoadBytesFromFile(rwkvworld.string()));
   }
   LOG(FATAL) << "Cannot find any tokenizer under: " << _path;
 }
@@ -439,20 +525,117 @@ std::vector<std::string> Tokenizer::PostProcessTokenTable(
 }
 
 #ifndef COMPILE_MLC_WASM_RUNTIME
+/*!
+ * \brief The precompiled token table file stores the post-processed token table in one buffer:
+ * - the magic string "MLCTOKTB" and the format version (uint32),
+ * - the fingerprint (uint64) of the tokenizer file the table is built from,
+ * - the length (uint32) and the string of the post-processing method,
+ * - the number of tokens N (uint32), the N + 1 offsets (uint32) of the tokens in the token buffer,
+ * - and the token buffer.
+ * The integers are stored in the native byte order.
+ */
+constexpr const char* kTokenTableMagic = "MLCTOKTB";
+constexpr uint32_t kTokenTableVersion = 2;
+
+/*!
+ * \brief Load the precompiled token table file.
+ * \return Whether the file is valid and matches the tokenizer fingerprint, the vocab size and the
+ * post-processing method.
+ */
+bool LoadTokenTable(const std::string& path, uint64_t tokenizer_fingerprint, int vocab_size,
+                    const std::string& token_postproc_method,
+                    std::vector<std::string>* token_table) {
+  std::string buffer = LoadBytesFromFile(path);
+  size_t pos = 0;
+  auto f_read_uint32 = [&](uint32_t* value) {
+    if (pos + sizeof(uint32_t) > buffer.size()) return false;
+    std::memcpy(value, buffer.data() + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+    return true;
+  };
+  size_t magic_len = std::strlen(kTokenTableMagic);
+  if (buffer.compare(0, magic_len, kTokenTableMagic) != 0) return false;
+  pos = magic_len;
+  uint32_t version, method_len, num_tokens;
+  if (!f_read_uint32(&version) || version != kTokenTableVersion) return false;
+  uint64_t fingerprint;
+  if (pos + sizeof(uint64_t) > buffer.size()) return false;
+  std::memcpy(&fingerprint, buffer.data() + pos, sizeof(uint64_t));
+  pos += sizeof(uint64_t);
+  if (fingerprint != tokenizer_fingerprint) return false;
+  if (!f_read_uint32(&method_len) || pos + method_len > buffer.size()) return false;
+  if (buffer.compare(pos, method_len, token_postproc_method) != 0) return false;
+  pos += method_len;
+  if (!f_read_uint32(&num_tokens) || static_cast<int>(num_tokens) != vocab_size) return false;
+  size_t offsets_pos = pos;
+  size_t tokens_pos = offsets_pos + (num_tokens + 1) * sizeof(uint32_t);
+  if (tokens_pos > buffer.size()) return false;
+  std::vector<uint32_t> offsets(num_tokens + 1);
+  std::memcpy(offsets.data(), buffer.data() + offsets_pos, offsets.size() * sizeof(uint32_t));
+  if (tokens_pos + offsets.back() != buffer.size()) return false;
+
+  token_table->clear();
+  token_table->reserve(num_tokens);
+  for (uint32_t i = 0; i < num_tokens; ++i) {
+    if (offsets[i] > offsets[i + 1]) return false;
+    token_table->emplace_back(buffer.data() + tokens_pos + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+  return true;
+}
+
+void TokenizerObj::SavePostProcessedTokenTable(const std::string& path) {
+  const std::vector<std::string>& token_table = PostProcessedTokenTable();
+  const std::string& method = info_->token_postproc_method;
+  std::string buffer = kTokenTableMagic;
+  auto f_write_uint32 = [&](uint32_t value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(uint32_t));
+  };
+  f_write_uint32(kTokenTableVersion);
+  buffer.append(reinterpret_cast<const char*>(&tokenizer_fingerprint_), sizeof(uint64_t));
+  f_write_uint32(method.size());
+  buffer += method;
+  f_write_uint32(token_table.size());
+  uint32_t offset = 0;
+  f_write_uint32(offset);
+  for (const std::string& token : token_table) {
+    offset += token.size();
+    f_write_uint32(offset);
+  }
+  for (const std::string& token : token_table) {
+    buffer += token;
+  }
+  std::ofstream fout(path, std::ios::binary);
+  CHECK(fout.is_open()) << "Cannot open file to write: " << path;
+  fout.write(buffer.data(), buffer.size());
+}
+
 const std::vector<std::string>& TokenizerObj::PostProcessedTokenTable() {
   if (!post_processed_token_table_.empty()) {
     return post_processed_token_table_;
   }
 
+  if (!token_table_path_.empty()) {
+    if (LoadTokenTable(token_table_path_, tokenizer_fingerprint_, GetVocabSize(),
+                       info_->token_postproc_method, &post_processed_token_table_)) {
+      return post_processed_token_table_;
+    }
+    LOG(WARNING) << "The precompiled token table " << token_table_path_
+                 << " does not match the tokenizer. The token table is built from the tokenizer.";
+    post_processed_token_table_.clear();
+  }
+  post_processed_token_table_ = BuildPostProcessedTokenTable();
+  return post_processed_token_table_;
+}
+
+std::vector<std::string> TokenizerObj::BuildPostProcessedTokenTable() const {
   std::vector<std::string> raw_token_table;
+  std::lock_guard<std::mutex> lock(tokenizer_mutex_);
   int vocab_size = tokenizer->GetVocabSize();
   raw_token_table.reserve(vocab_size);
   for (int32_t token_id = 0; token_id < vocab_size; ++token_id) {
     raw_token_table.push_back(tokenizer->IdToToken(token_id));
   }
-  post_processed_token_table_ =
-      Tokenizer::PostProcessTokenTable(raw_token_table, info_->token_postproc_method);
-  return post_processed_token_table_;
+  return Tokenizer::PostProcessTokenTable(raw_token_table, info_->token_postproc_method);
 }
 
 TVM_REGISTER_GLOBAL("mlc.tokenizers.Tokenizer").set_body_typed([](const String& path) {
@@ -481,6 +664,11 @@ TVM_REGISTER_GLOBAL("mlc.tokenizers.TokenizerDecode")
       return tokenizer->Decode({token_ids->data, token_ids->data + token_ids->size});
     });
 
+TVM_REGISTER_GLOBAL("mlc.tokenizers.TokenizerSavePostProcessedTokenTable")
+    .set_body_typed([](Tokenizer tokenizer, const String& path) {
+      tokenizer->SavePostProcessedTokenTable(path);
+    });
+
 TVM_REGISTER_GLOBAL("mlc.tokenizers.DetectTokenizerInfo").set_body_typed([](const String& path) {
   return Tokenizer::DetectTokenizerInfo(path)->AsJSONString();
 });
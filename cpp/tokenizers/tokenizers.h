@@ -12,6 +12,8 @@
 #include <tvm/runtime/container/string.h>
 #include <tvm/runtime/object.h>
 
+#include <list>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
 
@@ -60,13 +62,21 @@ class TokenizerInfo : public ObjectRef {
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(TokenizerInfo, ObjectRef, TokenizerInfoNode);
 };
 
-/*! \brief A wrapper object class for tokenizer. */
+/*!
+ * \brief A wrapper object class for tokenizer.
+ * \note The methods are safe to call from multiple threads. The underlying tokenizers keep the
+ * results of the last call in their handles (e.g. the HuggingFace tokenizer of tokenizers-cpp),
+ * so the calls into the underlying tokenizer are serialized.
+ */
 class TokenizerObj : public Object {
  public:
-  /*! \brief The underlying tokenizer. */
+  /*! \brief The underlying tokenizer, which is not safe to call concurrently. */
   std::unique_ptr<tokenizers::Tokenizer> tokenizer;
 
-  /*! \brief Encode text into ids. */
+  /*!
+   * \brief Encode text into ids. The results of long texts are kept in an LRU cache, so that
+   * the repeated text segments (e.g. system prompts and retrieved documents) are encoded once.
+   */
   std::vector<int32_t> Encode(const std::string& text) const;
 
   /*! \brief Encode text into ids. Some tokenizers may prepend a space in encoding, this method
@@ -79,9 +89,20 @@ class TokenizerObj : public Object {
   /*! \brief Decode token ids into text. */
   std::string Decode(const std::vector<int32_t>& token_ids) const;
 
-  /*! \brief Return the post-processed token table of the tokenizer. Special tokens are included. */
+  /*!
+   * \brief Return the post-processed token table of the tokenizer. Special tokens are included.
+   * The table is loaded from the precompiled token table file when it is found along with the
+   * tokenizer, and is built from the tokenizer otherwise.
+   */
   const std::vector<std::string>& PostProcessedTokenTable();
 
+  /*!
+   * \brief Save the post-processed token table to a precompiled token table file, which is
+   * loaded by later created tokenizers instead of building the table.
+   * \param path The path of the file to save to.
+   */
+  void SavePostProcessedTokenTable(const std::string& path);
+
   /*! \brief Get the prefix token mask as a bitset. The tokens which is a prefix of another token
    * are set to true, and others are set to false in the bitset. */
   const DynamicBitset& GetPrefixTokenMask();
@@ -111,12 +132,42 @@ class TokenizerObj : public Object {
   TVM_DECLARE_FINAL_OBJECT_INFO(TokenizerObj, Object);
 
  private:
+  /*! \brief Build the post-processed token table from the tokenizer. */
+  std::vector<std::string> BuildPostProcessedTokenTable() const;
+
   /*! \brief Useful information of the tokenizer during generation. */
   TokenizerInfo info_;
   /*! \brief The cached token table. */
   std::vector<std::string> post_processed_token_table_;
+  /*! \brief The path of the precompiled token table file. Empty if the file is not found. */
+  std::string token_table_path_;
+  /*!
+   * \brief The fingerprint of the tokenizer file, which the precompiled token table file must
+   * match to be loaded.
+   */
+  uint64_t tokenizer_fingerprint_ = 0;
   /*! \brief The cached prefix token mask. */
   DynamicBitset prefix_token_mask_;
+  /*! \brief The mutex serializing the calls into the underlying tokenizer. */
+  mutable std::mutex tokenizer_mutex_;
+
+  /*! \brief An entry of the encoding cache. */
+  struct EncodeCacheEntry {
+    std::string text;
+    std::vector<int32_t> token_ids;
+  };
+  /*! \brief The min length of the texts whose encoding results are cached. */
+  static constexpr int kMinCachedTextLength = 256;
+  /*! \brief The capacity of the encoding cache, counting the bytes of texts and token ids. */
+  static constexpr int64_t kEncodeCacheCapacityBytes = 64LL << 20;
+  /*! \brief The mutex of the encoding cache, which is shared by the tokenizing threads. */
+  mutable std::mutex encode_cache_mutex_;
+  /*! \brief The cached encoding results, from the most recently used to the least. */
+  mutable std::list<EncodeCacheEntry> encode_cache_entries_;
+  /*! \brief The map from the text hash to the cache entry. */
+  mutable std::unordered_map<size_t, std::list<EncodeCacheEntry>::iterator> encode_cache_index_;
+  /*! \brief The total bytes of the cache entries. */
+  mutable int64_t encode_cache_bytes_ = 0;
 };
 
 class Tokenizer : public ObjectRef {
@@ -129,6 +180,9 @@ class Tokenizer : public ObjectRef {
   MLC_LLM_DLL static Tokenizer FromPath(const String& path,
                                         std::optional<TokenizerInfo> info = std::nullopt);
 
+  /*! \brief The file name of the precompiled token table in the tokenizer directory. */
+  static constexpr const char* kTokenTableFileName = "tokenizer_table.bin";
+
   /*! \brief Detect the tokenizer info from the given path of the tokenizer. */
   MLC_LLM_DLL static TokenizerInfo DetectTokenizerInfo(const String& path);
 
@@ -5,6 +5,7 @@
 #import <Foundation/Foundation.h>
 #import <UIKit/UIKit.h>
 #include <os/proc.h>
+#include <pthread/qos.h>
 
 #include "LLMEngine.h"
 
@@ -25,6 +26,7 @@ using namespace tvm::runtime;
   PackedFunc unload_func_;
   PackedFunc reload_func_;
   PackedFunc reset_func_;
+  PackedFunc trim_memory_func_;
   PackedFunc chat_completion_func_;
   PackedFunc abort_func_;
   PackedFunc run_background_loop_func_;
@@ -42,6 +44,7 @@ using namespace tvm::runtime;
     reload_func_ = json_ffi_engine_->GetFunction("reload");
     unload_func_ = json_ffi_engine_->GetFunction("unload");
     reset_func_ = json_ffi_engine_->GetFunction("reset");
+    trim_memory_func_ = json_ffi_engine_->GetFunction("trim_memory");
     chat_completion_func_ = json_ffi_engine_->GetFunction("chat_completion");
     abort_func_ = json_ffi_engine_->GetFunction("abort");
     run_background_loop_func_ = json_ffi_engine_->GetFunction("run_background_loop");
@@ -53,6 +56,7 @@ using namespace tvm::runtime;
     ICHECK(reload_func_ != nullptr);
     ICHECK(unload_func_ != nullptr);
     ICHECK(reset_func_ != nullptr);
+    ICHECK(trim_memory_func_ != nullptr);
     ICHECK(chat_completion_func_ != nullptr);
     ICHECK(abort_func_ != nullptr);
     ICHECK(run_background_loop_func_ != nullptr);
@@ -71,6 +75,17 @@ using namespace tvm::runtime;
   init_background_engine_func_(device_type, device_id, internal_stream_callback);
 }
 
+- (void)initBackgroundEngineWithDataCallback:(void (^)(NSData*))streamCallback {
+  TypedPackedFunc<void(String)> internal_stream_callback([streamCallback](String value) {
+    // Hand over the UTF-8 bytes directly so that the JSON decoder reads them without
+    // transcoding through NSString.
+    streamCallback([NSData dataWithBytes:value.data() length:value.size()]);
+  });
+  int device_type = kDLMetal;
+  int device_id = 0;
+  init_background_engine_func_(device_type, device_id, internal_stream_callback);
+}
+
 - (void)reload:(NSString*)engineConfigJson {
   std::string engine_config = engineConfigJson.UTF8String;
   reload_func_(engine_config);
@@ -84,6 +99,10 @@ using namespace tvm::runtime;
   reset_func_();
 }
 
+- (void)trimMemory:(bool)critical {
+  trim_memory_func_(critical);
+}
+
 - (void)chatCompletion:(NSString*)requestJSON requestID:(NSString*)requestID {
   std::string request_json = requestJSON.UTF8String;
   std::string request_id = requestID.UTF8String;
@@ -96,10 +115,14 @@ using namespace tvm::runtime;
 }
 
 - (void)runBackgroundLoop {
+  // The engine loop issues the GPU work of every token, run it with user-interactive QoS.
+  pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
   run_background_loop_func_();
 }
 
 - (void)runBackgroundStreamBackLoop {
+  // The stream back loop delivers the token deltas to the UI.
+  pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
   run_background_stream_back_loop_func_();
 }
 
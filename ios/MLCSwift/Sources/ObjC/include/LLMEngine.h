@@ -13,12 +13,20 @@
 
 - (void)initBackgroundEngine:(void (^)(NSString*))streamCallback;
 
+/**
+ * Initialize the background engine with a stream callback receiving the UTF-8 bytes of
+ * the streamed JSON chunks, which skips the NSString conversion of every chunk.
+ */
+- (void)initBackgroundEngineWithDataCallback:(void (^)(NSData*))streamCallback;
+
 - (void)reload:(NSString*)engineConfig;
 
 - (void)unload;
 
 - (void)reset;
 
+- (void)trimMemory:(bool)critical;
+
 - (void)chatCompletion:(NSString*)requestJSON requestID:(NSString*)requestID;
 
 - (void)abort:(NSString*)requestID;
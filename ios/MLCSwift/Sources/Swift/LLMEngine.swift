@@ -65,14 +65,15 @@ public class MLCEngine {
             return stream
         }
 
-        func streamCallback(result: String?) {
+        func streamCallback(result: Data) {
             var responses: [ChatCompletionStreamResponse] = []
 
             let decoder = JSONDecoder()
             do {
-                responses = try decoder.decode([ChatCompletionStreamResponse].self, from: result!.data(using: .utf8)!)
+                responses = try decoder.decode([ChatCompletionStreamResponse].self, from: result)
             } catch let lastError {
-                logger.error("Swift json parsing error: error=\(lastError), jsonsrc=\(result!)")
+                let jsonsrc = String(decoding: result, as: UTF8.self)
+                logger.error("Swift json parsing error: error=\(lastError), jsonsrc=\(jsonsrc)")
              }
 
             // dispatch to right request ID
@@ -184,10 +185,10 @@ public class MLCEngine {
         self.state = state_
 
         // note: closure do not capture self
-        jsonFFIEngine_.initBackgroundEngine {
-            [state_](result : String?) -> Void in
+        jsonFFIEngine_.initBackgroundEngine(withDataCallback: {
+            [state_](result : Data) -> Void in
             state_.streamCallback(result: result)
-        }
+        })
         let backgroundWorker = BackgroundWorker { [jsonFFIEngine_] in
             Thread.setThreadPriority(1)
             jsonFFIEngine_.runBackgroundLoop()
@@ -196,8 +197,10 @@ public class MLCEngine {
             [jsonFFIEngine_] in
             jsonFFIEngine_.runBackgroundStreamBackLoop()
         }
-        // set background worker to be high QoS so it gets higher p for gpu
+        // set background workers to be high QoS so they get higher p for gpu
+        // and the streamed tokens reach the UI without delay
         backgroundWorker.qualityOfService = QualityOfService.userInteractive
+        backgroundStreamBackWorker.qualityOfService = QualityOfService.userInteractive
         threads.append(backgroundWorker)
         threads.append(backgroundStreamBackWorker)
         backgroundWorker.start()
@@ -226,6 +229,12 @@ public class MLCEngine {
         jsonFFIEngine.reset()
     }
 
+    /// Release memory in reaction to the memory pressure of the system.
+    /// The KV cache is further shrunk when the pressure is critical.
+    public func trimMemory(critical: Bool) async {
+        jsonFFIEngine.trimMemory(critical)
+    }
+
     public func unload() async {
         jsonFFIEngine.unload()
     }
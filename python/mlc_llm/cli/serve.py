@@ -23,9 +23,13 @@ class EngineConfigOverride:  # pylint: disable=too-many-instance-attributes
     gpu_memory_utilization: Optional[float] = None
     spec_draft_length: Optional[int] = None
     spec_tree_width: Optional[int] = None
-    prefix_cache_mode: Optional[Literal["disable", "radix"]] = None
+    spec_tree_token_budget: Optional[int] = None
+    prefix_cache_mode: Optional[Literal["disable", "radix", "shared"]] = None
     prefix_cache_max_num_recycling_seqs: Optional[int] = None
     prefill_mode: Optional[Literal["chunked", "hybrid"]] = None
+    scheduling_policy: Optional[Literal["fcfs", "priority", "fair"]] = None
+    target_inter_token_latency_ms: Optional[float] = None
+    long_prefill_chunk_size: Optional[int] = None
     context_window_size: Optional[int] = None
     sliding_window_size: Optional[int] = None
     attention_sink_size: Optional[int] = None
@@ -41,6 +45,7 @@ class EngineConfigOverride:  # pylint: disable=too-many-instance-attributes
         print(f";gpu_memory_utilization={self.gpu_memory_utilization}", file=out, end="")
         print(f";spec_draft_length={self.spec_draft_length}", file=out, end="")
         print(f";spec_tree_width={self.spec_tree_width}", file=out, end="")
+        print(f";spec_tree_token_budget={self.spec_tree_token_budget}", file=out, end="")
         print(f";prefix_cache_mode={self.prefix_cache_mode}", file=out, end="")
         print(
             f";prefix_cache_max_num_recycling_seqs={self.prefix_cache_max_num_recycling_seqs}",
@@ -48,6 +53,13 @@ class EngineConfigOverride:  # pylint: disable=too-many-instance-attributes
             end="",
         )
         print(f";prefill_mode={self.prefill_mode}", file=out, end="")
+        print(f";scheduling_policy={self.scheduling_policy}", file=out, end="")
+        print(
+            f";target_inter_token_latency_ms={self.target_inter_token_latency_ms}",
+            file=out,
+            end="",
+        )
+        print(f";long_prefill_chunk_size={self.long_prefill_chunk_size}", file=out, end="")
         print(f";context_window_size={self.context_window_size}", file=out, end="")
         print(f";sliding_window_size={self.sliding_window_size}", file=out, end="")
         print(f";attention_sink_size={self.attention_sink_size}", file=out, end="")
@@ -67,9 +79,13 @@ class EngineConfigOverride:  # pylint: disable=too-many-instance-attributes
         parser.add_argument("--gpu_memory_utilization", type=float, default=None)
         parser.add_argument("--spec_draft_length", type=int, default=None)
         parser.add_argument("--spec_tree_width", type=int, default=None)
+        parser.add_argument("--spec_tree_token_budget", type=int, default=None)
         parser.add_argument("--prefix_cache_mode", type=str, default="radix")
         parser.add_argument("--prefix_cache_max_num_recycling_seqs", type=int, default=None)
         parser.add_argument("--prefill_mode", type=str, default="hybrid")
+        parser.add_argument("--scheduling_policy", type=str, default=None)
+        parser.add_argument("--target_inter_token_latency_ms", type=float, default=None)
+        parser.add_argument("--long_prefill_chunk_size", type=int, default=None)
         parser.add_argument("--context_window_size", type=int, default=None)
         parser.add_argument("--sliding_window_size", type=int, default=None)
         parser.add_argument("--attention_sink_size", type=int, default=None)
@@ -84,9 +100,13 @@ class EngineConfigOverride:  # pylint: disable=too-many-instance-attributes
             gpu_memory_utilization=results.gpu_memory_utilization,
             spec_draft_length=results.spec_draft_length,
             spec_tree_width=results.spec_tree_width,
+            spec_tree_token_budget=results.spec_tree_token_budget,
             prefix_cache_mode=results.prefix_cache_mode,
             prefix_cache_max_num_recycling_seqs=results.prefix_cache_max_num_recycling_seqs,
             prefill_mode=results.prefill_mode,
+            scheduling_policy=results.scheduling_policy,
+            target_inter_token_latency_ms=results.target_inter_token_latency_ms,
+            long_prefill_chunk_size=results.long_prefill_chunk_size,
             context_window_size=results.context_window_size,
             sliding_window_size=results.sliding_window_size,
             attention_sink_size=results.attention_sink_size,
@@ -131,17 +151,18 @@ def main(argv):
     parser.add_argument(
         "--additional-models", type=str, nargs="*", help=HELP["additional_models_serve"]
     )
+    parser.add_argument("--lora-adapters", type=str, nargs="*", help=HELP["lora_adapters_serve"])
     parser.add_argument(
         "--speculative-mode",
         type=str,
-        choices=["disable", "small_draft", "eagle", "medusa"],
+        choices=["disable", "small_draft", "eagle", "medusa", "prompt_lookup"],
         default="disable",
         help=HELP["speculative_mode_serve"] + ' (default: "%(default)s")',
     )
     parser.add_argument(
         "--prefix-cache-mode",
         type=str,
-        choices=["disable", "radix"],
+        choices=["disable", "radix", "shared"],
         default="radix",
         help=HELP["prefix_cache_mode_serve"] + ' (default: "%(default)s")',
     )
@@ -208,6 +229,7 @@ def main(argv):
         mode=parsed.mode,
         enable_debug=parsed.enable_debug,
         additional_models=additional_models,
+        lora_adapters=parsed.lora_adapters or [],
         tensor_parallel_shards=parsed.overrides.tensor_parallel_shards,
         pipeline_parallel_stages=parsed.overrides.pipeline_parallel_stages,
         speculative_mode=parsed.speculative_mode,
@@ -222,8 +244,12 @@ def main(argv):
         gpu_memory_utilization=parsed.overrides.gpu_memory_utilization,
         spec_draft_length=parsed.overrides.spec_draft_length,
         spec_tree_width=parsed.overrides.spec_tree_width,
+        spec_tree_token_budget=parsed.overrides.spec_tree_token_budget,
         prefix_cache_max_num_recycling_seqs=parsed.overrides.prefix_cache_max_num_recycling_seqs,
         prefill_mode=parsed.prefill_mode,
+        scheduling_policy=parsed.overrides.scheduling_policy,
+        target_inter_token_latency_ms=parsed.overrides.target_inter_token_latency_ms,
+        long_prefill_chunk_size=parsed.overrides.long_prefill_chunk_size,
         enable_tracing=parsed.enable_tracing,
         host=parsed.host,
         port=parsed.port,
@@ -29,7 +29,13 @@ class AttachLogitProcessFunc:  # pylint: disable=too-few-public-methods
         mod = mod.clone()
         mod["apply_logit_bias_inplace"] = _get_apply_logit_bias_inplace(self.target)
         mod["apply_penalty_inplace"] = _get_apply_penalty_inplace(self.target)
+        mod["update_token_counts_inplace"] = _get_update_token_counts_inplace(self.target)
+        mod["apply_penalty_with_counts_inplace"] = _get_apply_penalty_with_counts_inplace(
+            self.target
+        )
         mod["apply_bitmask_inplace"] = _get_apply_bitmask_inplace(self.target)
+        mod["apply_logit_bias_csr_inplace"] = _get_apply_logit_bias_csr_inplace(self.target)
+        mod["apply_compact_bitmask_inplace"] = _get_apply_compact_bitmask_inplace(self.target)
         return mod
 
 
@@ -74,6 +80,59 @@ def _get_apply_logit_bias_inplace(target: tvm.target.Target):
     return _apply_logit_bias_inplace
 
 
+def _get_apply_logit_bias_csr_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _apply_logit_bias_csr_inplace(  # pylint: disable=too-many-arguments
+        var_logits: T.handle,
+        var_row_ids: T.handle,
+        var_row2seq_id: T.handle,
+        var_indptr: T.handle,
+        var_token_ids: T.handle,
+        var_logit_bias: T.handle,
+    ) -> None:
+        """Function that applies logit bias in place, where the bias entries of each sequence
+        are stored once in CSR format and shared by all the logit rows of the sequence."""
+        T.func_attr(
+            {
+                "global_symbol": "apply_logit_bias_csr_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        batch_size = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_row = T.int32(is_size_var=True)
+        num_seq = T.int32(is_size_var=True)
+        num_entry = T.int32(is_size_var=True)
+        logits = T.match_buffer(var_logits, (batch_size, vocab_size), "float32")
+        row_ids = T.match_buffer(var_row_ids, (num_row,), "int32")
+        row2seq_id = T.match_buffer(var_row2seq_id, (num_row,), "int32")
+        indptr = T.match_buffer(var_indptr, (num_seq + 1,), "int32")
+        token_ids = T.match_buffer(var_token_ids, (num_entry,), "int32")
+        logit_bias = T.match_buffer(var_logit_bias, (num_entry,), "float32")
+
+        for p0 in T.thread_binding(0, num_row, "blockIdx.x"):
+            for p1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vr = T.axis.spatial(num_row, p0)
+                    vt = T.axis.spatial(tx, p1)
+                    # Each thread applies the entries vt, vt + tx, ... of the sequence.
+                    for k in T.serial(
+                        (indptr[row2seq_id[vr] + 1] - indptr[row2seq_id[vr]] + tx - 1 - vt) // tx
+                    ):
+                        logits[
+                            row_ids[vr], token_ids[indptr[row2seq_id[vr]] + k * tx + vt]
+                        ] += logit_bias[indptr[row2seq_id[vr]] + k * tx + vt]
+
+    return _apply_logit_bias_csr_inplace
+
+
 def _get_apply_penalty_inplace(target: tvm.target.Target):
     tx = 1024  # default
     max_num_threads_per_block = get_max_num_threads_per_block(target)
@@ -129,6 +188,99 @@ def _get_apply_penalty_inplace(target: tvm.target.Target):
     return _apply_penalty_inplace
 
 
+def _get_update_token_counts_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _update_token_counts_inplace(
+        var_token_counts: T.handle,
+        var_slot_ids: T.handle,
+        var_token_ids: T.handle,
+        var_counts: T.handle,
+    ) -> None:
+        """Function that sets the given entries of the token count table in place."""
+        T.func_attr(
+            {
+                "global_symbol": "update_token_counts_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        num_slot = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_update = T.int32(is_size_var=True)
+        token_counts = T.match_buffer(var_token_counts, (num_slot, vocab_size), "int32")
+        slot_ids = T.match_buffer(var_slot_ids, (num_update,), "int32")
+        token_ids = T.match_buffer(var_token_ids, (num_update,), "int32")
+        counts = T.match_buffer(var_counts, (num_update,), "int32")
+
+        for p0 in T.thread_binding(0, (num_update + tx - 1) // tx, "blockIdx.x"):
+            for p1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vp = T.axis.spatial(num_update, p0 * tx + p1)
+                    T.where(p0 * tx + p1 < num_update)
+                    token_counts[slot_ids[vp], token_ids[vp]] = counts[vp]
+
+    return _update_token_counts_inplace
+
+
+def _get_apply_penalty_with_counts_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _apply_penalty_with_counts_inplace(  # pylint: disable=too-many-arguments,too-many-locals
+        var_logits: T.handle,
+        var_seq_ids: T.handle,
+        var_slot_ids: T.handle,
+        var_token_counts: T.handle,
+        var_penalties: T.handle,
+    ) -> None:
+        """Function that applies penalties in place with the device token count table."""
+        T.func_attr(
+            {
+                "global_symbol": "apply_penalty_with_counts_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        batch_size = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_seq = T.int32(is_size_var=True)
+        num_slot = T.int32(is_size_var=True)
+        logits = T.match_buffer(var_logits, (batch_size, vocab_size), "float32")
+        seq_ids = T.match_buffer(var_seq_ids, (num_seq,), "int32")
+        slot_ids = T.match_buffer(var_slot_ids, (num_seq,), "int32")
+        token_counts = T.match_buffer(var_token_counts, (num_slot, vocab_size), "int32")
+        penalties = T.match_buffer(var_penalties, (num_seq, 3), "float32")
+
+        for fused_s_v_0 in T.thread_binding(0, (num_seq * vocab_size + tx - 1) // tx, "blockIdx.x"):
+            for fused_s_v_1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vs = T.axis.spatial(num_seq, (fused_s_v_0 * tx + fused_s_v_1) // vocab_size)
+                    vv = T.axis.spatial(vocab_size, (fused_s_v_0 * tx + fused_s_v_1) % vocab_size)
+                    T.where(fused_s_v_0 * tx + fused_s_v_1 < num_seq * vocab_size)
+                    if token_counts[slot_ids[vs], vv] > 0:
+                        # Penalties: (presence_penalty, frequency_penalty, repetition_penalty)
+                        logits[seq_ids[vs], vv] -= (
+                            penalties[vs, 0] + token_counts[slot_ids[vs], vv] * penalties[vs, 1]
+                        )
+                        logits[seq_ids[vs], vv] = T.if_then_else(
+                            logits[seq_ids[vs], vv] < 0,
+                            logits[seq_ids[vs], vv] * penalties[vs, 2],
+                            logits[seq_ids[vs], vv] / penalties[vs, 2],
+                        )
+
+    return _apply_penalty_with_counts_inplace
+
+
 def _get_apply_bitmask_inplace(target: tvm.target.Target):
     tx = 1024  # default
     max_num_threads_per_block = get_max_num_threads_per_block(target)
@@ -170,3 +322,47 @@ def _get_apply_bitmask_inplace(target: tvm.target.Target):
                     )
 
     return _apply_bitmask_inplace
+
+
+def _get_apply_compact_bitmask_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _apply_compact_bitmask_inplace(
+        var_logits: T.handle,
+        var_seq_ids: T.handle,
+        var_bitmask: T.handle,
+    ) -> None:
+        """Function that applies vocabulary masking in place, where the bitmask only holds
+        the rows of the masked sequences."""
+        T.func_attr(
+            {
+                "global_symbol": "apply_compact_bitmask_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        batch_size = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_seq = T.int32(is_size_var=True)
+        logits = T.match_buffer(var_logits, (batch_size, vocab_size), "float32")
+        seq_ids = T.match_buffer(var_seq_ids, (num_seq,), "int32")
+        bitmask = T.match_buffer(var_bitmask, (num_seq, (vocab_size + 31) // 32), "int32")
+
+        for fused_s_v_0 in T.thread_binding(0, (num_seq * vocab_size + tx - 1) // tx, "blockIdx.x"):
+            for fused_s_v_1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vs = T.axis.spatial(num_seq, (fused_s_v_0 * tx + fused_s_v_1) // vocab_size)
+                    vv = T.axis.spatial(vocab_size, (fused_s_v_0 * tx + fused_s_v_1) % vocab_size)
+                    T.where(fused_s_v_0 * tx + fused_s_v_1 < num_seq * vocab_size)
+                    logits[seq_ids[vs], vv] = T.if_then_else(
+                        (bitmask[vs, vv // 32] >> (vv % 32)) & 1 == 1,
+                        logits[seq_ids[vs], vv],
+                        T.min_value("float32"),
+                    )
+
+    return _apply_compact_bitmask_inplace
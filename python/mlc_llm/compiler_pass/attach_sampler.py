@@ -7,7 +7,12 @@ from tvm import IRModule, relax, te, tir
 from tvm.relax.frontend import nn
 from tvm.script import tir as T
 
-from mlc_llm.op.batch_spec_verify import batch_spec_verify
+from mlc_llm.op.batch_check_stop import batch_check_stop
+from mlc_llm.op.batch_spec_verify import (
+    batch_spec_verify,
+    batch_spec_verify_deterministic,
+)
+from mlc_llm.op.top_k_probs import top_k_probs
 from mlc_llm.op.top_p_pivot import top_p_pivot, top_p_renorm
 
 
@@ -40,8 +45,13 @@ class AttachGPUSamplingFunc:  # pylint: disable=too-few-public-methods
                 _attach_argsort_func(bb),
                 _attach_sample_with_top_p(bb),
                 _attach_take_probs_func(bb),
+                _attach_top_k_probs_func(bb, self.target),
                 _attach_batch_verifier(bb),
+                _attach_deterministic_batch_verifier(bb),
                 _attach_renormalize_by_top_p(bb, self.target),
+                _attach_renormalize_by_min_p(bb),
+                _attach_renormalize_by_typical_p(bb),
+                _attach_check_stop(bb),
             ]
         ]
 
@@ -254,6 +264,102 @@ def _attach_renormalize_by_top_p(bb: relax.BlockBuilder, target: tvm.target.Targ
     return gv
 
 
+def _attach_renormalize_by_min_p(bb: relax.BlockBuilder):
+    batch_size = tir.SizeVar("batch_size", "int64")
+    vocab_size = tir.SizeVar("vocab_size", "int64")
+    probs = relax.Var("probs", relax.TensorStructInfo((batch_size, vocab_size), "float32"))
+    min_p = relax.Var("min_p", relax.TensorStructInfo((batch_size,), "float32"))
+    with bb.function("renormalize_by_min_p", [probs, min_p]):
+        with bb.dataflow():
+            max_probs = bb.emit(relax.op.max(probs, axis=[1], keepdims=True))
+            cutoff = bb.emit(relax.op.multiply(max_probs, relax.op.expand_dims(min_p, axis=1)))
+            masked_probs = bb.emit(
+                relax.op.where(
+                    relax.op.greater_equal(probs, cutoff), probs, relax.const(0, "float32")
+                )
+            )
+            renorm_sum = bb.emit(relax.op.sum(masked_probs, axis=[1], keepdims=True))
+            renormalized_probs = bb.emit_output(relax.op.divide(masked_probs, renorm_sum))
+        gv = bb.emit_func_output(renormalized_probs)
+    return gv
+
+
+def _attach_renormalize_by_typical_p(bb: relax.BlockBuilder):
+    # Locally typical sampling: keep the tokens whose surprisal is the closest to the
+    # entropy until their total probability reaches typical_p, and renormalize.
+    batch_size = tir.SizeVar("batch_size", "int64")
+    vocab_size = tir.SizeVar("vocab_size", "int64")
+    probs = relax.Var("probs", relax.TensorStructInfo((batch_size, vocab_size), "float32"))
+    typical_p = relax.Var("typical_p", relax.TensorStructInfo((batch_size,), "float32"))
+    zero = relax.const(0, "float32")
+    with bb.function("renormalize_by_typical_p", [probs, typical_p]):
+        with bb.dataflow():
+            nonzero = bb.emit(relax.op.greater(probs, zero))
+            log_probs = bb.emit(
+                relax.op.log(relax.op.where(nonzero, probs, relax.const(1, "float32")))
+            )
+            neg_entropy = bb.emit(
+                relax.op.sum(relax.op.multiply(probs, log_probs), axis=[1], keepdims=True)
+            )
+            # The zero probs are the farthest so that they are never kept before others.
+            distances = bb.emit(
+                relax.op.where(
+                    nonzero,
+                    relax.op.abs(relax.op.subtract(log_probs, neg_entropy)),
+                    relax.const(3.0e38, "float32"),
+                )
+            )
+            sorted_indices = bb.emit(relax.op.argsort(distances, descending=False, dtype="int32"))
+            sorted_values = bb.emit_te(
+                lambda unsorted_probs, unsorted_distances, sorted_indices: [
+                    te.compute(
+                        (batch_size, vocab_size),
+                        lambda i, j: unsorted_probs[i, sorted_indices[i, j]],
+                        name="take_sorted_probs",
+                    ),
+                    te.compute(
+                        (batch_size, vocab_size),
+                        lambda i, j: unsorted_distances[i, sorted_indices[i, j]],
+                        name="take_sorted_distances",
+                    ),
+                ],
+                probs,
+                distances,
+                sorted_indices,
+                primfunc_name_hint="take_sorted_probs_and_distances",
+            )
+            sorted_probs = bb.emit(relax.TupleGetItem(sorted_values, 0))
+            sorted_distances = bb.emit(relax.TupleGetItem(sorted_values, 1))
+            exclusive_cumsum = bb.emit(
+                relax.op.subtract(relax.op.cumsum(sorted_probs, axis=1), sorted_probs)
+            )
+            # The radius is the distance of the last kept token.
+            radius = bb.emit(
+                relax.op.max(
+                    relax.op.where(
+                        relax.op.less(exclusive_cumsum, relax.op.expand_dims(typical_p, axis=1)),
+                        sorted_distances,
+                        zero,
+                    ),
+                    axis=[1],
+                    keepdims=True,
+                )
+            )
+            masked_probs = bb.emit(
+                relax.op.where(
+                    relax.op.less_equal(
+                        distances, relax.op.add(radius, relax.const(1e-5, "float32"))
+                    ),
+                    probs,
+                    zero,
+                )
+            )
+            renorm_sum = bb.emit(relax.op.sum(masked_probs, axis=[1], keepdims=True))
+            renormalized_probs = bb.emit_output(relax.op.divide(masked_probs, renorm_sum))
+        gv = bb.emit_func_output(renormalized_probs)
+    return gv
+
+
 def _attach_take_probs_func(bb: relax.BlockBuilder):
     batch_size = tir.SizeVar("batch_size", "int64")
     num_samples = tir.SizeVar("num_samples", "int64")
@@ -324,6 +430,33 @@ def _attach_take_probs_func(bb: relax.BlockBuilder):
     return gv
 
 
+def _attach_top_k_probs_func(bb: relax.BlockBuilder, target: tvm.target.Target):
+    # We support at most 20 top prob results for each sample, the same as the OpenAI API.
+    max_top_logprobs = 20
+    batch_size = tir.SizeVar("batch_size", "int64")
+    num_samples = tir.SizeVar("num_samples", "int64")
+    vocab_size = tir.SizeVar("vocab_size", "int64")
+    probs = relax.Var("probs", relax.TensorStructInfo((batch_size, vocab_size), "float32"))
+    sample_indices = relax.Var("sample_indices", relax.TensorStructInfo((num_samples,), "int32"))
+    sampling_results = relax.Var("sampling_result", relax.TensorStructInfo((num_samples,), "int32"))
+    args = [probs, sample_indices, sampling_results]
+    with bb.function("sampler_top_k_probs", args):
+        with bb.dataflow():
+            taken_probs_indices = bb.emit_output(
+                relax.call_tir(
+                    bb.add_func(top_k_probs(max_top_logprobs, target), "sampler_top_k_probs_tir"),
+                    args,
+                    out_sinfo=[
+                        relax.TensorStructInfo((num_samples,), "float32"),
+                        relax.TensorStructInfo((num_samples, max_top_logprobs), "float32"),
+                        relax.TensorStructInfo((num_samples, max_top_logprobs), "int32"),
+                    ],
+                )
+            )
+        gv = bb.emit_func_output(taken_probs_indices)
+    return gv
+
+
 def _attach_batch_verifier(bb: relax.BlockBuilder):
     num_nodes = tir.SizeVar("num_nodes", "int64")
     nbatch = tir.SizeVar("nbatch", "int64")
@@ -369,3 +502,78 @@ def _attach_batch_verifier(bb: relax.BlockBuilder):
             )
         gv = bb.emit_func_output(res)
     return gv
+
+
+def _attach_deterministic_batch_verifier(bb: relax.BlockBuilder):
+    num_nodes = tir.SizeVar("num_nodes", "int64")
+    nbatch = tir.SizeVar("nbatch", "int64")
+    vocab_size = tir.SizeVar("vocab_size", "int64")
+    draft_tokens = relax.Var("draft_tokens", relax.TensorStructInfo((num_nodes,), "int32"))
+    model_probs = relax.Var(
+        "model_probs", relax.TensorStructInfo((num_nodes, vocab_size), "float32")
+    )
+    token_tree_first_child = relax.Var(
+        "token_tree_first_child", relax.TensorStructInfo((num_nodes,), "int32")
+    )
+    token_tree_next_sibling = relax.Var(
+        "token_tree_next_sibling", relax.TensorStructInfo((num_nodes,), "int32")
+    )
+    uniform_samples = relax.Var("uniform_samples", relax.TensorStructInfo((num_nodes,), "float32"))
+    token_tree_parent_ptr = relax.Var(
+        "token_tree_parent_ptr", relax.TensorStructInfo((nbatch,), "int32")
+    )
+    args = [
+        draft_tokens,
+        model_probs,
+        token_tree_first_child,
+        token_tree_next_sibling,
+        uniform_samples,
+        token_tree_parent_ptr,
+    ]
+    with bb.function("sampler_verify_deterministic_draft_tokens", args):
+        with bb.dataflow():
+            res = bb.emit_output(
+                relax.call_tir_inplace(
+                    bb.add_func(
+                        batch_spec_verify_deterministic(vocab_size),
+                        "batch_verify_deterministic_on_gpu_single_kernel",
+                    ),
+                    args,
+                    inplace_indices=[args.index(model_probs), args.index(token_tree_parent_ptr)],
+                    out_sinfo=[
+                        model_probs.struct_info,  # pylint: disable=no-member
+                        token_tree_parent_ptr.struct_info,  # pylint: disable=no-member
+                    ],
+                )
+            )
+        gv = bb.emit_func_output(res)
+    return gv
+
+
+def _attach_check_stop(bb: relax.BlockBuilder):
+    num_samples = tir.SizeVar("num_samples", "int64")
+    num_stop_tokens = tir.SizeVar("num_stop_tokens", "int64")
+    sampled_token_ids = relax.Var(
+        "sampled_token_ids", relax.TensorStructInfo((num_samples,), "int32")
+    )
+    stop_token_indptr = relax.Var(
+        "stop_token_indptr", relax.TensorStructInfo((num_samples + 1,), "int32")
+    )
+    stop_token_ids = relax.Var(
+        "stop_token_ids", relax.TensorStructInfo((num_stop_tokens,), "int32")
+    )
+    num_remaining_tokens = relax.Var(
+        "num_remaining_tokens", relax.TensorStructInfo((num_samples,), "int32")
+    )
+    args = [sampled_token_ids, stop_token_indptr, stop_token_ids, num_remaining_tokens]
+    with bb.function("sampler_check_stop", args):
+        with bb.dataflow():
+            finished = bb.emit_output(
+                relax.call_tir(
+                    bb.add_func(batch_check_stop(), "batch_check_stop_on_gpu"),
+                    args,
+                    out_sinfo=relax.TensorStructInfo((num_samples,), "int32"),
+                )
+            )
+        gv = bb.emit_func_output(finished)
+    return gv
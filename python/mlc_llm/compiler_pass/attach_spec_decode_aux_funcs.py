@@ -32,6 +32,7 @@ class AttachSpecDecodeAuxFuncs:  # pylint: disable=too-few-public-methods
             dtype = hidden_states_struct_info.dtype
             _add_gather_hidden_states(bb, self.tensor_parallel_shards, dtype)
             _add_scatter_hidden_states(bb, self.tensor_parallel_shards, dtype)
+            _add_pool_hidden_states(bb, self.tensor_parallel_shards, dtype)
         return bb.finalize()
 
 
@@ -121,3 +122,60 @@ def _add_gather_hidden_states(bb: BlockBuilder, tensor_parallel_shards: int, dty
             )
         gv = bb.emit_func_output(output)
     return gv
+
+
+def _get_pool_hidden_states(dtype: str):
+    @T.prim_func
+    def _pool_hidden_states(
+        var_src: T.handle, var_pool_info: T.handle, var_pooled: T.handle, var_pooled_f32: T.handle
+    ):
+        T.func_attr({"global_symbol": "_pool_hidden_states", "tir.noalias": True})
+        batch_size = T.int32(is_size_var=True)
+        m = T.int32(is_size_var=True)
+        n = T.int32(is_size_var=True)
+        src = T.match_buffer(var_src, (m, n), dtype)
+        # Each row is (begin, end, use_mean) of a sequence in the source hidden states.
+        pool_info = T.match_buffer(var_pool_info, (batch_size, 3), "int32")
+        pooled = T.match_buffer(var_pooled, (batch_size, n), dtype)
+        pooled_f32 = T.match_buffer(var_pooled_f32, (batch_size, n), "float32")
+        for b, j in T.grid(batch_size, n):
+            with T.block("pool_hidden_states"):
+                vb, vj = T.axis.remap("SS", [b, j])
+                T.reads(pool_info[vb, 0:3], src[0:m, vj])
+                T.writes(pooled[vb, vj], pooled_f32[vb, vj])
+                if pool_info[vb, 2] != 0:
+                    pooled_f32[vb, vj] = T.float32(0)
+                    for k in range(pool_info[vb, 1] - pool_info[vb, 0]):
+                        pooled_f32[vb, vj] += T.Cast("float32", src[pool_info[vb, 0] + k, vj])
+                    pooled_f32[vb, vj] = pooled_f32[vb, vj] / T.Cast(
+                        "float32", pool_info[vb, 1] - pool_info[vb, 0]
+                    )
+                else:
+                    pooled_f32[vb, vj] = T.Cast("float32", src[pool_info[vb, 1] - 1, vj])
+                pooled[vb, vj] = T.Cast(dtype, pooled_f32[vb, vj])
+
+    return _pool_hidden_states
+
+
+def _add_pool_hidden_states(bb: BlockBuilder, tensor_parallel_shards: int, dtype: str):
+    batch_size = tir.SizeVar("batch_size", "int64")
+    m = tir.SizeVar("m", "int64")
+    n = tir.SizeVar("n", "int64")
+    src = relax.Var("src", struct_info=TensorStructInfo([m, n], dtype))
+    pool_info = relax.Var("pool_info", struct_info=TensorStructInfo([batch_size, 3], "int32"))
+    with bb.function("pool_hidden_states", [src, pool_info]):
+        with bb.dataflow():
+            if tensor_parallel_shards > 1:
+                pool_info = relax.op.ccl.broadcast_from_worker0(pool_info)
+            output = bb.emit_output(
+                relax.call_tir(
+                    bb.add_func(_get_pool_hidden_states(dtype), "_pool_hidden_states"),
+                    [src, pool_info],
+                    [
+                        TensorStructInfo([batch_size, n], dtype),
+                        TensorStructInfo([batch_size, n], "float32"),
+                    ],
+                )
+            )
+        gv = bb.emit_func_output(output)
+    return gv
@@ -114,6 +114,7 @@ class DispatchKVCacheCreation:  # pylint: disable=too-many-instance-attributes
             "num_attention_heads": kwargs["num_attention_heads"],
             "num_key_value_heads": kwargs["num_key_value_heads"],
             "head_dim": kwargs["head_dim"],
+            "dtype": str(kwargs["dtype"]),
         }
 
     def create_tir_paged_kv_cache(self, bb: relax.BlockBuilder, kwargs: Dict[str, Any]) -> None:
@@ -100,6 +100,46 @@ class BNFGrammar(Object):
             _ffi_api.BNFGrammarToJSON(self, prettify)  # type: ignore  # pylint: disable=no-member
         )
 
+    @staticmethod
+    def from_binary(binary: bytes) -> "BNFGrammar":
+        """Load a BNF grammar from the raw representation of the AST in binary format. It is
+        much faster than loading from the JSON format.
+
+        Parameters
+        ----------
+        binary : bytes
+            The binary string dumped by to_binary.
+
+        Returns
+        -------
+        grammar : BNFGrammar
+            The loaded BNF grammar.
+        """
+        return _ffi_api.BNFGrammarFromBinary(binary)  # type: ignore  # pylint: disable=no-member
+
+    def to_binary(self) -> bytes:
+        """Serialize the AST. Dump the raw representation of the AST to a compact binary string.
+
+        Returns
+        -------
+        binary : bytes
+            The binary string.
+        """
+        return bytes(
+            _ffi_api.BNFGrammarToBinary(self)  # type: ignore  # pylint: disable=no-member
+        )
+
+    def content_hash(self) -> int:
+        """Get the hash of the binary serialization of the grammar, which is the same across
+        processes for the same grammar.
+
+        Returns
+        -------
+        hash : int
+            The hash as a signed 64-bit integer.
+        """
+        return int(_ffi_api.BNFGrammarHash(self))  # type: ignore  # pylint: disable=no-member
+
     @staticmethod
     def from_schema(
         schema: str,
@@ -142,6 +182,23 @@ class BNFGrammar(Object):
             schema, indent, separators, strict_mode
         )
 
+    @staticmethod
+    def from_regex(regex: str) -> "BNFGrammar":
+        """Construct a BNF grammar from a regular expression. The grammar accepts the strings that
+        are fully matched by the regex. Backreferences and lookarounds are not supported.
+
+        Parameters
+        ----------
+        regex : str
+            The regular expression.
+
+        Returns
+        -------
+        grammar : BNFGrammar
+            The generated BNF grammar.
+        """
+        return _ffi_api.BNFGrammarFromRegex(regex)  # type: ignore  # pylint: disable=no-member
+
     @staticmethod
     def get_grammar_of_json() -> "BNFGrammar":
         """Get the grammar of standard JSON.
@@ -219,6 +276,22 @@ class BNFGrammar(Object):
             schema, indent, separators, strict_mode
         )
 
+    @staticmethod
+    def debug_regex_to_ebnf(regex: str) -> str:
+        """Convert a regular expression to EBNF grammar string. For test purposes.
+
+        Parameters
+        ----------
+        regex : str
+            The regular expression.
+
+        Returns
+        -------
+        ebnf_string : str
+            The EBNF grammar string.
+        """
+        return _ffi_api.DebugRegexToEBNF(regex)  # type: ignore  # pylint: disable=no-member
+
 
 @tvm._ffi.register_object("mlc.grammar.GrammarStateMatcher")  # pylint: disable=protected-access
 class GrammarStateMatcher(Object):
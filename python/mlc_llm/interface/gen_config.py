@@ -240,6 +240,19 @@ def gen_config(  # pylint: disable=too-many-locals,too-many-arguments,too-many-b
                         raise ValueError("Duplicated vocab in tokenizer.json")
                     appeared_content.add(content)
 
+    # 3.6. Precompile the post-processed token table, so that the engine and the grammar init
+    # context cache load it at startup instead of building it from the tokenizer. The table of a
+    # previous run is removed first, so that the table is always rebuilt from the tokenizer.
+    try:
+        token_table_file = output / "tokenizer_table.bin"
+        token_table_file.unlink(missing_ok=True)
+        Tokenizer(str(output)).save_post_processed_token_table(str(token_table_file))
+        if "tokenizer_table.bin" not in mlc_chat_config.tokenizer_files:
+            mlc_chat_config.tokenizer_files.append("tokenizer_table.bin")
+        logger.info("Saving precompiled token table to: %s", bold(str(token_table_file)))
+    except Exception:  # pylint: disable=broad-exception-caught
+        logger.exception("%s with the exception below. Skipping", FAILED)
+
     # Step 4. Load system default value
     apply_system_defaults_for_missing_fields(mlc_chat_config)
     # Step 5. Dump the configuration file to output directory
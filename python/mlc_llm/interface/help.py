@@ -193,6 +193,12 @@ The way of specifying additional models is:
 "--additional-models model_path_1,model_lib_1 model_path_2 ...".
 When the model lib of a model is not given, JIT model compilation will be activated
 to compile the model automatically.
+""".strip(),
+    "lora_adapters_serve": """
+The directories of the LoRA adapters to serve with the model, in the form of
+"--lora-adapters adapter_path_1 adapter_path_2 ...".
+Each adapter is named by its directory name, and a request picks an adapter with the
+"lora_adapter" field. The model library needs to be compiled with LoRA support.
 """.strip(),
     "gpu_memory_utilization_serve": """
 A number in (0, 1) denoting the fraction of GPU memory used by the server in total.
@@ -202,22 +208,27 @@ Under mode "local" or "interactive", the actual memory usage may be significantl
 this number. Under mode "server", the actual memory usage may be slightly larger than this number.
 """.strip(),
     "speculative_mode_serve": """
-The speculative decoding mode. Right now four options are supported:
+The speculative decoding mode. Right now five options are supported:
  - "disable", where speculative decoding is not enabled,
  - "small_draft", denoting the normal speculative decoding (small draft) style,
  - "eagle", denoting the eagle-style speculative decoding.
  - "medusa", denoting the medusa-style speculative decoding.
+ - "prompt_lookup", denoting the draft tokens are proposed by n-gram matching in the prompt
+   and generated tokens, without a draft model. It requires a positive draft length.
 The default mode is "disable".
 """.strip(),
     "spec_draft_length_serve": """
 The number of draft tokens to generate in speculative proposal.
 Being 0 means to enable adaptive speculative mode, where the draft length will be
-automatically adjusted based on engine state. The default values is 0.
+automatically adjusted based on engine state. The "prompt_lookup" mode does not support
+the adaptive draft length, where being 0 means the draft length 4. The default values is 0.
 """.strip(),
     "prefix_cache_mode_serve": """
-The prefix cache mode. Right now two options are supported:
+The prefix cache mode. Right now three options are supported:
  - "disable", where prefix cache is not enabled,
  - "radix", denoting the normal paged radix tree based prefix cache,
+ - "shared", denoting the paged radix tree based prefix cache which additionally shares
+   prefixes with the engines of other processes on the same node via host shared memory,
 The default mode is "radix".
 """.strip(),
     "prefix_cache_max_num_recycling_seqs_serve": """
@@ -232,8 +243,9 @@ hybrid prefill or split-fuse, so that decode step will be converted into prefill
 Overriding extra configurable fields of EngineConfig and model compilation config.
 Supporting fields that can be be overridden: "tensor_parallel_shards", "max_num_sequence",
 "max_total_seq_length", "prefill_chunk_size", "max_history_size", "gpu_memory_utilization",
-"spec_draft_length", "prefix_cache_max_num_recycling_seqs", "context_window_size",
-"sliding_window_size", "attention_sink_size".
+"spec_draft_length", "spec_tree_width", "spec_tree_token_budget",
+"prefix_cache_max_num_recycling_seqs", "scheduling_policy", "target_inter_token_latency_ms",
+"long_prefill_chunk_size", "context_window_size", "sliding_window_size", "attention_sink_size".
 Please check out the documentation of EngineConfig in mlc_llm/serve/config.py for detailed docstring
 of each field.
 Example: --overrides "max_num_sequence=32;max_total_seq_length=4096;tensor_parallel_shards=2"
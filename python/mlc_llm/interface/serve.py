@@ -26,6 +26,7 @@ def serve(
     mode: Literal["local", "interactive", "server"],
     enable_debug: bool,
     additional_models: List[Union[str, Tuple[str, str]]],
+    lora_adapters: List[str],
     tensor_parallel_shards: Optional[int],
     pipeline_parallel_stages: Optional[int],
     max_num_sequence: Optional[int],
@@ -36,12 +37,16 @@ def serve(
     attention_sink_size: Optional[int],
     max_history_size: Optional[int],
     gpu_memory_utilization: Optional[float],
-    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa"],
+    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa", "prompt_lookup"],
     spec_draft_length: Optional[int],
     spec_tree_width: Optional[int],
-    prefix_cache_mode: Literal["disable", "radix"],
+    spec_tree_token_budget: Optional[int],
+    prefix_cache_mode: Literal["disable", "radix", "shared"],
     prefix_cache_max_num_recycling_seqs: Optional[int],
     prefill_mode: Literal["hybrid", "chunked"],
+    scheduling_policy: Optional[Literal["fcfs", "priority"]],
+    target_inter_token_latency_ms: Optional[float],
+    long_prefill_chunk_size: Optional[int],
     enable_tracing: bool,
     host: str,
     port: int,
@@ -59,6 +64,7 @@ def serve(
         mode=mode,
         engine_config=engine.EngineConfig(
             additional_models=additional_models,
+            lora_adapters=lora_adapters,
             tensor_parallel_shards=tensor_parallel_shards,
             pipeline_parallel_stages=pipeline_parallel_stages,
             max_num_sequence=max_num_sequence,
@@ -72,9 +78,13 @@ def serve(
             speculative_mode=speculative_mode,
             spec_draft_length=spec_draft_length,
             spec_tree_width=spec_tree_width,
+            spec_tree_token_budget=spec_tree_token_budget or 0,
             prefix_cache_mode=prefix_cache_mode,
             prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
             prefill_mode=prefill_mode,
+            scheduling_policy=scheduling_policy or "fcfs",
+            target_inter_token_latency_ms=target_inter_token_latency_ms or 0.0,
+            long_prefill_chunk_size=long_prefill_chunk_size or 0,
         ),
         enable_tracing=enable_tracing,
     )
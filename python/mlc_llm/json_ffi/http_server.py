@@ -0,0 +1,59 @@
+"""The native HTTP server which serves the OpenAI chat completion API on JSON FFI engine."""
+
+from typing import Literal, Optional, Union
+
+import tvm
+
+from mlc_llm.serve.engine_base import (
+    EngineConfig,
+    _check_engine_config,
+    _parse_models,
+    _process_model_args,
+    detect_device,
+)
+
+
+class JSONFFIHTTPServer:  # pylint: disable=too-few-public-methods
+    """The native HTTP server running an epoll event loop in C++, which serves
+    `POST /v1/chat/completions` (with server-sent events for streaming requests)
+    and `GET /health` directly on JSON FFI engine, with no Python in the request path.
+
+    The server is only supported on Linux.
+    """
+
+    def __init__(  # pylint: disable=too-many-arguments
+        self,
+        model: str,
+        device: Union[str, tvm.runtime.Device] = "auto",
+        *,
+        model_lib: Optional[str] = None,
+        mode: Literal["local", "interactive", "server"] = "server",
+        engine_config: Optional[EngineConfig] = None,
+    ) -> None:
+        if engine_config is None:
+            engine_config = EngineConfig()
+        _check_engine_config(model, model_lib, mode, engine_config)
+        models = _parse_models(model, model_lib, engine_config.additional_models)
+        if isinstance(device, str):
+            device = detect_device(device)
+        assert isinstance(device, tvm.runtime.Device)
+        model_args = _process_model_args(models, device, engine_config)[0]
+
+        engine_config.model = model_args[0][0]
+        engine_config.model_lib = model_args[0][1]
+        engine_config.additional_models = model_args[1:]  # type: ignore
+        engine_config.mode = mode
+        self.engine_config = engine_config
+
+        module = tvm.get_global_func("mlc.json_ffi.CreateHTTPServer", allow_missing=False)()
+        self._ffi = {key: module[key] for key in ["init_engine", "start", "stop"]}
+        self._ffi["init_engine"](device.device_type, device.device_id, engine_config.asjson())
+
+    def start(self, host: str = "127.0.0.1", port: int = 8000) -> None:
+        """Start serving on the given IPv4 address. The call returns immediately,
+        and the server runs on its own thread until `stop` is called."""
+        self._ffi["start"](host, port)
+
+    def stop(self) -> None:
+        """Stop the server and the engine."""
+        self._ffi["stop"]()
@@ -7,7 +7,14 @@ from mlc_llm.op import cutlass, extern, ft_gemm, moe_matmul
 
 
 class MixtralExperts(nn.Module):
-    """Mixtral experts"""
+    """Mixtral experts
+
+    The weights of all the experts of one layer are stacked in a single parameter of shape
+    ``(num_local_experts, out_features, in_features)``, which the MoE GEMV and group GEMM
+    kernels index by the expert ids routed inside the compiled model. Hence the whole stacked
+    parameter has to reside on device when the layer runs, and the serving runtime cannot
+    swap individual experts in or out between layers.
+    """
 
     def __init__(self, num_local_experts, in_features, out_features, tensor_parallel_shards=1):
         self.num_local_experts = num_local_experts
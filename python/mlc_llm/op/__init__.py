@@ -2,9 +2,10 @@
 
 from . import moe_matmul, moe_misc
 from .attention import attention
-from .batch_spec_verify import batch_spec_verify
+from .batch_spec_verify import batch_spec_verify, batch_spec_verify_deterministic
 from .extern import configure, enable, get_store
 from .ft_gemm import faster_transformer_dequantize_gemm
 from .pipeline_parallel import pipeline_stage_boundary
 from .position_embedding import llama_rope
+from .top_k_probs import top_k_probs
 from .top_p_pivot import top_p_pivot, top_p_renorm
@@ -0,0 +1,77 @@
+"""Operators for checking the token stop conditions of the sampled tokens on device."""
+
+from tvm.script import tir as T
+
+# mypy: disable-error-code="attr-defined,valid-type,name-defined"
+# pylint: disable=too-many-locals,invalid-name,too-many-arguments
+
+
+def batch_check_stop():
+    """Batch stop check function, which checks the stop conditions that only depend on the
+    sampled token, so that the sampled tokens do not need to be copied back to host for it.
+
+    A sample is finished when the sampled token is one of the stop tokens of the sample,
+    or when the sampled token is the last token the sample can generate.
+
+    Parameters
+    ----------
+    sampled_token_ids:
+        The sampled token of each sample
+
+    stop_token_indptr:
+        The indptr of the stop tokens of each sample in stop_token_ids
+
+    stop_token_ids:
+        The concatenated stop tokens of all samples
+
+    num_remaining_tokens:
+        The number of tokens each sample can generate, including the sampled token
+
+    finished:
+        The output finished flag of each sample, which is 1 when the sample is finished
+    """
+    TX = 256
+
+    def _var(dtype="int32"):
+        return T.alloc_buffer((1,), dtype, scope="local")
+
+    # fmt: off
+    @T.prim_func(private=True)
+    def _func(
+        var_sampled_token_ids: T.handle,
+        var_stop_token_indptr: T.handle,
+        var_stop_token_ids: T.handle,
+        var_num_remaining_tokens: T.handle,
+        var_finished: T.handle,
+    ):
+        """
+        [
+            blockIdx.x * threadIdx.x on samples,
+            for loop over the stop tokens of the sample
+        ]
+        """
+        T.func_attr({"tir.is_scheduled": 1, "tir.noalias": True})
+        num_samples = T.int32(is_size_var=True)
+        num_stop_tokens = T.int32(is_size_var=True)
+        sampled_token_ids = T.match_buffer(var_sampled_token_ids, (num_samples,), "int32")
+        stop_token_indptr = T.match_buffer(var_stop_token_indptr, (num_samples + 1,), "int32")
+        stop_token_ids = T.match_buffer(var_stop_token_ids, (num_stop_tokens,), "int32")
+        num_remaining_tokens = T.match_buffer(var_num_remaining_tokens, (num_samples,), "int32")
+        finished = T.match_buffer(var_finished, (num_samples,), "int32")
+
+        with T.block("kernel"):
+            is_finished = _var()
+            for _bx in T.thread_binding(0, T.ceildiv(num_samples, TX), thread="blockIdx.x"):
+                for _tx in T.thread_binding(0, TX, thread="threadIdx.x"):
+                    with T.block("CTA"):
+                        bx, tx = T.axis.remap("SS", [_bx, _tx])
+                        i = T.meta_var(bx * TX + tx)
+                        if i < num_samples:
+                            is_finished[0] = T.if_then_else(num_remaining_tokens[i] <= 1, 1, 0)
+                            for j in T.serial(stop_token_indptr[i + 1] - stop_token_indptr[i]):
+                                if stop_token_ids[stop_token_indptr[i] + j] == sampled_token_ids[i]:
+                                    is_finished[0] = 1
+                            finished[i] = is_finished[0]
+    # fmt: on
+
+    return _func
@@ -0,0 +1,155 @@
+"""Operators for taking the tokens with top probabilities for logprobs."""
+
+import tvm
+from tvm.script import tir as T
+
+from mlc_llm.support.max_thread_check import get_max_num_threads_per_block
+
+# mypy: disable-error-code="attr-defined,valid-type,name-defined"
+# pylint: disable=too-many-locals,invalid-name,too-many-arguments,unnecessary-lambda
+# pylint: disable=too-many-statements,line-too-long,too-many-nested-blocks,too-many-branches
+
+
+def top_k_probs(k: int, target: tvm.target.Target):
+    """Batched top-k function. This function takes the `k` tokens with top probabilities
+    of each sample, together with the probability of the sampled token.
+
+    Each thread block handles one sample. Every thread keeps a sorted list of the top `k`
+    elements among the elements it visits, in a single pass over the vocabulary.
+    The block then pops the largest head of the thread lists for `k` rounds.
+    So the probabilities are read once, instead of being fully sorted.
+
+    Ties are broken by the smaller token index.
+
+    Parameters
+    ----------
+    probs:
+        The probability distributions.
+
+    sample_indices:
+        The distribution index of each sample.
+
+    sampled_tokens:
+        The sampled token of each sample.
+
+    sampled_values:
+        The probability of the sampled token of each sample.
+
+    top_values:
+        The top `k` probabilities of each sample, in descending order.
+
+    top_indices:
+        The tokens of the top `k` probabilities of each sample.
+    """
+    TX = 256
+
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < TX:
+        TX = max_num_threads_per_block
+
+    def _var(dtype="int32"):
+        return T.alloc_buffer((1,), dtype, scope="local")
+
+    # fmt: off
+    @T.prim_func(private=True)
+    def _func(
+        var_probs: T.handle,
+        var_sample_indices: T.handle,
+        var_sampled_tokens: T.handle,
+        var_sampled_values: T.handle,
+        var_top_values: T.handle,
+        var_top_indices: T.handle,
+    ):
+        T.func_attr({"tir.is_scheduled": 1, "tir.noalias": True})
+        B = T.int32(is_size_var=True)
+        N = T.int32(is_size_var=True)
+        S = T.int32(is_size_var=True)
+        probs = T.match_buffer(var_probs, (B, N), "float32")
+        sample_indices = T.match_buffer(var_sample_indices, (S,), "int32")
+        sampled_tokens = T.match_buffer(var_sampled_tokens, (S,), "int32")
+        sampled_values = T.match_buffer(var_sampled_values, (S,), "float32")
+        top_values = T.match_buffer(var_top_values, (S, k), "float32")
+        top_indices = T.match_buffer(var_top_indices, (S, k), "int32")
+
+        with T.block("kernel"):
+            local_values = T.alloc_buffer((k,), "float32", scope="local")
+            local_indices = T.alloc_buffer((k,), "int32", scope="local")
+            row = _var("int32")
+            num_local = _var("int32")
+            head = _var("int32")
+            pos = _var("int32")
+            moving = _var("bool")
+            value = _var("float32")
+            index = _var("int32")
+            max_value = _var("float32")
+            min_index = _var("int32")
+
+            for _bx in T.thread_binding(0, S, thread="blockIdx.x"):
+                for _tx in T.thread_binding(0, TX, thread="threadIdx.x"):
+                    with T.block("CTA"):
+                        b, tx = T.axis.remap("SS", [_bx, _tx])
+
+                        row[0] = sample_indices[b]
+                        num_local[0] = 0
+                        # Keep the top k elements visited by this thread, in descending order.
+                        # The elements are visited in ascending index, so a tie never moves
+                        # before an existing element.
+                        for i in T.serial(T.ceildiv(N, TX)):
+                            idx = T.meta_var(i * TX + tx)
+                            if idx < N:
+                                value[0] = probs[row[0], idx]
+                                pos[0] = -1
+                                if num_local[0] < k:
+                                    pos[0] = num_local[0]
+                                    num_local[0] += 1
+                                elif value[0] > local_values[k - 1]:
+                                    pos[0] = k - 1
+                                if pos[0] >= 0:
+                                    moving[0] = True
+                                    while moving[0]:
+                                        if pos[0] == 0:
+                                            moving[0] = False
+                                        elif local_values[pos[0] - 1] < value[0]:
+                                            local_values[pos[0]] = local_values[pos[0] - 1]
+                                            local_indices[pos[0]] = local_indices[pos[0] - 1]
+                                            pos[0] -= 1
+                                        else:
+                                            moving[0] = False
+                                    local_values[pos[0]] = value[0]
+                                    local_indices[pos[0]] = idx
+
+                        # Pop the largest head of the thread lists for k rounds.
+                        head[0] = 0
+                        for j in T.serial(k):
+                            value[0] = T.if_then_else(head[0] < num_local[0], local_values[head[0]], T.float32(-1))
+                            with T.block("block_cross_thread_max"):
+                                T.reads(value[0])
+                                T.writes(max_value[0])
+                                T.attr(
+                                    T.comm_reducer(lambda x0, y0: T.max(x0, y0), [T.float32(-1)]),
+                                    "reduce_scope",
+                                    T.reinterpret("handle", T.uint64(0)),
+                                )
+                                T.tvm_thread_allreduce(T.uint32(1), value[0], True, max_value[0], tx, dtype="handle")
+                            index[0] = T.if_then_else(head[0] < num_local[0] and value[0] == max_value[0], local_indices[head[0]], N)
+                            with T.block("block_cross_thread_min"):
+                                T.reads(index[0])
+                                T.writes(min_index[0])
+                                T.attr(
+                                    T.comm_reducer(lambda x0, y0: T.min(x0, y0), [T.int32(2147483647)]),
+                                    "reduce_scope",
+                                    T.reinterpret("handle", T.uint64(0)),
+                                )
+                                T.tvm_thread_allreduce(T.uint32(1), index[0], True, min_index[0], tx, dtype="handle")
+                            if index[0] == min_index[0] and index[0] < N:
+                                # The owner thread of the popped element moves its head.
+                                head[0] += 1
+                            if tx == 0:
+                                top_values[b, j] = T.max(max_value[0], T.float32(0))
+                                top_indices[b, j] = T.min(min_index[0], N - 1)
+
+                        if tx == 0:
+                            sampled_values[b] = probs[row[0], sampled_tokens[b]]
+    # fmt: on
+
+    return _func
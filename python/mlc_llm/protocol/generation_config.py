@@ -1,7 +1,7 @@
 """Low-level generation config class"""
 
 # pylint: disable=missing-class-docstring, disable=too-many-instance-attributes
-from typing import Dict, List, Optional
+from typing import Dict, List, Literal, Optional
 
 from pydantic import BaseModel
 
@@ -18,16 +18,34 @@ class GenerationConfig(BaseModel):  # pylint:
     n: int = 1
     temperature: Optional[float] = None
     top_p: Optional[float] = None
+    min_p: Optional[float] = None
+    typical_p: Optional[float] = None
+    # beam search with n beams, returning the n best finished beams
+    use_beam_search: bool = False
+    length_penalty: Optional[float] = None
     frequency_penalty: Optional[float] = None
     presence_penalty: Optional[float] = None
     repetition_penalty: Optional[float] = None
     logprobs: bool = False
     top_logprobs: int = 0
+    # return the logprobs of the prompt tokens, with "top_logprobs" top tokens at each position
+    prompt_logprobs: bool = False
     logit_bias: Optional[Dict[int, float]] = None
     # internally we use -1 to represent infinite
     max_tokens: int = -1
     seed: Optional[int] = None
     stop_strs: Optional[List[str]] = None
     stop_token_ids: Optional[List[int]] = None
+    # scheduling hints, only effective under the "priority" scheduling policy
+    priority: int = 0
+    ttft_deadline_ms: Optional[float] = None
+    tpot_deadline_ms: Optional[float] = None
+    # the tenant of the request, only effective under the "fair" scheduling policy
+    tenant_id: Optional[str] = None
+    # the name of the LoRA adapter registered in the engine, None means the base model
+    lora_adapter: Optional[str] = None
+    # the pooling of the prompt hidden states for an embedding request, which returns the
+    # prompt embedding instead of generated tokens, "none" means a generation request
+    embedding_pooling: Literal["none", "last", "mean"] = "none"
     response_format: Optional[RequestResponseFormat] = None
     debug_config: Optional[Optional[DebugConfig]] = None
@@ -86,12 +86,21 @@ class ModelResponse(BaseModel):
 
 
 class RequestResponseFormat(BaseModel):
-    type: Literal["text", "json_object"] = "text"
+    type: Literal["text", "json_object", "regex"] = "text"
     json_schema: Optional[str] = Field(default=None, alias="schema")
     """This field is named json_schema instead of schema because BaseModel defines a method called
     schema. During construction of RequestResponseFormat, key "schema" still should be used:
     `RequestResponseFormat(type="json_object", schema="{}")`
     """
+    regex: Optional[str] = None
+    """The regular expression that the output fully matches. Required when type is "regex"."""
+
+    @model_validator(mode="after")
+    def check_regex(self) -> "RequestResponseFormat":
+        """Check that the regex is given for the regex response format."""
+        if self.type == "regex" and self.regex is None:
+            raise ValueError('"regex" is required when the response format type is "regex".')
+        return self
 
 
 class CompletionRequest(BaseModel):
@@ -116,8 +125,20 @@ class CompletionRequest(BaseModel):
     suffix: Optional[str] = None
     temperature: Optional[float] = None
     top_p: Optional[float] = None
+    # NOTE: min_p and typical_p are not part of OpenAI protocol
+    min_p: Optional[float] = None
+    typical_p: Optional[float] = None
+    # NOTE: beam search is not part of OpenAI protocol
+    use_beam_search: bool = False
+    length_penalty: Optional[float] = None
     user: Optional[str] = None
     response_format: Optional[RequestResponseFormat] = None
+    # NOTE: the scheduling fields are not part of OpenAI protocol
+    priority: int = 0
+    ttft_deadline_ms: Optional[float] = None
+    tpot_deadline_ms: Optional[float] = None
+    # NOTE: lora_adapter is not part of OpenAI protocol
+    lora_adapter: Optional[str] = None
     debug_config: Optional[DebugConfig] = None
 
     @field_validator("frequency_penalty", "presence_penalty")
@@ -227,10 +248,22 @@ class ChatCompletionRequest(BaseModel):
     stream_options: Optional[StreamOptions] = None
     temperature: Optional[float] = None
     top_p: Optional[float] = None
+    # NOTE: min_p and typical_p are not part of OpenAI protocol
+    min_p: Optional[float] = None
+    typical_p: Optional[float] = None
+    # NOTE: beam search is not part of OpenAI protocol
+    use_beam_search: bool = False
+    length_penalty: Optional[float] = None
     tools: Optional[List[ChatTool]] = None
     tool_choice: Optional[Union[Literal["none", "auto"], Dict]] = None
     user: Optional[str] = None
     response_format: Optional[RequestResponseFormat] = None
+    # NOTE: the scheduling fields are not part of OpenAI protocol
+    priority: int = 0
+    ttft_deadline_ms: Optional[float] = None
+    tpot_deadline_ms: Optional[float] = None
+    # NOTE: lora_adapter is not part of OpenAI protocol
+    lora_adapter: Optional[str] = None
     # NOTE: debug_config is not part of OpenAI protocol
     # we add it to enable extra debug options
     debug_config: Optional[DebugConfig] = None
@@ -364,14 +397,14 @@ class ChatCompletionRequest(BaseModel):
 
 
 class ChatCompletionResponseChoice(BaseModel):
-    finish_reason: Optional[Literal["stop", "length", "tool_calls", "error"]] = None
+    finish_reason: Optional[Literal["stop", "length", "tool_calls", "error", "abort"]] = None
     index: int = 0
     message: ChatCompletionMessage
     logprobs: Optional[LogProbs] = None
 
 
 class ChatCompletionStreamResponseChoice(BaseModel):
-    finish_reason: Optional[Literal["stop", "length", "tool_calls", "error"]] = None
+    finish_reason: Optional[Literal["stop", "length", "tool_calls", "error", "abort"]] = None
     index: int = 0
     delta: ChatCompletionMessage
     logprobs: Optional[LogProbs] = None
@@ -2,7 +2,7 @@
 
 import json
 from dataclasses import asdict, dataclass, field
-from typing import List, Literal, Optional, Tuple, Union
+from typing import Dict, List, Literal, Optional, Tuple, Union
 
 
 @dataclass
@@ -22,6 +22,16 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
         Each element is a single string (denoting the model directory)
         or a tuple of two strings (denoting the model directory and model lib path).
 
+    lora_adapters : List[str]
+        The paths to the LoRA adapter directories of the model. Each adapter is
+        named by its directory name, and requests pick an adapter by name with the
+        "lora_adapter" field of generation config. The model library needs to be
+        compiled with LoRA support.
+
+    max_num_resident_lora_adapters : int
+        The maximum number of LoRA adapters whose weights stay on GPU at the same time.
+        The other adapters are loaded on demand, evicting the least recently used ones.
+
     mode : Literal["local", "interactive", "server"]
         The engine mode in MLC LLM.
         We provide three preset modes: "local", "interactive" and "server".
@@ -61,6 +71,11 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
     kv_cache_page_size : int
         The number of consecutive tokens handled in each page in paged KV cache.
 
+    kv_cache_dtype : str
+        The storage dtype of the KV data in KV cache, or "auto" to use the dtype
+        the model lib is compiled with. The KV storage dtype is decided at model
+        compilation, and the engine checks that the model lib matches the given dtype.
+
     max_num_sequence : Optional[int]
         The maximum number of sequences that are allowed to be
         processed by the KV cache at any time.
@@ -87,48 +102,247 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
     kv_state_kind: Optional[Literal["kv_cache", "rnn_state"]]
         The kind of cache.
 
-    speculative_mode : Literal["disable", "small_draft", "eagle", "medusa"]
+    speculative_mode : Literal["disable", "small_draft", "eagle", "medusa", "prompt_lookup"]
         The speculative mode.
         "disable" means speculative decoding is disabled.
         "small_draft" means the normal speculative decoding (small draft) mode.
         "eagle" means the eagle-style speculative decoding.
         "medusa" means the medusa-style speculative decoding.
+        "prompt_lookup" means the draft tokens are proposed by n-gram matching in the
+        prompt and generated tokens, without a draft model.
 
     spec_draft_length : int
         The number of tokens to generate in speculative proposal (draft).
         Being 0 means to enable adaptive speculative mode, where the draft length
-        will be automatically adjusted based on engine state.
+        will be automatically adjusted based on engine state. The "prompt_lookup" mode
+        does not support the adaptive draft length, where being 0 means the draft length 4.
 
     spec_tree_width : int
         The width of the speculative decoding tree.
 
-    prefix_cache_mode : Literal["disable", "radix"]
+    spec_tree_token_budget : int
+        The max number of draft tokens of each request in a speculative decoding step
+        under the token tree mode. When positive, the token tree grows in a dynamic shape,
+        where each draft round adds the "spec_tree_width" candidates with the highest draft
+        path probabilities. Being 0 means the fixed tree shape.
+
+    spec_auto_disable : bool
+        Whether to switch to normal mode batch decode in the steps where the cost model
+        of the measured draft, verify and decode times expects speculative decoding to be
+        slower, e.g., under high batch load. It applies to the "small_draft" speculative mode.
+
+    spec_optimistic_draft : bool
+        Whether to feed the last draft token of each request into the draft model right
+        after launching the verification, optimistically assuming the draft is fully
+        accepted, so that the draft model forward is not launched after the verification
+        result arrives. The rejected drafts are rolled back from the draft model.
+        It applies to the chain drafts (spec_tree_width=1) of the "small_draft" mode.
+
+    prefix_cache_mode : Literal["disable", "radix", "shared"]
         The prefix cache mode.
         "disable" means no prefix cache is disabled.
         "radix" means the paged radix tree based prefix cache mode.
+        "shared" means the paged radix tree based prefix cache mode, which additionally
+        shares prefixes with the engines of other processes on the same node through
+        host shared memory.
 
     prefix_cache_max_num_recycling_seqs: Optional[int]
         The maximum number of recycling sequences in prefix cache, default as max_num_sequence.
         And set 0 to disable prefix cache, set -1 to have infinite capacity prefix cache.
 
+    prefix_cache_eviction_policy : Literal["lru", "cost_aware"]
+        The policy to pick the recycling sequence to evict from prefix cache.
+        "lru" evicts the least recently used sequence.
+        "cost_aware" evicts the sequence with the lowest priority weighing the recompute
+        cost of the tokens freed by the eviction, the number of hits and the recency.
+
+    prefix_cache_keep_aborted_min_tokens : int
+        The minimum number of prefilled tokens of an aborted request to keep its KV
+        data in prefix cache as a recycling sequence, as a long aborted prompt is likely
+        to be sent again by a retrying client. The KV data of the other aborted requests
+        are released immediately. Set 0 to always release the KV data of aborted requests.
+
+    prefix_cache_compaction_max_num_tokens : int
+        The maximum number of tokens whose KV data are compacted per idle engine step.
+        When the engine has no request, the recycling sequences of prefix cache whose
+        KV data span several forked blocks are copied into fresh pages, reclaiming the
+        partially filled pages at the fork boundaries. Set 0 to disable the compaction.
+
+    prefix_cache_max_num_host_tokens : int
+        The maximum number of tokens whose KV data are offloaded to host memory
+        when evicted from prefix cache, so that they can be restored instead of
+        recomputed when matched again. Set 0 to disable the host memory tier.
+
+    prefix_cache_max_num_disk_tokens : int
+        The maximum number of tokens whose KV data are further offloaded to disk
+        when evicted from the host memory tier. Set 0 to disable the disk tier.
+
+    prefix_cache_disk_path : str
+        The directory to store the prefix cache KV data offloaded to disk.
+
+    kv_session_dir : str
+        The directory to store the KV snapshots of conversation sessions saved by
+        `save_session`, which are restored into prefix cache by `restore_session`
+        when the sessions resume. Empty to disable the session snapshots.
+
+    prefix_cache_shared_memory_name : str
+        The name of the host shared memory to share prefixes across engine processes
+        under the "shared" prefix cache mode. Engines must run the same model to
+        share a name.
+
+    prefix_cache_shared_memory_bytes : int
+        The capacity in bytes of the host shared memory under the "shared" prefix cache mode.
+
+    image_embedding_cache_bytes : int
+        The capacity in bytes of the device-resident LRU cache of image embeddings
+        per model, which reuses the embedding of an image sent again.
+        Set 0 to disable the cache.
+
+    grammar_cache_dir : str
+        The directory to persist the grammar preprocessing results in, so that the
+        preprocessing of a grammar is reused across engine restarts.
+        Empty means no persistence.
+
+    scheduling_policy : Literal["fcfs", "priority", "fair"]
+        The request scheduling policy.
+        "fcfs" means requests are admitted in arrival order, and the latest
+        running request is preempted first.
+        "priority" means requests are admitted and preempted by their
+        "priority" first, and then by their TTFT/TPOT deadlines in generation config.
+        "fair" means the tenants, identified by the "tenant_id" in generation config,
+        share the prefill tokens and decode slots in proportion to their weights.
+
+    tenant_weights : Dict[str, float]
+        The weights of tenants under the "fair" scheduling policy.
+        The tenants not listed have weight 1.
+
+    tenant_max_tokens_per_s : float
+        The maximum number of tokens per second processed for each tenant under
+        the "fair" scheduling policy. New requests of a tenant over the rate are
+        not admitted until its rate falls back. Zero means unlimited.
+
+    preemption_mode : Literal["recompute", "swap"]
+        The preemption mode.
+        "recompute" means the KV data of preempted requests are dropped and
+        recomputed via prefill when the requests resume.
+        "swap" means the KV data of preempted requests are swapped out to host
+        memory and swapped back in when the requests resume. Requests that cannot
+        be swapped fall back to recompute.
+
+    kv_swap_max_num_tokens : Optional[int]
+        The maximum total number of tokens whose KV data are allowed to be swapped
+        out to host memory at any time under the "swap" preemption mode.
+        Default as max_total_sequence_length.
+
     prefill_mode : Literal["chunked", "hybrid"]
         The prefill mode.
         "chunked" means the basic prefill with chunked input enabled.
         "hybrid" means the hybrid prefill or split-fuse,
         so that decode step will be converted into prefill.
 
+    target_inter_token_latency_ms : float
+        The target inter-token latency in milliseconds of the running requests
+        under the "hybrid" prefill mode. When positive, the per-step prefill token
+        budget is tuned online from the measured step latency, so that the decode
+        requests fused into prefill keep the target latency. The budget never
+        exceeds the prefill chunk size. Set 0 to always use the prefill chunk size.
+
+    long_prefill_chunk_size : int
+        The maximum number of prompt tokens of a single request to prefill in a step
+        when there are running requests. Longer prompts are chunked across steps and
+        interleaved with the decode of the running requests, which are fused into the
+        prefill under the "hybrid" prefill mode and run in alternate steps otherwise,
+        so that a long prompt does not stall decode for its whole prefill.
+        Set 0 to chunk prompts only by the prefill token budget.
+
+    reserve_decode_kv_pages : bool
+        Whether to reserve KV cache pages for the expected decode growth of the
+        running requests when admitting new requests to prefill. The output length
+        of each request is predicted from the average output length of the finished
+        requests, capped by its "max_tokens", so that the admitted requests are less
+        likely to be preempted later.
+
+    auto_tune : bool
+        Whether to tune "max_num_sequence" and "prefill_chunk_size" at engine startup
+        by short synthetic prefill/decode sweeps on the device, picking the config with
+        the highest throughput that meets "target_inter_token_latency_ms" (when positive).
+        The values explicitly specified are not tuned. The tuned result is cached per
+        device and model under MLC_LLM_HOME.
+
+    disaggregation_role : Literal["none", "prefill", "decode"]
+        The role of the engine in disaggregated prefill and decode serving.
+        "none" means the engine runs both the prefill and the decode of requests.
+        "prefill" means the engine runs the prefill of requests, and hands the
+        prefilled requests off to the paired decode engines.
+        "decode" means the engine decodes the requests handed off by prefill engines.
+        Engines are paired with "pair_decode_engines", and the KV data are
+        transferred through host memory.
+
+    overlap_stream_callback : bool
+        A boolean indicating whether to defer the request stream callback of each
+        engine step until the next step has launched its GPU work, so that the
+        callback overhead overlaps with the GPU execution.
+
+    decode_batch_size_buckets : List[int]
+        The batch size buckets of batch decode. When specified, the batch decode
+        pads the batch size to the smallest bucket covering it, so that the CUDA
+        graphs captured by the model library (compiled with "cudagraph=1") are
+        replayed at a small fixed set of batch sizes. Empty means no padding.
+
+    num_decode_steps : int
+        The number of decode steps the batch decode runs back-to-back on device in
+        an engine step, when none of the running requests needs its tokens on host
+        in every step (e.g., for stop strings, grammars, penalties or logprobs).
+        The tokens of all the steps are post-processed at once, which trades the
+        streaming granularity for throughput at small batch sizes.
+        Value 1 means one decode step per engine step.
+
+    batch_invariant_sampling : bool
+        A boolean indicating whether to sample every request in the same way
+        regardless of the other requests in the batch, so that the outputs of a
+        request with a fixed seed are reproducible under any batch composition.
+        The sampler applies the top-p (and min-p, typical-p) filters and the sorted
+        sampling to every distribution, the tokens are always sampled on host, and
+        the random stream of each request restarts at its number of committed tokens
+        in every engine step. It costs sampling throughput.
+
     verbose : bool
         A boolean indicating whether to print logging info in engine.
+
+    enable_device_timing : bool
+        A boolean indicating whether to time the device work (embedding, prefill,
+        decode, logit processing and sampling) of each engine step with device timers,
+        so that the device time is reported separately from the host time in the
+        engine metrics.
+
+    step_watchdog_threshold_ms : float
+        The latency threshold in milliseconds of an engine step, beyond which the
+        engine logs the latency breakdown of the step (per action and per device
+        time kind when device timing is enabled) as a warning.
+        Zero disables the step watchdog.
+
+    stream_flush_interval_ms : float
+        The max time in milliseconds to hold the stream outputs before invoking the
+        request stream callback. The outputs of a request held in the meantime are
+        merged into one, so that a larger interval means fewer callback invocations.
+        Zero means invoking the callback as soon as there are outputs.
+
+    stream_flush_max_outputs : int
+        The number of held request stream outputs which triggers the callback
+        invocation before the flush interval elapses. Zero means no limit.
     """
 
     model: Optional[str] = None
     model_lib: Optional[str] = None
     additional_models: List[Union[str, Tuple[str, str]]] = field(default_factory=list)
+    lora_adapters: List[str] = field(default_factory=list)
+    max_num_resident_lora_adapters: int = 8
     mode: Optional[Literal["local", "interactive", "server"]] = None
     tensor_parallel_shards: Optional[int] = None
     pipeline_parallel_stages: Optional[int] = None
     gpu_memory_utilization: Optional[float] = None
     kv_cache_page_size: int = 16
+    kv_cache_dtype: str = "auto"
     max_num_sequence: Optional[int] = None
     max_total_sequence_length: Optional[int] = None
     max_single_sequence_length: Optional[int] = None
@@ -137,13 +351,47 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
     attention_sink_size: Optional[int] = None
     max_history_size: Optional[int] = None
     kv_state_kind: Optional[Literal["kv_cache", "rnn_state"]] = None
-    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa"] = "disable"
+    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa", "prompt_lookup"] = (
+        "disable"
+    )
     spec_draft_length: int = 0
     spec_tree_width: int = 1
-    prefix_cache_mode: Literal["disable", "radix"] = "radix"
+    spec_tree_token_budget: int = 0
+    spec_auto_disable: bool = True
+    spec_optimistic_draft: bool = False
+    prefix_cache_mode: Literal["disable", "radix", "shared"] = "radix"
     prefix_cache_max_num_recycling_seqs: Optional[int] = None
+    prefix_cache_eviction_policy: Literal["lru", "cost_aware"] = "lru"
+    prefix_cache_keep_aborted_min_tokens: int = 0
+    prefix_cache_compaction_max_num_tokens: int = 0
+    prefix_cache_max_num_host_tokens: int = 0
+    prefix_cache_max_num_disk_tokens: int = 0
+    prefix_cache_disk_path: str = ""
+    kv_session_dir: str = ""
+    prefix_cache_shared_memory_name: str = "mlc_llm_prefix_cache"
+    prefix_cache_shared_memory_bytes: int = 1 << 30
+    image_embedding_cache_bytes: int = 0
+    grammar_cache_dir: str = ""
+    scheduling_policy: Literal["fcfs", "priority", "fair"] = "fcfs"
+    tenant_weights: Dict[str, float] = field(default_factory=dict)
+    tenant_max_tokens_per_s: float = 0.0
+    preemption_mode: Literal["recompute", "swap"] = "recompute"
+    kv_swap_max_num_tokens: Optional[int] = None
     prefill_mode: Literal["chunked", "hybrid"] = "hybrid"
+    target_inter_token_latency_ms: float = 0.0
+    long_prefill_chunk_size: int = 0
+    reserve_decode_kv_pages: bool = True
+    auto_tune: bool = False
+    disaggregation_role: Literal["none", "prefill", "decode"] = "none"
+    overlap_stream_callback: bool = False
+    decode_batch_size_buckets: List[int] = field(default_factory=list)
+    num_decode_steps: int = 1
+    batch_invariant_sampling: bool = False
     verbose: bool = True
+    enable_device_timing: bool = False
+    step_watchdog_threshold_ms: float = 0
+    stream_flush_interval_ms: float = 0
+    stream_flush_max_outputs: int = 0
 
     def asjson(self) -> str:
         """Return the config in string of JSON format."""
@@ -0,0 +1,281 @@
+"""Startup tuning of the engine config on the actual device.
+
+The engine config inference in C++ chooses "max_num_sequence" and "prefill_chunk_size"
+from static memory estimates. The tuning here runs short synthetic prefill/decode
+sweeps of candidate configs on the device, and picks the config with the highest
+throughput among the ones meeting the inter-token latency target. The tuned result
+is cached per device and model.
+"""
+
+import gc
+import hashlib
+import json
+import random
+import time
+from dataclasses import asdict, dataclass, replace
+from pathlib import Path
+from typing import List, Literal, Optional
+
+import tvm
+
+from mlc_llm.protocol.debug_protocol import DebugConfig
+from mlc_llm.protocol.generation_config import GenerationConfig
+from mlc_llm.serve.config import EngineConfig
+from mlc_llm.support import logging
+from mlc_llm.support.constants import MLC_LLM_HOME
+
+logger = logging.getLogger(__name__)
+
+# The number of tokens every synthetic request decodes.
+_BENCHMARK_DECODE_LENGTH = 32
+# The maximum prompt length of the synthetic requests.
+_BENCHMARK_MAX_PROMPT_LENGTH = 256
+# The number of halvings of the inferred config values to sweep.
+_NUM_MAX_NUM_SEQUENCE_CANDIDATES = 3
+_NUM_PREFILL_CHUNK_SIZE_CANDIDATES = 2
+
+
+@dataclass
+class TuningSample:
+    """The measurement of one candidate engine config."""
+
+    max_num_sequence: int
+    prefill_chunk_size: int
+    throughput: float
+    """The output tokens per second of the synthetic workload."""
+    inter_token_latency_ms: float
+    """The p90 inter-token latency in milliseconds of the synthetic requests."""
+
+
+def _get_cache_path(
+    model: str,
+    model_lib: Optional[str],
+    device: tvm.runtime.Device,
+    mode: str,
+    engine_config: EngineConfig,
+) -> Path:
+    # Every engine config field can change the memory estimates or the measured throughput,
+    # so the key has all of them except the ones only controlling the logging and the tuning.
+    key_fields = {
+        name: value
+        for name, value in asdict(engine_config).items()
+        if name not in ("auto_tune", "verbose")
+    }
+    key_fields.update(
+        {
+            "model": str(Path(model).resolve()) if Path(model).exists() else model,
+            "model_lib": model_lib,
+            "device": f"{device.device_name}:{device.device_id}:{device.device_type}",
+            "mode": mode,
+        }
+    )
+    key = json.dumps(key_fields, sort_keys=True, default=str)
+    digest = hashlib.sha256(key.encode("utf-8")).hexdigest()[:16]
+    return MLC_LLM_HOME / "engine_config_tuning" / f"{digest}.json"
+
+
+def _candidate_values(inferred: int, num_candidates: int) -> List[int]:
+    values = []
+    value = inferred
+    for _ in range(num_candidates):
+        if value < 1 or value in values:
+            break
+        values.append(value)
+        value //= 2
+    return values
+
+
+def _measure(  # pylint: disable=too-many-locals
+    model: str,
+    device: tvm.runtime.Device,
+    model_lib: Optional[str],
+    mode: Literal["local", "interactive", "server"],
+    engine_config: EngineConfig,
+) -> TuningSample:
+    from mlc_llm.serve.sync_engine import (  # pylint: disable=import-outside-toplevel
+        SyncMLCEngine,
+    )
+
+    # The engine fills the model fields of the config, so a copy is passed.
+    engine = SyncMLCEngine(
+        model=model,
+        device=device,
+        model_lib=model_lib,
+        mode=mode,
+        engine_config=replace(engine_config),
+    )
+    num_requests = engine.engine_config.max_num_sequence
+    prompt_length = min(
+        _BENCHMARK_MAX_PROMPT_LENGTH,
+        engine.engine_config.max_total_sequence_length // num_requests - _BENCHMARK_DECODE_LENGTH,
+    )
+    prompt_length = max(prompt_length, 1)
+    vocab_size = engine.model_config_dicts[0]["vocab_size"]
+    # Random prompts, so that the requests share no prefix.
+    rng = random.Random(0)
+    prompts = [
+        [rng.randrange(vocab_size) for _ in range(prompt_length)] for _ in range(num_requests)
+    ]
+    generation_config = GenerationConfig(
+        temperature=0.0,
+        max_tokens=_BENCHMARK_DECODE_LENGTH,
+        debug_config=DebugConfig(ignore_eos=True),
+    )
+    tstart = time.perf_counter()
+    engine.generate(prompts, generation_config)
+    elapsed = time.perf_counter() - tstart
+    metrics = engine.metrics()
+    sample = TuningSample(
+        max_num_sequence=engine.engine_config.max_num_sequence,
+        prefill_chunk_size=engine.engine_config.prefill_chunk_size,
+        throughput=metrics["completion_tokens_sum"] / elapsed,
+        inter_token_latency_ms=metrics["latency_histograms"]["inter_token_latency_s"]["p90"]
+        * 1000,
+    )
+    # Release the engine and its KV cache before measuring the next candidate.
+    del engine
+    gc.collect()
+    return sample
+
+
+def _pick_sample(samples: List[TuningSample], target_inter_token_latency_ms: float) -> TuningSample:
+    """Pick the highest throughput sample on the Pareto front of throughput and latency
+    that meets the latency target, or the lowest latency sample if none meets the target."""
+    pareto_front = [
+        sample
+        for sample in samples
+        if not any(
+            other.throughput >= sample.throughput
+            and other.inter_token_latency_ms <= sample.inter_token_latency_ms
+            and other is not sample
+            and (
+                other.throughput > sample.throughput
+                or other.inter_token_latency_ms < sample.inter_token_latency_ms
+            )
+            for other in samples
+        )
+    ]
+    if target_inter_token_latency_ms > 0:
+        meeting_target = [
+            sample
+            for sample in pareto_front
+            if sample.inter_token_latency_ms <= target_inter_token_latency_ms
+        ]
+        if not meeting_target:
+            return min(pareto_front, key=lambda sample: sample.inter_token_latency_ms)
+        pareto_front = meeting_target
+    return max(pareto_front, key=lambda sample: sample.throughput)
+
+
+def _fill_unset_fields(
+    engine_config: EngineConfig, max_num_sequence: int, prefill_chunk_size: int
+) -> EngineConfig:
+    """Fill the tuned values into the fields left unset by the user."""
+    return replace(
+        engine_config,
+        max_num_sequence=(
+            engine_config.max_num_sequence
+            if engine_config.max_num_sequence is not None
+            else max_num_sequence
+        ),
+        prefill_chunk_size=(
+            engine_config.prefill_chunk_size
+            if engine_config.prefill_chunk_size is not None
+            else prefill_chunk_size
+        ),
+    )
+
+
+def tune_engine_config(  # pylint: disable=too-many-locals
+    model: str,
+    device: tvm.runtime.Device,
+    model_lib: Optional[str],
+    mode: Literal["local", "interactive", "server"],
+    engine_config: EngineConfig,
+) -> EngineConfig:
+    """Tune "max_num_sequence" and "prefill_chunk_size" of the engine config on the device.
+
+    The candidates are the values inferred from the memory estimates and their halvings,
+    except the values explicitly specified in the given engine config. Each candidate is
+    measured by a synthetic workload of "max_num_sequence" requests, and the config with
+    the highest throughput whose p90 inter-token latency meets
+    "engine_config.target_inter_token_latency_ms" (when positive) is picked.
+    The result is cached under MLC_LLM_HOME, and reused by later startups.
+
+    Parameters
+    ----------
+    model : str
+        The model of the engine.
+
+    device : tvm.runtime.Device
+        The device to tune on.
+
+    model_lib : Optional[str]
+        The model library of the engine.
+
+    mode : Literal["local", "interactive", "server"]
+        The engine mode.
+
+    engine_config : EngineConfig
+        The engine config to tune.
+
+    Returns
+    -------
+    tuned_engine_config : EngineConfig
+        The engine config with the tuned "max_num_sequence" and "prefill_chunk_size",
+        where the values specified in the given engine config are kept.
+    """
+    cache_path = _get_cache_path(model, model_lib, device, mode, engine_config)
+    base_config = replace(engine_config, auto_tune=False, verbose=False)
+    if cache_path.exists():
+        with open(cache_path, "r", encoding="utf-8") as file:
+            cached = json.load(file)
+        logger.info("Using the cached tuned engine config %s: %s", cache_path, cached)
+        return _fill_unset_fields(
+            engine_config, cached["max_num_sequence"], cached["prefill_chunk_size"]
+        )
+
+    # Measure the inferred config first, which also tells the inferred values.
+    inferred_sample = _measure(model, device, model_lib, mode, base_config)
+    max_num_sequence_candidates = (
+        [engine_config.max_num_sequence]
+        if engine_config.max_num_sequence is not None
+        else _candidate_values(inferred_sample.max_num_sequence, _NUM_MAX_NUM_SEQUENCE_CANDIDATES)
+    )
+    prefill_chunk_size_candidates = (
+        [engine_config.prefill_chunk_size]
+        if engine_config.prefill_chunk_size is not None
+        else _candidate_values(
+            inferred_sample.prefill_chunk_size, _NUM_PREFILL_CHUNK_SIZE_CANDIDATES
+        )
+    )
+    samples = [inferred_sample]
+    for max_num_sequence in max_num_sequence_candidates:
+        for prefill_chunk_size in prefill_chunk_size_candidates:
+            if (
+                max_num_sequence == inferred_sample.max_num_sequence
+                and prefill_chunk_size == inferred_sample.prefill_chunk_size
+            ):
+                continue
+            samples.append(
+                _measure(
+                    model,
+                    device,
+                    model_lib,
+                    mode,
+                    replace(
+                        base_config,
+                        max_num_sequence=max_num_sequence,
+                        prefill_chunk_size=prefill_chunk_size,
+                    ),
+                )
+            )
+    for sample in samples:
+        logger.info("Engine config tuning sample: %s", sample)
+    picked = _pick_sample(samples, engine_config.target_inter_token_latency_ms)
+    logger.info("Picked the tuned engine config: %s", picked)
+
+    cache_path.parent.mkdir(parents=True, exist_ok=True)
+    with open(cache_path, "w", encoding="utf-8") as file:
+        json.dump(asdict(picked), file)
+    return _fill_unset_fields(engine_config, picked.max_num_sequence, picked.prefill_chunk_size)
@@ -149,6 +149,15 @@ class SingleRequestStreamOutput:
     finish_reason : Optional[str]
         The finish reason of the request when it is finished,
         of None if the request has not finished yet.
+
+    embedding : Optional[List[float]]
+        The prompt embedding of an embedding request when it is finished,
+        or None otherwise.
+
+    prompt_logprob_json_strs : Optional[List[str]]
+        The logprobs JSON strings of the prompt tokens computed since last invocation,
+        for the requests with "prompt_logprobs". The prompt is shared by all the outputs of
+        a request, and only the first output carries the prompt logprobs.
     """
 
     delta_token_ids: List[int]
@@ -156,6 +165,8 @@ class SingleRequestStreamOutput:
     finish_reason: Optional[str]
     request_final_usage_json_str: Optional[str]
     extra_prefix_string: str
+    embedding: Optional[List[float]] = None
+    prompt_logprob_json_strs: Optional[List[str]] = None
 
 
 @tvm._ffi.register_object("mlc.serve.RequestStreamOutput")  # pylint: disable=protected-access
@@ -196,6 +207,8 @@ class RequestStreamOutput(Object):
                 [SingleRequestStreamOutput([], None, None, request_final_usage_json_str, "")],
             )
 
+        embedding = fields[6].numpy().tolist() if fields[6] is not None else None
+        prompt_logprob_json_strs = [str(logprob_json_str) for logprob_json_str in fields[7]]
         stream_outputs = []
         for i, (delta_token_ids, finish_reason, extra_prefix_string) in enumerate(
             zip(fields[1], fields[3], fields[5])
@@ -212,6 +225,10 @@ class RequestStreamOutput(Object):
                     finish_reason=str(finish_reason) if finish_reason is not None else None,
                     request_final_usage_json_str=None,
                     extra_prefix_string=str(extra_prefix_string),
+                    embedding=embedding,
+                    prompt_logprob_json_strs=(
+                        prompt_logprob_json_strs if i == 0 and prompt_logprob_json_strs else None
+                    ),
                 )
             )
         return request_id, stream_outputs
@@ -9,7 +9,7 @@ import numbers
 import queue
 import sys
 import threading
-from dataclasses import dataclass
+from dataclasses import dataclass, replace
 from pathlib import Path
 from typing import Any, Callable, Dict, List, Literal, Optional, Tuple, Union
 
@@ -257,7 +257,44 @@ class EngineMetrics:
                     if isinstance(value, dict) and len(value) != 0:
                         traverse(f"{comment_scope}/{key}", f"{key_prefix}{key}_", value)
 
-        traverse("", "", self.metrics)
+        metrics = dict(self.metrics)
+        histograms = metrics.pop("latency_histograms", {})
+        traverse("", "", metrics)
+
+        # Render the latency histograms as prometheus histograms, with the
+        # percentiles reported in a separate "<name>_quantile" metric.
+        # NOTE: the keys are sorted, so the histograms of the same name are adjacent.
+        quantile_lines = {}
+        for key, histogram in histograms.items():
+            name, _, labels = key.partition("{")
+            labels = ",".join(
+                f'{label_key}="{label_value}"'
+                for label_key, _, label_value in (
+                    item.partition("=") for item in labels.rstrip("}").split(",") if item
+                )
+            )
+            prefix = labels + "," if labels else ""
+            label_suffix = f"{{{labels}}}" if labels else ""
+            if name not in quantile_lines:
+                output_lines.append(f"\n# TYPE {name} histogram")
+                quantile_lines[name] = []
+            for upper_bound, cumulative_count in histogram.get("buckets", []):
+                output_lines.append(
+                    f'{name}_bucket{{{prefix}le="{upper_bound}"}}\t{cumulative_count}'
+                )
+            output_lines.append(f'{name}_bucket{{{prefix}le="+Inf"}}\t{histogram["count"]}')
+            output_lines.append(f"{name}_sum{label_suffix}\t{histogram['sum']}")
+            output_lines.append(f"{name}_count{label_suffix}\t{histogram['count']}")
+            for quantile_key, quantile in [("p50", "0.5"), ("p90", "0.9"), ("p99", "0.99")]:
+                if quantile_key in histogram:
+                    quantile_lines[name].append(
+                        f'{name}_quantile{{{prefix}quantile="{quantile}"}}'
+                        f"\t{histogram[quantile_key]}"
+                    )
+        for name, lines in quantile_lines.items():
+            if lines:
+                output_lines.append(f"\n# TYPE {name}_quantile gauge")
+                output_lines.extend(lines)
         return "\n".join(output_lines)
 
 
@@ -583,6 +620,12 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
         if isinstance(device, str):
             device = detect_device(device)
         assert isinstance(device, Device)
+        self._device = device
+        if engine_config.auto_tune:
+            # pylint: disable=import-outside-toplevel
+            from mlc_llm.serve.config_tuning import tune_engine_config
+
+            engine_config = tune_engine_config(model, device, model_lib, mode, engine_config)
         (
             model_args,
             model_config_paths,
@@ -611,14 +654,21 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
                 "run_background_loop",
                 "run_background_stream_back_loop",
                 "reload",
+                "hot_swap",
                 "init_threaded_engine",
                 "exit_background_loop",
                 "create_request",
                 "get_complete_engine_config",
                 "reset",
+                "preload_prefix",
+                "trim_memory",
+                "save_session",
+                "restore_session",
                 "debug_call_func_on_all_worker",
+                "pair_decode_engines",
             ]
         }
+        self._module = module
         self.tokenizer = Tokenizer(model_args[0][0])
         self._ffi["init_threaded_engine"](
             device,
@@ -672,6 +722,133 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
         """Reset the engine, clear the running data and metrics."""
         return self._ffi["reset"]()
 
+    def trim_memory(self, critical: bool = False) -> None:
+        """Release memory in reaction to the memory pressure of the system. The recycling
+        sequences of prefix cache and the memory cached by the models are released. Under
+        critical pressure, the KV cache is further recreated with half of its capacity once
+        the engine has no request, which lowers the max total sequence length.
+
+        Parameters
+        ----------
+        critical : bool
+            Whether the memory pressure is critical.
+        """
+        self._ffi["trim_memory"](critical)
+
+    def save_session(self, session_id: str, token_ids: List[int]) -> None:
+        """Save the KV data of the conversation tokens cached in prefix cache into the
+        snapshot of the session under `kv_session_dir` of the engine config.
+
+        Parameters
+        ----------
+        session_id : str
+            The session id, which consists of letters, digits, "-" and "_".
+
+        token_ids : List[int]
+            The token ids of the conversation so far.
+        """
+        self._ffi["save_session"](session_id, tvm.runtime.ShapeTuple(token_ids))
+
+    def restore_session(self, session_id: str) -> None:
+        """Restore the snapshot of the session saved by `save_session` into prefix cache,
+        so that the next request of the session reuses the restored KV data.
+
+        Parameters
+        ----------
+        session_id : str
+            The session id.
+        """
+        self._ffi["restore_session"](session_id)
+
+    def preload_prefixes(self, prompts: List[Union[str, List[int]]]) -> None:
+        """Preload the given prompts into the prefix cache and pin them there, so that
+        the requests starting with the prompts, e.g., with the known system prompts, reuse
+        their KV cache instead of prefilling them. The prompts are prefilled in background
+        when the engine has no request to process, and are preloaded again after reset.
+
+        Parameters
+        ----------
+        prompts : List[Union[str, List[int]]]
+            The prompts to preload, each of which is a string or a list of token ids.
+        """
+        for prompt in prompts:
+            token_ids = self.tokenizer.encode(prompt) if isinstance(prompt, str) else prompt
+            self._ffi["preload_prefix"](tvm.runtime.ShapeTuple(token_ids))
+
+    def hot_swap(
+        self,
+        model: str,
+        additional_models: Optional[List[str]] = None,
+    ) -> None:
+        """Swap the model weights of the engine to the given models, keeping the KV cache
+        allocation and the model workspace. The new models should be compatible with the
+        current ones, i.e., have the same architecture, quantization and shapes (for example,
+        the fine-tuned variants of the current models), and they run with the current model
+        libs. The new weights are loaded while the engine keeps serving, and the running
+        requests are aborted at the swap. The engine is reloaded instead when the new models
+        are not compatible.
+
+        Parameters
+        ----------
+        model : str
+            The new model to swap in.
+
+        additional_models : Optional[List[str]]
+            The new additional models, one for each current additional model.
+        """
+        if additional_models is None:
+            additional_models = []
+        current_model_libs = [self.engine_config.model_lib] + [
+            model_lib for _, model_lib in self.engine_config.additional_models  # type: ignore
+        ]
+        if len(additional_models) + 1 != len(current_model_libs):
+            raise ValueError(
+                f"The engine runs {len(current_model_libs)} models, while "
+                f"{len(additional_models) + 1} models are given to swap in."
+            )
+        models = [
+            ModelInfo(model_path, model_lib)
+            for model_path, model_lib in zip([model] + additional_models, current_model_libs)
+        ]
+        model_args, model_config_paths, conv_template = _process_model_args(
+            models, self._device, self.engine_config
+        )
+        engine_config = replace(self.engine_config)
+        engine_config.model = model_args[0][0]
+        engine_config.model_lib = model_args[0][1]
+        engine_config.additional_models = model_args[1:]  # type: ignore
+        self._ffi["hot_swap"](engine_config.asjson())
+        self.engine_config = EngineConfig.from_json(self._ffi["get_complete_engine_config"]())
+        self.conv_template = conv_template
+        self.model_config_dicts = []
+        for model_config_path in model_config_paths:
+            with open(model_config_path, "r", encoding="utf-8") as file:
+                self.model_config_dicts.append(json.load(file))
+
+    def pair_decode_engines(self, decode_engines: List["MLCEngineBase"]) -> None:
+        """Pair this engine with the given decode engines for disaggregated prefill and
+        decode serving. This engine should run the "prefill" disaggregation role, and the
+        decode engines should run the "decode" role. Requests added to this engine are
+        prefilled here, and then handed off to the decode engines in turn together with
+        their KV data. The outputs of all the requests are streamed back from this engine.
+
+        Parameters
+        ----------
+        decode_engines : List[MLCEngineBase]
+            The decode engines to pair with. They should be terminated before this engine.
+        """
+        if self.engine_config.disaggregation_role != "prefill":
+            raise ValueError(
+                'Only the engines of "prefill" disaggregation role can pair decode engines.'
+            )
+        for decode_engine in decode_engines:
+            if decode_engine.engine_config.disaggregation_role != "decode":
+                raise ValueError('The paired engines should run the "decode" disaggregation role.')
+        # pylint: disable=protected-access
+        decode_modules = [decode_engine._module for decode_engine in decode_engines]
+        # pylint: enable=protected-access
+        self._ffi["pair_decode_engines"](decode_modules)
+
 
 def process_chat_completion_request(  # pylint: disable=too-many-arguments
     request: openai_api_protocol.ChatCompletionRequest,
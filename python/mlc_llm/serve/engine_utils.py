@@ -30,12 +30,20 @@ def openai_api_get_generation_config(request: RequestProtocol) -> Dict[str, Any]
         "n",
         "temperature",
         "top_p",
+        "min_p",
+        "typical_p",
+        "use_beam_search",
+        "length_penalty",
         "max_tokens",
         "frequency_penalty",
         "presence_penalty",
         "logit_bias",
         "seed",
         "response_format",
+        "priority",
+        "ttft_deadline_ms",
+        "tpot_deadline_ms",
+        "lora_adapter",
         "debug_config",
     ]
     for arg_name in arg_names:
@@ -44,6 +52,8 @@ def openai_api_get_generation_config(request: RequestProtocol) -> Dict[str, Any]
         # Setting to -1 means the generation will not stop until
         # exceeding model capability or hit any stop criteria.
         kwargs["max_tokens"] = -1
+    # The end user of the request is the tenant under fair scheduling.
+    kwargs["tenant_id"] = request.user
     if request.stop is not None:
         kwargs["stop_strs"] = [request.stop] if isinstance(request.stop, str) else request.stop
     if isinstance(request, openai_api_protocol.ChatCompletionRequest):
@@ -8,12 +8,28 @@ from . import _ffi_api
 
 @tvm._ffi.register_object("mlc.serve.EventTraceRecorder")  # pylint: disable=protected-access
 class EventTraceRecorder(Object):
-    """The event trace recorder for requests."""
+    """The event trace recorder for requests.
+    The events are recorded into fixed-size per-thread ring buffers without locking,
+    so only the latest events of each thread are kept.
+    """
 
-    def __init__(self) -> None:
-        """Initialize a trace recorder."""
+    def __init__(self, buffer_size_per_thread: int = 65536, sample_ratio: float = 1.0) -> None:
+        """Initialize a trace recorder.
+
+        Parameters
+        ----------
+        buffer_size_per_thread : int
+            The number of latest events kept for each recording thread.
+
+        sample_ratio : float
+            The ratio of requests whose events are recorded, in (0, 1].
+            The sampling is decided by the hash of request id,
+            so a traced request has all its events recorded.
+        """
         self.__init_handle_by_constructor__(
-            _ffi_api.EventTraceRecorder  # type: ignore  # pylint: disable=no-member
+            _ffi_api.EventTraceRecorder,  # type: ignore  # pylint: disable=no-member
+            buffer_size_per_thread,
+            sample_ratio,
         )
 
     def add_event(self, request_id: str, event: str) -> None:
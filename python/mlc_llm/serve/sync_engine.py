@@ -134,10 +134,16 @@ class SyncMLCEngine:
                 "abort_request",
                 "step",
                 "reset",
+                "preload_prefix",
+                "trim_memory",
+                "save_session",
+                "restore_session",
+                "empty",
                 "json_metrics",
                 "get_request_stream_callback",
                 "set_request_stream_callback",
                 "create_request",
+                "get_complete_engine_config",
             ],
         )
         self.trace_recorder = EventTraceRecorder() if enable_tracing else None
@@ -152,6 +158,7 @@ class SyncMLCEngine:
             request_stream_callback,
             self.trace_recorder,
         )
+        self.engine_config = EngineConfig.from_json(self._ffi["get_complete_engine_config"]())
         self.tokenizer = Tokenizer(model_args[0][0])
 
     def generate(  # pylint: disable=too-many-locals
@@ -354,6 +361,61 @@ class SyncMLCEngine:
         """Reset the engine, clean up all running data and metrics."""
         self._ffi["reset"]()
 
+    def trim_memory(self, critical: bool = False) -> None:
+        """Release memory in reaction to the memory pressure of the system. The recycling
+        sequences of prefix cache and the memory cached by the models are released. Under
+        critical pressure, the KV cache is further recreated with half of its capacity once
+        the engine has no request.
+
+        Parameters
+        ----------
+        critical : bool
+            Whether the memory pressure is critical.
+        """
+        self._ffi["trim_memory"](critical)
+
+    def save_session(self, session_id: str, token_ids: List[int]) -> None:
+        """Save the KV data of the conversation tokens cached in prefix cache into the
+        snapshot of the session under `kv_session_dir` of the engine config.
+
+        Parameters
+        ----------
+        session_id : str
+            The session id, which consists of letters, digits, "-" and "_".
+
+        token_ids : List[int]
+            The token ids of the conversation so far.
+        """
+        self._ffi["save_session"](session_id, tvm.runtime.ShapeTuple(token_ids))
+
+    def restore_session(self, session_id: str) -> None:
+        """Restore the snapshot of the session saved by `save_session` into prefix cache,
+        so that the next request of the session reuses the restored KV data.
+
+        Parameters
+        ----------
+        session_id : str
+            The session id.
+        """
+        self._ffi["restore_session"](session_id)
+
+    def preload_prefixes(self, prompts: List[Union[str, List[int]]]) -> None:
+        """Preload the given prompts into the prefix cache and pin them there, so that
+        the requests starting with the prompts reuse their KV cache instead of prefilling
+        them. The prompts are prefilled before returning, and are preloaded again in the
+        engine steps after reset.
+
+        Parameters
+        ----------
+        prompts : List[Union[str, List[int]]]
+            The prompts to preload, each of which is a string or a list of token ids.
+        """
+        for prompt in prompts:
+            token_ids = self.tokenizer.encode(prompt) if isinstance(prompt, str) else prompt
+            self._ffi["preload_prefix"](tvm.runtime.ShapeTuple(token_ids))
+        while not self._ffi["empty"]():
+            self._ffi["step"]()
+
     def metrics(self) -> EngineMetrics:
         """Reset the engine, clean up all running data and metrics."""
         return EngineMetrics(json.loads(self._ffi["json_metrics"]()))
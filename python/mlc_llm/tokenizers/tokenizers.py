@@ -112,6 +112,20 @@ class Tokenizer(Object):
             self, tvm.runtime.ShapeTuple(token_ids)
         )
 
+    def save_post_processed_token_table(self, path: str) -> None:
+        """Save the post-processed token table to a precompiled token table file. The file named
+        "tokenizer_table.bin" in the tokenizer directory is loaded by the tokenizers created
+        later, instead of building the token table from the tokenizer.
+
+        Parameters
+        ----------
+        path : str
+            The path of the file to save to.
+        """
+        _ffi_api.TokenizerSavePostProcessedTokenTable(  # type: ignore  # pylint: disable=no-member
+            self, path
+        )
+
     @staticmethod
     def detect_tokenizer_info(tokenizer_path: str) -> TokenizerInfo:
         """Detect the tokenizer info from the given path of the tokenizer.
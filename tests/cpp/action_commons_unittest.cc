@@ -0,0 +1,98 @@
+#include "serve/engine_actions/action_commons.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief Format the outputs of the requests, each of which only touches its own slot. */
+std::vector<std::string> _FormatRequestOutputs(int num_requests,
+                                               int min_num_requests_for_parallel,
+                                               std::vector<std::atomic<int>>* num_calls) {
+  std::vector<std::string> outputs(num_requests);
+  ParallelForRequests(num_requests, min_num_requests_for_parallel, [&](int r) {
+    (*num_calls)[r].fetch_add(1, std::memory_order_relaxed);
+    std::string output;
+    for (int i = 0; i <= r % 37; ++i) {
+      output += "{\"token_id\": " + std::to_string(r * 1000 + i) + "}";
+    }
+    outputs[r] = std::move(output);
+  });
+  return outputs;
+}
+
+void _TestParallelForRequestsMatchesSerial() {
+  for (int num_requests : {0, 1, 15, 16, 100, 1000}) {
+    std::vector<std::atomic<int>> serial_calls(num_requests);
+    std::vector<std::atomic<int>> parallel_calls(num_requests);
+    std::vector<std::string> serial = _FormatRequestOutputs(
+        num_requests, std::numeric_limits<int>::max(), &serial_calls);
+    std::vector<std::string> parallel =
+        _FormatRequestOutputs(num_requests, /*min_num_requests_for_parallel=*/0, &parallel_calls);
+    EXPECT_EQ(parallel, serial) << "num_requests = " << num_requests;
+    // Each request is processed exactly once.
+    for (int r = 0; r < num_requests; ++r) {
+      EXPECT_EQ(serial_calls[r].load(), 1);
+      EXPECT_EQ(parallel_calls[r].load(), 1);
+    }
+  }
+}
+
+void _TestParallelForRequestsSerialOrder() {
+  // Below the threshold the requests are processed serially in order.
+  std::vector<int> order;
+  ParallelForRequests(10, /*min_num_requests_for_parallel=*/16,
+                      [&order](int r) { order.push_back(r); });
+  EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+}
+
+EngineConfig _MakeSpecDraftEngineConfig(bool spec_optimistic_draft, int spec_tree_width) {
+  ObjectPtr<EngineConfigNode> engine_config = make_object<EngineConfigNode>();
+  engine_config->speculative_mode = SpeculativeMode::kSmallDraft;
+  engine_config->spec_optimistic_draft = spec_optimistic_draft;
+  engine_config->spec_tree_width = spec_tree_width;
+  return EngineConfig(engine_config);
+}
+
+void _TestUseOptimisticDraft() {
+  EXPECT_TRUE(UseOptimisticDraft(_MakeSpecDraftEngineConfig(true, 1), true));
+  EXPECT_FALSE(UseOptimisticDraft(_MakeSpecDraftEngineConfig(false, 1), true));
+  // The token tree drafts and the drafts without a separate draft model are not fed.
+  EXPECT_FALSE(UseOptimisticDraft(_MakeSpecDraftEngineConfig(true, 2), true));
+  EXPECT_FALSE(UseOptimisticDraft(_MakeSpecDraftEngineConfig(true, 1), false));
+}
+
+void _TestDraftModelRollbackLength() {
+  // A draft of 4 tokens is verified with 5 tokens, including the last committed token.
+  // Without the optimistic feeding, the last draft token is not in the draft model.
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 5, false), 0);
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 4, false), 0);
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 2, false), 2);
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 1, false), 3);
+  // With the optimistic feeding, every rejected token is popped, and none when fully accepted.
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 5, true), 0);
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 4, true), 1);
+  EXPECT_EQ(GetDraftModelRollbackLength(5, 1, true), 4);
+  // A request without draft tokens rolls back nothing.
+  EXPECT_EQ(GetDraftModelRollbackLength(1, 1, false), 0);
+  EXPECT_EQ(GetDraftModelRollbackLength(1, 1, true), 0);
+}
+
+TEST(ActionCommonsTest, ParallelForRequestsMatchesSerialTest) {
+  _TestParallelForRequestsMatchesSerial();
+}
+TEST(ActionCommonsTest, ParallelForRequestsSerialOrderTest) {
+  _TestParallelForRequestsSerialOrder();
+}
+TEST(ActionCommonsTest, UseOptimisticDraftTest) { _TestUseOptimisticDraft(); }
+TEST(ActionCommonsTest, DraftModelRollbackLengthTest) { _TestDraftModelRollbackLength(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,52 @@
+#include "serve/engine_actions/batch_prefill_base.h"
+
+#include <gtest/gtest.h>
+
+#include <utility>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+EngineConfig _MakeLongPrefillEngineConfig(PrefillMode prefill_mode,
+                                          int64_t long_prefill_chunk_size) {
+  ObjectPtr<EngineConfigNode> engine_config = make_object<EngineConfigNode>();
+  engine_config->prefill_mode = prefill_mode;
+  engine_config->long_prefill_chunk_size = long_prefill_chunk_size;
+  return EngineConfig(engine_config);
+}
+
+void _TestCapLongPrefillChunk() {
+  // A long prompt is capped only when there are running requests to interleave with.
+  EXPECT_EQ(CapLongPrefillChunk(1000, 256, 2), std::make_pair(256, true));
+  EXPECT_EQ(CapLongPrefillChunk(1000, 256, 0), std::make_pair(1000, false));
+  // A prompt not longer than the chunk size is prefilled in full.
+  EXPECT_EQ(CapLongPrefillChunk(256, 256, 2), std::make_pair(256, false));
+  EXPECT_EQ(CapLongPrefillChunk(100, 256, 2), std::make_pair(100, false));
+  // The chunk size 0 disables the cap.
+  EXPECT_EQ(CapLongPrefillChunk(1000, 0, 2), std::make_pair(1000, false));
+}
+
+void _TestShouldDeferPrefillForDecode() {
+  EngineConfig chunked = _MakeLongPrefillEngineConfig(PrefillMode::kChunked, 256);
+  // The capped long prompt is not fully prefilled, so the next step decodes.
+  EXPECT_TRUE(ShouldDeferPrefillForDecode(chunked, 2, 256, 1000));
+  // The last chunk of the prompt is prefilled, or there is nothing to decode.
+  EXPECT_FALSE(ShouldDeferPrefillForDecode(chunked, 2, 256, 256));
+  EXPECT_FALSE(ShouldDeferPrefillForDecode(chunked, 0, 256, 1000));
+  // The decode is fused into every prefill step under the hybrid mode.
+  EngineConfig hybrid = _MakeLongPrefillEngineConfig(PrefillMode::kHybrid, 256);
+  EXPECT_FALSE(ShouldDeferPrefillForDecode(hybrid, 2, 256, 1000));
+  // No deferral when the long prefill chunk size is unset.
+  EngineConfig unset = _MakeLongPrefillEngineConfig(PrefillMode::kChunked, 0);
+  EXPECT_FALSE(ShouldDeferPrefillForDecode(unset, 2, 256, 1000));
+}
+
+TEST(BatchPrefillBaseTest, CapLongPrefillChunkTest) { _TestCapLongPrefillChunk(); }
+TEST(BatchPrefillBaseTest, ShouldDeferPrefillForDecodeTest) {
+  _TestShouldDeferPrefillForDecode();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,145 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file cpu_sampler_kernels_microbenchmark.cc
+ * \brief The microbenchmarks of the vectorized top-p and top-k scan kernels of the CPU sampler.
+ */
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "serve/sampler/cpu_sampler_kernels.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+constexpr int64_t kVocabSize = 128256;
+
+/*! \brief A peaked distribution like the softmax of LLM logits. */
+const std::vector<float>& GetProbs() {
+  static const std::vector<float> probs = []() {
+    std::mt19937 gen(3);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> probs(kVocabSize);
+    double sum = 0.0;
+    for (float& prob : probs) {
+      prob = std::exp(dist(gen) * 4);
+      sum += prob;
+    }
+    for (float& prob : probs) {
+      prob /= sum;
+    }
+    return probs;
+  }();
+  return probs;
+}
+
+/*! \brief Run the benchmark only when the ISA of the argument is supported by the CPU. */
+bool SkipUnsupportedISA(benchmark::State& state, CPUKernelISA* isa) {
+  *isa = static_cast<CPUKernelISA>(state.range(0));
+  if (!CPUKernelISASupported(*isa)) {
+    state.SkipWithError("The ISA is not supported by the CPU.");
+    return true;
+  }
+  state.SetLabel(CPUKernelISAToString(*isa));
+  return false;
+}
+
+void ApplyISAArgs(benchmark::internal::Benchmark* b) {
+  for (CPUKernelISA isa : {CPUKernelISA::kScalar, CPUKernelISA::kNEON, CPUKernelISA::kAVX2,
+                           CPUKernelISA::kAVX512}) {
+    b->Arg(static_cast<int>(isa));
+  }
+}
+
+/*! \brief The previous top-p filter: a branchy scalar scan. */
+void BM_TopPFilterScalarScan(benchmark::State& state) {
+  const std::vector<float>& probs = GetProbs();
+  std::vector<std::pair<float, int>> data;
+  float cutoff = 0.9 / 1024;
+  for (auto _ : state) {
+    data.clear();
+    for (int64_t i = 0; i < kVocabSize; ++i) {
+      if (probs[i] >= cutoff) data.emplace_back(probs[i], i);
+    }
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kVocabSize);
+}
+BENCHMARK(BM_TopPFilterScalarScan);
+
+/*! \brief The previous top-p boundary fallback: a full sort. */
+void BM_TopPBoundaryFullSort(benchmark::State& state) {
+  const std::vector<float>& probs = GetProbs();
+  for (auto _ : state) {
+    std::vector<float> sorted = probs;
+    std::sort(sorted.begin(), sorted.end(), std::greater<>());
+    double sum = 0.0;
+    float boundary = 0.0f;
+    for (float prob : sorted) {
+      sum += prob;
+      if (sum >= 0.9) {
+        boundary = prob;
+        break;
+      }
+    }
+    benchmark::DoNotOptimize(boundary);
+  }
+  state.SetItemsProcessed(state.iterations() * kVocabSize);
+}
+BENCHMARK(BM_TopPBoundaryFullSort);
+
+/*! \brief The vectorized top-p filter collecting the probabilities above a cutoff. */
+void BM_CollectAtLeast(benchmark::State& state) {
+  CPUKernelISA isa;
+  if (SkipUnsupportedISA(state, &isa)) return;
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels(isa);
+  const std::vector<float>& probs = GetProbs();
+  std::vector<std::pair<float, int>> data;
+  for (auto _ : state) {
+    data.clear();
+    CollectAtLeast(kernels, probs.data(), kVocabSize, 0.9 / 1024, 2.0f, &data);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kVocabSize);
+}
+BENCHMARK(BM_CollectAtLeast)->Apply(ApplyISAArgs);
+
+/*! \brief The vectorized scan for the first probability above the top probability. */
+void BM_SkipBlocksNotAbove(benchmark::State& state) {
+  CPUKernelISA isa;
+  if (SkipUnsupportedISA(state, &isa)) return;
+  const CPUSamplerKernels& kernels = GetCPUSamplerKernels(isa);
+  const std::vector<float>& probs = GetProbs();
+  const float top_prob = *std::max_element(probs.begin(), probs.end());
+  for (auto _ : state) {
+    float sum = 0.0f;
+    int64_t pos = kernels.skip_blocks_not_above(probs.data(), 0, kVocabSize, top_prob, &sum);
+    benchmark::DoNotOptimize(pos);
+  }
+  state.SetItemsProcessed(state.iterations() * kVocabSize);
+}
+BENCHMARK(BM_SkipBlocksNotAbove)->Apply(ApplyISAArgs);
+
+/*! \brief The radix select of the top-p boundary. */
+void BM_FindTopPBoundary(benchmark::State& state) {
+  const std::vector<float>& probs = GetProbs();
+  for (auto _ : state) {
+    float boundary = FindTopPBoundary(probs.data(), kVocabSize, 0.9);
+    benchmark::DoNotOptimize(boundary);
+  }
+  state.SetItemsProcessed(state.iterations() * kVocabSize);
+}
+BENCHMARK(BM_FindTopPBoundary);
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
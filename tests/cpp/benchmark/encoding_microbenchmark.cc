@@ -0,0 +1,109 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file encoding_microbenchmark.cc
+ * \brief The microbenchmarks of the UTF-8 parsing with vectorized ASCII run scanning.
+ */
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "support/encoding.h"
+
+namespace mlc {
+namespace llm {
+namespace {
+
+/*! \brief The scalar ParseUTF8 without the ASCII run scanning, as the baseline. */
+std::vector<TCodepoint> ParseUTF8Scalar(const char* utf8) {
+  std::vector<TCodepoint> codepoints;
+  while (*utf8 != 0) {
+    auto [accepted, num_bytes, res] = HandleUTF8FirstByte(utf8[0]);
+    if (accepted) {
+      for (int i = 1; i < num_bytes; ++i) {
+        if (utf8[i] == 0 || (static_cast<uint8_t>(utf8[i]) & 0xC0) != 0x80) {
+          return {CharHandlingError::kInvalidUTF8};
+        }
+        res = (res << 6) | (static_cast<uint8_t>(utf8[i]) & 0x3F);
+      }
+    } else {
+      return {CharHandlingError::kInvalidUTF8};
+    }
+    codepoints.push_back(res);
+    utf8 += num_bytes;
+  }
+  return codepoints;
+}
+
+/*! \brief Random valid text of mostly ASCII characters, with 2% multi-byte characters. */
+std::string MakeText(int num_chars, int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  std::string text;
+  for (int i = 0; i < num_chars; ++i) {
+    if (dist(gen) < 0.02) {
+      TCodepoint codepoints[] = {0xE9, 0x4E2D, 0x1F600, 0x3B1};
+      text += PrintAsUTF8(codepoints[gen() % 4]);
+    } else {
+      text += static_cast<char>(0x20 + gen() % 0x5F);
+    }
+  }
+  return text;
+}
+
+/*! \brief Short tokens like the vocabulary of a tokenizer. */
+const std::vector<std::string>& GetTokens() {
+  static const std::vector<std::string> tokens = []() {
+    std::vector<std::string> tokens;
+    for (int i = 0; i < 128000; ++i) {
+      tokens.push_back(MakeText(1 + i % 12, i));
+    }
+    return tokens;
+  }();
+  return tokens;
+}
+
+void BM_ParseUTF8VocabScalar(benchmark::State& state) {
+  const std::vector<std::string>& tokens = GetTokens();
+  for (auto _ : state) {
+    for (const std::string& token : tokens) {
+      benchmark::DoNotOptimize(ParseUTF8Scalar(token.c_str()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * tokens.size());
+}
+BENCHMARK(BM_ParseUTF8VocabScalar);
+
+void BM_ParseUTF8Vocab(benchmark::State& state) {
+  const std::vector<std::string>& tokens = GetTokens();
+  for (auto _ : state) {
+    for (const std::string& token : tokens) {
+      benchmark::DoNotOptimize(ParseUTF8(token.c_str(), UTF8ErrorPolicy::kReturnInvalid));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * tokens.size());
+}
+BENCHMARK(BM_ParseUTF8Vocab);
+
+void BM_ParseUTF8ParagraphScalar(benchmark::State& state) {
+  std::string paragraph = MakeText(1 << 20, 0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseUTF8Scalar(paragraph.c_str()));
+  }
+  state.SetBytesProcessed(state.iterations() * paragraph.size());
+}
+BENCHMARK(BM_ParseUTF8ParagraphScalar);
+
+void BM_ParseUTF8Paragraph(benchmark::State& state) {
+  std::string paragraph = MakeText(1 << 20, 0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseUTF8(paragraph.c_str(), UTF8ErrorPolicy::kReturnInvalid));
+  }
+  state.SetBytesProcessed(state.iterations() * paragraph.size());
+}
+BENCHMARK(BM_ParseUTF8Paragraph);
+
+}  // namespace
+}  // namespace llm
+}  // namespace mlc
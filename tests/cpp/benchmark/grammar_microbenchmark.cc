@@ -0,0 +1,116 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file grammar_microbenchmark.cc
+ * \brief The microbenchmarks of the next token bitmask generation of the grammar state matcher.
+ */
+#include <benchmark/benchmark.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grammar/grammar.h"
+#include "grammar/grammar_state_matcher.h"
+#include "microbenchmark_utils.h"
+#include "support/dynamic_bitset.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+using tvm::runtime::NDArray;
+
+/*! \brief The vocabulary size of the synthetic token table. */
+constexpr int kVocabSize = 32000;
+
+/*! \brief A representative JSON schema with nested objects, arrays and enums. */
+constexpr const char* kPersonSchema = R"({
+  "type": "object",
+  "properties": {
+    "name": {"type": "string"},
+    "age": {"type": "integer"},
+    "email": {"type": "string"},
+    "tags": {"type": "array", "items": {"type": "string"}},
+    "role": {"enum": ["admin", "user", "guest"]},
+    "address": {
+      "type": "object",
+      "properties": {"street": {"type": "string"}, "city": {"type": "string"}},
+      "required": ["street", "city"]
+    }
+  },
+  "required": ["name", "age", "email", "tags", "role", "address"]
+})";
+
+/*! \brief The grammars under benchmark. */
+enum class GrammarKind : int { kJSON = 0, kPersonSchema = 1 };
+
+/*! \brief Get the cached init context of the grammar. */
+std::shared_ptr<GrammarStateInitContext> GetInitContext(GrammarKind kind) {
+  static const std::vector<std::string> token_table = bench::MakeSyntheticTokenTable(kVocabSize);
+  static std::shared_ptr<GrammarStateInitContext> json_ctx = nullptr;
+  static std::shared_ptr<GrammarStateInitContext> schema_ctx = nullptr;
+  if (kind == GrammarKind::kJSON) {
+    if (json_ctx == nullptr) {
+      json_ctx = GrammarStateMatcher::CreateInitContext(BNFGrammar::GetGrammarOfJSON(),
+                                                        token_table);
+    }
+    return json_ctx;
+  }
+  if (schema_ctx == nullptr) {
+    schema_ctx = GrammarStateMatcher::CreateInitContext(BNFGrammar::FromSchema(kPersonSchema),
+                                                        token_table);
+  }
+  return schema_ctx;
+}
+
+/*! \brief The generated prefixes at which the bitmask is computed. */
+const std::vector<std::string>& GetPrefixes() {
+  static const std::vector<std::string> prefixes = {
+      // The beginning of the output.
+      "",
+      // Inside a string.
+      R"({"name": "Ali)",
+      // After a number, where the number, the separator and the end are all possible.
+      R"({"name": "Alice", "age": 3)",
+      // Inside an array of strings.
+      R"({"name": "Alice", "age": 30, "email": "a@b.c", "tags": ["x", )",
+  };
+  return prefixes;
+}
+
+/*!
+ * \brief Find the next token bitmask of a matcher after a generated prefix.
+ * The arguments are the grammar kind and the index of the prefix.
+ */
+void BM_GrammarFindNextTokenBitmask(benchmark::State& state) {
+  GrammarKind kind = static_cast<GrammarKind>(state.range(0));
+  const std::string& prefix = GetPrefixes()[state.range(1)];
+  GrammarStateMatcher matcher(GetInitContext(kind));
+  // The first tokens of the synthetic token table are the printable ASCII characters.
+  for (char c : prefix) {
+    if (!matcher->AcceptToken(c - ' ')) {
+      state.SkipWithError(("The grammar rejects the prefix " + prefix).c_str());
+      return;
+    }
+  }
+  NDArray bitmask = NDArray::Empty({DynamicBitset::CalculateBufferSize(kVocabSize)},
+                                   DLDataType{kDLUInt, 32, 1}, DLDevice{kDLCPU, 0});
+  DLTensor* dltensor = const_cast<DLTensor*>(bitmask.operator->());
+  for (auto _ : state) {
+    matcher->FindNextTokenBitmask(dltensor);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GrammarFindNextTokenBitmask)
+    ->ArgNames({"grammar", "prefix"})
+    ->ArgsProduct({{static_cast<int>(GrammarKind::kJSON),
+                    static_cast<int>(GrammarKind::kPersonSchema)},
+                   {0, 1, 2, 3}});
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
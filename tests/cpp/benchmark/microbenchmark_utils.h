@@ -0,0 +1,82 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file microbenchmark_utils.h
+ * \brief The shared utilities of the microbenchmarks of the engine hot paths.
+ */
+#ifndef MLC_LLM_TESTS_CPP_BENCHMARK_MICROBENCHMARK_UTILS_H_
+#define MLC_LLM_TESTS_CPP_BENCHMARK_MICROBENCHMARK_UTILS_H_
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tokenizers/tokenizers.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace bench {
+
+/*! \brief The environment variable of the tokenizer directory used by the benchmarks. */
+constexpr const char* kTokenizerPathEnv = "MLC_LLM_BENCHMARK_TOKENIZER_PATH";
+
+/*!
+ * \brief Make a synthetic post-processed token table. The first tokens are the single printable
+ * ASCII characters, and the remaining ones are random byte strings of length 2 to 8 drawn from
+ * the characters common in JSON and natural language, a quarter of which start with a space.
+ * The table is deterministic, so that the results are comparable across runs.
+ * \param vocab_size The size of the vocabulary.
+ */
+inline std::vector<std::string> MakeSyntheticTokenTable(int vocab_size) {
+  static const std::string kAlphabet =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789{}[]\":,.-_ \n";
+  std::vector<std::string> token_table;
+  token_table.reserve(vocab_size);
+  for (char c = ' '; c <= '~' && static_cast<int>(token_table.size()) < vocab_size; ++c) {
+    token_table.push_back(std::string(1, c));
+  }
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> len_dist(2, 8);
+  std::uniform_int_distribution<int> char_dist(0, kAlphabet.size() - 1);
+  while (static_cast<int>(token_table.size()) < vocab_size) {
+    std::string token = rng() % 4 == 0 ? " " : "";
+    int len = len_dist(rng);
+    while (static_cast<int>(token.size()) < len) {
+      token.push_back(kAlphabet[char_dist(rng)]);
+    }
+    token_table.push_back(std::move(token));
+  }
+  return token_table;
+}
+
+/*!
+ * \brief Load the tokenizer from the directory given by `MLC_LLM_BENCHMARK_TOKENIZER_PATH`.
+ * Skip the benchmark when the variable is not set.
+ * \param state The benchmark state.
+ * \return The tokenizer, or std::nullopt when the benchmark is skipped.
+ */
+inline std::optional<Tokenizer> LoadBenchmarkTokenizer(benchmark::State& state) {
+  const char* path = std::getenv(kTokenizerPathEnv);
+  if (path == nullptr) {
+    state.SkipWithError((std::string(kTokenizerPathEnv) + " is not set").c_str());
+    return std::nullopt;
+  }
+  static std::optional<Tokenizer> tokenizer;
+  static std::string tokenizer_path;
+  if (!tokenizer.has_value() || tokenizer_path != path) {
+    tokenizer = Tokenizer::FromPath(path);
+    tokenizer_path = path;
+  }
+  return tokenizer;
+}
+
+}  // namespace bench
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_TESTS_CPP_BENCHMARK_MICROBENCHMARK_UTILS_H_
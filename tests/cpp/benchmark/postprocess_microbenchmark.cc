@@ -0,0 +1,121 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file postprocess_microbenchmark.cc
+ * \brief The microbenchmark of the post-processing of engine steps, which streams the newly
+ * committed tokens back and updates the prefix cache of a batch of decoding requests.
+ */
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "microbenchmark_utils.h"
+#include "serve/config.h"
+#include "serve/data.h"
+#include "serve/engine_actions/action_commons.h"
+#include "serve/engine_state.h"
+#include "serve/request.h"
+#include "serve/request_state.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+/*! \brief The number of decode steps after which the request states are rebuilt. */
+constexpr int kNumStepsPerRebuild = 1024;
+
+/*!
+ * \brief Create an engine state with `num_requests` decoding requests of random prompts.
+ * The request states are created as the engine adds requests, and are put in the running queue.
+ */
+EngineState CreateEngineState(int num_requests, int num_stop_strs, int vocab_size,
+                              const std::vector<std::string>& token_table,
+                              Array<Request>* requests) {
+  EngineState estate;
+  estate->prefix_cache = PrefixCache::CreateNoPrefixCache();
+  ObjectPtr<GenerationConfigNode> n = make_object<GenerationConfigNode>();
+  n->debug_config.ignore_eos = true;
+  for (int i = 0; i < num_stop_strs; ++i) {
+    n->stop_strs.push_back("<|stop_" + std::to_string(i) + "|>");
+  }
+  GenerationConfig generation_cfg(n);
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int32_t> token_dist(0, vocab_size - 1);
+  *requests = Array<Request>();
+  for (int r = 0; r < num_requests; ++r) {
+    std::vector<int32_t> prompt(128);
+    for (int32_t& token_id : prompt) {
+      token_id = token_dist(rng);
+    }
+    Request request("req" + std::to_string(r), {TokenData(prompt)}, generation_cfg);
+    RequestStateEntry rsentry(request, /*num_models=*/1, estate->id_manager.GetNewId(),
+                              /*rng_seed=*/r, token_table, std::nullopt);
+    RequestState rstate({rsentry}, /*num_response=*/1, std::chrono::high_resolution_clock::now());
+    rsentry->rstate = rstate.operator->();
+    request->rstate = rstate.operator->();
+    rsentry->status = RequestStateStatus::kAlive;
+    estate->request_states.emplace(request->id, rstate);
+    estate->running_queue.push_back(request);
+    requests->push_back(request);
+  }
+  return estate;
+}
+
+/*!
+ * \brief Commit one token for each request and post-process the step.
+ * The arguments are the number of requests and the number of stop strings of each request.
+ * Requires the tokenizer given by `MLC_LLM_BENCHMARK_TOKENIZER_PATH`.
+ */
+void BM_ActionStepPostProcess(benchmark::State& state) {
+  int num_requests = state.range(0);
+  int num_stop_strs = state.range(1);
+  std::optional<Tokenizer> tokenizer = bench::LoadBenchmarkTokenizer(state);
+  if (!tokenizer.has_value()) return;
+  const std::vector<std::string>& token_table = tokenizer.value()->PostProcessedTokenTable();
+  int vocab_size = token_table.size();
+
+  Array<Request> requests;
+  EngineState estate =
+      CreateEngineState(num_requests, num_stop_strs, vocab_size, token_table, &requests);
+  // The callback unpacks the stream outputs so that they are reused, as the real callbacks do.
+  FRequestStreamCallback callback([](Array<RequestStreamOutput> delta_outputs) {
+    for (const RequestStreamOutput& delta_output : delta_outputs) {
+      delta_output->unpacked = true;
+    }
+    benchmark::DoNotOptimize(delta_outputs);
+  });
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int32_t> token_dist(0, vocab_size - 1);
+  int step = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (const Request& request : requests) {
+      estate->GetRequestState(request)->entries[0]->mstates[0]->CommitToken(
+          SampleResult{{token_dist(rng), 1.0f}});
+    }
+    state.ResumeTiming();
+    ActionStepPostProcess(requests, estate, /*models=*/{}, tokenizer.value(), callback,
+                          /*max_single_sequence_length=*/1 << 30,
+                          /*draft_token_workspace_manager=*/NullOpt,
+                          /*trace_recorder=*/NullOpt);
+    if (++step == kNumStepsPerRebuild) {
+      state.PauseTiming();
+      estate = CreateEngineState(num_requests, num_stop_strs, vocab_size, token_table, &requests);
+      step = 0;
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_requests);
+}
+BENCHMARK(BM_ActionStepPostProcess)
+    ->ArgNames({"batch", "stop_strs"})
+    ->ArgsProduct({{1, 32, 256}, {0, 4}});
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
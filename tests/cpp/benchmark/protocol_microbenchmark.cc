@@ -0,0 +1,98 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file protocol_microbenchmark.cc
+ * \brief The microbenchmarks of the OpenAI protocol stream response serialization, which runs
+ * for every delta streamed back by the JSON FFI engine.
+ */
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "json_ffi/openai_api_protocol.h"
+
+namespace mlc {
+namespace llm {
+namespace json_ffi {
+namespace {
+
+/*! \brief Make a batch of stream responses, each with the given number of choices. */
+std::vector<ChatCompletionStreamResponse> MakeStreamResponses(int num_responses,
+                                                              int num_choices) {
+  std::vector<ChatCompletionStreamResponse> responses(num_responses);
+  for (int i = 0; i < num_responses; ++i) {
+    ChatCompletionStreamResponse& response = responses[i];
+    response.id = "chatcmpl-" + std::to_string(i);
+    response.model = "Llama-3-8B-Instruct-q4f16_1-MLC";
+    for (int j = 0; j < num_choices; ++j) {
+      ChatCompletionStreamResponseChoice choice;
+      choice.index = j;
+      choice.delta.role = "assistant";
+      choice.delta.content = std::string(" token\n\"") + std::to_string(i * num_choices + j);
+      response.choices.push_back(std::move(choice));
+    }
+  }
+  return responses;
+}
+
+/*!
+ * \brief Serialize a batch of 32 stream responses by building the picojson values.
+ * The argument is the number of choices per response.
+ */
+void BM_StreamResponsePicojson(benchmark::State& state) {
+  std::vector<ChatCompletionStreamResponse> responses = MakeStreamResponses(32, state.range(0));
+  for (auto _ : state) {
+    picojson::array json_response_arr;
+    for (const ChatCompletionStreamResponse& response : responses) {
+      json_response_arr.push_back(picojson::value(response.AsJSON()));
+    }
+    std::string json_str = picojson::value(json_response_arr).serialize();
+    benchmark::DoNotOptimize(json_str);
+  }
+  state.SetItemsProcessed(state.iterations() * responses.size());
+}
+BENCHMARK(BM_StreamResponsePicojson)->Arg(1)->Arg(4);
+
+/*!
+ * \brief Serialize a batch of 32 stream responses with the JSON writer into a reused buffer.
+ * The argument is the number of choices per response.
+ */
+void BM_StreamResponseWriter(benchmark::State& state) {
+  std::vector<ChatCompletionStreamResponse> responses = MakeStreamResponses(32, state.range(0));
+  std::string buffer;
+  for (auto _ : state) {
+    buffer.clear();
+    json::JSONWriter writer(&buffer);
+    writer.BeginArray();
+    for (const ChatCompletionStreamResponse& response : responses) {
+      response.WriteJSON(&writer);
+    }
+    writer.EndArray();
+    benchmark::DoNotOptimize(buffer);
+  }
+  state.SetItemsProcessed(state.iterations() * responses.size());
+}
+BENCHMARK(BM_StreamResponseWriter)->Arg(1)->Arg(4);
+
+/*! \brief Parse a chat completion request with a multi-turn conversation. */
+void BM_ChatCompletionRequestFromJSON(benchmark::State& state) {
+  std::string request_json_str = "{\"model\": \"llama\", \"stream\": true, \"messages\": [";
+  for (int i = 0; i < 16; ++i) {
+    if (i > 0) request_json_str += ", ";
+    request_json_str += std::string("{\"role\": \"") + (i % 2 == 0 ? "user" : "assistant") +
+                        "\", \"content\": \"This is the message number " + std::to_string(i) +
+                        " of the conversation.\"}";
+  }
+  request_json_str += "], \"max_tokens\": 128, \"temperature\": 0.7, \"stop\": [\"</s>\"]}";
+  for (auto _ : state) {
+    Result<ChatCompletionRequest> request = ChatCompletionRequest::FromJSON(request_json_str);
+    benchmark::DoNotOptimize(request);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ChatCompletionRequestFromJSON);
+
+}  // namespace
+}  // namespace json_ffi
+}  // namespace llm
+}  // namespace mlc
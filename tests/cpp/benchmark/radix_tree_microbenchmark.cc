@@ -0,0 +1,99 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file radix_tree_microbenchmark.cc
+ * \brief The microbenchmarks of the paged radix tree of the prefix cache.
+ */
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "serve/radix_tree.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+/*!
+ * \brief Build a tree of `num_seqs` sequences of `seq_len` tokens, which share the first half
+ * of their tokens in groups of 8 sequences.
+ */
+PagedRadixTree BuildTree(int num_seqs, int seq_len) {
+  PagedRadixTree tree = PagedRadixTree::Create();
+  std::vector<int32_t> tokens(seq_len);
+  for (int i = 0; i < num_seqs; ++i) {
+    for (int j = 0; j < seq_len; ++j) {
+      tokens[j] = j < seq_len / 2 ? (i / 8) * seq_len + j : i * seq_len + j;
+    }
+    tree->AddSequence(i);
+    tree->ExtendSequence(i, tokens);
+  }
+  return tree;
+}
+
+/*! \brief Match the prompt of a sequence in the tree, with a different suffix. */
+void BM_RadixTreeMatchPrefix(benchmark::State& state) {
+  int num_seqs = state.range(0);
+  int seq_len = state.range(1);
+  PagedRadixTree tree = BuildTree(num_seqs, seq_len);
+  std::vector<int32_t> query(seq_len + 64);
+  for (int j = 0; j < static_cast<int>(query.size()); ++j) {
+    query[j] = j < seq_len ? (num_seqs / 2) * seq_len + j : -j;
+  }
+  for (auto _ : state) {
+    auto result = tree->MatchPrefix(query);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations() * query.size());
+}
+BENCHMARK(BM_RadixTreeMatchPrefix)->Args({64, 1024})->Args({1024, 1024})->Args({256, 8192});
+
+/*! \brief Extend the sequences one decoded token at a time, as the post-processing does. */
+void BM_RadixTreeExtendSequenceDecode(benchmark::State& state) {
+  int num_seqs = state.range(0);
+  int seq_len = 512;
+  PagedRadixTree tree = BuildTree(num_seqs, seq_len);
+  std::vector<int32_t> token(1);
+  int32_t step = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < num_seqs; ++i) {
+      token[0] = step;
+      tree->ExtendSequence(i, token);
+    }
+    if (++step == 2048) {
+      // Keep the tree size bounded.
+      state.PauseTiming();
+      tree = BuildTree(num_seqs, seq_len);
+      step = 0;
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_seqs);
+}
+BENCHMARK(BM_RadixTreeExtendSequenceDecode)->Arg(16)->Arg(128);
+
+/*! \brief Extend a new sequence with a whole prompt, as after a prefill. */
+void BM_RadixTreeExtendSequencePrefill(benchmark::State& state) {
+  int prompt_len = state.range(0);
+  PagedRadixTree tree = BuildTree(64, 1024);
+  std::vector<int32_t> prompt(prompt_len);
+  for (int j = 0; j < prompt_len; ++j) {
+    prompt[j] = 1000000 + j;
+  }
+  int64_t seq_id = 1000000;
+  for (auto _ : state) {
+    tree->AddSequence(seq_id);
+    tree->ExtendSequence(seq_id, prompt);
+    state.PauseTiming();
+    tree->RemoveSequence(seq_id);
+    state.ResumeTiming();
+    ++seq_id;
+  }
+  state.SetItemsProcessed(state.iterations() * prompt_len);
+}
+BENCHMARK(BM_RadixTreeExtendSequencePrefill)->Arg(512)->Arg(4096);
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,101 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file sampler_microbenchmark.cc
+ * \brief The microbenchmarks of the CPU sampler on large vocabularies.
+ */
+#include <benchmark/benchmark.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "serve/config.h"
+#include "serve/sampler/sampler.h"
+#include "support/random.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+using tvm::runtime::DataType;
+using tvm::runtime::NDArray;
+
+/*!
+ * \brief Make a batch of probability distributions on CPU. The logits are Gaussian with a
+ * large deviation, so that the distributions are peaked as the ones of trained models.
+ */
+NDArray MakeProbs(int batch_size, int vocab_size) {
+  NDArray probs = NDArray::Empty({batch_size, vocab_size}, DataType::Float(32), {kDLCPU, 0});
+  float* p_probs = static_cast<float*>(probs->data);
+  std::mt19937 rng(0);
+  std::normal_distribution<float> dist(0.0f, 3.0f);
+  for (int i = 0; i < batch_size; ++i) {
+    float* row = p_probs + static_cast<int64_t>(i) * vocab_size;
+    float max_logit = -INFINITY;
+    for (int j = 0; j < vocab_size; ++j) {
+      row[j] = dist(rng);
+      max_logit = std::max(max_logit, row[j]);
+    }
+    double sum = 0.0;
+    for (int j = 0; j < vocab_size; ++j) {
+      row[j] = std::exp(row[j] - max_logit);
+      sum += row[j];
+    }
+    for (int j = 0; j < vocab_size; ++j) {
+      row[j] /= sum;
+    }
+  }
+  return probs;
+}
+
+/*!
+ * \brief Sample a batch of tokens with the CPU sampler.
+ * The arguments are the vocabulary size, the batch size and the top-p in percent, where
+ * top-p 0 means greedy sampling.
+ */
+void BM_CPUSamplerTopP(benchmark::State& state) {
+  int vocab_size = state.range(0);
+  int batch_size = state.range(1);
+  double top_p = state.range(2) / 100.0;
+
+  Sampler sampler = Sampler::CreateCPUSampler(NullOpt);
+  NDArray probs = MakeProbs(batch_size, vocab_size);
+  ObjectPtr<GenerationConfigNode> n = make_object<GenerationConfigNode>();
+  n->temperature = top_p == 0.0 ? 0.0 : 1.0;
+  n->top_p = top_p == 0.0 ? 1.0 : top_p;
+  GenerationConfig generation_cfg(n);
+
+  std::vector<int> sample_indices(batch_size);
+  Array<String> request_ids;
+  Array<GenerationConfig> generation_cfgs;
+  std::vector<RandomGenerator> rng_storage;
+  rng_storage.reserve(batch_size);
+  std::vector<RandomGenerator*> rngs;
+  for (int i = 0; i < batch_size; ++i) {
+    sample_indices[i] = i;
+    request_ids.push_back("req" + std::to_string(i));
+    generation_cfgs.push_back(generation_cfg);
+    rng_storage.emplace_back(i);
+    rngs.push_back(&rng_storage.back());
+  }
+
+  for (auto _ : state) {
+    std::vector<SampleResult> results = sampler->BatchSampleTokensWithProbBeforeTopP(
+        probs, sample_indices, request_ids, generation_cfgs, rngs);
+    benchmark::DoNotOptimize(results);
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK(BM_CPUSamplerTopP)
+    ->ArgNames({"vocab", "batch", "top_p_pct"})
+    ->ArgsProduct({{128000, 256000}, {1, 16}, {0, 95, 100}})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
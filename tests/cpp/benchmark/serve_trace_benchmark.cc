@@ -0,0 +1,402 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve_trace_benchmark.cc
+ * \brief The serving benchmark that replays request traces on ThreadedEngine directly,
+ * without the Python overhead.
+ *
+ * Usage:
+ *   mlc_llm_serve_benchmark --model <model dir> --model-lib <model lib> --trace <trace.jsonl>
+ *     [--device cuda:0] [--engine-config '<engine config JSON>'] [--time-scale 1.0]
+ *     [--output <result.json>]
+ *
+ * Each line of the trace is a JSON object of a request:
+ *   {"arrival_time_s": 0.5, "prompt_len": 512, "output_len": 128,
+ *    "prefix_group": 3, "prefix_len": 256, "response_format": {"type": "json_object"}}
+ * - "arrival_time_s" is the arrival time relative to the start of replay.
+ * - The prompts of the requests in the same "prefix_group" share their first "prefix_len"
+ *   tokens. "prefix_group" and "prefix_len" are optional.
+ * - "response_format" is optional, and is passed to the generation config as is, to
+ *   exercise the grammar-constrained generation.
+ * The prompt tokens are sampled uniformly from the vocabulary, and every request generates
+ * exactly "output_len" tokens (the EOS is ignored) unless constrained by its grammar.
+ *
+ * The benchmark reports the throughput, the TTFT/ITL/end-to-end latency percentiles measured
+ * at the stream callback, and the KV cache utilization reported by the engine.
+ */
+#include <picojson.h>
+#include <tvm/runtime/packed_func.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "serve/config.h"
+#include "serve/data.h"
+#include "serve/request.h"
+#include "serve/threaded_engine.h"
+#include "support/json_parser.h"
+#include "tokenizers/tokenizers.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/*! \brief A request in the trace. */
+struct TraceRequest {
+  double arrival_time_s = 0.0;
+  int prompt_len = 0;
+  int output_len = 0;
+  int64_t prefix_group = -1;
+  int prefix_len = 0;
+  picojson::value response_format;
+};
+
+/*! \brief The timeline of a replayed request, observed at the stream callback. */
+struct RequestTimeline {
+  Clock::time_point add_time;
+  std::vector<Clock::time_point> token_times;
+  int64_t num_tokens = 0;
+  bool finished = false;
+};
+
+/*! \brief The command line options. */
+struct Options {
+  std::string model;
+  std::string model_lib;
+  std::string trace;
+  std::string device = "cuda:0";
+  std::string engine_config = "{}";
+  std::string output;
+  double time_scale = 1.0;
+};
+
+Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    CHECK_LT(i + 1, argc) << "Missing the value of option " << arg;
+    std::string value = argv[++i];
+    if (arg == "--model") {
+      options.model = value;
+    } else if (arg == "--model-lib") {
+      options.model_lib = value;
+    } else if (arg == "--trace") {
+      options.trace = value;
+    } else if (arg == "--device") {
+      options.device = value;
+    } else if (arg == "--engine-config") {
+      options.engine_config = value;
+    } else if (arg == "--output") {
+      options.output = value;
+    } else if (arg == "--time-scale") {
+      options.time_scale = std::stod(value);
+    } else {
+      LOG(FATAL) << "Unknown option " << arg;
+    }
+  }
+  CHECK(!options.model.empty() && !options.model_lib.empty() && !options.trace.empty())
+      << "Options --model, --model-lib and --trace are required.";
+  CHECK_GT(options.time_scale, 0) << "The time scale must be positive.";
+  return options;
+}
+
+Device ParseDevice(const std::string& device_str) {
+  static const std::unordered_map<std::string, DLDeviceType> device_types = {
+      {"cpu", kDLCPU},       {"cuda", kDLCUDA},     {"rocm", kDLROCM},
+      {"metal", kDLMetal},   {"vulkan", kDLVulkan}, {"opencl", kDLOpenCL},
+  };
+  size_t pos = device_str.find(':');
+  std::string name = device_str.substr(0, pos);
+  int device_id = pos == std::string::npos ? 0 : std::stoi(device_str.substr(pos + 1));
+  auto it = device_types.find(name);
+  CHECK(it != device_types.end()) << "Unsupported device " << device_str;
+  return Device{it->second, device_id};
+}
+
+std::vector<TraceRequest> LoadTrace(const std::string& path) {
+  std::ifstream fin(path);
+  CHECK(fin.good()) << "Cannot open the trace file " << path;
+  std::vector<TraceRequest> trace;
+  std::string line;
+  while (std::getline(fin, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    picojson::object json = json::ParseToJSONObject(line);
+    TraceRequest request;
+    request.arrival_time_s = json::Lookup<double>(json, "arrival_time_s");
+    request.prompt_len = json::Lookup<int64_t>(json, "prompt_len");
+    request.output_len = json::Lookup<int64_t>(json, "output_len");
+    request.prefix_group = json::LookupOrDefault<int64_t>(json, "prefix_group", -1);
+    request.prefix_len = json::LookupOrDefault<int64_t>(json, "prefix_len", 0);
+    CHECK_GT(request.prompt_len, 0) << "The prompt length must be positive.";
+    CHECK_GT(request.output_len, 0) << "The output length must be positive.";
+    CHECK_LE(request.prefix_len, request.prompt_len)
+        << "The prefix length must not exceed the prompt length.";
+    if (json.count("response_format")) {
+      request.response_format = json.at("response_format");
+    }
+    trace.push_back(std::move(request));
+  }
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceRequest& lhs, const TraceRequest& rhs) {
+                     return lhs.arrival_time_s < rhs.arrival_time_s;
+                   });
+  return trace;
+}
+
+/*! \brief Sample the prompt tokens. The shared prefix tokens are seeded by the prefix group. */
+std::vector<int32_t> SamplePromptTokens(const TraceRequest& request, int request_index,
+                                        int vocab_size) {
+  // Skip the leading part of vocabulary, where the special tokens usually are.
+  int min_token_id = std::min(vocab_size / 16, 1000);
+  std::uniform_int_distribution<int32_t> dist(min_token_id, vocab_size - 1);
+  std::vector<int32_t> tokens;
+  tokens.reserve(request.prompt_len);
+  if (request.prefix_group >= 0) {
+    std::mt19937 prefix_rng(static_cast<uint32_t>(request.prefix_group));
+    for (int i = 0; i < request.prefix_len; ++i) {
+      tokens.push_back(dist(prefix_rng));
+    }
+  }
+  std::mt19937 rng(static_cast<uint32_t>(request_index) + 0x9E3779B9u);
+  while (static_cast<int>(tokens.size()) < request.prompt_len) {
+    tokens.push_back(dist(rng));
+  }
+  return tokens;
+}
+
+/*! \brief Get the given percentile of the sorted values. */
+double Percentile(const std::vector<double>& sorted_values, double percentile) {
+  if (sorted_values.empty()) {
+    return 0.0;
+  }
+  size_t rank = static_cast<size_t>(percentile / 100.0 * (sorted_values.size() - 1) + 0.5);
+  return sorted_values[std::min(rank, sorted_values.size() - 1)];
+}
+
+picojson::object SummarizeLatency(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  picojson::object result;
+  double sum = 0.0;
+  for (double value : values) sum += value;
+  result["mean"] = picojson::value(values.empty() ? 0.0 : sum / values.size());
+  result["p50"] = picojson::value(Percentile(values, 50));
+  result["p90"] = picojson::value(Percentile(values, 90));
+  result["p99"] = picojson::value(Percentile(values, 99));
+  result["max"] = picojson::value(values.empty() ? 0.0 : values.back());
+  return result;
+}
+
+/*! \brief The trace replayer that drives a ThreadedEngine. */
+class TraceReplayer {
+ public:
+  explicit TraceReplayer(const Options& options) : options_(options) {
+    engine_ = ThreadedEngine::Create();
+    PackedFunc callback([this](TVMArgs args, TVMRetValue* rv) {
+      Array<RequestStreamOutput> outputs = args[0];
+      this->OnStreamOutputs(outputs);
+    });
+    engine_->InitThreadedEngine(ParseDevice(options.device), callback, NullOpt);
+    background_loop_ = std::thread([this]() { engine_->RunBackgroundLoop(); });
+    stream_back_loop_ = std::thread([this]() { engine_->RunBackgroundStreamBackLoop(); });
+
+    picojson::object engine_config = json::ParseToJSONObject(options.engine_config);
+    engine_config["model"] = picojson::value(options.model);
+    engine_config["model_lib"] = picojson::value(options.model_lib);
+    engine_->Reload(picojson::value(engine_config).serialize());
+    default_generation_cfg_ = engine_->GetDefaultGenerationConfig();
+    vocab_size_ = Tokenizer::FromPath(options.model)->GetVocabSize();
+  }
+
+  ~TraceReplayer() {
+    engine_->ExitBackgroundLoop();
+    background_loop_.join();
+    stream_back_loop_.join();
+  }
+
+  /*! \brief Replay the trace and return the benchmark result. */
+  picojson::object Replay(const std::vector<TraceRequest>& trace) {
+    // Build all the requests ahead, so that the request creation is not timed.
+    std::vector<Request> requests;
+    requests.reserve(trace.size());
+    for (int i = 0; i < static_cast<int>(trace.size()); ++i) {
+      requests.push_back(CreateRequest(trace[i], i));
+    }
+    timelines_.resize(trace.size());
+
+    Clock::time_point start_time = Clock::now();
+    for (int i = 0; i < static_cast<int>(trace.size()); ++i) {
+      std::this_thread::sleep_until(
+          start_time + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                           trace[i].arrival_time_s * options_.time_scale)));
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timelines_[i].add_time = Clock::now();
+      }
+      engine_->AddRequest(requests[i]);
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      finish_cv_.wait(lock, [this, &trace]() { return num_finished_ == trace.size(); });
+    }
+    double duration = std::chrono::duration<double>(Clock::now() - start_time).count();
+
+    picojson::object result = SummarizeResults(duration);
+    result["engine_metrics"] = picojson::value(QueryEngineMetrics());
+    return result;
+  }
+
+ private:
+  Request CreateRequest(const TraceRequest& trace_request, int index) {
+    picojson::object generation_cfg;
+    generation_cfg["max_tokens"] = picojson::value(static_cast<int64_t>(trace_request.output_len));
+    picojson::object debug_config;
+    debug_config["ignore_eos"] = picojson::value(true);
+    generation_cfg["debug_config"] = picojson::value(debug_config);
+    if (!trace_request.response_format.is<picojson::null>()) {
+      generation_cfg["response_format"] = trace_request.response_format;
+    }
+    Result<GenerationConfig> cfg =
+        GenerationConfig::FromJSON(generation_cfg, default_generation_cfg_);
+    CHECK(cfg.IsOk()) << cfg.UnwrapErr();
+    String request_id = "bench-" + std::to_string(index);
+    request_index_map_[request_id] = index;
+    return Request(request_id,
+                   {TokenData(SamplePromptTokens(trace_request, index, vocab_size_))},
+                   cfg.Unwrap());
+  }
+
+  void OnStreamOutputs(const Array<RequestStreamOutput>& outputs) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const RequestStreamOutput& output : outputs) {
+      if (output->request_id == kMetricsRequestId) {
+        if (output->request_final_usage_json_str.defined()) {
+          engine_metrics_json_ = output->request_final_usage_json_str.value();
+          finish_cv_.notify_all();
+        }
+        continue;
+      }
+      auto it = request_index_map_.find(output->request_id);
+      if (it == request_index_map_.end()) continue;
+      RequestTimeline& timeline = timelines_[it->second];
+      int64_t num_delta_tokens = 0;
+      for (const std::vector<int64_t>& delta_token_ids : output->group_delta_token_ids) {
+        num_delta_tokens += delta_token_ids.size();
+      }
+      if (num_delta_tokens > 0) {
+        timeline.token_times.push_back(now);
+        timeline.num_tokens += num_delta_tokens;
+      }
+      if (output->request_final_usage_json_str.defined() && !timeline.finished) {
+        timeline.finished = true;
+        ++num_finished_;
+        finish_cv_.notify_all();
+      }
+    }
+  }
+
+  picojson::object SummarizeResults(double duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<double> ttfts;
+    std::vector<double> itls;
+    std::vector<double> e2e_latencies;
+    int64_t num_output_tokens = 0;
+    for (const RequestTimeline& timeline : timelines_) {
+      num_output_tokens += timeline.num_tokens;
+      if (timeline.token_times.empty()) continue;
+      auto f_seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+      ttfts.push_back(f_seconds(timeline.token_times.front() - timeline.add_time));
+      e2e_latencies.push_back(f_seconds(timeline.token_times.back() - timeline.add_time));
+      for (size_t i = 1; i < timeline.token_times.size(); ++i) {
+        itls.push_back(f_seconds(timeline.token_times[i] - timeline.token_times[i - 1]));
+      }
+    }
+    picojson::object result;
+    result["num_requests"] = picojson::value(static_cast<int64_t>(timelines_.size()));
+    result["duration_s"] = picojson::value(duration);
+    result["request_throughput"] = picojson::value(timelines_.size() / duration);
+    result["output_token_throughput"] = picojson::value(num_output_tokens / duration);
+    result["ttft_s"] = picojson::value(SummarizeLatency(std::move(ttfts)));
+    result["inter_token_latency_s"] = picojson::value(SummarizeLatency(std::move(itls)));
+    result["end_to_end_latency_s"] = picojson::value(SummarizeLatency(std::move(e2e_latencies)));
+    return result;
+  }
+
+  /*! \brief Query the engine metrics through the special request. */
+  picojson::object QueryEngineMetrics() {
+    picojson::object generation_cfg;
+    picojson::object debug_config;
+    debug_config["special_request"] = picojson::value("query_engine_metrics");
+    generation_cfg["debug_config"] = picojson::value(debug_config);
+    GenerationConfig cfg =
+        GenerationConfig::FromJSON(generation_cfg, default_generation_cfg_).Unwrap();
+    engine_->AddRequest(Request(kMetricsRequestId, {TokenData(std::vector<int32_t>{0})}, cfg));
+    std::unique_lock<std::mutex> lock(mutex_);
+    finish_cv_.wait(lock, [this]() { return !engine_metrics_json_.empty(); });
+    picojson::object usage = json::ParseToJSONObject(engine_metrics_json_);
+    picojson::object metrics = json::Lookup<picojson::object>(usage, "extra");
+    picojson::object result;
+    for (const char* key : {"kv_cache_utilization_mean", "kv_cache_utilization_max",
+                            "prefill_tokens_per_s", "decode_tokens_per_s"}) {
+      if (metrics.count(key)) {
+        result[key] = metrics.at(key);
+      }
+    }
+    return result;
+  }
+
+  static constexpr const char* kMetricsRequestId = "bench-query-engine-metrics";
+
+  Options options_;
+  std::unique_ptr<ThreadedEngine> engine_;
+  std::thread background_loop_;
+  std::thread stream_back_loop_;
+  GenerationConfig default_generation_cfg_;
+  int vocab_size_;
+  /*! \brief The mapping from request ids to their indices in the trace. */
+  std::unordered_map<String, int> request_index_map_;
+
+  /*! \brief The mutex guarding the states below, which are updated by the stream callback. */
+  std::mutex mutex_;
+  std::condition_variable finish_cv_;
+  std::vector<RequestTimeline> timelines_;
+  size_t num_finished_ = 0;
+  std::string engine_metrics_json_;
+};
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+int main(int argc, char** argv) {
+  using namespace mlc::llm::serve;
+  Options options = ParseOptions(argc, argv);
+  std::vector<TraceRequest> trace = LoadTrace(options.trace);
+  CHECK(!trace.empty()) << "The trace is empty.";
+
+  picojson::object result;
+  {
+    TraceReplayer replayer(options);
+    result = replayer.Replay(trace);
+  }
+  std::string result_str = picojson::value(result).serialize(/*prettify=*/true);
+  std::cout << result_str << std::endl;
+  if (!options.output.empty()) {
+    std::ofstream fout(options.output);
+    CHECK(fout.good()) << "Cannot open the output file " << options.output;
+    fout << result_str;
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file streamer_microbenchmark.cc
+ * \brief The microbenchmarks of the text streamer and the stop string handler, which run for
+ * every generated token.
+ */
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "microbenchmark_utils.h"
+#include "tokenizers/streamer.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace {
+
+/*! \brief A text of mixed English, code and CJK characters to stream back. */
+constexpr const char* kStreamText =
+    "The quick brown fox jumps over the lazy dog. def f(x):\n    return {\"key\": [x, 2]}\n"
+    "\xe4\xbd\xa0\xe5\xa5\xbd\xef\xbc\x8c\xe4\xb8\x96\xe7\x95\x8c\xe3\x80\x82 "
+    "Numbers like 3.14159 and 2718 are tokenized into digits. ";
+
+/*!
+ * \brief Put the tokens of a text into the text streamer one at a time, as the engine does.
+ * Requires the tokenizer given by `MLC_LLM_BENCHMARK_TOKENIZER_PATH`.
+ */
+void BM_TextStreamerPut(benchmark::State& state) {
+  std::optional<Tokenizer> tokenizer = bench::LoadBenchmarkTokenizer(state);
+  if (!tokenizer.has_value()) return;
+  std::string text;
+  for (int i = 0; i < 16; ++i) {
+    text += kStreamText;
+  }
+  std::vector<int32_t> token_ids = tokenizer.value()->Encode(text);
+  TextStreamer streamer(tokenizer.value());
+  std::vector<int32_t> delta_tokens(1);
+  size_t pos = 0;
+  for (auto _ : state) {
+    delta_tokens[0] = token_ids[pos];
+    std::string delta = streamer->Put(delta_tokens);
+    benchmark::DoNotOptimize(delta);
+    if (++pos == token_ids.size()) {
+      state.PauseTiming();
+      streamer = TextStreamer(tokenizer.value());
+      pos = 0;
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TextStreamerPut);
+
+/*!
+ * \brief Put random tokens of the synthetic token table into the stop string handler.
+ * The argument is the number of stop strings.
+ */
+void BM_StopStrHandlerPut(benchmark::State& state) {
+  int num_stop_strs = state.range(0);
+  static const std::vector<std::string> token_table = bench::MakeSyntheticTokenTable(128000);
+  Array<String> stop_strs;
+  for (int i = 0; i < num_stop_strs; ++i) {
+    stop_strs.push_back("<|stop_" + std::to_string(i) + "|>");
+  }
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int32_t> token_dist(0, token_table.size() - 1);
+  std::vector<int32_t> token_ids(4096);
+  for (int32_t& token_id : token_ids) {
+    token_id = token_dist(rng);
+  }
+
+  StopStrHandler handler(stop_strs, token_table);
+  std::vector<int64_t> return_token_ids;
+  size_t pos = 0;
+  for (auto _ : state) {
+    handler->Put(token_ids[pos], &return_token_ids);
+    if (++pos == token_ids.size() || handler->StopTriggered()) {
+      state.PauseTiming();
+      handler = StopStrHandler(stop_strs, token_table);
+      return_token_ids.clear();
+      pos = 0;
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StopStrHandlerPut)->Arg(1)->Arg(4)->Arg(32);
+
+}  // namespace
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
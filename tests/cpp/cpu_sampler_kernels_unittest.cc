@@ -0,0 +1,121 @@
+#include "serve/sampler/cpu_sampler_kernels.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+std::vector<CPUKernelISA> _SupportedISAs() {
+  std::vector<CPUKernelISA> isas;
+  for (CPUKernelISA isa : {CPUKernelISA::kScalar, CPUKernelISA::kNEON, CPUKernelISA::kAVX2,
+                           CPUKernelISA::kAVX512}) {
+    if (CPUKernelISASupported(isa)) {
+      isas.push_back(isa);
+    }
+  }
+  return isas;
+}
+
+/*! \brief A peaked distribution like the softmax of LLM logits, with an odd size for tails. */
+std::vector<float> _MakeProbs(int64_t vocab_size, double temperature, int seed) {
+  std::mt19937 gen(seed);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> probs(vocab_size);
+  double sum = 0.0;
+  for (float& prob : probs) {
+    prob = std::exp(dist(gen) * 4 / temperature);
+    sum += prob;
+  }
+  for (float& prob : probs) {
+    prob /= sum;
+  }
+  return probs;
+}
+
+/*! \brief The reference top-p boundary by sorting all the probabilities. */
+float _SortedTopPBoundary(std::vector<float> probs, double target) {
+  std::sort(probs.begin(), probs.end(), std::greater<>());
+  double sum = 0.0;
+  for (float prob : probs) {
+    sum += prob;
+    if (sum >= target) {
+      return prob;
+    }
+  }
+  return 0.0f;
+}
+
+void _TestCPUSamplerKernelsMatchScalar() {
+  for (double temperature : {0.5, 1.0, 8.0}) {
+    std::vector<float> probs = _MakeProbs(32003, temperature, /*seed=*/1);
+    const int64_t n = probs.size();
+    const CPUSamplerKernels& scalar = GetCPUSamplerKernels(CPUKernelISA::kScalar);
+    for (CPUKernelISA isa : _SupportedISAs()) {
+      const CPUSamplerKernels& kernels = GetCPUSamplerKernels(isa);
+      ASSERT_EQ(kernels.isa, isa);
+      for (float threshold : {0.0f, 1e-5f, 1e-3f, 0.1f}) {
+        float sum = 0.0f;
+        float scalar_sum = 0.0f;
+        int64_t pos = kernels.skip_blocks_not_above(probs.data(), 5, n, threshold, &sum);
+        ASSERT_EQ(pos, scalar.skip_blocks_not_above(probs.data(), 5, n, threshold, &scalar_sum));
+        ASSERT_NEAR(sum, scalar_sum, 1e-4);
+        ASSERT_NEAR(kernels.sum_at_least(probs.data(), n, threshold),
+                    scalar.sum_at_least(probs.data(), n, threshold), 1e-4);
+
+        std::vector<std::pair<float, int>> collected;
+        std::vector<std::pair<float, int>> expected;
+        CollectAtLeast(kernels, probs.data(), n, threshold, 2.0f, &collected);
+        for (int64_t i = 0; i < n; ++i) {
+          if (probs[i] >= threshold) expected.emplace_back(probs[i], i);
+        }
+        ASSERT_EQ(collected, expected);
+      }
+      for (double target : {0.0, 0.3, 0.9}) {
+        double prefix_sum = 0.0;
+        int64_t pos = kernels.skip_blocks_below_prefix_sum(probs.data(), 3, n, target, &prefix_sum);
+        double expected_prefix_sum = 0.0;
+        for (int64_t i = 3; i < pos; ++i) expected_prefix_sum += probs[i];
+        ASSERT_NEAR(prefix_sum, expected_prefix_sum, 1e-4);
+        if (pos + CPUSamplerKernels::kBlockSize <= n) {
+          // The block at the returned position reaches the target.
+          double block_sum = 0.0;
+          for (int64_t i = pos; i < pos + CPUSamplerKernels::kBlockSize; ++i) block_sum += probs[i];
+          ASSERT_GE(prefix_sum + block_sum + 1e-4, target);
+        }
+      }
+      std::vector<float> masked = probs;
+      kernels.mask_and_scale(masked.data(), n, 1e-4f, 2.0f);
+      for (int64_t i = 0; i < n; ++i) {
+        ASSERT_FLOAT_EQ(masked[i], probs[i] >= 1e-4f ? probs[i] * 2.0f : 0.0f);
+      }
+    }
+  }
+}
+
+void _TestFindTopPBoundary() {
+  for (double temperature : {0.5, 1.0, 8.0}) {
+    std::vector<float> probs = _MakeProbs(32003, temperature, /*seed=*/2);
+    for (double top_p : {0.1, 0.5, 0.9, 0.99}) {
+      ASSERT_EQ(FindTopPBoundary(probs.data(), probs.size(), top_p),
+                _SortedTopPBoundary(probs, top_p));
+    }
+  }
+  // Ties and zeros.
+  std::vector<float> probs{0.25f, 0.0f, 0.25f, 0.25f, 0.0f, 0.25f};
+  ASSERT_EQ(FindTopPBoundary(probs.data(), probs.size(), 0.6), 0.25f);
+  ASSERT_EQ(FindTopPBoundary(probs.data(), probs.size(), 1.5), 0.0f);
+}
+
+TEST(CPUSamplerKernelsTest, MatchScalarTest) { _TestCPUSamplerKernelsMatchScalar(); }
+TEST(CPUSamplerKernelsTest, FindTopPBoundaryTest) { _TestFindTopPBoundary(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "serve/sampler/sampler.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief Make the probability NDArray on CPU from the given rows. */
+NDArray _MakeProbs(const std::vector<std::vector<float>>& rows) {
+  int64_t vocab_size = rows[0].size();
+  NDArray probs = NDArray::Empty({static_cast<int64_t>(rows.size()), vocab_size},
+                                 DataType::Float(32), DLDevice{kDLCPU, 0});
+  float* p_probs = static_cast<float*>(probs->data);
+  for (const std::vector<float>& row : rows) {
+    p_probs = std::copy(row.begin(), row.end(), p_probs);
+  }
+  return probs;
+}
+
+void _TestVerifyDeterministicDraftTokens() {
+  Sampler sampler = Sampler::CreateCPUSampler(NullOpt);
+  GenerationConfig generation_cfg(make_object<GenerationConfigNode>());
+  RandomGenerator rng0(0);
+  RandomGenerator rng1(1);
+  // The first sequence has the draft tokens 1 and 3, where 1 has probability one and 3 has
+  // probability zero. The second sequence has no draft token.
+  NDArray probs = _MakeProbs({{0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}});
+  std::vector<std::vector<SampleResult>> draft_output_tokens = {
+      {SampleResult{{1, 1.0f}}, SampleResult{{3, 1.0f}}}, {}};
+  auto [sample_results, last_accepted_tree_node] =
+      sampler->BatchVerifyDraftTokensWithProbAfterTopP(
+          probs, {"0", "1"}, /*cum_verify_lengths=*/{0, 3, 4}, {generation_cfg, generation_cfg},
+          {&rng0, &rng1}, draft_output_tokens, /*token_tree_parent_ptr=*/{-1, 0, 1, -1},
+          /*draft_probs_on_device=*/NDArray{nullptr});
+  ASSERT_EQ(sample_results.size(), 2);
+  // The draft token 1 is accepted, and the draft token 3 is rejected and resampled as 2.
+  ASSERT_EQ(sample_results[0].size(), 2);
+  EXPECT_EQ(sample_results[0][0].GetTokenId(), 1);
+  EXPECT_EQ(sample_results[0][1].GetTokenId(), 2);
+  EXPECT_EQ(last_accepted_tree_node[0], 1);
+  // The sequence without draft tokens samples from the last committed token.
+  ASSERT_EQ(sample_results[1].size(), 1);
+  EXPECT_EQ(sample_results[1][0].GetTokenId(), 3);
+  EXPECT_EQ(last_accepted_tree_node[1], 0);
+}
+
+void _TestVerifyDeterministicDraftTokensAcceptRate() {
+  Sampler sampler = Sampler::CreateCPUSampler(NullOpt);
+  GenerationConfig generation_cfg(make_object<GenerationConfigNode>());
+  RandomGenerator rng(0);
+  // A one-hot draft of token 0 is accepted with its target probability 0.25. Otherwise the
+  // token is resampled from the target distribution without token 0.
+  constexpr int kNumTrials = 4000;
+  std::vector<std::vector<SampleResult>> draft_output_tokens = {{SampleResult{{0, 1.0f}}}};
+  int num_accepted = 0;
+  std::vector<int> num_resampled(4, 0);
+  for (int trial = 0; trial < kNumTrials; ++trial) {
+    NDArray probs = _MakeProbs({{0.25, 0.25, 0.5, 0}, {0, 0, 0, 1}});
+    auto [sample_results, last_accepted_tree_node] =
+        sampler->BatchVerifyDraftTokensWithProbAfterTopP(
+            probs, {"0"}, /*cum_verify_lengths=*/{0, 2}, {generation_cfg}, {&rng},
+            draft_output_tokens, /*token_tree_parent_ptr=*/{-1, 0},
+            /*draft_probs_on_device=*/NDArray{nullptr});
+    if (last_accepted_tree_node[0] == 1) {
+      ASSERT_EQ(sample_results[0].size(), 2);
+      EXPECT_EQ(sample_results[0][0].GetTokenId(), 0);
+      EXPECT_EQ(sample_results[0][1].GetTokenId(), 3);
+      ++num_accepted;
+    } else {
+      ASSERT_EQ(sample_results[0].size(), 1);
+      ++num_resampled[sample_results[0][0].GetTokenId()];
+    }
+  }
+  EXPECT_NEAR(static_cast<double>(num_accepted) / kNumTrials, 0.25, 0.03);
+  EXPECT_EQ(num_resampled[0], 0);
+  EXPECT_EQ(num_resampled[3], 0);
+  // The resampled tokens follow the target distribution of the other tokens, i.e., 1 : 2.
+  EXPECT_NEAR(static_cast<double>(num_resampled[2]) / (kNumTrials - num_accepted), 2.0 / 3, 0.04);
+}
+
+TEST(CPUSamplerTest, VerifyDeterministicDraftTokensTest) { _TestVerifyDeterministicDraftTokens(); }
+TEST(CPUSamplerTest, VerifyDeterministicDraftTokensAcceptRateTest) {
+  _TestVerifyDeterministicDraftTokensAcceptRate();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
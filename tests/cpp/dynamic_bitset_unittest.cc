@@ -0,0 +1,69 @@
+#include "support/dynamic_bitset.h"
+
+#include <gtest/gtest.h>
+
+namespace mlc {
+namespace llm {
+
+void _TestDynamicBitsetSetRange() {
+  DynamicBitset bitset(100);
+  bitset.SetRange(3, 70);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(bitset[i], i >= 3 && i < 70) << i;
+  }
+  EXPECT_EQ(bitset.Count(), 67);
+  // A range within one word.
+  bitset.SetRange(40, 45, false);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(bitset[i], i >= 3 && i < 70 && !(i >= 40 && i < 45)) << i;
+  }
+  EXPECT_EQ(bitset.Count(), 62);
+  // An empty range changes nothing.
+  bitset.SetRange(50, 50, false);
+  EXPECT_EQ(bitset.Count(), 62);
+  bitset.SetRange(0, 100);
+  EXPECT_TRUE(bitset.All());
+  EXPECT_EQ(bitset.Count(), 100);
+}
+
+void _TestDynamicBitsetAllIgnoresBitsBeyondSize() {
+  uint32_t buffer[2] = {0, 0};
+  DynamicBitset bitset(40, buffer);
+  bitset.SetRange(0, 40);
+  EXPECT_TRUE(bitset.All());
+  EXPECT_EQ(buffer[1], 0xFFu);
+  // The bits beyond the size do not count.
+  buffer[1] = 0xFFFFFFFFu;
+  EXPECT_EQ(bitset.Count(), 40);
+  bitset.Reset(39);
+  EXPECT_FALSE(bitset.All());
+  EXPECT_EQ(bitset.Count(), 39);
+}
+
+void _TestDynamicBitsetBulkOperations() {
+  DynamicBitset lhs(64);
+  DynamicBitset rhs(64);
+  lhs.SetRange(0, 40);
+  rhs.SetRange(20, 64);
+  DynamicBitset and_result(64);
+  and_result = lhs;
+  and_result &= rhs;
+  DynamicBitset and_not_result(64);
+  and_not_result = lhs;
+  and_not_result.AndNot(rhs);
+  for (int i = 0; i < 64; ++i) {
+    EXPECT_EQ(and_result[i], i >= 20 && i < 40) << i;
+    EXPECT_EQ(and_not_result[i], i < 20) << i;
+  }
+  lhs |= rhs;
+  EXPECT_TRUE(lhs.All());
+}
+
+TEST(DynamicBitsetTest, SetRangeTest) { _TestDynamicBitsetSetRange(); }
+TEST(DynamicBitsetTest, AllIgnoresBitsBeyondSizeTest) {
+  _TestDynamicBitsetAllIgnoresBitsBeyondSize();
+}
+TEST(DynamicBitsetTest, BulkOperationsTest) { _TestDynamicBitsetBulkOperations(); }
+
+}  // namespace llm
+}  // namespace mlc
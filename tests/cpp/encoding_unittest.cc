@@ -0,0 +1,91 @@
+#include "support/encoding.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+
+/*! \brief The previous scalar implementation of ParseUTF8, as the reference. */
+std::vector<TCodepoint> _ParseUTF8Scalar(const char* utf8, UTF8ErrorPolicy error_policy) {
+  std::vector<TCodepoint> codepoints;
+  while (*utf8 != 0) {
+    auto [accepted, num_bytes, res] = HandleUTF8FirstByte(utf8[0]);
+    if (accepted) {
+      for (int i = 1; i < num_bytes; ++i) {
+        if (utf8[i] == 0 || (static_cast<uint8_t>(utf8[i]) & 0xC0) != 0x80) {
+          accepted = false;
+          break;
+        }
+        res = (res << 6) | (static_cast<uint8_t>(utf8[i]) & 0x3F);
+      }
+    }
+    if (!accepted) {
+      if (error_policy == UTF8ErrorPolicy::kReturnInvalid) {
+        return {CharHandlingError::kInvalidUTF8};
+      }
+      codepoints.push_back(static_cast<unsigned char>(utf8[0]));
+      utf8 += 1;
+      continue;
+    }
+    codepoints.push_back(res);
+    utf8 += num_bytes;
+  }
+  return codepoints;
+}
+
+/*! \brief Random text with ASCII runs, multi-byte chars and invalid bytes at the given rate. */
+std::string _MakeText(int num_chars, double non_ascii_rate, double invalid_rate, int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  std::string text;
+  for (int i = 0; i < num_chars; ++i) {
+    double r = dist(gen);
+    if (r < invalid_rate) {
+      text += static_cast<char>(0x80 + gen() % 0x40);
+    } else if (r < invalid_rate + non_ascii_rate) {
+      TCodepoint codepoints[] = {0xE9, 0x4E2D, 0x1F600, 0x3B1};
+      text += PrintAsUTF8(codepoints[gen() % 4]);
+    } else {
+      text += static_cast<char>(0x20 + gen() % 0x5F);
+    }
+  }
+  return text;
+}
+
+void _TestFindFirstNonASCII() {
+  for (int length = 0; length < 70; ++length) {
+    for (int pos = 0; pos <= length; ++pos) {
+      std::string text(length, 'a');
+      if (pos < length) text[pos] = static_cast<char>(0xC3);
+      ASSERT_EQ(FindFirstNonASCII(text.data(), length), pos);
+    }
+  }
+}
+
+void _TestParseUTF8MatchScalar() {
+  for (double non_ascii_rate : {0.0, 0.05, 0.5}) {
+    for (double invalid_rate : {0.0, 0.01}) {
+      for (int seed = 0; seed < 10; ++seed) {
+        std::string text = _MakeText(1000, non_ascii_rate, invalid_rate, seed);
+        for (UTF8ErrorPolicy policy :
+             {UTF8ErrorPolicy::kReturnInvalid, UTF8ErrorPolicy::kReturnByte}) {
+          ASSERT_EQ(ParseUTF8(text.c_str(), policy), _ParseUTF8Scalar(text.c_str(), policy));
+        }
+      }
+    }
+  }
+  // A truncated multi-byte char at the end.
+  std::string truncated = "abc\xE4\xB8";
+  ASSERT_EQ(ParseUTF8(truncated.c_str(), UTF8ErrorPolicy::kReturnByte),
+            _ParseUTF8Scalar(truncated.c_str(), UTF8ErrorPolicy::kReturnByte));
+}
+
+TEST(EncodingTest, FindFirstNonASCIITest) { _TestFindFirstNonASCII(); }
+TEST(EncodingTest, ParseUTF8MatchScalarTest) { _TestParseUTF8MatchScalar(); }
+
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "grammar/grammar_state_matcher_preproc.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The token table of all strings of "a" to "h" up to length 3, with special tokens. */
+std::vector<std::string> _MakeTokenTable() {
+  std::vector<std::string> token_table = {"<s>", "</s>"};
+  std::vector<std::string> prev = {""};
+  for (int length = 1; length <= 3; ++length) {
+    std::vector<std::string> cur;
+    for (const std::string& prefix : prev) {
+      for (char c : std::string("abcdefgh")) {
+        cur.push_back(prefix + c);
+      }
+    }
+    token_table.insert(token_table.end(), cur.begin(), cur.end());
+    prev = std::move(cur);
+  }
+  return token_table;
+}
+
+/*! \brief A temporary grammar cache directory, removed on destruction. */
+class _TempCacheDir {
+ public:
+  _TempCacheDir()
+      : path_((std::filesystem::temp_directory_path() /
+               ("mlc_grammar_cache_test_" + std::to_string(std::random_device()())))
+                  .string()) {}
+
+  ~_TempCacheDir() {
+    std::error_code error;
+    std::filesystem::remove_all(path_, error);
+  }
+
+  const std::string& path() const { return path_; }
+
+  /*! \brief The only cache file in the directory. */
+  std::string GetCacheFile() const {
+    std::vector<std::string> files;
+    for (const auto& entry : std::filesystem::directory_iterator(path_)) {
+      files.push_back(entry.path().string());
+    }
+    EXPECT_EQ(files.size(), 1);
+    return files.empty() ? "" : files[0];
+  }
+
+ private:
+  std::string path_;
+};
+
+/*!
+ * \brief The grammar whose first position accepts and rejects about half of the tokens each,
+ * so that both the index and the bitset storages are used.
+ */
+BNFGrammar _MakeGrammar() {
+  return BNFGrammar::FromEBNFString("main ::= [a-d] [a-h] [a-h] [a-h] \"e\" | \"h\" [a-b]*");
+}
+
+/*! \brief Create an init context with the tokenizer info and the grammar only. */
+std::shared_ptr<GrammarStateInitContext> _MakeEmptyInitContext(
+    const BNFGrammar& grammar, const std::vector<std::string>& token_table) {
+  auto init_ctx = std::make_shared<GrammarStateInitContext>();
+  init_ctx->grammar = grammar;
+  SetTokenizerInfoOfInitContext(init_ctx.get(), token_table);
+  return init_ctx;
+}
+
+void _TestGrammarInitContextDiskCacheRoundTrip() {
+  std::vector<std::string> token_table = _MakeTokenTable();
+  BNFGrammar grammar = _MakeGrammar();
+  _TempCacheDir cache_dir;
+  GrammarInitContextDiskCache disk_cache(cache_dir.path(), token_table);
+  ASSERT_TRUE(disk_cache.Enabled());
+
+  auto expected = GrammarStateMatcher::CreateInitContext(grammar, token_table);
+  ASSERT_FALSE(expected->catagorized_tokens_for_grammar.empty());
+  auto loaded = _MakeEmptyInitContext(grammar, token_table);
+  EXPECT_FALSE(disk_cache.Load(loaded.get()));
+  disk_cache.Save(*expected);
+  ASSERT_TRUE(disk_cache.Load(loaded.get()));
+
+  ASSERT_EQ(loaded->catagorized_tokens_for_grammar.size(),
+            expected->catagorized_tokens_for_grammar.size());
+  bool has_bitset = false;
+  for (const auto& [rule_position, tokens] : expected->catagorized_tokens_for_grammar) {
+    auto it = loaded->catagorized_tokens_for_grammar.find(rule_position);
+    ASSERT_NE(it, loaded->catagorized_tokens_for_grammar.end());
+    const CatagorizedTokens& loaded_tokens = it->second;
+    EXPECT_EQ(it->first.rule_id, rule_position.rule_id);
+    EXPECT_EQ(loaded_tokens.save_type, tokens.save_type);
+    EXPECT_EQ(loaded_tokens.accepted_indices, tokens.accepted_indices);
+    EXPECT_EQ(loaded_tokens.rejected_indices, tokens.rejected_indices);
+    EXPECT_EQ(loaded_tokens.uncertain_indices, tokens.uncertain_indices);
+    if (tokens.save_type == CatagorizedTokens::SaveType::kAcceptedBitset) {
+      has_bitset = true;
+      ASSERT_EQ(loaded_tokens.accepted_bitset.BufferSize(), tokens.accepted_bitset.BufferSize());
+      EXPECT_TRUE(std::equal(tokens.accepted_bitset.Data(),
+                             tokens.accepted_bitset.Data() + tokens.accepted_bitset.BufferSize(),
+                             loaded_tokens.accepted_bitset.Data()));
+    }
+  }
+  EXPECT_TRUE(has_bitset);
+}
+
+void _TestGrammarInitContextDiskCacheRejectStale() {
+  std::vector<std::string> token_table = _MakeTokenTable();
+  BNFGrammar grammar = _MakeGrammar();
+  _TempCacheDir cache_dir;
+  GrammarInitContextDiskCache disk_cache(cache_dir.path(), token_table);
+  disk_cache.Save(*GrammarStateMatcher::CreateInitContext(grammar, token_table));
+
+  // Another grammar or token table does not find the file.
+  BNFGrammar other_grammar = BNFGrammar::FromEBNFString("main ::= \"a\" main | \"b\"");
+  EXPECT_FALSE(disk_cache.Load(_MakeEmptyInitContext(other_grammar, token_table).get()));
+  std::vector<std::string> other_token_table = token_table;
+  other_token_table.push_back("hhhh");
+  GrammarInitContextDiskCache other_disk_cache(cache_dir.path(), other_token_table);
+  EXPECT_FALSE(other_disk_cache.Load(_MakeEmptyInitContext(grammar, other_token_table).get()));
+
+  // A file of another format version is rejected.
+  std::string path = cache_dir.GetCacheFile();
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    uint32_t version = 1;
+    file.seekp(sizeof(uint64_t));
+    file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+  }
+  EXPECT_FALSE(disk_cache.Load(_MakeEmptyInitContext(grammar, token_table).get()));
+}
+
+void _TestGrammarInitContextDiskCacheRejectCorrupt() {
+  std::vector<std::string> token_table = _MakeTokenTable();
+  BNFGrammar grammar = _MakeGrammar();
+  _TempCacheDir cache_dir;
+  GrammarInitContextDiskCache disk_cache(cache_dir.path(), token_table);
+  disk_cache.Save(*GrammarStateMatcher::CreateInitContext(grammar, token_table));
+  std::string path = cache_dir.GetCacheFile();
+  std::string data;
+  {
+    std::ifstream fin(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+  }
+  auto f_load_with = [&](const std::string& file_data) {
+    {
+      std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+      fout.write(file_data.data(), file_data.size());
+    }
+    auto init_ctx = _MakeEmptyInitContext(grammar, token_table);
+    bool loaded = disk_cache.Load(init_ctx.get());
+    // A rejected file leaves the init context unchanged.
+    EXPECT_TRUE(loaded || init_ctx->catagorized_tokens_for_grammar.empty());
+    return loaded;
+  };
+  ASSERT_TRUE(f_load_with(data));
+
+  // Truncated files, and a file with trailing bytes.
+  constexpr size_t kHeaderSize = 40;
+  EXPECT_FALSE(f_load_with(data.substr(0, kHeaderSize / 2)));
+  EXPECT_FALSE(f_load_with(data.substr(0, kHeaderSize + 4)));
+  EXPECT_FALSE(f_load_with(data.substr(0, data.size() - 4)));
+  EXPECT_FALSE(f_load_with(data + std::string(4, '\0')));
+
+  // The out-of-range fields of the first entry: the rule id, the save type and the number of
+  // accepted indices.
+  auto f_set_entry_field = [&](int field, int32_t value) {
+    std::string corrupt = data;
+    std::memcpy(&corrupt[kHeaderSize + field * sizeof(int32_t)], &value, sizeof(value));
+    return corrupt;
+  };
+  EXPECT_FALSE(f_load_with(f_set_entry_field(0, 1000)));
+  EXPECT_FALSE(f_load_with(f_set_entry_field(0, -1)));
+  EXPECT_FALSE(f_load_with(f_set_entry_field(5, 3)));
+  EXPECT_FALSE(f_load_with(f_set_entry_field(6, -1)));
+  EXPECT_FALSE(f_load_with(f_set_entry_field(6, 1 << 30)));
+
+  // An out-of-range token index.
+  std::string corrupt = data;
+  int32_t num_accepted, num_rejected, num_uncertain;
+  std::memcpy(&num_accepted, &data[kHeaderSize + 6 * sizeof(int32_t)], sizeof(int32_t));
+  std::memcpy(&num_rejected, &data[kHeaderSize + 7 * sizeof(int32_t)], sizeof(int32_t));
+  std::memcpy(&num_uncertain, &data[kHeaderSize + 8 * sizeof(int32_t)], sizeof(int32_t));
+  if (num_accepted + num_rejected + num_uncertain > 0) {
+    int32_t index = token_table.size();
+    std::memcpy(&corrupt[kHeaderSize + 10 * sizeof(int32_t)], &index, sizeof(index));
+    EXPECT_FALSE(f_load_with(corrupt));
+  }
+}
+
+TEST(GrammarInitContextDiskCacheTest, RoundTripTest) {
+  _TestGrammarInitContextDiskCacheRoundTrip();
+}
+TEST(GrammarInitContextDiskCacheTest, RejectStaleTest) {
+  _TestGrammarInitContextDiskCacheRejectStale();
+}
+TEST(GrammarInitContextDiskCacheTest, RejectCorruptTest) {
+  _TestGrammarInitContextDiskCacheRejectCorrupt();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
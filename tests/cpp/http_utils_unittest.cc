@@ -0,0 +1,118 @@
+#include "json_ffi/http_utils.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace mlc {
+namespace llm {
+namespace json_ffi {
+
+picojson::value ParseJSON(const std::string& json_str) {
+  picojson::value value;
+  std::string err = picojson::parse(value, json_str);
+  EXPECT_TRUE(err.empty()) << err;
+  return value;
+}
+
+void _TestHTTPParseRequestHeader() {
+  HTTPRequestHeader header;
+  ASSERT_TRUE(ParseHTTPRequestHeader(
+      "POST /v1/chat/completions HTTP/1.1\r\nHost: localhost\r\nContent-Length: 42 \r\n"
+      "CONNECTION: Close",
+      &header));
+  EXPECT_EQ(header.method, "POST");
+  EXPECT_EQ(header.path, "/v1/chat/completions");
+  EXPECT_EQ(header.version, "HTTP/1.1");
+  EXPECT_EQ(header.content_length, 42);
+  EXPECT_FALSE(header.keep_alive);
+
+  // HTTP/1.0 closes the connection unless asked to keep it alive.
+  ASSERT_TRUE(ParseHTTPRequestHeader("GET /health HTTP/1.0", &header));
+  EXPECT_EQ(header.version, "HTTP/1.0");
+  EXPECT_EQ(header.content_length, 0);
+  EXPECT_FALSE(header.keep_alive);
+  ASSERT_TRUE(ParseHTTPRequestHeader("GET /health HTTP/1.0\r\nConnection: keep-alive", &header));
+  EXPECT_TRUE(header.keep_alive);
+}
+
+void _TestHTTPParseRequestHeaderRejectsInvalid() {
+  HTTPRequestHeader header;
+  EXPECT_FALSE(ParseHTTPRequestHeader("GET /health", &header));
+  EXPECT_FALSE(ParseHTTPRequestHeader("GET /health HTTP/2", &header));
+  EXPECT_FALSE(ParseHTTPRequestHeader("POST / HTTP/1.1\r\nContent-Length: -1", &header));
+  EXPECT_FALSE(ParseHTTPRequestHeader("POST / HTTP/1.1\r\nContent-Length: 12abc", &header));
+  EXPECT_FALSE(
+      ParseHTTPRequestHeader("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999", &header));
+  EXPECT_FALSE(ParseHTTPRequestHeader("POST / HTTP/1.1\r\nTransfer-Encoding: chunked", &header));
+}
+
+void _TestHTTPEncodeChunk() {
+  EXPECT_EQ(EncodeHTTPChunk("data: [DONE]\n\n"), "e\r\ndata: [DONE]\n\n\r\n");
+  EXPECT_EQ(EncodeHTTPChunk(std::string(300, 'a')), "12c\r\n" + std::string(300, 'a') + "\r\n");
+}
+
+void _TestHTTPAggregateChatCompletionChunks() {
+  ChatCompletionAggregate aggregate;
+  AggregateChatCompletionChunk(
+      ParseJSON("{\"id\": \"0\", \"choices\": [{\"index\": 0, \"delta\": {\"content\": \"Hel\"}, "
+                "\"finish_reason\": null}, {\"index\": 1, \"delta\": {\"content\": \"A\"}}]}"),
+      &aggregate);
+  AggregateChatCompletionChunk(
+      ParseJSON("{\"id\": \"0\", \"choices\": [{\"index\": 0, \"delta\": {\"content\": \"lo\"}, "
+                "\"finish_reason\": \"stop\"}, {\"index\": 1, \"delta\": {\"content\": \"B\"}, "
+                "\"finish_reason\": \"length\"}]}"),
+      &aggregate);
+  picojson::value final_chunk =
+      ParseJSON("{\"id\": \"0\", \"choices\": [], \"usage\": {\"total_tokens\": 5}}");
+  EXPECT_TRUE(IsFinalChatCompletionChunk(final_chunk));
+  AggregateChatCompletionChunk(final_chunk, &aggregate);
+  EXPECT_FALSE(aggregate.error.has_value());
+
+  picojson::value response = ParseJSON(
+      BuildChatCompletionJSON("chatcmpl-0", "model", aggregate, final_chunk.get("usage")));
+  EXPECT_EQ(response.get("id").get<std::string>(), "chatcmpl-0");
+  EXPECT_EQ(response.get("object").get<std::string>(), "chat.completion");
+  const picojson::array& choices = response.get("choices").get<picojson::array>();
+  ASSERT_EQ(choices.size(), 2);
+  EXPECT_EQ(choices[0].get("message").get("content").get<std::string>(), "Hello");
+  EXPECT_EQ(choices[0].get("finish_reason").get<std::string>(), "stop");
+  EXPECT_EQ(choices[1].get("message").get("content").get<std::string>(), "AB");
+  EXPECT_EQ(choices[1].get("finish_reason").get<std::string>(), "length");
+  EXPECT_EQ(response.get("usage").get("total_tokens").get<int64_t>(), 5);
+}
+
+void _TestHTTPChatCompletionErrorChunks() {
+  std::vector<picojson::value> chunks = MakeChatCompletionErrorChunks("chatcmpl-1", "bad request");
+  ASSERT_EQ(chunks.size(), 2);
+  EXPECT_EQ(chunks[0].get("id").get<std::string>(), "chatcmpl-1");
+  EXPECT_FALSE(IsFinalChatCompletionChunk(chunks[0]));
+  std::optional<std::string> error = GetChatCompletionChunkError(chunks[0]);
+  ASSERT_TRUE(error.has_value());
+  EXPECT_EQ(error.value(), "bad request");
+  EXPECT_TRUE(IsFinalChatCompletionChunk(chunks[1]));
+  EXPECT_FALSE(GetChatCompletionChunkError(chunks[1]).has_value());
+
+  ChatCompletionAggregate aggregate;
+  for (const picojson::value& chunk : chunks) {
+    AggregateChatCompletionChunk(chunk, &aggregate);
+  }
+  ASSERT_TRUE(aggregate.error.has_value());
+  EXPECT_EQ(aggregate.error.value(), "bad request");
+  EXPECT_EQ(ParseJSON(ErrorResponseJSON("bad request")).get("error").get("message").to_str(),
+            "bad request");
+}
+
+TEST(HTTPUtilsTest, ParseRequestHeaderTest) { _TestHTTPParseRequestHeader(); }
+TEST(HTTPUtilsTest, ParseRequestHeaderRejectsInvalidTest) {
+  _TestHTTPParseRequestHeaderRejectsInvalid();
+}
+TEST(HTTPUtilsTest, EncodeChunkTest) { _TestHTTPEncodeChunk(); }
+TEST(HTTPUtilsTest, AggregateChatCompletionChunksTest) {
+  _TestHTTPAggregateChatCompletionChunks();
+}
+TEST(HTTPUtilsTest, ChatCompletionErrorChunksTest) { _TestHTTPChatCompletionErrorChunks(); }
+
+}  // namespace json_ffi
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,86 @@
+#include "support/json_writer.h"
+
+#include <gtest/gtest.h>
+
+#include "json_ffi/openai_api_protocol.h"
+
+namespace mlc {
+namespace llm {
+namespace json_ffi {
+
+std::string _WriteJSON(const ChatCompletionStreamResponse& response) {
+  std::string buffer;
+  json::JSONWriter writer(&buffer);
+  response.WriteJSON(&writer);
+  return buffer;
+}
+
+void _TestJSONWriterBasic() {
+  std::string buffer;
+  json::JSONWriter writer(&buffer);
+  writer.BeginObject();
+  writer.Key("a");
+  writer.BeginArray();
+  writer.Int(1);
+  writer.Null();
+  writer.Bool(true);
+  writer.String("x\"\\/\n\x01");
+  writer.BeginObject();
+  writer.EndObject();
+  writer.EndArray();
+  writer.Key("b");
+  writer.Raw("{\"c\":2}");
+  writer.EndObject();
+  EXPECT_EQ(buffer, "{\"a\":[1,null,true,\"x\\\"\\\\\\/\\n\\u0001\",{}],\"b\":{\"c\":2}}");
+}
+
+void _TestJSONWriterStreamResponseMatchesPicojson() {
+  ChatCompletionStreamResponse response;
+  response.id = "chatcmpl-0";
+  response.model = "model";
+  ChatCompletionStreamResponseChoice choice;
+  choice.index = 1;
+  choice.delta.role = "assistant";
+  choice.delta.content = std::string("Hello, \"world\"\n\t</s>\x7f");
+  response.choices.push_back(choice);
+  choice.index = 2;
+  choice.delta.content = std::nullopt;
+  choice.finish_reason = FinishReason::length;
+  response.choices.push_back(choice);
+  EXPECT_EQ(_WriteJSON(response), picojson::value(response.AsJSON()).serialize());
+
+  // The final usage response.
+  response.choices.clear();
+  picojson::value usage;
+  ASSERT_TRUE(picojson::parse(usage, "{\"completion_tokens\":3,\"prompt_tokens\":5}").empty());
+  response.usage = usage;
+  EXPECT_EQ(_WriteJSON(response), picojson::value(response.AsJSON()).serialize());
+}
+
+void _TestJSONWriterStreamResponseKeyOrder() {
+  // The keys follow the insertion order of AsJSON, not the sorted order.
+  ChatCompletionStreamResponse response;
+  response.id = "chatcmpl-0";
+  response.created = 7;
+  response.model = "model";
+  ChatCompletionStreamResponseChoice choice;
+  choice.delta.role = "assistant";
+  choice.delta.content = std::string("Hi");
+  choice.delta.name = "bot";
+  response.choices.push_back(choice);
+  EXPECT_EQ(_WriteJSON(response),
+            "{\"id\":\"chatcmpl-0\",\"choices\":[{\"finish_reason\":null,\"index\":0,\"delta\":"
+            "{\"content\":\"Hi\",\"role\":\"assistant\",\"name\":\"bot\"}}],\"created\":7,"
+            "\"model\":\"model\",\"system_fingerprint\":\"\","
+            "\"object\":\"chat.completion.chunk\"}");
+}
+
+TEST(JSONWriterTest, BasicTest) { _TestJSONWriterBasic(); }
+TEST(JSONWriterTest, StreamResponseMatchesPicojsonTest) {
+  _TestJSONWriterStreamResponseMatchesPicojson();
+}
+TEST(JSONWriterTest, StreamResponseKeyOrderTest) { _TestJSONWriterStreamResponseKeyOrder(); }
+
+}  // namespace json_ffi
+}  // namespace llm
+}  // namespace mlc
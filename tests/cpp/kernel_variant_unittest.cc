@@ -0,0 +1,135 @@
+#include "serve/kernel_variant.h"
+
+#include <gtest/gtest.h>
+#include <tvm/runtime/ndarray.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using tvm::runtime::NDArray;
+using tvm::runtime::TVMArgs;
+using tvm::runtime::TVMRetValue;
+
+std::string _KernelVariantCachePath(const std::string& test_name) {
+  return (std::filesystem::temp_directory_path() /
+          ("mlc_llm_test_" + test_name + "_" + std::to_string(getpid())) / "cache.json")
+      .string();
+}
+
+/*! \brief Make a variant that counts its calls, optionally sleeping to be slower. */
+PackedFunc _MakeCountingVariant(int* num_calls, int sleep_ms) {
+  return PackedFunc([num_calls, sleep_ms](TVMArgs args, TVMRetValue* rv) {
+    ++*num_calls;
+    if (sleep_ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+    }
+  });
+}
+
+void _TestKernelVariantCacheRoundTrip() {
+  std::string path = _KernelVariantCachePath("cache_round_trip");
+  {
+    KernelVariantCache cache(path);
+    EXPECT_FALSE(cache.Lookup("batch_decode", 8).has_value());
+    cache.Update("batch_decode", 8, "gemm_a");
+    cache.Update("batch_decode", 16, "gemm_b");
+    cache.Update("prefill", 1024, "gemm_c");
+    cache.Update("batch_decode", 8, "gemm_d");
+  }
+  KernelVariantCache loaded(path);
+  EXPECT_EQ(loaded.Lookup("batch_decode", 8).value_or(""), "gemm_d");
+  EXPECT_EQ(loaded.Lookup("batch_decode", 16).value_or(""), "gemm_b");
+  EXPECT_EQ(loaded.Lookup("prefill", 1024).value_or(""), "gemm_c");
+  EXPECT_FALSE(loaded.Lookup("prefill", 512).has_value());
+  EXPECT_FALSE(loaded.Lookup("decode", 8).has_value());
+  std::filesystem::remove_all(std::filesystem::path(path).parent_path());
+
+  // The cache with an empty path is only kept in memory.
+  KernelVariantCache in_memory("");
+  in_memory.Update("batch_decode", 8, "gemm_a");
+  EXPECT_EQ(in_memory.Lookup("batch_decode", 8).value_or(""), "gemm_a");
+}
+
+void _TestKernelVariantCacheIgnoresMalformedFile() {
+  std::string path = _KernelVariantCachePath("cache_malformed");
+  std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+  std::ofstream(path) << "{\"batch_decode\": ";
+  KernelVariantCache cache(path);
+  EXPECT_FALSE(cache.Lookup("batch_decode", 8).has_value());
+  // The malformed file is overwritten by the next update.
+  cache.Update("batch_decode", 8, "gemm_a");
+  EXPECT_EQ(KernelVariantCache(path).Lookup("batch_decode", 8).value_or(""), "gemm_a");
+  std::filesystem::remove_all(std::filesystem::path(path).parent_path());
+}
+
+void _TestKernelVariantBucketRounding() {
+  EXPECT_EQ(GetKernelVariantBucket(0), 1);
+  EXPECT_EQ(GetKernelVariantBucket(1), 1);
+  EXPECT_EQ(GetKernelVariantBucket(2), 2);
+  EXPECT_EQ(GetKernelVariantBucket(3), 4);
+  EXPECT_EQ(GetKernelVariantBucket(64), 64);
+  EXPECT_EQ(GetKernelVariantBucket(65), 128);
+  EXPECT_EQ(GetKernelVariantBucket(4097), 8192);
+}
+
+void _TestKernelVariantDispatcherSelectsFastest() {
+  Device device{kDLCPU, 0};
+  auto cache = std::make_shared<KernelVariantCache>("");
+  int num_slow_calls = 0;
+  int num_fast_calls = 0;
+  PackedFunc dispatcher = CreateKernelVariantDispatcher(
+      "batch_decode",
+      {{"slow", _MakeCountingVariant(&num_slow_calls, 5)},
+       {"fast", _MakeCountingVariant(&num_fast_calls, 0)}},
+      device, cache);
+  // 3 tokens of hidden size 8, which fall into the bucket of 4 tokens.
+  NDArray input = NDArray::Empty({3, 8}, DLDataType{kDLFloat, 32, 1}, device);
+  // Each variant takes one warmup call and three timed calls, in turn.
+  for (int i = 0; i < 8; ++i) {
+    dispatcher(input);
+  }
+  EXPECT_EQ(num_slow_calls, 4);
+  EXPECT_EQ(num_fast_calls, 4);
+  EXPECT_EQ(cache->Lookup("batch_decode", 4).value_or(""), "fast");
+  for (int i = 0; i < 5; ++i) {
+    dispatcher(input);
+  }
+  EXPECT_EQ(num_slow_calls, 4);
+  EXPECT_EQ(num_fast_calls, 9);
+
+  // A new dispatcher takes the cached selection without timing.
+  int num_new_slow_calls = 0;
+  int num_new_fast_calls = 0;
+  PackedFunc new_dispatcher = CreateKernelVariantDispatcher(
+      "batch_decode",
+      {{"slow", _MakeCountingVariant(&num_new_slow_calls, 0)},
+       {"fast", _MakeCountingVariant(&num_new_fast_calls, 0)}},
+      device, cache);
+  new_dispatcher(input);
+  EXPECT_EQ(num_new_slow_calls, 0);
+  EXPECT_EQ(num_new_fast_calls, 1);
+}
+
+TEST(KernelVariantTest, CacheRoundTripTest) { _TestKernelVariantCacheRoundTrip(); }
+TEST(KernelVariantTest, CacheIgnoresMalformedFileTest) {
+  _TestKernelVariantCacheIgnoresMalformedFile();
+}
+TEST(KernelVariantTest, BucketRoundingTest) { _TestKernelVariantBucketRounding(); }
+TEST(KernelVariantTest, DispatcherSelectsFastestTest) {
+  _TestKernelVariantDispatcherSelectsFastest();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,65 @@
+#include "support/lock_free_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+
+void _TestLockFreeQueueSingleThread() {
+  MPSCQueue<std::unique_ptr<int>> queue;
+  EXPECT_TRUE(queue.Empty());
+  std::unique_ptr<int> value;
+  EXPECT_FALSE(queue.TryPop(&value));
+  for (int i = 0; i < 10; ++i) {
+    queue.Push(std::make_unique<int>(i));
+  }
+  EXPECT_FALSE(queue.Empty());
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(queue.TryPop(&value));
+    EXPECT_EQ(*value, i);
+  }
+  EXPECT_TRUE(queue.Empty());
+  // The remaining elements are freed on destruction.
+  queue.Push(std::make_unique<int>(10));
+}
+
+void _TestLockFreeQueueMultiProducerOrder() {
+  // Each producer pushes increasing values, which the consumer must pop in order.
+  const int num_producers = 4;
+  const int num_values = 100000;
+  MPSCQueue<std::pair<int, int>> queue;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&queue, p]() {
+      for (int i = 0; i < num_values; ++i) {
+        queue.Push({p, i});
+      }
+    });
+  }
+  std::vector<int> next_values(num_producers, 0);
+  int num_popped = 0;
+  std::pair<int, int> value;
+  while (num_popped < num_producers * num_values) {
+    if (!queue.TryPop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(value.second, next_values[value.first]);
+    ++next_values[value.first];
+    ++num_popped;
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(queue.Empty());
+}
+
+TEST(LockFreeQueueTest, SingleThreadTest) { _TestLockFreeQueueSingleThread(); }
+TEST(LockFreeQueueTest, MultiProducerOrderTest) { _TestLockFreeQueueMultiProducerOrder(); }
+
+}  // namespace llm
+}  // namespace mlc
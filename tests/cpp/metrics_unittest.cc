@@ -0,0 +1,121 @@
+#include "serve/metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+void _TestLatencyHistogramBucketBounds() {
+  for (int i = 0; i < LatencyHistogram::kNumBuckets; ++i) {
+    int64_t lower = LatencyHistogram::BucketLowerBound(i);
+    int64_t upper = LatencyHistogram::BucketUpperBound(i);
+    ASSERT_LT(lower, upper);
+    EXPECT_EQ(LatencyHistogram::BucketIndex(lower), i);
+    EXPECT_EQ(LatencyHistogram::BucketIndex(upper - 1), i);
+    // The bucket width is bounded by the relative error.
+    EXPECT_LE(upper - lower, std::max(lower / LatencyHistogram::kNumSubBuckets, int64_t(1)));
+  }
+  EXPECT_EQ(LatencyHistogram::BucketIndex(int64_t(1) << 40), LatencyHistogram::kNumBuckets - 1);
+}
+
+void _TestLatencyHistogramQuantile() {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Quantile(0.5), 0.0);
+  std::vector<double> values;
+  std::mt19937 rng(0);
+  std::lognormal_distribution<double> dist(-4.0, 1.5);
+  for (int i = 0; i < 100000; ++i) {
+    values.push_back(dist(rng));
+    histogram.Update(values.back());
+  }
+  std::sort(values.begin(), values.end());
+  EXPECT_EQ(histogram.Count(), values.size());
+  for (double q : {0.5, 0.9, 0.99}) {
+    double expected = values[static_cast<size_t>(q * values.size()) - 1];
+    EXPECT_NEAR(histogram.Quantile(q), expected,
+                expected / LatencyHistogram::kNumSubBuckets + 1e-6);
+  }
+}
+
+void _TestLatencyHistogramMergeAndConcurrentUpdate() {
+  LatencyHistogram histogram;
+  LatencyHistogram merged;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&histogram, t]() {
+      for (int i = 0; i < 10000; ++i) {
+        histogram.Update((t * 10000 + i) * 1e-6);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  merged.Merge(histogram);
+  merged.Merge(histogram);
+  EXPECT_EQ(histogram.Count(), 40000);
+  EXPECT_EQ(merged.Count(), 80000);
+  EXPECT_DOUBLE_EQ(merged.Sum(), histogram.Sum() * 2);
+  EXPECT_DOUBLE_EQ(merged.Quantile(0.5), histogram.Quantile(0.5));
+  merged.Reset();
+  EXPECT_EQ(merged.Count(), 0);
+}
+
+void _TestLatencyHistogramClampOutOfRange() {
+  LatencyHistogram histogram;
+  histogram.Update(-1.0);
+  histogram.Update(std::nan(""));
+  histogram.Update(std::numeric_limits<double>::infinity());
+  histogram.Update(1e30);
+  EXPECT_EQ(histogram.Count(), 4);
+  // The negative and NaN values are recorded as 0, and the others at the maximum value.
+  double max_seconds = ((int64_t(1) << LatencyHistogram::kMaxExponent) - 1) / 1e6;
+  EXPECT_DOUBLE_EQ(histogram.Sum(), max_seconds * 2);
+  EXPECT_LT(histogram.Quantile(0.5), 1e-6);
+  EXPECT_GT(histogram.Quantile(1.0), max_seconds * 0.9);
+}
+
+void _TestEngineMetricsBatchSizeBucket() {
+  EXPECT_EQ(EngineMetrics::BatchSizeBucket(1), 0);
+  EXPECT_EQ(EngineMetrics::BatchSizeBucket(3), 1);
+  EXPECT_EQ(EngineMetrics::BatchSizeBucket(4), 2);
+  EXPECT_EQ(EngineMetrics::BatchSizeBucket(255), 7);
+  EXPECT_EQ(EngineMetrics::BatchSizeBucket(256), EngineMetrics::kNumBatchSizeBuckets - 1);
+}
+
+void _TestEngineMetricsTenantLimit() {
+  EngineMetrics metrics;
+  for (int i = 0; i < EngineMetrics::kMaxNumTenants + 10; ++i) {
+    metrics.UpdateTenantServedTokens("user" + std::to_string(i), 2);
+  }
+  EXPECT_EQ(metrics.tenants.size(), EngineMetrics::kMaxNumTenants);
+  EXPECT_EQ(metrics.tenants.at("user0").served_tokens, 2);
+  EXPECT_EQ(metrics.other_tenants.served_tokens, 20);
+  // The tenants already kept are still accounted to themselves.
+  metrics.UpdateTenantServedTokens("user1", 3);
+  EXPECT_EQ(metrics.tenants.at("user1").served_tokens, 5);
+  metrics.Reset();
+  EXPECT_TRUE(metrics.tenants.empty());
+  EXPECT_EQ(metrics.other_tenants.served_tokens, 0);
+}
+
+TEST(LatencyHistogramTest, BucketBoundsTest) { _TestLatencyHistogramBucketBounds(); }
+TEST(LatencyHistogramTest, QuantileTest) { _TestLatencyHistogramQuantile(); }
+TEST(LatencyHistogramTest, MergeAndConcurrentUpdateTest) {
+  _TestLatencyHistogramMergeAndConcurrentUpdate();
+}
+TEST(LatencyHistogramTest, ClampOutOfRangeTest) { _TestLatencyHistogramClampOutOfRange(); }
+TEST(EngineMetricsTest, BatchSizeBucketTest) { _TestEngineMetricsBatchSizeBucket(); }
+TEST(EngineMetricsTest, TenantLimitTest) { _TestEngineMetricsTenantLimit(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
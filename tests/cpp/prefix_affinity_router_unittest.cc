@@ -0,0 +1,85 @@
+#include "serve/prefix_affinity_router.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+std::vector<int32_t> _MakePrompt(int32_t prefix_begin, int prefix_len, int32_t suffix_begin,
+                                 int suffix_len) {
+  std::vector<int32_t> prompt;
+  for (int i = 0; i < prefix_len; ++i) prompt.push_back(prefix_begin + i);
+  for (int i = 0; i < suffix_len; ++i) prompt.push_back(suffix_begin + i);
+  return prompt;
+}
+
+void _TestPrefixAffinityRouterBlockHashes() {
+  std::vector<uint64_t> a =
+      PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(0, 32, 100, 20), 16);
+  std::vector<uint64_t> b =
+      PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(0, 32, 200, 20), 16);
+  ASSERT_EQ(a.size(), 3);
+  ASSERT_EQ(b.size(), 3);
+  EXPECT_EQ(a[0], b[0]);
+  EXPECT_EQ(a[1], b[1]);
+  EXPECT_NE(a[2], b[2]);
+}
+
+void _TestPrefixAffinityRouterRouteByAffinityAndLoad() {
+  PrefixAffinityRouter router(/*max_blocks_per_replica=*/1024, /*max_load_imbalance=*/1);
+  std::vector<int> candidates = {router.AddReplica(), router.AddReplica()};
+  auto prompt_a = PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(0, 64, 1000, 16), 16);
+  auto prompt_b = PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(5000, 64, 2000, 16), 16);
+
+  // The requests without matches go to the least loaded replica.
+  auto [replica_a, matched_a] = router.Route(prompt_a, candidates);
+  EXPECT_EQ(matched_a, 0);
+  auto [replica_b, matched_b] = router.Route(prompt_b, candidates);
+  EXPECT_EQ(matched_b, 0);
+  EXPECT_NE(replica_a, replica_b);
+
+  // The requests sharing a prefix go to the same replica until the load is imbalanced.
+  auto prompt_a2 = PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(0, 64, 3000, 16), 16);
+  for (int i = 0; i < 2; ++i) {
+    auto [replica, matched] = router.Route(prompt_a2, candidates);
+    EXPECT_EQ(replica, replica_a);
+    EXPECT_GE(matched, 4);
+  }
+  EXPECT_EQ(router.GetLoad(replica_a), 3);
+  auto [replica, matched] = router.Route(prompt_a2, candidates);
+  EXPECT_EQ(replica, replica_b);
+  EXPECT_EQ(matched, 0);
+
+  for (int i = 0; i < 3; ++i) {
+    router.Finish(replica_a);
+  }
+  EXPECT_EQ(router.GetLoad(replica_a), 0);
+  EXPECT_EQ(router.Route(prompt_a2, candidates).first, replica_a);
+}
+
+void _TestPrefixAffinityRouterEviction() {
+  PrefixAffinityRouter router(/*max_blocks_per_replica=*/8, /*max_load_imbalance=*/0);
+  std::vector<int> candidates = {router.AddReplica()};
+  auto prompt = PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(0, 64, 0, 0), 16);
+  for (int i = 0; i < 100; ++i) {
+    router.Route(prompt, candidates);
+    router.Route(PrefixAffinityRouter::ComputeBlockHashes(_MakePrompt(i * 100, 32, 0, 0), 16),
+                 candidates);
+    EXPECT_LE(router.GetNumBlocks(0), 8);
+  }
+  // The recently used prompt is kept.
+  EXPECT_EQ(router.Route(prompt, candidates).second, 4);
+}
+
+TEST(PrefixAffinityRouterTest, BlockHashesTest) { _TestPrefixAffinityRouterBlockHashes(); }
+TEST(PrefixAffinityRouterTest, RouteByAffinityAndLoadTest) {
+  _TestPrefixAffinityRouterRouteByAffinityAndLoad();
+}
+TEST(PrefixAffinityRouterTest, EvictionTest) { _TestPrefixAffinityRouterEviction(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
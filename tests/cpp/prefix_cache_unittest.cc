@@ -0,0 +1,73 @@
+#include "serve/prefix_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+std::vector<int32_t> _MakePrefixCacheTokens(int32_t begin, int32_t length) {
+  std::vector<int32_t> tokens(length);
+  for (int32_t i = 0; i < length; ++i) {
+    tokens[i] = begin + i;
+  }
+  return tokens;
+}
+
+void _TestPrefixCacheCompactUnalignedSequence() {
+  std::vector<std::pair<int64_t, int64_t>> compacted;
+  PrefixCacheOffloadCallbacks callbacks;
+  callbacks.compact = [&compacted](int64_t seq_id, int64_t num_tokens) {
+    compacted.emplace_back(seq_id, num_tokens);
+  };
+  PrefixCache cache = PrefixCache::CreateRadixPrefixCache(/*max_recycling_seqs=*/8, nullptr, {},
+                                                          callbacks);
+  // Sequence 0 has 19 tokens, which is not a multiple of the KV cache page size.
+  std::vector<int32_t> prompt = _MakePrefixCacheTokens(0, 20);
+  EXPECT_EQ(cache->InsertSequence(0, prompt).prefilled_offset, 0);
+  cache->ExtendSequence(0, std::vector<int32_t>(prompt.begin(), prompt.end() - 1));
+  cache->CommitSequenceExtention();
+
+  // Sequence 1 forks sequence 0 in the middle, so that both sequences are fragmented.
+  std::vector<int32_t> forked_prompt(prompt.begin(), prompt.begin() + 10);
+  std::vector<int32_t> suffix = _MakePrefixCacheTokens(100, 6);
+  forked_prompt.insert(forked_prompt.end(), suffix.begin(), suffix.end());
+  PrefixCacheMatchedResult result = cache->InsertSequence(1, forked_prompt);
+  EXPECT_EQ(result.prefilled_offset, 10);
+  EXPECT_EQ(result.forked_seq_id, 0);
+  cache->ExtendSequence(1, std::vector<int32_t>(suffix.begin(), suffix.end() - 1));
+  cache->RecycleSequence(0);
+  cache->RecycleSequence(1);
+
+  // The sequences share a prefix, so neither of them is compacted.
+  EXPECT_FALSE(cache->HasFragmentedRecyclingSequence());
+  EXPECT_EQ(cache->CompactRecyclingSequences(1000), 0);
+  EXPECT_TRUE(compacted.empty());
+
+  // After sequence 0 is evicted, the whole unaligned sequence 1 is compacted, even beyond
+  // the budget as it is the first sequence compacted in the call.
+  EXPECT_TRUE(cache->TryFreeMemory());
+  EXPECT_FALSE(cache->HasSequence(0));
+  EXPECT_TRUE(cache->HasFragmentedRecyclingSequence());
+  EXPECT_EQ(cache->CompactRecyclingSequences(4), 15);
+  ASSERT_EQ(compacted.size(), 1);
+  EXPECT_EQ(compacted[0], std::make_pair(int64_t{1}, int64_t{15}));
+  EXPECT_FALSE(cache->HasFragmentedRecyclingSequence());
+  EXPECT_EQ(cache->CompactRecyclingSequences(1000), 0);
+
+  // The compacted sequence is still reused in full.
+  std::vector<int32_t> reused_prompt = forked_prompt;
+  reused_prompt.push_back(200);
+  result = cache->InsertSequence(2, reused_prompt);
+  EXPECT_EQ(result.prefilled_offset, 15);
+  EXPECT_EQ(result.reused_seq_id, 1);
+}
+
+TEST(PrefixCacheTest, CompactUnalignedSequenceTest) { _TestPrefixCacheCompactUnalignedSequence(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "serve/engine_actions/action_commons.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+void _TestLookupPromptDraftTokensLatestOccurrence() {
+  std::vector<int32_t> draft_tokens;
+  // The last bigram (1, 2) occurs at 0 and 4, where the latest occurrence wins.
+  std::vector<int32_t> history_tokens = {1, 2, 3, 9, 1, 2, 5, 6, 7, 1, 2};
+  EXPECT_EQ(LookupPromptDraftTokens(history_tokens, 2, &draft_tokens), 2);
+  EXPECT_EQ(draft_tokens, std::vector<int32_t>({5, 6}));
+  // The draft tokens do not run past the history tokens.
+  EXPECT_EQ(LookupPromptDraftTokens(history_tokens, 8, &draft_tokens), 5);
+  EXPECT_EQ(draft_tokens, std::vector<int32_t>({5, 6, 7, 1, 2}));
+}
+
+void _TestLookupPromptDraftTokensLongerNgramFirst() {
+  std::vector<int32_t> draft_tokens;
+  // The trigram (8, 1, 2) at 0 wins over the later bigram (1, 2) at 4.
+  std::vector<int32_t> history_tokens = {8, 1, 2, 3, 1, 2, 4, 8, 1, 2};
+  EXPECT_EQ(LookupPromptDraftTokens(history_tokens, 1, &draft_tokens), 1);
+  EXPECT_EQ(draft_tokens, std::vector<int32_t>({3}));
+}
+
+void _TestLookupPromptDraftTokensNoMatch() {
+  std::vector<int32_t> draft_tokens = {100};
+  EXPECT_EQ(LookupPromptDraftTokens({}, 4, &draft_tokens), 0);
+  EXPECT_TRUE(draft_tokens.empty());
+  EXPECT_EQ(LookupPromptDraftTokens({1}, 4, &draft_tokens), 0);
+  EXPECT_EQ(LookupPromptDraftTokens({1, 2, 3, 4, 5}, 4, &draft_tokens), 0);
+  // A repeated unigram is not matched.
+  EXPECT_EQ(LookupPromptDraftTokens({1, 2, 3, 2}, 4, &draft_tokens), 0);
+  EXPECT_TRUE(draft_tokens.empty());
+}
+
+void _TestLookupPromptDraftTokensNonTokenData() {
+  std::vector<int32_t> draft_tokens;
+  // The n-grams containing the non-token data are not matched.
+  EXPECT_EQ(LookupPromptDraftTokens({1, -1, 3, 1, -1}, 4, &draft_tokens), 0);
+  // The draft tokens stop before the non-token data.
+  EXPECT_EQ(LookupPromptDraftTokens({1, 2, 3, -1, 4, 1, 2}, 4, &draft_tokens), 1);
+  EXPECT_EQ(draft_tokens, std::vector<int32_t>({3}));
+  // An occurrence followed by the non-token data only falls back to an earlier one.
+  EXPECT_EQ(LookupPromptDraftTokens({1, 2, 5, 1, 2, -1, 1, 2}, 4, &draft_tokens), 3);
+  EXPECT_EQ(draft_tokens, std::vector<int32_t>({5, 1, 2}));
+}
+
+TEST(PromptLookupDraftTest, LatestOccurrenceTest) {
+  _TestLookupPromptDraftTokensLatestOccurrence();
+}
+TEST(PromptLookupDraftTest, LongerNgramFirstTest) {
+  _TestLookupPromptDraftTokensLongerNgramFirst();
+}
+TEST(PromptLookupDraftTest, NoMatchTest) { _TestLookupPromptDraftTokensNoMatch(); }
+TEST(PromptLookupDraftTest, NonTokenDataTest) { _TestLookupPromptDraftTokensNonTokenData(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
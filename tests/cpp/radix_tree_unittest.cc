@@ -0,0 +1,142 @@
+#include "serve/radix_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+std::vector<int32_t> _MakeTokens(int32_t begin, int32_t length) {
+  std::vector<int32_t> tokens(length);
+  for (int32_t i = 0; i < length; ++i) {
+    tokens[i] = begin + i;
+  }
+  return tokens;
+}
+
+void _TestRadixTreeManySiblings() {
+  PagedRadixTree tree = PagedRadixTree::Create();
+  std::vector<int32_t> prefix = _MakeTokens(0, 100);
+  tree->AddSequence(0);
+  tree->ExtendSequence(0, prefix);
+  // Fork many sequences from the same offset, so that the forked page has many children.
+  const int num_siblings = 1000;
+  for (int i = 1; i <= num_siblings; ++i) {
+    tree->ForkSequence(i, 0, 50);
+    tree->ExtendSequence(i, {100000 + i, 7, 8});
+  }
+  for (int i = 1; i <= num_siblings; ++i) {
+    std::vector<int32_t> tokens(prefix.begin(), prefix.begin() + 50);
+    tokens.push_back(100000 + i);
+    tokens.push_back(7);
+    tokens.push_back(8);
+    tokens.push_back(9);
+    auto [matched_offset, matched_seqs] = tree->MatchPrefix(tokens);
+    ASSERT_EQ(matched_offset, 53);
+    ASSERT_EQ(matched_seqs, std::vector<int64_t>{i});
+  }
+  // Remove every other sibling and check the rest are still reachable.
+  for (int i = 1; i <= num_siblings; i += 2) {
+    tree->RemoveSequence(i);
+  }
+  for (int i = 1; i <= num_siblings; ++i) {
+    std::vector<int32_t> tokens(prefix.begin(), prefix.begin() + 50);
+    tokens.push_back(100000 + i);
+    auto [matched_offset, matched_seqs] = tree->MatchPrefix(tokens);
+    if (i % 2 == 1) {
+      ASSERT_EQ(matched_offset, 50);
+    } else {
+      ASSERT_EQ(matched_offset, 51);
+      ASSERT_EQ(matched_seqs, std::vector<int64_t>{i});
+    }
+  }
+  auto [matched_offset, matched_seqs] = tree->MatchPrefix(prefix);
+  ASSERT_EQ(matched_offset, 100);
+  ASSERT_EQ(matched_seqs, std::vector<int64_t>{0});
+}
+
+void _TestRadixTreeSplitAndMerge() {
+  PagedRadixTree tree = PagedRadixTree::Create();
+  size_t free_capacity = tree->FreeCapacity();
+  std::vector<int32_t> tokens = _MakeTokens(0, 300);
+  tree->AddSequence(0);
+  tree->ExtendSequence(0, tokens);
+  // Forking in the middle of pages splits the pages.
+  tree->ForkSequence(1, 0, 130);
+  tree->ForkSequence(2, 0, 10);
+  tree->ExtendSequence(1, {-1, -2});
+  tree->ExtendSequence(2, {-3});
+  ASSERT_EQ(tree->GetSequenceLength(1), 132);
+  ASSERT_EQ(tree->GetSequenceLength(2), 11);
+  {
+    std::vector<int32_t> query(tokens.begin(), tokens.begin() + 130);
+    query.push_back(-1);
+    auto [matched_offset, matched_seqs] = tree->MatchPrefix(query);
+    ASSERT_EQ(matched_offset, 131);
+    ASSERT_EQ(matched_seqs, std::vector<int64_t>{1});
+  }
+  // Removing the forked sequences merges the pages back.
+  tree->RemoveSequence(1);
+  tree->RemoveSequence(2);
+  ASSERT_EQ(tree->GetSequence(0).size(), 300);
+  {
+    auto [matched_offset, matched_seqs] = tree->MatchPrefix(tokens);
+    ASSERT_EQ(matched_offset, 300);
+    ASSERT_EQ(matched_seqs, std::vector<int64_t>{0});
+  }
+  tree->RollBackSequence(0, 250);
+  ASSERT_EQ(tree->GetSequenceLength(0), 50);
+  tree->ExtendSequence(0, {-5, -6});
+  {
+    std::vector<int32_t> query(tokens.begin(), tokens.begin() + 50);
+    query.push_back(-5);
+    auto [matched_offset, matched_seqs] = tree->MatchPrefix(query);
+    ASSERT_EQ(matched_offset, 51);
+  }
+  tree->RemoveSequence(0);
+  ASSERT_EQ(tree->FreeCapacity(), free_capacity);
+  // The tree is reusable after reset.
+  tree->AddSequence(3);
+  tree->ExtendSequence(3, tokens);
+  tree->Reset();
+  ASSERT_FALSE(tree->HasSequence(3));
+  tree->AddSequence(3);
+  tree->ExtendSequence(3, tokens);
+  ASSERT_EQ(tree->MatchPrefix(tokens).first, 300);
+}
+
+void _TestRadixTreeSequenceExclusiveLength() {
+  PagedRadixTree tree = PagedRadixTree::Create();
+  std::vector<int32_t> tokens = _MakeTokens(0, 300);
+  tree->AddSequence(0);
+  tree->ExtendSequence(0, tokens);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(0), 300);
+  // The branches share the prefix before the fork position.
+  tree->ForkSequence(1, 0, 130);
+  tree->ExtendSequence(1, {-1, -2});
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(0), 170);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(1), 2);
+  // A sequence ending at the fork position shares all its tokens.
+  tree->ForkSequence(2, 0, 130);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(2), 0);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(1), 2);
+  // A copy of the entire sequence shares all the tokens with it.
+  tree->ForkSequence(3, 0, 300);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(0), 0);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(3), 0);
+  tree->RemoveSequence(3);
+  tree->RemoveSequence(2);
+  tree->RemoveSequence(1);
+  ASSERT_EQ(tree->GetSequenceExclusiveLength(0), 300);
+}
+
+TEST(RadixTreeTest, ManySiblingsTest) { _TestRadixTreeManySiblings(); }
+TEST(RadixTreeTest, SplitAndMergeTest) { _TestRadixTreeSplitAndMerge(); }
+TEST(RadixTreeTest, SequenceExclusiveLengthTest) { _TestRadixTreeSequenceExclusiveLength(); }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,60 @@
+#include "support/random.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace mlc {
+namespace llm {
+
+std::vector<double> _DrawRandomNumbers(RandomGenerator* rng, int num) {
+  std::vector<double> numbers;
+  for (int i = 0; i < num; ++i) {
+    numbers.push_back(rng->GetRandomNumber());
+  }
+  return numbers;
+}
+
+void _TestRandomGeneratorResetStreamIgnoresHistory() {
+  RandomGenerator rng(42);
+  RandomGenerator other_rng(42);
+  // The numbers drawn before the reset do not change the numbers drawn after.
+  _DrawRandomNumbers(&other_rng, 5);
+  rng.ResetStream(7);
+  other_rng.ResetStream(7);
+  EXPECT_EQ(_DrawRandomNumbers(&rng, 10), _DrawRandomNumbers(&other_rng, 10));
+  // Resetting to the same offset again repeats the stream.
+  rng.ResetStream(7);
+  std::vector<double> repeated = _DrawRandomNumbers(&rng, 10);
+  other_rng.ResetStream(7);
+  EXPECT_EQ(repeated, _DrawRandomNumbers(&other_rng, 10));
+}
+
+void _TestRandomGeneratorResetStreamDistinctStreams() {
+  RandomGenerator rng(42);
+  rng.ResetStream(7);
+  std::vector<double> stream = _DrawRandomNumbers(&rng, 10);
+  rng.ResetStream(8);
+  EXPECT_NE(_DrawRandomNumbers(&rng, 10), stream);
+  // The high bits of the offset select a different stream as well.
+  rng.ResetStream(7 + (int64_t(1) << 32));
+  EXPECT_NE(_DrawRandomNumbers(&rng, 10), stream);
+  RandomGenerator other_seed_rng(43);
+  other_seed_rng.ResetStream(7);
+  EXPECT_NE(_DrawRandomNumbers(&other_seed_rng, 10), stream);
+  // The stream follows the seed set after construction.
+  RandomGenerator reseeded_rng(43);
+  reseeded_rng.SetSeed(42);
+  reseeded_rng.ResetStream(7);
+  EXPECT_EQ(_DrawRandomNumbers(&reseeded_rng, 10), stream);
+}
+
+TEST(RandomGeneratorTest, ResetStreamIgnoresHistoryTest) {
+  _TestRandomGeneratorResetStreamIgnoresHistory();
+}
+TEST(RandomGeneratorTest, ResetStreamDistinctStreamsTest) {
+  _TestRandomGeneratorResetStreamDistinctStreams();
+}
+
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,155 @@
+#include "serve/scheduling_policy.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "serve/data.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+Request _MakeTenantRequest(const std::string& id, const std::string& tenant_id,
+                           int num_prompt_tokens) {
+  ObjectPtr<GenerationConfigNode> cfg = make_object<GenerationConfigNode>();
+  cfg->tenant_id = tenant_id;
+  return Request(id, {TokenData(std::vector<int32_t>(num_prompt_tokens, 1))},
+                 GenerationConfig(cfg));
+}
+
+SchedulingPolicy _MakeFairSchedulingPolicy(std::unordered_map<std::string, double> weights,
+                                           double max_tokens_per_s) {
+  ObjectPtr<EngineConfigNode> engine_config = make_object<EngineConfigNode>();
+  engine_config->scheduling_policy = SchedulingPolicyKind::kFair;
+  engine_config->tenant_weights = std::move(weights);
+  engine_config->tenant_max_tokens_per_s = max_tokens_per_s;
+  return SchedulingPolicy::Create(EngineConfig(engine_config));
+}
+
+std::vector<std::string> _GetRequestIds(const std::vector<Request>& requests) {
+  std::vector<std::string> ids;
+  for (const Request& request : requests) {
+    ids.push_back(request->id);
+  }
+  return ids;
+}
+
+void _TestFairSchedulingPolicySortByServedTokens() {
+  SchedulingPolicy policy = _MakeFairSchedulingPolicy({}, 0);
+  Request a1 = _MakeTenantRequest("a1", "A", 100);
+  Request a2 = _MakeTenantRequest("a2", "A", 100);
+  Request a3 = _MakeTenantRequest("a3", "A", 100);
+  Request b1 = _MakeTenantRequest("b1", "B", 100);
+  Request b2 = _MakeTenantRequest("b2", "B", 100);
+  std::vector<Request> waiting_queue = {a1, a2, a3, b1};
+  policy->SortWaitingQueue(&waiting_queue);
+  EXPECT_EQ(_GetRequestIds(waiting_queue), (std::vector<std::string>{"a1", "b1", "a2", "a3"}));
+
+  // The tenant served more goes after the other one.
+  policy->UpdateServedTokens(a1, 1000);
+  waiting_queue = {a2, a3, b1, b2};
+  policy->SortWaitingQueue(&waiting_queue);
+  EXPECT_EQ(_GetRequestIds(waiting_queue), (std::vector<std::string>{"b1", "b2", "a2", "a3"}));
+}
+
+void _TestFairSchedulingPolicyWeights() {
+  SchedulingPolicy policy = _MakeFairSchedulingPolicy({{"A", 3.0}}, 0);
+  std::vector<Request> waiting_queue;
+  for (int i = 1; i <= 4; ++i) {
+    waiting_queue.push_back(_MakeTenantRequest("a" + std::to_string(i), "A", 100));
+  }
+  for (int i = 1; i <= 2; ++i) {
+    waiting_queue.push_back(_MakeTenantRequest("b" + std::to_string(i), "B", 100));
+  }
+  policy->SortWaitingQueue(&waiting_queue);
+  EXPECT_EQ(_GetRequestIds(waiting_queue),
+            (std::vector<std::string>{"a1", "b1", "a2", "a3", "a4", "b2"}));
+}
+
+void _TestFairSchedulingPolicyIdleTenantNoCredit() {
+  SchedulingPolicy policy = _MakeFairSchedulingPolicy({}, 0);
+  Request a1 = _MakeTenantRequest("a1", "A", 10);
+  Request a2 = _MakeTenantRequest("a2", "A", 10);
+  Request b1 = _MakeTenantRequest("b1", "B", 10);
+  Request b2 = _MakeTenantRequest("b2", "B", 10);
+  std::vector<Request> waiting_queue = {a1, b1};
+  policy->SortWaitingQueue(&waiting_queue);
+  policy->UpdateServedTokens(a1, 1000);
+  policy->UpdateServedTokens(b1, 300);
+  // Only tenant A stays backlogged, while tenant B is idle.
+  waiting_queue = {a2};
+  policy->SortWaitingQueue(&waiting_queue);
+  policy->SortWaitingQueue(&waiting_queue);
+  // Tenant B is lifted to the virtual service of tenant A when it comes back, instead of going
+  // first with the credit built up while idle.
+  waiting_queue = {a2, b2};
+  policy->SortWaitingQueue(&waiting_queue);
+  EXPECT_EQ(_GetRequestIds(waiting_queue), (std::vector<std::string>{"a2", "b2"}));
+}
+
+void _TestFairSchedulingPolicyPreemption() {
+  SchedulingPolicy policy = _MakeFairSchedulingPolicy({}, 0);
+  Request a1 = _MakeTenantRequest("a1", "A", 10);
+  Request a2 = _MakeTenantRequest("a2", "A", 10);
+  Request b1 = _MakeTenantRequest("b1", "B", 10);
+  std::vector<Request> running_queue = {a1, b1, a2};
+  // The latest request is preempted under ties.
+  EXPECT_EQ(policy->SelectPreemptionVictim(running_queue), 2);
+  policy->UpdateServedTokens(b1, 500);
+  EXPECT_EQ(policy->SelectPreemptionVictim(running_queue), 1);
+  policy->UpdateServedTokens(a1, 1000);
+  EXPECT_EQ(policy->SelectPreemptionVictim(running_queue), 2);
+}
+
+void _TestFairSchedulingPolicyAdmissionReservesQuota() {
+  SchedulingPolicy policy = _MakeFairSchedulingPolicy({}, 100);
+  Request a1 = _MakeTenantRequest("a1", "A", 80);
+  Request a2 = _MakeTenantRequest("a2", "A", 80);
+  Request a3 = _MakeTenantRequest("a3", "A", 80);
+  Request b1 = _MakeTenantRequest("b1", "B", 80);
+  // The requests admitted in the same step reserve the quota before being served.
+  EXPECT_TRUE(policy->CanAdmit(a1));
+  EXPECT_TRUE(policy->CanAdmit(a2));
+  EXPECT_FALSE(policy->CanAdmit(a3));
+  // The quota is per tenant.
+  EXPECT_TRUE(policy->CanAdmit(b1));
+  // The reservations are released at the next sort of the waiting queue.
+  std::vector<Request> waiting_queue = {a3};
+  policy->SortWaitingQueue(&waiting_queue);
+  EXPECT_TRUE(policy->CanAdmit(a3));
+  // The served tokens exhaust the quota.
+  policy->UpdateServedTokens(a1, 200);
+  policy->SortWaitingQueue(&waiting_queue);
+  EXPECT_FALSE(policy->CanAdmit(a3));
+}
+
+void _TestFairSchedulingPolicyUnlimitedAdmission() {
+  SchedulingPolicy policy = _MakeFairSchedulingPolicy({}, 0);
+  Request a1 = _MakeTenantRequest("a1", "A", 1000);
+  policy->UpdateServedTokens(a1, 1000000);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(policy->CanAdmit(a1));
+  }
+}
+
+TEST(FairSchedulingPolicyTest, SortByServedTokensTest) {
+  _TestFairSchedulingPolicySortByServedTokens();
+}
+TEST(FairSchedulingPolicyTest, WeightsTest) { _TestFairSchedulingPolicyWeights(); }
+TEST(FairSchedulingPolicyTest, IdleTenantNoCreditTest) {
+  _TestFairSchedulingPolicyIdleTenantNoCredit();
+}
+TEST(FairSchedulingPolicyTest, PreemptionTest) { _TestFairSchedulingPolicyPreemption(); }
+TEST(FairSchedulingPolicyTest, AdmissionReservesQuotaTest) {
+  _TestFairSchedulingPolicyAdmissionReservesQuota();
+}
+TEST(FairSchedulingPolicyTest, UnlimitedAdmissionTest) {
+  _TestFairSchedulingPolicyUnlimitedAdmission();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,47 @@
+#include "support/sha256.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+namespace mlc {
+namespace llm {
+
+std::string ToHex(const std::string& digest) {
+  static constexpr const char* kHexDigits = "0123456789abcdef";
+  std::string hex;
+  for (unsigned char c : digest) {
+    hex += kHexDigits[c >> 4];
+    hex += kHexDigits[c & 15];
+  }
+  return hex;
+}
+
+void _TestSHA256KnownDigests() {
+  EXPECT_EQ(ToHex(SHA256("", 0)),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  EXPECT_EQ(ToHex(SHA256("abc", 3)),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  // The message of 56 bytes needs a second padding block.
+  std::string message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ(ToHex(SHA256(message.data(), message.size())),
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+void _TestSHA256IncrementalUpdate() {
+  std::string message(1000000, 'a');
+  SHA256Hasher hasher;
+  for (size_t i = 0; i < message.size(); i += 7) {
+    hasher.Update(message.data() + i, std::min<size_t>(7, message.size() - i));
+  }
+  std::string digest = hasher.Finalize();
+  EXPECT_EQ(digest, SHA256(message.data(), message.size()));
+  EXPECT_EQ(ToHex(digest), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST(SHA256Test, KnownDigestsTest) { _TestSHA256KnownDigests(); }
+TEST(SHA256Test, IncrementalUpdateTest) { _TestSHA256IncrementalUpdate(); }
+
+}  // namespace llm
+}  // namespace mlc
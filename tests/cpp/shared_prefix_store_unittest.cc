@@ -0,0 +1,110 @@
+#include "serve/shared_prefix_store.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+KVSwapLayout _MakeSharedPrefixStoreLayout() {
+  KVSwapLayout layout;
+  layout.model_hash = 42;
+  layout.num_layers = 2;
+  layout.num_kv_heads = 1;
+  layout.head_dim = 4;
+  layout.chunk_size = 256;
+  layout.dtype = DLDataType{kDLFloat, 32, 1};
+  return layout;
+}
+
+/*! \brief Make the KV data chunks of the given number of tokens, filled with the given value. */
+Array<NDArray> _MakeKVData(const KVSwapLayout& layout, int64_t num_tokens, float value) {
+  Array<NDArray> kv_data;
+  for (int64_t begin = 0; begin < num_tokens; begin += layout.chunk_size) {
+    int64_t length = std::min(layout.chunk_size, num_tokens - begin);
+    for (int kv = 0; kv < 2; ++kv) {
+      NDArray chunk = NDArray::Empty(layout.ChunkShape(length), layout.dtype, Device{kDLCPU, 0});
+      float* data = static_cast<float*>(chunk->data);
+      for (int64_t i = 0; i < layout.num_layers * length * layout.num_kv_heads * layout.head_dim;
+           ++i) {
+        data[i] = value;
+      }
+      kv_data.push_back(chunk);
+    }
+  }
+  return kv_data;
+}
+
+std::string _SharedPrefixStoreName(const std::string& test_name) {
+  return "mlc_llm_test_" + test_name + "_" + std::to_string(getpid());
+}
+
+void _TestSharedPrefixStoreShortPrefix() {
+  KVSwapLayout layout = _MakeSharedPrefixStoreLayout();
+  auto store = SharedPrefixStore::Open(_SharedPrefixStoreName("short_prefix"), 1 << 20, layout);
+  if (store == nullptr) {
+    GTEST_SKIP() << "The shared memory is not supported on this platform.";
+  }
+  // A prefix shorter than one chunk.
+  std::vector<int32_t> tokens = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  ASSERT_TRUE(store->Publish(tokens, _MakeKVData(layout, tokens.size(), 1.0f)));
+  EXPECT_TRUE(store->HasSequence(tokens));
+
+  std::vector<int32_t> query = {1, 2, 3, 4, 5, 6, 100};
+  auto [length, kv_data] = store->MatchAndImport(query, 0);
+  EXPECT_EQ(length, 6);
+  ASSERT_TRUE(kv_data.defined());
+  ASSERT_EQ(kv_data.value().size(), 2);
+  EXPECT_TRUE(layout.Matches(kv_data.value()));
+  EXPECT_EQ(kv_data.value()[0]->shape[1], tokens.size());
+  EXPECT_EQ(static_cast<const float*>(kv_data.value()[1]->data)[0], 1.0f);
+}
+
+void _TestSharedPrefixStoreMultiChunkPrefix() {
+  KVSwapLayout layout = _MakeSharedPrefixStoreLayout();
+  auto store = SharedPrefixStore::Open(_SharedPrefixStoreName("multi_chunk"), 1 << 20, layout);
+  if (store == nullptr) {
+    GTEST_SKIP() << "The shared memory is not supported on this platform.";
+  }
+  std::vector<int32_t> tokens(300);
+  for (int i = 0; i < 300; ++i) {
+    tokens[i] = i;
+  }
+  ASSERT_TRUE(store->Publish(tokens, _MakeKVData(layout, tokens.size(), 2.0f)));
+  auto [length, kv_data] = store->MatchAndImport(tokens, 0);
+  EXPECT_EQ(length, 300);
+  ASSERT_TRUE(kv_data.defined());
+  ASSERT_EQ(kv_data.value().size(), 4);
+  EXPECT_EQ(kv_data.value()[0]->shape[1], 256);
+  EXPECT_EQ(kv_data.value()[2]->shape[1], 44);
+  // The matched prefix not longer than the minimum length is not imported.
+  EXPECT_FALSE(store->MatchAndImport(tokens, 300).second.defined());
+}
+
+void _TestSharedPrefixStoreRejectsOtherLayout() {
+  KVSwapLayout layout = _MakeSharedPrefixStoreLayout();
+  auto store = SharedPrefixStore::Open(_SharedPrefixStoreName("other_layout"), 1 << 20, layout);
+  if (store == nullptr) {
+    GTEST_SKIP() << "The shared memory is not supported on this platform.";
+  }
+  KVSwapLayout other_layout = layout;
+  other_layout.head_dim = 8;
+  std::vector<int32_t> tokens = {1, 2, 3};
+  EXPECT_FALSE(store->Publish(tokens, _MakeKVData(other_layout, tokens.size(), 1.0f)));
+  EXPECT_FALSE(store->HasSequence(tokens));
+}
+
+TEST(SharedPrefixStoreTest, ShortPrefixTest) { _TestSharedPrefixStoreShortPrefix(); }
+TEST(SharedPrefixStoreTest, MultiChunkPrefixTest) { _TestSharedPrefixStoreMultiChunkPrefix(); }
+TEST(SharedPrefixStoreTest, RejectsOtherLayoutTest) {
+  _TestSharedPrefixStoreRejectsOtherLayout();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -335,5 +335,40 @@ d_1 ::= ("" | ("d"))
     assert output_str == before
 
 
+def test_to_binary_roundtrip():
+    before = r"""main ::= ((b c) | (b main))
+b ::= ((b_1 d [a]*))
+c ::= ((c_1))
+d ::= ((d_1))
+b_1 ::= ("" | ("b" b_1))
+c_1 ::= ((c_2 c_1) | (c_2))
+c_2 ::= (([acep-z]))
+d_1 ::= ("" | ("d"))
+"""
+    bnf_grammar_1 = BNFGrammar.from_ebnf_string(before, "main")
+    output_binary_1 = bnf_grammar_1.to_binary()
+    bnf_grammar_2 = BNFGrammar.from_binary(output_binary_1)
+    assert bnf_grammar_2.to_binary() == output_binary_1
+    assert bnf_grammar_2.to_string() == before
+    assert bnf_grammar_2.content_hash() == bnf_grammar_1.content_hash()
+    bnf_grammar_3 = BNFGrammar.from_ebnf_string('main ::= "a"', "main")
+    assert bnf_grammar_3.content_hash() != bnf_grammar_1.content_hash()
+
+
+def test_from_binary_malformed():
+    binary = BNFGrammar.from_ebnf_string('main ::= "a"', "main").to_binary()
+    with pytest.raises(TVMError):
+        BNFGrammar.from_binary(binary[:-1])
+    # The main rule id is out of range.
+    with pytest.raises(TVMError):
+        BNFGrammar.from_binary(binary[:8] + (100).to_bytes(4, "little") + binary[12:])
+    # The number of rules exceeds the remaining length.
+    with pytest.raises(TVMError):
+        BNFGrammar.from_binary(binary[:12] + (0x7FFFFFFF).to_bytes(4, "little") + binary[16:])
+    # The rule expr indptr points out of the rule expr data.
+    with pytest.raises(TVMError):
+        BNFGrammar.from_binary(binary[:-4] + (1000).to_bytes(4, "little"))
+
+
 if __name__ == "__main__":
     tvm.testing.main()
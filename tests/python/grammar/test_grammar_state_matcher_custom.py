@@ -353,6 +353,40 @@ def test_token_based_operations(json_grammar: BNFGrammar):
     assert result == expected
 
 
+def test_regular_grammar_token_mask_dfa():
+    """Test the masks of a regular grammar, which are fetched from its token-level DFA once the
+    states are visited."""
+    grammar_str = r"""main ::= "{" ws "\"color\"" ws ":" ws ("\"red\"" | "\"green\"") ws "}"
+ws ::= [ \n\t]*
+"""
+    grammar = BNFGrammar.from_ebnf_string(grammar_str)
+    token_table = [
+        # fmt: off
+        "<s>", "</s>", "{", "}", " ", "\n", '"', "color", '"color"', ":", "red", '"red"', "green",
+        ' "',
+        # fmt: on
+    ]
+    input_splitted = ["{", " ", '"color"', ":", ' "', "red", '"', "}"]
+    input_ids = [token_table.index(t) for t in input_splitted]
+
+    grammar_state_matcher = GrammarStateMatcher(grammar, token_table)
+
+    def match_and_find_rejected_tokens():
+        result = []
+        for id in input_ids:
+            rejected = grammar_state_matcher.find_next_rejected_tokens()
+            assert id not in rejected
+            result.append(sorted(rejected))
+            assert grammar_state_matcher.accept_token(id)
+        result.append(sorted(grammar_state_matcher.find_next_rejected_tokens()))
+        return result
+
+    # The first pass explores the DFA states, and the second pass fetches the masks from them.
+    expected = match_and_find_rejected_tokens()
+    grammar_state_matcher.reset_state()
+    assert match_and_find_rejected_tokens() == expected
+
+
 def test_custom_main_rule() -> None:
     json_grammar_ebnf = r"""
 main ::= basic_object
@@ -9,7 +9,7 @@ import tvm
 import tvm.testing
 from tvm import TVMError
 
-from mlc_llm.grammar import BNFGrammar, GrammarStateMatcher
+from mlc_llm.grammar import BNFGrammar, GrammarStateMatcher, _ffi_api
 from mlc_llm.tokenizers import Tokenizer
 
 
@@ -337,6 +337,39 @@ def test_token_based_operations(json_grammar: BNFGrammar):
     assert result == expected
 
 
+def test_json_matcher_same_as_generic(json_grammar: BNFGrammar, json_input_accepted: str):
+    """The JSON matcher for the built-in JSON grammar gives the same masks as the generic
+    matcher."""
+    token_table = (
+        ["<s>", "</s>"]
+        + [chr(i) for i in range(32, 127)]
+        # fmt: off
+        + ["\n", "\t", '"a":true', ':"', '", "', "}]", "]}", "}}", "tr", "ue", "1.5e", "-0",
+           "\\u00", "哈哈", '": {"', "null}", " \n"]
+        # fmt: on
+    )
+    generic_matcher = GrammarStateMatcher(json_grammar, token_table)
+    json_matcher = _ffi_api.GrammarStateMatcherForJSONFromTokenTable(  # type: ignore  # pylint: disable=no-member
+        token_table, 0
+    )
+    for char in json_input_accepted:
+        generic_mask = generic_matcher.find_next_token_bitmask_as_ndarray(len(token_table))
+        json_mask = json_matcher.find_next_token_bitmask_as_ndarray(len(token_table))
+        assert (generic_mask.numpy() == json_mask.numpy()).all()
+        assert generic_matcher.find_jump_forward_string() == json_matcher.find_jump_forward_string()
+        assert generic_matcher.accept_token(token_table.index(char))
+        assert json_matcher.accept_token(token_table.index(char))
+    generic_mask = generic_matcher.find_next_token_bitmask_as_ndarray(len(token_table))
+    json_mask = json_matcher.find_next_token_bitmask_as_ndarray(len(token_table))
+    assert (generic_mask.numpy() == json_mask.numpy()).all()
+    assert generic_matcher.find_next_rejected_tokens() == json_matcher.find_next_rejected_tokens()
+    # The JSON matcher does not match characters.
+    with pytest.raises(TVMError):
+        json_matcher.debug_match_complete_string("{}")
+    assert json_matcher.accept_token(token_table.index("</s>"))
+    assert json_matcher.is_terminated()
+
+
 def test_rollback(json_grammar: BNFGrammar):
     token_table = [
         # fmt: off
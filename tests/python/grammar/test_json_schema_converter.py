@@ -386,6 +386,53 @@ main ::= "{" "" "\"foo\"" ": " main_prop_0 ", " "\"bars\"" ": " main_prop_1 "" "
     check_schema_with_instance(schema, instance)
 
 
+def test_repeated_reference() -> None:
+    class Foo(BaseModel):
+        count: int
+
+    class MainModel(BaseModel):
+        foo_a: Foo
+        foo_b: Foo
+
+    ebnf_grammar = r"""basic_escape ::= ["\\/bfnrt] | "u" [A-Fa-f0-9] [A-Fa-f0-9] [A-Fa-f0-9] [A-Fa-f0-9]
+basic_string_sub ::= ("\"" | [^"\\\r\n] basic_string_sub | "\\" basic_escape basic_string_sub) (= [ \n\t]* [,}\]:])
+basic_any ::= basic_number | basic_string | basic_boolean | basic_null | basic_array | basic_object
+basic_integer ::= ("0" | "-"? [1-9] [0-9]*) ".0"?
+basic_number ::= ("0" | "-"? [1-9] [0-9]*) ("." [0-9]+)? ([eE] [+-]? [0-9]+)?
+basic_string ::= ["] basic_string_sub
+basic_boolean ::= "true" | "false"
+basic_null ::= "null"
+basic_array ::= ("[" "" basic_any (", " basic_any)* "" "]") | "[]"
+basic_object ::= ("{" "" basic_string ": " basic_any (", " basic_string ": " basic_any)* "" "}") | "{}"
+defs_Foo ::= "{" "" "\"count\"" ": " basic_integer "" "}"
+main_prop_0 ::= defs_Foo
+main_prop_1 ::= defs_Foo
+main ::= "{" "" "\"foo_a\"" ": " main_prop_0 ", " "\"foo_b\"" ": " main_prop_1 "" "}"
+"""
+
+    schema = MainModel.model_json_schema()
+    check_schema_with_grammar(schema, ebnf_grammar)
+    check_schema_with_instance(schema, MainModel(foo_a=Foo(count=1), foo_b=Foo(count=2)))
+
+
+def test_recursive_reference() -> None:
+    class Node(BaseModel):
+        value: int
+        children: List["Node"] = []
+
+    class MainModel(BaseModel):
+        left: Node
+        right: Node
+
+    instance = MainModel(
+        left=Node(value=1, children=[Node(value=2), Node(value=3, children=[Node(value=4)])]),
+        right=Node(value=5),
+    )
+    schema = MainModel.model_json_schema()
+    check_schema_with_instance(schema, instance)
+    check_schema_with_json(schema, '{"left": {"value": 1, "children": [{}]}, "right": {}}', False)
+
+
 def test_union() -> None:
     class Cat(BaseModel):
         name: str
@@ -0,0 +1,69 @@
+# pylint: disable=missing-module-docstring,missing-function-docstring
+import pytest
+import tvm.testing
+
+from mlc_llm.grammar import BNFGrammar, GrammarStateMatcher
+
+
+def check_regex_with_string(regex: str, string: str, check_accepted: bool = True):
+    grammar = BNFGrammar.from_regex(regex)
+    matcher = GrammarStateMatcher(grammar)
+    assert matcher.debug_match_complete_string(string) == check_accepted
+
+
+def test_basic():
+    regex = r"ab[c-e]*\d{2,3}"
+    expected = 'main ::= "ab" [c-e]* ([0-9] [0-9] [0-9]?)\n'
+    assert BNFGrammar.debug_regex_to_ebnf(regex) == expected
+
+
+def test_escape_and_dot():
+    regex = r'^"a\.b"\n.$'
+    expected = 'main ::= "\\u0022a.b\\u0022\\u000A" [^\\u000A]\n'
+    assert BNFGrammar.debug_regex_to_ebnf(regex) == expected
+
+
+regex_accepted_strings = [
+    (r"[a-z]+@[a-z]+\.(com|org)", "abc@mlc.com", True),
+    (r"[a-z]+@[a-z]+\.(com|org)", "abc@mlc.net", False),
+    (r"(?:\d{3}-){2}\d{4}", "123-456-7890", True),
+    (r"(?:\d{3}-){2}\d{4}", "123-4567890", False),
+    (r"(?P<year>\d{4})-\d\d?", "2024-1", True),
+    (r"[^\s,]+(, [^\s,]+)*", "a, bc, d", True),
+    (r"[^\s,]+(, [^\s,]+)*", "a,bc", False),
+    (r"x{2,}y?", "xxxx", True),
+    (r"x{2,}y?", "xy", False),
+    (r"(true|false|\w+\(\))", "foo_1()", True),
+    (r"a{b}", "a{b}", True),
+]
+
+
+@pytest.mark.parametrize("regex, string, check_accepted", regex_accepted_strings)
+def test_match(regex: str, string: str, check_accepted: bool):
+    check_regex_with_string(regex, string, check_accepted)
+
+
+@pytest.mark.parametrize(
+    "regex",
+    [
+        r"a(?=b)",
+        r"(a)\1",
+        r"(ab",
+        r"a**",
+        r"[b-a]",
+        r"a{}",
+        r"a{,}",
+        r"(?P<name",
+        r"(?<name",
+        r"(?P<>a)",
+        r"x{0,100000}",
+        r"(\d{0,1000}){1000}",
+    ],
+)
+def test_unsupported(regex: str):
+    with pytest.raises(tvm.error.TVMError):
+        BNFGrammar.debug_regex_to_ebnf(regex)
+
+
+if __name__ == "__main__":
+    tvm.testing.main()
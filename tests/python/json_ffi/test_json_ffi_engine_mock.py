@@ -1,9 +1,12 @@
 import json
+import queue
+from typing import Dict, List, Set
 
 import pytest
 import tvm
 
 from mlc_llm.json_ffi import JSONFFIEngine
+from mlc_llm.protocol.openai_api_protocol import ChatCompletionStreamResponse
 from mlc_llm.testing import require_test_model
 
 # test category "unittest"
@@ -93,6 +96,81 @@ def check_n_generation(engine):
         assert i in hit_set, f"{i} not in n generation"
 
 
+def submit_requests(engine, request_ids: List[str]) -> None:
+    """Submit the requests without waiting, with the stream outputs put into a new queue."""
+    engine._state.sync_queue = queue.Queue()
+    body = json.dumps(
+        {
+            "messages": [{"role": "user", "content": "hello world"}],
+            "stream_options": {"include_usage": True},
+        }
+    )
+    for request_id in request_ids:
+        assert engine._ffi["chat_completion"](body, request_id)
+
+
+def collect_finish_reasons(engine, request_ids: List[str]) -> Dict[str, Set[str]]:
+    """Wait for the final usage of every request, and collect their finish reasons."""
+    finish_reasons: Dict[str, Set[str]] = {request_id: set() for request_id in request_ids}
+    finished: Set[str] = set()
+    while len(finished) < len(request_ids):
+        for chunk in json.loads(engine._state.sync_queue.get(timeout=60)):
+            response = ChatCompletionStreamResponse.model_validate(chunk)
+            assert response.id in finish_reasons
+            if response.usage is not None:
+                # The final usage is streamed back exactly once, after all the other chunks.
+                assert response.id not in finished
+                finished.add(response.id)
+                continue
+            assert response.id not in finished
+            for choice in response.choices:
+                if choice.finish_reason is not None:
+                    finish_reasons[response.id].add(choice.finish_reason)
+    return finish_reasons
+
+
+def check_concurrent_requests(engine):
+    request_ids = [f"concurrent-{i}" for i in range(32)]
+    submit_requests(engine, request_ids)
+    for request_id, reasons in collect_finish_reasons(engine, request_ids).items():
+        assert reasons == {"stop"}, f"{request_id} finished with {reasons}"
+
+
+def check_abort_queued_requests(engine):
+    request_ids = [f"abort-{i}" for i in range(32)]
+    submit_requests(engine, request_ids)
+    aborted_ids = set(request_ids[::2])
+    for request_id in aborted_ids:
+        engine._ffi["abort"](request_id)
+    # Every request ends with the final usage, whether it is aborted while being prepared, aborted
+    # in the engine, or finished before the abort.
+    for request_id, reasons in collect_finish_reasons(engine, request_ids).items():
+        if request_id in aborted_ids:
+            assert reasons in ({"abort"}, {"stop"}), f"{request_id} finished with {reasons}"
+        else:
+            assert reasons == {"stop"}, f"{request_id} finished with {reasons}"
+
+
+def check_reload_after_requests(engine):
+    request_ids = [f"reload-{i}" for i in range(16)]
+    submit_requests(engine, request_ids)
+    # The reload waits for the queued requests to be added to the engine, which then aborts them
+    # or finishes them before the reload.
+    engine._test_reload()
+    for request_id, reasons in collect_finish_reasons(engine, request_ids).items():
+        assert reasons in ({"abort"}, {"stop"}), f"{request_id} finished with {reasons}"
+    check_concurrent_requests(engine)
+
+
+@require_test_model("Llama-3-8B-Instruct-q4f16_1-MLC")
+def test_request_queue(model: str):
+    engine = JSONFFIEngine(model, tvm.cpu(), model_lib="mock://echo")
+    check_concurrent_requests(engine)
+    check_abort_queued_requests(engine)
+    check_reload_after_requests(engine)
+    engine.terminate()
+
+
 @require_test_model("Llama-3-8B-Instruct-q4f16_1-MLC")
 def test_chat_completion_api(model: str):
     engine = JSONFFIEngine(model, tvm.cpu(), model_lib="mock://echo")
@@ -103,3 +181,4 @@ def test_chat_completion_api(model: str):
 if __name__ == "__main__":
     test_chat_completion_api()
     test_chat_completion_misuse()
+    test_request_queue()